@@ -372,6 +372,92 @@ bool VulkanDevice::init_device(const Options &opts)
 		return strcmp(ext, VK_AMD_SHADER_INFO_EXTENSION_NAME) == 0;
 	}) != end(active_device_extensions);
 
+	// The feature filter does not know about these extensions, so query and enable them on the side.
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT gpl_feature = {
+		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT
+	};
+	VkPhysicalDevicePipelineBinaryFeaturesKHR pipeline_binary_feature = {
+		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_BINARY_FEATURES_KHR
+	};
+	VkPhysicalDeviceMaintenance5FeaturesKHR maintenance5_feature = {
+		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAINTENANCE_5_FEATURES_KHR
+	};
+	VkPhysicalDevicePipelineCreationCacheControlFeaturesEXT cache_control_feature = {
+		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_CREATION_CACHE_CONTROL_FEATURES_EXT
+	};
+
+	if (has_device_features2)
+	{
+		VkPhysicalDeviceFeatures2 side_features2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+		bool has_gpl = find_extension(device_ext_props, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+		               find_extension(device_ext_props, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+		bool has_maintenance5 = find_extension(device_ext_props, VK_KHR_MAINTENANCE_5_EXTENSION_NAME);
+		bool has_cache_control = find_extension(device_ext_props, VK_EXT_PIPELINE_CREATION_CACHE_CONTROL_EXTENSION_NAME);
+		// Binaries are captured with VkPipelineCreateFlags2CreateInfoKHR, which comes from maintenance5.
+		bool has_pipeline_binary = find_extension(device_ext_props, VK_KHR_PIPELINE_BINARY_EXTENSION_NAME) &&
+		                           has_maintenance5;
+
+		if (has_gpl)
+		{
+			gpl_feature.pNext = side_features2.pNext;
+			side_features2.pNext = &gpl_feature;
+		}
+
+		if (has_pipeline_binary)
+		{
+			pipeline_binary_feature.pNext = side_features2.pNext;
+			side_features2.pNext = &pipeline_binary_feature;
+		}
+
+		if (has_maintenance5)
+		{
+			maintenance5_feature.pNext = side_features2.pNext;
+			side_features2.pNext = &maintenance5_feature;
+		}
+
+		if (has_cache_control)
+		{
+			cache_control_feature.pNext = side_features2.pNext;
+			side_features2.pNext = &cache_control_feature;
+		}
+
+		if (side_features2.pNext)
+			vkGetPhysicalDeviceFeatures2KHR(gpu, &side_features2);
+
+		graphics_pipeline_library = has_gpl && gpl_feature.graphicsPipelineLibrary == VK_TRUE;
+		pipeline_creation_cache_control = has_cache_control && cache_control_feature.pipelineCreationCacheControl == VK_TRUE;
+		pipeline_binary = has_pipeline_binary &&
+		                  pipeline_binary_feature.pipelineBinaries == VK_TRUE &&
+		                  maintenance5_feature.maintenance5 == VK_TRUE;
+		// Only enabled when something needs it, to keep replay as close to the application as possible.
+		maintenance5 = has_maintenance5 && maintenance5_feature.maintenance5 == VK_TRUE &&
+		               (pipeline_binary || opts.want_inline_shader_modules);
+
+		if (graphics_pipeline_library)
+		{
+			gpl_feature.pNext = gpu_features2.pNext;
+			gpu_features2.pNext = &gpl_feature;
+		}
+
+		if (pipeline_binary)
+		{
+			pipeline_binary_feature.pNext = gpu_features2.pNext;
+			gpu_features2.pNext = &pipeline_binary_feature;
+		}
+
+		if (maintenance5)
+		{
+			maintenance5_feature.pNext = gpu_features2.pNext;
+			gpu_features2.pNext = &maintenance5_feature;
+		}
+
+		if (pipeline_creation_cache_control)
+		{
+			cache_control_feature.pNext = gpu_features2.pNext;
+			gpu_features2.pNext = &cache_control_feature;
+		}
+	}
+
 	VkDeviceCreateInfo device_info = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
 	device_info.pNext = has_device_features2 ? &gpu_features2 : nullptr;
 	device_info.pEnabledFeatures = has_device_features2 ? nullptr : gpu_features;
@@ -396,6 +482,23 @@ bool VulkanDevice::init_device(const Options &opts)
 		return false;
 	}
 
+	if (pipeline_binary)
+	{
+		pipeline_binary_functions.create_pipeline_binaries = reinterpret_cast<PFN_vkCreatePipelineBinariesKHR>(
+				vkGetDeviceProcAddr(device, "vkCreatePipelineBinariesKHR"));
+		pipeline_binary_functions.destroy_pipeline_binary = reinterpret_cast<PFN_vkDestroyPipelineBinaryKHR>(
+				vkGetDeviceProcAddr(device, "vkDestroyPipelineBinaryKHR"));
+		pipeline_binary_functions.get_pipeline_binary_data = reinterpret_cast<PFN_vkGetPipelineBinaryDataKHR>(
+				vkGetDeviceProcAddr(device, "vkGetPipelineBinaryDataKHR"));
+		pipeline_binary_functions.release_captured_pipeline_data = reinterpret_cast<PFN_vkReleaseCapturedPipelineDataKHR>(
+				vkGetDeviceProcAddr(device, "vkReleaseCapturedPipelineDataKHR"));
+
+		pipeline_binary = pipeline_binary_functions.create_pipeline_binaries &&
+		                  pipeline_binary_functions.destroy_pipeline_binary &&
+		                  pipeline_binary_functions.get_pipeline_binary_data &&
+		                  pipeline_binary_functions.release_captured_pipeline_data;
+	}
+
 	if (!feature_filter.init(api_version, active_device_extensions.data(), active_device_extensions.size(),
 	                         &gpu_features2, &gpu_props2))
 	{
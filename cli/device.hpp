@@ -24,6 +24,8 @@
 
 #include "volk.h"
 #include "fossilize_feature_filter.hpp"
+#include "vulkan_compat.hpp"
+
 
 namespace Fossilize
 {
@@ -36,6 +38,8 @@ public:
 		bool want_amd_shader_info = false;
 		bool null_device = false;
 		bool want_pipeline_stats = false;
+		// Enables VK_KHR_maintenance5 if available, so shader stages can take SPIR-V without a VkShaderModule.
+		bool want_inline_shader_modules = false;
 		int device_index = -1;
 		const VkApplicationInfo *application_info = nullptr;
 		const VkPhysicalDeviceFeatures2 *features = nullptr;
@@ -85,6 +89,43 @@ public:
 		return amd_shader_info;
 	}
 
+	bool has_graphics_pipeline_library() const
+	{
+		return graphics_pipeline_library;
+	}
+
+	// Allows VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT, to find out if a pipeline is cached without compiling it.
+	bool has_pipeline_creation_cache_control() const
+	{
+		return pipeline_creation_cache_control;
+	}
+
+	// Both VK_KHR_maintenance5 and VK_EXT_graphics_pipeline_library allow a VkShaderModuleCreateInfo
+	// in the pNext of a shader stage instead of a VkShaderModule.
+	bool has_inline_shader_modules() const
+	{
+		return maintenance5 || graphics_pipeline_library;
+	}
+
+	struct PipelineBinaryFunctions
+	{
+		PFN_vkCreatePipelineBinariesKHR create_pipeline_binaries;
+		PFN_vkDestroyPipelineBinaryKHR destroy_pipeline_binary;
+		PFN_vkGetPipelineBinaryDataKHR get_pipeline_binary_data;
+		PFN_vkReleaseCapturedPipelineDataKHR release_captured_pipeline_data;
+	};
+
+	// Only valid if has_pipeline_binary() is true.
+	bool has_pipeline_binary() const
+	{
+		return pipeline_binary;
+	}
+
+	const PipelineBinaryFunctions &get_pipeline_binary_functions() const
+	{
+		return pipeline_binary_functions;
+	}
+
 	const FeatureFilter &get_feature_filter() const
 	{
 		return feature_filter;
@@ -112,6 +153,11 @@ private:
 	bool pipeline_stats = false;
 	bool validation_cache = false;
 	bool amd_shader_info = false;
+	bool graphics_pipeline_library = false;
+	bool maintenance5 = false;
+	bool pipeline_creation_cache_control = false;
+	bool pipeline_binary = false;
+	PipelineBinaryFunctions pipeline_binary_functions = {};
 
 	VulkanFeatures features = {};
 	VulkanProperties props = {};
@@ -22,6 +22,17 @@
 
 #include "file.hpp"
 #include <stdio.h>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace Fossilize
 {
@@ -76,4 +87,103 @@ bool write_buffer_to_file(const char *path, const void *data, size_t size)
 	fclose(file);
 	return true;
 }
+
+bool write_buffer_to_file_atomic(const char *path, const void *data, size_t size)
+{
+	std::string tmp_path = path;
+	tmp_path += ".tmp.";
+#ifdef _WIN32
+	tmp_path += std::to_string(GetCurrentProcessId());
+#else
+	tmp_path += std::to_string(getpid());
+#endif
+
+	if (!write_buffer_to_file(tmp_path.c_str(), data, size))
+	{
+		remove(tmp_path.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	bool ret = MoveFileExA(tmp_path.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool ret = rename(tmp_path.c_str(), path) == 0;
+#endif
+	if (!ret)
+		remove(tmp_path.c_str());
+	return ret;
+}
+
+MappedFile::~MappedFile()
+{
+	unmap();
+}
+
+bool MappedFile::map(const char *path)
+{
+	unmap();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+	                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0 ||
+	    uint64_t(file_size.QuadPart) > uint64_t(SIZE_MAX))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		return false;
+
+	// The view holds a reference to the mapping object, so we can close the handle right away.
+	void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!view)
+		return false;
+
+	mapped = static_cast<const uint8_t *>(view);
+	mapped_size = size_t(file_size.QuadPart);
+#else
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct stat s = {};
+	if (fstat(fd, &s) < 0 || s.st_size == 0 || uint64_t(s.st_size) > uint64_t(SIZE_MAX))
+	{
+		close(fd);
+		return false;
+	}
+
+	// The mapping keeps the file alive, so it stays valid even if the file is replaced while mapped.
+	void *view = mmap(nullptr, size_t(s.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	mapped = static_cast<const uint8_t *>(view);
+	mapped_size = size_t(s.st_size);
+#endif
+	return true;
+}
+
+void MappedFile::unmap()
+{
+	if (!mapped)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(mapped);
+#else
+	munmap(const_cast<uint8_t *>(mapped), mapped_size);
+#endif
+	mapped = nullptr;
+	mapped_size = 0;
+}
 }
@@ -31,4 +31,35 @@ namespace Fossilize
 std::vector<uint8_t> load_buffer_from_file(const char *path);
 bool write_string_to_file(const char *path, const char *text);
 bool write_buffer_to_file(const char *path, const void *data, size_t size);
+
+// Writes to a temporary file next to path, then renames it over path.
+// Readers, including processes which currently have path mapped, never observe a partially written file.
+bool write_buffer_to_file_atomic(const char *path, const void *data, size_t size);
+
+// Read-only mapping of an entire file. The pages are shared with every other process mapping the same file.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	void operator=(const MappedFile &) = delete;
+
+	bool map(const char *path);
+	void unmap();
+
+	const uint8_t *data() const
+	{
+		return mapped;
+	}
+
+	size_t size() const
+	{
+		return mapped_size;
+	}
+
+private:
+	const uint8_t *mapped = nullptr;
+	size_t mapped_size = 0;
+};
 }
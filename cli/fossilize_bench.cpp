@@ -23,32 +23,47 @@
 #include "fossilize.hpp"
 #include "fossilize_db.hpp"
 #include "layer/utils.hpp"
+#include "cli_parser.hpp"
+#include "crc32c.hpp"
+#include "varint.hpp"
+#include "path.hpp"
+#include "util/object_cache.hpp"
+#include "rapidjson/document.h"
+#include "rapidjson/prettywriter.h"
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <memory>
 #include <random>
+#include <string>
+#include <thread>
 #include <vector>
+#include <math.h>
+#include <string.h>
 #include "fossilize_inttypes.h"
 
 using namespace Fossilize;
 
-static void bench_recorder(const char *path, bool compressed, bool checksum)
-{
-	remove(path);
-	auto iface = std::unique_ptr<DatabaseInterface>(create_database(path, DatabaseMode::OverWrite));
-	StateRecorder recorder;
-	recorder.set_database_enable_checksum(checksum);
-	recorder.set_database_enable_compression(compressed);
-	recorder.init_recording_thread(iface.get());
+// Results of the measured work end up here, so the compiler cannot throw the work away.
+static uint64_t benchmark_sink;
 
-	std::mt19937 rnd(1);
+static std::vector<uint32_t> create_dummy_spirv(size_t word_count, uint32_t seed)
+{
+	// Small values, like the IDs and operands which make up most of real SPIR-V.
+	std::mt19937 rnd(seed);
 	std::uniform_int_distribution<int> dist(1, 500);
-
-	// Create 10000 random SPIR-V modules with reasonable ID distribution.
-	std::vector<uint32_t> dummy_spirv(4096);
-	for (auto &d : dummy_spirv)
+	std::vector<uint32_t> spirv(word_count);
+	for (auto &d : spirv)
 		d = dist(rnd);
+	return spirv;
+}
 
-	for (unsigned i = 0; i < 10000; i++)
+static void record_shader_modules(StateRecorder &recorder, unsigned count, size_t word_count)
+{
+	auto dummy_spirv = create_dummy_spirv(word_count, 1);
+
+	for (unsigned i = 0; i < count; i++)
 	{
 		dummy_spirv[0] = i;
 
@@ -58,8 +73,11 @@ static void bench_recorder(const char *path, bool compressed, bool checksum)
 		if (!recorder.record_shader_module((VkShaderModule)uint64_t(i + 1), info))
 			abort();
 	}
+}
 
-	for (unsigned i = 0; i < 10000; i++)
+static void record_samplers(StateRecorder &recorder, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++)
 	{
 		VkSamplerCreateInfo sampler = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
 		sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
@@ -69,8 +87,11 @@ static void bench_recorder(const char *path, bool compressed, bool checksum)
 		if (!recorder.record_sampler((VkSampler)uint64_t(i + 1), sampler))
 			abort();
 	}
+}
 
-	for (unsigned i = 0; i < 10000; i++)
+static void record_descriptor_set_layouts(StateRecorder &recorder, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++)
 	{
 		VkDescriptorSetLayoutCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
 		info.bindingCount = 16;
@@ -86,40 +107,49 @@ static void bench_recorder(const char *path, bool compressed, bool checksum)
 		if (!recorder.record_descriptor_set_layout((VkDescriptorSetLayout)uint64_t(i + 1), info))
 			abort();
 	}
+}
 
-	for (unsigned i = 0; i < 9000; i++)
+static void record_pipeline_layouts(StateRecorder &recorder, unsigned count, unsigned num_set_layouts)
+{
+	for (unsigned i = 0; i < count; i++)
 	{
 		VkPipelineLayoutCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-		VkDescriptorSetLayout set_layouts[4] = {
-			(VkDescriptorSetLayout)uint64_t(i + 1),
-			(VkDescriptorSetLayout)uint64_t(i + 2),
-			(VkDescriptorSetLayout)uint64_t(i + 3),
-			(VkDescriptorSetLayout)uint64_t(i + 4),
-		};
+		VkDescriptorSetLayout set_layouts[4];
+		for (unsigned j = 0; j < 4; j++)
+			set_layouts[j] = (VkDescriptorSetLayout)uint64_t(((i + j) % num_set_layouts) + 1);
 		info.pSetLayouts = set_layouts;
 		info.setLayoutCount = 4;
+
+		// Keeps layouts unique even when there are only a few set layouts to pick from.
+		VkPushConstantRange push_constant = { VK_SHADER_STAGE_ALL, 0, 4 * (i + 1) };
+		info.pushConstantRangeCount = 1;
+		info.pPushConstantRanges = &push_constant;
+
 		if (!recorder.record_pipeline_layout((VkPipelineLayout)uint64_t(i + 1), info))
 			abort();
 	}
+}
 
-	std::uniform_int_distribution<int> format_dist(0, 15);
+static void record_render_passes(StateRecorder &recorder, unsigned count)
+{
+	static const VkFormat formats[16] = {
+		VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB,
+		VK_FORMAT_R16_SFLOAT, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_B10G11R11_UFLOAT_PACK32,
+		VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_B8G8R8A8_UNORM,
+		VK_FORMAT_R8_SNORM, VK_FORMAT_R8G8_SNORM, VK_FORMAT_R8G8B8A8_SNORM, VK_FORMAT_R16G16B16A16_UNORM,
+	};
 
-	for (unsigned i = 0; i < 10000; i++)
+	for (unsigned i = 0; i < count; i++)
 	{
 		VkRenderPassCreateInfo info = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
 		info.attachmentCount = 4;
 
-		static const VkFormat random_formats[16] = {
-			VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB,
-			VK_FORMAT_R16_SFLOAT, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_B10G11R11_UFLOAT_PACK32,
-			VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_B8G8R8A8_UNORM,
-			VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB,
-		};
-
+		// Every attachment takes a nibble of the index as format, so the first 64k render passes are unique.
 		VkAttachmentDescription attachments[4] = {};
-		for (auto &att : attachments)
+		for (unsigned j = 0; j < 4; j++)
 		{
-			att.format = random_formats[format_dist(rnd)];
+			auto &att = attachments[j];
+			att.format = formats[(i >> (4 * j)) & 15];
 			att.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 			att.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 			att.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
@@ -145,46 +175,174 @@ static void bench_recorder(const char *path, bool compressed, bool checksum)
 		if (!recorder.record_render_pass((VkRenderPass)uint64_t(i + 1), info))
 			abort();
 	}
+}
 
-	for (unsigned i = 0; i < 100000; i++)
+static void record_graphics_pipelines(StateRecorder &recorder, unsigned count,
+                                      unsigned num_layouts, unsigned num_render_passes, unsigned num_modules)
+{
+	for (unsigned i = 0; i < count; i++)
 	{
 		VkGraphicsPipelineCreateInfo info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
-		info.layout = (VkPipelineLayout)uint64_t((i % 9000) + 1);
-		info.renderPass = (VkRenderPass)uint64_t((i % 10000) + 1);
+		info.layout = (VkPipelineLayout)uint64_t((i % num_layouts) + 1);
+		info.renderPass = (VkRenderPass)uint64_t((i % num_render_passes) + 1);
 		info.stageCount = 2;
 		VkPipelineShaderStageCreateInfo stages[2] = {};
 		stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
 		stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		stages[0].pName = "main";
-		stages[0].module = (VkShaderModule)uint64_t((i % 10000) + 1);
+		stages[0].module = (VkShaderModule)uint64_t((i % num_modules) + 1);
 		stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 		stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		stages[1].pName = "main";
-		stages[1].module = (VkShaderModule)uint64_t(((3 * i) % 10000) + 1);
+		stages[1].module = (VkShaderModule)uint64_t(((3 * i) % num_modules) + 1);
+		info.pStages = stages;
+
+		VkPipelineColorBlendStateCreateInfo cb = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+		info.pColorBlendState = &cb;
+
+		VkPipelineVertexInputStateCreateInfo vi = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+		info.pVertexInputState = &vi;
+
+		VkPipelineDepthStencilStateCreateInfo ds = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+		info.pDepthStencilState = &ds;
+
+		VkPipelineDynamicStateCreateInfo dyn = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+		info.pDynamicState = &dyn;
+
+		VkPipelineInputAssemblyStateCreateInfo ia = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+		info.pInputAssemblyState = &ia;
+
+		// Keeps pipelines unique even when there are only a few dependencies to pick from.
+		VkPipelineRasterizationStateCreateInfo rs = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+		rs.lineWidth = float(i + 1);
+		info.pRasterizationState = &rs;
+
+		VkPipelineMultisampleStateCreateInfo ms = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+		info.pMultisampleState = &ms;
+
+		VkPipelineViewportStateCreateInfo vp = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+		info.pViewportState = &vp;
+
+		if (!recorder.record_graphics_pipeline((VkPipeline)uint64_t(i + 1), info, nullptr, 0))
+			abort();
+	}
+}
+
+static void record_compute_pipelines(StateRecorder &recorder, unsigned count, unsigned num_layouts, unsigned num_modules)
+{
+	for (unsigned i = 0; i < count; i++)
+	{
+		VkComputePipelineCreateInfo info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+		info.layout = (VkPipelineLayout)uint64_t((i % num_layouts) + 1);
+		info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		info.stage.pName = "main";
+		info.stage.module = (VkShaderModule)uint64_t((i % num_modules) + 1);
+
+		uint32_t constant = i;
+		VkSpecializationMapEntry map_entry = { 0, 0, sizeof(constant) };
+		VkSpecializationInfo spec = {};
+		spec.mapEntryCount = 1;
+		spec.pMapEntries = &map_entry;
+		spec.dataSize = sizeof(constant);
+		spec.pData = &constant;
+		info.stage.pSpecializationInfo = &spec;
+
+		if (!recorder.record_compute_pipeline((VkPipeline)uint64_t(i + 1), info, nullptr, 0))
+			abort();
+	}
+}
+
+// Closer to what games create than record_graphics_pipelines(): several attachments and vertex streams,
+// dynamic viewport and scissor, and specialization constants in every stage.
+static void record_realistic_graphics_pipelines(StateRecorder &recorder, unsigned count,
+                                                unsigned num_layouts, unsigned num_render_passes, unsigned num_modules)
+{
+	for (unsigned i = 0; i < count; i++)
+	{
+		VkGraphicsPipelineCreateInfo info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+		info.layout = (VkPipelineLayout)uint64_t((i % num_layouts) + 1);
+		info.renderPass = (VkRenderPass)uint64_t((i % num_render_passes) + 1);
+
+		uint32_t constants[4] = { i, i >> 4, i >> 8, 1 };
+		VkSpecializationMapEntry map_entries[4];
+		for (unsigned j = 0; j < 4; j++)
+			map_entries[j] = { j, uint32_t(j * sizeof(uint32_t)), sizeof(uint32_t) };
+		VkSpecializationInfo spec = {};
+		spec.mapEntryCount = 4;
+		spec.pMapEntries = map_entries;
+		spec.dataSize = sizeof(constants);
+		spec.pData = constants;
+
+		VkPipelineShaderStageCreateInfo stages[2] = {};
+		for (unsigned j = 0; j < 2; j++)
+		{
+			stages[j].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+			stages[j].stage = j ? VK_SHADER_STAGE_FRAGMENT_BIT : VK_SHADER_STAGE_VERTEX_BIT;
+			stages[j].pName = "main";
+			stages[j].module = (VkShaderModule)uint64_t(((i * (2 * j + 1)) % num_modules) + 1);
+			stages[j].pSpecializationInfo = &spec;
+		}
+		info.stageCount = 2;
 		info.pStages = stages;
 
+		VkPipelineColorBlendAttachmentState attachments[4] = {};
+		for (auto &att : attachments)
+		{
+			att.blendEnable = VK_TRUE;
+			att.colorWriteMask = 0xf;
+			att.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+			att.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+			att.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+			att.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		}
 		VkPipelineColorBlendStateCreateInfo cb = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+		cb.attachmentCount = 4;
+		cb.pAttachments = attachments;
 		info.pColorBlendState = &cb;
 
+		VkVertexInputAttributeDescription attributes[6];
+		for (unsigned j = 0; j < 6; j++)
+			attributes[j] = { j, j / 3, VK_FORMAT_R32G32B32A32_SFLOAT, 16 * (j % 3) };
+		VkVertexInputBindingDescription bindings[2] = {
+			{ 0, 48, VK_VERTEX_INPUT_RATE_VERTEX },
+			{ 1, 48, VK_VERTEX_INPUT_RATE_INSTANCE },
+		};
 		VkPipelineVertexInputStateCreateInfo vi = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+		vi.vertexAttributeDescriptionCount = 6;
+		vi.pVertexAttributeDescriptions = attributes;
+		vi.vertexBindingDescriptionCount = 2;
+		vi.pVertexBindingDescriptions = bindings;
 		info.pVertexInputState = &vi;
 
 		VkPipelineDepthStencilStateCreateInfo ds = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+		ds.depthTestEnable = VK_TRUE;
+		ds.depthWriteEnable = VK_TRUE;
+		ds.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
 		info.pDepthStencilState = &ds;
 
+		static const VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
 		VkPipelineDynamicStateCreateInfo dyn = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+		dyn.dynamicStateCount = 2;
+		dyn.pDynamicStates = dynamic_states;
 		info.pDynamicState = &dyn;
 
 		VkPipelineInputAssemblyStateCreateInfo ia = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+		ia.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 		info.pInputAssemblyState = &ia;
 
 		VkPipelineRasterizationStateCreateInfo rs = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+		rs.cullMode = VK_CULL_MODE_BACK_BIT;
+		rs.lineWidth = 1.0f;
 		info.pRasterizationState = &rs;
 
 		VkPipelineMultisampleStateCreateInfo ms = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+		ms.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 		info.pMultisampleState = &ms;
 
 		VkPipelineViewportStateCreateInfo vp = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+		vp.viewportCount = 1;
+		vp.scissorCount = 1;
 		info.pViewportState = &vp;
 
 		if (!recorder.record_graphics_pipeline((VkPipeline)uint64_t(i + 1), info, nullptr, 0))
@@ -192,40 +350,74 @@ static void bench_recorder(const char *path, bool compressed, bool checksum)
 	}
 }
 
+static void bench_recorder(const char *path, bool compressed, bool checksum)
+{
+	remove(path);
+	auto iface = std::unique_ptr<DatabaseInterface>(create_database(path, DatabaseMode::OverWrite));
+	StateRecorder recorder;
+	recorder.set_database_enable_checksum(checksum);
+	recorder.set_database_enable_compression(compressed);
+	recorder.init_recording_thread(iface.get());
+
+	// Create 10000 random SPIR-V modules with reasonable ID distribution.
+	record_shader_modules(recorder, 10000, 4096);
+	record_samplers(recorder, 10000);
+	record_descriptor_set_layouts(recorder, 10000);
+	record_pipeline_layouts(recorder, 9000, 10000);
+	record_render_passes(recorder, 10000);
+	record_graphics_pipelines(recorder, 100000, 9000, 10000, 10000);
+}
+
+// Objects recorded by bench_recorder().
+static const unsigned BENCH_RECORDER_OBJECT_COUNT = 4 * 10000 + 9000 + 100000;
+
+template <typename T>
+static inline T fake_handle(uint64_t v)
+{
+	return (T)v;
+}
+
 struct ReplayInterface : StateCreatorInterface
 {
-	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override
+	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *, VkSampler *sampler) override
 	{
+		*sampler = fake_handle<VkSampler>(hash);
 		return true;
 	}
 
-	bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override
+	bool enqueue_create_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *layout) override
 	{
+		*layout = fake_handle<VkDescriptorSetLayout>(hash);
 		return true;
 	}
 
-	bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override
+	bool enqueue_create_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *layout) override
 	{
+		*layout = fake_handle<VkPipelineLayout>(hash);
 		return true;
 	}
 
-	bool enqueue_create_shader_module(Hash, const VkShaderModuleCreateInfo *, VkShaderModule *) override
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *, VkShaderModule *module) override
 	{
+		*module = fake_handle<VkShaderModule>(hash);
 		return true;
 	}
 
-	bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override
+	bool enqueue_create_render_pass(Hash hash, const VkRenderPassCreateInfo *, VkRenderPass *render_pass) override
 	{
+		*render_pass = fake_handle<VkRenderPass>(hash);
 		return true;
 	}
 
-	bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override
+	bool enqueue_create_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo *, VkPipeline *pipeline) override
 	{
+		*pipeline = fake_handle<VkPipeline>(hash);
 		return true;
 	}
 
-	bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override
+	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *pipeline) override
 	{
+		*pipeline = fake_handle<VkPipeline>(hash);
 		return true;
 	}
 };
@@ -283,7 +475,7 @@ static bool dummy_replay_archive(const char *path)
 			if (!iface->read_entry(tag, hash, &state_json_size, state_json.data(), 0))
 			{
 				LOGE("Failed to load blob from cache.\n");
-				return EXIT_FAILURE;
+				return false;
 			}
 
 			if (!state_replayer.parse(replayer, nullptr, state_json.data(), state_json.size()))
@@ -294,47 +486,811 @@ static bool dummy_replay_archive(const char *path)
 	return true;
 }
 
-int main()
+struct Benchmark
+{
+	std::string name;
+
+	// Work done by one iteration, used to compute throughput. Either can be filled in by prepare.
+	uint64_t bytes = 0;
+	uint64_t items = 0;
+
+	// prepare runs once before the warmup iterations, and setup before every iteration.
+	// Only run is measured.
+	std::function<bool (Benchmark &)> prepare;
+	std::function<bool ()> setup;
+	std::function<bool ()> run;
+	std::function<void ()> teardown;
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	uint64_t bytes;
+	uint64_t items;
+	std::vector<double> samples_ms;
+	double min_ms, max_ms, mean_ms, median_ms, stddev_ms;
+};
+
+static Benchmark &add_benchmark(std::vector<Benchmark> &benchmarks, std::string name, uint64_t bytes, uint64_t items)
+{
+	benchmarks.emplace_back();
+	auto &bench = benchmarks.back();
+	bench.name = std::move(name);
+	bench.bytes = bytes;
+	bench.items = items;
+	return bench;
+}
+
+static void add_hash_benchmarks(std::vector<Benchmark> &benchmarks)
 {
-	for (unsigned i = 0; i < 2; i++)
+	auto spirv = std::make_shared<std::vector<uint32_t>>(create_dummy_spirv(4 * 1024 * 1024, 1));
+	uint64_t bytes = spirv->size() * sizeof(uint32_t);
+
+	static const struct
 	{
-		const char *path_compressed = i ? ".test.compressed.zip" : ".test.compressed.foz";
-		const char *path_uncompressed = i ? ".test.uncompressed.zip" : ".test.uncompressed.foz";
+		const char *name;
+		HashAlgorithm algorithm;
+	} algorithms[] = {
+		{ "hash/shader-module-fnv1a", HashAlgorithm::FNV1A },
+		{ "hash/shader-module-xxh64", HashAlgorithm::XXH64 },
+	};
 
-		if (i)
-			LOGI("=== Testing ZIP (miniz) ===\n");
-		else
-			LOGI("=== Testing Fossilize DB ===\n");
-
-		const auto run = [&](bool compressed, bool checksum) {
-			const char *path = compressed ? path_compressed : path_uncompressed;
-			auto begin_time = std::chrono::steady_clock::now();
-			bench_recorder(path, compressed, checksum);
-			auto end_time = std::chrono::steady_clock::now();
-			auto len = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count();
-
-			if (compressed && checksum)
-				LOGI("[WRITE] Compressed & checksum: %.3f ms\n", len * 1e-6);
-			else if (compressed)
-				LOGI("[WRITE] Compressed: %.3f ms\n", len * 1e-6);
-			else if (checksum)
-				LOGI("[WRITE] Uncompressed & checksum: %.3f ms\n", len * 1e-6);
+	for (auto &algorithm : algorithms)
+	{
+		auto hash_algorithm = algorithm.algorithm;
+		add_benchmark(benchmarks, algorithm.name, bytes, 1).run = [spirv, hash_algorithm]() {
+			VkShaderModuleCreateInfo info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+			info.codeSize = spirv->size() * sizeof(uint32_t);
+			info.pCode = spirv->data();
+			Hash hash = 0;
+			if (!Hashing::compute_hash_shader_module(info, &hash, hash_algorithm))
+				return false;
+			benchmark_sink ^= hash;
+			return true;
+		};
+	}
+
+	add_benchmark(benchmarks, "hash/crc32c", bytes, 1).run = [spirv]() {
+		benchmark_sink ^= compute_crc32c(0, spirv->data(), spirv->size() * sizeof(uint32_t));
+		return true;
+	};
+}
+
+static void add_varint_benchmarks(std::vector<Benchmark> &benchmarks)
+{
+	struct VarintState
+	{
+		std::vector<uint32_t> words;
+		std::vector<uint8_t> encoded;
+	};
+
+	auto state = std::make_shared<VarintState>();
+	state->words = create_dummy_spirv(4 * 1024 * 1024, 2);
+	state->encoded.resize(compute_size_varint(state->words.data(), state->words.size()));
+	encode_varint(state->encoded.data(), state->words.data(), state->words.size());
+
+	uint64_t bytes = state->words.size() * sizeof(uint32_t);
+	uint64_t items = state->words.size();
+
+	add_benchmark(benchmarks, "varint/encode", bytes, items).run = [state]() {
+		size_t size = compute_size_varint(state->words.data(), state->words.size());
+		if (size != state->encoded.size())
+			return false;
+		encode_varint(state->encoded.data(), state->words.data(), state->words.size());
+		return true;
+	};
+
+	add_benchmark(benchmarks, "varint/decode", bytes, items).run = [state]() {
+		if (!decode_varint(state->words.data(), state->words.size(), state->encoded.data(), state->encoded.size()))
+			return false;
+		benchmark_sink ^= state->words.back();
+		return true;
+	};
+}
+
+struct DatabaseBackend
+{
+	const char *name;
+	const char *path;
+	bool directory;
+};
+
+static const unsigned DATABASE_ENTRY_COUNT = 2048;
+static const size_t DATABASE_ENTRY_SIZE = 16 * 1024;
+
+static Hash get_database_entry_hash(unsigned index)
+{
+	return Hash(index + 1);
+}
+
+static void remove_database(const DatabaseBackend &backend)
+{
+	if (!backend.directory)
+	{
+		remove(backend.path);
+		return;
+	}
+
+	// The folder database shards entries by the top 16 bits of the hash, which are zero for all our entries.
+	std::string shard = Path::join(Path::join(backend.path, "00"), "00");
+	for (unsigned i = 0; i < DATABASE_ENTRY_COUNT; i++)
+	{
+		char filename[25];
+		sprintf(filename, "%02x.%016" PRIx64 ".json", unsigned(RESOURCE_SHADER_MODULE), get_database_entry_hash(i));
+		remove(Path::join(shard, filename).c_str());
+	}
+
+	remove(shard.c_str());
+	remove(Path::join(backend.path, "00").c_str());
+	remove(backend.path);
+}
+
+static bool write_database(const DatabaseBackend &backend, const std::vector<std::vector<uint8_t>> &payloads)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_database(backend.path, DatabaseMode::OverWrite));
+	if (!db || !db->prepare())
+		return false;
+
+	for (size_t i = 0; i < payloads.size(); i++)
+	{
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, get_database_entry_hash(unsigned(i)),
+		                     payloads[i].data(), payloads[i].size(),
+		                     PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT))
+			return false;
+	}
+
+	return true;
+}
+
+static bool read_database_entries(DatabaseInterface &db, const Hash *hashes, size_t count, PayloadReadFlags flags)
+{
+	std::vector<uint8_t> blob(DATABASE_ENTRY_SIZE);
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t size = blob.size();
+		if (!db.read_entry(RESOURCE_SHADER_MODULE, hashes[i], &size, blob.data(), flags))
+			return false;
+		benchmark_sink ^= blob[i % size];
+	}
+	return true;
+}
+
+static void add_database_benchmarks(std::vector<Benchmark> &benchmarks, unsigned num_threads)
+{
+	// Compressible payloads, the size of a typical shader module.
+	auto payloads = std::make_shared<std::vector<std::vector<uint8_t>>>(DATABASE_ENTRY_COUNT);
+	for (unsigned i = 0; i < DATABASE_ENTRY_COUNT; i++)
+	{
+		auto words = create_dummy_spirv(DATABASE_ENTRY_SIZE / sizeof(uint32_t), i);
+		auto &payload = (*payloads)[i];
+		payload.resize(DATABASE_ENTRY_SIZE);
+		memcpy(payload.data(), words.data(), DATABASE_ENTRY_SIZE);
+	}
+
+	auto sequential_hashes = std::make_shared<std::vector<Hash>>(DATABASE_ENTRY_COUNT);
+	for (unsigned i = 0; i < DATABASE_ENTRY_COUNT; i++)
+		(*sequential_hashes)[i] = get_database_entry_hash(i);
+
+	auto random_hashes = std::make_shared<std::vector<Hash>>(*sequential_hashes);
+	std::shuffle(random_hashes->begin(), random_hashes->end(), std::mt19937(3));
+
+	static const DatabaseBackend backends[] = {
+		{ "foz", ".__bench.foz", false },
+		{ "zip", ".__bench.zip", false },
+		{ "dir", ".__bench.dir", true },
+	};
+
+	uint64_t bytes = uint64_t(DATABASE_ENTRY_COUNT) * DATABASE_ENTRY_SIZE;
+
+	for (auto &backend_ref : backends)
+	{
+		const DatabaseBackend *backend = &backend_ref;
+		std::string prefix = std::string("db/") + backend->name + "/";
+
+		auto &write = add_benchmark(benchmarks, prefix + "write", bytes, DATABASE_ENTRY_COUNT);
+		write.setup = [backend]() {
+			remove_database(*backend);
+			return true;
+		};
+		write.run = [backend, payloads]() {
+			return write_database(*backend, *payloads);
+		};
+		write.teardown = [backend]() {
+			remove_database(*backend);
+		};
+
+		auto &open = add_benchmark(benchmarks, prefix + "open", 0, DATABASE_ENTRY_COUNT);
+		open.prepare = [backend, payloads](Benchmark &) {
+			remove_database(*backend);
+			return write_database(*backend, *payloads);
+		};
+		open.run = [backend]() {
+			auto db = std::unique_ptr<DatabaseInterface>(create_database(backend->path, DatabaseMode::ReadOnly));
+			return db && db->prepare();
+		};
+		open.teardown = [backend]() {
+			remove_database(*backend);
+		};
+
+		struct ReadMode
+		{
+			const char *name;
+			std::shared_ptr<std::vector<Hash>> hashes;
+			bool concurrent;
+		};
+
+		// Only the Fossilize format supports concurrent reads.
+		std::vector<ReadMode> read_modes = {
+			{ "read-sequential", sequential_hashes, false },
+			{ "read-random", random_hashes, false },
+		};
+		if (strcmp(backend->name, "foz") == 0)
+			read_modes.push_back({ "read-concurrent", random_hashes, true });
+
+		for (auto &mode : read_modes)
+		{
+			auto db = std::make_shared<std::unique_ptr<DatabaseInterface>>();
+			auto hashes = mode.hashes;
+
+			auto &read = add_benchmark(benchmarks, prefix + mode.name, bytes, DATABASE_ENTRY_COUNT);
+			read.prepare = [backend, payloads, db](Benchmark &) {
+				remove_database(*backend);
+				if (!write_database(*backend, *payloads))
+					return false;
+				db->reset(create_database(backend->path, DatabaseMode::ReadOnly));
+				return *db && (*db)->prepare();
+			};
+			read.teardown = [backend, db]() {
+				db->reset();
+				remove_database(*backend);
+			};
+
+			if (mode.concurrent)
+			{
+				read.run = [db, hashes, num_threads]() {
+					std::atomic<bool> success(true);
+					std::vector<std::thread> threads;
+					size_t per_thread = (hashes->size() + num_threads - 1) / num_threads;
+
+					for (unsigned i = 0; i < num_threads; i++)
+					{
+						size_t begin = std::min(hashes->size(), i * per_thread);
+						size_t end = std::min(hashes->size(), begin + per_thread);
+						threads.emplace_back([&, begin, end]() {
+							if (!read_database_entries(**db, hashes->data() + begin, end - begin, PAYLOAD_READ_CONCURRENT_BIT))
+								success = false;
+						});
+					}
+
+					for (auto &thread : threads)
+						thread.join();
+					return success.load();
+				};
+			}
 			else
-				LOGI("[WRITE] Uncompressed: %.3f ms\n", len * 1e-6);
-
-			begin_time = std::chrono::steady_clock::now();
-			if (!dummy_replay_archive(path))
-				LOGE("Failed to replay archive.\n");
-			remove(path);
-			end_time = std::chrono::steady_clock::now();
-			len = std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count();
-			LOGI("[READ]: %.3f ms\n", len * 1e-6);
+			{
+				read.run = [db, hashes]() {
+					return read_database_entries(**db, hashes->data(), hashes->size(), 0);
+				};
+			}
+		}
+	}
+}
+
+static void add_json_benchmarks(std::vector<Benchmark> &benchmarks)
+{
+	static const unsigned count = 4096;
+	const bool simdjson_supported = StateReplayer().set_json_parse_backend(JsonParseBackend::Simdjson);
+
+	// Pipelines and layouts reference a single instance of each dependency, so they dominate the serialized state.
+	static const struct
+	{
+		const char *name;
+		unsigned items;
+		void (*record)(StateRecorder &recorder);
+	} types[] = {
+		{ "sampler", count, [](StateRecorder &recorder) { record_samplers(recorder, count); } },
+		{ "descriptor-set-layout", count, [](StateRecorder &recorder) { record_descriptor_set_layouts(recorder, count); } },
+		{ "pipeline-layout", count, [](StateRecorder &recorder) {
+			record_descriptor_set_layouts(recorder, 1);
+			record_pipeline_layouts(recorder, count, 1);
+		} },
+		{ "shader-module", count / 4, [](StateRecorder &recorder) { record_shader_modules(recorder, count / 4, 1024); } },
+		{ "render-pass", count, [](StateRecorder &recorder) { record_render_passes(recorder, count); } },
+		{ "graphics-pipeline", count, [](StateRecorder &recorder) {
+			record_descriptor_set_layouts(recorder, 1);
+			record_pipeline_layouts(recorder, 1, 1);
+			record_render_passes(recorder, 1);
+			record_shader_modules(recorder, 1, 64);
+			record_graphics_pipelines(recorder, count, 1, 1, 1);
+		} },
+		{ "compute-pipeline", count, [](StateRecorder &recorder) {
+			record_descriptor_set_layouts(recorder, 1);
+			record_pipeline_layouts(recorder, 1, 1);
+			record_shader_modules(recorder, 1, 64);
+			record_compute_pipelines(recorder, count, 1, 1);
+		} },
+	};
+
+	for (auto &type : types)
+	{
+		struct JsonState
+		{
+			StateRecorder recorder;
+			std::vector<uint8_t> json;
+		};
+
+		auto state = std::make_shared<JsonState>();
+		auto record = type.record;
+
+		// The first serialize also drains the recording queue, so it happens up front.
+		const auto prepare = [state, record](Benchmark &bench) {
+			if (!state->json.empty())
+			{
+				bench.bytes = state->json.size();
+				return true;
+			}
+
+			record(state->recorder);
+			uint8_t *serialized = nullptr;
+			size_t serialized_size = 0;
+			if (!state->recorder.serialize(&serialized, &serialized_size))
+				return false;
+			state->json.assign(serialized, serialized + serialized_size);
+			StateRecorder::free_serialized(serialized);
+			bench.bytes = state->json.size();
+			return true;
+		};
+
+		auto &serialize = add_benchmark(benchmarks, std::string("json/serialize/") + type.name, 0, type.items);
+		serialize.prepare = prepare;
+		serialize.run = [state]() {
+			uint8_t *serialized = nullptr;
+			size_t serialized_size = 0;
+			if (!state->recorder.serialize(&serialized, &serialized_size))
+				return false;
+			benchmark_sink ^= serialized_size;
+			StateRecorder::free_serialized(serialized);
+			return true;
+		};
+
+		auto &parse = add_benchmark(benchmarks, std::string("json/parse/") + type.name, 0, type.items);
+		parse.prepare = prepare;
+		parse.run = [state]() {
+			StateReplayer replayer;
+			ReplayInterface iface;
+			replayer.set_json_parse_backend(JsonParseBackend::RapidJSON);
+			return replayer.parse(iface, nullptr, state->json.data(), state->json.size());
+		};
+
+		if (simdjson_supported)
+		{
+			auto &simd_parse = add_benchmark(benchmarks, std::string("json/parse-simdjson/") + type.name, 0, type.items);
+			simd_parse.prepare = prepare;
+			simd_parse.run = [state]() {
+				StateReplayer replayer;
+				ReplayInterface iface;
+				replayer.set_json_parse_backend(JsonParseBackend::Simdjson);
+				return replayer.parse(iface, nullptr, state->json.data(), state->json.size());
+			};
+		}
+	}
+}
+
+static void add_object_cache_benchmarks(std::vector<Benchmark> &benchmarks)
+{
+	static const unsigned num_objects = 2048;
+	static const unsigned num_lookups = 50000;
+
+	struct CacheState
+	{
+		std::vector<Hash> lookups;
+		std::vector<size_t> sizes;
+		size_t target_size = 0;
+		std::unique_ptr<ObjectCache<uint64_t>> cache;
+	};
+
+	// A few hot objects and a long tail, like shader modules shared between pipelines.
+	auto state = std::make_shared<CacheState>();
+	std::mt19937 rnd(4);
+	std::exponential_distribution<double> index_dist(1.0 / 256.0);
+	std::uniform_int_distribution<size_t> size_dist(4 * 1024, 64 * 1024);
+
+	size_t total_size = 0;
+	state->sizes.resize(num_objects);
+	for (auto &size : state->sizes)
+	{
+		size = size_dist(rnd);
+		total_size += size;
+	}
+	state->target_size = total_size / 8;
+
+	state->lookups.resize(num_lookups);
+	for (auto &lookup : state->lookups)
+		lookup = Hash(std::min<unsigned>(num_objects - 1, unsigned(index_dist(rnd)))) + 1;
+
+	static const struct
+	{
+		const char *name;
+		ObjectCacheEvictionPolicy policy;
+	} policies[] = {
+		{ "object-cache/churn-lru", ObjectCacheEvictionPolicy::LeastRecentlyUsed },
+		{ "object-cache/churn-fewest-remaining-uses", ObjectCacheEvictionPolicy::FewestRemainingUses },
+	};
+
+	for (auto &policy_ref : policies)
+	{
+		auto policy = policy_ref.policy;
+		auto &bench = add_benchmark(benchmarks, policy_ref.name, 0, num_lookups);
+
+		bench.setup = [state, policy]() {
+			state->cache.reset(new ObjectCache<uint64_t>);
+			state->cache->set_target_size(state->target_size);
+			state->cache->set_eviction_policy(policy);
+			if (policy == ObjectCacheEvictionPolicy::FewestRemainingUses)
+				for (auto &lookup : state->lookups)
+					state->cache->add_remaining_uses(lookup, 1);
+			return true;
+		};
+
+		bench.run = [state, policy]() {
+			auto &cache = *state->cache;
+			uint64_t evictions = 0;
+			const auto deleter = [&](Hash, uint64_t) { evictions++; };
+
+			for (auto &lookup : state->lookups)
+			{
+				if (!cache.find_object(lookup).second)
+				{
+					cache.insert_object(lookup, lookup, state->sizes[lookup - 1]);
+					cache.prune_cache(deleter);
+				}
+
+				if (policy == ObjectCacheEvictionPolicy::FewestRemainingUses)
+					cache.release_use(lookup);
+			}
+
+			cache.delete_cache(deleter);
+			benchmark_sink ^= evictions;
+			return true;
+		};
+
+		bench.teardown = [state]() {
+			state->cache.reset();
 		};
+	}
+}
+
+// Claims to already have every object, so recording measures copying, hashing and remapping,
+// but not serialization or disk I/O.
+struct PopulatedDatabase : DatabaseInterface
+{
+	PopulatedDatabase()
+		: DatabaseInterface(DatabaseMode::Append)
+	{
+	}
+
+	bool prepare() override
+	{
+		return true;
+	}
+
+	bool read_entry(ResourceTag, Hash, size_t *, void *, PayloadReadFlags) override
+	{
+		return false;
+	}
+
+	bool write_entry(ResourceTag, Hash, const void *, size_t, PayloadWriteFlags) override
+	{
+		return true;
+	}
+
+	bool has_entry(ResourceTag, Hash) override
+	{
+		return true;
+	}
+
+	bool get_hash_list_for_resource_tag(ResourceTag, size_t *num_hashes, Hash *) override
+	{
+		*num_hashes = 0;
+		return true;
+	}
+
+	void flush() override
+	{
+	}
+
+	const char *get_db_path_for_hash(ResourceTag, Hash) override
+	{
+		return nullptr;
+	}
+};
+
+static void add_record_benchmarks(std::vector<Benchmark> &benchmarks)
+{
+	static const unsigned count = 16384;
+
+	// Includes the time for the recording thread to drain its queue, which happens when the recorder is destroyed.
+	add_benchmark(benchmarks, "record/graphics-pipeline", 0, count).run = []() {
+		PopulatedDatabase db;
+		StateRecorder recorder;
+		recorder.init_recording_thread(&db);
+		record_descriptor_set_layouts(recorder, 16);
+		record_pipeline_layouts(recorder, 64, 16);
+		record_render_passes(recorder, 16);
+		record_shader_modules(recorder, 256, 64);
+		record_realistic_graphics_pipelines(recorder, count, 64, 16, 256);
+		return true;
+	};
+}
+
+static void add_macro_benchmarks(std::vector<Benchmark> &benchmarks)
+{
+	static const struct
+	{
+		const char *name;
+		const char *path;
+	} formats[] = {
+		{ "foz", ".__bench.macro.foz" },
+		{ "zip", ".__bench.macro.zip" },
+	};
+
+	static const struct
+	{
+		const char *name;
+		bool compressed;
+		bool checksum;
+	} configs[] = {
+		{ "uncompressed", false, false },
+		{ "uncompressed-checksum", false, true },
+		{ "compressed", true, false },
+		{ "compressed-checksum", true, true },
+	};
+
+	for (auto &format : formats)
+	{
+		for (auto &config : configs)
+		{
+			const char *path = format.path;
+			bool compressed = config.compressed;
+			bool checksum = config.checksum;
+			std::string suffix = std::string(format.name) + "/" + config.name;
+
+			auto &record = add_benchmark(benchmarks, "macro/record/" + suffix, 0, BENCH_RECORDER_OBJECT_COUNT);
+			record.run = [=]() {
+				bench_recorder(path, compressed, checksum);
+				return true;
+			};
+			record.teardown = [path]() {
+				remove(path);
+			};
+
+			auto &replay = add_benchmark(benchmarks, "macro/replay/" + suffix, 0, BENCH_RECORDER_OBJECT_COUNT);
+			replay.prepare = [=](Benchmark &) {
+				bench_recorder(path, compressed, checksum);
+				return true;
+			};
+			replay.run = [path]() {
+				return dummy_replay_archive(path);
+			};
+			replay.teardown = [path]() {
+				remove(path);
+			};
+		}
+	}
+}
+
+static double get_time_ms(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+	return double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()) * 1e-6;
+}
+
+static bool run_benchmark(Benchmark &bench, unsigned warmup, unsigned iterations, BenchmarkResult &result)
+{
+	if (bench.prepare && !bench.prepare(bench))
+	{
+		LOGE("Failed to prepare benchmark %s.\n", bench.name.c_str());
+		return false;
+	}
+
+	bool success = true;
+	for (unsigned i = 0; success && i < warmup + iterations; i++)
+	{
+		if (bench.setup && !bench.setup())
+		{
+			LOGE("Failed to set up benchmark %s.\n", bench.name.c_str());
+			success = false;
+			break;
+		}
+
+		auto begin_time = std::chrono::steady_clock::now();
+		success = bench.run();
+		auto end_time = std::chrono::steady_clock::now();
+
+		if (!success)
+			LOGE("Benchmark %s failed.\n", bench.name.c_str());
+		else if (i >= warmup)
+			result.samples_ms.push_back(get_time_ms(begin_time, end_time));
+	}
+
+	if (bench.teardown)
+		bench.teardown();
+
+	if (!success)
+		return false;
+
+	auto sorted = result.samples_ms;
+	std::sort(sorted.begin(), sorted.end());
+	size_t count = sorted.size();
+
+	double sum = 0.0;
+	for (auto &sample : sorted)
+		sum += sample;
+
+	result.name = bench.name;
+	result.bytes = bench.bytes;
+	result.items = bench.items;
+	result.min_ms = sorted.front();
+	result.max_ms = sorted.back();
+	result.mean_ms = sum / double(count);
+	result.median_ms = count & 1 ? sorted[count / 2] : 0.5 * (sorted[count / 2 - 1] + sorted[count / 2]);
+
+	double variance = 0.0;
+	for (auto &sample : sorted)
+		variance += (sample - result.mean_ms) * (sample - result.mean_ms);
+	result.stddev_ms = count > 1 ? sqrt(variance / double(count - 1)) : 0.0;
+
+	return true;
+}
+
+// Throughput is based on the median, which is less sensitive to outliers than the mean.
+static double get_throughput(uint64_t amount, double median_ms)
+{
+	return median_ms > 0.0 ? double(amount) / (median_ms * 1e-3) : 0.0;
+}
+
+static void log_result(const BenchmarkResult &result)
+{
+	char throughput[64] = "";
+	if (result.bytes)
+	{
+		snprintf(throughput, sizeof(throughput), " %10.1f MB/s",
+		         get_throughput(result.bytes, result.median_ms) / (1024.0 * 1024.0));
+	}
+
+	LOGI("%-48s median %10.3f ms, mean %10.3f ms, stddev %8.3f ms, min %10.3f ms, max %10.3f ms,%s %12.0f items/s\n",
+	     result.name.c_str(), result.median_ms, result.mean_ms, result.stddev_ms, result.min_ms, result.max_ms,
+	     throughput, get_throughput(result.items, result.median_ms));
+}
+
+static bool write_json_report(const std::string &path, const std::vector<BenchmarkResult> &results,
+                              unsigned warmup, unsigned iterations)
+{
+	rapidjson::Document doc;
+	doc.SetObject();
+	auto &alloc = doc.GetAllocator();
+
+	doc.AddMember("warmup", warmup, alloc);
+	doc.AddMember("iterations", iterations, alloc);
+
+	rapidjson::Value values(rapidjson::kArrayType);
+	for (auto &result : results)
+	{
+		rapidjson::Value value(rapidjson::kObjectType);
+		value.AddMember("name", rapidjson::StringRef(result.name.c_str()), alloc);
+		value.AddMember("bytes", result.bytes, alloc);
+		value.AddMember("items", result.items, alloc);
+		value.AddMember("min_ms", result.min_ms, alloc);
+		value.AddMember("max_ms", result.max_ms, alloc);
+		value.AddMember("mean_ms", result.mean_ms, alloc);
+		value.AddMember("median_ms", result.median_ms, alloc);
+		value.AddMember("stddev_ms", result.stddev_ms, alloc);
+		value.AddMember("bytes_per_second", get_throughput(result.bytes, result.median_ms), alloc);
+		value.AddMember("items_per_second", get_throughput(result.items, result.median_ms), alloc);
+
+		rapidjson::Value samples(rapidjson::kArrayType);
+		for (auto &sample : result.samples_ms)
+			samples.PushBack(sample, alloc);
+		value.AddMember("samples_ms", samples, alloc);
+
+		values.PushBack(value, alloc);
+	}
+	doc.AddMember("benchmarks", values, alloc);
+
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+	doc.Accept(writer);
+
+	FILE *file = fopen(path.c_str(), "w");
+	if (!file)
+	{
+		LOGE("Failed to open %s for writing.\n", path.c_str());
+		return false;
+	}
+
+	fwrite(buffer.GetString(), 1, buffer.GetSize(), file);
+	fputc('\n', file);
+	fclose(file);
+	return true;
+}
+
+static void print_help()
+{
+	LOGI("Usage: fossilize-bench\n"
+	     "\t[--iterations <count> (default: 5)]\n"
+	     "\t[--warmup <count> (default: 1)]\n"
+	     "\t[--filter <substring>]\n"
+	     "\t[--num-threads <count>]\n"
+	     "\t[--json <path>]\n"
+	     "\t[--list]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	CLICallbacks cbs;
+	unsigned iterations = 5;
+	unsigned warmup = 1;
+	unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::string filter;
+	std::string json_path;
+	bool list = false;
+
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--iterations", [&](CLIParser &parser) { iterations = parser.next_uint(); });
+	cbs.add("--warmup", [&](CLIParser &parser) { warmup = parser.next_uint(); });
+	cbs.add("--filter", [&](CLIParser &parser) { filter = parser.next_string(); });
+	cbs.add("--num-threads", [&](CLIParser &parser) { num_threads = parser.next_uint(); });
+	cbs.add("--json", [&](CLIParser &parser) { json_path = parser.next_string(); });
+	cbs.add("--list", [&](CLIParser &) { list = true; });
+	cbs.error_handler = [] { print_help(); };
+
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (!iterations || !num_threads)
+	{
+		LOGE("Iteration and thread counts must be at least 1.\n");
+		return EXIT_FAILURE;
+	}
 
-		run(false, false);
-		run(false, true);
-		run(true, false);
-		run(true, true);
-		LOGI("===================\n\n");
+	std::vector<Benchmark> benchmarks;
+	add_hash_benchmarks(benchmarks);
+	add_varint_benchmarks(benchmarks);
+	add_database_benchmarks(benchmarks, num_threads);
+	add_json_benchmarks(benchmarks);
+	add_object_cache_benchmarks(benchmarks);
+	add_record_benchmarks(benchmarks);
+	add_macro_benchmarks(benchmarks);
+
+	std::vector<BenchmarkResult> results;
+	bool success = true;
+
+	for (auto &bench : benchmarks)
+	{
+		if (!filter.empty() && bench.name.find(filter) == std::string::npos)
+			continue;
+
+		if (list)
+		{
+			LOGI("%s\n", bench.name.c_str());
+			continue;
+		}
+
+		BenchmarkResult result;
+		if (run_benchmark(bench, warmup, iterations, result))
+		{
+			log_result(result);
+			results.push_back(std::move(result));
+		}
+		else
+			success = false;
 	}
+
+	if (!json_path.empty() && !list && !write_json_report(json_path, results, warmup, iterations))
+		success = false;
+
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
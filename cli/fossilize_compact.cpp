@@ -0,0 +1,574 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fossilize_inttypes.h"
+#include "fossilize_db.hpp"
+#include <stdlib.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include "layer/utils.hpp"
+#include "cli_parser.hpp"
+
+using namespace Fossilize;
+using namespace std;
+
+static void print_help()
+{
+	LOGI("Usage: fossilize-compact\n"
+	     "\t[--keep-unreferenced]\n"
+	     "\tinput-db output-db\n");
+}
+
+template <typename T>
+static inline T fake_handle(uint64_t v)
+{
+	return (T)v;
+}
+
+// Records the dependency graph of the archive, so we can emit entries in the order a replayer consumes them.
+struct CompactReplayer : StateCreatorInterface
+{
+	struct Link
+	{
+		Hash link_hash;
+		ResourceTag tag;
+		Hash hash;
+	};
+
+	unordered_map<Hash, vector<Hash>> descriptor_set_samplers;
+	unordered_map<Hash, vector<Hash>> pipeline_layout_sets;
+	unordered_map<Hash, vector<Hash>> pipeline_modules[RESOURCE_COUNT];
+	vector<Link> links;
+
+	unordered_set<Hash> accessed_samplers;
+	unordered_set<Hash> accessed_descriptor_sets;
+	unordered_set<Hash> accessed_pipeline_layouts;
+	unordered_set<Hash> accessed_render_passes;
+
+	void notify_application_info_link(Hash link_hash, Hash, ResourceTag tag, Hash hash) override
+	{
+		links.push_back({ link_hash, tag, hash });
+	}
+
+	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *, VkSampler *sampler) override
+	{
+		*sampler = fake_handle<VkSampler>(hash);
+		return true;
+	}
+
+	bool enqueue_create_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo *create_info, VkDescriptorSetLayout *layout) override
+	{
+		*layout = fake_handle<VkDescriptorSetLayout>(hash);
+		auto &samplers = descriptor_set_samplers[hash];
+		samplers.clear();
+		for (uint32_t binding = 0; binding < create_info->bindingCount; binding++)
+		{
+			auto &bind = create_info->pBindings[binding];
+			if (bind.pImmutableSamplers && bind.descriptorCount != 0)
+			{
+				for (uint32_t i = 0; i < bind.descriptorCount; i++)
+					if (bind.pImmutableSamplers[i] != VK_NULL_HANDLE)
+						samplers.push_back((Hash)bind.pImmutableSamplers[i]);
+			}
+		}
+		return true;
+	}
+
+	bool enqueue_create_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo *create_info, VkPipelineLayout *layout) override
+	{
+		*layout = fake_handle<VkPipelineLayout>(hash);
+		auto &sets = pipeline_layout_sets[hash];
+		sets.clear();
+		for (uint32_t layout_index = 0; layout_index < create_info->setLayoutCount; layout_index++)
+			sets.push_back((Hash)create_info->pSetLayouts[layout_index]);
+		return true;
+	}
+
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *, VkShaderModule *module) override
+	{
+		*module = fake_handle<VkShaderModule>(hash);
+		return true;
+	}
+
+	bool enqueue_create_render_pass(Hash hash, const VkRenderPassCreateInfo *, VkRenderPass *render_pass) override
+	{
+		*render_pass = fake_handle<VkRenderPass>(hash);
+		return true;
+	}
+
+	void access_descriptor_set(Hash hash)
+	{
+		if (!accessed_descriptor_sets.insert(hash).second)
+			return;
+
+		auto itr = descriptor_set_samplers.find(hash);
+		if (itr != descriptor_set_samplers.end())
+			accessed_samplers.insert(itr->second.begin(), itr->second.end());
+	}
+
+	void access_pipeline_layout(Hash hash)
+	{
+		if (!accessed_pipeline_layouts.insert(hash).second)
+			return;
+
+		auto itr = pipeline_layout_sets.find(hash);
+		if (itr == pipeline_layout_sets.end())
+			return;
+
+		for (auto set : itr->second)
+			access_descriptor_set(set);
+	}
+
+	// Takes the place of the enqueue_create_* calls when the archive has a complete dependency graph.
+	void add_dependencies(ResourceTag tag, Hash hash, const vector<DependencyGraph::Dependency> &deps)
+	{
+		vector<Hash> *hashes = nullptr;
+		if (tag == RESOURCE_DESCRIPTOR_SET_LAYOUT)
+			hashes = &descriptor_set_samplers[hash];
+		else if (tag == RESOURCE_PIPELINE_LAYOUT)
+			hashes = &pipeline_layout_sets[hash];
+		else
+			hashes = &pipeline_modules[tag][hash];
+		hashes->clear();
+
+		for (auto &dep : deps)
+		{
+			switch (dep.tag)
+			{
+			case RESOURCE_SAMPLER:
+			case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+			case RESOURCE_SHADER_MODULE:
+				hashes->push_back(dep.hash);
+				break;
+			case RESOURCE_PIPELINE_LAYOUT:
+				access_pipeline_layout(dep.hash);
+				break;
+			case RESOURCE_RENDER_PASS:
+				accessed_render_passes.insert(dep.hash);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	bool enqueue_create_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		*pipeline = fake_handle<VkPipeline>(hash);
+		access_pipeline_layout((Hash)create_info->layout);
+		pipeline_modules[RESOURCE_COMPUTE_PIPELINE][hash] = { (Hash)create_info->stage.module };
+		return true;
+	}
+
+	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		*pipeline = fake_handle<VkPipeline>(hash);
+		access_pipeline_layout((Hash)create_info->layout);
+		accessed_render_passes.insert((Hash)create_info->renderPass);
+
+		auto &modules = pipeline_modules[RESOURCE_GRAPHICS_PIPELINE][hash];
+		modules.clear();
+		for (uint32_t i = 0; i < create_info->stageCount; i++)
+			modules.push_back((Hash)create_info->pStages[i].module);
+		return true;
+	}
+};
+
+struct CompactWriter
+{
+	DatabaseInterface &input_db;
+	DatabaseInterface &output_db;
+	vector<uint8_t> blob;
+	unordered_set<Hash> written[RESOURCE_COUNT];
+
+	CompactWriter(DatabaseInterface &input_db_, DatabaseInterface &output_db_)
+		: input_db(input_db_), output_db(output_db_)
+	{
+	}
+
+	bool copy_entry(ResourceTag tag, Hash hash)
+	{
+		if (written[tag].count(hash))
+			return true;
+
+		size_t blob_size = 0;
+		if (!input_db.read_entry(tag, hash, &blob_size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+			return false;
+		blob.resize(blob_size);
+		if (!input_db.read_entry(tag, hash, &blob_size, blob.data(), PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+			return false;
+
+		if (!output_db.write_entry(tag, hash, blob.data(), blob.size(), PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT))
+		{
+			// Payloads which depend on a compression dictionary cannot be carried over raw, recompress them.
+			if (!input_db.read_entry(tag, hash, &blob_size, nullptr, PAYLOAD_READ_NO_FLAGS))
+				return false;
+			blob.resize(blob_size);
+			if (!input_db.read_entry(tag, hash, &blob_size, blob.data(), PAYLOAD_READ_NO_FLAGS))
+				return false;
+			if (!output_db.write_entry(tag, hash, blob.data(), blob.size(),
+			                           PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPRESS_ZSTD_BIT |
+			                           PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT))
+			{
+				return false;
+			}
+		}
+
+		written[tag].insert(hash);
+		return true;
+	}
+
+	bool copy_entries(ResourceTag tag, const vector<Hash> &hashes, const unordered_set<Hash> *accessed)
+	{
+		for (auto hash : hashes)
+		{
+			if (accessed && !accessed->count(hash))
+				continue;
+
+			if (!input_db.has_entry(tag, hash))
+			{
+				// Dangling references are expected for pruned archives, just skip over them.
+				LOGW("Referenced entry (tag: %u, hash: %016" PRIx64 ") does not exist in database.\n", unsigned(tag), hash);
+				continue;
+			}
+
+			if (!copy_entry(tag, hash))
+			{
+				LOGE("Failed to copy entry (tag: %u, hash: %016" PRIx64 ").\n", unsigned(tag), hash);
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+static bool get_sorted_hashes(DatabaseInterface &db, ResourceTag tag, vector<Hash> &hashes)
+{
+	size_t hash_count = 0;
+	if (!db.get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+		return false;
+	hashes.resize(hash_count);
+	if (!db.get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+		return false;
+
+	// Replayers consume pipelines in hash order, so emit everything in that order as well.
+	sort(hashes.begin(), hashes.end());
+	return true;
+}
+
+// Only used if every layout and pipeline has an entry, otherwise we cannot tell what a missing entry refers to.
+static bool has_complete_dependency_graph(DatabaseInterface &db, const vector<Hash> *hashes)
+{
+	if (hashes[RESOURCE_DEPENDENCY_GRAPH].empty())
+		return false;
+
+	for (auto tag : { RESOURCE_DESCRIPTOR_SET_LAYOUT, RESOURCE_PIPELINE_LAYOUT,
+	                  RESOURCE_GRAPHICS_PIPELINE, RESOURCE_COMPUTE_PIPELINE })
+	{
+		for (auto hash : hashes[tag])
+			if (!db.has_entry(RESOURCE_DEPENDENCY_GRAPH, hash))
+				return false;
+	}
+
+	return true;
+}
+
+static bool load_dependency_graph(DatabaseInterface &db, const vector<Hash> *hashes, CompactReplayer &compact_replayer)
+{
+	vector<uint8_t> blob;
+	vector<DependencyGraph::Dependency> deps;
+
+	// Layouts go first, so that pipelines can mark everything they reach right away.
+	for (auto tag : { RESOURCE_DESCRIPTOR_SET_LAYOUT, RESOURCE_PIPELINE_LAYOUT,
+	                  RESOURCE_GRAPHICS_PIPELINE, RESOURCE_COMPUTE_PIPELINE })
+	{
+		for (auto hash : hashes[tag])
+		{
+			size_t blob_size = 0;
+			if (!db.read_entry(RESOURCE_DEPENDENCY_GRAPH, hash, &blob_size, nullptr, PAYLOAD_READ_NO_FLAGS))
+				return false;
+			blob.resize(blob_size);
+			if (!db.read_entry(RESOURCE_DEPENDENCY_GRAPH, hash, &blob_size, blob.data(), PAYLOAD_READ_NO_FLAGS))
+				return false;
+
+			ResourceTag entry_tag;
+			size_t count = 0;
+			if (!DependencyGraph::decode_entry(blob.data(), blob.size(), &entry_tag, &count, nullptr) || entry_tag != tag)
+				return false;
+			deps.resize(count);
+			if (count && !DependencyGraph::decode_entry(blob.data(), blob.size(), &entry_tag, &count, deps.data()))
+				return false;
+
+			compact_replayer.add_dependencies(tag, hash, deps);
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	CLICallbacks cbs;
+	vector<string> paths;
+	bool keep_unreferenced = false;
+
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--keep-unreferenced", [&](CLIParser &) { keep_unreferenced = true; });
+	cbs.default_handler = [&](const char *arg) { paths.push_back(arg); };
+	cbs.error_handler = [] { print_help(); };
+
+	CLIParser parser(move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (paths.size() != 2)
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	auto input_db = unique_ptr<DatabaseInterface>(create_database(paths[0].c_str(), DatabaseMode::ReadOnly));
+	auto output_db = unique_ptr<DatabaseInterface>(create_stream_archive_database(paths[1].c_str(), DatabaseMode::OverWrite));
+
+	if (!input_db || !input_db->prepare())
+	{
+		LOGE("Failed to load database: %s\n", paths[0].c_str());
+		return EXIT_FAILURE;
+	}
+
+	if (!output_db || !output_db->prepare())
+	{
+		LOGE("Failed to open database for writing: %s\n", paths[1].c_str());
+		return EXIT_FAILURE;
+	}
+
+	static const ResourceTag playback_order[] = {
+		RESOURCE_APPLICATION_INFO,
+		RESOURCE_APPLICATION_BLOB_LINK,
+		RESOURCE_SHADER_MODULE,
+		RESOURCE_SAMPLER,
+		RESOURCE_DESCRIPTOR_SET_LAYOUT,
+		RESOURCE_PIPELINE_LAYOUT,
+		RESOURCE_RENDER_PASS,
+		RESOURCE_GRAPHICS_PIPELINE,
+		RESOURCE_COMPUTE_PIPELINE,
+		RESOURCE_PIPELINE_USAGE,
+		RESOURCE_DEPENDENCY_GRAPH,
+	};
+
+	static const char *tag_names[] = {
+		"AppInfo",
+		"Sampler",
+		"Descriptor Set Layout",
+		"Pipeline Layout",
+		"Shader Module",
+		"Render Pass",
+		"Graphics Pipeline",
+		"Compute Pipeline",
+		"Application Blob Link",
+		"Pipeline Usage",
+		"Dependency Graph",
+	};
+
+	StateReplayer replayer;
+	CompactReplayer compact_replayer;
+
+	// Every blob must be parsed in isolation, we only care about the raw hashes it refers to.
+	replayer.set_resolve_shader_module_handles(false);
+	replayer.set_resolve_derivative_pipeline_handles(false);
+
+	vector<Hash> hashes[RESOURCE_COUNT];
+	vector<uint8_t> state_json;
+
+	for (auto tag : playback_order)
+	{
+		if (!get_sorted_hashes(*input_db, tag, hashes[tag]))
+		{
+			LOGE("Failed to get hashes.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// With a dependency graph, the only JSON left to parse are the application blob links.
+	bool use_dependency_graph = has_complete_dependency_graph(*input_db, hashes);
+	if (use_dependency_graph)
+	{
+		if (!load_dependency_graph(*input_db, hashes, compact_replayer))
+		{
+			LOGW("Dependency graph is corrupt, parsing all entries instead.\n");
+			compact_replayer = CompactReplayer();
+			use_dependency_graph = false;
+		}
+		else
+			LOGI("Using dependency graph of the archive.\n");
+	}
+
+	for (auto tag : playback_order)
+	{
+		// Shader modules, usage counts and the graph itself have no dependencies, so there is no need to parse them.
+		if (tag == RESOURCE_SHADER_MODULE || tag == RESOURCE_PIPELINE_USAGE || tag == RESOURCE_DEPENDENCY_GRAPH)
+			continue;
+
+		if (use_dependency_graph && tag != RESOURCE_APPLICATION_BLOB_LINK)
+			continue;
+
+		for (auto hash : hashes[tag])
+		{
+			size_t state_json_size = 0;
+			if (!input_db->read_entry(tag, hash, &state_json_size, nullptr, PAYLOAD_READ_NO_FLAGS))
+			{
+				LOGE("Failed to load blob from cache.\n");
+				return EXIT_FAILURE;
+			}
+
+			state_json.resize(state_json_size);
+
+			if (!input_db->read_entry(tag, hash, &state_json_size, state_json.data(), PAYLOAD_READ_NO_FLAGS))
+			{
+				LOGE("Failed to load blob from cache.\n");
+				return EXIT_FAILURE;
+			}
+
+			if (!replayer.parse(compact_replayer, input_db.get(), state_json.data(), state_json.size()))
+				LOGE("Failed to parse blob (tag: %d, hash: 0x%" PRIx64 ").\n", tag, hash);
+		}
+	}
+
+	CompactWriter writer(*input_db, *output_db);
+
+	auto *accessed_samplers = keep_unreferenced ? nullptr : &compact_replayer.accessed_samplers;
+	auto *accessed_descriptor_sets = keep_unreferenced ? nullptr : &compact_replayer.accessed_descriptor_sets;
+	auto *accessed_pipeline_layouts = keep_unreferenced ? nullptr : &compact_replayer.accessed_pipeline_layouts;
+	auto *accessed_render_passes = keep_unreferenced ? nullptr : &compact_replayer.accessed_render_passes;
+
+	unordered_set<Hash> accessed_shader_modules;
+	for (auto tag : { RESOURCE_GRAPHICS_PIPELINE, RESOURCE_COMPUTE_PIPELINE })
+		for (auto &pipeline : compact_replayer.pipeline_modules[tag])
+			accessed_shader_modules.insert(pipeline.second.begin(), pipeline.second.end());
+
+	// Links are only meaningful if the entry they refer to survives.
+	vector<Hash> links;
+	for (auto &link : compact_replayer.links)
+	{
+		bool accessed;
+		switch (link.tag)
+		{
+		case RESOURCE_SAMPLER:
+			accessed = compact_replayer.accessed_samplers.count(link.hash) != 0;
+			break;
+		case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+			accessed = compact_replayer.accessed_descriptor_sets.count(link.hash) != 0;
+			break;
+		case RESOURCE_PIPELINE_LAYOUT:
+			accessed = compact_replayer.accessed_pipeline_layouts.count(link.hash) != 0;
+			break;
+		case RESOURCE_RENDER_PASS:
+			accessed = compact_replayer.accessed_render_passes.count(link.hash) != 0;
+			break;
+		case RESOURCE_SHADER_MODULE:
+			accessed = accessed_shader_modules.count(link.hash) != 0;
+			break;
+		case RESOURCE_GRAPHICS_PIPELINE:
+		case RESOURCE_COMPUTE_PIPELINE:
+			accessed = compact_replayer.pipeline_modules[link.tag].count(link.hash) != 0;
+			break;
+		default:
+			accessed = true;
+			break;
+		}
+
+		if (keep_unreferenced || (accessed && input_db->has_entry(link.tag, link.hash)))
+			links.push_back(link.link_hash);
+	}
+	sort(links.begin(), links.end());
+	links.erase(unique(links.begin(), links.end()), links.end());
+
+	// All the small state objects go first, they are needed before any pipeline can be replayed.
+	if (!writer.copy_entries(RESOURCE_APPLICATION_INFO, hashes[RESOURCE_APPLICATION_INFO], nullptr) ||
+	    !writer.copy_entries(RESOURCE_APPLICATION_BLOB_LINK, links, nullptr) ||
+	    !writer.copy_entries(RESOURCE_SAMPLER, hashes[RESOURCE_SAMPLER], accessed_samplers) ||
+	    !writer.copy_entries(RESOURCE_DESCRIPTOR_SET_LAYOUT, hashes[RESOURCE_DESCRIPTOR_SET_LAYOUT], accessed_descriptor_sets) ||
+	    !writer.copy_entries(RESOURCE_PIPELINE_LAYOUT, hashes[RESOURCE_PIPELINE_LAYOUT], accessed_pipeline_layouts) ||
+	    !writer.copy_entries(RESOURCE_RENDER_PASS, hashes[RESOURCE_RENDER_PASS], accessed_render_passes))
+	{
+		return EXIT_FAILURE;
+	}
+
+	// Place every shader module right before the first pipeline which uses it,
+	// so that replaying pipelines in order reads the archive mostly sequentially.
+	vector<Hash> pipeline_hash(1);
+	for (auto tag : { RESOURCE_GRAPHICS_PIPELINE, RESOURCE_COMPUTE_PIPELINE })
+	{
+		auto &modules = compact_replayer.pipeline_modules[tag];
+		for (auto hash : hashes[tag])
+		{
+			auto itr = modules.find(hash);
+
+			// Pipelines which could not be parsed cannot be replayed either.
+			if (itr == modules.end())
+			{
+				LOGW("Dropping unparsable pipeline (tag: %u, hash: %016" PRIx64 ").\n", unsigned(tag), hash);
+				continue;
+			}
+
+			pipeline_hash[0] = hash;
+			if (!writer.copy_entries(RESOURCE_SHADER_MODULE, itr->second, nullptr) ||
+			    !writer.copy_entries(tag, pipeline_hash, nullptr))
+			{
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (keep_unreferenced && !writer.copy_entries(RESOURCE_SHADER_MODULE, hashes[RESOURCE_SHADER_MODULE], nullptr))
+		return EXIT_FAILURE;
+
+	// Usage counts are small and stay useful for ordering a replay, even for pipelines which were dropped.
+	if (!writer.copy_entries(RESOURCE_PIPELINE_USAGE, hashes[RESOURCE_PIPELINE_USAGE], nullptr))
+		return EXIT_FAILURE;
+
+	// Graph entries only make sense for objects which survived.
+	unordered_set<Hash> written_objects;
+	for (auto tag : { RESOURCE_DESCRIPTOR_SET_LAYOUT, RESOURCE_PIPELINE_LAYOUT,
+	                  RESOURCE_GRAPHICS_PIPELINE, RESOURCE_COMPUTE_PIPELINE })
+	{
+		written_objects.insert(writer.written[tag].begin(), writer.written[tag].end());
+	}
+
+	if (!writer.copy_entries(RESOURCE_DEPENDENCY_GRAPH, hashes[RESOURCE_DEPENDENCY_GRAPH], &written_objects))
+		return EXIT_FAILURE;
+
+	for (auto tag : playback_order)
+	{
+		LOGI("Compacted %s entries: %u -> %u entries\n", tag_names[tag],
+		     unsigned(hashes[tag].size()), unsigned(writer.written[tag].size()));
+	}
+
+	// The index footer is written when the output archive is closed.
+	output_db.reset();
+	return EXIT_SUCCESS;
+}
@@ -21,8 +21,15 @@
  */
 
 #include "fossilize_db.hpp"
+#include "fossilize.hpp"
+#include "fossilize_inttypes.h"
+#include "cli_parser.hpp"
 #include <memory>
 #include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 #include "layer/utils.hpp"
 #include <cstdlib>
 
@@ -30,35 +37,384 @@ using namespace Fossilize;
 
 static void print_help()
 {
-	LOGI("Usage: fossilize-convert-db input-db output-db\n");
+	LOGI("Usage: fossilize-convert-db\n"
+	     "\t[--compression <none|deflate|zstd|lz4>]\n"
+	     "\t[--fast]\n"
+	     "\t[--train-dictionary] (implies --compression zstd)\n"
+	     "\t[--dictionary-size <bytes>]\n"
+	     "\t[--num-threads <count>]\n"
+	     "\t[--payload-encoding <keep|json|binary>]\n"
+	     "\t[--dependency-graph]\n"
+	     "\tinput-db output-db\n");
+}
+
+// Zstandard recommends roughly 100x the dictionary size worth of samples.
+static const size_t SampleBytesPerDictionaryByte = 100;
+// Below this, training is either going to fail or not be worth it.
+static const size_t MinimumDictionarySamples = 16;
+// Entries are read in batches on all threads, then written out in order.
+static const size_t ReadBatchSize = 1024;
+
+static bool read_blob(DatabaseInterface &db, ResourceTag tag, Hash hash, std::vector<uint8_t> &blob,
+                      PayloadReadFlags flags = PAYLOAD_READ_NO_FLAGS)
+{
+	size_t blob_size = 0;
+	if (!db.read_entry(tag, hash, &blob_size, nullptr, flags))
+		return false;
+	blob.resize(blob_size);
+	if (!db.read_entry(tag, hash, &blob_size, blob.data(), flags))
+		return false;
+	return true;
+}
+
+static bool read_blobs(DatabaseInterface &db, ResourceTag tag, const Hash *hashes, size_t count,
+                       std::vector<std::vector<uint8_t>> &blobs, unsigned num_threads)
+{
+	std::atomic<size_t> next_index(0);
+	std::atomic<bool> success(true);
+
+	const auto worker = [&]() {
+		size_t index;
+		while ((index = next_index.fetch_add(1, std::memory_order_relaxed)) < count)
+		{
+			if (!read_blob(db, tag, hashes[index], blobs[index], PAYLOAD_READ_CONCURRENT_BIT))
+			{
+				success = false;
+				return;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < std::min<size_t>(num_threads, count); i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &thread : threads)
+		thread.join();
+
+	return success.load();
+}
+
+// If converter is non-null, payloads are re-encoded before they are written out.
+// Keeps the original payload if it cannot be converted, e.g. because a dependency is missing from the archive.
+static const std::vector<uint8_t> &convert_blob(PayloadConverter *converter, PayloadEncoding encoding,
+                                                ResourceTag tag, Hash hash, const std::vector<uint8_t> &blob,
+                                                std::vector<uint8_t> &converted)
+{
+	if (!converter)
+		return blob;
+
+	if (!converter->convert(tag, blob.data(), blob.size(), encoding))
+	{
+		LOGW("Failed to convert payload %016" PRIx64 " of tag %u, keeping it as-is.\n", hash, unsigned(tag));
+		return blob;
+	}
+
+	auto *data = static_cast<const uint8_t *>(converter->get_data());
+	converted.assign(data, data + converter->get_size());
+	return converted;
+}
+
+// Refers to every object by its hash, which is the form DependencyGraph expects.
+struct DependencyGraphBuilder : StateCreatorInterface
+{
+	ResourceTag tag = RESOURCE_COUNT;
+	Hash hash = 0;
+	const void *create_info = nullptr;
+
+	template <typename T, typename Handle>
+	bool capture(ResourceTag tag_, Hash hash_, const T *create_info_, Handle *handle)
+	{
+		tag = tag_;
+		hash = hash_;
+		create_info = create_info_;
+		*handle = (Handle)hash_;
+		return true;
+	}
+
+	bool enqueue_create_sampler(Hash hash_, const VkSamplerCreateInfo *info, VkSampler *sampler) override
+	{
+		return capture(RESOURCE_SAMPLER, hash_, info, sampler);
+	}
+
+	bool enqueue_create_descriptor_set_layout(Hash hash_, const VkDescriptorSetLayoutCreateInfo *info, VkDescriptorSetLayout *layout) override
+	{
+		return capture(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash_, info, layout);
+	}
+
+	bool enqueue_create_pipeline_layout(Hash hash_, const VkPipelineLayoutCreateInfo *info, VkPipelineLayout *layout) override
+	{
+		return capture(RESOURCE_PIPELINE_LAYOUT, hash_, info, layout);
+	}
+
+	bool enqueue_create_shader_module(Hash hash_, const VkShaderModuleCreateInfo *info, VkShaderModule *module) override
+	{
+		return capture(RESOURCE_SHADER_MODULE, hash_, info, module);
+	}
+
+	bool enqueue_create_render_pass(Hash hash_, const VkRenderPassCreateInfo *info, VkRenderPass *render_pass) override
+	{
+		return capture(RESOURCE_RENDER_PASS, hash_, info, render_pass);
+	}
+
+	bool enqueue_create_compute_pipeline(Hash hash_, const VkComputePipelineCreateInfo *info, VkPipeline *pipeline) override
+	{
+		return capture(RESOURCE_COMPUTE_PIPELINE, hash_, info, pipeline);
+	}
+
+	bool enqueue_create_graphics_pipeline(Hash hash_, const VkGraphicsPipelineCreateInfo *info, VkPipeline *pipeline) override
+	{
+		return capture(RESOURCE_GRAPHICS_PIPELINE, hash_, info, pipeline);
+	}
+};
+
+struct GraphEntry
+{
+	Hash hash;
+	std::vector<uint8_t> blob;
+};
+
+// Objects are parsed in tag order, so everything they refer to has been seen by the replayer already.
+static void build_dependency_graph_entry(StateReplayer &replayer, DependencyGraphBuilder &builder, ResourceTag tag,
+                                         Hash hash, const std::vector<uint8_t> &blob, std::vector<GraphEntry> &entries)
+{
+	// Samplers and render passes refer to nothing, but later objects refer to them.
+	if (tag == RESOURCE_SAMPLER || tag == RESOURCE_RENDER_PASS)
+	{
+		if (!replayer.parse(builder, nullptr, blob.data(), blob.size()))
+			LOGW("Failed to parse payload %016" PRIx64 " of tag %u.\n", hash, unsigned(tag));
+		replayer.get_allocator().reset();
+		return;
+	}
+
+	if (tag != RESOURCE_DESCRIPTOR_SET_LAYOUT && tag != RESOURCE_PIPELINE_LAYOUT &&
+	    tag != RESOURCE_GRAPHICS_PIPELINE && tag != RESOURCE_COMPUTE_PIPELINE)
+	{
+		return;
+	}
+
+	builder.tag = RESOURCE_COUNT;
+	if (!replayer.parse(builder, nullptr, blob.data(), blob.size()) || builder.tag != tag || builder.hash != hash)
+	{
+		LOGW("Failed to parse payload %016" PRIx64 " of tag %u, it gets no dependency graph entry.\n",
+		     hash, unsigned(tag));
+		replayer.get_allocator().reset();
+		return;
+	}
+
+	std::vector<DependencyGraph::Dependency> deps;
+	size_t count = 0;
+	if (DependencyGraph::get_dependencies(tag, builder.create_info, &count, nullptr))
+	{
+		deps.resize(count);
+		if (!count || DependencyGraph::get_dependencies(tag, builder.create_info, &count, deps.data()))
+		{
+			GraphEntry entry = { hash, std::vector<uint8_t>(DependencyGraph::compute_entry_size(count)) };
+			DependencyGraph::encode_entry(tag, deps.data(), count, entry.blob.data());
+			entries.push_back(std::move(entry));
+		}
+	}
+
+	replayer.get_allocator().reset();
+}
+
+static bool train_dictionaries(DatabaseInterface &input_db, DatabaseInterface &output_db, size_t dictionary_size,
+                               PayloadConverter *converter, PayloadEncoding encoding)
+{
+	std::vector<uint8_t> dictionary(dictionary_size);
+	std::vector<uint8_t> samples;
+	std::vector<size_t> sample_sizes;
+	std::vector<uint8_t> blob;
+	std::vector<uint8_t> converted;
+
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		auto tag = static_cast<ResourceTag>(i);
+
+		size_t hash_count = 0;
+		if (!input_db.get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!input_db.get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			return false;
+
+		samples.clear();
+		sample_sizes.clear();
+		for (auto &hash : hashes)
+		{
+			bool enough_samples = samples.size() >= dictionary_size * SampleBytesPerDictionaryByte;
+			// Later tags can only be converted once everything they reference has been.
+			if (enough_samples && !converter)
+				break;
+			if (!read_blob(input_db, tag, hash, blob))
+				return false;
+			auto &sample = convert_blob(converter, encoding, tag, hash, blob, converted);
+			if (enough_samples)
+				continue;
+			samples.insert(samples.end(), sample.begin(), sample.end());
+			sample_sizes.push_back(sample.size());
+		}
+
+		if (sample_sizes.size() < MinimumDictionarySamples)
+			continue;
+
+		size_t size = train_compression_dictionary(samples.data(), sample_sizes.data(), unsigned(sample_sizes.size()),
+		                                           dictionary.data(), dictionary.size());
+		if (!size)
+		{
+			LOGW("Could not train compression dictionary for tag %u, skipping.\n", i);
+			continue;
+		}
+
+		if (!output_db.add_compression_dictionary(tag, dictionary.data(), size))
+		{
+			LOGE("Failed to add compression dictionary for tag %u.\n", i);
+			return false;
+		}
+
+		LOGI("Trained %u byte compression dictionary for tag %u from %u samples.\n",
+		     unsigned(size), i, unsigned(sample_sizes.size()));
+	}
+
+	return true;
 }
 
 int main(int argc, char *argv[])
 {
-	if (argc != 3)
+	CLICallbacks cbs;
+	std::vector<std::string> paths;
+	std::string compression = "deflate";
+	bool fast = false;
+	bool train_dictionary = false;
+	size_t dictionary_size = 112 * 1024;
+	unsigned num_threads = 0;
+	std::string payload_encoding = "keep";
+	bool dependency_graph = false;
+
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--compression", [&](CLIParser &parser) { compression = parser.next_string(); });
+	cbs.add("--fast", [&](CLIParser &) { fast = true; });
+	cbs.add("--train-dictionary", [&](CLIParser &) { train_dictionary = true; });
+	cbs.add("--dictionary-size", [&](CLIParser &parser) { dictionary_size = parser.next_uint(); });
+	cbs.add("--num-threads", [&](CLIParser &parser) { num_threads = parser.next_uint(); });
+	cbs.add("--payload-encoding", [&](CLIParser &parser) { payload_encoding = parser.next_string(); });
+	cbs.add("--dependency-graph", [&](CLIParser &) { dependency_graph = true; });
+	cbs.default_handler = [&](const char *arg) { paths.push_back(arg); };
+	cbs.error_handler = [] { print_help(); };
+
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (paths.size() != 2)
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	if (train_dictionary)
+		compression = "zstd";
+
+	if (train_dictionary && dictionary_size == 0)
+	{
+		LOGE("Dictionary size must be non-zero.\n");
+		return EXIT_FAILURE;
+	}
+
+	PayloadWriteFlags write_flags = PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+	if (!fast)
+		write_flags |= PAYLOAD_WRITE_BEST_COMPRESSION_BIT;
+
+	if (compression == "deflate")
+		write_flags |= PAYLOAD_WRITE_COMPRESS_BIT;
+	else if (compression == "zstd")
+		write_flags |= PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPRESS_ZSTD_BIT;
+	else if (compression == "lz4")
+		write_flags |= PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPRESS_LZ4_BIT;
+	else if (compression != "none")
 	{
+		LOGE("Unknown compression algorithm: %s\n", compression.c_str());
 		print_help();
 		return EXIT_FAILURE;
 	}
 
-	auto input_db = std::unique_ptr<DatabaseInterface>(create_database(argv[1], DatabaseMode::ReadOnly));
-	auto output_db = std::unique_ptr<DatabaseInterface>(create_database(argv[2], DatabaseMode::OverWrite));
+	bool convert_payloads = payload_encoding != "keep";
+	PayloadEncoding encoding = PayloadEncoding::JSON;
+	if (payload_encoding == "binary")
+		encoding = PayloadEncoding::Binary;
+	else if (convert_payloads && payload_encoding != "json")
+	{
+		LOGE("Unknown payload encoding: %s\n", payload_encoding.c_str());
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	auto input_db = std::unique_ptr<DatabaseInterface>(create_database(paths[0].c_str(), DatabaseMode::ReadOnly));
+	auto output_db = std::unique_ptr<DatabaseInterface>(create_database(paths[1].c_str(), DatabaseMode::OverWrite));
+
+	// Only stream archives compress on background threads, other backends keep writing synchronously.
+	if (output_db && num_threads > 1)
+	{
+		DatabaseAsyncWritePolicy policy;
+		policy.compression_threads = num_threads;
+		output_db->set_async_write_policy(policy);
+	}
+
 	if (!input_db || !input_db->prepare())
 	{
-		LOGE("Failed to load database: %s\n", argv[1]);
+		LOGE("Failed to load database: %s\n", paths[0].c_str());
 		return EXIT_FAILURE;
 	}
 
 	if (!output_db || !output_db->prepare())
 	{
-		LOGE("Failed to open database for writing: %s\n", argv[2]);
+		LOGE("Failed to open database for writing: %s\n", paths[1].c_str());
 		return EXIT_FAILURE;
 	}
 
+	// Dictionaries must be added before any other entry is written.
+	if (train_dictionary)
+	{
+		std::unique_ptr<PayloadConverter> converter;
+		if (convert_payloads)
+			converter.reset(new PayloadConverter);
+		if (!train_dictionaries(*input_db, *output_db, dictionary_size, converter.get(), encoding))
+			return EXIT_FAILURE;
+	}
+
+	// Conversion resolves references between objects, so it runs in order on this thread.
+	std::unique_ptr<PayloadConverter> converter;
+	if (convert_payloads)
+		converter.reset(new PayloadConverter);
+
+	std::vector<std::vector<uint8_t>> blobs(ReadBatchSize);
+	std::vector<uint8_t> converted;
+
+	// Graph entries are generated from the payloads, and replace any the input had.
+	StateReplayer graph_replayer;
+	DependencyGraphBuilder graph_builder;
+	std::vector<GraphEntry> graph_entries;
+	graph_replayer.set_resolve_shader_module_handles(false);
+	graph_replayer.set_resolve_derivative_pipeline_handles(false);
+
 	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
 	{
 		auto tag = static_cast<ResourceTag>(i);
 
+		if (dependency_graph && tag == RESOURCE_DEPENDENCY_GRAPH)
+		{
+			for (auto &entry : graph_entries)
+				if (!output_db->write_entry(tag, entry.hash, entry.blob.data(), entry.blob.size(), write_flags))
+					return EXIT_FAILURE;
+			LOGI("Wrote %u dependency graph entries.\n", unsigned(graph_entries.size()));
+			continue;
+		}
+
 		size_t hash_count = 0;
 		if (!input_db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
 			return EXIT_FAILURE;
@@ -66,21 +422,20 @@ int main(int argc, char *argv[])
 		if (!input_db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
 			return EXIT_FAILURE;
 
-		for (auto &hash : hashes)
+		for (size_t base = 0; base < hashes.size(); base += ReadBatchSize)
 		{
-			size_t blob_size = 0;
-			if (!input_db->read_entry(tag, hash, &blob_size, nullptr, PAYLOAD_READ_NO_FLAGS))
-				return EXIT_FAILURE;
-			std::vector<uint8_t> blob(blob_size);
-			if (!input_db->read_entry(tag, hash, &blob_size, blob.data(), PAYLOAD_READ_NO_FLAGS))
+			size_t count = std::min(ReadBatchSize, hashes.size() - base);
+			if (!read_blobs(*input_db, tag, hashes.data() + base, count, blobs, num_threads))
 				return EXIT_FAILURE;
 
-			if (!output_db->write_entry(tag, hash, blob.data(), blob.size(),
-					PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT |
-					PAYLOAD_WRITE_COMPRESS_BIT |
-					PAYLOAD_WRITE_BEST_COMPRESSION_BIT))
+			for (size_t j = 0; j < count; j++)
 			{
-				return EXIT_FAILURE;
+				if (dependency_graph)
+					build_dependency_graph_entry(graph_replayer, graph_builder, tag, hashes[base + j], blobs[j], graph_entries);
+
+				auto &blob = convert_blob(converter.get(), encoding, tag, hashes[base + j], blobs[j], converted);
+				if (!output_db->write_entry(tag, hashes[base + j], blob.data(), blob.size(), write_flags))
+					return EXIT_FAILURE;
 			}
 		}
 	}
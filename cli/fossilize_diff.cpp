@@ -0,0 +1,75 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fossilize_inttypes.h"
+#include "fossilize_db.hpp"
+#include "cli_parser.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+#include "layer/utils.hpp"
+#include <cstdlib>
+
+using namespace Fossilize;
+
+static void print_help()
+{
+	LOGI("Usage: fossilize-diff\n"
+	     "\t[--help]\n"
+	     "\t--output-db <delta.foz>\n"
+	     "\tbase.foz [base-delta1.foz] ... new.foz\n");
+}
+
+int main(int argc, char **argv)
+{
+	CLICallbacks cbs;
+	std::vector<const char *> paths;
+	std::string output_db_path;
+
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--output-db", [&](CLIParser &parser) { output_db_path = parser.next_string(); });
+	cbs.default_handler = [&](const char *arg) { paths.push_back(arg); };
+	cbs.error_handler = [] { print_help(); };
+
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (paths.size() < 2 || output_db_path.empty())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	DatabaseDiffStatistics stats = {};
+	if (!diff_concurrent_databases(output_db_path.c_str(), paths.data(), paths.size() - 1, paths.back(), &stats))
+	{
+		LOGE("Failed to write delta archive %s.\n", output_db_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	LOGI("Wrote %" PRIu64 " of %" PRIu64 " entries (%" PRIu64 " payload bytes) to %s.\n",
+	     stats.delta_entry_count, stats.new_entry_count, stats.delta_payload_bytes, output_db_path.c_str());
+	return EXIT_SUCCESS;
+}
@@ -31,6 +31,9 @@
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <stdlib.h>
 #include <string.h>
 #include "fossilize_inttypes.h"
@@ -79,12 +82,6 @@ struct DisasmReplayer : StateCreatorInterface
 			for (auto &render_pass : render_passes)
 				if (render_pass)
 					vkDestroyRenderPass(device->get_device(), render_pass, nullptr);
-			for (auto &pipeline : compute_pipelines)
-				if (pipeline)
-					vkDestroyPipeline(device->get_device(), pipeline, nullptr);
-			for (auto &pipeline : graphics_pipelines)
-				if (pipeline)
-					vkDestroyPipeline(device->get_device(), pipeline, nullptr);
 		}
 	}
 
@@ -190,26 +187,10 @@ struct DisasmReplayer : StateCreatorInterface
 		return true;
 	}
 
+	// Pipelines are only compiled once they are disassembled, see create_pipeline().
 	bool enqueue_create_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline) override
 	{
-		if (device)
-		{
-			if (device->has_pipeline_stats())
-				const_cast<VkComputePipelineCreateInfo *>(create_info)->flags |= VK_PIPELINE_CREATE_CAPTURE_INTERNAL_REPRESENTATIONS_BIT_KHR;
-
-			LOGI("Creating compute pipeline %0" PRIX64 "\n", hash);
-			if (vkCreateComputePipelines(device->get_device(), pipeline_cache, 1, create_info, nullptr, pipeline) !=
-			    VK_SUCCESS)
-			{
-				LOGE(" ... Failed!\n");
-				return false;
-			}
-			LOGI(" ... Succeeded!\n");
-		}
-		else
-			*pipeline = fake_handle<VkPipeline>(hash);
-
-		compute_pipelines.push_back(*pipeline);
+		*pipeline = fake_handle<VkPipeline>(hash);
 		compute_infos.push_back(create_info);
 		compute_hashes.push_back(hash);
 		return true;
@@ -217,29 +198,33 @@ struct DisasmReplayer : StateCreatorInterface
 
 	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline) override
 	{
-		if (device)
-		{
-			if (device->has_pipeline_stats())
-				const_cast<VkGraphicsPipelineCreateInfo *>(create_info)->flags |= VK_PIPELINE_CREATE_CAPTURE_INTERNAL_REPRESENTATIONS_BIT_KHR;
-
-			LOGI("Creating graphics pipeline %0" PRIX64 "\n", hash);
-			if (vkCreateGraphicsPipelines(device->get_device(), pipeline_cache, 1, create_info, nullptr, pipeline) !=
-			    VK_SUCCESS)
-			{
-				LOGE(" ... Failed!\n");
-				return false;
-			}
-			LOGI(" ... Succeeded!\n");
-		}
-		else
-			*pipeline = fake_handle<VkPipeline>(hash);
-
-		graphics_pipelines.push_back(*pipeline);
+		*pipeline = fake_handle<VkPipeline>(hash);
 		graphics_infos.push_back(create_info);
 		graphics_hashes.push_back(hash);
 		return true;
 	}
 
+	// Can be called from any thread. Derivative parents are only a hint for the driver, and they are compiled
+	// on other threads, if at all, so pipelines are compiled on their own.
+	template <typename CreateInfo, typename CreateFunc>
+	VkPipeline create_pipeline(Hash hash, const CreateInfo *create_info, CreateFunc create_func) const
+	{
+		auto info = *create_info;
+		info.flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+		info.basePipelineHandle = VK_NULL_HANDLE;
+		info.basePipelineIndex = -1;
+		if (device->has_pipeline_stats())
+			info.flags |= VK_PIPELINE_CREATE_CAPTURE_INTERNAL_REPRESENTATIONS_BIT_KHR;
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		if (create_func(device->get_device(), pipeline_cache, 1, &info, nullptr, &pipeline) != VK_SUCCESS)
+		{
+			LOGE("Failed to create pipeline %016" PRIx64 ".\n", hash);
+			return VK_NULL_HANDLE;
+		}
+		return pipeline;
+	}
+
 	const VulkanDevice *device;
 
 	vector<const VkSamplerCreateInfo *> sampler_infos;
@@ -260,8 +245,6 @@ struct DisasmReplayer : StateCreatorInterface
 	vector<VkPipelineLayout> pipeline_layouts;
 	vector<VkShaderModule> shader_modules;
 	vector<VkRenderPass> render_passes;
-	vector<VkPipeline> compute_pipelines;
-	vector<VkPipeline> graphics_pipelines;
 	VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
 };
 
@@ -522,6 +505,7 @@ static void print_help()
 	     "\t[--output <path>]\n"
 	     "\t[--target asm/glsl/isa]\n"
 	     "\t[--module-only]\n"
+	     "\t[--num-threads <count>]\n"
 	     "state.json\n");
 }
 
@@ -532,6 +516,44 @@ static string uint64_string(uint64_t value)
 	return string(str);
 }
 
+// Runs func(index) for every index on num_threads threads, and stops early once func fails.
+template <typename Func>
+static bool run_parallel(size_t count, unsigned num_threads, const Func &func)
+{
+	std::atomic<size_t> next_index(0);
+	std::atomic<bool> success(true);
+
+	const auto worker = [&]() {
+		size_t index;
+		while (success.load(std::memory_order_relaxed) &&
+		       (index = next_index.fetch_add(1, std::memory_order_relaxed)) < count)
+		{
+			if (!func(index))
+				success = false;
+		}
+	};
+
+	vector<thread> threads;
+	for (size_t i = 1; i < std::min<size_t>(num_threads, count); i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &t : threads)
+		t.join();
+
+	return success.load();
+}
+
+static bool write_disassembly(const string &path, const string &disassembled)
+{
+	LOGI("Dumping disassembly to: %s\n", path.c_str());
+	if (!write_string_to_file(path.c_str(), disassembled.c_str()))
+	{
+		LOGE("Failed to write disassembly to file: %s\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
 static string stage_to_string(VkShaderStageFlagBits stage)
 {
 	switch (stage)
@@ -560,6 +582,7 @@ int main(int argc, char *argv[])
 	VulkanDevice::Options opts;
 	DisasmMethod method = DisasmMethod::Asm;
 	bool module_only = false;
+	unsigned num_threads = 0;
 
 	CLICallbacks cbs;
 	cbs.default_handler = [&](const char *arg) { json_path = arg; };
@@ -571,6 +594,7 @@ int main(int argc, char *argv[])
 		method = method_from_string(parser.next_string());
 	});
 	cbs.add("--module-only", [&](CLIParser &) { module_only = true; });
+	cbs.add("--num-threads", [&](CLIParser &parser) { num_threads = parser.next_uint(); });
 	cbs.error_handler = [] { print_help(); };
 
 	CLIParser parser(move(cbs), argc - 1, argv + 1);
@@ -586,6 +610,9 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
 	VulkanDevice device;
 	if (method == DisasmMethod::ISA)
 	{
@@ -613,6 +640,8 @@ int main(int argc, char *argv[])
 
 	DisasmReplayer replayer(device.get_device() ? &device : nullptr);
 	StateReplayer state_replayer;
+	// Pipelines are created on their own later, so parents need not be resolved.
+	state_replayer.set_resolve_derivative_pipeline_handles(false);
 	auto resolver = unique_ptr<DatabaseInterface>(create_database(json_path.c_str(), DatabaseMode::ReadOnly));
 	if (!resolver->prepare())
 	{
@@ -688,86 +717,145 @@ int main(int argc, char *argv[])
 		LOGI("Replayed tag: %s\n", tag_names[tag]);
 	}
 
+	// SPIR-V disassembly only depends on the module, and for GLSL on the entry point as well,
+	// so every distinct module is disassembled once and written out for each pipeline which uses it.
+	struct ModuleOutput
+	{
+		unsigned module_index;
+		const char *entry_point;
+		VkShaderStageFlagBits stage;
+		vector<string> paths;
+	};
+
+	vector<ModuleOutput> module_outputs;
+	unordered_map<string, size_t> module_output_index;
 	unordered_set<VkShaderModule> unique_shader_modules;
 
+	const auto add_module_output = [&](VkShaderModule module, const char *entry_point, VkShaderStageFlagBits stage,
+	                                   string path) {
+		unique_shader_modules.insert(module);
+		unsigned index = replayer.module_to_index[module];
+
+		string key = uint64_string(replayer.module_hashes[index]);
+		if (method == DisasmMethod::GLSL && entry_point)
+			key += string(".") + entry_point + "." + stage_to_string(stage);
+
+		auto itr = module_output_index.find(key);
+		if (itr == module_output_index.end())
+		{
+			itr = module_output_index.insert({ key, module_outputs.size() }).first;
+			module_outputs.push_back({ index, entry_point, stage, {} });
+		}
+		module_outputs[itr->second].paths.push_back(move(path));
+	};
+
+	const auto disassemble_module = [&](size_t i) -> bool {
+		auto &module_output = module_outputs[i];
+		auto *module_info = replayer.shader_module_infos[module_output.module_index];
+		string disassembled = disassemble_spirv(device, VK_NULL_HANDLE, method, module_output.stage,
+		                                        module_info, module_output.entry_point);
+		for (auto &path : module_output.paths)
+			if (!write_disassembly(path, disassembled))
+				return false;
+		return true;
+	};
+
 	if (module_only)
 	{
-		string disassembled;
 		size_t module_count = replayer.shader_module_infos.size();
 		for (size_t i = 0; i < module_count; i++)
 		{
-			auto *module_info = replayer.shader_module_infos[i];
-			disassembled = disassemble_spirv(device, VK_NULL_HANDLE, method, VK_SHADER_STAGE_ALL,
-			                                 module_info, nullptr);
-
-			auto module_hash = replayer.module_hashes[i];
-			string path = output + "/" + uint64_string(module_hash);
-
-			LOGI("Dumping disassembly to: %s\n", path.c_str());
-			if (!write_string_to_file(path.c_str(), disassembled.c_str()))
-			{
-				LOGE("Failed to write disassembly to file: %s\n", output.c_str());
-				return EXIT_FAILURE;
-			}
+			add_module_output(replayer.shader_modules[i], nullptr, VK_SHADER_STAGE_ALL,
+			                  output + "/" + uint64_string(replayer.module_hashes[i]));
 		}
+
+		if (!run_parallel(module_outputs.size(), num_threads, disassemble_module))
+			return EXIT_FAILURE;
 	}
 	else
 	{
-		string disassembled;
+		const auto stage_path = [&](VkShaderModule module, const char *entry_point, VkShaderStageFlagBits stage, Hash pipeline_hash) {
+			Hash module_hash = replayer.module_hashes[replayer.module_to_index.find(module)->second];
+			return output + "/" + uint64_string(module_hash) + "." + entry_point + "." +
+			       uint64_string(pipeline_hash) + "." + stage_to_string(stage);
+		};
+
 		size_t graphics_pipeline_count = replayer.graphics_infos.size();
-		for (size_t i = 0; i < graphics_pipeline_count; i++)
+		size_t compute_pipeline_count = replayer.compute_infos.size();
+
+		if (method == DisasmMethod::ISA)
 		{
-			auto *info = replayer.graphics_infos[i];
-			for (uint32_t j = 0; j < info->stageCount; j++)
-			{
-				VkShaderModule module = info->pStages[j].module;
-				unique_shader_modules.insert(module);
-				unsigned index = replayer.module_to_index[module];
-				auto *module_info = replayer.shader_module_infos[index];
-				disassembled = disassemble_spirv(device, replayer.graphics_pipelines[i], method, info->pStages[j].stage,
-				                                 module_info, info->pStages[j].pName);
-
-				Hash module_hash = replayer.module_hashes[index];
-
-				string path = output + "/" + uint64_string(module_hash) + "." +
-				              info->pStages[j].pName + "." +
-				              uint64_string(replayer.graphics_hashes[i]) +
-				              "." + stage_to_string(info->pStages[j].stage);
-
-				LOGI("Dumping disassembly to: %s\n", path.c_str());
-				if (!write_string_to_file(path.c_str(), disassembled.c_str()))
+			// ISA is specific to each pipeline, so compile and disassemble pipelines on all threads.
+			// Pipelines are destroyed right after, so only a few are alive at any time.
+			bool success = run_parallel(graphics_pipeline_count + compute_pipeline_count, num_threads, [&](size_t i) -> bool {
+				if (i < graphics_pipeline_count)
 				{
-					LOGE("Failed to write disassembly to file: %s\n", output.c_str());
-					return EXIT_FAILURE;
+					auto *info = replayer.graphics_infos[i];
+					VkPipeline pipeline = replayer.create_pipeline(replayer.graphics_hashes[i], info, vkCreateGraphicsPipelines);
+					if (pipeline == VK_NULL_HANDLE)
+						return false;
+
+					bool ret = true;
+					for (uint32_t j = 0; ret && j < info->stageCount; j++)
+					{
+						auto &stage = info->pStages[j];
+						string disassembled = disassemble_spirv_isa(device, pipeline, stage.stage);
+						ret = write_disassembly(stage_path(stage.module, stage.pName, stage.stage, replayer.graphics_hashes[i]),
+						                        disassembled);
+					}
+
+					vkDestroyPipeline(device.get_device(), pipeline, nullptr);
+					return ret;
 				}
-			}
-		}
+				else
+				{
+					i -= graphics_pipeline_count;
+					auto *info = replayer.compute_infos[i];
+					VkPipeline pipeline = replayer.create_pipeline(replayer.compute_hashes[i], info, vkCreateComputePipelines);
 
-		size_t compute_pipeline_count = replayer.compute_infos.size();
-		for (size_t i = 0; i < compute_pipeline_count; i++)
-		{
-			auto *info = replayer.compute_infos[i];
-			VkShaderModule module = info->stage.module;
-			unique_shader_modules.insert(module);
+					if (pipeline == VK_NULL_HANDLE)
+						return false;
 
-			unsigned index = replayer.module_to_index[module];
-			auto *module_info = replayer.shader_module_infos[index];
-			disassembled = disassemble_spirv(device, replayer.compute_pipelines[i], method, info->stage.stage,
-			                                 module_info, info->stage.pName);
+					string disassembled = disassemble_spirv_isa(device, pipeline, info->stage.stage);
+					bool ret = write_disassembly(stage_path(info->stage.module, info->stage.pName, info->stage.stage,
+					                                        replayer.compute_hashes[i]), disassembled);
 
-			Hash module_hash = replayer.module_hashes[index];
+					vkDestroyPipeline(device.get_device(), pipeline, nullptr);
+					return ret;
+				}
+			});
 
-			string path = output + "/" + uint64_string(module_hash) + "." +
-			              info->stage.pName + "." +
-			              uint64_string(replayer.compute_hashes[i]) +
-			              "." + stage_to_string(info->stage.stage);
+			if (!success)
+				return EXIT_FAILURE;
 
-			LOGI("Dumping disassembly to: %s\n", path.c_str());
-			if (!write_string_to_file(path.c_str(), disassembled.c_str()))
+			for (auto *info : replayer.graphics_infos)
+				for (uint32_t j = 0; j < info->stageCount; j++)
+					unique_shader_modules.insert(info->pStages[j].module);
+			for (auto *info : replayer.compute_infos)
+				unique_shader_modules.insert(info->stage.module);
+		}
+		else
+		{
+			for (size_t i = 0; i < graphics_pipeline_count; i++)
 			{
-				LOGE("Failed to write disassembly to file: %s\n", output.c_str());
-				return EXIT_FAILURE;
+				auto *info = replayer.graphics_infos[i];
+				for (uint32_t j = 0; j < info->stageCount; j++)
+				{
+					auto &stage = info->pStages[j];
+					add_module_output(stage.module, stage.pName, stage.stage,
+					                  stage_path(stage.module, stage.pName, stage.stage, replayer.graphics_hashes[i]));
+				}
 			}
+
+			for (size_t i = 0; i < compute_pipeline_count; i++)
+			{
+				auto &stage = replayer.compute_infos[i]->stage;
+				add_module_output(stage.module, stage.pName, stage.stage,
+				                  stage_path(stage.module, stage.pName, stage.stage, replayer.compute_hashes[i]));
+			}
+
+			if (!run_parallel(module_outputs.size(), num_threads, disassemble_module))
+				return EXIT_FAILURE;
 		}
 
 		LOGI("Shader modules used: %u, shader modules in database: %u\n",
@@ -25,9 +25,9 @@
 #include "spirv.hpp"
 #include "logging.hpp"
 #include <string.h>
-#include <unordered_set>
-#include <string>
+#include <stddef.h>
 #include <algorithm>
+#include <bitset>
 
 namespace Fossilize
 {
@@ -122,6 +122,58 @@ void *build_pnext_chain(VulkanProperties &props)
 	return pNext;
 }
 
+// Every extension the filter checks for. Support is resolved once in init() rather than by string lookups per object.
+#define FOSSILIZE_FILTER_EXTENSIONS(X) \
+	X(AMD_GPU_SHADER_HALF_FLOAT) \
+	X(AMD_SHADER_BALLOT) \
+	X(AMD_SHADER_FRAGMENT_MASK) \
+	X(AMD_SHADER_IMAGE_LOAD_STORE_LOD) \
+	X(AMD_TEXTURE_GATHER_BIAS_LOD) \
+	X(EXT_CONSERVATIVE_RASTERIZATION) \
+	X(EXT_DEPTH_CLIP_ENABLE) \
+	X(EXT_DESCRIPTOR_INDEXING) \
+	X(EXT_DISCARD_RECTANGLES) \
+	X(EXT_EXTENDED_DYNAMIC_STATE) \
+	X(EXT_LINE_RASTERIZATION) \
+	X(EXT_POST_DEPTH_COVERAGE) \
+	X(EXT_SAMPLE_LOCATIONS) \
+	X(EXT_SCALAR_BLOCK_LAYOUT) \
+	X(EXT_SHADER_STENCIL_EXPORT) \
+	X(EXT_SHADER_SUBGROUP_BALLOT) \
+	X(EXT_SHADER_SUBGROUP_VOTE) \
+	X(EXT_SHADER_VIEWPORT_INDEX_LAYER) \
+	X(EXT_VERTEX_ATTRIBUTE_DIVISOR) \
+	X(KHR_MAINTENANCE2) \
+	X(KHR_SHADER_CLOCK) \
+	X(KHR_SHADER_DRAW_PARAMETERS) \
+	X(KHR_SPIRV_1_4) \
+	X(NVX_MULTIVIEW_PER_VIEW_ATTRIBUTES) \
+	X(NV_CLIP_SPACE_W_SCALING) \
+	X(NV_GEOMETRY_SHADER_PASSTHROUGH) \
+	X(NV_MESH_SHADER) \
+	X(NV_RAY_TRACING) \
+	X(NV_SAMPLE_MASK_OVERRIDE_COVERAGE) \
+	X(NV_SCISSOR_EXCLUSIVE) \
+	X(NV_SHADING_RATE_IMAGE) \
+	X(NV_VIEWPORT_ARRAY2)
+
+enum class Extension
+{
+#define X(name) name,
+	FOSSILIZE_FILTER_EXTENSIONS(X)
+#undef X
+	Count
+};
+
+static const char *extension_names[] = {
+#define X(name) VK_##name##_EXTENSION_NAME,
+	FOSSILIZE_FILTER_EXTENSIONS(X)
+#undef X
+};
+
+// Bump when the filter logic changes, so memoized results from older versions are not reused.
+static const uint64_t FeatureFilterVersion = 1;
+
 struct FeatureFilter::Impl
 {
 	bool init(uint32_t api_version, const char **device_exts, unsigned count,
@@ -136,7 +188,15 @@ struct FeatureFilter::Impl
 	bool graphics_pipeline_is_supported(const VkGraphicsPipelineCreateInfo *info) const;
 	bool compute_pipeline_is_supported(const VkComputePipelineCreateInfo *info) const;
 
-	std::unordered_set<std::string> enabled_extensions;
+	std::bitset<size_t(Extension::Count)> enabled_extensions;
+	uint64_t fingerprint = 0;
+
+	bool has_extension(Extension ext) const
+	{
+		return enabled_extensions.test(size_t(ext));
+	}
+
+	void compute_fingerprint();
 
 	uint32_t api_version = 0;
 	VkPhysicalDeviceProperties2 props2 = {};
@@ -268,21 +328,117 @@ bool FeatureFilter::Impl::init(uint32_t api_version_, const char **device_exts,
 {
 	for (unsigned i = 0; i < count; i++)
 	{
-		enabled_extensions.insert(device_exts[i]);
-		if (strcmp(device_exts[i], VK_EXT_SCALAR_BLOCK_LAYOUT_EXTENSION_NAME) == 0)
-			supports_scalar_block_layout = true;
+		for (size_t ext = 0; ext < size_t(Extension::Count); ext++)
+		{
+			if (strcmp(device_exts[i], extension_names[ext]) == 0)
+			{
+				enabled_extensions.set(ext);
+				break;
+			}
+		}
 	}
 
+	supports_scalar_block_layout = has_extension(Extension::EXT_SCALAR_BLOCK_LAYOUT);
 	api_version = api_version_;
 	props2 = *properties;
+	props2.pNext = nullptr;
 	features2 = *enabled_features;
+	features2.pNext = nullptr;
 
 	init_features(enabled_features->pNext);
 	init_properties(properties->pNext);
+	compute_fingerprint();
 
 	return true;
 }
 
+namespace
+{
+struct FingerprintHasher
+{
+	// FNV-1a, the fingerprint only needs to tell devices apart.
+	uint64_t h = 0xcbf29ce484222325ull;
+
+	void data(const void *data_, size_t size)
+	{
+		auto *bytes = static_cast<const uint8_t *>(data_);
+		for (size_t i = 0; i < size; i++)
+			h = (h ^ bytes[i]) * 0x100000001b3ull;
+	}
+
+	void u64(uint64_t v)
+	{
+		data(&v, sizeof(v));
+	}
+
+	// Skips sType and pNext.
+	template <typename T>
+	void feature_struct(const T &t)
+	{
+		size_t offset = offsetof(T, pNext) + sizeof(t.pNext);
+		data(reinterpret_cast<const uint8_t *>(&t) + offset, sizeof(T) - offset);
+	}
+};
+}
+
+void FeatureFilter::Impl::compute_fingerprint()
+{
+	FingerprintHasher h;
+	h.u64(FeatureFilterVersion);
+	h.u64(api_version);
+	for (size_t ext = 0; ext < size_t(Extension::Count); ext++)
+		h.u64(enabled_extensions.test(ext) ? 1 : 0);
+	h.data(&features2.features, sizeof(features2.features));
+	h.data(&props2.properties.limits, sizeof(props2.properties.limits));
+	h.u64(props2.properties.vendorID);
+	h.u64(props2.properties.deviceID);
+	h.u64(props2.properties.driverVersion);
+
+	h.feature_struct(features.storage_16bit);
+	h.feature_struct(features.multiview);
+	h.feature_struct(features.variable_pointers);
+	h.feature_struct(features.ycbcr_conversion);
+	h.feature_struct(features.draw_parameters);
+	h.feature_struct(features.storage_8bit);
+	h.feature_struct(features.atomic_int64);
+	h.feature_struct(features.float16_int8);
+	h.feature_struct(features.descriptor_indexing);
+	h.feature_struct(features.memory_model);
+	h.feature_struct(features.ubo_standard_layout);
+	h.feature_struct(features.subgroup_extended_types);
+	h.feature_struct(features.separate_ds_layout);
+	h.feature_struct(features.buffer_device_address);
+	h.feature_struct(features.shader_clock);
+	h.feature_struct(features.transform_feedback);
+	h.feature_struct(features.depth_clip);
+	h.feature_struct(features.inline_uniform_block);
+	h.feature_struct(features.blend_operation_advanced);
+	h.feature_struct(features.attribute_divisor);
+	h.feature_struct(features.demote_to_helper);
+	h.feature_struct(features.shader_interlock);
+	h.feature_struct(features.fragment_density);
+	h.feature_struct(features.buffer_device_address_ext);
+	h.feature_struct(features.line_rasterization);
+	h.feature_struct(features.subgroup_size_control);
+	h.feature_struct(features.extended_dynamic_state);
+	h.feature_struct(features.compute_shader_derivatives);
+	h.feature_struct(features.barycentric_nv);
+	h.feature_struct(features.image_footprint_nv);
+	h.feature_struct(features.shading_rate_nv);
+	h.feature_struct(features.cooperative_matrix_nv);
+	h.feature_struct(features.sm_builtins_nv);
+	h.feature_struct(features.integer_functions2_intel);
+	h.feature_struct(features.mutable_descriptor_type_valve);
+	h.feature_struct(props.descriptor_indexing);
+	h.feature_struct(props.subgroup);
+	h.feature_struct(props.float_control);
+	h.feature_struct(props.subgroup_size_control);
+	h.feature_struct(props.inline_uniform_block);
+	h.feature_struct(props.attribute_divisor);
+
+	fingerprint = h.h;
+}
+
 bool FeatureFilter::init(uint32_t api_version, const char **device_exts, unsigned count,
                          const VkPhysicalDeviceFeatures2 *enabled_features, const VkPhysicalDeviceProperties2 *props)
 {
@@ -306,13 +462,13 @@ bool FeatureFilter::Impl::pnext_chain_is_supported(const void *pNext) const
 		switch (base->sType)
 		{
 		case VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_DOMAIN_ORIGIN_STATE_CREATE_INFO:
-			if (!enabled_extensions.count(VK_KHR_MAINTENANCE2_EXTENSION_NAME) && api_version < VK_API_VERSION_1_1)
+			if (!has_extension(Extension::KHR_MAINTENANCE2) && api_version < VK_API_VERSION_1_1)
 				return false;
 			break;
 
 		case VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_DIVISOR_STATE_CREATE_INFO_EXT:
 		{
-			if (!enabled_extensions.count(VK_EXT_VERTEX_ATTRIBUTE_DIVISOR_EXTENSION_NAME))
+			if (!has_extension(Extension::EXT_VERTEX_ATTRIBUTE_DIVISOR))
 				return false;
 
 			auto *divisor = static_cast<const VkPipelineVertexInputDivisorStateCreateInfoEXT *>(pNext);
@@ -341,7 +497,7 @@ bool FeatureFilter::Impl::pnext_chain_is_supported(const void *pNext) const
 
 		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_DEPTH_CLIP_STATE_CREATE_INFO_EXT:
 		{
-			if (!enabled_extensions.count(VK_EXT_DEPTH_CLIP_ENABLE_EXTENSION_NAME))
+			if (!has_extension(Extension::EXT_DEPTH_CLIP_ENABLE))
 				return false;
 			auto *clip = static_cast<const VkPipelineRasterizationDepthClipStateCreateInfoEXT *>(pNext);
 			if (clip->depthClipEnable && !features.depth_clip.depthClipEnable)
@@ -393,7 +549,7 @@ bool FeatureFilter::Impl::pnext_chain_is_supported(const void *pNext) const
 			break;
 
 		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT:
-			if (!enabled_extensions.count(VK_EXT_CONSERVATIVE_RASTERIZATION_EXTENSION_NAME))
+			if (!has_extension(Extension::EXT_CONSERVATIVE_RASTERIZATION))
 				return false;
 			break;
 
@@ -790,7 +946,7 @@ bool FeatureFilter::Impl::validate_module_capability(spv::Capability cap) const
 		return features.atomic_int64.shaderBufferInt64Atomics == VK_TRUE ||
 		       features.atomic_int64.shaderSharedInt64Atomics == VK_TRUE;
 	case spv::CapabilityGroups:
-		return enabled_extensions.count(VK_AMD_SHADER_BALLOT_EXTENSION_NAME);
+		return has_extension(Extension::AMD_SHADER_BALLOT);
 	case spv::CapabilityInt16:
 		return features2.features.shaderInt16 == VK_TRUE;
 	case spv::CapabilityTessellationPointSize:
@@ -834,7 +990,7 @@ bool FeatureFilter::Impl::validate_module_capability(spv::Capability cap) const
 		return features2.features.multiViewport == VK_TRUE;
 	case spv::CapabilityDrawParameters:
 		return features.draw_parameters.shaderDrawParameters == VK_TRUE ||
-		       enabled_extensions.count(VK_KHR_SHADER_DRAW_PARAMETERS_EXTENSION_NAME) != 0;
+		       has_extension(Extension::KHR_SHADER_DRAW_PARAMETERS) != 0;
 	case spv::CapabilityMultiView:
 		return features.multiview.multiview == VK_TRUE;
 	case spv::CapabilityVariablePointersStorageBuffer:
@@ -844,37 +1000,37 @@ bool FeatureFilter::Impl::validate_module_capability(spv::Capability cap) const
 	case spv::CapabilityShaderClockKHR:
 		// There aren't two separate capabilities, so we'd have to analyze all opcodes to deduce this.
 		// Just gate this on both feature bits being supported to be safe.
-		return enabled_extensions.count(VK_KHR_SHADER_CLOCK_EXTENSION_NAME) != 0 &&
+		return has_extension(Extension::KHR_SHADER_CLOCK) != 0 &&
 		       features.shader_clock.shaderDeviceClock == VK_TRUE &&
 		       features.shader_clock.shaderSubgroupClock == VK_TRUE;
 	case spv::CapabilityStencilExportEXT:
-		return enabled_extensions.count(VK_EXT_SHADER_STENCIL_EXPORT_EXTENSION_NAME) != 0;
+		return has_extension(Extension::EXT_SHADER_STENCIL_EXPORT) != 0;
 	case spv::CapabilitySubgroupBallotKHR:
-		return enabled_extensions.count(VK_EXT_SHADER_SUBGROUP_BALLOT_EXTENSION_NAME) != 0;
+		return has_extension(Extension::EXT_SHADER_SUBGROUP_BALLOT) != 0;
 	case spv::CapabilitySubgroupVoteKHR:
-		return enabled_extensions.count(VK_EXT_SHADER_SUBGROUP_VOTE_EXTENSION_NAME) != 0;
+		return has_extension(Extension::EXT_SHADER_SUBGROUP_VOTE) != 0;
 	case spv::CapabilityImageReadWriteLodAMD:
-		return enabled_extensions.count(VK_AMD_SHADER_IMAGE_LOAD_STORE_LOD_EXTENSION_NAME) != 0;
+		return has_extension(Extension::AMD_SHADER_IMAGE_LOAD_STORE_LOD) != 0;
 	case spv::CapabilityImageGatherBiasLodAMD:
-		return enabled_extensions.count(VK_AMD_TEXTURE_GATHER_BIAS_LOD_EXTENSION_NAME) != 0;
+		return has_extension(Extension::AMD_TEXTURE_GATHER_BIAS_LOD) != 0;
 	case spv::CapabilityFragmentMaskAMD:
-		return enabled_extensions.count(VK_AMD_SHADER_FRAGMENT_MASK_EXTENSION_NAME) != 0;
+		return has_extension(Extension::AMD_SHADER_FRAGMENT_MASK) != 0;
 	case spv::CapabilitySampleMaskOverrideCoverageNV:
-		return enabled_extensions.count(VK_NV_SAMPLE_MASK_OVERRIDE_COVERAGE_EXTENSION_NAME) != 0;
+		return has_extension(Extension::NV_SAMPLE_MASK_OVERRIDE_COVERAGE) != 0;
 	case spv::CapabilityGeometryShaderPassthroughNV:
-		return enabled_extensions.count(VK_NV_GEOMETRY_SHADER_PASSTHROUGH_EXTENSION_NAME) != 0;
+		return has_extension(Extension::NV_GEOMETRY_SHADER_PASSTHROUGH) != 0;
 	case spv::CapabilityShaderViewportIndex:
 	case spv::CapabilityShaderLayer:
 		// Vulkan 1.2 feature struct. Validation layer complains when we use 1_2 feature struct along other similar structs.
 		return false;
 	case spv::CapabilityShaderViewportIndexLayerEXT:
 		// NV version is a cloned enum.
-		return enabled_extensions.count(VK_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME) != 0 ||
-		       enabled_extensions.count(VK_NV_VIEWPORT_ARRAY2_EXTENSION_NAME) != 0;
+		return has_extension(Extension::EXT_SHADER_VIEWPORT_INDEX_LAYER) != 0 ||
+		       has_extension(Extension::NV_VIEWPORT_ARRAY2) != 0;
 	case spv::CapabilityShaderViewportMaskNV:
-		return enabled_extensions.count(VK_NV_VIEWPORT_ARRAY2_EXTENSION_NAME) != 0;
+		return has_extension(Extension::NV_VIEWPORT_ARRAY2) != 0;
 	case spv::CapabilityPerViewAttributesNV:
-		return enabled_extensions.count(VK_NVX_MULTIVIEW_PER_VIEW_ATTRIBUTES_EXTENSION_NAME) != 0;
+		return has_extension(Extension::NVX_MULTIVIEW_PER_VIEW_ATTRIBUTES) != 0;
 	case spv::CapabilityStorageBuffer16BitAccess:
 		return features.storage_16bit.storageBuffer16BitAccess == VK_TRUE;
 	case spv::CapabilityUniformAndStorageBuffer16BitAccess:
@@ -902,9 +1058,9 @@ bool FeatureFilter::Impl::validate_module_capability(spv::Capability cap) const
 	case spv::CapabilityGroupNonUniformPartitionedNV:
 		return (props.subgroup.supportedOperations & VK_SUBGROUP_FEATURE_PARTITIONED_BIT_NV) != 0;
 	case spv::CapabilitySampleMaskPostDepthCoverage:
-		return enabled_extensions.count(VK_EXT_POST_DEPTH_COVERAGE_EXTENSION_NAME) != 0;
+		return has_extension(Extension::EXT_POST_DEPTH_COVERAGE) != 0;
 	case spv::CapabilityShaderNonUniform:
-		return enabled_extensions.count(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) != 0 || api_version >= VK_API_VERSION_1_2;
+		return has_extension(Extension::EXT_DESCRIPTOR_INDEXING) != 0 || api_version >= VK_API_VERSION_1_2;
 	case spv::CapabilityRuntimeDescriptorArray:
 		return features.descriptor_indexing.runtimeDescriptorArray == VK_TRUE;
 	case spv::CapabilityInputAttachmentArrayDynamicIndexing:
@@ -928,7 +1084,7 @@ bool FeatureFilter::Impl::validate_module_capability(spv::Capability cap) const
 	case spv::CapabilityStorageTexelBufferArrayNonUniformIndexing:
 		return features.descriptor_indexing.shaderStorageTexelBufferArrayNonUniformIndexing == VK_TRUE;
 	case spv::CapabilityFloat16:
-		return features.float16_int8.shaderFloat16 == VK_TRUE || enabled_extensions.count(VK_AMD_GPU_SHADER_HALF_FLOAT_EXTENSION_NAME) != 0;
+		return features.float16_int8.shaderFloat16 == VK_TRUE || has_extension(Extension::AMD_GPU_SHADER_HALF_FLOAT) != 0;
 	case spv::CapabilityInt8:
 		return features.float16_int8.shaderInt8 == VK_TRUE;
 	case spv::CapabilityStorageBuffer8BitAccess:
@@ -979,9 +1135,9 @@ bool FeatureFilter::Impl::validate_module_capability(spv::Capability cap) const
 		return features.shading_rate_nv.shadingRateImage == VK_TRUE ||
 		       features.fragment_density.fragmentDensityMap == VK_TRUE;
 	case spv::CapabilityMeshShadingNV:
-		return enabled_extensions.count(VK_NV_MESH_SHADER_EXTENSION_NAME) == VK_TRUE;
+		return has_extension(Extension::NV_MESH_SHADER) == VK_TRUE;
 	case spv::CapabilityRayTracingNV:
-		return enabled_extensions.count(VK_NV_RAY_TRACING_EXTENSION_NAME) == VK_TRUE;
+		return has_extension(Extension::NV_RAY_TRACING) == VK_TRUE;
 	case spv::CapabilityTransformFeedback:
 		return features.transform_feedback.transformFeedback == VK_TRUE;
 	case spv::CapabilityGeometryStreams:
@@ -1050,7 +1206,7 @@ bool FeatureFilter::Impl::validate_module_capabilities(const uint32_t *data, siz
 	}
 	else if (version >= 0x10400)
 	{
-		if (api_version < VK_API_VERSION_1_2 && enabled_extensions.count(VK_KHR_SPIRV_1_4_EXTENSION_NAME) == 0)
+		if (api_version < VK_API_VERSION_1_2 && has_extension(Extension::KHR_SPIRV_1_4) == 0)
 		{
 			LOGE("Need VK_KHR_spirv_1_4 or Vulkan 1.2 for SPIR-V 1.4.\n");
 			return false;
@@ -1166,48 +1322,48 @@ bool FeatureFilter::Impl::graphics_pipeline_is_supported(const VkGraphicsPipelin
 			case VK_DYNAMIC_STATE_DEPTH_BOUNDS_TEST_ENABLE_EXT:
 			case VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE_EXT:
 			case VK_DYNAMIC_STATE_STENCIL_OP_EXT:
-				if (!enabled_extensions.count(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME))
+				if (!has_extension(Extension::EXT_EXTENDED_DYNAMIC_STATE))
 					return false;
 				if (!features.extended_dynamic_state.extendedDynamicState)
 					return false;
 				break;
 
 			case VK_DYNAMIC_STATE_VIEWPORT_W_SCALING_NV:
-				if (!enabled_extensions.count(VK_NV_CLIP_SPACE_W_SCALING_EXTENSION_NAME))
+				if (!has_extension(Extension::NV_CLIP_SPACE_W_SCALING))
 					return false;
 				break;
 
 			case VK_DYNAMIC_STATE_DISCARD_RECTANGLE_EXT:
-				if (!enabled_extensions.count(VK_EXT_DISCARD_RECTANGLES_EXTENSION_NAME))
+				if (!has_extension(Extension::EXT_DISCARD_RECTANGLES))
 					return false;
 				break;
 
 			case VK_DYNAMIC_STATE_SAMPLE_LOCATIONS_EXT:
-				if (!enabled_extensions.count(VK_EXT_SAMPLE_LOCATIONS_EXTENSION_NAME))
+				if (!has_extension(Extension::EXT_SAMPLE_LOCATIONS))
 					return false;
 				break;
 
 			case VK_DYNAMIC_STATE_VIEWPORT_SHADING_RATE_PALETTE_NV:
-				if (!enabled_extensions.count(VK_NV_SHADING_RATE_IMAGE_EXTENSION_NAME))
+				if (!has_extension(Extension::NV_SHADING_RATE_IMAGE))
 					return false;
 				if (!features.shading_rate_nv.shadingRateImage)
 					return false;
 				break;
 
 			case VK_DYNAMIC_STATE_VIEWPORT_COARSE_SAMPLE_ORDER_NV:
-				if (!enabled_extensions.count(VK_NV_SHADING_RATE_IMAGE_EXTENSION_NAME))
+				if (!has_extension(Extension::NV_SHADING_RATE_IMAGE))
 					return false;
 				if (!features.shading_rate_nv.shadingRateCoarseSampleOrder)
 					return false;
 				break;
 
 			case VK_DYNAMIC_STATE_EXCLUSIVE_SCISSOR_NV:
-				if (!enabled_extensions.count(VK_NV_SCISSOR_EXCLUSIVE_EXTENSION_NAME))
+				if (!has_extension(Extension::NV_SCISSOR_EXCLUSIVE))
 					return false;
 				break;
 
 			case VK_DYNAMIC_STATE_LINE_STIPPLE_EXT:
-				if (!enabled_extensions.count(VK_EXT_LINE_RASTERIZATION_EXTENSION_NAME))
+				if (!has_extension(Extension::EXT_LINE_RASTERIZATION))
 					return false;
 				break;
 
@@ -1306,4 +1462,9 @@ bool FeatureFilter::supports_scalar_block_layout() const
 {
 	return impl->null_device || impl->supports_scalar_block_layout;
 }
+
+uint64_t FeatureFilter::get_device_fingerprint() const
+{
+	return impl->null_device ? 0 : impl->fingerprint;
+}
 }
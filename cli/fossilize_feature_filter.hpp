@@ -105,6 +105,11 @@ public:
 
 	bool supports_scalar_block_layout() const;
 
+	// Identifies the enabled extensions, features and properties the filter decides on.
+	// Objects filtered with the same fingerprint get the same result, so results can be memoized across runs.
+	// Returns 0 for a null device.
+	uint64_t get_device_fingerprint() const;
+
 private:
 	struct Impl;
 	Impl *impl;
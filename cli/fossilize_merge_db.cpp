@@ -21,6 +21,7 @@
  */
 
 #include "fossilize_db.hpp"
+#include "cli_parser.hpp"
 #include <memory>
 #include <vector>
 #include "layer/utils.hpp"
@@ -30,22 +31,35 @@ using namespace Fossilize;
 
 static void print_help()
 {
-	LOGI("Usage: fossilize-merge-db append.foz [input1.foz] [input2.foz] ...\n");
+	LOGI("Usage: fossilize-merge-db\n"
+	     "\t[--num-threads <count>]\n"
+	     "\tappend.foz [input1.foz] [input2.foz] ...\n");
 }
 
 int main(int argc, char **argv)
 {
-	std::vector<const char *> inputs;
-	if (argc < 3)
+	CLICallbacks cbs;
+	std::vector<const char *> paths;
+	unsigned num_threads = 0;
+
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--num-threads", [&](CLIParser &parser) { num_threads = parser.next_uint(); });
+	cbs.default_handler = [&](const char *arg) { paths.push_back(arg); };
+	cbs.error_handler = [] { print_help(); };
+
+	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (paths.size() < 2)
 	{
 		print_help();
 		return EXIT_FAILURE;
 	}
 
-	for (int i = 2; i < argc; i++)
-		inputs.push_back(argv[i]);
-
-	if (!merge_concurrent_databases(argv[1], inputs.data(), inputs.size()))
+	if (!merge_concurrent_databases(paths.front(), paths.data() + 1, paths.size() - 1, num_threads))
 		return EXIT_FAILURE;
 
 	return EXIT_SUCCESS;
@@ -27,6 +27,13 @@
 #include "fossilize_db.hpp"
 #include "file.hpp"
 #include "spirv-tools/optimizer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <stdio.h>
 
 using namespace std;
 using namespace Fossilize;
@@ -37,10 +44,104 @@ static inline T fake_handle(uint64_t v)
 	return (T)v;
 }
 
+// Shader modules are optimized in batches on all threads, then recorded in order.
+// Bounds memory use to one batch of modules.
+static const size_t ModuleBatchSize = 256;
+
+struct OptimizedModule
+{
+	vector<uint32_t> code;
+	VkShaderModuleCreateFlags flags = 0;
+	bool parsed = false;
+};
+
+// Each thread parses and optimizes modules with its own replayer and optimizer.
+struct ModuleOptimizer : StateCreatorInterface
+{
+	explicit ModuleOptimizer(bool optimize_size)
+		: optimizer(SPV_ENV_VULKAN_1_1)
+	{
+		if (optimize_size)
+			optimizer.RegisterSizePasses();
+		else
+			optimizer.RegisterPerformancePasses();
+	}
+
+	StateReplayer replayer;
+	spvtools::Optimizer optimizer;
+	OptimizedModule *result = nullptr;
+
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module) override
+	{
+		*module = fake_handle<VkShaderModule>(hash);
+		result->flags = create_info->flags;
+		result->parsed = true;
+
+		if (!optimizer.Run(create_info->pCode, create_info->codeSize / sizeof(uint32_t), &result->code))
+		{
+			LOGE("Failed to optimize shader module %016" PRIx64 ". Using original module.\n", hash);
+			result->code.assign(create_info->pCode, create_info->pCode + create_info->codeSize / sizeof(uint32_t));
+		}
+		return true;
+	}
+
+	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override { return false; }
+	bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override { return false; }
+	bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override { return false; }
+	bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override { return false; }
+	bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override { return false; }
+	bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override { return false; }
+};
+
+static void optimize_modules(DatabaseInterface &input_db, vector<unique_ptr<ModuleOptimizer>> &optimizers,
+                             const Hash *hashes, size_t count, vector<OptimizedModule> &modules)
+{
+	std::atomic<size_t> next_index(0);
+
+	const auto worker = [&](ModuleOptimizer &optimizer) {
+		vector<uint8_t> state_json;
+		size_t index;
+		while ((index = next_index.fetch_add(1, std::memory_order_relaxed)) < count)
+		{
+			auto &module = modules[index];
+			module.parsed = false;
+			module.code.clear();
+
+			size_t state_json_size = 0;
+			if (!input_db.read_entry(RESOURCE_SHADER_MODULE, hashes[index], &state_json_size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
+			{
+				LOGE("Failed to load blob from cache.\n");
+				continue;
+			}
+
+			state_json.resize(state_json_size);
+
+			if (!input_db.read_entry(RESOURCE_SHADER_MODULE, hashes[index], &state_json_size, state_json.data(), PAYLOAD_READ_CONCURRENT_BIT))
+			{
+				LOGE("Failed to load blob from cache.\n");
+				continue;
+			}
+
+			optimizer.result = &module;
+			if (!optimizer.replayer.parse(optimizer, &input_db, state_json.data(), state_json.size()))
+				LOGE("Failed to parse blob (tag: %d, hash: 0x%" PRIx64 ").\n", RESOURCE_SHADER_MODULE, hashes[index]);
+			optimizer.replayer.get_allocator().reset();
+		}
+	};
+
+	vector<thread> threads;
+	for (size_t i = 1; i < std::min(optimizers.size(), count); i++)
+		threads.emplace_back(worker, std::ref(*optimizers[i]));
+	worker(*optimizers[0]);
+	for (auto &t : threads)
+		t.join();
+}
+
 struct OptimizeReplayer : StateCreatorInterface
 {
 	StateRecorder recorder;
-	bool optimize_size = false;
+	// Graphics pipelines are rehashed after their state is canonicalized.
+	bool canonicalize = false;
 
 	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *create_info, VkSampler *sampler) override
 	{
@@ -60,31 +161,20 @@ struct OptimizeReplayer : StateCreatorInterface
 		return recorder.record_pipeline_layout(*layout, *create_info, hash);
 	}
 
-	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module) override
+	// Shader modules are optimized by ModuleOptimizer, and pipelines refer to them by hash.
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *, VkShaderModule *module) override
 	{
-		vector<uint32_t> compiled_spirv;
-		spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_1);
-
-		if (optimize_size)
-			optimizer.RegisterSizePasses();
-		else
-			optimizer.RegisterPerformancePasses();
-
-		if (!optimizer.Run(create_info->pCode, create_info->codeSize / sizeof(uint32_t), &compiled_spirv))
-		{
-			LOGE("Failed to optimize shader module %016" PRIx64 ". Using original module.\n", hash);
-			*module = fake_handle<VkShaderModule>(hash);
-			return recorder.record_shader_module(*module, *create_info, hash);
-		}
-		else
-		{
-			auto info = *create_info;
-			info.pCode = compiled_spirv.data();
-			info.codeSize = compiled_spirv.size() * sizeof(uint32_t);
+		*module = fake_handle<VkShaderModule>(hash);
+		return true;
+	}
 
-			*module = fake_handle<VkShaderModule>(hash);
-			return recorder.record_shader_module(*module, info, hash);
-		}
+	bool record_optimized_module(Hash hash, const OptimizedModule &optimized)
+	{
+		VkShaderModuleCreateInfo info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+		info.flags = optimized.flags;
+		info.pCode = optimized.code.data();
+		info.codeSize = optimized.code.size() * sizeof(uint32_t);
+		return recorder.record_shader_module(fake_handle<VkShaderModule>(hash), info, hash);
 	}
 
 	bool enqueue_create_render_pass(Hash hash, const VkRenderPassCreateInfo *create_info, VkRenderPass *render_pass) override
@@ -102,7 +192,7 @@ struct OptimizeReplayer : StateCreatorInterface
 	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline) override
 	{
 		*pipeline = fake_handle<VkPipeline>(hash);
-		return recorder.record_graphics_pipeline(*pipeline, *create_info, nullptr, 0, hash);
+		return recorder.record_graphics_pipeline(*pipeline, *create_info, nullptr, 0, canonicalize ? 0 : hash);
 	}
 };
 
@@ -111,6 +201,9 @@ static void print_help()
 	LOGI("fossilize-opt\n"
 	     "\t[--help]\n"
 	     "\t[--optimize-size]\n"
+	     "\t[--canonicalize-pipelines]\n"
+	     "\t[--canonical-hash-map <path.csv>]\n"
+	     "\t[--num-threads <count>]\n"
 	     "\t[--input-db <path>]\n"
 	     "\t[--output-db <path>]\n");
 }
@@ -121,11 +214,17 @@ int main(int argc, char *argv[])
 	string output_db_path;
 	CLICallbacks cbs;
 	bool optimize_size = false;
+	bool canonicalize = false;
+	string hash_map_path;
+	unsigned num_threads = 0;
 
 	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
 	cbs.add("--input-db", [&](CLIParser &parser) { input_db_path = parser.next_string(); });
 	cbs.add("--output-db", [&](CLIParser &parser) { output_db_path = parser.next_string(); });
 	cbs.add("--optimize-size", [&](CLIParser &) { optimize_size = true; });
+	cbs.add("--canonicalize-pipelines", [&](CLIParser &) { canonicalize = true; });
+	cbs.add("--canonical-hash-map", [&](CLIParser &parser) { hash_map_path = parser.next_string(); });
+	cbs.add("--num-threads", [&](CLIParser &parser) { num_threads = parser.next_uint(); });
 	cbs.error_handler = [] { print_help(); };
 
 	CLIParser parser(move(cbs), argc - 1, argv + 1);
@@ -151,12 +250,23 @@ int main(int argc, char *argv[])
 	auto input_db = std::unique_ptr<DatabaseInterface>(create_database(input_db_path.c_str(), DatabaseMode::ReadOnly));
 	auto output_db = std::unique_ptr<DatabaseInterface>(create_database(output_db_path.c_str(), DatabaseMode::OverWrite));
 
+	if (!hash_map_path.empty() && !canonicalize)
+	{
+		LOGE("--canonical-hash-map requires --canonicalize-pipelines.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
 	OptimizeReplayer optimize_replayer;
-	optimize_replayer.optimize_size = optimize_size;
 
 	StateReplayer replayer;
+	replayer.set_resolve_shader_module_handles(false);
 	optimize_replayer.recorder.set_database_enable_checksum(true);
 	optimize_replayer.recorder.set_database_enable_compression(true);
+	optimize_replayer.recorder.set_canonicalize_pipeline_state(canonicalize);
+	optimize_replayer.canonicalize = canonicalize;
 
 	if (!input_db || !input_db->prepare())
 	{
@@ -184,6 +294,7 @@ int main(int argc, char *argv[])
 	};
 
 	vector<uint8_t> state_json;
+	vector<Hash> graphics_hashes;
 	for (auto &tag : playback_order)
 	{
 		size_t hash_count = 0;
@@ -201,6 +312,29 @@ int main(int argc, char *argv[])
 			return EXIT_FAILURE;
 		}
 
+		if (tag == RESOURCE_SHADER_MODULE)
+		{
+			vector<unique_ptr<ModuleOptimizer>> optimizers;
+			for (unsigned i = 0; i < num_threads; i++)
+				optimizers.emplace_back(new ModuleOptimizer(optimize_size));
+
+			vector<OptimizedModule> modules(ModuleBatchSize);
+			for (size_t base = 0; base < hashes.size(); base += ModuleBatchSize)
+			{
+				size_t count = std::min(ModuleBatchSize, hashes.size() - base);
+				optimize_modules(*input_db, optimizers, hashes.data() + base, count, modules);
+
+				for (size_t i = 0; i < count; i++)
+				{
+					if (!modules[i].parsed)
+						continue;
+					if (!optimize_replayer.record_optimized_module(hashes[base + i], modules[i]))
+						LOGE("Failed to record shader module %016" PRIx64 ".\n", hashes[base + i]);
+				}
+			}
+			continue;
+		}
+
 		for (auto hash : hashes)
 		{
 			size_t state_json_size;
@@ -221,5 +355,43 @@ int main(int argc, char *argv[])
 			if (!replayer.parse(optimize_replayer, input_db.get(), state_json.data(), state_json.size()))
 				LOGE("Failed to parse blob (tag: %d, hash: 0x%" PRIx64 ").\n", tag, hash);
 		}
+
+		if (tag == RESOURCE_GRAPHICS_PIPELINE)
+			graphics_hashes = move(hashes);
+	}
+
+	if (canonicalize)
+	{
+		// Pipelines are hashed on the recording thread.
+		optimize_replayer.recorder.tear_down_recording_thread();
+
+		FILE *hash_map = nullptr;
+		if (!hash_map_path.empty())
+		{
+			hash_map = fopen(hash_map_path.c_str(), "w");
+			if (!hash_map)
+			{
+				LOGE("Failed to open %s for writing.\n", hash_map_path.c_str());
+				return EXIT_FAILURE;
+			}
+			fprintf(hash_map, "original,canonical\n");
+		}
+
+		unordered_set<Hash> canonical_hashes;
+		for (auto hash : graphics_hashes)
+		{
+			Hash canonical_hash;
+			if (!optimize_replayer.recorder.get_hash_for_graphics_pipeline_handle(fake_handle<VkPipeline>(hash), &canonical_hash))
+				continue;
+			canonical_hashes.insert(canonical_hash);
+			if (hash_map)
+				fprintf(hash_map, "%016" PRIx64 ",%016" PRIx64 "\n", hash, canonical_hash);
+		}
+
+		if (hash_map)
+			fclose(hash_map);
+
+		LOGI("Canonicalized %zu graphics pipelines into %zu unique pipelines.\n",
+		     graphics_hashes.size(), canonical_hashes.size());
 	}
 }
@@ -27,6 +27,8 @@
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
+#include <atomic>
+#include <thread>
 #include "layer/utils.hpp"
 #include "cli_parser.hpp"
 
@@ -48,7 +50,9 @@ static void print_help()
 	     "\t[--skip-application-info-links]\n"
 	     "\t[--whitelist whitelist.foz]\n"
 	     "\t[--blacklist blacklist.foz]\n"
-	     "\t[--invert-module-pruning]\n");
+	     "\t[--invert-module-pruning]\n"
+	     "\t[--num-threads <count>]\n"
+	     "\t[--shader-module-store store.modules.foz]\n");
 }
 
 template <typename T>
@@ -282,6 +286,79 @@ struct PruneReplayer : StateCreatorInterface
 	}
 };
 
+static void merge_accessed(unordered_set<Hash> &dst, const unordered_set<Hash> &src)
+{
+	dst.insert(begin(src), end(src));
+}
+
+// Pipelines only refer to objects which were replayed before them, so they can be parsed on all threads.
+// Each thread works on its own copy of the pruner, and what they accessed is merged afterwards.
+// Derivative pipelines are not resolved, since every parent is visited on its own anyway.
+static bool parse_pipelines(DatabaseInterface &input_db, const StateReplayer &replayer, PruneReplayer &prune_replayer,
+                            ResourceTag tag, const vector<Hash> &hashes, unsigned num_threads)
+{
+	num_threads = unsigned(std::max<size_t>(1, std::min<size_t>(num_threads, hashes.size())));
+	vector<PruneReplayer> pruners(num_threads, prune_replayer);
+	std::atomic<size_t> next_index(0);
+	std::atomic<bool> success(true);
+
+	const auto worker = [&](unsigned thread_index) {
+		StateReplayer thread_replayer;
+		thread_replayer.set_resolve_shader_module_handles(false);
+		thread_replayer.set_resolve_derivative_pipeline_handles(false);
+		thread_replayer.copy_handle_references(replayer);
+
+		auto &pruner = pruners[thread_index];
+		vector<uint8_t> state_json;
+		size_t index;
+		while ((index = next_index.fetch_add(1, std::memory_order_relaxed)) < hashes.size())
+		{
+			Hash hash = hashes[index];
+			size_t state_json_size = 0;
+			if (!input_db.read_entry(tag, hash, &state_json_size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
+			{
+				LOGE("Failed to load blob from cache.\n");
+				success = false;
+				return;
+			}
+
+			state_json.resize(state_json_size);
+
+			if (!input_db.read_entry(tag, hash, &state_json_size, state_json.data(), PAYLOAD_READ_CONCURRENT_BIT))
+			{
+				LOGE("Failed to load blob from cache.\n");
+				success = false;
+				return;
+			}
+
+			pruner.has_application_info_for_blob = false;
+			pruner.blob_belongs_to_application_info = false;
+			if (!thread_replayer.parse(pruner, &input_db, state_json.data(), state_json.size()))
+				LOGE("Failed to parse blob (tag: %d, hash: 0x%" PRIx64 ").\n", tag, hash);
+		}
+	};
+
+	vector<thread> threads;
+	for (unsigned i = 1; i < num_threads; i++)
+		threads.emplace_back(worker, i);
+	worker(0);
+	for (auto &t : threads)
+		t.join();
+
+	for (auto &pruner : pruners)
+	{
+		merge_accessed(prune_replayer.accessed_samplers, pruner.accessed_samplers);
+		merge_accessed(prune_replayer.accessed_descriptor_sets, pruner.accessed_descriptor_sets);
+		merge_accessed(prune_replayer.accessed_pipeline_layouts, pruner.accessed_pipeline_layouts);
+		merge_accessed(prune_replayer.accessed_shader_modules, pruner.accessed_shader_modules);
+		merge_accessed(prune_replayer.accessed_render_passes, pruner.accessed_render_passes);
+		merge_accessed(prune_replayer.accessed_graphics_pipelines, pruner.accessed_graphics_pipelines);
+		merge_accessed(prune_replayer.accessed_compute_pipelines, pruner.accessed_compute_pipelines);
+	}
+
+	return success.load();
+}
+
 static bool copy_accessed_types(DatabaseInterface &input_db,
                                 DatabaseInterface &output_db,
                                 vector<uint8_t> &state_json,
@@ -325,6 +402,8 @@ int main(int argc, char *argv[])
 	bool should_filter_application_hash = false;
 	bool skip_application_info_links = false;
 	bool invert_module_pruning = false;
+	unsigned num_threads = 0;
+	string module_store_path;
 
 	unordered_set<Hash> filter_graphics;
 	unordered_set<Hash> filter_compute;
@@ -371,6 +450,12 @@ int main(int argc, char *argv[])
 	cbs.add("--blacklist", [&](CLIParser &parser) {
 		blacklist = parser.next_string();
 	});
+	cbs.add("--num-threads", [&](CLIParser &parser) {
+		num_threads = parser.next_uint();
+	});
+	cbs.add("--shader-module-store", [&](CLIParser &parser) {
+		module_store_path = parser.next_string();
+	});
 	cbs.error_handler = [] { print_help(); };
 
 	CLIParser parser(move(cbs), argc - 1, argv + 1);
@@ -418,6 +503,21 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	// Modules go to the store rather than the output, modules which are already there are not written again.
+	std::unique_ptr<DatabaseInterface> module_store;
+	if (!module_store_path.empty())
+	{
+		module_store.reset(create_shader_module_store_database(module_store_path.c_str(), DatabaseMode::Append));
+		if (!module_store->prepare())
+		{
+			LOGE("Failed to open shader module store: %s\n", module_store_path.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
 	StateReplayer replayer;
 	PruneReplayer prune_replayer;
 
@@ -488,6 +588,13 @@ int main(int argc, char *argv[])
 			return EXIT_FAILURE;
 		}
 
+		if (tag == RESOURCE_GRAPHICS_PIPELINE || tag == RESOURCE_COMPUTE_PIPELINE)
+		{
+			if (!parse_pipelines(*input_db, replayer, prune_replayer, tag, hashes, num_threads))
+				return EXIT_FAILURE;
+			continue;
+		}
+
 		for (auto hash : hashes)
 		{
 			size_t state_json_size;
@@ -588,7 +695,15 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	if (!copy_accessed_types(*input_db, *output_db, state_json,
+	size_t stored_modules = 0;
+	if (module_store)
+	{
+		for (auto hash : prune_replayer.accessed_shader_modules)
+			if (module_store->has_entry(RESOURCE_SHADER_MODULE, hash))
+				stored_modules++;
+	}
+
+	if (!copy_accessed_types(*input_db, module_store ? *module_store : *output_db, state_json,
 	                         prune_replayer.accessed_shader_modules, RESOURCE_SHADER_MODULE,
 	                         per_tag_written))
 	{
@@ -596,6 +711,13 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (module_store)
+	{
+		LOGI("Moved %u shader modules to %s, %u of them were already stored.\n",
+		     per_tag_written[RESOURCE_SHADER_MODULE], module_store_path.c_str(), unsigned(stored_modules));
+		per_tag_written[RESOURCE_SHADER_MODULE] = 0;
+	}
+
 	if (!copy_accessed_types(*input_db, *output_db, state_json,
 	                         prune_replayer.accessed_render_passes, RESOURCE_RENDER_PASS,
 	                         per_tag_written))
@@ -628,6 +750,24 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	// Dependency graph entries follow the layouts and pipelines they belong to.
+	unordered_set<Hash> accessed_graph_entries;
+	for (auto *accessed : { &prune_replayer.accessed_descriptor_sets, &prune_replayer.accessed_pipeline_layouts,
+	                        &prune_replayer.accessed_graphics_pipelines, &prune_replayer.accessed_compute_pipelines })
+	{
+		for (auto hash : *accessed)
+			if (input_db->has_entry(RESOURCE_DEPENDENCY_GRAPH, hash))
+				accessed_graph_entries.insert(hash);
+	}
+
+	if (!copy_accessed_types(*input_db, *output_db, state_json,
+	                         accessed_graph_entries, RESOURCE_DEPENDENCY_GRAPH,
+	                         per_tag_written))
+	{
+		LOGE("Failed to copy DEPENDENCY_GRAPHs.\n");
+		return EXIT_FAILURE;
+	}
+
 	for (auto tag : playback_order)
 		LOGI("Pruned %s entries: %u -> %u entries\n", tag_names[tag], per_tag_read[tag], per_tag_written[tag]);
 }
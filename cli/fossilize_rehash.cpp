@@ -26,6 +26,9 @@
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include "layer/utils.hpp"
 #include "cli_parser.hpp"
 
@@ -34,7 +37,7 @@ using namespace std;
 
 static void print_help()
 {
-	LOGI("Usage: fossilize-rehash [--input-db path] [--output-db path] [--application hash]\n");
+	LOGI("Usage: fossilize-rehash [--input-db path] [--output-db path] [--application hash] [--hash-xxh64] [--spirv-delta] [--binary-payloads] [--num-threads count]\n");
 }
 
 template <typename T>
@@ -113,11 +116,257 @@ struct RehashReplayer : StateCreatorInterface
 	}
 };
 
+// What a shader module or pipeline blob parsed to, so objects parsed on other threads can be recorded in order.
+struct ParsedObject
+{
+	Hash hash = 0;
+	Hash rehashed = 0;
+	const void *create_info = nullptr;
+};
+
+// Shader modules do not depend on anything, so they are rehashed right away while parsing.
+// Pipelines depend on how the recorder remapped the objects they refer to, so they are hashed on the recording thread.
+struct DeferredReplayer : StateCreatorInterface
+{
+	ParsedObject *object = nullptr;
+	HashAlgorithm hash_algorithm = HashAlgorithm::FNV1A;
+
+	// Everything else was replayed up front, and thread replayers copy the references to it.
+	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override
+	{
+		return false;
+	}
+
+	bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override
+	{
+		return false;
+	}
+
+	bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override
+	{
+		return false;
+	}
+
+	bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override
+	{
+		return false;
+	}
+
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module) override
+	{
+		*module = fake_handle<VkShaderModule>(hash);
+		object->hash = hash;
+		object->create_info = create_info;
+		return Hashing::compute_hash_shader_module(*create_info, &object->rehashed, hash_algorithm);
+	}
+
+	bool enqueue_create_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		*pipeline = fake_handle<VkPipeline>(hash);
+		object->hash = hash;
+		object->create_info = create_info;
+		return true;
+	}
+
+	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		*pipeline = fake_handle<VkPipeline>(hash);
+		object->hash = hash;
+		object->create_info = create_info;
+		return true;
+	}
+};
+
+static bool read_blob(DatabaseInterface &input_db, ResourceTag tag, Hash hash, vector<uint8_t> &state_json, PayloadReadFlags flags)
+{
+	size_t state_json_size = 0;
+	if (!input_db.read_entry(tag, hash, &state_json_size, nullptr, flags))
+		return false;
+	state_json.resize(state_json_size);
+	return input_db.read_entry(tag, hash, &state_json_size, state_json.data(), flags);
+}
+
+// Records shader modules and pipelines in the same order a single threaded replay would.
+// A derivative pipeline is held back until its parent is recorded, since the recorder remaps the base pipeline.
+struct OrderedRecorder
+{
+	StateRecorder &recorder;
+	StateReplayer &replayer;
+	DatabaseInterface &input_db;
+	ResourceTag tag;
+	unordered_set<Hash> tag_hashes;
+	unordered_set<Hash> recorded;
+	unordered_map<Hash, vector<Hash>> waiting_children;
+
+	OrderedRecorder(StateRecorder &recorder_, StateReplayer &replayer_, DatabaseInterface &input_db_,
+	                ResourceTag tag_, const vector<Hash> &hashes)
+		: recorder(recorder_), replayer(replayer_), input_db(input_db_), tag(tag_), tag_hashes(hashes.begin(), hashes.end())
+	{
+	}
+
+	// Derivative pipelines are not resolved, so the handle is the hash of the parent.
+	// The recorder remaps any base pipeline, whether or not the derivative bit is set.
+	Hash get_base_pipeline(const ParsedObject &object) const
+	{
+		VkPipeline base_pipeline = VK_NULL_HANDLE;
+		if (tag == RESOURCE_GRAPHICS_PIPELINE)
+			base_pipeline = static_cast<const VkGraphicsPipelineCreateInfo *>(object.create_info)->basePipelineHandle;
+		else if (tag == RESOURCE_COMPUTE_PIPELINE)
+			base_pipeline = static_cast<const VkComputePipelineCreateInfo *>(object.create_info)->basePipelineHandle;
+		return (Hash)base_pipeline;
+	}
+
+	bool record_object(const ParsedObject &object)
+	{
+		switch (tag)
+		{
+		case RESOURCE_SHADER_MODULE:
+			return recorder.record_shader_module(fake_handle<VkShaderModule>(object.hash),
+			                                     *static_cast<const VkShaderModuleCreateInfo *>(object.create_info),
+			                                     object.rehashed);
+
+		case RESOURCE_GRAPHICS_PIPELINE:
+			return recorder.record_graphics_pipeline(fake_handle<VkPipeline>(object.hash),
+			                                         *static_cast<const VkGraphicsPipelineCreateInfo *>(object.create_info),
+			                                         nullptr, 0);
+
+		case RESOURCE_COMPUTE_PIPELINE:
+			return recorder.record_compute_pipeline(fake_handle<VkPipeline>(object.hash),
+			                                        *static_cast<const VkComputePipelineCreateInfo *>(object.create_info),
+			                                        nullptr, 0);
+
+		default:
+			return false;
+		}
+	}
+
+	void record(const ParsedObject &object)
+	{
+		Hash parent = get_base_pipeline(object);
+		if (parent && !recorded.count(parent) && tag_hashes.count(parent))
+		{
+			waiting_children[parent].push_back(object.hash);
+			return;
+		}
+
+		if (!record_object(object))
+			LOGE("Failed to record blob (tag: %d, hash: 0x%" PRIx64 ").\n", tag, object.hash);
+		recorded.insert(object.hash);
+
+		auto itr = waiting_children.find(object.hash);
+		if (itr == waiting_children.end())
+			return;
+
+		auto children = move(itr->second);
+		waiting_children.erase(itr);
+
+		// The memory of the parsed child might be gone by now, so parse it again. This is rare.
+		for (auto child : children)
+		{
+			vector<uint8_t> state_json;
+			ParsedObject child_object;
+			DeferredReplayer deferred;
+			deferred.object = &child_object;
+			deferred.hash_algorithm = recorder.get_hash_algorithm();
+
+			if (!read_blob(input_db, tag, child, state_json, 0))
+				LOGE("Failed to load blob from cache.\n");
+			else if (!replayer.parse(deferred, &input_db, state_json.data(), state_json.size()) || !child_object.create_info)
+				LOGE("Failed to parse blob (tag: %d, hash: 0x%" PRIx64 ").\n", tag, child);
+			else
+				record(child_object);
+		}
+	}
+
+	void finish()
+	{
+		for (auto &waiting : waiting_children)
+			for (auto child : waiting.second)
+				LOGE("Failed to record blob (tag: %d, hash: 0x%" PRIx64 "), base pipeline 0x%" PRIx64 " was never recorded.\n",
+				     tag, child, waiting.first);
+		waiting_children.clear();
+	}
+};
+
+// Blobs are parsed in batches on all threads, and the main thread records each batch in order.
+// Between batches, the thread replayers are recreated to release what they parsed.
+static bool rehash_objects(DatabaseInterface &input_db, StateRecorder &recorder, StateReplayer &replayer,
+                           ResourceTag tag, const vector<Hash> &hashes, unsigned num_threads)
+{
+	static const size_t BatchSize = 1024;
+	OrderedRecorder ordered(recorder, replayer, input_db, tag, hashes);
+	vector<ParsedObject> objects;
+
+	for (size_t batch_offset = 0; batch_offset < hashes.size(); batch_offset += BatchSize)
+	{
+		size_t batch_count = std::min(BatchSize, hashes.size() - batch_offset);
+		objects.clear();
+		objects.resize(batch_count);
+
+		std::atomic<size_t> next_index(0);
+		std::atomic<bool> success(true);
+		vector<unique_ptr<StateReplayer>> thread_replayers;
+
+		const auto worker = [&](StateReplayer *thread_replayer) {
+			DeferredReplayer deferred;
+			deferred.hash_algorithm = recorder.get_hash_algorithm();
+			vector<uint8_t> state_json;
+
+			size_t index;
+			while ((index = next_index.fetch_add(1, std::memory_order_relaxed)) < batch_count)
+			{
+				Hash hash = hashes[batch_offset + index];
+				if (!read_blob(input_db, tag, hash, state_json, PAYLOAD_READ_CONCURRENT_BIT))
+				{
+					LOGE("Failed to load blob from cache.\n");
+					success = false;
+					return;
+				}
+
+				deferred.object = &objects[index];
+				if (!thread_replayer->parse(deferred, &input_db, state_json.data(), state_json.size()))
+				{
+					LOGE("Failed to parse blob (tag: %d, hash: 0x%" PRIx64 ").\n", tag, hash);
+					objects[index].create_info = nullptr;
+				}
+			}
+		};
+
+		unsigned thread_count = unsigned(std::max<size_t>(1, std::min<size_t>(num_threads, batch_count)));
+		for (unsigned i = 0; i < thread_count; i++)
+		{
+			thread_replayers.emplace_back(new StateReplayer);
+			thread_replayers.back()->set_resolve_shader_module_handles(false);
+			thread_replayers.back()->set_resolve_derivative_pipeline_handles(false);
+			thread_replayers.back()->copy_handle_references(replayer);
+		}
+
+		vector<thread> threads;
+		for (unsigned i = 1; i < thread_count; i++)
+			threads.emplace_back(worker, thread_replayers[i].get());
+		worker(thread_replayers.front().get());
+		for (auto &t : threads)
+			t.join();
+
+		if (!success.load())
+			return false;
+
+		// The recorder copies what it needs, so the parsed objects can go away with the thread replayers.
+		for (auto &object : objects)
+			if (object.create_info)
+				ordered.record(object);
+	}
+
+	ordered.finish();
+	return true;
+}
+
 int main(int argc, char *argv[])
 {
 	CLICallbacks cbs;
 	string input_db_path;
 	string output_db_path;
+	unsigned num_threads = 0;
 
 	unique_ptr<DatabaseInterface> output_db;
 
@@ -134,6 +383,12 @@ int main(int argc, char *argv[])
 		rehash_replayer.filter_application_hash = strtoull(parser.next_string(), nullptr, 16);
 		rehash_replayer.should_filter_application_hash = true;
 	});
+	cbs.add("--hash-xxh64", [&](CLIParser &) { recorder.set_hash_algorithm(HashAlgorithm::XXH64); });
+	cbs.add("--spirv-delta", [&](CLIParser &) {
+		recorder.set_database_shader_module_encoding(ShaderModuleEncoding::SPIRVDelta);
+	});
+	cbs.add("--binary-payloads", [&](CLIParser &) { recorder.set_database_payload_encoding(PayloadEncoding::Binary); });
+	cbs.add("--num-threads", [&](CLIParser &parser) { num_threads = parser.next_uint(); });
 
 	cbs.error_handler = [] { print_help(); };
 
@@ -164,7 +419,18 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	// Objects are still hashed in order on the recording thread, but serialized and compressed on workers.
+	if (num_threads > 1)
+		recorder.set_serialization_worker_count(num_threads);
+
 	StateReplayer replayer;
+	// Shader modules and pipelines are never parsed by this replayer on the first go,
+	// so references to them are just the hash, which is what RehashReplayer hands out anyway.
+	replayer.set_resolve_shader_module_handles(false);
+	replayer.set_resolve_derivative_pipeline_handles(false);
 
 	static const ResourceTag playback_order[] = {
 		RESOURCE_APPLICATION_INFO,
@@ -195,6 +461,13 @@ int main(int argc, char *argv[])
 			return EXIT_FAILURE;
 		}
 
+		if (tag == RESOURCE_SHADER_MODULE || tag == RESOURCE_GRAPHICS_PIPELINE || tag == RESOURCE_COMPUTE_PIPELINE)
+		{
+			if (!rehash_objects(*input_db, recorder, replayer, tag, hashes, num_threads))
+				return EXIT_FAILURE;
+			continue;
+		}
+
 		for (auto hash : hashes)
 		{
 			size_t state_json_size;
@@ -25,6 +25,7 @@
 #define RAPIDJSON_HAS_STDSTRING 1
 #include "rapidjson/document.h"
 #include "rapidjson/writer.h"
+#include "rapidjson/prettywriter.h"
 
 #include "volk.h"
 #include "device.hpp"
@@ -38,6 +39,8 @@
 #include "fossilize_external_replayer_control_block.hpp"
 #include "fossilize_errors.hpp"
 #include "util/object_cache.hpp"
+#include "xxhash64.hpp"
+#include "fossilize_shared_module_cache.hpp"
 
 #include <string>
 #include <unordered_set>
@@ -45,6 +48,7 @@
 #include <string.h>
 #include <chrono>	// VALVE
 #include <queue>	// VALVE
+#include <deque>
 #include <thread>	// VALVE
 #include <mutex>	// VALVE
 #include <condition_variable> // VALVE
@@ -60,6 +64,20 @@
 #include "spirv-tools/libspirv.hpp"
 #endif
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
 using namespace Fossilize;
 using namespace std;
 
@@ -190,14 +208,371 @@ namespace Global
 static thread_local unsigned worker_thread_index;
 }
 
+// The number of pipeline memory contexts in flight is chosen at runtime, up to MAX_PIPELINE_MEMORY_CONTEXTS.
 enum MemoryConstants
 {
-	NUM_MEMORY_CONTEXTS = 4,
-	SHADER_MODULE_MEMORY_CONTEXT = NUM_MEMORY_CONTEXTS - 1,
-	PARENT_PIPELINE_MEMORY_CONTEXT = NUM_MEMORY_CONTEXTS - 2,
-	NUM_PIPELINE_MEMORY_CONTEXTS = NUM_MEMORY_CONTEXTS - 2
+	MAX_PIPELINE_MEMORY_CONTEXTS = 8,
+	DEFAULT_PIPELINE_MEMORY_CONTEXTS = 2,
+	PARENT_PIPELINE_MEMORY_CONTEXT = MAX_PIPELINE_MEMORY_CONTEXTS,
+	SHADER_MODULE_MEMORY_CONTEXT = MAX_PIPELINE_MEMORY_CONTEXTS + 1,
+	NUM_MEMORY_CONTEXTS = MAX_PIPELINE_MEMORY_CONTEXTS + 2
+};
+
+// Returns false if the platform cannot tell us.
+static bool get_system_memory_info(uint64_t &total_bytes, uint64_t &available_bytes)
+{
+#if defined(__linux__)
+	FILE *file = fopen("/proc/meminfo", "r");
+	if (!file)
+		return false;
+
+	bool got_total = false;
+	bool got_available = false;
+	char buffer[1024];
+	while (fgets(buffer, sizeof(buffer), file))
+	{
+		if (strncmp(buffer, "MemTotal:", 9) == 0)
+		{
+			total_bytes = strtoull(buffer + 9, nullptr, 10) * 1024;
+			got_total = true;
+		}
+		else if (strncmp(buffer, "MemAvailable:", 13) == 0)
+		{
+			available_bytes = strtoull(buffer + 13, nullptr, 10) * 1024;
+			got_available = true;
+		}
+	}
+
+	fclose(file);
+	return got_total && got_available;
+#elif defined(_WIN32)
+	MEMORYSTATUSEX status = {};
+	status.dwLength = sizeof(status);
+	if (!GlobalMemoryStatusEx(&status))
+		return false;
+	total_bytes = status.ullTotalPhys;
+	available_bytes = status.ullAvailPhys;
+	return true;
+#else
+	(void)total_bytes;
+	(void)available_bytes;
+	return false;
+#endif
+}
+
+// Below this fraction of available system memory, finished pipeline memory contexts are drained eagerly.
+static bool system_memory_is_under_pressure()
+{
+	uint64_t total_bytes = 0, available_bytes = 0;
+	if (!get_system_memory_info(total_bytes, available_bytes))
+		return false;
+	return available_bytes < total_bytes / 10;
+}
+
+enum class WorkerPriority
+{
+	Normal,
+	// Below normal priority, still gets its fair share once nothing else wants the CPU.
+	Low,
+	// Only runs when a CPU would otherwise be idle, SCHED_IDLE or THREAD_MODE_BACKGROUND_BEGIN.
+	Idle
+};
+
+// Parses CPU lists in the format used by sysfs and taskset -c, e.g. "0-15,32-47".
+static bool parse_cpu_list(const char *str, vector<unsigned> &cpus)
+{
+	cpus.clear();
+	while (*str != '\0' && *str != '\n')
+	{
+		char *end = nullptr;
+		unsigned long first = strtoul(str, &end, 10);
+		if (end == str)
+			return false;
+		unsigned long last = first;
+		str = end;
+
+		if (*str == '-')
+		{
+			str++;
+			last = strtoul(str, &end, 10);
+			if (end == str || last < first)
+				return false;
+			str = end;
+		}
+
+		for (unsigned long cpu = first; cpu <= last; cpu++)
+			cpus.push_back(unsigned(cpu));
+
+		if (*str == ',')
+			str++;
+		else if (*str != '\0' && *str != '\n')
+			return false;
+	}
+
+	return !cpus.empty();
+}
+
+static string format_cpu_list(const vector<unsigned> &cpus)
+{
+	string str;
+	for (auto cpu : cpus)
+	{
+		if (!str.empty())
+			str += ",";
+		str += to_string(cpu);
+	}
+	return str;
+}
+
+#ifdef __linux__
+static bool read_sysfs_cpu_list(const char *path, vector<unsigned> &cpus)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	char buffer[4096];
+	bool ret = fgets(buffer, sizeof(buffer), file) && parse_cpu_list(buffer, cpus);
+	fclose(file);
+	return ret;
+}
+
+// CPUs of every online NUMA node which has any.
+static vector<vector<unsigned>> get_numa_node_cpus()
+{
+	vector<vector<unsigned>> nodes;
+	vector<unsigned> node_ids;
+	if (!read_sysfs_cpu_list("/sys/devices/system/node/online", node_ids))
+		return nodes;
+
+	for (auto node : node_ids)
+	{
+		char path[128];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+		vector<unsigned> cpus;
+		if (read_sysfs_cpu_list(path, cpus))
+			nodes.push_back(move(cpus));
+	}
+
+	return nodes;
+}
+#elif defined(_WIN32)
+// CPU N is bit N % 64 of processor group N / 64.
+static KAFFINITY cpu_list_to_group_mask(const vector<unsigned> &cpus, WORD group)
+{
+	constexpr unsigned bits = sizeof(KAFFINITY) * 8;
+	KAFFINITY mask = 0;
+	for (auto cpu : cpus)
+		if (cpu / bits == group)
+			mask |= KAFFINITY(1) << (cpu % bits);
+	return mask;
+}
+#endif
+
+// Restricts the calling worker thread to the requested CPUs and lowers its priority.
+// With numa_local, slot picks one NUMA node round-robin, so the thread's parsing memory is allocated on
+// first touch from, and stays on, the node it runs on. Threads the driver spawns from here inherit both on Linux.
+static void apply_worker_thread_placement(const vector<unsigned> &cpus, bool numa_local,
+                                          WorkerPriority priority, unsigned slot)
+{
+#if defined(__linux__)
+	vector<unsigned> allowed = cpus;
+	if (numa_local)
+	{
+		auto nodes = get_numa_node_cpus();
+
+		// Only nodes which overlap with the requested CPUs are candidates.
+		if (!cpus.empty())
+		{
+			for (auto &node : nodes)
+			{
+				node.erase(remove_if(node.begin(), node.end(), [&](unsigned cpu) {
+					return find(cpus.begin(), cpus.end(), cpu) == cpus.end();
+				}), node.end());
+			}
+			nodes.erase(remove_if(nodes.begin(), nodes.end(), [](const vector<unsigned> &node) {
+				return node.empty();
+			}), nodes.end());
+		}
+
+		if (!nodes.empty())
+			allowed = nodes[slot % nodes.size()];
+	}
+
+	if (!allowed.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (auto cpu : allowed)
+			if (cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			LOGW("Failed to set worker thread affinity.\n");
+	}
+
+	if (priority == WorkerPriority::Idle)
+	{
+		sched_param param = {};
+		if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+			LOGW("Failed to move worker thread to SCHED_IDLE.\n");
+	}
+	else if (priority == WorkerPriority::Low)
+	{
+		// Nice values are per-thread on Linux.
+		if (setpriority(PRIO_PROCESS, id_t(syscall(SYS_gettid)), 10) < 0)
+			LOGW("Failed to lower worker thread priority.\n");
+	}
+#elif defined(_WIN32)
+	bool set_affinity = false;
+	if (numa_local)
+	{
+		vector<GROUP_AFFINITY> nodes;
+		ULONG highest_node = 0;
+		if (GetNumaHighestNodeNumber(&highest_node))
+		{
+			for (ULONG node = 0; node <= highest_node; node++)
+			{
+				GROUP_AFFINITY affinity = {};
+				if (!GetNumaNodeProcessorMaskEx(USHORT(node), &affinity))
+					continue;
+				if (!cpus.empty())
+					affinity.Mask &= cpu_list_to_group_mask(cpus, affinity.Group);
+				if (affinity.Mask)
+					nodes.push_back(affinity);
+			}
+		}
+
+		if (!nodes.empty())
+		{
+			if (!SetThreadGroupAffinity(GetCurrentThread(), &nodes[slot % nodes.size()], nullptr))
+				LOGW("Failed to set worker thread affinity.\n");
+			set_affinity = true;
+		}
+	}
+
+	if (!set_affinity && !cpus.empty())
+	{
+		GROUP_AFFINITY affinity = {};
+		affinity.Group = 0;
+		affinity.Mask = cpu_list_to_group_mask(cpus, 0);
+		if (!affinity.Mask || !SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr))
+			LOGW("Failed to set worker thread affinity.\n");
+	}
+
+	if (priority == WorkerPriority::Idle)
+	{
+		// Also lowers IO and memory priority of the thread.
+		if (!SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN))
+			LOGW("Failed to move worker thread to background mode.\n");
+	}
+	else if (priority == WorkerPriority::Low)
+	{
+		if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL))
+			LOGW("Failed to lower worker thread priority.\n");
+	}
+#else
+	(void)cpus;
+	(void)numa_local;
+	(void)priority;
+	(void)slot;
+#endif
+}
+
+// Cumulative counters sampled by the adaptive worker governor. Stall times are -1 where PSI is unavailable.
+struct SystemPressureSample
+{
+	uint64_t total_memory = 0;
+	uint64_t available_memory = 0;
+	uint64_t major_faults = 0;
+	int64_t io_stalled_us = -1;
+	int64_t memory_stalled_us = -1;
+	int64_t timestamp_ns = 0;
 };
 
+#ifdef __linux__
+static int64_t read_pressure_stall_total_us(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return -1;
+
+	int64_t total_us = -1;
+	char buffer[1024];
+	if (fgets(buffer, sizeof(buffer), file) && strncmp(buffer, "some ", 5) == 0)
+	{
+		const char *total = strstr(buffer, "total=");
+		if (total)
+			total_us = int64_t(strtoull(total + 6, nullptr, 10));
+	}
+
+	fclose(file);
+	return total_us;
+}
+#endif
+
+static void sample_system_pressure(SystemPressureSample &sample)
+{
+	if (!get_system_memory_info(sample.total_memory, sample.available_memory))
+		sample.total_memory = sample.available_memory = 0;
+
+#ifdef __linux__
+	rusage usage = {};
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		sample.major_faults = uint64_t(usage.ru_majflt);
+	sample.io_stalled_us = read_pressure_stall_total_us("/proc/pressure/io");
+	sample.memory_stalled_us = read_pressure_stall_total_us("/proc/pressure/memory");
+#endif
+
+	sample.timestamp_ns = chrono::duration_cast<chrono::nanoseconds>(
+			chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Same idea as the robust replayer's process throttling, one worker at a time.
+// Backs off when memory runs low, when pages we need are being faulted back in, or when
+// the machine stalls on IO or memory. Only goes back up once every signal is calm again.
+static unsigned adapt_active_worker_count(const SystemPressureSample &old_sample, const SystemPressureSample &new_sample,
+                                          unsigned active_workers, unsigned max_workers)
+{
+	float delta_us = 1e-3f * float(new_sample.timestamp_ns - old_sample.timestamp_ns);
+	if (delta_us <= 0.0f)
+		return active_workers;
+
+	bool go_down = false;
+	bool go_up = true;
+
+	if (new_sample.total_memory)
+	{
+		if (new_sample.available_memory < new_sample.total_memory / 10)
+			go_down = true;
+		else if (new_sample.available_memory < new_sample.total_memory / 5)
+			go_up = false;
+	}
+
+	float major_faults_per_second = 1e6f * float(new_sample.major_faults - old_sample.major_faults) / delta_us;
+	if (major_faults_per_second > 100.0f)
+		go_down = true;
+	else if (major_faults_per_second > 10.0f)
+		go_up = false;
+
+	float stall_ratio = -1.0f;
+	if (new_sample.io_stalled_us >= 0 && old_sample.io_stalled_us >= 0)
+		stall_ratio = float(new_sample.io_stalled_us - old_sample.io_stalled_us) / delta_us;
+	if (new_sample.memory_stalled_us >= 0 && old_sample.memory_stalled_us >= 0)
+		stall_ratio = std::max(stall_ratio, float(new_sample.memory_stalled_us - old_sample.memory_stalled_us) / delta_us);
+
+	if (stall_ratio > 0.3f)
+		go_down = true;
+	else if (stall_ratio >= 0.1f)
+		go_up = false;
+
+	if (go_down)
+		return std::max(1u, active_workers - 1);
+	else if (go_up)
+		return std::min(max_workers, active_workers + 1);
+	else
+		return active_workers;
+}
+
 struct EnqueuedWork
 {
 	unsigned order_index;
@@ -209,19 +584,178 @@ static void on_validation_error(void *userdata);
 static void timeout_handler();
 #endif
 
+// Used to key files which are only valid for one driver and GPU, e.g. replayer caches and merged pipeline caches.
+static std::string pipeline_cache_uuid_string(const VkPhysicalDeviceProperties &props)
+{
+	const auto to_hex = [](uint8_t v) -> char {
+		if (v < 10)
+			return char('0' + v);
+		else
+			return char('a' + (v - 10));
+	};
+
+	std::string uuid;
+	uuid.reserve(2 * VK_UUID_SIZE);
+	for (unsigned i = 0; i < VK_UUID_SIZE; i++)
+	{
+		uuid.push_back(to_hex(props.pipelineCacheUUID[i] & 0xf));
+		uuid.push_back(to_hex((props.pipelineCacheUUID[i] >> 4) & 0xf));
+	}
+	return uuid;
+}
+
+// Replayer caches record what one driver has already compiled. Driver updates do not always bump pipelineCacheUUID,
+// so the vendor, device and driver version are part of the key too.
+static std::string replayer_cache_key_string(const VkPhysicalDeviceProperties &props)
+{
+	char ids[3 * 9 + 1];
+	snprintf(ids, sizeof(ids), ".%08x.%08x.%08x", props.vendorID, props.deviceID, props.driverVersion);
+	return pipeline_cache_uuid_string(props) + ids;
+}
+
+// Children of earlier runs appended what they replayed to <cache>.N.foz, fold those into <cache>.foz,
+// which is the only archive a replayer cache is primed from.
+static void fold_replayer_cache_deltas(const std::string &cache_path)
+{
+	std::vector<std::string> paths;
+	for (unsigned idx = 1; idx < 256; idx++)
+	{
+		auto path = cache_path + "." + std::to_string(idx) + ".foz";
+		FILE *file = fopen(path.c_str(), "rb");
+		if (!file)
+			continue;
+		fclose(file);
+		paths.push_back(std::move(path));
+	}
+
+	if (paths.empty())
+		return;
+
+	std::vector<const char *> path_ptrs;
+	for (auto &path : paths)
+		path_ptrs.push_back(path.c_str());
+
+	auto base_path = cache_path + ".foz";
+	if (!merge_concurrent_databases(base_path.c_str(), path_ptrs.data(), path_ptrs.size()))
+	{
+		LOGE("Failed to merge replayer cache into %s.\n", base_path.c_str());
+		return;
+	}
+
+	for (auto &path : paths)
+		remove(path.c_str());
+}
+
+static bool validate_pipeline_cache_header(VkPhysicalDevice gpu, const uint8_t *blob, size_t size)
+{
+	if (size < 16 + VK_UUID_SIZE)
+	{
+		LOGI("Pipeline cache header is too small.\n");
+		return false;
+	}
+
+	const auto read_le = [&](unsigned offset) -> uint32_t {
+		return uint32_t(blob[offset + 0]) |
+			(uint32_t(blob[offset + 1]) << 8) |
+			(uint32_t(blob[offset + 2]) << 16) |
+			(uint32_t(blob[offset + 3]) << 24);
+	};
+
+	auto length = read_le(0);
+	if (length != 16 + VK_UUID_SIZE)
+	{
+		LOGI("Length of pipeline cache header is not as expected.\n");
+		return false;
+	}
+
+	auto version = read_le(4);
+	if (version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+	{
+		LOGI("Version of pipeline cache header is not 1.\n");
+		return false;
+	}
+
+	VkPhysicalDeviceProperties props = {};
+	vkGetPhysicalDeviceProperties(gpu, &props);
+	if (props.vendorID != read_le(8))
+	{
+		LOGI("Mismatch of vendorID and cache vendorID.\n");
+		return false;
+	}
+
+	if (props.deviceID != read_le(12))
+	{
+		LOGI("Mismatch of deviceID and cache deviceID.\n");
+		return false;
+	}
+
+	if (memcmp(props.pipelineCacheUUID, blob + 16, VK_UUID_SIZE) != 0)
+	{
+		LOGI("Mismatch between pipelineCacheUUID.\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Deadline for --time-budget. Child processes are started with whatever is left of the budget,
+// so restarted children share the deadline of the replay as a whole.
+struct TimeBudget
+{
+	TimeBudget() = default;
+
+	explicit TimeBudget(unsigned seconds)
+		: enabled(seconds != 0), deadline(chrono::steady_clock::now() + chrono::seconds(seconds))
+	{
+	}
+
+	bool exhausted() const
+	{
+		return enabled && chrono::steady_clock::now() >= deadline;
+	}
+
+	// Rounded up, and never 0, since 0 disables the budget.
+	unsigned remaining_seconds() const
+	{
+		auto remaining_ms = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+		return remaining_ms > 0 ? unsigned((remaining_ms + 999) / 1000) : 1u;
+	}
+
+	bool enabled = false;
+	chrono::steady_clock::time_point deadline;
+};
+
 struct ThreadedReplayer : StateCreatorInterface
 {
 	struct Options
 	{
 		bool spirv_validate = false;
+		// Threads validating SPIR-V ahead of the pipelines which need it. 0 picks a quarter of num_threads.
+		unsigned spirv_validation_threads = 0;
 		bool ignore_derived_pipelines = false;
+		bool prioritize_hot_pipelines = false;
+		bool prioritize_expensive_pipelines = false;
+		bool module_affinity_order = false;
+		// Samplers, layouts and render passes are replayed by the workers when a pipeline first needs them,
+		// rather than all of them up front.
+		bool lazy_trivial_objects = false;
+		bool scratch_huge_pages = false;
+		bool graphics_pipeline_library = false;
+		bool inline_shader_modules = false;
+		bool probe_pipeline_cache = false;
 		bool pipeline_stats = false;
 		string on_disk_pipeline_cache_path;
 		string on_disk_validation_cache_path;
 		string on_disk_validation_whitelist_path;
 		string on_disk_validation_blacklist_path;
 		string pipeline_stats_path;
+		string pipeline_cost_history_path;
+		string pipeline_binary_archive_path;
+		string benchmark_report_path;
+		string trace_path;
 		string replayer_cache_path;
+		// Set by the robust master, which loads the replayer cache once and exports its hashes to every child.
+		intptr_t replayer_cache_metadata = DatabaseInterface::invalid_metadata_handle();
 		vector<unsigned> implicit_whitelist_database_indices;
 
 		// VALVE: Add multi-threaded pipeline creation
@@ -232,6 +766,53 @@ struct ThreadedReplayer : StateCreatorInterface
 
 		unsigned shader_cache_size_mb = 256;
 
+		// Max number of pipelines to pass to a single vkCreate*Pipelines call.
+		unsigned pipeline_batch_size = 1;
+
+		// Number of chunks of pipelines which can be parsed and compiled at the same time.
+		// 0 picks a depth based on the thread count.
+		unsigned pipeline_memory_contexts = 0;
+
+		// Size of the decoded SPIR-V cache shared between child processes. 0 disables it.
+		unsigned shared_module_cache_mb = 0;
+
+		// Keep a warmed-up standby child per process, which takes over as soon as a child crashes.
+		bool spare_processes = false;
+
+		// Delegated cgroup v2 directory to run child processes in, with optional limits.
+		std::string cgroup_path;
+		unsigned cgroup_memory_high_mb = 0;
+		unsigned cgroup_cpu_weight = 0;
+
+		// Windows job object limit on committed memory of all child processes.
+		unsigned job_memory_limit_mb = 0;
+
+		// Only replay the pipelines in one of shard_count disjoint shards. 0 replays everything.
+		unsigned shard_index = 0;
+		unsigned shard_count = 0;
+
+		// Only replay the pipelines linked to this application feature hash. 0 replays everything.
+		Hash filter_application_hash = 0;
+
+		// Stop compiling pipelines once this many seconds have passed. 0 means no limit.
+		unsigned time_budget_seconds = 0;
+
+		// Parks and unparks worker threads at runtime under memory and IO pressure, see adapt_active_worker_count().
+		bool adaptive_workers = false;
+
+		// Placement and scheduling priority of worker threads, see apply_worker_thread_placement().
+		vector<unsigned> worker_cpus;
+		bool numa_local_workers = false;
+		WorkerPriority worker_priority = WorkerPriority::Normal;
+		// Added to the worker thread index when picking a NUMA node. Child process N of the robust replayer uses N.
+		// It also publishes its tracked memory into slot N + 1 of the control block, see publish_tracked_memory().
+		unsigned worker_slot_offset = 0;
+
+		// Robust replayer only. Child process N replays on device_indices[N % size], empty uses the device options as-is.
+		vector<unsigned> device_indices;
+
+		ObjectCacheEvictionPolicy shader_cache_policy = ObjectCacheEvictionPolicy::LeastRecentlyUsed;
+
 		// Hash for replaying a single pipeline
 		Hash pipeline_hash = 0;
 
@@ -243,10 +824,14 @@ struct ThreadedReplayer : StateCreatorInterface
 		unsigned end_compute_index = ~0u;
 
 		SharedControlBlock *control_block = nullptr;
+		SharedModuleCache *shared_module_cache = nullptr;
 
 		void (*on_thread_callback)(void *userdata) = nullptr;
 		void *on_thread_callback_userdata = nullptr;
 		void (*on_validation_error_callback)(ThreadedReplayer *) = nullptr;
+		// Called once the device exists and the trivial objects are replayed, before any pipelines are.
+		// Returning false ends the replay.
+		bool (*on_warmup_complete_callback)(ThreadedReplayer *) = nullptr;
 
 		unsigned timeout_seconds = 0;
 	};
@@ -300,6 +885,37 @@ struct ThreadedReplayer : StateCreatorInterface
 		} hash_map_entry = {};
 	};
 
+	struct TimingSample
+	{
+		ResourceTag tag;
+		Hash hash;
+		uint64_t duration_ns;
+	};
+
+	struct TraceEvent
+	{
+		const char *name;
+		Hash hash;
+		unsigned memory_context_index;
+		uint64_t start_ns;
+		uint64_t duration_ns;
+	};
+
+	// With --inline-shader-modules, shader module handles point to one of these rather than a VkShaderModule.
+	// The SPIR-V is passed to the driver in the pNext of every shader stage which uses it.
+	struct InlineShaderModule
+	{
+		Hash hash;
+		VkShaderModuleCreateInfo create_info;
+		// Empty if the code lives in the shared module cache.
+		std::vector<uint32_t> code;
+	};
+
+	static InlineShaderModule *get_inline_shader_module(VkShaderModule module)
+	{
+		return reinterpret_cast<InlineShaderModule *>(uintptr_t(module));
+	}
+
 	struct PerThreadData
 	{
 		StateReplayer *per_thread_replayers = nullptr;
@@ -315,12 +931,19 @@ struct ThreadedReplayer : StateCreatorInterface
 
 		bool force_outside_range = false;
 		bool triggered_validation_error = false;
+		bool in_pipeline_batch = false;
+
+		// Only filled in when writing a benchmark report or trace.
+		std::vector<TimingSample> timing_samples;
+		std::vector<TraceEvent> trace_events;
+		uint64_t idle_ns = 0;
+		uint64_t busy_ns = 0;
 	};
 
 	ThreadedReplayer(const VulkanDevice::Options &device_opts_, const Options &opts_)
 		: opts(opts_),
 		  num_worker_threads(opts.num_threads), loop_count(opts.loop_count),
-		  device_opts(device_opts_)
+		  device_opts(device_opts_), time_budget(opts.time_budget_seconds)
 	{
 		// Cannot use initializers for atomics.
 		graphics_pipeline_ns.store(0);
@@ -333,12 +956,39 @@ struct ThreadedReplayer : StateCreatorInterface
 		thread_total_ns.store(0);
 		total_idle_ns.store(0);
 		total_peak_memory.store(0);
+		scratch_block_allocations.store(0);
+		feature_filter_memo_hits.store(0);
+		scratch_block_reuses.store(0);
 		pipeline_cache_hits.store(0);
 		pipeline_cache_misses.store(0);
+		graphics_library_count.store(0);
+		graphics_library_hits.store(0);
+		graphics_linked_pipeline_count.store(0);
+		pipeline_binary_count.store(0);
+		shared_module_cache_hits.store(0);
+		time_budget_skipped_count.store(0);
+		available_work_items.store(0);
+		sleeping_workers.store(0);
+		active_worker_limit.store(~0u);
+		shutting_down.store(false);
+		for (unsigned i = 0; i < NUM_MEMORY_CONTEXTS; i++)
+		{
+			queued_count[i].store(0);
+			completed_count[i].store(0);
+			context_waiters[i].store(false);
+		}
+
+		// Deeper pipelining keeps more workers busy, a couple of contexts per eight threads is plenty.
+		num_pipeline_memory_contexts = opts.pipeline_memory_contexts;
+		if (num_pipeline_memory_contexts == 0)
+			num_pipeline_memory_contexts = max<unsigned>(DEFAULT_PIPELINE_MEMORY_CONTEXTS, num_worker_threads / 8);
+		num_pipeline_memory_contexts = min<unsigned>(num_pipeline_memory_contexts, MAX_PIPELINE_MEMORY_CONTEXTS);
 
 		shader_module_total_compressed_size.store(0);
 		shader_module_total_size.store(0);
 		per_thread_data.resize(num_worker_threads + 1);
+		worker_parse_buffer_bytes.reset(new std::atomic<std::uint64_t>[num_worker_threads + 1]());
+		last_tracked_memory_publish_ns.store(0);
 
 		// Could potentially overflow on 32-bit.
 #if ((SIZE_MAX / (1024 * 1024)) < UINT_MAX)
@@ -352,6 +1002,10 @@ struct ThreadedReplayer : StateCreatorInterface
 #endif
 
 		shader_modules.set_target_size(target_size);
+		shader_modules.set_eviction_policy(opts.shader_cache_policy);
+
+		// Libraries are counted rather than sized, we cannot know how much memory the driver spends on them.
+		graphics_libraries.set_target_size(1024);
 		init_whitelist_db();
 		init_blacklist_db();
 	}
@@ -361,6 +1015,24 @@ struct ThreadedReplayer : StateCreatorInterface
 		return per_thread_data[Global::worker_thread_index];
 	}
 
+	void record_timing_sample(ResourceTag tag, Hash hash, uint64_t duration_ns)
+	{
+		if (!opts.benchmark_report_path.empty())
+			get_per_thread_data().timing_samples.push_back({ tag, hash, duration_ns });
+	}
+
+	// name must be a string literal, it is written out as-is.
+	void record_trace_event(const char *name, Hash hash, unsigned memory_context_index,
+	                        chrono::steady_clock::time_point start_time, chrono::steady_clock::time_point end_time)
+	{
+		if (opts.trace_path.empty())
+			return;
+
+		uint64_t start_ns = chrono::duration_cast<chrono::nanoseconds>(start_time.time_since_epoch()).count();
+		uint64_t duration_ns = chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
+		get_per_thread_data().trace_events.push_back({ name, hash, memory_context_index, start_ns, duration_ns });
+	}
+
 	void init_whitelist_db()
 	{
 		if (!opts.on_disk_validation_whitelist_path.empty())
@@ -393,6 +1065,15 @@ struct ThreadedReplayer : StateCreatorInterface
 		size_t size = 0;
 
 		const auto resolve = [&](ResourceTag tag) -> bool {
+			// Look up hashes directly in the database's tables if it lets us, rather than in a copy.
+			DatabaseHashView view;
+			if (iface.get_hash_view_for_resource_tag(tag, &view))
+			{
+				if (!view.empty())
+					implicit_whitelist_views[tag].push_back(view);
+				return true;
+			}
+
 			if (!iface.get_hash_list_for_resource_tag(tag, &size, nullptr))
 				return false;
 			hashes.resize(size);
@@ -439,27 +1120,43 @@ struct ThreadedReplayer : StateCreatorInterface
 		if (!device)
 			return false;
 
-		auto &props = device->get_gpu_properties();
-		char uuid[2 * VK_UUID_SIZE + 1];
-		uuid[2 * VK_UUID_SIZE] = '\0';
+		auto key = replayer_cache_key_string(device->get_gpu_properties());
 
-		const auto to_hex = [](uint8_t v) -> char {
-			if (v < 10)
-				return char('0' + v);
-			else
-				return char('a' + (v - 10));
-		};
+		// Robust child processes run concurrently with each other, the master folds the cache for them.
+		if (!robustness)
+			fold_replayer_cache_deltas(opts.replayer_cache_path + "." + key);
+
+		replayer_cache_db.reset(create_concurrent_database((opts.replayer_cache_path + "." + key).c_str(), DatabaseMode::Append, nullptr, 0));
+		if (!replayer_cache_db)
+			return false;
 
-		for (unsigned i = 0; i < VK_UUID_SIZE; i++)
+		// The master already loaded the cache, so test its exported bloom filters and hash lists instead of reading it again.
+		if (DatabaseInterface::metadata_handle_is_valid(opts.replayer_cache_metadata) &&
+		    !replayer_cache_db->import_metadata_from_os_handle(opts.replayer_cache_metadata))
 		{
-			uuid[2 * i + 0] = to_hex(props.pipelineCacheUUID[i] & 0xf);
-			uuid[2 * i + 1] = to_hex((props.pipelineCacheUUID[i] >> 4) & 0xf);
+			LOGW("Failed to import replayer cache metadata, reading the cache directly.\n");
 		}
 
-		replayer_cache_db.reset(create_concurrent_database((opts.replayer_cache_path + "." + uuid).c_str(), DatabaseMode::Append, nullptr, 0));
-		if (!replayer_cache_db || !replayer_cache_db->prepare())
+		if (!replayer_cache_db->prepare())
 			return false;
-		return true;
+
+		// Objects the feature filter rejected, for this exact set of enabled features.
+		// A different driver version or feature set gets a different fingerprint, and thus a fresh memo.
+		uint64_t fingerprint = device->get_feature_filter().get_device_fingerprint();
+		if (fingerprint)
+		{
+			char fingerprint_str[17];
+			snprintf(fingerprint_str, sizeof(fingerprint_str), "%016" PRIx64, fingerprint);
+			auto memo_path = opts.replayer_cache_path + "." + key + ".filter." + fingerprint_str;
+			feature_filter_memo_db.reset(create_concurrent_database(memo_path.c_str(), DatabaseMode::Append, nullptr, 0));
+			if (!feature_filter_memo_db || !feature_filter_memo_db->prepare())
+			{
+				LOGW("Failed to open feature filter memo, filtering all objects.\n");
+				feature_filter_memo_db.reset();
+			}
+		}
+
+		return true;
 	}
 
 	void start_worker_threads()
@@ -474,14 +1171,23 @@ struct ThreadedReplayer : StateCreatorInterface
 			d.current_compute_index = opts.start_compute_index;
 		}
 
+		worker_queues.reset(new WorkerQueue[num_worker_threads]);
+		active_worker_limit.store(num_worker_threads);
+		min_active_worker_limit = num_worker_threads;
+
 		// Create a thread pool with the # of specified worker threads (defaults to thread::hardware_concurrency()).
 		for (unsigned i = 0; i < num_worker_threads; i++)
 			thread_pool.push_back(std::thread(&ThreadedReplayer::worker_thread, this, i + 1));
 
+		if (pipeline_stats_db)
+			start_pipeline_stats_thread();
+		if (opts.adaptive_workers && num_worker_threads > 1)
+			start_worker_governor_thread();
+
 		// Make sure all threads have started so we can poke around the per thread allocators from
 		// the main thread when the memory contexts in each thread have been drained.
 		{
-			unique_lock<mutex> holder(pipeline_work_queue_mutex);
+			unique_lock<mutex> holder(worker_wait_mutex);
 			work_done_condition[0].wait(holder, [&]() -> bool {
 				return thread_initialized_count == num_worker_threads;
 			});
@@ -514,29 +1220,42 @@ struct ThreadedReplayer : StateCreatorInterface
 		}
 	}
 
+	void reset_memory_context_allocators(unsigned index)
+	{
+		for (auto &data : per_thread_data)
+			if (data.per_thread_replayers)
+				data.per_thread_replayers[index].get_allocator().reset();
+	}
+
 	void sync_worker_memory_context(unsigned index)
 	{
 		assert(index < NUM_MEMORY_CONTEXTS);
-		unique_lock<mutex> lock(pipeline_work_queue_mutex);
+		flush_work_items();
 
-		if (queued_count[index] == completed_count[index])
+		unique_lock<mutex> lock(worker_wait_mutex);
+		if (queued_count[index].load() == completed_count[index].load())
 		{
 			reset_memory_context_pipeline_cache(index);
 			return;
 		}
 
+		auto stall_start_time = chrono::steady_clock::now();
+
+		// Workers only take the lock to wake us up while this is set.
+		context_waiters[index].store(true);
+
 		if (opts.timeout_seconds != 0)
 		{
 			bool signalled;
-			unsigned current_completed = completed_count[index];
+			unsigned current_completed = completed_count[index].load();
 			do
 			{
 				signalled = work_done_condition[index].wait_for(lock, std::chrono::seconds(opts.timeout_seconds),
 				                                                [&]() -> bool
 				                                                {
-					                                                return current_completed != completed_count[index];
+					                                                return current_completed != completed_count[index].load();
 				                                                });
-				if (!signalled && completed_count[index] == current_completed)
+				if (!signalled && completed_count[index].load() == current_completed)
 				{
 #ifndef NO_ROBUST_REPLAYER
 					timeout_handler();
@@ -546,46 +1265,103 @@ struct ThreadedReplayer : StateCreatorInterface
 #endif
 				}
 
-				current_completed = completed_count[index];
-			} while (queued_count[index] != completed_count[index]);
+				current_completed = completed_count[index].load();
+			} while (queued_count[index].load() != current_completed);
 		}
 		else
 		{
 			work_done_condition[index].wait(lock, [&]() -> bool
 			{
-				return queued_count[index] == completed_count[index];
+				return queued_count[index].load() == completed_count[index].load();
 			});
 		}
+
+		context_waiters[index].store(false);
+		auto stall_end_time = chrono::steady_clock::now();
+		memory_context_stall_ns[index] += chrono::duration_cast<chrono::nanoseconds>(stall_end_time - stall_start_time).count();
+		record_trace_event("sync_memory_context", 0, index, stall_start_time, stall_end_time);
 		reset_memory_context_pipeline_cache(index);
 	}
 
+	bool create_shader_module_from_shared_cache(Hash hash)
+	{
+		const uint32_t *code;
+		size_t code_size;
+		uint32_t flags;
+		if (!opts.shared_module_cache->find(hash, &code, &code_size, &flags))
+			return false;
+
+		VkShaderModuleCreateInfo info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+		info.flags = flags;
+		info.codeSize = code_size;
+		info.pCode = code;
+
+		VkShaderModule module;
+		if (!enqueue_create_shader_module(hash, &info, &module))
+			return false;
+
+		shared_module_cache_hits.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
 	bool run_parse_work_item(StateReplayer &replayer, vector<uint8_t> &buffer, const PipelineWorkItem &work_item)
 	{
-		size_t json_size = 0;
-		if (!global_database->read_entry(work_item.tag, work_item.hash, &json_size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
+		auto read_start_time = chrono::steady_clock::now();
+
+		// Another process might have decoded this module already.
+		if (work_item.tag == RESOURCE_SHADER_MODULE && opts.shared_module_cache &&
+		    create_shader_module_from_shared_cache(work_item.hash))
 		{
-			LOGW("Entry (%u: %016" PRIx64 ") does not exist, this might be benign depending on where the archive comes from.\n",
-			     unsigned(work_item.tag), work_item.hash);
-			if (work_item.tag == RESOURCE_SHADER_MODULE && opts.control_block)
-				opts.control_block->parsed_module_failures.fetch_add(1, std::memory_order_relaxed);
-			return false;
+			record_trace_event("shared_module_cache_hit", work_item.hash, ~0u, read_start_time, chrono::steady_clock::now());
+			return true;
 		}
 
-		buffer.resize(json_size);
+		size_t json_size = 0;
+		const void *json_data = nullptr;
+		void *insitu_data = nullptr;
 
-		if (!global_database->read_entry(work_item.tag, work_item.hash, &json_size, buffer.data(), PAYLOAD_READ_CONCURRENT_BIT))
+		// If the archive is memory mapped and the payload is not compressed, we can parse straight from the mapping.
+		if (!global_database->read_entry_zero_copy(work_item.tag, work_item.hash, &json_size, &json_data, PAYLOAD_READ_CONCURRENT_BIT))
 		{
-			LOGW("Entry (%u: %016" PRIx64 ") does not exist, this might be benign depending on where the archive comes from.\n",
-			     unsigned(work_item.tag), work_item.hash);
-			return false;
+			if (!global_database->read_entry(work_item.tag, work_item.hash, &json_size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
+			{
+				LOGW("Entry (%u: %016" PRIx64 ") does not exist, this might be benign depending on where the archive comes from.\n",
+				     unsigned(work_item.tag), work_item.hash);
+				if (work_item.tag == RESOURCE_SHADER_MODULE && opts.control_block)
+					opts.control_block->parsed_module_failures.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			// One spare byte so the payload can be parsed in place.
+			buffer.resize(json_size + 1);
+
+			if (!global_database->read_entry(work_item.tag, work_item.hash, &json_size, buffer.data(), PAYLOAD_READ_CONCURRENT_BIT))
+			{
+				LOGW("Entry (%u: %016" PRIx64 ") does not exist, this might be benign depending on where the archive comes from.\n",
+				     unsigned(work_item.tag), work_item.hash);
+				return false;
+			}
+
+			insitu_data = buffer.data();
 		}
 
+		auto parse_start_time = chrono::steady_clock::now();
+		record_trace_event("read", work_item.hash, ~0u, read_start_time, parse_start_time);
+
 		auto &per_thread = get_per_thread_data();
 		per_thread.current_parse_index = work_item.index;
 		per_thread.force_outside_range = work_item.force_outside_range;
 		per_thread.memory_context_index = work_item.memory_context_index;
 
-		if (!replayer.parse(*this, global_database, buffer.data(), buffer.size()))
+		bool parsed;
+		if (insitu_data)
+			parsed = replayer.parse_insitu(*this, global_database, insitu_data, json_size);
+		else
+			parsed = replayer.parse(*this, global_database, json_data, json_size);
+
+		record_trace_event("parse", work_item.hash, ~0u, parse_start_time, chrono::steady_clock::now());
+
+		if (!parsed)
 		{
 			LOGW("Did not replay blob (tag: %d, hash: 0x%016" PRIx64 "). See previous logs for context.\n",
 			     work_item.tag, work_item.hash);
@@ -634,14 +1410,15 @@ struct ThreadedReplayer : StateCreatorInterface
 		return true;
 	}
 
-	void get_pipeline_stats(ResourceTag tag, Hash hash, VkPipeline pipeline)
+	bool serialize_pipeline_stats(ResourceTag tag, Hash hash, VkPipeline pipeline, uint64_t compile_time_ns,
+	                              rapidjson::StringBuffer &buffer)
 	{
 		VkPipelineInfoKHR pipeline_info = { VK_STRUCTURE_TYPE_PIPELINE_INFO_KHR };
 		pipeline_info.pipeline = pipeline;
 
 		uint32_t pe_count = 0;
 		if (vkGetPipelineExecutablePropertiesKHR(device->get_device(), &pipeline_info, &pe_count, nullptr) != VK_SUCCESS)
-			return;
+			return false;
 
 		if (pe_count > 0)
 		{
@@ -657,11 +1434,12 @@ struct ThreadedReplayer : StateCreatorInterface
 			doc.AddMember("db_path", db_path, alloc);
 			doc.AddMember("pipeline", std::string(hash_str), alloc);
 			doc.AddMember("pipeline_type", std::string(tag == RESOURCE_GRAPHICS_PIPELINE ? "GRAPHICS" : "COMPUTE"), alloc);
+			doc.AddMember("compile_time_ns", compile_time_ns, alloc);
 
 			rapidjson::Value execs(rapidjson::kArrayType);
 			vector<VkPipelineExecutablePropertiesKHR> pipe_executables(pe_count);
 			if (vkGetPipelineExecutablePropertiesKHR(device->get_device(), &pipeline_info, &pe_count, pipe_executables.data()) != VK_SUCCESS)
-				return;
+				return false;
 
 			for (uint32_t exec = 0; exec < pe_count; exec++)
 			{
@@ -716,231 +1494,624 @@ struct ThreadedReplayer : StateCreatorInterface
 			}
 			doc.AddMember("executables", execs, alloc);
 
-			rapidjson::StringBuffer buffer;
 			rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
 			doc.Accept(writer);
+			return true;
+		}
 
-			if (pipeline_stats_db)
-			{
-				// Need lock here because multiple threads could be in flight.
-				lock_guard<mutex> lock(pipeline_stats_queue_mutex);
+		return false;
+	}
 
-				if (pipeline_stats_db->write_entry(tag, hash, buffer.GetString(), buffer.GetLength(), 0))
-					pipeline_stats_db->flush();
-				else
-					LOGE("Failed to write pipeline stats entry to database.\n");
-			}
-		}
+	void write_pipeline_stats(ResourceTag tag, Hash hash, const rapidjson::StringBuffer &buffer)
+	{
+		if (!pipeline_stats_db->write_entry(tag, hash, buffer.GetString(), buffer.GetLength(), 0))
+			LOGE("Failed to write pipeline stats entry to database.\n");
 	}
 
-	void blacklist_resource(ResourceTag tag, Hash hash)
+	void get_pipeline_stats(ResourceTag tag, Hash hash, VkPipeline pipeline, uint64_t compile_time_ns)
 	{
-		if (validation_blacklist_db)
+		rapidjson::StringBuffer buffer;
+		if (!pipeline_stats_db || !serialize_pipeline_stats(tag, hash, pipeline, compile_time_ns, buffer))
+			return;
+
+		// Need lock here because multiple threads could be in flight.
+		lock_guard<mutex> lock(pipeline_stats_db_mutex);
+		write_pipeline_stats(tag, hash, buffer);
+		pipeline_stats_db->flush();
+	}
+
+	// Hands a freshly compiled pipeline over to the stats thread, which queries its statistics and destroys it.
+	// This keeps the executable queries and database writes off the workers, so they only measure compilation.
+	void enqueue_pipeline_stats(ResourceTag tag, Hash hash, VkPipeline pipeline, uint64_t compile_time_ns)
+	{
+		if (!pipeline_stats_thread.joinable())
 		{
-			lock_guard<mutex> holder{validation_db_mutex};
-			validation_blacklist_db->write_entry(tag, hash, nullptr, 0, 0);
+			get_pipeline_stats(tag, hash, pipeline, compile_time_ns);
+			vkDestroyPipeline(device->get_device(), pipeline, nullptr);
+			return;
 		}
+
+		unique_lock<mutex> holder(pipeline_stats_queue_mutex);
+		// Every queued pipeline is still alive, so don't let the stats thread fall arbitrarily far behind.
+		pipeline_stats_space_condition.wait(holder, [&]() -> bool {
+			return pipeline_stats_queue.size() < MAX_PENDING_PIPELINE_STATS;
+		});
+		pipeline_stats_queue.push_back({ tag, hash, pipeline, compile_time_ns });
+		pipeline_stats_work_condition.notify_one();
 	}
 
-	void whitelist_resource(ResourceTag tag, Hash hash)
+	void pipeline_stats_thread_main()
 	{
-		if (validation_whitelist_db)
+		vector<PipelineStatsWork> batch;
+		for (;;)
 		{
-			lock_guard<mutex> holder{validation_db_mutex};
-			validation_whitelist_db->write_entry(tag, hash, nullptr, 0, 0);
+			{
+				unique_lock<mutex> holder(pipeline_stats_queue_mutex);
+				pipeline_stats_work_condition.wait(holder, [&]() -> bool {
+					return !pipeline_stats_queue.empty() || pipeline_stats_thread_done;
+				});
+
+				if (pipeline_stats_queue.empty())
+					break;
+
+				batch.assign(pipeline_stats_queue.begin(), pipeline_stats_queue.end());
+				pipeline_stats_queue.clear();
+				pipeline_stats_space_condition.notify_all();
+			}
+
+			// Write everything which piled up since the last wakeup, then flush once.
+			lock_guard<mutex> lock(pipeline_stats_db_mutex);
+			for (auto &work : batch)
+			{
+				rapidjson::StringBuffer buffer;
+				if (serialize_pipeline_stats(work.tag, work.hash, work.pipeline, work.compile_time_ns, buffer))
+					write_pipeline_stats(work.tag, work.hash, buffer);
+				vkDestroyPipeline(device->get_device(), work.pipeline, nullptr);
+			}
+			pipeline_stats_db->flush();
 		}
 	}
 
-	void mark_replayed_resource(ResourceTag tag, Hash hash)
+	void start_pipeline_stats_thread()
 	{
-		if (replayer_cache_db)
+		pipeline_stats_thread_done = false;
+		pipeline_stats_thread = std::thread(&ThreadedReplayer::pipeline_stats_thread_main, this);
+	}
+
+	void tear_down_pipeline_stats_thread()
+	{
+		if (!pipeline_stats_thread.joinable())
+			return;
+
 		{
-			lock_guard<mutex> holder{replayer_cache_mutex};
-			replayer_cache_db->write_entry(tag, hash, nullptr, 0, 0);
+			lock_guard<mutex> holder(pipeline_stats_queue_mutex);
+			pipeline_stats_thread_done = true;
+			pipeline_stats_work_condition.notify_one();
 		}
+		pipeline_stats_thread.join();
 	}
 
-	bool has_resource_in_whitelist(ResourceTag tag, Hash hash)
+	// Workers at or above the limit finish what they are doing, then sleep until the limit is raised again.
+	// Their queues are drained by the others through work stealing.
+	bool worker_is_parked(unsigned worker_index) const
 	{
-		if (validation_whitelist_db)
+		return worker_index >= active_worker_limit.load(std::memory_order_relaxed);
+	}
+
+	void set_active_worker_limit(unsigned limit)
+	{
+		unsigned old_limit = active_worker_limit.load(std::memory_order_relaxed);
+		if (limit == old_limit)
+			return;
+
+		if (limit > old_limit)
 		{
-			if (implicit_whitelist[tag].count(hash))
-				return true;
-			lock_guard<mutex> holder{validation_db_mutex};
-			return validation_whitelist_db->has_entry(tag, hash);
+			lock_guard<mutex> lock(worker_wait_mutex);
+			active_worker_limit.store(limit, std::memory_order_relaxed);
+			work_available_condition.notify_all();
 		}
 		else
-			return false;
+		{
+			active_worker_limit.store(limit, std::memory_order_relaxed);
+			min_active_worker_limit = std::min(min_active_worker_limit, limit);
+		}
 	}
 
-	bool resource_is_blacklisted(ResourceTag tag, Hash hash)
+	void worker_governor_thread_main()
 	{
-		if (validation_blacklist_db)
+		SystemPressureSample old_sample;
+		sample_system_pressure(old_sample);
+
+		unique_lock<mutex> holder(worker_governor_mutex);
+		while (!worker_governor_condition.wait_for(holder, chrono::milliseconds(WORKER_GOVERNOR_INTERVAL_MS), [&]() -> bool {
+			return worker_governor_thread_done;
+		}))
 		{
-			lock_guard<mutex> holder{validation_db_mutex};
-			return validation_blacklist_db->has_entry(tag, hash);
+			SystemPressureSample new_sample;
+			sample_system_pressure(new_sample);
+			set_active_worker_limit(adapt_active_worker_count(old_sample, new_sample,
+			                                                  active_worker_limit.load(std::memory_order_relaxed),
+			                                                  num_worker_threads));
+			old_sample = new_sample;
 		}
-		else
-			return false;
 	}
 
-	void run_creation_work_item(const PipelineWorkItem &work_item)
+	void start_worker_governor_thread()
 	{
-		switch (work_item.tag)
+		worker_governor_thread_done = false;
+		worker_governor_thread = std::thread(&ThreadedReplayer::worker_governor_thread_main, this);
+	}
+
+	void tear_down_worker_governor_thread()
+	{
+		if (!worker_governor_thread.joinable())
+			return;
+
 		{
-		case RESOURCE_GRAPHICS_PIPELINE:
+			lock_guard<mutex> holder(worker_governor_mutex);
+			worker_governor_thread_done = true;
+			worker_governor_condition.notify_one();
+		}
+		worker_governor_thread.join();
+
+		if (min_active_worker_limit < num_worker_threads)
 		{
-			auto &per_thread = get_per_thread_data();
-			per_thread.current_graphics_index = work_item.index + 1;
-			per_thread.current_graphics_pipeline = work_item.hash;
-			per_thread.current_compute_pipeline = 0;
-			per_thread.triggered_validation_error = false;
+			LOGI("Adaptive worker count went down to %u of %u workers under system pressure.\n",
+			     min_active_worker_limit, num_worker_threads);
+		}
+	}
 
-			// Make sure to iterate the index so main thread and worker threads
-			// have a coherent idea of replayer state.
-			if (!work_item.create_info.graphics_create_info)
-			{
-				if (opts.control_block)
-					opts.control_block->skipped_graphics.fetch_add(1, std::memory_order_relaxed);
-				break;
-			}
+	// Writes the memory this process accounts for into its slot of the control block,
+	// so the master can tell which subsystem a growing child spends its memory on.
+	void publish_tracked_memory()
+	{
+		unsigned slot = opts.worker_slot_offset + 1;
+		if (!opts.control_block || slot >= MaxProcessStats)
+			return;
 
-			if (robustness)
+		uint64_t parse_buffer_bytes = 0;
+		for (unsigned i = 0; i <= num_worker_threads; i++)
+			parse_buffer_bytes += worker_parse_buffer_bytes[i].load(std::memory_order_relaxed);
+
+		uint64_t bytes[ControlBlockMemorySubsystemCount] = {};
+		bytes[ControlBlockMemoryScratchAllocators] = ScratchAllocator::get_process_memory_usage();
+		bytes[ControlBlockMemoryParseBuffers] = parse_buffer_bytes;
+		bytes[ControlBlockMemoryShaderModuleCache] = shader_modules.get_current_total_size();
+		bytes[ControlBlockMemoryDatabaseIndex] = database_index_bytes;
+
+		auto &subsystems = opts.control_block->process_subsystem_memory_kib[slot];
+		for (unsigned i = 0; i < ControlBlockMemorySubsystemCount; i++)
+			subsystems[i].store(uint32_t(std::min<uint64_t>(bytes[i] / 1024, UINT32_MAX)), std::memory_order_relaxed);
+	}
+
+	// Called by workers after every parse. Only one of them publishes per interval.
+	void maybe_publish_tracked_memory()
+	{
+		int64_t now_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+		int64_t last_ns = last_tracked_memory_publish_ns.load(std::memory_order_relaxed);
+		if (now_ns - last_ns < int64_t(TRACKED_MEMORY_PUBLISH_INTERVAL_MS) * 1000000)
+			return;
+		if (last_tracked_memory_publish_ns.compare_exchange_strong(last_ns, now_ns, std::memory_order_relaxed))
+			publish_tracked_memory();
+	}
+
+#ifdef FOSSILIZE_REPLAYER_SPIRV_VAL
+	bool validate_spirv(const VkShaderModuleCreateInfo *create_info)
+	{
+		spv_target_env env;
+		if (device->get_api_version() >= VK_VERSION_1_2)
+			env = SPV_ENV_VULKAN_1_2;
+		else if (device->get_api_version() >= VK_VERSION_1_1)
+			env = SPV_ENV_VULKAN_1_1;
+		else
+			env = SPV_ENV_VULKAN_1_0;
+
+		spvtools::SpirvTools context(env);
+		spvtools::ValidatorOptions validation_opts;
+		validation_opts.SetScalarBlockLayout(device->get_feature_filter().supports_scalar_block_layout());
+		context.SetMessageConsumer([](spv_message_level_t, const char *, const spv_position_t &, const char *message) {
+			LOGE("spirv-val: %s\n", message);
+		});
+
+		return context.Validate(create_info->pCode, create_info->codeSize / 4, validation_opts);
+	}
+
+	// Uses the validation pool's result if it has one, waits if the pool is validating the module right now,
+	// and validates on the calling thread otherwise. already_blacklisted is set if the failure is already taken care of.
+	bool shader_module_passes_spirv_validation(Hash hash, const VkShaderModuleCreateInfo *create_info,
+	                                           bool &already_blacklisted)
+	{
+		bool claimed = false;
+		if (!spirv_validation_threads.empty())
+		{
+			unique_lock<mutex> holder(spirv_validation_lock);
+			auto itr = spirv_validation_states.find(hash);
+			if (itr != spirv_validation_states.end())
 			{
-				per_thread.num_failed_module_hashes = work_item.create_info.graphics_create_info->stageCount;
-				for (unsigned i = 0; i < work_item.create_info.graphics_create_info->stageCount; i++)
+				if (itr->second == SpirvValidationState::Pending)
 				{
-					VkShaderModule module = work_item.create_info.graphics_create_info->pStages[i].module;
-					per_thread.failed_module_hashes[i] = shader_module_to_hash[module];
+					itr->second = SpirvValidationState::Running;
+					claimed = true;
 				}
-			}
-
-			if ((work_item.create_info.graphics_create_info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
-			{
-				// This pipeline failed for some reason, don't try to compile this one either.
-				if (work_item.create_info.graphics_create_info->basePipelineHandle == VK_NULL_HANDLE)
+				else
 				{
-					*work_item.output.pipeline = VK_NULL_HANDLE;
-					LOGE("Invalid derivative pipeline!\n");
-					break;
+					if (itr->second == SpirvValidationState::Running)
+						spirv_validation_inline_waits++;
+					spirv_validation_condition.wait(holder, [&]() -> bool {
+						return itr->second != SpirvValidationState::Running;
+					});
+					already_blacklisted = itr->second == SpirvValidationState::Failed;
+					return itr->second == SpirvValidationState::Passed;
 				}
 			}
+		}
 
-			// Don't bother replaying blacklisted objects.
-			if (resource_is_blacklisted(work_item.tag, work_item.hash))
-			{
-				*work_item.output.pipeline = VK_NULL_HANDLE;
-				LOGW("Resource is blacklisted, ignoring.\n");
-				if (opts.control_block)
-					opts.control_block->skipped_graphics.fetch_add(1, std::memory_order_relaxed);
-				break;
-			}
+		auto start_time = chrono::steady_clock::now();
+		bool ret = validate_spirv(create_info);
+		auto end_time = chrono::steady_clock::now();
+		auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
+		shader_module_ns.fetch_add(duration_ns, std::memory_order_relaxed);
 
-			if (!device->get_feature_filter().graphics_pipeline_is_supported(work_item.create_info.graphics_create_info))
-			{
-				*work_item.output.pipeline = VK_NULL_HANDLE;
-				LOGW("Graphics pipeline %016" PRIx64 " is not supported by current device, skipping.\n", work_item.hash);
-				if (opts.control_block)
-					opts.control_block->skipped_graphics.fetch_add(1, std::memory_order_relaxed);
-				break;
-			}
+		if (claimed)
+		{
+			lock_guard<mutex> holder(spirv_validation_lock);
+			spirv_validation_states[hash] = ret ? SpirvValidationState::Passed : SpirvValidationState::Failed;
+			spirv_validation_inline_count++;
+			spirv_validation_condition.notify_all();
+		}
+
+		return ret;
+	}
 
-			VkPipelineCache cache = disk_pipeline_cache;
-			if (!cache)
-				cache = memory_context_pipeline_cache[work_item.memory_context_index];
+	// Decodes shader module blobs for the validation pool. Nothing else is expected in those blobs.
+	struct SpirvValidationCreator : StateCreatorInterface
+	{
+		explicit SpirvValidationCreator(ThreadedReplayer &replayer_)
+			: replayer(replayer_)
+		{
+		}
 
-			for (unsigned i = 0; i < loop_count; i++)
-			{
-				// Avoid leak.
-				if (*work_item.hash_map_entry.pipeline != VK_NULL_HANDLE)
-					vkDestroyPipeline(device->get_device(), *work_item.hash_map_entry.pipeline, nullptr);
-				*work_item.hash_map_entry.pipeline = VK_NULL_HANDLE;
+		bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override { return false; }
+		bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override { return false; }
+		bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override { return false; }
+		bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override { return false; }
+		bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override { return false; }
+		bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override { return false; }
 
-				auto start_time = chrono::steady_clock::now();
+		bool enqueue_create_shader_module(Hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module) override
+		{
+			*module = VK_NULL_HANDLE;
+			passed = replayer.validate_spirv(create_info);
+			decoded = true;
+			return true;
+		}
 
-#ifdef SIMULATE_UNSTABLE_DRIVER
-				spurious_crash();
-#endif
+		ThreadedReplayer &replayer;
+		bool decoded = false;
+		bool passed = false;
+	};
 
-				VkPipelineCreationFeedbackEXT feedbacks[16] = {};
-				VkPipelineCreationFeedbackEXT primary_feedback = {};
-				VkPipelineCreationFeedbackCreateInfoEXT feedback = { VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT };
-				feedback.pipelineStageCreationFeedbackCount = work_item.create_info.graphics_create_info->stageCount;
-				feedback.pPipelineStageCreationFeedbacks = feedbacks;
-				feedback.pPipelineCreationFeedback = &primary_feedback;
+	// Results are committed to the validation databases in batches, off the critical path.
+	// Passing modules only go to the whitelist without validation layers.
+	// With validation layers, the whitelist also means that creating the module triggered no errors,
+	// which is only known once a worker creates it.
+	void commit_spirv_validation_results(bool force)
+	{
+		vector<Hash> passed, failed;
+		{
+			lock_guard<mutex> holder(spirv_validation_lock);
+			if (!force && spirv_validation_passed.size() + spirv_validation_failed.size() < SPIRV_VALIDATION_COMMIT_BATCH)
+				return;
+			swap(passed, spirv_validation_passed);
+			swap(failed, spirv_validation_failed);
+		}
 
-				if (disk_pipeline_cache && device->pipeline_feedback_enabled())
-					const_cast<VkGraphicsPipelineCreateInfo *>(work_item.create_info.graphics_create_info)->pNext = &feedback;
+		if (passed.empty() && failed.empty())
+			return;
 
-				if (vkCreateGraphicsPipelines(device->get_device(), cache, 1, work_item.create_info.graphics_create_info,
-				                              nullptr, work_item.output.pipeline) == VK_SUCCESS)
-				{
-					auto end_time = chrono::steady_clock::now();
-					auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
+		lock_guard<mutex> holder{validation_db_mutex};
+		if (validation_whitelist_db && !device_opts.enable_validation)
+			for (auto hash : passed)
+				validation_whitelist_db->write_entry(RESOURCE_SHADER_MODULE, hash, nullptr, 0, 0);
+		if (validation_blacklist_db)
+			for (auto hash : failed)
+				validation_blacklist_db->write_entry(RESOURCE_SHADER_MODULE, hash, nullptr, 0, 0);
+	}
 
-					graphics_pipeline_ns.fetch_add(duration_ns, std::memory_order_relaxed);
-					graphics_pipeline_count.fetch_add(1, std::memory_order_relaxed);
+	void spirv_validation_thread_main()
+	{
+		StateReplayer state_replayer;
+		SpirvValidationCreator creator(*this);
+		vector<uint8_t> buffer;
 
-					if (opts.pipeline_stats && i == 0)
-						get_pipeline_stats(work_item.tag, work_item.hash, *work_item.output.pipeline);
+		for (;;)
+		{
+			Hash hash;
+			{
+				unique_lock<mutex> holder(spirv_validation_lock);
+				spirv_validation_condition.wait(holder, [&]() -> bool {
+					return spirv_validation_thread_done || !spirv_validation_queue.empty();
+				});
 
-					if (!opts.ignore_derived_pipelines && (work_item.create_info.graphics_create_info->flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) != 0)
-					{
-						*work_item.hash_map_entry.pipeline = *work_item.output.pipeline;
-					}
-					else
-					{
-						// Destroy the pipeline right away to save memory if we don't need it for purposes of creating derived pipelines later.
-						*work_item.hash_map_entry.pipeline = VK_NULL_HANDLE;
-						vkDestroyPipeline(device->get_device(), *work_item.output.pipeline, nullptr);
-						*work_item.output.pipeline = VK_NULL_HANDLE;
-					}
+				if (spirv_validation_thread_done)
+					break;
 
-					if (opts.control_block && i == 0)
-						opts.control_block->successful_graphics.fetch_add(1, std::memory_order_relaxed);
+				hash = spirv_validation_queue.front();
+				spirv_validation_queue.pop_front();
 
-					if (disk_pipeline_cache && i == 0 && (primary_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) != 0)
-					{
-						bool cache_hit = (primary_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0;
+				auto &state = spirv_validation_states[hash];
+				if (state != SpirvValidationState::Pending)
+					continue;
+				state = SpirvValidationState::Running;
+			}
 
-						// Check per-stage feedback.
-						if (!cache_hit)
-						{
-							cache_hit = true;
-							for (uint32_t j = 0; j < feedback.pipelineStageCreationFeedbackCount; j++)
-							{
-								bool valid = (feedbacks[j].flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) != 0;
-								bool hit = (feedbacks[j].flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0;
-								if (!valid || !hit)
-									cache_hit = false;
-							}
-						}
+			// Anything that will not be validated on the critical path either is left alone.
+			bool skip = masked_shader_modules.count(hash) || is_unsupported_blob(RESOURCE_SHADER_MODULE, hash) ||
+			            has_resource_in_whitelist(RESOURCE_SHADER_MODULE, hash) ||
+			            resource_is_blacklisted(RESOURCE_SHADER_MODULE, hash);
 
-						if (cache_hit)
-							pipeline_cache_hits.fetch_add(1, std::memory_order_relaxed);
-						else
-							pipeline_cache_misses.fetch_add(1, std::memory_order_relaxed);
-					}
+			creator.decoded = false;
+			size_t size = 0;
+			if (!skip && global_database->read_entry(RESOURCE_SHADER_MODULE, hash, &size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
+			{
+				buffer.resize(size);
+				if (global_database->read_entry(RESOURCE_SHADER_MODULE, hash, &size, buffer.data(), PAYLOAD_READ_CONCURRENT_BIT) &&
+				    !state_replayer.parse(creator, nullptr, buffer.data(), size))
+				{
+					creator.decoded = false;
+				}
+				state_replayer.forget_handle_references();
+			}
+
+			{
+				lock_guard<mutex> holder(spirv_validation_lock);
+				// A worker which needs a module we could not decode validates it on its own.
+				auto &state = spirv_validation_states[hash];
+				if (!creator.decoded)
+					state = SpirvValidationState::Pending;
+				else if (creator.passed)
+				{
+					state = SpirvValidationState::Passed;
+					spirv_validation_passed.push_back(hash);
 				}
 				else
 				{
-					LOGE("Failed to create graphics pipeline for hash 0x%016" PRIx64 ".\n", work_item.hash);
+					state = SpirvValidationState::Failed;
+					spirv_validation_failed.push_back(hash);
 				}
+
+				if (creator.decoded)
+					spirv_validation_ahead_count++;
+				spirv_validation_condition.notify_all();
 			}
 
-			if (!per_thread.triggered_validation_error)
-				whitelist_resource(work_item.tag, work_item.hash);
+			if (creator.decoded)
+				commit_spirv_validation_results(false);
+		}
+	}
 
-			mark_replayed_resource(work_item.tag, work_item.hash);
+	// Validation of queued modules starts right away, on threads of its own.
+	// Modules which are about to be needed are moved to the front of the queue, see queue_spirv_validation().
+	void start_spirv_validation_pool(const vector<Hash> &module_hashes)
+	{
+		unsigned count = opts.spirv_validation_threads ? opts.spirv_validation_threads : max(1u, num_worker_threads / 4);
 
-			per_thread.current_graphics_pipeline = 0;
-			per_thread.current_compute_pipeline = 0;
-			break;
+		{
+			lock_guard<mutex> holder(spirv_validation_lock);
+			spirv_validation_thread_done = false;
+			for (auto hash : module_hashes)
+			{
+				if (spirv_validation_states.emplace(hash, SpirvValidationState::Pending).second)
+					spirv_validation_queue.push_back(hash);
+			}
 		}
 
-		case RESOURCE_COMPUTE_PIPELINE:
+		for (unsigned i = 0; i < count; i++)
+			spirv_validation_threads.push_back(std::thread(&ThreadedReplayer::spirv_validation_thread_main, this));
+	}
+
+	void queue_spirv_validation(const vector<Hash> &module_hashes)
+	{
+		if (spirv_validation_threads.empty() || module_hashes.empty())
+			return;
+
+		lock_guard<mutex> holder(spirv_validation_lock);
+		for (auto itr = module_hashes.rbegin(); itr != module_hashes.rend(); ++itr)
+		{
+			auto &state = spirv_validation_states.emplace(*itr, SpirvValidationState::Pending).first->second;
+			if (state == SpirvValidationState::Pending)
+				spirv_validation_queue.push_front(*itr);
+		}
+		spirv_validation_condition.notify_all();
+	}
+
+	void tear_down_spirv_validation_pool()
+	{
+		if (spirv_validation_threads.empty())
+			return;
+
+		{
+			lock_guard<mutex> holder(spirv_validation_lock);
+			spirv_validation_thread_done = true;
+			spirv_validation_condition.notify_all();
+		}
+
+		for (auto &thread : spirv_validation_threads)
+			thread.join();
+		spirv_validation_threads.clear();
+		commit_spirv_validation_results(true);
+
+		LOGI("SPIR-V validation: %u modules validated ahead of time, %u on the critical path, %u waited for.\n",
+		     spirv_validation_ahead_count, spirv_validation_inline_count, spirv_validation_inline_waits);
+	}
+#endif
+
+	void blacklist_resource(ResourceTag tag, Hash hash)
+	{
+		if (validation_blacklist_db)
+		{
+			lock_guard<mutex> holder{validation_db_mutex};
+			validation_blacklist_db->write_entry(tag, hash, nullptr, 0, 0);
+		}
+	}
+
+	void whitelist_resource(ResourceTag tag, Hash hash)
+	{
+		if (validation_whitelist_db)
+		{
+			lock_guard<mutex> holder{validation_db_mutex};
+			validation_whitelist_db->write_entry(tag, hash, nullptr, 0, 0);
+		}
+	}
+
+	// Objects which an earlier run on the same driver already replayed.
+	// Only looks at what the cache was prepared with, so this is safe from any thread while others mark resources.
+	bool is_cached_blob(ResourceTag tag, Hash hash) const
+	{
+		return replayer_cache_db && replayer_cache_db->has_prior_entry(tag, hash);
+	}
+
+	// Objects which an earlier run with the same feature fingerprint found to be unsupported.
+	bool is_unsupported_blob(ResourceTag tag, Hash hash) const
+	{
+		return feature_filter_memo_db && feature_filter_memo_db->has_prior_entry(tag, hash);
+	}
+
+	void mark_replayed_resource(ResourceTag tag, Hash hash)
+	{
+		if (replayer_cache_db)
+		{
+			lock_guard<mutex> holder{replayer_cache_mutex};
+			replayer_cache_db->write_entry(tag, hash, nullptr, 0, 0);
+		}
+	}
+
+	// Runs the feature filter check unless an earlier run already rejected the object on this device.
+	template <typename Func>
+	bool resource_is_supported(ResourceTag tag, Hash hash, const Func &is_supported)
+	{
+		if (is_unsupported_blob(tag, hash))
+		{
+			feature_filter_memo_hits.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if (is_supported())
+			return true;
+
+		if (feature_filter_memo_db)
+		{
+			lock_guard<mutex> holder{replayer_cache_mutex};
+			feature_filter_memo_db->write_entry(tag, hash, nullptr, 0, 0);
+		}
+		return false;
+	}
+
+	bool has_resource_in_whitelist(ResourceTag tag, Hash hash)
+	{
+		if (validation_whitelist_db)
+		{
+			if (implicit_whitelist[tag].count(hash))
+				return true;
+			for (auto &view : implicit_whitelist_views[tag])
+				if (view.contains(hash))
+					return true;
+			lock_guard<mutex> holder{validation_db_mutex};
+			return validation_whitelist_db->has_entry(tag, hash);
+		}
+		else
+			return false;
+	}
+
+	bool resource_is_blacklisted(ResourceTag tag, Hash hash)
+	{
+		if (validation_blacklist_db)
+		{
+			lock_guard<mutex> holder{validation_db_mutex};
+			return validation_blacklist_db->has_entry(tag, hash);
+		}
+		else
+			return false;
+	}
+
+	// Sets up per-thread crash bookkeeping for a pipeline and checks if it should be compiled at all.
+	bool begin_creation_work_item(const PipelineWorkItem &work_item)
+	{
+		auto &per_thread = get_per_thread_data();
+
+		switch (work_item.tag)
+		{
+		case RESOURCE_GRAPHICS_PIPELINE:
+		{
+			per_thread.current_graphics_index = work_item.index + 1;
+			per_thread.current_graphics_pipeline = work_item.hash;
+			per_thread.current_compute_pipeline = 0;
+			per_thread.triggered_validation_error = false;
+
+			// Make sure to iterate the index so main thread and worker threads
+			// have a coherent idea of replayer state.
+			if (!work_item.create_info.graphics_create_info)
+			{
+				if (opts.control_block)
+					opts.control_block->skipped_graphics.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			// Past the deadline, remaining pipelines are left for a later session.
+			if (time_budget.exhausted())
+			{
+				*work_item.output.pipeline = VK_NULL_HANDLE;
+				time_budget_skipped_count.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			if (robustness)
+			{
+				per_thread.num_failed_module_hashes = work_item.create_info.graphics_create_info->stageCount;
+				for (unsigned i = 0; i < work_item.create_info.graphics_create_info->stageCount; i++)
+				{
+					VkShaderModule module = work_item.create_info.graphics_create_info->pStages[i].module;
+					per_thread.failed_module_hashes[i] = get_shader_module_hash(module);
+				}
+			}
+
+			if ((work_item.create_info.graphics_create_info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
+			{
+				// This pipeline failed for some reason, don't try to compile this one either.
+				if (work_item.create_info.graphics_create_info->basePipelineHandle == VK_NULL_HANDLE)
+				{
+					*work_item.output.pipeline = VK_NULL_HANDLE;
+					LOGE("Invalid derivative pipeline!\n");
+					return false;
+				}
+			}
+
+			// Don't bother replaying blacklisted objects.
+			if (resource_is_blacklisted(work_item.tag, work_item.hash))
+			{
+				*work_item.output.pipeline = VK_NULL_HANDLE;
+				LOGW("Resource is blacklisted, ignoring.\n");
+				if (opts.control_block)
+					opts.control_block->skipped_graphics.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			if (!resource_is_supported(work_item.tag, work_item.hash, [&]() {
+				    return device->get_feature_filter().graphics_pipeline_is_supported(work_item.create_info.graphics_create_info);
+			    }))
+			{
+				*work_item.output.pipeline = VK_NULL_HANDLE;
+				LOGW("Graphics pipeline %016" PRIx64 " is not supported by current device, skipping.\n", work_item.hash);
+				if (opts.control_block)
+					opts.control_block->skipped_graphics.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			return true;
+		}
+
+		case RESOURCE_COMPUTE_PIPELINE:
 		{
-			auto &per_thread = get_per_thread_data();
 			per_thread.current_compute_index = work_item.index + 1;
 			per_thread.current_compute_pipeline = work_item.hash;
 			per_thread.current_graphics_pipeline = 0;
@@ -952,14 +2123,21 @@ struct ThreadedReplayer : StateCreatorInterface
 			{
 				if (opts.control_block)
 					opts.control_block->skipped_compute.fetch_add(1, std::memory_order_relaxed);
-				break;
+				return false;
+			}
+
+			if (time_budget.exhausted())
+			{
+				*work_item.output.pipeline = VK_NULL_HANDLE;
+				time_budget_skipped_count.fetch_add(1, std::memory_order_relaxed);
+				return false;
 			}
 
 			if (robustness)
 			{
 				per_thread.num_failed_module_hashes = 1;
 				VkShaderModule module = work_item.create_info.compute_create_info->stage.module;
-				per_thread.failed_module_hashes[0] = shader_module_to_hash[module];
+				per_thread.failed_module_hashes[0] = get_shader_module_hash(module);
 			}
 
 			if ((work_item.create_info.compute_create_info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
@@ -968,7 +2146,7 @@ struct ThreadedReplayer : StateCreatorInterface
 				if (work_item.create_info.compute_create_info->basePipelineHandle == VK_NULL_HANDLE)
 				{
 					*work_item.output.pipeline = VK_NULL_HANDLE;
-					break;
+					return false;
 				}
 			}
 
@@ -979,1002 +2157,2057 @@ struct ThreadedReplayer : StateCreatorInterface
 				LOGW("Resource is blacklisted, ignoring.\n");
 				if (opts.control_block)
 					opts.control_block->skipped_compute.fetch_add(1, std::memory_order_relaxed);
-				break;
+				return false;
 			}
 
-			if (!device->get_feature_filter().compute_pipeline_is_supported(work_item.create_info.compute_create_info))
+			if (!resource_is_supported(work_item.tag, work_item.hash, [&]() {
+				    return device->get_feature_filter().compute_pipeline_is_supported(work_item.create_info.compute_create_info);
+			    }))
 			{
 				*work_item.output.pipeline = VK_NULL_HANDLE;
 				LOGW("Compute pipeline %016" PRIx64 " is not supported by current device, skipping.\n", work_item.hash);
 				if (opts.control_block)
 					opts.control_block->skipped_compute.fetch_add(1, std::memory_order_relaxed);
-				break;
+				return false;
 			}
 
-			VkPipelineCache cache = disk_pipeline_cache;
-			if (!cache)
-				cache = memory_context_pipeline_cache[work_item.memory_context_index];
-
-			for (unsigned i = 0; i < loop_count; i++)
-			{
-				// Avoid leak.
-				if (*work_item.hash_map_entry.pipeline != VK_NULL_HANDLE)
-					vkDestroyPipeline(device->get_device(), *work_item.hash_map_entry.pipeline, nullptr);
-				*work_item.hash_map_entry.pipeline = VK_NULL_HANDLE;
+			return true;
+		}
 
-				auto start_time = chrono::steady_clock::now();
+		default:
+			return false;
+		}
+	}
 
-#ifdef SIMULATE_UNSTABLE_DRIVER
-				spurious_crash();
-#endif
-				VkPipelineCreationFeedbackEXT feedbacks = {};
-				VkPipelineCreationFeedbackEXT primary_feedback = {};
-				VkPipelineCreationFeedbackCreateInfoEXT feedback = { VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT };
-				feedback.pipelineStageCreationFeedbackCount = 1;
-				feedback.pPipelineStageCreationFeedbacks = &feedbacks;
-				feedback.pPipelineCreationFeedback = &primary_feedback;
-
-				if (disk_pipeline_cache && device->pipeline_feedback_enabled())
-					const_cast<VkComputePipelineCreateInfo *>(work_item.create_info.compute_create_info)->pNext = &feedback;
-
-				if (vkCreateComputePipelines(device->get_device(), cache, 1,
-				                             work_item.create_info.compute_create_info,
-				                             nullptr, work_item.output.pipeline) == VK_SUCCESS)
-				{
-					auto end_time = chrono::steady_clock::now();
-					auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
+	void end_creation_work_item(const PipelineWorkItem &work_item)
+	{
+		auto &per_thread = get_per_thread_data();
 
-					compute_pipeline_ns.fetch_add(duration_ns, std::memory_order_relaxed);
-					compute_pipeline_count.fetch_add(1, std::memory_order_relaxed);
+		if (!per_thread.triggered_validation_error)
+			whitelist_resource(work_item.tag, work_item.hash);
 
-					if (opts.pipeline_stats && i == 0)
-						get_pipeline_stats(work_item.tag, work_item.hash, *work_item.output.pipeline);
+		mark_replayed_resource(work_item.tag, work_item.hash);
 
-					if (!opts.ignore_derived_pipelines && (work_item.create_info.compute_create_info->flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) != 0)
-					{
-						*work_item.hash_map_entry.pipeline = *work_item.output.pipeline;
-					}
-					else
-					{
-						// Destroy the pipeline right away to save memory if we don't need it for purposes of creating derived pipelines later.
-						*work_item.hash_map_entry.pipeline = VK_NULL_HANDLE;
-						vkDestroyPipeline(device->get_device(), *work_item.output.pipeline, nullptr);
-						*work_item.output.pipeline = VK_NULL_HANDLE;
-					}
+		per_thread.current_graphics_pipeline = 0;
+		per_thread.current_compute_pipeline = 0;
+	}
 
-					if (opts.control_block && i == 0)
-						opts.control_block->successful_compute.fetch_add(1, std::memory_order_relaxed);
+	static bool pipeline_cache_hit(const VkPipelineCreationFeedbackEXT &primary_feedback,
+	                               const VkPipelineCreationFeedbackEXT *stage_feedbacks, uint32_t stage_count)
+	{
+		bool cache_hit = (primary_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0;
 
-					if (disk_pipeline_cache && i == 0 && (primary_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) != 0)
-					{
-						bool cache_hit = (primary_feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0;
+		// Check per-stage feedback.
+		if (!cache_hit)
+		{
+			cache_hit = true;
+			for (uint32_t j = 0; j < stage_count; j++)
+			{
+				bool valid = (stage_feedbacks[j].flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) != 0;
+				bool hit = (stage_feedbacks[j].flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0;
+				if (!valid || !hit)
+					cache_hit = false;
+			}
+		}
 
-						if (!cache_hit)
-						{
-							bool valid = (feedbacks.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) != 0;
-							bool hit = (feedbacks.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) != 0;
-							cache_hit = valid && hit;
-						}
+		return cache_hit;
+	}
 
-						if (cache_hit)
-							pipeline_cache_hits.fetch_add(1, std::memory_order_relaxed);
-						else
-							pipeline_cache_misses.fetch_add(1, std::memory_order_relaxed);
-					}
-				}
-				else
-				{
-					LOGE("Failed to create compute pipeline for hash 0x%016" PRIx64 ".\n", work_item.hash);
-				}
-			}
+	// Serializes the state which a graphics pipeline library depends on, so libraries can be shared by key.
+	// Shader modules are keyed by handle, which is why the library cache is flushed whenever modules are evicted.
+	struct LibraryKeyBuilder
+	{
+		vector<uint8_t> data;
 
-			if (!per_thread.triggered_validation_error)
-				whitelist_resource(work_item.tag, work_item.hash);
+		template <typename T>
+		void add(const T &value)
+		{
+			auto *bytes = reinterpret_cast<const uint8_t *>(&value);
+			data.insert(data.end(), bytes, bytes + sizeof(T));
+		}
 
-			mark_replayed_resource(work_item.tag, work_item.hash);
+		void add_bytes(const void *bytes, size_t size)
+		{
+			add(uint64_t(size));
+			if (size)
+				data.insert(data.end(), static_cast<const uint8_t *>(bytes), static_cast<const uint8_t *>(bytes) + size);
+		}
 
-			per_thread.current_compute_pipeline = 0;
-			per_thread.current_graphics_pipeline = 0;
-			break;
+		void add_string(const char *str)
+		{
+			add_bytes(str, str ? strlen(str) : 0);
 		}
 
-		default:
-			break;
+		Hash hash() const
+		{
+			return compute_xxh64(data.data(), data.size(), 0);
 		}
+	};
+
+	static const VkBaseInStructure *find_pnext(const void *pNext, VkStructureType sType)
+	{
+		auto *base = static_cast<const VkBaseInStructure *>(pNext);
+		while (base && base->sType != sType)
+			base = base->pNext;
+		return base;
 	}
 
-	void worker_thread(unsigned thread_index)
+	static bool pnext_chain_is_restricted_to(const void *pNext, std::initializer_list<VkStructureType> allowed)
 	{
-		Global::worker_thread_index = thread_index;
+		for (auto *base = static_cast<const VkBaseInStructure *>(pNext); base; base = base->pNext)
+			if (find(allowed.begin(), allowed.end(), base->sType) == allowed.end())
+				return false;
+		return true;
+	}
 
-		if (opts.on_thread_callback)
-			opts.on_thread_callback(opts.on_thread_callback_userdata);
+	// Only plain graphics pipelines whose extension structs we know how to key are split into libraries.
+	// Everything else goes through the normal creation path.
+	static bool graphics_pipeline_can_use_libraries(const VkGraphicsPipelineCreateInfo &info)
+	{
+		constexpr VkPipelineCreateFlags incompatible_flags =
+				VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT | VK_PIPELINE_CREATE_DERIVATIVE_BIT |
+				VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
 
-		uint64_t idle_ns = 0;
-		auto thread_start_time = chrono::steady_clock::now();
+		if ((info.flags & incompatible_flags) != 0 || info.renderPass == VK_NULL_HANDLE)
+			return false;
+		if (!pnext_chain_is_restricted_to(info.pNext, { VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT }))
+			return false;
 
-		// Pipelines and shader modules are decompressed and parsed in the worker threads.
-		// Inherit references to the trivial modules.
-		StateReplayer per_thread_replayer[NUM_MEMORY_CONTEXTS];
-		for (auto &r : per_thread_replayer)
-		{
-			r.set_resolve_derivative_pipeline_handles(false);
-			r.set_resolve_shader_module_handles(false);
-			r.copy_handle_references(*global_replayer);
-		}
+		// Without rasterization there is no fragment state to build a library from.
+		if (!info.pRasterizationState || !info.pMultisampleState)
+			return false;
+		if (info.pRasterizationState->rasterizerDiscardEnable)
+			return false;
 
-		get_per_thread_data().per_thread_replayers = per_thread_replayer;
-		// Let main thread know that the per thread replayers have been initialized correctly.
+		for (uint32_t i = 0; i < info.stageCount; i++)
 		{
-			lock_guard<mutex> lock(pipeline_work_queue_mutex);
-			thread_initialized_count++;
-			work_done_condition[0].notify_one();
+			if (!pnext_chain_is_restricted_to(info.pStages[i].pNext,
+			                                  { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT,
+			                                    VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO }))
+				return false;
 		}
 
-		vector<uint8_t> json_buffer;
+		if (!pnext_chain_is_restricted_to(info.pRasterizationState->pNext, {
+				VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_DEPTH_CLIP_STATE_CREATE_INFO_EXT,
+				VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_STREAM_CREATE_INFO_EXT,
+				VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT,
+				VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_LINE_STATE_CREATE_INFO_EXT }))
+			return false;
 
-		for (;;)
+		if (info.pTessellationState &&
+		    !pnext_chain_is_restricted_to(info.pTessellationState->pNext,
+		                                  { VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_DOMAIN_ORIGIN_STATE_CREATE_INFO }))
+			return false;
+
+		if ((info.pViewportState && info.pViewportState->pNext) ||
+		    info.pMultisampleState->pNext ||
+		    (info.pDepthStencilState && info.pDepthStencilState->pNext) ||
+		    (info.pDynamicState && info.pDynamicState->pNext))
+			return false;
+
+		return true;
+	}
+
+	static void add_shader_stage_to_key(LibraryKeyBuilder &key, const VkPipelineShaderStageCreateInfo &stage)
+	{
+		key.add(stage.flags);
+		key.add(stage.stage);
+
+		// Inline shader modules keep their code alive for as long as a module handle would be, so it is just as unique.
+		auto *module_info = reinterpret_cast<const VkShaderModuleCreateInfo *>(
+				find_pnext(stage.pNext, VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO));
+		if (stage.module == VK_NULL_HANDLE && module_info)
+			key.add(uint64_t(reinterpret_cast<uintptr_t>(module_info->pCode)));
+		else
+			key.add(uint64_t(stage.module));
+		key.add_string(stage.pName);
+
+		if (stage.pSpecializationInfo)
 		{
-			PipelineWorkItem work_item;
-			auto idle_start_time = chrono::steady_clock::now();
+			auto *spec = stage.pSpecializationInfo;
+			key.add(spec->mapEntryCount);
+			for (uint32_t i = 0; i < spec->mapEntryCount; i++)
 			{
-				unique_lock<mutex> lock(pipeline_work_queue_mutex);
-				work_available_condition.wait(lock, [&]() -> bool {
-					return shutting_down || !pipeline_work_queue.empty();
-				});
+				key.add(spec->pMapEntries[i].constantID);
+				key.add(spec->pMapEntries[i].offset);
+				key.add(uint64_t(spec->pMapEntries[i].size));
+			}
+			key.add_bytes(spec->pData, spec->dataSize);
+		}
+		else
+			key.add(uint32_t(~0u));
 
-				if (shutting_down)
-					break;
+		auto *subgroup = reinterpret_cast<const VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT *>(
+				find_pnext(stage.pNext, VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT));
+		key.add(subgroup ? subgroup->requiredSubgroupSize : 0u);
+	}
 
-				work_item = pipeline_work_queue.front();
-				pipeline_work_queue.pop();
-			}
+	static void add_common_library_state_to_key(LibraryKeyBuilder &key, const VkGraphicsPipelineCreateInfo &info)
+	{
+		key.add(info.flags);
+		key.add(uint64_t(info.layout));
+		key.add(uint64_t(info.renderPass));
+		key.add(info.subpass);
 
-			auto idle_end_time = chrono::steady_clock::now();
-			auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(idle_end_time - idle_start_time).count();
-			idle_ns += duration_ns;
+		if (info.pDynamicState)
+		{
+			key.add(info.pDynamicState->dynamicStateCount);
+			for (uint32_t i = 0; i < info.pDynamicState->dynamicStateCount; i++)
+				key.add(info.pDynamicState->pDynamicStates[i]);
+		}
+		else
+			key.add(uint32_t(0));
+	}
 
-			if (work_item.parse_only)
-				run_parse_work_item(per_thread_replayer[work_item.memory_context_index], json_buffer, work_item);
-			else
-				run_creation_work_item(work_item);
+	static Hash compute_pre_rasterization_library_key(const VkGraphicsPipelineCreateInfo &info)
+	{
+		LibraryKeyBuilder key;
+		key.add(uint32_t(VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT));
+		add_common_library_state_to_key(key, info);
 
-			idle_start_time = chrono::steady_clock::now();
+		for (uint32_t i = 0; i < info.stageCount; i++)
+			if (info.pStages[i].stage != VK_SHADER_STAGE_FRAGMENT_BIT)
+				add_shader_stage_to_key(key, info.pStages[i]);
+
+		if (info.pViewportState)
+		{
+			auto &vp = *info.pViewportState;
+			key.add(vp.flags);
+			key.add(vp.viewportCount);
+			key.add(vp.scissorCount);
+			if (vp.pViewports)
+				for (uint32_t i = 0; i < vp.viewportCount; i++)
+					key.add(vp.pViewports[i]);
+			if (vp.pScissors)
+				for (uint32_t i = 0; i < vp.scissorCount; i++)
+					key.add(vp.pScissors[i]);
+		}
+
+		auto &rs = *info.pRasterizationState;
+		key.add(rs.flags);
+		key.add(rs.depthClampEnable);
+		key.add(rs.polygonMode);
+		key.add(rs.cullMode);
+		key.add(rs.frontFace);
+		key.add(rs.depthBiasEnable);
+		key.add(rs.depthBiasConstantFactor);
+		key.add(rs.depthBiasClamp);
+		key.add(rs.depthBiasSlopeFactor);
+		key.add(rs.lineWidth);
+
+		for (auto *base = static_cast<const VkBaseInStructure *>(rs.pNext); base; base = base->pNext)
+		{
+			key.add(base->sType);
+			switch (base->sType)
 			{
-				unsigned context_index = work_item.memory_context_index;
-				lock_guard<mutex> lock(pipeline_work_queue_mutex);
-				completed_count[context_index]++;
+			case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_DEPTH_CLIP_STATE_CREATE_INFO_EXT:
+			{
+				auto *clip = reinterpret_cast<const VkPipelineRasterizationDepthClipStateCreateInfoEXT *>(base);
+				key.add(clip->flags);
+				key.add(clip->depthClipEnable);
+				break;
+			}
 
-				// Makes sense to signal main thread now.
-				// If we have a timeout, we need to keep the dispatcher thread aware of the progress,
-				// so wake it up after each work item is complete.
-				if (opts.timeout_seconds != 0 || (completed_count[context_index] == queued_count[context_index]))
-					work_done_condition[context_index].notify_one();
+			case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_STREAM_CREATE_INFO_EXT:
+			{
+				auto *stream = reinterpret_cast<const VkPipelineRasterizationStateStreamCreateInfoEXT *>(base);
+				key.add(stream->flags);
+				key.add(stream->rasterizationStream);
+				break;
 			}
 
-			idle_end_time = chrono::steady_clock::now();
-			duration_ns = chrono::duration_cast<chrono::nanoseconds>(idle_end_time - idle_start_time).count();
-			idle_ns += duration_ns;
-		}
+			case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT:
+			{
+				auto *conservative = reinterpret_cast<const VkPipelineRasterizationConservativeStateCreateInfoEXT *>(base);
+				key.add(conservative->flags);
+				key.add(conservative->conservativeRasterizationMode);
+				key.add(conservative->extraPrimitiveOverestimationSize);
+				break;
+			}
 
-		total_idle_ns.fetch_add(idle_ns, std::memory_order_relaxed);
-		auto thread_end_time = chrono::steady_clock::now();
-		thread_total_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(thread_end_time - thread_start_time).count(),
-		                          std::memory_order_relaxed);
+			case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_LINE_STATE_CREATE_INFO_EXT:
+			{
+				auto *line = reinterpret_cast<const VkPipelineRasterizationLineStateCreateInfoEXT *>(base);
+				key.add(line->lineRasterizationMode);
+				key.add(line->stippledLineEnable);
+				key.add(line->lineStippleFactor);
+				key.add(line->lineStipplePattern);
+				break;
+			}
 
-		size_t peak_memory = 0;
-		for (auto &r : per_thread_replayer)
-			peak_memory += r.get_allocator().get_peak_memory_consumption();
+			default:
+				break;
+			}
+		}
 
-		total_peak_memory.fetch_add(peak_memory, std::memory_order_relaxed);
+		if (info.pTessellationState)
+		{
+			key.add(info.pTessellationState->flags);
+			key.add(info.pTessellationState->patchControlPoints);
+			auto *domain = reinterpret_cast<const VkPipelineTessellationDomainOriginStateCreateInfo *>(
+					find_pnext(info.pTessellationState->pNext, VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_DOMAIN_ORIGIN_STATE_CREATE_INFO));
+			key.add(domain ? domain->domainOrigin : VK_TESSELLATION_DOMAIN_ORIGIN_MAX_ENUM);
+		}
+
+		return key.hash();
 	}
 
-	void flush_pipeline_cache()
+	static Hash compute_fragment_shader_library_key(const VkGraphicsPipelineCreateInfo &info)
 	{
-		if (device && disk_pipeline_cache)
+		LibraryKeyBuilder key;
+		key.add(uint32_t(VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT));
+		add_common_library_state_to_key(key, info);
+
+		for (uint32_t i = 0; i < info.stageCount; i++)
+			if (info.pStages[i].stage == VK_SHADER_STAGE_FRAGMENT_BIT)
+				add_shader_stage_to_key(key, info.pStages[i]);
+
+		auto &ms = *info.pMultisampleState;
+		key.add(ms.flags);
+		key.add(ms.rasterizationSamples);
+		key.add(ms.sampleShadingEnable);
+		key.add(ms.minSampleShading);
+		key.add(ms.alphaToCoverageEnable);
+		key.add(ms.alphaToOneEnable);
+		if (ms.pSampleMask)
+			for (uint32_t i = 0; i < (uint32_t(ms.rasterizationSamples) + 31) / 32; i++)
+				key.add(ms.pSampleMask[i]);
+
+		if (info.pDepthStencilState)
 		{
-			if (!opts.on_disk_pipeline_cache_path.empty())
-			{
-				size_t pipeline_cache_size = 0;
-				if (vkGetPipelineCacheData(device->get_device(), disk_pipeline_cache, &pipeline_cache_size, nullptr) == VK_SUCCESS)
-				{
-					vector<uint8_t> pipeline_buffer(pipeline_cache_size);
-					if (vkGetPipelineCacheData(device->get_device(), disk_pipeline_cache, &pipeline_cache_size, pipeline_buffer.data()) == VK_SUCCESS)
-					{
-						// This isn't safe to do in a signal handler, but it's unlikely to be a problem in practice.
-						FILE *file = fopen(opts.on_disk_pipeline_cache_path.c_str(), "wb");
-						if (!file || fwrite(pipeline_buffer.data(), 1, pipeline_buffer.size(), file) != pipeline_buffer.size())
-							LOGE("Failed to write pipeline cache data to disk.\n");
-						if (file)
-							fclose(file);
-					}
-				}
-			}
-			vkDestroyPipelineCache(device->get_device(), disk_pipeline_cache, nullptr);
-			disk_pipeline_cache = VK_NULL_HANDLE;
+			auto &ds = *info.pDepthStencilState;
+			key.add(ds.flags);
+			key.add(ds.depthTestEnable);
+			key.add(ds.depthWriteEnable);
+			key.add(ds.depthCompareOp);
+			key.add(ds.depthBoundsTestEnable);
+			key.add(ds.stencilTestEnable);
+			key.add(ds.front);
+			key.add(ds.back);
+			key.add(ds.minDepthBounds);
+			key.add(ds.maxDepthBounds);
 		}
+
+		return key.hash();
 	}
 
-	void flush_validation_cache()
+	// Returns a cached library, or compiles one which is shared with any later pipeline using the same state.
+	VkPipeline get_graphics_pipeline_library(VkPipelineCache cache, const VkGraphicsPipelineCreateInfo &info,
+	                                         VkGraphicsPipelineLibraryFlagsEXT library_flags)
 	{
-		if (device && validation_cache)
+		Hash key = library_flags == VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT ?
+		           compute_fragment_shader_library_key(info) : compute_pre_rasterization_library_key(info);
+
 		{
-			if (!opts.on_disk_validation_cache_path.empty())
+			lock_guard<mutex> lock(graphics_library_lock);
+			auto cached = graphics_libraries.find_object(key);
+			if (cached.second)
 			{
-				size_t validation_cache_size = 0;
-				if (vkGetValidationCacheDataEXT(device->get_device(), validation_cache, &validation_cache_size, nullptr) == VK_SUCCESS)
-				{
-					vector<uint8_t> validation_buffer(validation_cache_size);
-					if (vkGetValidationCacheDataEXT(device->get_device(), validation_cache, &validation_cache_size, validation_buffer.data()) == VK_SUCCESS)
-					{
-						// This isn't safe to do in a signal handler, but it's unlikely to be a problem in practice.
-						FILE *file = fopen(opts.on_disk_validation_cache_path.c_str(), "wb");
-						if (!file || fwrite(validation_buffer.data(), 1, validation_buffer.size(), file) != validation_buffer.size())
-							LOGE("Failed to write pipeline cache data to disk.\n");
-						if (file)
-							fclose(file);
-					}
-				}
+				graphics_library_hits.fetch_add(1, std::memory_order_relaxed);
+				return cached.first;
 			}
-			vkDestroyValidationCacheEXT(device->get_device(), validation_cache, nullptr);
-			validation_cache = VK_NULL_HANDLE;
 		}
-	}
 
-	void tear_down_threads()
-	{
-		// Signal that it's time for threads to die.
+		VkPipelineShaderStageCreateInfo stages[16];
+		uint32_t stage_count = 0;
+		for (uint32_t i = 0; i < info.stageCount && stage_count < 16; i++)
 		{
-			lock_guard<mutex> lock(pipeline_work_queue_mutex);
-			shutting_down = true;
-			work_available_condition.notify_all();
+			bool is_fragment = info.pStages[i].stage == VK_SHADER_STAGE_FRAGMENT_BIT;
+			if (is_fragment == (library_flags == VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT))
+				stages[stage_count++] = info.pStages[i];
 		}
 
-		for (auto &thread : thread_pool)
-			if (thread.joinable())
-				thread.join();
-		thread_pool.clear();
+		// State which does not belong to this part of the pipeline is ignored by the driver.
+		VkGraphicsPipelineLibraryCreateInfoEXT library_info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT };
+		library_info.flags = library_flags;
+		VkGraphicsPipelineCreateInfo create_info = info;
+		create_info.pNext = &library_info;
+		create_info.flags |= VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+		create_info.stageCount = stage_count;
+		create_info.pStages = stages;
+
+		VkPipeline library = VK_NULL_HANDLE;
+		if (vkCreateGraphicsPipelines(device->get_device(), cache, 1, &create_info, nullptr, &library) != VK_SUCCESS)
+			return VK_NULL_HANDLE;
+		graphics_library_count.fetch_add(1, std::memory_order_relaxed);
+
+		lock_guard<mutex> lock(graphics_library_lock);
+		auto cached = graphics_libraries.find_object(key);
+		if (cached.second)
+		{
+			// Another thread raced us to it.
+			vkDestroyPipeline(device->get_device(), library, nullptr);
+			return cached.first;
+		}
+
+		graphics_libraries.insert_object(key, library, 1);
+		return library;
 	}
 
-	~ThreadedReplayer()
+	// Links a graphics pipeline from its pre-rasterization and fragment shader libraries.
+	// Returns VK_ERROR_FEATURE_NOT_PRESENT if the pipeline has to be compiled the normal way.
+	VkResult create_linked_graphics_pipeline(VkPipelineCache cache, const VkGraphicsPipelineCreateInfo &info,
+	                                         VkPipeline *pipeline)
 	{
-		tear_down_threads();
-		flush_pipeline_cache();
-		flush_validation_cache();
+		if (!graphics_pipeline_can_use_libraries(info))
+			return VK_ERROR_FEATURE_NOT_PRESENT;
+
+		// Libraries never see the creation feedback of the pipeline they end up in.
+		VkGraphicsPipelineCreateInfo library_create_info = info;
+		library_create_info.pNext = nullptr;
+
+		VkPipeline libraries[2];
+		libraries[0] = get_graphics_pipeline_library(cache, library_create_info,
+		                                             VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT);
+		if (libraries[0] == VK_NULL_HANDLE)
+			return VK_ERROR_INITIALIZATION_FAILED;
+		libraries[1] = get_graphics_pipeline_library(cache, library_create_info,
+		                                             VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT);
+		if (libraries[1] == VK_NULL_HANDLE)
+			return VK_ERROR_INITIALIZATION_FAILED;
+
+		// The linked pipeline has no stages of its own, so only keep the overall feedback.
+		VkPipelineCreationFeedbackCreateInfoEXT feedback;
+		auto *orig_feedback = find_pnext(info.pNext, VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT);
+		if (orig_feedback)
+		{
+			feedback = *reinterpret_cast<const VkPipelineCreationFeedbackCreateInfoEXT *>(orig_feedback);
+			feedback.pNext = nullptr;
+			feedback.pipelineStageCreationFeedbackCount = 0;
+			feedback.pPipelineStageCreationFeedbacks = nullptr;
+		}
 
-		for (auto &sampler : samplers)
-			if (sampler.second)
-				vkDestroySampler(device->get_device(), sampler.second, nullptr);
-		for (auto &layout : layouts)
-			if (layout.second)
-				vkDestroyDescriptorSetLayout(device->get_device(), layout.second, nullptr);
-		for (auto &pipeline_layout : pipeline_layouts)
-			if (pipeline_layout.second)
-				vkDestroyPipelineLayout(device->get_device(), pipeline_layout.second, nullptr);
-		for (auto &render_pass : render_passes)
-			if (render_pass.second)
-				vkDestroyRenderPass(device->get_device(), render_pass.second, nullptr);
-		for (auto &pipeline : compute_pipelines)
-			if (pipeline.second)
-				vkDestroyPipeline(device->get_device(), pipeline.second, nullptr);
-		for (auto &pipeline : graphics_pipelines)
-			if (pipeline.second)
-				vkDestroyPipeline(device->get_device(), pipeline.second, nullptr);
+		VkPipelineLibraryCreateInfoKHR link_info = { VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR };
+		link_info.pNext = orig_feedback ? &feedback : nullptr;
+		link_info.libraryCount = 2;
+		link_info.pLibraries = libraries;
 
-		shader_modules.delete_cache([this](Hash, VkShaderModule module) {
-			if (module != VK_NULL_HANDLE)
-				vkDestroyShaderModule(device->get_device(), module, nullptr);
-		});
+		VkGraphicsPipelineLibraryCreateInfoEXT library_info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT };
+		library_info.pNext = &link_info;
+		library_info.flags = VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT |
+		                     VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+
+		VkGraphicsPipelineCreateInfo create_info = info;
+		create_info.pNext = &library_info;
+		create_info.stageCount = 0;
+		create_info.pStages = nullptr;
+
+		return vkCreateGraphicsPipelines(device->get_device(), cache, 1, &create_info, nullptr, pipeline);
 	}
 
-	bool validate_validation_cache_header(const vector<uint8_t> &blob) const
+	VkResult create_graphics_pipelines(VkPipelineCache cache, uint32_t count,
+	                                   const VkGraphicsPipelineCreateInfo *infos, VkPipeline *pipelines)
 	{
-		if (blob.size() < 8 + VK_UUID_SIZE)
+		if (!use_graphics_pipeline_library)
+			return vkCreateGraphicsPipelines(device->get_device(), cache, count, infos, nullptr, pipelines);
+
+		VkResult result = VK_SUCCESS;
+		for (uint32_t i = 0; i < count; i++)
 		{
-			LOGE("Validation cache header is too small.\n");
-			return false;
+			pipelines[i] = VK_NULL_HANDLE;
+			VkResult res = create_linked_graphics_pipeline(cache, infos[i], &pipelines[i]);
+			if (res == VK_ERROR_FEATURE_NOT_PRESENT)
+				res = vkCreateGraphicsPipelines(device->get_device(), cache, 1, &infos[i], nullptr, &pipelines[i]);
+			else if (res == VK_SUCCESS)
+				graphics_linked_pipeline_count.fetch_add(1, std::memory_order_relaxed);
+
+			if (res != VK_SUCCESS)
+			{
+				pipelines[i] = VK_NULL_HANDLE;
+				result = res;
+			}
 		}
 
-		const auto read_le = [&](unsigned offset) -> uint32_t {
-			return uint32_t(blob[offset + 0]) |
-			       (uint32_t(blob[offset + 1]) << 8) |
-			       (uint32_t(blob[offset + 2]) << 16) |
-			       (uint32_t(blob[offset + 3]) << 24);
-		};
+		return result;
+	}
 
-		if (read_le(4) != VK_VALIDATION_CACHE_HEADER_VERSION_ONE_EXT)
-			return false;
+	// Libraries are keyed by shader module handles. Once a module is destroyed its handle can be reused
+	// by a different module, so libraries cannot outlive an eviction from the shader module cache.
+	void maintain_graphics_library_cache(bool shader_modules_evicted)
+	{
+		lock_guard<mutex> lock(graphics_library_lock);
+		auto deleter = [this](Hash, VkPipeline library) {
+			vkDestroyPipeline(device->get_device(), library, nullptr);
+		};
 
-		// Doesn't seem to be a way to get the UUID, but layer should reject mismatches.
-		return true;
+		if (shader_modules_evicted)
+			graphics_libraries.delete_cache(deleter);
+		else
+			graphics_libraries.prune_cache(deleter);
 	}
 
-	bool validate_pipeline_cache_header(const vector<uint8_t> &blob) const
+	// Captures the driver binaries of a pipeline created with VK_PIPELINE_CREATE_2_CAPTURE_DATA_BIT_KHR.
+	// Entries are keyed by the pipeline hash combined with pipelineCacheUUID, so one archive can hold several drivers.
+	// Payload layout: uint32_t version, uint8_t pipelineCacheUUID[VK_UUID_SIZE], uint32_t binary count,
+	// then for each binary: uint32_t key size, uint8_t key[VK_MAX_PIPELINE_BINARY_KEY_SIZE_KHR], uint64_t data size, data.
+	void capture_pipeline_binaries(ResourceTag tag, Hash hash, VkPipeline pipeline)
 	{
-		if (blob.size() < 16 + VK_UUID_SIZE)
+		auto &funcs = device->get_pipeline_binary_functions();
+		VkDevice vk_device = device->get_device();
+
+		VkPipelineBinaryCreateInfoKHR create_info = { VK_STRUCTURE_TYPE_PIPELINE_BINARY_CREATE_INFO_KHR };
+		create_info.pipeline = pipeline;
+		VkPipelineBinaryHandlesInfoKHR handles = { VK_STRUCTURE_TYPE_PIPELINE_BINARY_HANDLES_INFO_KHR };
+		vector<VkPipelineBinaryKHR> binaries;
+
+		bool ok = funcs.create_pipeline_binaries(vk_device, &create_info, nullptr, &handles) == VK_SUCCESS;
+		if (ok && handles.pipelineBinaryCount != 0)
 		{
-			LOGI("Pipeline cache header is too small.\n");
-			return false;
+			binaries.resize(handles.pipelineBinaryCount);
+			handles.pPipelineBinaries = binaries.data();
+			ok = funcs.create_pipeline_binaries(vk_device, &create_info, nullptr, &handles) == VK_SUCCESS;
 		}
 
-		const auto read_le = [&](unsigned offset) -> uint32_t {
-			return uint32_t(blob[offset + 0]) |
-				(uint32_t(blob[offset + 1]) << 8) |
-				(uint32_t(blob[offset + 2]) << 16) |
-				(uint32_t(blob[offset + 3]) << 24);
+		// The driver holds on to the captured data until we release it, even if creating binaries failed.
+		VkReleaseCapturedPipelineDataInfoKHR release_info = { VK_STRUCTURE_TYPE_RELEASE_CAPTURED_PIPELINE_DATA_INFO_KHR };
+		release_info.pipeline = pipeline;
+		funcs.release_captured_pipeline_data(vk_device, &release_info, nullptr);
+
+		vector<uint8_t> blob;
+		auto append = [&blob](const void *data, size_t size) {
+			blob.insert(blob.end(), static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size);
 		};
 
-		auto length = read_le(0);
-		if (length != 16 + VK_UUID_SIZE)
+		const uint32_t version = 1;
+		const uint32_t binary_count = uint32_t(binaries.size());
+		append(&version, sizeof(version));
+		append(device->get_gpu_properties().pipelineCacheUUID, VK_UUID_SIZE);
+		append(&binary_count, sizeof(binary_count));
+
+		vector<uint8_t> data;
+		for (auto binary : binaries)
 		{
-			LOGI("Length of pipeline cache header is not as expected.\n");
-			return false;
+			if (!ok || binary == VK_NULL_HANDLE)
+				continue;
+
+			VkPipelineBinaryDataInfoKHR data_info = { VK_STRUCTURE_TYPE_PIPELINE_BINARY_DATA_INFO_KHR };
+			data_info.pipelineBinary = binary;
+			VkPipelineBinaryKeyKHR key = { VK_STRUCTURE_TYPE_PIPELINE_BINARY_KEY_KHR };
+			size_t data_size = 0;
+
+			if (funcs.get_pipeline_binary_data(vk_device, &data_info, &key, &data_size, nullptr) != VK_SUCCESS)
+				ok = false;
+			data.resize(data_size);
+			if (ok && funcs.get_pipeline_binary_data(vk_device, &data_info, &key, &data_size, data.data()) != VK_SUCCESS)
+				ok = false;
+
+			if (ok)
+			{
+				uint64_t size = data_size;
+				append(&key.keySize, sizeof(key.keySize));
+				append(key.key, sizeof(key.key));
+				append(&size, sizeof(size));
+				append(data.data(), data_size);
+			}
 		}
 
-		auto version = read_le(4);
-		if (version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+		for (auto binary : binaries)
+			if (binary != VK_NULL_HANDLE)
+				funcs.destroy_pipeline_binary(vk_device, binary, nullptr);
+
+		if (!ok)
 		{
-			LOGI("Version of pipeline cache header is not 1.\n");
-			return false;
+			LOGW("Failed to capture pipeline binaries for hash 0x%016" PRIx64 ".\n", hash);
+			return;
 		}
 
-		VkPhysicalDeviceProperties props = {};
-		vkGetPhysicalDeviceProperties(device->get_gpu(), &props);
-		if (props.vendorID != read_le(8))
+		Hash binary_hash = compute_xxh64(device->get_gpu_properties().pipelineCacheUUID, VK_UUID_SIZE, hash);
+
+		lock_guard<mutex> lock(pipeline_binary_mutex);
+		if (pipeline_binary_db->write_entry(tag, binary_hash, blob.data(), blob.size(), PAYLOAD_WRITE_COMPRESS_BIT))
 		{
-			LOGI("Mismatch of vendorID and cache vendorID.\n");
-			return false;
+			pipeline_binary_db->flush();
+			pipeline_binary_count.fetch_add(binary_count, std::memory_order_relaxed);
 		}
+		else
+			LOGE("Failed to write pipeline binaries to archive.\n");
+	}
+
+	static void expand_inline_shader_stage(const VkPipelineShaderStageCreateInfo &stage,
+	                                       VkPipelineShaderStageCreateInfo &inline_stage,
+	                                       VkShaderModuleCreateInfo &module_info)
+	{
+		module_info = get_inline_shader_module(stage.module)->create_info;
+		module_info.pNext = stage.pNext;
+		inline_stage = stage;
+		inline_stage.pNext = &module_info;
+		inline_stage.module = VK_NULL_HANDLE;
+	}
 
-		if (props.deviceID != read_le(12))
+	template <typename CreateInfo>
+	static void set_fail_on_compile_required(vector<CreateInfo> &infos, bool enable)
+	{
+		for (auto &info : infos)
 		{
-			LOGI("Mismatch of deviceID and cache deviceID.\n");
-			return false;
+			if (enable)
+				info.flags |= VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT;
+			else
+				info.flags &= ~VkPipelineCreateFlags(VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT);
 		}
+	}
+
+	// Asks for every pipeline with VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT first.
+	// Pipelines the on-disk or driver cache already has come back right away, and only the misses are compiled.
+	// Exactly one of graphics_infos and compute_infos is non-empty.
+	VkResult probe_and_create_pipelines(VkPipelineCache cache, uint32_t count,
+	                                    vector<VkGraphicsPipelineCreateInfo> &graphics_infos,
+	                                    vector<VkComputePipelineCreateInfo> &compute_infos,
+	                                    vector<VkPipeline> &pipelines)
+	{
+		const bool graphics = !graphics_infos.empty();
+		auto start_time = chrono::steady_clock::now();
+
+		set_fail_on_compile_required(graphics_infos, true);
+		set_fail_on_compile_required(compute_infos, true);
+		if (graphics)
+			vkCreateGraphicsPipelines(device->get_device(), cache, count, graphics_infos.data(), nullptr, pipelines.data());
+		else
+			vkCreateComputePipelines(device->get_device(), cache, count, compute_infos.data(), nullptr, pipelines.data());
+		set_fail_on_compile_required(graphics_infos, false);
+		set_fail_on_compile_required(compute_infos, false);
+
+		record_trace_event("probe_pipeline_cache", 0, ~0u, start_time, chrono::steady_clock::now());
+
+		// Pipelines which were not created need to be compiled for real, whatever the reason.
+		vector<uint32_t> misses;
+		for (uint32_t j = 0; j < count; j++)
+			if (pipelines[j] == VK_NULL_HANDLE)
+				misses.push_back(j);
+
+		pipeline_cache_hits.fetch_add(count - uint32_t(misses.size()), std::memory_order_relaxed);
+		pipeline_cache_misses.fetch_add(uint32_t(misses.size()), std::memory_order_relaxed);
 
-		if (memcmp(props.pipelineCacheUUID, blob.data() + 16, VK_UUID_SIZE) != 0)
+		if (misses.empty())
+			return VK_SUCCESS;
+
+		vector<VkPipeline> miss_pipelines(misses.size());
+		VkResult result;
+		if (graphics)
 		{
-			LOGI("Mismatch between pipelineCacheUUID.\n");
-			return false;
+			vector<VkGraphicsPipelineCreateInfo> miss_infos;
+			for (auto j : misses)
+				miss_infos.push_back(graphics_infos[j]);
+			result = create_graphics_pipelines(cache, uint32_t(misses.size()), miss_infos.data(), miss_pipelines.data());
+		}
+		else
+		{
+			vector<VkComputePipelineCreateInfo> miss_infos;
+			for (auto j : misses)
+				miss_infos.push_back(compute_infos[j]);
+			result = vkCreateComputePipelines(device->get_device(), cache, uint32_t(misses.size()), miss_infos.data(),
+			                                  nullptr, miss_pipelines.data());
 		}
 
-		return true;
+		// Same as a single vkCreate*Pipelines call, failed pipelines are VK_NULL_HANDLE.
+		if (result != VK_SUCCESS && misses.size() == 1)
+			miss_pipelines[0] = VK_NULL_HANDLE;
+		for (size_t k = 0; k < misses.size(); k++)
+			pipelines[misses[k]] = miss_pipelines[k];
+
+		return result;
 	}
 
-	void set_application_info(Hash, const VkApplicationInfo *app, const VkPhysicalDeviceFeatures2 *features) override
+	// Compiles a set of pipelines of the same type and memory context in one vkCreate*Pipelines call.
+	// Every work item must have passed begin_creation_work_item().
+	void create_pipelines(const PipelineWorkItem *work_items, uint32_t count)
 	{
-		// TODO: Could use this to create multiple VkDevices for replay as necessary if app changes.
+		const bool graphics = work_items[0].tag == RESOURCE_GRAPHICS_PIPELINE;
+		const bool want_feedback = disk_pipeline_cache && device->pipeline_feedback_enabled();
+		constexpr uint32_t max_stages = 16;
 
-		if (!device_was_init)
+		VkPipelineCache cache = disk_pipeline_cache;
+		if (!cache)
+			cache = memory_context_pipeline_cache[work_items[0].memory_context_index];
+
+		vector<VkGraphicsPipelineCreateInfo> graphics_infos;
+		vector<VkComputePipelineCreateInfo> compute_infos;
+		if (graphics)
 		{
-			// Now we can init the device with correct app info.
-			device_was_init = true;
-			device.reset(new VulkanDevice);
-			device_opts.application_info = app;
-			device_opts.features = features;
-			device_opts.want_pipeline_stats = opts.pipeline_stats;
-			auto start_device = chrono::steady_clock::now();
-			if (!device->init_device(device_opts))
+			graphics_infos.resize(count);
+			for (uint32_t j = 0; j < count; j++)
+				graphics_infos[j] = *work_items[j].create_info.graphics_create_info;
+		}
+		else
+		{
+			compute_infos.resize(count);
+			for (uint32_t j = 0; j < count; j++)
+				compute_infos[j] = *work_items[j].create_info.compute_create_info;
+		}
+
+		// The parsed create infos keep their module handles, so a crash can still be attributed to the modules.
+		vector<VkPipelineShaderStageCreateInfo> inline_stages;
+		vector<VkShaderModuleCreateInfo> inline_module_infos;
+		if (use_inline_shader_modules)
+		{
+			inline_stages.resize(count * max_stages);
+			inline_module_infos.resize(count * max_stages);
+			for (uint32_t j = 0; j < count; j++)
 			{
-				LOGE("Failed to create Vulkan device, bailing ...\n");
-				exit(EXIT_FAILURE);
+				auto *stages = &inline_stages[j * max_stages];
+				auto *module_infos = &inline_module_infos[j * max_stages];
+				if (graphics)
+				{
+					auto &info = graphics_infos[j];
+					for (uint32_t k = 0; k < info.stageCount && k < max_stages; k++)
+						expand_inline_shader_stage(info.pStages[k], stages[k], module_infos[k]);
+					info.pStages = stages;
+				}
+				else
+				{
+					auto &info = compute_infos[j];
+					expand_inline_shader_stage(info.stage, stages[0], module_infos[0]);
+					info.stage = stages[0];
+				}
 			}
+		}
 
-			device->set_validation_error_callback(on_validation_error, this);
+		vector<VkPipeline> pipelines(count);
+		vector<VkPipelineCreationFeedbackEXT> feedbacks(count * max_stages);
+		vector<VkPipelineCreationFeedbackEXT> primary_feedbacks(count);
+		vector<VkPipelineCreationFeedbackCreateInfoEXT> feedback_infos(count);
+		vector<VkPipelineCreateFlags2CreateInfoKHR> flags2_infos(pipeline_binary_db ? count : 0);
 
-			if (opts.pipeline_stats && !device->has_pipeline_stats())
+		for (unsigned i = 0; i < loop_count; i++)
+		{
+			for (uint32_t j = 0; j < count; j++)
 			{
-				LOGI("Requested pipeline stats, but device does not support them. Disabling.\n");
-				opts.pipeline_stats = false;
-			}
+				auto &work_item = work_items[j];
 
-			if (opts.pipeline_stats)
-			{
-				auto foz_path = opts.pipeline_stats_path + ".__tmp.foz";
-				pipeline_stats_db.reset(create_stream_archive_database(foz_path.c_str(), DatabaseMode::Append));
-				if (!pipeline_stats_db->prepare())
+				// Avoid leak.
+				if (*work_item.hash_map_entry.pipeline != VK_NULL_HANDLE)
+					vkDestroyPipeline(device->get_device(), *work_item.hash_map_entry.pipeline, nullptr);
+				*work_item.hash_map_entry.pipeline = VK_NULL_HANDLE;
+
+				auto &feedback = feedback_infos[j];
+				feedback = { VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT };
+				feedback.pipelineStageCreationFeedbackCount = graphics ? graphics_infos[j].stageCount : 1;
+				feedback.pPipelineStageCreationFeedbacks = &feedbacks[j * max_stages];
+				feedback.pPipelineCreationFeedback = &primary_feedbacks[j];
+				primary_feedbacks[j] = {};
+				for (uint32_t k = 0; k < max_stages; k++)
+					feedbacks[j * max_stages + k] = {};
+
+				const void *pNext = graphics ? work_item.create_info.graphics_create_info->pNext :
+				                    work_item.create_info.compute_create_info->pNext;
+				if (want_feedback)
+					pNext = &feedback;
+
+				// Binaries only need to be captured once, capturing makes the driver hold on to extra data.
+				if (pipeline_binary_db && i == 0)
 				{
-					LOGW("Failed to prepare stats database. Disabling pipeline stats.\n");
-					pipeline_stats_db.reset();
-					opts.pipeline_stats = false;
+					auto &flags2 = flags2_infos[j];
+					flags2 = { VK_STRUCTURE_TYPE_PIPELINE_CREATE_FLAGS_2_CREATE_INFO_KHR };
+					flags2.pNext = pNext;
+					flags2.flags = VkPipelineCreateFlags2KHR(graphics ? graphics_infos[j].flags : compute_infos[j].flags) |
+					               VK_PIPELINE_CREATE_2_CAPTURE_DATA_BIT_KHR;
+					pNext = &flags2;
 				}
+
+				if (graphics)
+					graphics_infos[j].pNext = pNext;
+				else
+					compute_infos[j].pNext = pNext;
 			}
 
-			if (!opts.on_disk_pipeline_cache_path.empty())
+			auto start_time = chrono::steady_clock::now();
+
+#ifdef SIMULATE_UNSTABLE_DRIVER
+			spurious_crash();
+#endif
+
+			// Per specification, pipelines which failed to compile are VK_NULL_HANDLE,
+			// and the others are valid even if the call as a whole failed.
+			VkResult result;
+			if (use_pipeline_cache_probe && i == 0)
+				result = probe_and_create_pipelines(cache, count, graphics_infos, compute_infos, pipelines);
+			else if (graphics)
+				result = create_graphics_pipelines(cache, count, graphics_infos.data(), pipelines.data());
+			else
+				result = vkCreateComputePipelines(device->get_device(), cache, count, compute_infos.data(), nullptr, pipelines.data());
+
+			auto end_time = chrono::steady_clock::now();
+			auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
+			record_trace_event(graphics ? "create_graphics_pipelines" : "create_compute_pipelines",
+			                   work_items[0].hash, ~0u, start_time, end_time);
+			// We cannot tell how a batch was split up by the driver, so attribute time evenly.
+			auto pipeline_duration_ns = duration_ns / count;
+
+			for (uint32_t j = 0; j < count; j++)
 			{
-				VkPipelineCacheCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
-				vector<uint8_t> on_disk_cache;
+				auto &work_item = work_items[j];
+				if (result != VK_SUCCESS && count == 1)
+					pipelines[j] = VK_NULL_HANDLE;
+				*work_item.output.pipeline = pipelines[j];
 
-				// Try to load on-disk cache.
-				FILE *file = fopen(opts.on_disk_pipeline_cache_path.c_str(), "rb");
-				if (file)
+				if (pipelines[j] == VK_NULL_HANDLE)
 				{
-					fseek(file, 0, SEEK_END);
-					size_t len = ftell(file);
-					rewind(file);
-
-					if (len != 0)
-					{
-						on_disk_cache.resize(len);
-						if (fread(on_disk_cache.data(), 1, len, file) == len)
-						{
-							if (validate_pipeline_cache_header(on_disk_cache))
-							{
-								info.pInitialData = on_disk_cache.data();
-								info.initialDataSize = on_disk_cache.size();
-							}
-							else
-								LOGI("Failed to validate pipeline cache. Creating a blank one.\n");
-						}
-					}
+					LOGE("Failed to create %s pipeline for hash 0x%016" PRIx64 ".\n",
+					     graphics ? "graphics" : "compute", work_item.hash);
+					continue;
 				}
 
-				if (vkCreatePipelineCache(device->get_device(), &info, nullptr, &disk_pipeline_cache) != VK_SUCCESS)
+				if (graphics)
 				{
-					LOGW("Failed to create pipeline cache, trying to create a blank one.\n");
-					info.initialDataSize = 0;
-					info.pInitialData = nullptr;
-					if (vkCreatePipelineCache(device->get_device(), &info, nullptr, &disk_pipeline_cache) != VK_SUCCESS)
-					{
-						LOGE("Failed to create pipeline cache.\n");
-						disk_pipeline_cache = VK_NULL_HANDLE;
-					}
+					graphics_pipeline_ns.fetch_add(pipeline_duration_ns, std::memory_order_relaxed);
+					graphics_pipeline_count.fetch_add(1, std::memory_order_relaxed);
 				}
-			}
-
-			if (!opts.on_disk_validation_cache_path.empty())
-			{
-				if (device->has_validation_cache())
+				else
 				{
-					VkValidationCacheCreateInfoEXT info = {VK_STRUCTURE_TYPE_VALIDATION_CACHE_CREATE_INFO_EXT };
-					vector<uint8_t> on_disk_cache;
+					compute_pipeline_ns.fetch_add(pipeline_duration_ns, std::memory_order_relaxed);
+					compute_pipeline_count.fetch_add(1, std::memory_order_relaxed);
+				}
 
-					FILE *file = fopen(opts.on_disk_validation_cache_path.c_str(), "rb");
-					if (file)
-					{
-						fseek(file, 0, SEEK_END);
-						size_t len = ftell(file);
-						rewind(file);
+				VkPipelineCreateFlags flags = graphics ? graphics_infos[j].flags : compute_infos[j].flags;
+				bool keep_pipeline = !opts.ignore_derived_pipelines && (flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) != 0;
 
-						if (len != 0)
-						{
-							on_disk_cache.resize(len);
-							if (fread(on_disk_cache.data(), 1, len, file) == len)
-							{
-								if (validate_validation_cache_header(on_disk_cache))
-								{
-									info.pInitialData = on_disk_cache.data();
-									info.initialDataSize = on_disk_cache.size();
-								}
-								else
-									LOGI("Failed to validate validation cache. Creating a blank one.\n");
-							}
-						}
-					}
+				// Parent pipelines outlive this function, but may be destroyed by a later loop iteration, so query them here.
+				if (opts.pipeline_stats && i == 0 && keep_pipeline)
+					get_pipeline_stats(work_item.tag, work_item.hash, pipelines[j], pipeline_duration_ns);
 
-					if (vkCreateValidationCacheEXT(device->get_device(), &info, nullptr, &validation_cache) != VK_SUCCESS)
-					{
-						LOGW("Failed to create validation cache, trying to create a blank one.\n");
-						info.initialDataSize = 0;
-						info.pInitialData = nullptr;
-						if (vkCreateValidationCacheEXT(device->get_device(), &info, nullptr, &validation_cache) != VK_SUCCESS)
-						{
-							LOGE("Failed to create validation cache.\n");
-							validation_cache = VK_NULL_HANDLE;
-						}
-					}
+				if (i == 0)
+					record_timing_sample(work_item.tag, work_item.hash, pipeline_duration_ns);
+
+				if (pipeline_binary_db && i == 0)
+					capture_pipeline_binaries(work_item.tag, work_item.hash, pipelines[j]);
+
+				if (keep_pipeline)
+				{
+					*work_item.hash_map_entry.pipeline = pipelines[j];
 				}
 				else
 				{
-					LOGE("Requested validation cache, but validation layers do not support this extension.\n");
+					// Destroy the pipeline right away to save memory if we don't need it for purposes of creating derived pipelines later.
+					// With pipeline stats, the stats thread destroys it once the statistics are queried.
+					*work_item.hash_map_entry.pipeline = VK_NULL_HANDLE;
+					if (opts.pipeline_stats && i == 0)
+						enqueue_pipeline_stats(work_item.tag, work_item.hash, pipelines[j], pipeline_duration_ns);
+					else
+						vkDestroyPipeline(device->get_device(), pipelines[j], nullptr);
+					*work_item.output.pipeline = VK_NULL_HANDLE;
 				}
-			}
-
-			if (!opts.replayer_cache_path.empty())
-				if (!init_replayer_cache())
-					LOGW("Failed to initialize replayer cache. Ignoring!\n");
 
-			auto end_device = chrono::steady_clock::now();
-			long time_ms = chrono::duration_cast<chrono::milliseconds>(end_device - start_device).count();
-			LOGI("Creating Vulkan device took: %ld ms\n", time_ms);
+				if (opts.control_block && i == 0)
+				{
+					if (graphics)
+						opts.control_block->successful_graphics.fetch_add(1, std::memory_order_relaxed);
+					else
+						opts.control_block->successful_compute.fetch_add(1, std::memory_order_relaxed);
+				}
 
-			if (app)
-			{
-				LOGI("Replaying for application:\n");
-				LOGI("  apiVersion: %u.%u.%u\n",
-				     VK_VERSION_MAJOR(app->apiVersion),
-				     VK_VERSION_MINOR(app->apiVersion),
-				     VK_VERSION_PATCH(app->apiVersion));
-				LOGI("  engineVersion: %u\n", app->engineVersion);
-				LOGI("  applicationVersion: %u\n", app->applicationVersion);
-				if (app->pEngineName)
-					LOGI("  engineName: %s\n", app->pEngineName);
-				if (app->pApplicationName)
-					LOGI("  applicationName: %s\n", app->pApplicationName);
+				// Probing counts hits and misses itself, and does not rely on the driver filling in feedback.
+				if (disk_pipeline_cache && i == 0 && !use_pipeline_cache_probe &&
+				    (primary_feedbacks[j].flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) != 0)
+				{
+					if (pipeline_cache_hit(primary_feedbacks[j], &feedbacks[j * max_stages],
+					                       feedback_infos[j].pipelineStageCreationFeedbackCount))
+						pipeline_cache_hits.fetch_add(1, std::memory_order_relaxed);
+					else
+						pipeline_cache_misses.fetch_add(1, std::memory_order_relaxed);
+				}
 			}
 		}
 	}
 
-	bool enqueue_create_sampler(Hash index, const VkSamplerCreateInfo *create_info, VkSampler *sampler) override
+	static void set_base_pipeline(const PipelineWorkItem &work_item, VkPipeline pipeline)
 	{
-		if (!device->get_feature_filter().sampler_is_supported(create_info))
-		{
-			LOGW("Sampler %016" PRIx64 " is not supported. Skipping.\n", index);
-			return false;
-		}
+		if (work_item.tag == RESOURCE_GRAPHICS_PIPELINE)
+			const_cast<VkGraphicsPipelineCreateInfo *>(work_item.create_info.graphics_create_info)->basePipelineHandle = pipeline;
+		else
+			const_cast<VkComputePipelineCreateInfo *>(work_item.create_info.compute_create_info)->basePipelineHandle = pipeline;
+	}
 
-		// Playback in-order.
-		if (vkCreateSampler(device->get_device(), create_info, nullptr, sampler) != VK_SUCCESS)
+	// Called by workers once a pipeline has been processed, successfully or not.
+	// If it is a parent pipeline, derived pipelines waiting for it become runnable right away.
+	void release_derived_work_items(const PipelineWorkItem &work_item)
+	{
+		VkPipelineCreateFlags flags;
+		if (work_item.tag == RESOURCE_GRAPHICS_PIPELINE && work_item.create_info.graphics_create_info)
+			flags = work_item.create_info.graphics_create_info->flags;
+		else if (work_item.tag == RESOURCE_COMPUTE_PIPELINE && work_item.create_info.compute_create_info)
+			flags = work_item.create_info.compute_create_info->flags;
+		else
+			return;
+
+		if ((flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) == 0)
+			return;
+
+		VkPipeline parent_pipeline = *work_item.hash_map_entry.pipeline;
+		vector<PipelineWorkItem> children;
 		{
-			LOGE("Creating sampler %016" PRIx64 " Failed!\n", index);
-			return false;
+			lock_guard<mutex> lock(derived_dependency_lock);
+			auto &parent = derived_dependencies[work_item.tag][work_item.hash];
+			parent.complete = true;
+			parent.pipeline = parent_pipeline;
+			swap(children, parent.children);
 		}
-		samplers[index] = *sampler;
-		return true;
-	}
 
-	bool enqueue_create_descriptor_set_layout(Hash index, const VkDescriptorSetLayoutCreateInfo *create_info, VkDescriptorSetLayout *layout) override
-	{
-		if (!device->get_feature_filter().descriptor_set_layout_is_supported(create_info))
+		if (children.empty())
+			return;
+
+		for (auto &child : children)
+			set_base_pipeline(child, parent_pipeline);
+
+		// Children were counted as queued when they were deferred. Put them in front of our own queue,
+		// the parent was just compiled and drivers may reuse some of that work.
+		unsigned queue_index = (Global::worker_thread_index + num_worker_threads - 1) % num_worker_threads;
+		available_work_items.fetch_add(unsigned(children.size()));
 		{
-			LOGW("Descriptor set layout %016" PRIx64 " is not supported. Skipping.\n", index);
-			return false;
+			lock_guard<mutex> lock(worker_queues[queue_index].lock);
+			for (auto itr = children.rbegin(); itr != children.rend(); ++itr)
+				worker_queues[queue_index].items.push_front(*itr);
 		}
 
-		// Playback in-order.
-		if (vkCreateDescriptorSetLayout(device->get_device(), create_info, nullptr, layout) != VK_SUCCESS)
+		if (sleeping_workers.load() != 0)
 		{
-			LOGE("Creating descriptor set layout %016" PRIx64 " Failed!\n", index);
-			return false;
+			lock_guard<mutex> lock(worker_wait_mutex);
+			work_available_condition.notify_all();
 		}
-		layouts[index] = *layout;
-		return true;
 	}
 
-	bool enqueue_create_pipeline_layout(Hash index, const VkPipelineLayoutCreateInfo *create_info, VkPipelineLayout *layout) override
+	// Main thread only. Holds on to a derived pipeline until its parent has been processed.
+	void enqueue_derived_work_item(const PipelineWorkItem &work_item, Hash parent_hash)
 	{
-		if (!device->get_feature_filter().pipeline_layout_is_supported(create_info))
+		if (work_item.create_info.graphics_create_info || work_item.create_info.compute_create_info)
 		{
-			LOGW("Pipeline layout %016" PRIx64 " is not supported. Skipping.\n", index);
-			return false;
-		}
+			lock_guard<mutex> lock(derived_dependency_lock);
+			auto &parent = derived_dependencies[work_item.tag][parent_hash];
+			if (!parent.complete)
+			{
+				// Count it right away, so syncing the memory context waits for it.
+				queued_count[work_item.memory_context_index].fetch_add(1);
+				parent.children.push_back(work_item);
+				return;
+			}
 
-		// Playback in-order.
-		if (vkCreatePipelineLayout(device->get_device(), create_info, nullptr, layout) != VK_SUCCESS)
-		{
-			LOGE("Creating pipeline layout %0" PRIX64 " Failed!\n", index);
-			return false;
+			set_base_pipeline(work_item, parent.pipeline);
 		}
-		pipeline_layouts[index] = *layout;
-		return true;
+
+		enqueue_work_item(work_item);
 	}
 
-	bool enqueue_create_render_pass(Hash index, const VkRenderPassCreateInfo *create_info, VkRenderPass *render_pass) override
+	void run_creation_work_item(const PipelineWorkItem &work_item)
 	{
-		if (!device->get_feature_filter().render_pass_is_supported(create_info))
+		if (begin_creation_work_item(work_item))
 		{
-			LOGW("Render pass %016" PRIx64 " is not supported. Skipping.\n", index);
-			return false;
+			create_pipelines(&work_item, 1);
+			end_creation_work_item(work_item);
 		}
-
-		// Playback in-order.
-		if (vkCreateRenderPass(device->get_device(), create_info, nullptr, render_pass) != VK_SUCCESS)
+		else
 		{
-			LOGE("Creating render pass %0" PRIX64 " Failed!\n", index);
-			return false;
+			auto &per_thread = get_per_thread_data();
+			per_thread.current_graphics_pipeline = 0;
+			per_thread.current_compute_pipeline = 0;
 		}
-		render_passes[index] = *render_pass;
-		return true;
+
+		release_derived_work_items(work_item);
 	}
 
-	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module) override
+	// All work items are creation work items of the same type and memory context, see pop_work_items().
+	void run_creation_work_items(const PipelineWorkItem *work_items, size_t count)
 	{
-		*module = VK_NULL_HANDLE;
-		if (masked_shader_modules.count(hash) || resource_is_blacklisted(RESOURCE_SHADER_MODULE, hash))
+		auto &per_thread = get_per_thread_data();
+		vector<PipelineWorkItem> batch;
+		batch.reserve(count);
+
+		for (size_t i = 0; i < count; i++)
+			if (begin_creation_work_item(work_items[i]))
+				batch.push_back(work_items[i]);
+
+		if (batch.empty())
 		{
-			lock_guard<mutex> lock(internal_enqueue_mutex);
-			//LOGI("Inserting shader module %016llx.\n", static_cast<unsigned long long>(hash));
-			shader_modules.insert_object(hash, *module, 1);
-			if (opts.control_block)
-				opts.control_block->banned_modules.fetch_add(1, std::memory_order_relaxed);
-			return true;
+			per_thread.current_graphics_pipeline = 0;
+			per_thread.current_compute_pipeline = 0;
+			for (size_t i = 0; i < count; i++)
+				release_derived_work_items(work_items[i]);
+			return;
 		}
 
-#ifdef FOSSILIZE_REPLAYER_SPIRV_VAL
-		if (opts.spirv_validate && !has_resource_in_whitelist(RESOURCE_SHADER_MODULE, hash))
-		{
-			auto start_time = chrono::steady_clock::now();
-			spv_target_env env;
-			if (device->get_api_version() >= VK_VERSION_1_2)
-				env = SPV_ENV_VULKAN_1_2;
-			else if (device->get_api_version() >= VK_VERSION_1_1)
-				env = SPV_ENV_VULKAN_1_1;
-			else
-				env = SPV_ENV_VULKAN_1_0;
+		// If we crash in here, we cannot know which pipeline was at fault.
+		// Make the crash handler restart from the first pipeline in the batch with batching disabled,
+		// so the faulty pipeline is found and attributed on the next attempt.
+		if (batch.front().tag == RESOURCE_GRAPHICS_PIPELINE)
+			per_thread.current_graphics_index = batch.front().index;
+		else
+			per_thread.current_compute_index = batch.front().index;
+		per_thread.current_graphics_pipeline = 0;
+		per_thread.current_compute_pipeline = 0;
+		per_thread.num_failed_module_hashes = 0;
+		per_thread.in_pipeline_batch = true;
 
-			spvtools::SpirvTools context(env);
-			spvtools::ValidatorOptions validation_opts;
-			validation_opts.SetScalarBlockLayout(device->get_feature_filter().supports_scalar_block_layout());
-			context.SetMessageConsumer([](spv_message_level_t, const char *, const spv_position_t &, const char *message) {
-				LOGE("spirv-val: %s\n", message);
-			});
+		create_pipelines(batch.data(), uint32_t(batch.size()));
 
-			bool ret = context.Validate(create_info->pCode, create_info->codeSize / 4, validation_opts);
+		per_thread.in_pipeline_batch = false;
+		if (batch.back().tag == RESOURCE_GRAPHICS_PIPELINE)
+			per_thread.current_graphics_index = batch.back().index + 1;
+		else
+			per_thread.current_compute_index = batch.back().index + 1;
 
-			auto end_time = chrono::steady_clock::now();
-			auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
-			shader_module_ns.fetch_add(duration_ns, std::memory_order_relaxed);
+		for (auto &work_item : batch)
+			end_creation_work_item(work_item);
 
-			if (!ret)
-			{
-				LOGW("Failed to validate SPIR-V module: %0" PRIX64 ", skipping!\n", hash);
-				*module = VK_NULL_HANDLE;
-				lock_guard<mutex> lock(internal_enqueue_mutex);
-				//LOGI("Inserting shader module %016llx.\n", static_cast<unsigned long long>(hash));
-				shader_modules.insert_object(hash, VK_NULL_HANDLE, 1);
-				shader_module_count.fetch_add(1, std::memory_order_relaxed);
+		// Parents which were skipped must release their children as well, they will fail on a null parent handle.
+		for (size_t i = 0; i < count; i++)
+			release_derived_work_items(work_items[i]);
+	}
 
-				if (opts.control_block)
-					opts.control_block->module_validation_failures.fetch_add(1, std::memory_order_relaxed);
+	void worker_thread(unsigned thread_index)
+	{
+		Global::worker_thread_index = thread_index;
 
-				blacklist_resource(RESOURCE_SHADER_MODULE, hash);
-				return true;
-			}
-		}
-#endif
+		if (opts.on_thread_callback)
+			opts.on_thread_callback(opts.on_thread_callback_userdata);
 
-		if (!device->get_feature_filter().shader_module_is_supported(create_info))
+		// Before any per-thread memory is touched, so it is allocated on the right NUMA node.
+		if (!opts.worker_cpus.empty() || opts.numa_local_workers || opts.worker_priority != WorkerPriority::Normal)
 		{
-			LOGW("Shader module %0" PRIx64 " is not supported on this device.\n", hash);
-			*module = VK_NULL_HANDLE;
+			apply_worker_thread_placement(opts.worker_cpus, opts.numa_local_workers, opts.worker_priority,
+			                              opts.worker_slot_offset + thread_index - 1);
+		}
 
-			lock_guard<mutex> lock(internal_enqueue_mutex);
-			//LOGI("Inserting shader module %016llx.\n", static_cast<unsigned long long>(hash));
-			shader_modules.insert_object(hash, VK_NULL_HANDLE, 1);
-			shader_module_count.fetch_add(1, std::memory_order_relaxed);
+		uint64_t idle_ns = 0;
+		auto thread_start_time = chrono::steady_clock::now();
 
-			if (opts.control_block)
-				opts.control_block->module_validation_failures.fetch_add(1, std::memory_order_relaxed);
+		// Pipelines and shader modules are decompressed and parsed in the worker threads.
+		// Inherit references to the trivial modules.
+		StateReplayer per_thread_replayer[NUM_MEMORY_CONTEXTS];
+		for (auto &r : per_thread_replayer)
+		{
+			r.set_resolve_derivative_pipeline_handles(false);
+			r.set_resolve_shader_module_handles(false);
+			r.set_resolve_trivial_object_handles(opts.lazy_trivial_objects);
+			r.copy_handle_references(*global_replayer);
+			if (opts.scratch_huge_pages)
+				r.get_allocator().set_huge_page_threshold(2 * 1024 * 1024);
+		}
 
-			return true;
+		get_per_thread_data().per_thread_replayers = per_thread_replayer;
+		// Let main thread know that the per thread replayers have been initialized correctly.
+		{
+			lock_guard<mutex> lock(worker_wait_mutex);
+			thread_initialized_count++;
+			work_done_condition[0].notify_one();
 		}
 
-		auto &per_thread = get_per_thread_data();
-		per_thread.triggered_validation_error = false;
+		vector<uint8_t> json_buffer;
+		vector<PipelineWorkItem> batch;
 
-		for (unsigned i = 0; i < loop_count; i++)
+		for (;;)
 		{
-			// Avoid leak.
-			if (*module != VK_NULL_HANDLE)
-				vkDestroyShaderModule(device->get_device(), *module, nullptr);
-			*module = VK_NULL_HANDLE;
+			PipelineWorkItem work_item;
+			auto idle_start_time = chrono::steady_clock::now();
 
-			VkShaderModuleValidationCacheCreateInfoEXT validation_info = { VK_STRUCTURE_TYPE_SHADER_MODULE_VALIDATION_CACHE_CREATE_INFO_EXT };
-			if (validation_cache)
+			while (!shutting_down.load() &&
+			       (worker_is_parked(thread_index - 1) || !pop_work_item(thread_index - 1, work_item)))
 			{
-				validation_info.validationCache = validation_cache;
-				const_cast<VkShaderModuleCreateInfo *>(create_info)->pNext = &validation_info;
+				unique_lock<mutex> lock(worker_wait_mutex);
+				// Pairs with flush_work_items(), which only takes the lock if someone is asleep.
+				sleeping_workers.fetch_add(1);
+				work_available_condition.wait(lock, [&]() -> bool {
+					return shutting_down.load() ||
+					       (!worker_is_parked(thread_index - 1) && available_work_items.load() != 0);
+				});
+				sleeping_workers.fetch_sub(1);
 			}
 
-			auto start_time = chrono::steady_clock::now();
-			if (vkCreateShaderModule(device->get_device(), create_info, nullptr, module) == VK_SUCCESS)
+			if (shutting_down.load())
+				break;
+
+			auto idle_end_time = chrono::steady_clock::now();
+			auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(idle_end_time - idle_start_time).count();
+			idle_ns += duration_ns;
+
+			unsigned work_item_count = 1;
+			if (work_item.parse_only)
 			{
-				auto end_time = chrono::steady_clock::now();
-				auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
-				shader_module_ns.fetch_add(duration_ns, std::memory_order_relaxed);
-				shader_module_count.fetch_add(1, std::memory_order_relaxed);
+				run_parse_work_item(per_thread_replayer[work_item.memory_context_index], json_buffer, work_item);
 
-				if (robustness)
+				if (opts.control_block)
 				{
-					lock_guard<mutex> lock(internal_enqueue_mutex);
-					shader_module_to_hash[*module] = hash;
+					size_t parse_buffer_bytes = json_buffer.capacity();
+					for (auto &r : per_thread_replayer)
+						parse_buffer_bytes += r.get_parse_buffer_memory_usage();
+					worker_parse_buffer_bytes[thread_index].store(parse_buffer_bytes, std::memory_order_relaxed);
+					maybe_publish_tracked_memory();
 				}
-
-				if (opts.control_block && i == 0)
-					opts.control_block->successful_modules.fetch_add(1, std::memory_order_relaxed);
 			}
-			else
+			else if (opts.pipeline_batch_size > 1)
 			{
-				LOGE("Failed to create shader module for hash 0x%016" PRIx64 ".\n", hash);
+				batch.clear();
+				batch.push_back(work_item);
+				pop_compatible_work_items(thread_index - 1, batch, opts.pipeline_batch_size);
+				run_creation_work_items(batch.data(), batch.size());
+				work_item_count = unsigned(batch.size());
 			}
-		}
-
-		{
-			lock_guard<mutex> lock(internal_enqueue_mutex);
-			//LOGI("Inserting shader module %016llx.\n", static_cast<unsigned long long>(hash));
-			shader_modules.insert_object(hash, *module, create_info->codeSize);
-		}
-
-		// vkCreateShaderModule doesn't generally crash anything, so just deal with blacklisting here
-		// rather than in an error callback.
-		if (!per_thread.triggered_validation_error)
-			whitelist_resource(RESOURCE_SHADER_MODULE, hash);
-		else
-			blacklist_resource(RESOURCE_SHADER_MODULE, hash);
+			else
+				run_creation_work_item(work_item);
 
-		return true;
-	}
+			idle_start_time = chrono::steady_clock::now();
+			{
+				unsigned context_index = work_item.memory_context_index;
+				unsigned completed = completed_count[context_index].fetch_add(work_item_count) + work_item_count;
 
-	bool enqueue_create_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline) override
-	{
-		bool derived = (create_info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
-		bool parent = (create_info->flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) != 0;
-		if (derived && create_info->basePipelineHandle == VK_NULL_HANDLE)
-			LOGE("Creating a derived pipeline with NULL handle.\n");
+				// Makes sense to signal main thread now.
+				// If we have a timeout, we need to keep the dispatcher thread aware of the progress,
+				// so wake it up after each work item is complete.
+				if ((opts.timeout_seconds != 0 || completed == queued_count[context_index].load()) &&
+				    context_waiters[context_index].load())
+				{
+					lock_guard<mutex> lock(worker_wait_mutex);
+					work_done_condition[context_index].notify_one();
+				}
+			}
 
-		// It has never been observed that an application uses multiple layers of derived pipelines.
-		// Rather than trying to replay with arbitrary layers of derived-ness - which may or may not have any impact on caching -
-		// We force these pipelines to be non-derived.
-		// That way we avoid handing the complicated case.
-		// Would need to be fixed if it's determined that:
-		// - An application uses a deep inheritance hierarchy
-		// - Some drivers care about this information w.r.t. caching.
-		if (parent && derived)
-		{
-			LOGE("A parent pipeline is also a derived pipeline. Avoid potential deep dependency chains in replay by forcing the pipeline to be non-derived.\n");
-			auto *info = const_cast<VkComputePipelineCreateInfo *>(create_info);
-			info->flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
-			info->basePipelineHandle = VK_NULL_HANDLE;
-			info->basePipelineIndex = 0;
-		}
-		else if (opts.ignore_derived_pipelines)
-		{
-			auto *info = const_cast<VkComputePipelineCreateInfo *>(create_info);
-			info->flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
-			info->basePipelineHandle = VK_NULL_HANDLE;
-			info->basePipelineIndex = 0;
+			idle_end_time = chrono::steady_clock::now();
+			duration_ns = chrono::duration_cast<chrono::nanoseconds>(idle_end_time - idle_start_time).count();
+			idle_ns += duration_ns;
 		}
 
-		if (opts.pipeline_stats)
-		{
-			auto *info = const_cast<VkComputePipelineCreateInfo *>(create_info);
-			info->flags |= VK_PIPELINE_CREATE_CAPTURE_STATISTICS_BIT_KHR;
-		}
+		total_idle_ns.fetch_add(idle_ns, std::memory_order_relaxed);
+		auto thread_end_time = chrono::steady_clock::now();
+		uint64_t thread_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(thread_end_time - thread_start_time).count();
+		thread_total_ns.fetch_add(thread_ns, std::memory_order_relaxed);
 
 		auto &per_thread = get_per_thread_data();
-		unsigned index = per_thread.current_parse_index;
-		unsigned memory_index = per_thread.memory_context_index;
-		bool force_outside_range = per_thread.force_outside_range;
+		per_thread.idle_ns = idle_ns;
+		per_thread.busy_ns = thread_ns - idle_ns;
 
-		if (!force_outside_range && index < deferred_compute[memory_index].size())
-		{
-			assert(index < deferred_compute[memory_index].size());
-			deferred_compute[memory_index][index] = {
-				const_cast<VkComputePipelineCreateInfo *>(create_info), hash, pipeline, index,
-			};
-		}
-		else
+		size_t peak_memory = 0;
+		size_t block_allocations = 0;
+		size_t block_reuses = 0;
+		for (auto &r : per_thread_replayer)
 		{
-			lock_guard<mutex> holder(hash_lock);
-			compute_parents[hash] = {
-				const_cast<VkComputePipelineCreateInfo *>(create_info), hash, pipeline, index,
-			};
+			auto &allocator = r.get_allocator();
+			peak_memory += allocator.get_peak_memory_consumption();
+			auto stats = allocator.get_statistics();
+			block_allocations += stats.block_allocations;
+			block_reuses += stats.block_reuses;
 		}
 
-		*pipeline = (VkPipeline)hash;
-		if (opts.control_block)
-			opts.control_block->parsed_compute.fetch_add(1, std::memory_order_relaxed);
-
-		return true;
+		total_peak_memory.fetch_add(peak_memory, std::memory_order_relaxed);
+		scratch_block_allocations.fetch_add(block_allocations, std::memory_order_relaxed);
+		scratch_block_reuses.fetch_add(block_reuses, std::memory_order_relaxed);
 	}
 
-	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	void flush_pipeline_cache()
 	{
-		bool derived = (create_info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
-		bool parent = (create_info->flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) != 0;
-		if (derived && create_info->basePipelineHandle == VK_NULL_HANDLE)
-			LOGE("Creating a derived pipeline with NULL handle.\n");
-
-		// It has never been observed that an application uses multiple layers of derived pipelines.
-		// Rather than trying to replay with arbitrary layers of derived-ness - which may or may not have any impact on caching -
-		// We force these pipelines to be non-derived.
-		// That way we avoid handing the complicated case.
-		// Would need to be fixed if it's determined that:
-		// - An application uses a deep inheritance hierarchy
-		// - Some drivers care about this information w.r.t. caching.
-		if (parent && derived)
-		{
-			LOGW("A parent pipeline is also a derived pipeline. Avoid potential deep dependency chains in replay by forcing the pipeline to be non-derived.\n");
-			auto *info = const_cast<VkGraphicsPipelineCreateInfo *>(create_info);
-			info->flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
-			info->basePipelineHandle = VK_NULL_HANDLE;
-			info->basePipelineIndex = 0;
-		}
-		else if (opts.ignore_derived_pipelines)
+		if (device && disk_pipeline_cache)
 		{
-			auto *info = const_cast<VkGraphicsPipelineCreateInfo *>(create_info);
-			info->flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
-			info->basePipelineHandle = VK_NULL_HANDLE;
-			info->basePipelineIndex = 0;
+			if (!opts.on_disk_pipeline_cache_path.empty())
+			{
+				size_t pipeline_cache_size = 0;
+				if (vkGetPipelineCacheData(device->get_device(), disk_pipeline_cache, &pipeline_cache_size, nullptr) == VK_SUCCESS)
+				{
+					vector<uint8_t> pipeline_buffer(pipeline_cache_size);
+					if (vkGetPipelineCacheData(device->get_device(), disk_pipeline_cache, &pipeline_cache_size, pipeline_buffer.data()) == VK_SUCCESS)
+					{
+						// This isn't safe to do in a signal handler, but it's unlikely to be a problem in practice.
+						// Other processes may have the old cache mapped, so replace the file rather than rewriting it.
+						if (!write_buffer_to_file_atomic(opts.on_disk_pipeline_cache_path.c_str(),
+						                                 pipeline_buffer.data(), pipeline_buffer.size()))
+							LOGE("Failed to write pipeline cache data to disk.\n");
+					}
+				}
+			}
+			vkDestroyPipelineCache(device->get_device(), disk_pipeline_cache, nullptr);
+			disk_pipeline_cache = VK_NULL_HANDLE;
 		}
+	}
 
-		if (opts.pipeline_stats)
+	void flush_validation_cache()
+	{
+		if (device && validation_cache)
 		{
-			auto *info = const_cast<VkGraphicsPipelineCreateInfo *>(create_info);
-			info->flags |= VK_PIPELINE_CREATE_CAPTURE_STATISTICS_BIT_KHR;
+			if (!opts.on_disk_validation_cache_path.empty())
+			{
+				size_t validation_cache_size = 0;
+				if (vkGetValidationCacheDataEXT(device->get_device(), validation_cache, &validation_cache_size, nullptr) == VK_SUCCESS)
+				{
+					vector<uint8_t> validation_buffer(validation_cache_size);
+					if (vkGetValidationCacheDataEXT(device->get_device(), validation_cache, &validation_cache_size, validation_buffer.data()) == VK_SUCCESS)
+					{
+						// This isn't safe to do in a signal handler, but it's unlikely to be a problem in practice.
+						if (!write_buffer_to_file_atomic(opts.on_disk_validation_cache_path.c_str(),
+						                                 validation_buffer.data(), validation_buffer.size()))
+							LOGE("Failed to write validation cache data to disk.\n");
+					}
+				}
+			}
+			vkDestroyValidationCacheEXT(device->get_device(), validation_cache, nullptr);
+			validation_cache = VK_NULL_HANDLE;
 		}
+	}
 
-		auto &per_thread = get_per_thread_data();
-		unsigned index = per_thread.current_parse_index;
-		unsigned memory_index = per_thread.memory_context_index;
-		bool force_outside_range = per_thread.force_outside_range;
+	void tear_down_threads()
+	{
+		tear_down_worker_governor_thread();
+#ifdef FOSSILIZE_REPLAYER_SPIRV_VAL
+		tear_down_spirv_validation_pool();
+#endif
 
-		if (!force_outside_range)
-		{
-			assert(index < deferred_graphics[memory_index].size());
-			deferred_graphics[memory_index][index] = {
-				const_cast<VkGraphicsPipelineCreateInfo *>(create_info), hash, pipeline, index,
-			};
-		}
-		else
+		// Signal that it's time for threads to die.
 		{
-			lock_guard<mutex> holder(hash_lock);
-			graphics_parents[hash] = {
-				const_cast<VkGraphicsPipelineCreateInfo *>(create_info), hash, pipeline, index,
-			};
+			lock_guard<mutex> lock(worker_wait_mutex);
+			shutting_down.store(true);
+			work_available_condition.notify_all();
 		}
 
-		*pipeline = (VkPipeline)hash;
-		if (opts.control_block)
-			opts.control_block->parsed_graphics.fetch_add(1, std::memory_order_relaxed);
+		for (auto &thread : thread_pool)
+			if (thread.joinable())
+				thread.join();
+		thread_pool.clear();
 
-		return true;
+		// Workers are gone, so nothing else can be queued up.
+		tear_down_pipeline_stats_thread();
 	}
 
-	bool enqueue_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline,
-	                      unsigned index, unsigned memory_context_index)
+	~ThreadedReplayer()
 	{
-		PipelineWorkItem work_item = {};
-		work_item.hash = hash;
-		work_item.tag = RESOURCE_COMPUTE_PIPELINE;
-		work_item.output.pipeline = pipeline;
-		work_item.index = index;
-		work_item.memory_context_index = memory_context_index;
+		tear_down_threads();
+		flush_pipeline_cache();
+		flush_validation_cache();
 
-		if (create_info->stage.module != VK_NULL_HANDLE)
+		for (auto &sampler : samplers)
+			if (sampler.second)
+				vkDestroySampler(device->get_device(), sampler.second, nullptr);
+		for (auto &layout : layouts)
+			if (layout.second)
+				vkDestroyDescriptorSetLayout(device->get_device(), layout.second, nullptr);
+		for (auto &pipeline_layout : pipeline_layouts)
+			if (pipeline_layout.second)
+				vkDestroyPipelineLayout(device->get_device(), pipeline_layout.second, nullptr);
+		for (auto &render_pass : render_passes)
+			if (render_pass.second)
+				vkDestroyRenderPass(device->get_device(), render_pass.second, nullptr);
+		for (auto &pipeline : compute_pipelines)
+			if (pipeline.second)
+				vkDestroyPipeline(device->get_device(), pipeline.second, nullptr);
+		for (auto &pipeline : graphics_pipelines)
+			if (pipeline.second)
+				vkDestroyPipeline(device->get_device(), pipeline.second, nullptr);
+
+		shader_modules.delete_cache([this](Hash, VkShaderModule module) {
+			destroy_shader_module(module);
+		});
+
+		graphics_libraries.delete_cache([this](Hash, VkPipeline library) {
+			vkDestroyPipeline(device->get_device(), library, nullptr);
+		});
+	}
+
+	bool validate_validation_cache_header(const uint8_t *blob, size_t size) const
+	{
+		if (size < 8 + VK_UUID_SIZE)
 		{
-			work_item.create_info.compute_create_info = create_info;
-			// Pointer to value in std::unordered_map remains fixed per spec (node-based).
-			lock_guard<mutex> lock(internal_enqueue_mutex);
-			work_item.hash_map_entry.pipeline = &compute_pipelines[hash];
+			LOGE("Validation cache header is too small.\n");
+			return false;
 		}
-		//else
-		//	LOGE("Skipping replay of graphics pipeline index %u.\n", graphics_pipeline_index);
 
-		enqueue_work_item(work_item);
+		const auto read_le = [&](unsigned offset) -> uint32_t {
+			return uint32_t(blob[offset + 0]) |
+			       (uint32_t(blob[offset + 1]) << 8) |
+			       (uint32_t(blob[offset + 2]) << 16) |
+			       (uint32_t(blob[offset + 3]) << 24);
+		};
+
+		if (read_le(4) != VK_VALIDATION_CACHE_HEADER_VERSION_ONE_EXT)
+			return false;
 
+		// Doesn't seem to be a way to get the UUID, but layer should reject mismatches.
 		return true;
 	}
 
-	bool enqueue_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline,
-	                      unsigned index, unsigned memory_context_index)
+	void notify_pipeline_usage(ResourceTag tag, Hash hash, uint64_t bind_count) override
 	{
-		bool valid_handles = true;
-		for (uint32_t i = 0; i < create_info->stageCount; i++)
-			if (create_info->pStages[i].module == VK_NULL_HANDLE)
-				valid_handles = false;
+		if (tag == RESOURCE_GRAPHICS_PIPELINE || tag == RESOURCE_COMPUTE_PIPELINE)
+			pipeline_usage[tag][hash] += bind_count;
+	}
 
-		PipelineWorkItem work_item = {};
-		work_item.hash = hash;
-		work_item.tag = RESOURCE_GRAPHICS_PIPELINE;
-		work_item.output.pipeline = pipeline;
-		work_item.index = index;
-		work_item.memory_context_index = memory_context_index;
+	void set_application_info(Hash, const VkApplicationInfo *app, const VkPhysicalDeviceFeatures2 *features) override
+	{
+		// TODO: Could use this to create multiple VkDevices for replay as necessary if app changes.
 
-		if (valid_handles)
+		if (!device_was_init)
 		{
-			work_item.create_info.graphics_create_info = create_info;
-			lock_guard<mutex> lock(internal_enqueue_mutex);
-			// Pointer to value in std::unordered_map remains fixed per spec (node-based).
-			work_item.hash_map_entry.pipeline = &graphics_pipelines[hash];
-		}
-		//else
-		//	LOGE("Skipping replay of graphics pipeline index %u.\n", graphics_pipeline_index);
+			// Now we can init the device with correct app info.
+			device_was_init = true;
+			device.reset(new VulkanDevice);
+			device_opts.application_info = app;
+			device_opts.features = features;
+			device_opts.want_pipeline_stats = opts.pipeline_stats;
+			device_opts.want_inline_shader_modules = opts.inline_shader_modules;
+			auto start_device = chrono::steady_clock::now();
+			if (!device->init_device(device_opts))
+			{
+				LOGE("Failed to create Vulkan device, bailing ...\n");
+				exit(EXIT_FAILURE);
+			}
 
-		enqueue_work_item(work_item);
+			device->set_validation_error_callback(on_validation_error, this);
+
+			// Validation errors are attributed to the pipeline currently being compiled.
+			if (device_opts.enable_validation && opts.pipeline_batch_size > 1)
+			{
+				LOGW("Pipeline batching is not supported with validation, disabling.\n");
+				opts.pipeline_batch_size = 1;
+			}
+
+			if (opts.graphics_pipeline_library)
+			{
+				if (device->has_graphics_pipeline_library())
+					use_graphics_pipeline_library = true;
+				else
+					LOGW("Requested graphics pipeline libraries, but device does not support them. Disabling.\n");
+			}
+
+			if (opts.probe_pipeline_cache)
+			{
+				if (!device->has_pipeline_creation_cache_control())
+					LOGW("Requested pipeline cache probing, but device does not support VK_EXT_pipeline_creation_cache_control. Disabling.\n");
+				else if (!opts.pipeline_binary_archive_path.empty())
+					LOGW("Pipeline cache probing is not supported with pipeline binary capture, disabling.\n");
+				else
+					use_pipeline_cache_probe = true;
+			}
+
+			if (opts.inline_shader_modules)
+			{
+				if (device->has_inline_shader_modules())
+					use_inline_shader_modules = true;
+				else
+					LOGW("Requested inline shader modules, but device supports neither VK_KHR_maintenance5 nor VK_EXT_graphics_pipeline_library. Disabling.\n");
+			}
+
+			if (!opts.pipeline_binary_archive_path.empty())
+			{
+				if (!device->has_pipeline_binary())
+				{
+					LOGW("Requested pipeline binary capture, but device does not support VK_KHR_pipeline_binary. Disabling.\n");
+				}
+				else
+				{
+					pipeline_binary_db.reset(create_stream_archive_database(opts.pipeline_binary_archive_path.c_str(),
+					                                                        DatabaseMode::Append));
+					if (!pipeline_binary_db->prepare())
+					{
+						LOGW("Failed to prepare pipeline binary archive. Disabling pipeline binary capture.\n");
+						pipeline_binary_db.reset();
+					}
+				}
+
+				// The library path links pipelines from pieces, there is no single pipeline to capture from.
+				if (pipeline_binary_db && use_graphics_pipeline_library)
+				{
+					LOGW("Pipeline binary capture does not support graphics pipeline libraries, disabling libraries.\n");
+					use_graphics_pipeline_library = false;
+				}
+			}
+
+			if (opts.pipeline_stats && !device->has_pipeline_stats())
+			{
+				LOGI("Requested pipeline stats, but device does not support them. Disabling.\n");
+				opts.pipeline_stats = false;
+			}
+
+			if (opts.pipeline_stats)
+			{
+				auto foz_path = opts.pipeline_stats_path + ".__tmp.foz";
+				pipeline_stats_db.reset(create_stream_archive_database(foz_path.c_str(), DatabaseMode::Append));
+				if (!pipeline_stats_db->prepare())
+				{
+					LOGW("Failed to prepare stats database. Disabling pipeline stats.\n");
+					pipeline_stats_db.reset();
+					opts.pipeline_stats = false;
+				}
+			}
+
+			if (!opts.on_disk_pipeline_cache_path.empty())
+			{
+				VkPipelineCacheCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+
+				// Try to load on-disk cache. Map it rather than reading it, so the page cache is shared
+				// between all child processes loading the same cache, and nothing is copied before the driver parses it.
+				MappedFile on_disk_cache;
+				if (on_disk_cache.map(opts.on_disk_pipeline_cache_path.c_str()))
+				{
+					if (validate_pipeline_cache_header(device->get_gpu(), on_disk_cache.data(), on_disk_cache.size()))
+					{
+						info.pInitialData = on_disk_cache.data();
+						info.initialDataSize = on_disk_cache.size();
+					}
+					else
+						LOGI("Failed to validate pipeline cache. Creating a blank one.\n");
+				}
+
+				if (vkCreatePipelineCache(device->get_device(), &info, nullptr, &disk_pipeline_cache) != VK_SUCCESS)
+				{
+					LOGW("Failed to create pipeline cache, trying to create a blank one.\n");
+					info.initialDataSize = 0;
+					info.pInitialData = nullptr;
+					if (vkCreatePipelineCache(device->get_device(), &info, nullptr, &disk_pipeline_cache) != VK_SUCCESS)
+					{
+						LOGE("Failed to create pipeline cache.\n");
+						disk_pipeline_cache = VK_NULL_HANDLE;
+					}
+				}
+			}
+
+			if (!opts.on_disk_validation_cache_path.empty())
+			{
+				if (device->has_validation_cache())
+				{
+					VkValidationCacheCreateInfoEXT info = {VK_STRUCTURE_TYPE_VALIDATION_CACHE_CREATE_INFO_EXT };
+
+					MappedFile on_disk_cache;
+					if (on_disk_cache.map(opts.on_disk_validation_cache_path.c_str()))
+					{
+						if (validate_validation_cache_header(on_disk_cache.data(), on_disk_cache.size()))
+						{
+							info.pInitialData = on_disk_cache.data();
+							info.initialDataSize = on_disk_cache.size();
+						}
+						else
+							LOGI("Failed to validate validation cache. Creating a blank one.\n");
+					}
+
+					if (vkCreateValidationCacheEXT(device->get_device(), &info, nullptr, &validation_cache) != VK_SUCCESS)
+					{
+						LOGW("Failed to create validation cache, trying to create a blank one.\n");
+						info.initialDataSize = 0;
+						info.pInitialData = nullptr;
+						if (vkCreateValidationCacheEXT(device->get_device(), &info, nullptr, &validation_cache) != VK_SUCCESS)
+						{
+							LOGE("Failed to create validation cache.\n");
+							validation_cache = VK_NULL_HANDLE;
+						}
+					}
+				}
+				else
+				{
+					LOGE("Requested validation cache, but validation layers do not support this extension.\n");
+				}
+			}
+
+			if (!opts.replayer_cache_path.empty())
+				if (!init_replayer_cache())
+					LOGW("Failed to initialize replayer cache. Ignoring!\n");
+
+			auto end_device = chrono::steady_clock::now();
+			long time_ms = chrono::duration_cast<chrono::milliseconds>(end_device - start_device).count();
+			LOGI("Creating Vulkan device took: %ld ms\n", time_ms);
+
+			if (app)
+			{
+				LOGI("Replaying for application:\n");
+				LOGI("  apiVersion: %u.%u.%u\n",
+				     VK_VERSION_MAJOR(app->apiVersion),
+				     VK_VERSION_MINOR(app->apiVersion),
+				     VK_VERSION_PATCH(app->apiVersion));
+				LOGI("  engineVersion: %u\n", app->engineVersion);
+				LOGI("  applicationVersion: %u\n", app->applicationVersion);
+				if (app->pEngineName)
+					LOGI("  engineName: %s\n", app->pEngineName);
+				if (app->pApplicationName)
+					LOGI("  applicationName: %s\n", app->pApplicationName);
+			}
+		}
+	}
 
+	// With --lazy-trivial-objects, workers can replay the same object concurrently.
+	// The first one to be created is kept, and the others reuse its handle.
+	template <typename T>
+	bool find_trivial_object(const std::unordered_map<Hash, T> &objects, Hash index, T *handle)
+	{
+		lock_guard<mutex> holder{trivial_object_lock};
+		auto itr = objects.find(index);
+		if (itr == objects.end())
+			return false;
+		*handle = itr->second;
 		return true;
 	}
 
-	bool enqueue_shader_module(VkShaderModule shader_module_hash)
+	template <typename T, typename DestroyFunc>
+	void insert_trivial_object(std::unordered_map<Hash, T> &objects, Hash index, T *handle, DestroyFunc destroy)
 	{
-		if (enqueued_shader_modules.count(shader_module_hash) == 0)
+		lock_guard<mutex> holder{trivial_object_lock};
+		auto itr = objects.insert({ index, *handle });
+		if (!itr.second)
 		{
-			if (opts.control_block)
-				opts.control_block->total_modules.fetch_add(1, std::memory_order_relaxed);
+			destroy(device->get_device(), *handle, nullptr);
+			*handle = itr.first->second;
+		}
+	}
 
-			PipelineWorkItem work_item;
-			work_item.tag = RESOURCE_SHADER_MODULE;
-			work_item.hash = (Hash) shader_module_hash;
-			work_item.parse_only = true;
-			work_item.memory_context_index = SHADER_MODULE_MEMORY_CONTEXT;
-			enqueue_work_item(work_item);
-			enqueued_shader_modules.insert(shader_module_hash);
-			//LOGI("Queueing up shader module: %016llx.\n", static_cast<unsigned long long>((Hash) shader_module_hash));
+	bool enqueue_create_sampler(Hash index, const VkSamplerCreateInfo *create_info, VkSampler *sampler) override
+	{
+		if (find_trivial_object(samplers, index, sampler))
 			return true;
-		}
-		else
+
+		if (!resource_is_supported(RESOURCE_SAMPLER, index, [&]() { return device->get_feature_filter().sampler_is_supported(create_info); }))
 		{
-			//LOGI("Not queueing up shader module: %016llx.\n", static_cast<unsigned long long>((Hash) shader_module_hash));
+			LOGW("Sampler %016" PRIx64 " is not supported. Skipping.\n", index);
 			return false;
 		}
-	}
 
-	bool enqueue_shader_modules(const VkGraphicsPipelineCreateInfo *info)
-	{
-		bool ret = false;
-		for (uint32_t i = 0; i < info->stageCount; i++)
-			if (enqueue_shader_module(info->pStages[i].module))
-				ret = true;
-		return ret;
+		// Playback in-order.
+		if (vkCreateSampler(device->get_device(), create_info, nullptr, sampler) != VK_SUCCESS)
+		{
+			LOGE("Creating sampler %016" PRIx64 " Failed!\n", index);
+			return false;
+		}
+		insert_trivial_object(samplers, index, sampler, vkDestroySampler);
+		return true;
 	}
 
-	bool enqueue_shader_modules(const VkComputePipelineCreateInfo *info)
+	bool enqueue_create_descriptor_set_layout(Hash index, const VkDescriptorSetLayoutCreateInfo *create_info, VkDescriptorSetLayout *layout) override
 	{
-		bool ret = enqueue_shader_module(info->stage.module);
-		return ret;
-	}
+		if (find_trivial_object(layouts, index, layout))
+			return true;
 
-	void resolve_shader_modules(VkGraphicsPipelineCreateInfo *info)
-	{
-		for (uint32_t i = 0; i < info->stageCount; i++)
+		if (!resource_is_supported(RESOURCE_DESCRIPTOR_SET_LAYOUT, index, [&]() { return device->get_feature_filter().descriptor_set_layout_is_supported(create_info); }))
 		{
-			auto result = shader_modules.find_object((Hash) info->pStages[i].module);
-			const_cast<VkPipelineShaderStageCreateInfo *>(info->pStages)[i].module = result.first;
+			LOGW("Descriptor set layout %016" PRIx64 " is not supported. Skipping.\n", index);
+			return false;
 		}
-	}
 
-	void resolve_shader_modules(VkComputePipelineCreateInfo *info)
-	{
-		auto result = shader_modules.find_object((Hash) info->stage.module);
-		const_cast<VkComputePipelineCreateInfo*>(info)->stage.module = result.first;
+		// Playback in-order.
+		if (vkCreateDescriptorSetLayout(device->get_device(), create_info, nullptr, layout) != VK_SUCCESS)
+		{
+			LOGE("Creating descriptor set layout %016" PRIx64 " Failed!\n", index);
+			return false;
+		}
+		insert_trivial_object(layouts, index, layout, vkDestroyDescriptorSetLayout);
+		return true;
 	}
 
-	template <typename DerivedInfo>
-	void sort_deferred_derived_pipelines(vector<DerivedInfo> &derived, vector<DerivedInfo> &deferred)
+	bool enqueue_create_pipeline_layout(Hash index, const VkPipelineLayoutCreateInfo *create_info, VkPipelineLayout *layout) override
 	{
-		sort(begin(deferred), end(deferred), [&](const DerivedInfo &a, const DerivedInfo &b) -> bool {
-			bool a_derived = !a.info || (a.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
-			bool b_derived = !b.info || (b.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
-			if (a_derived == b_derived)
-				return a.index < b.index;
-			else
-				return b_derived;
-		});
+		if (find_trivial_object(pipeline_layouts, index, layout))
+			return true;
 
-		unsigned end_index_non_derived = deferred.size();
-		unsigned index = 0;
-		for (auto &def : deferred)
+		if (!resource_is_supported(RESOURCE_PIPELINE_LAYOUT, index, [&]() { return device->get_feature_filter().pipeline_layout_is_supported(create_info); }))
 		{
-			index++;
-			if (def.info && (def.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) == 0)
-				end_index_non_derived = index;
+			LOGW("Pipeline layout %016" PRIx64 " is not supported. Skipping.\n", index);
+			return false;
 		}
 
-		derived.clear();
-		assert(deferred.size() >= end_index_non_derived);
-		derived.reserve(deferred.size() - end_index_non_derived);
-		copy(begin(deferred) + end_index_non_derived, end(deferred), back_inserter(derived));
-		deferred.erase(begin(deferred) + end_index_non_derived, end(deferred));
-
-		auto itr = remove_if(begin(derived), end(derived), [](const DerivedInfo &a) { return a.info == nullptr; });
-		derived.erase(itr, end(derived));
+		// Playback in-order.
+		if (vkCreatePipelineLayout(device->get_device(), create_info, nullptr, layout) != VK_SUCCESS)
+		{
+			LOGE("Creating pipeline layout %0" PRIX64 " Failed!\n", index);
+			return false;
+		}
+		insert_trivial_object(pipeline_layouts, index, layout, vkDestroyPipelineLayout);
+		return true;
 	}
 
-	template <typename DerivedInfo>
-	void enqueue_deferred_pipelines(vector<DerivedInfo> *deferred, const unordered_map<Hash, VkPipeline> &pipelines,
-	                                unordered_map<Hash, DerivedInfo> &parents,
-	                                vector<EnqueuedWork> &work, const vector<Hash> &hashes, unsigned start_index)
+	bool enqueue_create_render_pass(Hash index, const VkRenderPassCreateInfo *create_info, VkRenderPass *render_pass) override
 	{
-		static const unsigned NUM_PIPELINES_PER_CONTEXT = 1024;
+		if (find_trivial_object(render_passes, index, render_pass))
+			return true;
 
-		// Make sure that if we sort by work_index, we get an interleaved execution pattern which
-		// will naturally pipeline.
-		enum PassOrder
+		if (!resource_is_supported(RESOURCE_RENDER_PASS, index, [&]() { return device->get_feature_filter().render_pass_is_supported(create_info); }))
 		{
-			PARSE_ENQUEUE_OFFSET = 0,
-			MAINTAIN_SHADER_MODULE_LRU_CACHE = 1,
-			ENQUEUE_SHADER_MODULES_PRIMARY_OFFSET = 2,
+			LOGW("Render pass %016" PRIx64 " is not supported. Skipping.\n", index);
+			return false;
+		}
+
+		// Playback in-order.
+		if (vkCreateRenderPass(device->get_device(), create_info, nullptr, render_pass) != VK_SUCCESS)
+		{
+			LOGE("Creating render pass %0" PRIX64 " Failed!\n", index);
+			return false;
+		}
+		insert_trivial_object(render_passes, index, render_pass, vkDestroyRenderPass);
+		return true;
+	}
+
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module) override
+	{
+		*module = VK_NULL_HANDLE;
+		if (masked_shader_modules.count(hash) || resource_is_blacklisted(RESOURCE_SHADER_MODULE, hash))
+		{
+			//LOGI("Inserting shader module %016llx.\n", static_cast<unsigned long long>(hash));
+			shader_modules.insert_object(hash, *module, 1);
+			if (opts.control_block)
+				opts.control_block->banned_modules.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+#ifdef FOSSILIZE_REPLAYER_SPIRV_VAL
+		if (opts.spirv_validate && !is_unsupported_blob(RESOURCE_SHADER_MODULE, hash) &&
+		    !has_resource_in_whitelist(RESOURCE_SHADER_MODULE, hash))
+		{
+			bool already_blacklisted = false;
+			if (!shader_module_passes_spirv_validation(hash, create_info, already_blacklisted))
+			{
+				LOGW("Failed to validate SPIR-V module: %0" PRIX64 ", skipping!\n", hash);
+				*module = VK_NULL_HANDLE;
+				//LOGI("Inserting shader module %016llx.\n", static_cast<unsigned long long>(hash));
+				shader_modules.insert_object(hash, VK_NULL_HANDLE, 1);
+				shader_module_count.fetch_add(1, std::memory_order_relaxed);
+
+				if (opts.control_block)
+					opts.control_block->module_validation_failures.fetch_add(1, std::memory_order_relaxed);
+
+				if (!already_blacklisted)
+					blacklist_resource(RESOURCE_SHADER_MODULE, hash);
+				return true;
+			}
+		}
+#endif
+
+		if (!resource_is_supported(RESOURCE_SHADER_MODULE, hash, [&]() {
+			    return device->get_feature_filter().shader_module_is_supported(create_info);
+		    }))
+		{
+			LOGW("Shader module %0" PRIx64 " is not supported on this device.\n", hash);
+			*module = VK_NULL_HANDLE;
+
+			//LOGI("Inserting shader module %016llx.\n", static_cast<unsigned long long>(hash));
+			shader_modules.insert_object(hash, VK_NULL_HANDLE, 1);
+			shader_module_count.fetch_add(1, std::memory_order_relaxed);
+
+			if (opts.control_block)
+				opts.control_block->module_validation_failures.fetch_add(1, std::memory_order_relaxed);
+
+			return true;
+		}
+
+		if (opts.shared_module_cache && !opts.shared_module_cache->contains(create_info->pCode))
+			opts.shared_module_cache->publish(hash, create_info->pCode, create_info->codeSize, create_info->flags);
+
+		if (use_inline_shader_modules)
+		{
+			create_inline_shader_module(hash, create_info, module);
+			return true;
+		}
+
+		auto &per_thread = get_per_thread_data();
+		per_thread.triggered_validation_error = false;
+
+		for (unsigned i = 0; i < loop_count; i++)
+		{
+			// Avoid leak.
+			if (*module != VK_NULL_HANDLE)
+				vkDestroyShaderModule(device->get_device(), *module, nullptr);
+			*module = VK_NULL_HANDLE;
+
+			VkShaderModuleValidationCacheCreateInfoEXT validation_info = { VK_STRUCTURE_TYPE_SHADER_MODULE_VALIDATION_CACHE_CREATE_INFO_EXT };
+			if (validation_cache)
+			{
+				validation_info.validationCache = validation_cache;
+				const_cast<VkShaderModuleCreateInfo *>(create_info)->pNext = &validation_info;
+			}
+
+			auto start_time = chrono::steady_clock::now();
+			if (vkCreateShaderModule(device->get_device(), create_info, nullptr, module) == VK_SUCCESS)
+			{
+				auto end_time = chrono::steady_clock::now();
+				auto duration_ns = chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
+				shader_module_ns.fetch_add(duration_ns, std::memory_order_relaxed);
+				shader_module_count.fetch_add(1, std::memory_order_relaxed);
+
+				if (i == 0)
+					record_timing_sample(RESOURCE_SHADER_MODULE, hash, duration_ns);
+				record_trace_event("create_shader_module", hash, ~0u, start_time, end_time);
+
+				if (robustness)
+				{
+					lock_guard<mutex> lock(internal_enqueue_mutex);
+					shader_module_to_hash[*module] = hash;
+				}
+
+				if (opts.control_block && i == 0)
+					opts.control_block->successful_modules.fetch_add(1, std::memory_order_relaxed);
+			}
+			else
+			{
+				LOGE("Failed to create shader module for hash 0x%016" PRIx64 ".\n", hash);
+			}
+		}
+
+		//LOGI("Inserting shader module %016llx.\n", static_cast<unsigned long long>(hash));
+		shader_modules.insert_object(hash, *module, create_info->codeSize);
+
+		// vkCreateShaderModule doesn't generally crash anything, so just deal with blacklisting here
+		// rather than in an error callback.
+		if (!per_thread.triggered_validation_error)
+			whitelist_resource(RESOURCE_SHADER_MODULE, hash);
+		else
+			blacklist_resource(RESOURCE_SHADER_MODULE, hash);
+
+		return true;
+	}
+
+	// No driver object is created, the code is kept until the module is evicted and handed to every pipeline using it.
+	// This also means there is no handle to map back to a hash, the module carries its own.
+	void create_inline_shader_module(Hash hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module)
+	{
+		auto *inline_module = new InlineShaderModule;
+		inline_module->hash = hash;
+		inline_module->create_info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+		inline_module->create_info.flags = create_info->flags;
+		inline_module->create_info.codeSize = create_info->codeSize;
+
+		// Entries in the shared module cache are never removed, so the code can be referenced in place.
+		const uint32_t *shared_code = nullptr;
+		size_t shared_code_size = 0;
+		uint32_t shared_flags = 0;
+		if (opts.shared_module_cache &&
+		    opts.shared_module_cache->find(hash, &shared_code, &shared_code_size, &shared_flags) &&
+		    shared_code_size == create_info->codeSize)
+		{
+			inline_module->create_info.pCode = shared_code;
+		}
+		else
+		{
+			inline_module->code.assign(create_info->pCode, create_info->pCode + create_info->codeSize / sizeof(uint32_t));
+			inline_module->create_info.pCode = inline_module->code.data();
+		}
+
+		*module = (VkShaderModule)uintptr_t(inline_module);
+		shader_module_count.fetch_add(1, std::memory_order_relaxed);
+		if (opts.control_block)
+			opts.control_block->successful_modules.fetch_add(1, std::memory_order_relaxed);
+
+		//LOGI("Inserting shader module %016llx.\n", static_cast<unsigned long long>(hash));
+		shader_modules.insert_object(hash, *module, create_info->codeSize);
+		whitelist_resource(RESOURCE_SHADER_MODULE, hash);
+	}
+
+	void destroy_shader_module(VkShaderModule module)
+	{
+		if (module == VK_NULL_HANDLE)
+			return;
+
+		if (use_inline_shader_modules)
+			delete get_inline_shader_module(module);
+		else
+			vkDestroyShaderModule(device->get_device(), module, nullptr);
+	}
+
+	Hash get_shader_module_hash(VkShaderModule module)
+	{
+		if (module == VK_NULL_HANDLE)
+			return 0;
+		if (use_inline_shader_modules)
+			return get_inline_shader_module(module)->hash;
+		return shader_module_to_hash[module];
+	}
+
+	bool enqueue_create_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		bool derived = (create_info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
+		bool parent = (create_info->flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) != 0;
+		if (derived && create_info->basePipelineHandle == VK_NULL_HANDLE)
+			LOGE("Creating a derived pipeline with NULL handle.\n");
+
+		// It has never been observed that an application uses multiple layers of derived pipelines.
+		// Rather than trying to replay with arbitrary layers of derived-ness - which may or may not have any impact on caching -
+		// We force these pipelines to be non-derived.
+		// That way we avoid handing the complicated case.
+		// Would need to be fixed if it's determined that:
+		// - An application uses a deep inheritance hierarchy
+		// - Some drivers care about this information w.r.t. caching.
+		if (parent && derived)
+		{
+			LOGE("A parent pipeline is also a derived pipeline. Avoid potential deep dependency chains in replay by forcing the pipeline to be non-derived.\n");
+			auto *info = const_cast<VkComputePipelineCreateInfo *>(create_info);
+			info->flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+			info->basePipelineHandle = VK_NULL_HANDLE;
+			info->basePipelineIndex = 0;
+		}
+		else if (opts.ignore_derived_pipelines)
+		{
+			auto *info = const_cast<VkComputePipelineCreateInfo *>(create_info);
+			info->flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+			info->basePipelineHandle = VK_NULL_HANDLE;
+			info->basePipelineIndex = 0;
+		}
+
+		if (opts.pipeline_stats)
+		{
+			auto *info = const_cast<VkComputePipelineCreateInfo *>(create_info);
+			info->flags |= VK_PIPELINE_CREATE_CAPTURE_STATISTICS_BIT_KHR;
+		}
+
+		auto &per_thread = get_per_thread_data();
+		unsigned index = per_thread.current_parse_index;
+		unsigned memory_index = per_thread.memory_context_index;
+		bool force_outside_range = per_thread.force_outside_range;
+
+		if (!force_outside_range && index < deferred_compute[memory_index].size())
+		{
+			assert(index < deferred_compute[memory_index].size());
+			deferred_compute[memory_index][index] = {
+				const_cast<VkComputePipelineCreateInfo *>(create_info), hash, pipeline, index,
+			};
+		}
+		else
+		{
+			lock_guard<mutex> holder(hash_lock);
+			compute_parents[hash] = {
+				const_cast<VkComputePipelineCreateInfo *>(create_info), hash, pipeline, index,
+			};
+		}
+
+		*pipeline = (VkPipeline)hash;
+		if (opts.control_block)
+			opts.control_block->parsed_compute.fetch_add(1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		bool derived = (create_info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
+		bool parent = (create_info->flags & VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT) != 0;
+		if (derived && create_info->basePipelineHandle == VK_NULL_HANDLE)
+			LOGE("Creating a derived pipeline with NULL handle.\n");
+
+		// It has never been observed that an application uses multiple layers of derived pipelines.
+		// Rather than trying to replay with arbitrary layers of derived-ness - which may or may not have any impact on caching -
+		// We force these pipelines to be non-derived.
+		// That way we avoid handing the complicated case.
+		// Would need to be fixed if it's determined that:
+		// - An application uses a deep inheritance hierarchy
+		// - Some drivers care about this information w.r.t. caching.
+		if (parent && derived)
+		{
+			LOGW("A parent pipeline is also a derived pipeline. Avoid potential deep dependency chains in replay by forcing the pipeline to be non-derived.\n");
+			auto *info = const_cast<VkGraphicsPipelineCreateInfo *>(create_info);
+			info->flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+			info->basePipelineHandle = VK_NULL_HANDLE;
+			info->basePipelineIndex = 0;
+		}
+		else if (opts.ignore_derived_pipelines)
+		{
+			auto *info = const_cast<VkGraphicsPipelineCreateInfo *>(create_info);
+			info->flags &= ~VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+			info->basePipelineHandle = VK_NULL_HANDLE;
+			info->basePipelineIndex = 0;
+		}
+
+		if (opts.pipeline_stats)
+		{
+			auto *info = const_cast<VkGraphicsPipelineCreateInfo *>(create_info);
+			info->flags |= VK_PIPELINE_CREATE_CAPTURE_STATISTICS_BIT_KHR;
+		}
+
+		auto &per_thread = get_per_thread_data();
+		unsigned index = per_thread.current_parse_index;
+		unsigned memory_index = per_thread.memory_context_index;
+		bool force_outside_range = per_thread.force_outside_range;
+
+		if (!force_outside_range)
+		{
+			assert(index < deferred_graphics[memory_index].size());
+			deferred_graphics[memory_index][index] = {
+				const_cast<VkGraphicsPipelineCreateInfo *>(create_info), hash, pipeline, index,
+			};
+		}
+		else
+		{
+			lock_guard<mutex> holder(hash_lock);
+			graphics_parents[hash] = {
+				const_cast<VkGraphicsPipelineCreateInfo *>(create_info), hash, pipeline, index,
+			};
+		}
+
+		*pipeline = (VkPipeline)hash;
+		if (opts.control_block)
+			opts.control_block->parsed_graphics.fetch_add(1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	// If parent_hash is not 0, the pipeline is derived and is only handed to the workers once the parent is done.
+	bool enqueue_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline,
+	                      unsigned index, unsigned memory_context_index, Hash parent_hash = 0)
+	{
+		PipelineWorkItem work_item = {};
+		work_item.hash = hash;
+		work_item.tag = RESOURCE_COMPUTE_PIPELINE;
+		work_item.output.pipeline = pipeline;
+		work_item.index = index;
+		work_item.memory_context_index = memory_context_index;
+
+		if (create_info->stage.module != VK_NULL_HANDLE)
+		{
+			work_item.create_info.compute_create_info = create_info;
+			// Pointer to value in std::unordered_map remains fixed per spec (node-based).
+			lock_guard<mutex> lock(internal_enqueue_mutex);
+			work_item.hash_map_entry.pipeline = &compute_pipelines[hash];
+		}
+		//else
+		//	LOGE("Skipping replay of graphics pipeline index %u.\n", graphics_pipeline_index);
+
+		if (parent_hash)
+			enqueue_derived_work_item(work_item, parent_hash);
+		else
+			enqueue_work_item(work_item);
+
+		return true;
+	}
+
+	bool enqueue_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline,
+	                      unsigned index, unsigned memory_context_index, Hash parent_hash = 0)
+	{
+		bool valid_handles = true;
+		for (uint32_t i = 0; i < create_info->stageCount; i++)
+			if (create_info->pStages[i].module == VK_NULL_HANDLE)
+				valid_handles = false;
+
+		PipelineWorkItem work_item = {};
+		work_item.hash = hash;
+		work_item.tag = RESOURCE_GRAPHICS_PIPELINE;
+		work_item.output.pipeline = pipeline;
+		work_item.index = index;
+		work_item.memory_context_index = memory_context_index;
+
+		if (valid_handles)
+		{
+			work_item.create_info.graphics_create_info = create_info;
+			lock_guard<mutex> lock(internal_enqueue_mutex);
+			// Pointer to value in std::unordered_map remains fixed per spec (node-based).
+			work_item.hash_map_entry.pipeline = &graphics_pipelines[hash];
+		}
+		//else
+		//	LOGE("Skipping replay of graphics pipeline index %u.\n", graphics_pipeline_index);
+
+		if (parent_hash)
+			enqueue_derived_work_item(work_item, parent_hash);
+		else
+			enqueue_work_item(work_item);
+
+		return true;
+	}
+
+	bool enqueue_shader_module(VkShaderModule shader_module_hash)
+	{
+		if (enqueued_shader_modules.count(shader_module_hash) == 0)
+		{
+			if (opts.control_block)
+				opts.control_block->total_modules.fetch_add(1, std::memory_order_relaxed);
+
+			PipelineWorkItem work_item;
+			work_item.tag = RESOURCE_SHADER_MODULE;
+			work_item.hash = (Hash) shader_module_hash;
+			work_item.parse_only = true;
+			work_item.memory_context_index = SHADER_MODULE_MEMORY_CONTEXT;
+			enqueue_work_item(work_item);
+			enqueued_shader_modules.insert(shader_module_hash);
+			//LOGI("Queueing up shader module: %016llx.\n", static_cast<unsigned long long>((Hash) shader_module_hash));
+			return true;
+		}
+		else
+		{
+			//LOGI("Not queueing up shader module: %016llx.\n", static_cast<unsigned long long>((Hash) shader_module_hash));
+			return false;
+		}
+	}
+
+	void add_shader_module_prefetch(vector<Hash> &prefetch, VkShaderModule shader_module_hash)
+	{
+		if (enqueued_shader_modules.count(shader_module_hash) == 0)
+			prefetch.push_back((Hash) shader_module_hash);
+	}
+
+	void add_shader_module_prefetch(vector<Hash> &prefetch, const VkGraphicsPipelineCreateInfo *info)
+	{
+		for (uint32_t i = 0; i < info->stageCount; i++)
+			add_shader_module_prefetch(prefetch, info->pStages[i].module);
+	}
+
+	void add_shader_module_prefetch(vector<Hash> &prefetch, const VkComputePipelineCreateInfo *info)
+	{
+		add_shader_module_prefetch(prefetch, info->stage.module);
+	}
+
+	// Hint the OS to start reading entries we are about to hand to the workers.
+	// The database sorts by file offset, so disk reads are issued in order
+	// instead of in whatever order the workers happen to pick up work.
+	void prefetch_database_entries(ResourceTag tag, const Hash *hashes, size_t count)
+	{
+		if (count && global_database)
+			global_database->prefetch_entries(tag, hashes, count);
+	}
+
+	bool enqueue_shader_modules(const VkGraphicsPipelineCreateInfo *info)
+	{
+		bool ret = false;
+		for (uint32_t i = 0; i < info->stageCount; i++)
+			if (enqueue_shader_module(info->pStages[i].module))
+				ret = true;
+		return ret;
+	}
+
+	bool enqueue_shader_modules(const VkComputePipelineCreateInfo *info)
+	{
+		bool ret = enqueue_shader_module(info->stage.module);
+		return ret;
+	}
+
+	void resolve_shader_modules(VkGraphicsPipelineCreateInfo *info)
+	{
+		for (uint32_t i = 0; i < info->stageCount; i++)
+		{
+			auto result = shader_modules.find_object_and_release_use((Hash) info->pStages[i].module);
+			const_cast<VkPipelineShaderStageCreateInfo *>(info->pStages)[i].module = result.first;
+		}
+	}
+
+	void resolve_shader_modules(VkComputePipelineCreateInfo *info)
+	{
+		auto result = shader_modules.find_object_and_release_use((Hash) info->stage.module);
+		const_cast<VkComputePipelineCreateInfo*>(info)->stage.module = result.first;
+	}
+
+	template <typename DerivedInfo>
+	void sort_deferred_derived_pipelines(vector<DerivedInfo> &derived, vector<DerivedInfo> &deferred)
+	{
+		sort(begin(deferred), end(deferred), [&](const DerivedInfo &a, const DerivedInfo &b) -> bool {
+			bool a_derived = !a.info || (a.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
+			bool b_derived = !b.info || (b.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0;
+			if (a_derived == b_derived)
+				return a.index < b.index;
+			else
+				return b_derived;
+		});
+
+		unsigned end_index_non_derived = deferred.size();
+		unsigned index = 0;
+		for (auto &def : deferred)
+		{
+			index++;
+			if (def.info && (def.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) == 0)
+				end_index_non_derived = index;
+		}
+
+		derived.clear();
+		assert(deferred.size() >= end_index_non_derived);
+		derived.reserve(deferred.size() - end_index_non_derived);
+		copy(begin(deferred) + end_index_non_derived, end(deferred), back_inserter(derived));
+		deferred.erase(begin(deferred) + end_index_non_derived, end(deferred));
+
+		auto itr = remove_if(begin(derived), end(derived), [](const DerivedInfo &a) { return a.info == nullptr; });
+		derived.erase(itr, end(derived));
+	}
+
+	template <typename DerivedInfo>
+	void enqueue_deferred_pipelines(vector<DerivedInfo> *deferred, const unordered_map<Hash, VkPipeline> &pipelines,
+	                                unordered_map<Hash, DerivedInfo> &parents,
+	                                vector<EnqueuedWork> &work, const vector<Hash> &hashes, unsigned start_index)
+	{
+		static const unsigned NUM_PIPELINES_PER_CONTEXT = 1024;
+
+		// Make sure that if we sort by work_index, we get an interleaved execution pattern which
+		// will naturally pipeline.
+		enum PassOrder
+		{
+			PARSE_ENQUEUE_OFFSET = 0,
+			MAINTAIN_SHADER_MODULE_LRU_CACHE = 1,
+			ENQUEUE_SHADER_MODULES_PRIMARY_OFFSET = 2,
 			RESOLVE_SHADER_MODULE_AND_ENQUEUE_PIPELINES_PRIMARY_OFFSET = 3,
 			ENQUEUE_OUT_OF_RANGE_PARENT_PIPELINES = 4,
 			ENQUEUE_SHADER_MODULE_SECONDARY_OFFSET = 5,
@@ -1982,946 +4215,2252 @@ struct ThreadedReplayer : StateCreatorInterface
 			PASS_COUNT = 7
 		};
 
-		auto outside_range_hashes = make_shared<unordered_set<Hash>>();
+		auto outside_range_hashes = make_shared<unordered_set<Hash>>();
+
+		unsigned memory_index = 0;
+		unsigned iteration = 0;
+
+		// This makes sure that we interleave execution of N iterations. Essentially, we get an execution order:
+		// - Pass 0, chunk 0 (context 0)
+		// - Pass 0, chunk 1 (context 1)
+		// - Pass 1, chunk 0 (context 0)
+		// - Pass 1, chunk 1 (context 1)
+		// - ...
+		// - Pass 6, chunk 0 (reclaim memory for context 0)
+		// - Pass 6, chunk 1 (reclaim memory for context 1)
+		// - Pass 7, sync point
+		// - Pass 0, chunk 2 (context 0)
+		// - Pass 1, chunk 3 (context 1)
+
+		const auto get_order_index = [&](unsigned pass) -> unsigned {
+			return (iteration / num_pipeline_memory_contexts) * PASS_COUNT * num_pipeline_memory_contexts +
+			       pass * num_pipeline_memory_contexts +
+			       memory_index;
+		};
+
+		for (unsigned hash_offset = 0; hash_offset < hashes.size(); hash_offset += NUM_PIPELINES_PER_CONTEXT, iteration++)
+		{
+			unsigned left_to_submit = hashes.size() - hash_offset;
+			unsigned to_submit = left_to_submit < NUM_PIPELINES_PER_CONTEXT ? left_to_submit : NUM_PIPELINES_PER_CONTEXT;
+
+			// State which is used between pipeline stages.
+			auto derived = make_shared<vector<DerivedInfo>>();
+
+			// Submit pipelines to be parsed.
+			work.push_back({ get_order_index(PARSE_ENQUEUE_OFFSET),
+			                 [this, &hashes, &pipelines, deferred, memory_index, to_submit, hash_offset]() {
+				                 // Drain old allocators.
+				                 sync_worker_memory_context(memory_index);
+				                 // Reset per memory-context allocators.
+				                 reset_memory_context_allocators(memory_index);
+
+				                 // The contexts after us still hold chunks from the previous round, which are fully enqueued.
+				                 // If memory is tight, drain and release them now rather than when they come up for reuse,
+				                 // which effectively reduces how many contexts are in flight.
+				                 if (memory_index + 1 < num_pipeline_memory_contexts && system_memory_is_under_pressure())
+				                 {
+					                 memory_pressure_drain_count++;
+					                 for (unsigned i = memory_index + 1; i < num_pipeline_memory_contexts; i++)
+					                 {
+						                 sync_worker_memory_context(i);
+						                 reset_memory_context_allocators(i);
+					                 }
+				                 }
+
+				                 // Read ahead of the parser by one chunk, so disk I/O for the next chunk overlaps
+				                 // with parsing and compiling this one.
+				                 auto tag = DerivedInfo::get_tag();
+				                 if (hash_offset == 0)
+					                 prefetch_database_entries(tag, hashes.data(), to_submit);
+				                 if (hash_offset + to_submit < hashes.size())
+				                 {
+					                 prefetch_database_entries(tag, hashes.data() + hash_offset + to_submit,
+					                                           std::min<size_t>(NUM_PIPELINES_PER_CONTEXT,
+					                                                            hashes.size() - (hash_offset + to_submit)));
+				                 }
+
+				                 deferred[memory_index].resize(to_submit);
+				                 for (unsigned index = hash_offset; index < hash_offset + to_submit; index++)
+				                 {
+					                 if (is_cached_blob(tag, hashes[index]))
+					                 {
+						                 // Do not do anything with this pipeline.
+						                 // Need to check here which is not optimal, since we need to maintain a stable pipeline index
+						                 // for the robust replayer mechanism.
+						                 deferred[memory_index][index - hash_offset] = {};
+						                 if (opts.control_block)
+						                 {
+							                 if (tag == RESOURCE_GRAPHICS_PIPELINE)
+							                 {
+								                 opts.control_block->total_graphics.fetch_add(1, std::memory_order_relaxed);
+								                 opts.control_block->cached_graphics.fetch_add(1, std::memory_order_relaxed);
+							                 }
+							                 else if (tag == RESOURCE_COMPUTE_PIPELINE)
+							                 {
+								                 opts.control_block->total_compute.fetch_add(1, std::memory_order_relaxed);
+								                 opts.control_block->cached_compute.fetch_add(1, std::memory_order_relaxed);
+							                 }
+						                 }
+					                 }
+					                 else if (is_unsupported_blob(tag, hashes[index]))
+					                 {
+						                 // An earlier run found this pipeline unsupported on this device, no need to parse it again.
+						                 deferred[memory_index][index - hash_offset] = {};
+						                 feature_filter_memo_hits.fetch_add(1, std::memory_order_relaxed);
+						                 if (opts.control_block)
+						                 {
+							                 if (tag == RESOURCE_GRAPHICS_PIPELINE)
+							                 {
+								                 opts.control_block->total_graphics.fetch_add(1, std::memory_order_relaxed);
+								                 opts.control_block->skipped_graphics.fetch_add(1, std::memory_order_relaxed);
+							                 }
+							                 else if (tag == RESOURCE_COMPUTE_PIPELINE)
+							                 {
+								                 opts.control_block->total_compute.fetch_add(1, std::memory_order_relaxed);
+								                 opts.control_block->skipped_compute.fetch_add(1, std::memory_order_relaxed);
+							                 }
+						                 }
+					                 }
+					                 else if (pipelines.count(hashes[index]) == 0)
+					                 {
+						                 ThreadedReplayer::PipelineWorkItem work_item;
+						                 work_item.hash = hashes[index];
+						                 work_item.tag = DerivedInfo::get_tag();
+						                 work_item.parse_only = true;
+						                 work_item.memory_context_index = memory_index;
+						                 work_item.index = index - hash_offset;
+
+						                 if (opts.control_block)
+						                 {
+							                 if (tag == RESOURCE_GRAPHICS_PIPELINE)
+								                 opts.control_block->total_graphics.fetch_add(1, std::memory_order_relaxed);
+							                 else if (tag == RESOURCE_COMPUTE_PIPELINE)
+								                 opts.control_block->total_compute.fetch_add(1, std::memory_order_relaxed);
+						                 }
+
+						                 enqueue_work_item(work_item);
+					                 }
+					                 else
+					                 {
+						                 // This pipeline has already been processed before in order to resolve parent pipelines.
+						                 // Don't do anything with it this iteration since it has already been compiled.
+						                 deferred[memory_index][index - hash_offset] = {};
+					                 }
+				                 }
+			                 }});
+
+			if (memory_index == 0)
+			{
+				work.push_back({ get_order_index(MAINTAIN_SHADER_MODULE_LRU_CACHE),
+				                 [this]() {
+					                 // Now all worker threads are drained for any work which needs shader modules,
+					                 // so we can maintain the shader module LRU cache while we're parsing new pipelines in parallel.
+					                 auto maintain_start_time = chrono::steady_clock::now();
+					                 uint32_t evicted_count = shader_module_evicted_count.load(std::memory_order_relaxed);
+					                 shader_modules.prune_cache([this](Hash hash, VkShaderModule module) {
+						                 assert(enqueued_shader_modules.count((VkShaderModule) hash) != 0);
+						                 //LOGI("Removing shader module %016llx.\n", static_cast<unsigned long long>(hash));
+						                 enqueued_shader_modules.erase((VkShaderModule) hash);
+						                 destroy_shader_module(module);
+
+						                 shader_module_evicted_count.fetch_add(1, std::memory_order_relaxed);
+					                 });
+
+					                 if (use_graphics_pipeline_library)
+						                 maintain_graphics_library_cache(evicted_count != shader_module_evicted_count.load(std::memory_order_relaxed));
+
+					                 record_trace_event("maintain_shader_module_cache", 0, ~0u, maintain_start_time, chrono::steady_clock::now());
+
+					                 // Need to forget that we have seen an object before so we can replay the same object multiple times.
+					                 for (auto &per_thread : per_thread_data)
+						                 if (per_thread.per_thread_replayers)
+							                 per_thread.per_thread_replayers[SHADER_MODULE_MEMORY_CONTEXT].forget_handle_references();
+				                 }});
+			}
+
+			work.push_back({ get_order_index(ENQUEUE_SHADER_MODULES_PRIMARY_OFFSET),
+			                 [this, derived, deferred, memory_index]() {
+				                 // Make sure all parsing of pipelines is complete for this memory context.
+				                 sync_worker_memory_context(memory_index);
+
+				                 // Enqueue creation of all shader modules which are referenced by the pipelines.
+				                 vector<Hash> prefetch;
+				                 for (auto &item : deferred[memory_index])
+					                 if (item.info)
+						                 add_shader_module_prefetch(prefetch, item.info);
+				                 prefetch_database_entries(RESOURCE_SHADER_MODULE, prefetch.data(), prefetch.size());
+#ifdef FOSSILIZE_REPLAYER_SPIRV_VAL
+				                 queue_spirv_validation(prefetch);
+#endif
+
+				                 for (auto &item : deferred[memory_index])
+					                 if (item.info)
+						                 enqueue_shader_modules(item.info);
+
+				                 // There are two primary kinds of pipelines, derived and non-derived. We split compilation in two here.
+				                 // Non-derived pipelines have no dependencies on other pipelines, so we can go ahead,
+				                 // and we force that parent pipeline candidates cannot also be derived, which simplifies a lot of things.
+				                 // While decompressing modules, we can sort the pipeline infos here in parallel.
+				                 sort_deferred_derived_pipelines(*derived, deferred[memory_index]);
+			                 }});
+
+			work.push_back({ get_order_index(RESOLVE_SHADER_MODULE_AND_ENQUEUE_PIPELINES_PRIMARY_OFFSET),
+			                 [this, derived, deferred, memory_index, hash_offset, start_index]() {
+				                 // Make sure all VkShaderModules have been queued and completed.
+				                 // We reserve a special memory context for all shader modules since other memory indices
+				                 // might queue up shader module work which we need in our memory index.
+				                 // Remap VkShaderModule references from hashes to real handles and enqueue all non-derived pipelines for work.
+				                 sync_worker_memory_context(SHADER_MODULE_MEMORY_CONTEXT);
+
+				                 for (auto &item : deferred[memory_index])
+				                 {
+					                 if (item.info)
+					                 {
+						                 resolve_shader_modules(item.info);
+						                 enqueue_pipeline(item.hash, item.info, item.pipeline,
+						                                  item.index + hash_offset + start_index, memory_index);
+					                 }
+				                 }
+			                 }});
+
+			work.push_back({ get_order_index(ENQUEUE_OUT_OF_RANGE_PARENT_PIPELINES),
+			                 [this, &pipelines, derived, outside_range_hashes, memory_index]() {
+				                 // Parent pipelines from the previous round may still be compiling,
+				                 // their create infos live in the parent memory context until they are done.
+				                 // Once a round, wait for them before we parse new parents into it.
+				                 if (memory_index == 0)
+				                 {
+					                 sync_worker_memory_context(PARENT_PIPELINE_MEMORY_CONTEXT);
+					                 for (auto &per_thread : per_thread_data)
+						                 if (per_thread.per_thread_replayers)
+							                 per_thread.per_thread_replayers[PARENT_PIPELINE_MEMORY_CONTEXT].get_allocator().reset();
+				                 }
+
+				                 // Figure out which of the parent pipelines we need.
+				                 for (auto &d : *derived)
+				                 {
+					                 if (!d.info)
+						                 continue;
+					                 Hash h = (Hash)d.info->basePipelineHandle;
+
+					                 // pipelines will have an entry if we called enqueue_pipeline() already for this hash,
+					                 // it's not necessarily complete yet!
+					                 bool is_inside_range = pipelines.count(h) != 0;
+
+					                 if (!is_inside_range)
+					                 {
+						                 // We have not seen this parent pipeline before.
+						                 // Make sure this auxillary entry has been parsed and is not seen before.
+						                 if (!outside_range_hashes->count(h))
+						                 {
+							                 PipelineWorkItem work_item;
+							                 work_item.index = d.index;
+							                 work_item.hash = h;
+							                 work_item.parse_only = true;
+							                 work_item.force_outside_range = true;
+							                 work_item.memory_context_index = PARENT_PIPELINE_MEMORY_CONTEXT;
+							                 work_item.tag = DerivedInfo::get_tag();
+							                 outside_range_hashes->insert(h);
+							                 enqueue_work_item(work_item);
+						                 }
+					                 }
+				                 }
+			                 }});
+
+			if (memory_index == 0)
+			{
+				// This is a join-like operation. We need to wait for all parent pipelines and all shader modules to have completed.
+				work.push_back({get_order_index(ENQUEUE_SHADER_MODULE_SECONDARY_OFFSET),
+				                [this, &parents, hash_offset, start_index]()
+				                {
+					                // Wait until all parent pipelines have been parsed.
+					                sync_worker_memory_context(PARENT_PIPELINE_MEMORY_CONTEXT);
+
+					                // Queue up all shader modules if somehow the shader modules used by parent pipelines differ from children ...
+					                for (auto &parent : parents)
+					                {
+						                // If we enqueued something here, we have to wait for shader handles to resolve.
+						                if (parent.second.info)
+							                enqueue_shader_modules(parent.second.info);
+					                }
+
+					                if (opts.control_block)
+					                {
+						                auto tag = DerivedInfo::get_tag();
+						                if (tag == RESOURCE_GRAPHICS_PIPELINE)
+							                opts.control_block->total_graphics.fetch_add(parents.size(),
+							                                                             std::memory_order_relaxed);
+						                else if (tag == RESOURCE_COMPUTE_PIPELINE)
+							                opts.control_block->total_compute.fetch_add(parents.size(),
+							                                                            std::memory_order_relaxed);
+					                }
+
+					                sync_worker_memory_context(SHADER_MODULE_MEMORY_CONTEXT);
+					                // The shader module memory context recycles itself.
+
+					                for (auto &parent : parents)
+					                {
+						                if (parent.second.info)
+						                {
+							                resolve_shader_modules(parent.second.info);
+							                assert((parent.second.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) ==
+							                       0);
+							                enqueue_pipeline(parent.second.hash, parent.second.info,
+							                                 parent.second.pipeline,
+							                                 parent.second.index + hash_offset + start_index,
+							                                 PARENT_PIPELINE_MEMORY_CONTEXT);
+						                }
+					                }
+
+					                parents.clear();
+				                }});
+			}
+
+			work.push_back({ get_order_index(ENQUEUE_DERIVED_PIPELINES_OFFSET),
+			                 [this, &pipelines, derived, memory_index, hash_offset, start_index]() {
+				                 // Go over all pipelines. If there are no further dependencies to resolve, we can go ahead and queue them up.
+				                 // If an entry exists in pipelines, we have queued up that hash earlier, but it might not be done compiling yet.
+				                 auto itr = unstable_remove_if(begin(*derived), end(*derived), [&](const DerivedInfo &info) -> bool {
+					                 if (info.info)
+					                 {
+						                 Hash hash = (Hash)info.info->basePipelineHandle;
+						                 return pipelines.count(hash) != 0;
+					                 }
+					                 else
+						                 return false;
+				                 });
+
+				                 // All parents have been enqueued at this point, but they might not be done compiling.
+				                 // Derived pipelines are handed to the workers as soon as their parent is done,
+				                 // so there is no need to wait for all parents here.
+				                 for (auto i = itr; i != end(*derived); ++i)
+				                 {
+					                 if (i->info)
+					                 {
+						                 resolve_shader_modules(i->info);
+						                 enqueue_pipeline(i->hash, i->info, i->pipeline,
+						                                  i->index + hash_offset + start_index, memory_index,
+						                                  (Hash) i->info->basePipelineHandle);
+					                 }
+				                 }
+
+				                 // It might be possible that we couldn't resolve some dependencies, log this.
+				                 if (itr != begin(*derived))
+				                 {
+					                 auto skipped_count = unsigned(itr - begin(*derived));
+					                 LOGW("%u pipelines were not compiled because parent pipelines do not exist.\n", skipped_count);
+
+					                 if (opts.control_block)
+					                 {
+						                 auto tag = DerivedInfo::get_tag();
+						                 if (tag == RESOURCE_GRAPHICS_PIPELINE)
+							                 opts.control_block->skipped_graphics.fetch_add(skipped_count, std::memory_order_relaxed);
+						                 else if (tag == RESOURCE_COMPUTE_PIPELINE)
+							                 opts.control_block->skipped_compute.fetch_add(skipped_count, std::memory_order_relaxed);
+					                 }
+				                 }
+			                 }});
+
+			memory_index = (memory_index + 1) % num_pipeline_memory_contexts;
+		}
+	}
+
+	void sync_threads() override
+	{
+		sync_worker_threads();
+	}
+
+	// Support ignoring shader module which are known to cause crashes.
+	void mask_shader_module(Hash hash)
+	{
+		masked_shader_modules.insert(hash);
+	}
+
+	const vector<thread> &get_threads() const
+	{
+		return thread_pool;
+	}
+
+	void emergency_teardown()
+	{
+#ifdef SIMULATE_UNSTABLE_DRIVER
+		spurious_deadlock();
+#endif
+		flush_pipeline_cache();
+		flush_validation_cache();
+		if (validation_whitelist_db)
+			validation_whitelist_db->flush();
+		if (validation_blacklist_db)
+			validation_blacklist_db->flush();
+		// The stats thread may be the one which crashed, don't wait for it.
+		if (pipeline_stats_db && pipeline_stats_db_mutex.try_lock())
+		{
+			pipeline_stats_db->flush();
+			pipeline_stats_db_mutex.unlock();
+		}
+		device.reset();
+	}
+
+	Options opts;
+
+	// Samplers, layouts and render passes may be created from several threads at startup,
+	// see replay_main_thread_objects_threaded(), or by the workers with --lazy-trivial-objects.
+	// Lookup and insertion while replaying need the lock.
+	std::mutex trivial_object_lock;
+	std::unordered_map<Hash, VkSampler> samplers;
+	std::unordered_map<Hash, VkDescriptorSetLayout> layouts;
+	std::unordered_map<Hash, VkPipelineLayout> pipeline_layouts;
+
+	// Shader modules are inserted by worker threads as they are created, without taking internal_enqueue_mutex.
+	ShardedObjectCache<VkShaderModule> shader_modules;
+
+	// Pre-rasterization and fragment shader libraries, shared between pipelines when replaying with --graphics-pipeline-library.
+	bool use_graphics_pipeline_library = false;
+	// Shader module handles are InlineShaderModule pointers, see --inline-shader-modules.
+	bool use_inline_shader_modules = false;
+	// Pipelines are first created with VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT, see --probe-pipeline-cache.
+	bool use_pipeline_cache_probe = false;
+	std::mutex graphics_library_lock;
+	ObjectCache<VkPipeline> graphics_libraries;
+
+	std::unordered_map<Hash, VkRenderPass> render_passes;
+	std::unordered_map<Hash, VkPipeline> compute_pipelines;
+	std::unordered_map<Hash, VkPipeline> graphics_pipelines;
+	std::unordered_set<Hash> masked_shader_modules;
+	std::unordered_map<VkShaderModule, Hash> shader_module_to_hash;
+	std::unordered_set<VkShaderModule> enqueued_shader_modules;
+	VkPipelineCache disk_pipeline_cache = VK_NULL_HANDLE;
+	VkValidationCacheEXT validation_cache = VK_NULL_HANDLE;
+
+	// VALVE: multi-threaded work queue for replayer
+
+	// Work is only enqueued from the main thread. It is handed to the workers in batches,
+	// spread round-robin over per-worker queues. Workers which run dry steal from the others.
+	// All queues are drained front first, so work still starts roughly in the order it was enqueued.
+	void enqueue_work_item(const PipelineWorkItem &item)
+	{
+		static const size_t WORK_ITEM_BATCH_SIZE = 64;
+		pending_work_items.push_back(item);
+		if (pending_work_items.size() >= WORK_ITEM_BATCH_SIZE)
+			flush_work_items();
+	}
+
+	void flush_work_items()
+	{
+		if (pending_work_items.empty())
+			return;
+
+		for (auto &item : pending_work_items)
+			queued_count[item.memory_context_index].fetch_add(1);
+
+		size_t count = pending_work_items.size();
+		available_work_items.fetch_add(unsigned(count));
+		for (unsigned i = 0; i < num_worker_threads && i < count; i++)
+		{
+			unsigned queue_index = (next_worker_queue + i) % num_worker_threads;
+			lock_guard<mutex> lock(worker_queues[queue_index].lock);
+			for (size_t j = i; j < count; j += num_worker_threads)
+				worker_queues[queue_index].items.push_back(pending_work_items[j]);
+		}
+		next_worker_queue = unsigned((next_worker_queue + count) % num_worker_threads);
+		pending_work_items.clear();
+
+		if (sleeping_workers.load() != 0)
+		{
+			lock_guard<mutex> lock(worker_wait_mutex);
+			work_available_condition.notify_all();
+		}
+	}
+
+	bool pop_work_item(unsigned queue_index, PipelineWorkItem &item)
+	{
+		for (unsigned i = 0; i < num_worker_threads; i++)
+		{
+			auto &queue = worker_queues[(queue_index + i) % num_worker_threads];
+			lock_guard<mutex> lock(queue.lock);
+			if (!queue.items.empty())
+			{
+				item = queue.items.front();
+				queue.items.pop_front();
+				available_work_items.fetch_sub(1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Takes more creation work items matching the first one in batch from the front of our own queue.
+	// We don't steal here, other workers are better off compiling those themselves.
+	void pop_compatible_work_items(unsigned queue_index, vector<PipelineWorkItem> &batch, size_t max_count)
+	{
+		auto &queue = worker_queues[queue_index];
+		const auto &first = batch.front();
+		lock_guard<mutex> lock(queue.lock);
+
+		while (batch.size() < max_count && !queue.items.empty())
+		{
+			auto &item = queue.items.front();
+			if (item.parse_only || item.tag != first.tag || item.memory_context_index != first.memory_context_index)
+				break;
+
+			batch.push_back(item);
+			queue.items.pop_front();
+			available_work_items.fetch_sub(1);
+		}
+	}
+
+	unsigned num_worker_threads = 0;
+	unsigned loop_count = 0;
+
+	struct WorkerQueue
+	{
+		std::mutex lock;
+		std::deque<PipelineWorkItem> items;
+	};
+
+	std::unique_ptr<WorkerQueue[]> worker_queues;
+	std::vector<PipelineWorkItem> pending_work_items;
+	unsigned next_worker_queue = 0;
+	std::atomic<unsigned> available_work_items;
+	std::atomic<unsigned> sleeping_workers;
+
+	std::atomic<unsigned> queued_count[NUM_MEMORY_CONTEXTS];
+	std::atomic<unsigned> completed_count[NUM_MEMORY_CONTEXTS];
+	std::atomic<bool> context_waiters[NUM_MEMORY_CONTEXTS];
+	unsigned thread_initialized_count = 0;
+	// Only guards sleeping and waking up, the work itself is in worker_queues.
+	std::mutex worker_wait_mutex;
+	std::condition_variable work_available_condition;
+	std::condition_variable work_done_condition[NUM_MEMORY_CONTEXTS];
+
+	std::vector<std::thread> thread_pool;
+	std::vector<PerThreadData> per_thread_data;
+	std::mutex internal_enqueue_mutex;
+
+	struct PipelineStatsWork
+	{
+		ResourceTag tag;
+		Hash hash;
+		VkPipeline pipeline;
+		uint64_t compile_time_ns;
+	};
+	enum { MAX_PENDING_PIPELINE_STATS = 256 };
+	std::thread pipeline_stats_thread;
+	std::mutex pipeline_stats_queue_mutex;
+	std::condition_variable pipeline_stats_work_condition;
+	std::condition_variable pipeline_stats_space_condition;
+	std::deque<PipelineStatsWork> pipeline_stats_queue;
+	bool pipeline_stats_thread_done = false;
+
+	enum { WORKER_GOVERNOR_INTERVAL_MS = 500 };
+	std::thread worker_governor_thread;
+	std::mutex worker_governor_mutex;
+	std::condition_variable worker_governor_condition;
+	bool worker_governor_thread_done = false;
+	std::atomic<unsigned> active_worker_limit;
+	unsigned min_active_worker_limit = 0;
+
+#ifdef FOSSILIZE_REPLAYER_SPIRV_VAL
+	// A worker which validates a module the pool has not gotten to yet commits a failure itself.
+	enum class SpirvValidationState : uint8_t { Pending, Running, Passed, Failed };
+	enum { SPIRV_VALIDATION_COMMIT_BATCH = 64 };
+	std::vector<std::thread> spirv_validation_threads;
+	std::mutex spirv_validation_lock;
+	std::condition_variable spirv_validation_condition;
+	std::unordered_map<Hash, SpirvValidationState> spirv_validation_states;
+	std::deque<Hash> spirv_validation_queue;
+	std::vector<Hash> spirv_validation_passed;
+	std::vector<Hash> spirv_validation_failed;
+	bool spirv_validation_thread_done = false;
+	unsigned spirv_validation_ahead_count = 0;
+	unsigned spirv_validation_inline_count = 0;
+	unsigned spirv_validation_inline_waits = 0;
+#endif
+
+	std::unique_ptr<DatabaseInterface> pipeline_binary_db;
+	std::mutex pipeline_binary_mutex;
+	std::unique_ptr<DatabaseInterface> pipeline_stats_db;
+	std::mutex pipeline_stats_db_mutex;
+
+	std::mutex validation_db_mutex;
+	std::unique_ptr<DatabaseInterface> validation_whitelist_db;
+	std::unique_ptr<DatabaseInterface> validation_blacklist_db;
+	std::unordered_set<Hash> implicit_whitelist[RESOURCE_COUNT];
+	std::vector<DatabaseHashView> implicit_whitelist_views[RESOURCE_COUNT];
+
+	std::mutex replayer_cache_mutex;
+	std::unique_ptr<DatabaseInterface> replayer_cache_db;
+	// Written by resource_is_supported(), read back by the next run on a device with the same feature fingerprint.
+	std::unique_ptr<DatabaseInterface> feature_filter_memo_db;
+	std::atomic<uint32_t> feature_filter_memo_hits;
+
+	// Summed up bind counts from RESOURCE_PIPELINE_USAGE entries, if prioritize_hot_pipelines is set.
+	std::unordered_map<Hash, uint64_t> pipeline_usage[RESOURCE_COUNT];
+	// Compile times from an earlier --enable-pipeline-stats run, if pipeline_cost_history_path is set.
+	std::unordered_map<Hash, uint64_t> pipeline_cost_history[RESOURCE_COUNT];
+
+	std::mutex hash_lock;
+	std::unordered_map<Hash, DeferredGraphicsInfo> graphics_parents;
+	std::unordered_map<Hash, DeferredComputeInfo> compute_parents;
+	std::vector<DeferredGraphicsInfo> deferred_graphics[NUM_MEMORY_CONTEXTS];
+	std::vector<DeferredComputeInfo> deferred_compute[NUM_MEMORY_CONTEXTS];
+
+	// Derived pipelines waiting for their parent pipeline, keyed by the parent hash.
+	struct DerivedDependencies
+	{
+		bool complete = false;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		std::vector<PipelineWorkItem> children;
+	};
+	std::mutex derived_dependency_lock;
+	std::unordered_map<Hash, DerivedDependencies> derived_dependencies[RESOURCE_COUNT];
+	VkPipelineCache memory_context_pipeline_cache[NUM_MEMORY_CONTEXTS] = {};
+	unsigned num_pipeline_memory_contexts = DEFAULT_PIPELINE_MEMORY_CONTEXTS;
+
+	// Only touched by the main thread.
+	uint64_t memory_context_stall_ns[NUM_MEMORY_CONTEXTS] = {};
+	unsigned memory_pressure_drain_count = 0;
+
+	// Feed statistics from the worker threads.
+	std::atomic<std::uint64_t> graphics_pipeline_ns;
+	std::atomic<std::uint64_t> compute_pipeline_ns;
+	std::atomic<std::uint64_t> shader_module_ns;
+	std::atomic<std::uint64_t> total_idle_ns;
+	std::atomic<std::uint64_t> thread_total_ns;
+	std::atomic<std::uint32_t> graphics_pipeline_count;
+	std::atomic<std::uint32_t> compute_pipeline_count;
+	std::atomic<std::uint32_t> shader_module_count;
+	std::atomic<std::uint32_t> shader_module_evicted_count;
+	std::atomic<std::uint32_t> pipeline_cache_hits;
+	std::atomic<std::uint32_t> pipeline_cache_misses;
+	std::atomic<std::uint32_t> graphics_library_count;
+	std::atomic<std::uint32_t> graphics_library_hits;
+	std::atomic<std::uint32_t> graphics_linked_pipeline_count;
+	std::atomic<std::uint32_t> pipeline_binary_count;
+	std::atomic<std::uint32_t> shared_module_cache_hits;
+	std::atomic<std::uint32_t> time_budget_skipped_count;
+
+	std::atomic<std::uint64_t> shader_module_total_size;
+	std::atomic<std::uint64_t> shader_module_total_compressed_size;
+
+	std::atomic<size_t> total_peak_memory;
+	std::atomic<size_t> scratch_block_allocations;
+	std::atomic<size_t> scratch_block_reuses;
+
+	// Tracked memory published through the control block, see publish_tracked_memory().
+	// Parse buffers are owned by the workers, so each one reports its own after every parse.
+	enum { TRACKED_MEMORY_PUBLISH_INTERVAL_MS = 100 };
+	std::unique_ptr<std::atomic<std::uint64_t>[]> worker_parse_buffer_bytes;
+	std::atomic<std::int64_t> last_tracked_memory_publish_ns;
+	// The archive index does not change after prepare(), so it is only measured once.
+	size_t database_index_bytes = 0;
+
+	std::atomic<bool> shutting_down;
+
+	unique_ptr<VulkanDevice> device;
+	bool device_was_init = false;
+	VulkanDevice::Options device_opts;
+
+	TimeBudget time_budget;
+
+	// Crash recovery.
+	bool robustness = false;
+
+	const StateReplayer *global_replayer = nullptr;
+	DatabaseInterface *global_database = nullptr;
+};
+
+static void on_validation_error(void *userdata)
+{
+	auto *replayer = static_cast<ThreadedReplayer *>(userdata);
+
+	auto &per_thread = replayer->get_per_thread_data();
+	per_thread.triggered_validation_error = true;
+
+	if (per_thread.current_graphics_pipeline)
+		replayer->blacklist_resource(RESOURCE_GRAPHICS_PIPELINE, per_thread.current_graphics_pipeline);
+	if (per_thread.current_compute_pipeline)
+		replayer->blacklist_resource(RESOURCE_COMPUTE_PIPELINE, per_thread.current_compute_pipeline);
+
+	if (replayer->opts.on_validation_error_callback)
+		replayer->opts.on_validation_error_callback(replayer);
+}
+
+static void print_help()
+{
+#ifndef NO_ROBUST_REPLAYER
+#ifdef _WIN32
+#define EXTRA_OPTIONS \
+	"\t[--slave-process]\n" \
+	"\t[--master-process]\n" \
+	"\t[--timeout <seconds>]\n" \
+	"\t[--progress]\n" \
+	"\t[--quiet-slave]\n" \
+	"\t[--shm-name <name>]\n\t[--shm-mutex-name <name>]\n" \
+	"\t[--metadata-name <name>]\n" \
+	"\t[--replayer-cache-metadata-name <name>]\n" \
+	"\t[--worker-slot <index>]\n" \
+	"\t[--job-memory-limit <value (MiB)>]\n"
+#else
+#define EXTRA_OPTIONS \
+	"\t[--slave-process]\n" \
+	"\t[--master-process]\n" \
+	"\t[--timeout <seconds>]\n" \
+	"\t[--progress]\n" \
+	"\t[--quiet-slave]\n" \
+	"\t[--shmem-fd <fd>]\n" \
+	"\t[--control-fd <fd>]\n" \
+	"\t[--progress-fd <fd>]\n"
+#endif
+#else
+#define EXTRA_OPTIONS ""
+#endif
+	LOGI("fossilize-replay\n"
+	     "\t[--help]\n"
+	     "\t[--device-index <index>]\n"
+	     "\t[--replay-device-index <index> (can be repeated, robust replayer only)]\n"
+	     "\t[--enable-validation]\n"
+	     "\t[--enable-pipeline-stats <path>]\n"
+	     "\t[--benchmark-report <path.json>]\n"
+	     "\t[--trace <path.json>]\n"
+	     "\t[--spirv-val]\n"
+	     "\t[--spirv-val-threads <count>]\n"
+	     "\t[--num-threads <count>]\n"
+	     "\t[--loop <count>]\n"
+	     "\t[--on-disk-pipeline-cache <path>]\n"
+	     "\t[--on-disk-validation-cache <path>]\n"
+	     "\t[--on-disk-validation-whitelist <path>]\n"
+	     "\t[--on-disk-validation-blacklist <path>]\n"
+	     "\t[--on-disk-replay-whitelist <path>]\n"
+	     "\t[--on-disk-replay-whitelist-mask <module/pipeline/hex>]\n"
+	     "\t[--pipeline-hash <hash>]\n"
+	     "\t[--graphics-pipeline-range <start> <end>]\n"
+	     "\t[--compute-pipeline-range <start> <end>]\n"
+	     "\t[--shader-cache-size <value (MiB)>]\n"
+	     "\t[--shader-cache-policy <lru|remaining-uses>]\n"
+	     "\t[--pipeline-batch-size <count>]\n"
+	     "\t[--shared-module-cache <value (MiB)>]\n"
+	     "\t[--spare-processes]\n"
+	     "\t[--cgroup <path>]\n"
+	     "\t[--cgroup-memory-high <value (MiB)>]\n"
+	     "\t[--cgroup-cpu-weight <weight>]\n"
+	     "\t[--shard <index> <count>]\n"
+	     "\t[--filter-application <hash>]\n"
+	     "\t[--time-budget <seconds>]\n"
+	     "\t[--merge-pipeline-caches <output> (positional arguments are the input caches)]\n"
+	     "\t[--memory-contexts <count>]\n"
+	     "\t[--graphics-pipeline-library]\n"
+	     "\t[--inline-shader-modules]\n"
+	     "\t[--probe-pipeline-cache]\n"
+	     "\t[--worker-cpus <cpu list, e.g. 0-15,32-47>]\n"
+	     "\t[--numa-local-workers]\n"
+	     "\t[--adaptive-workers]\n"
+	     "\t[--worker-priority <normal|low|idle>]\n"
+	     "\t[--ignore-derived-pipelines]\n"
+	     "\t[--prioritize-hot-pipelines]\n"
+	     "\t[--prioritize-expensive-pipelines]\n"
+	     "\t[--module-affinity-order]\n"
+	     "\t[--lazy-trivial-objects]\n"
+	     "\t[--scratch-huge-pages]\n"
+	     "\t[--pipeline-cost-history <stats.csv>]\n"
+	     "\t[--pipeline-binary-archive <path.foz>]\n"
+	     "\t[--log-memory]\n"
+	     "\t[--null-device]\n"
+	     "\t[--timeout-seconds]\n"
+	     "\t[--implicit-whitelist <index>]\n"
+	     "\t[--replayer-cache <path>]\n"
+	     EXTRA_OPTIONS
+	     "\t<Database>\n");
+}
+
+#ifndef NO_ROBUST_REPLAYER
+static void log_progress(const ExternalReplayer::Progress &progress)
+{
+	unsigned current_actions, total_actions;
+	ExternalReplayer::compute_condensed_progress(progress, current_actions, total_actions);
+
+	LOGI("=================\n");
+	LOGI(" Progress report:\n");
+	LOGI("   Overall %u / %u\n", current_actions, total_actions);
+	LOGI("   Parsed graphics %u / %u, failed %u, cached %u\n",
+	     progress.graphics.parsed, progress.graphics.total, progress.graphics.parsed_fail, progress.graphics.cached);
+	LOGI("   Parsed compute %u / %u, failed %u, cached %u\n",
+	     progress.compute.parsed, progress.compute.total, progress.compute.parsed_fail, progress.compute.cached);
+	LOGI("   Decompress modules %u / %u, skipped %u, failed validation %u, missing %u\n",
+	     progress.completed_modules, progress.total_modules, progress.banned_modules, progress.module_validation_failures, progress.missing_modules);
+	LOGI("   Compile graphics %u / %u, skipped %u, cached %u\n",
+	     progress.graphics.completed, progress.graphics.total, progress.graphics.skipped, progress.graphics.cached);
+	LOGI("   Compile compute %u / %u, skipped %u, cached %u\n",
+	     progress.compute.completed, progress.compute.total, progress.compute.skipped, progress.compute.cached);
+	LOGI("   Clean crashes %u\n", progress.clean_crashes);
+	LOGI("   Dirty crashes %u\n", progress.dirty_crashes);
+	LOGI("=================\n");
+}
+
+static void log_memory_usage(const std::vector<ExternalReplayer::ProcessStats> &usage,
+                             const ExternalReplayer::GlobalResourceUsage *global_stats)
+{
+	LOGI("=================\n");
+	LOGI(" Memory usage:\n");
+	unsigned index = 0;
+	for (auto &use : usage)
+	{
+		LOGI("   #%u: %5u MiB resident %5u MiB shared (%u MiB shared metadata).\n", index++,
+		     use.resident_mib, use.shared_mib, use.shared_metadata_mib);
+		if (use.scratch_allocator_kib || use.parse_buffer_kib || use.shader_module_cache_kib || use.database_index_kib)
+		{
+			LOGI("       tracked: %u KiB scratch, %u KiB parse buffers, %u KiB shader module cache, %u KiB archive index.\n",
+			     use.scratch_allocator_kib, use.parse_buffer_kib, use.shader_module_cache_kib, use.database_index_kib);
+		}
+	}
+
+	if (global_stats)
+	{
+		if (global_stats->dirty_pages_mib >= 0)
+			LOGI(" Dirty filesystem writes: %u MiB.\n", global_stats->dirty_pages_mib);
+		else
+			LOGI(" Dirty filesystem writes: N/A.\n");
+
+		if (global_stats->io_stall_percentage >= 0)
+			LOGI(" IO stall: %u%%.\n", global_stats->io_stall_percentage);
+		else
+			LOGI(" IO stall: N/A.\n");
+
+		LOGI(" Num running child processes: %u.\n", global_stats->num_running_processes);
+	}
+	LOGI("=================\n");
+}
+
+static void log_faulty_modules(ExternalReplayer &replayer)
+{
+	size_t count;
+	if (!replayer.get_faulty_spirv_modules(&count, nullptr))
+		return;
+	vector<Hash> hashes(count);
+	if (!replayer.get_faulty_spirv_modules(&count, hashes.data()))
+		return;
+
+	sort(begin(hashes), end(hashes));
+
+	for (auto &h : hashes)
+		LOGI("Detected faulty SPIR-V module: %016" PRIx64 "\n", h);
+}
+
+static void log_faulty_graphics(ExternalReplayer &replayer)
+{
+	size_t count;
+	if (!replayer.get_graphics_failed_validation(&count, nullptr))
+		return;
+	vector<Hash> hashes(count);
+	if (!replayer.get_graphics_failed_validation(&count, hashes.data()))
+		return;
+
+	sort(begin(hashes), end(hashes));
+
+	for (auto &h : hashes)
+	{
+		LOGI("Graphics pipeline failed validation: %016" PRIx64 "\n", h);
+
+		// Ad-hoc hack to test automatic pruning ideas ...
+		//printf("--skip-graphics %016llx ", static_cast<unsigned long long>(h));
+	}
+
+	vector<unsigned> indices;
+	if (!replayer.get_faulty_graphics_pipelines(&count, nullptr, nullptr))
+		return;
+	indices.resize(count);
+	hashes.resize(count);
+	if (!replayer.get_faulty_graphics_pipelines(&count, indices.data(), hashes.data()))
+		return;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		LOGI("Graphics pipeline crashed or hung: %016" PRIx64 ". Repro with: --graphics-pipeline-range %u %u\n",
+		     hashes[i], indices[i], indices[i] + 1);
+	}
+}
+
+static void log_faulty_compute(ExternalReplayer &replayer)
+{
+	size_t count;
+	if (!replayer.get_compute_failed_validation(&count, nullptr))
+		return;
+	vector<Hash> hashes(count);
+	if (!replayer.get_compute_failed_validation(&count, hashes.data()))
+		return;
+
+	sort(begin(hashes), end(hashes));
+
+	for (auto &h : hashes)
+	{
+		LOGI("Compute pipeline failed validation: %016" PRIx64 "\n", h);
+
+		// Ad-hoc hack to test automatic pruning ideas ...
+		//printf("--skip-compute %016llx ", static_cast<unsigned long long>(h));
+	}
+
+	vector<unsigned> indices;
+	if (!replayer.get_faulty_compute_pipelines(&count, nullptr, nullptr))
+		return;
+	indices.resize(count);
+	hashes.resize(count);
+	if (!replayer.get_faulty_compute_pipelines(&count, indices.data(), hashes.data()))
+		return;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		LOGI("Compute pipeline crashed or hung: %016" PRIx64 ". Repro with: --compute-pipeline-range %u %u\n",
+		     hashes[i], indices[i], indices[i] + 1);
+	}
+}
+
+static int run_progress_process(const VulkanDevice::Options &device_opts,
+                                const ThreadedReplayer::Options &replayer_opts,
+                                const vector<const char *> &databases,
+                                const char *whitelist, uint32_t whitelist_mask,
+                                int timeout, bool log_memory)
+{
+	ExternalReplayer::Options opts = {};
+	opts.on_disk_pipeline_cache = replayer_opts.on_disk_pipeline_cache_path.empty() ?
+	                              nullptr : replayer_opts.on_disk_pipeline_cache_path.c_str();
+	opts.on_disk_validation_cache = replayer_opts.on_disk_validation_cache_path.empty() ?
+	                                nullptr : replayer_opts.on_disk_validation_cache_path.c_str();
+	opts.on_disk_validation_whitelist = replayer_opts.on_disk_validation_whitelist_path.empty() ?
+	                                    nullptr : replayer_opts.on_disk_validation_whitelist_path.c_str();
+	opts.on_disk_validation_blacklist = replayer_opts.on_disk_validation_blacklist_path.empty() ?
+	                                    nullptr : replayer_opts.on_disk_validation_blacklist_path.c_str();
+	opts.pipeline_stats_path = replayer_opts.pipeline_stats_path.empty() ?
+	                           nullptr : replayer_opts.pipeline_stats_path.c_str();
+	opts.num_threads = replayer_opts.num_threads;
+	opts.quiet = true;
+	opts.databases = databases.data();
+	opts.num_databases = databases.size();
+	opts.external_replayer_path = nullptr;
+	opts.inherit_process_group = true;
+	opts.spirv_validate = replayer_opts.spirv_validate;
+	opts.device_index = device_opts.device_index;
+	opts.enable_validation = device_opts.enable_validation;
+	opts.ignore_derived_pipelines = replayer_opts.ignore_derived_pipelines;
+	opts.prioritize_hot_pipelines = replayer_opts.prioritize_hot_pipelines;
+	opts.prioritize_expensive_pipelines = replayer_opts.prioritize_expensive_pipelines;
+	opts.module_affinity_order = replayer_opts.module_affinity_order;
+	opts.lazy_trivial_objects = replayer_opts.lazy_trivial_objects;
+	opts.scratch_huge_pages = replayer_opts.scratch_huge_pages;
+	opts.graphics_pipeline_library = replayer_opts.graphics_pipeline_library;
+	opts.inline_shader_modules = replayer_opts.inline_shader_modules;
+	opts.probe_pipeline_cache = replayer_opts.probe_pipeline_cache;
+	opts.pipeline_batch_size = replayer_opts.pipeline_batch_size;
+	opts.shared_module_cache_mb = replayer_opts.shared_module_cache_mb;
+	opts.spare_processes = replayer_opts.spare_processes;
+	opts.cgroup_path = replayer_opts.cgroup_path.empty() ? nullptr : replayer_opts.cgroup_path.c_str();
+	opts.cgroup_memory_high_mb = replayer_opts.cgroup_memory_high_mb;
+	opts.cgroup_cpu_weight = replayer_opts.cgroup_cpu_weight;
+	opts.job_memory_limit_mb = replayer_opts.job_memory_limit_mb;
+	opts.shard_index = replayer_opts.shard_index;
+	opts.shard_count = replayer_opts.shard_count;
+	opts.filter_application_hash = replayer_opts.filter_application_hash;
+	opts.time_budget_seconds = replayer_opts.time_budget_seconds;
+	opts.pipeline_memory_contexts = replayer_opts.pipeline_memory_contexts;
+	opts.shader_cache_remaining_uses =
+			replayer_opts.shader_cache_policy == ObjectCacheEvictionPolicy::FewestRemainingUses;
+	opts.pipeline_cost_history_path = replayer_opts.pipeline_cost_history_path.empty() ?
+	                                  nullptr : replayer_opts.pipeline_cost_history_path.c_str();
+	opts.pipeline_binary_archive_path = replayer_opts.pipeline_binary_archive_path.empty() ?
+	                                    nullptr : replayer_opts.pipeline_binary_archive_path.c_str();
+	opts.benchmark_report_path = replayer_opts.benchmark_report_path.empty() ?
+	                             nullptr : replayer_opts.benchmark_report_path.c_str();
+	opts.trace_path = replayer_opts.trace_path.empty() ? nullptr : replayer_opts.trace_path.c_str();
+	opts.null_device = device_opts.null_device;
+	opts.start_graphics_index = replayer_opts.start_graphics_index;
+	opts.end_graphics_index = replayer_opts.end_graphics_index;
+	opts.start_compute_index = replayer_opts.start_compute_index;
+	opts.end_compute_index = replayer_opts.end_compute_index;
+	opts.use_pipeline_range =
+			(replayer_opts.start_graphics_index != 0) ||
+			(replayer_opts.end_graphics_index != ~0u) ||
+			(replayer_opts.start_compute_index != 0) ||
+			(replayer_opts.end_compute_index != ~0u);
+	opts.timeout_seconds = replayer_opts.timeout_seconds;
+	opts.implicit_whitelist_indices = replayer_opts.implicit_whitelist_database_indices.data();
+	opts.num_implicit_whitelist_indices = replayer_opts.implicit_whitelist_database_indices.size();
+	opts.replay_device_indices = replayer_opts.device_indices.data();
+	auto worker_cpus = format_cpu_list(replayer_opts.worker_cpus);
+	opts.worker_cpus = worker_cpus.empty() ? nullptr : worker_cpus.c_str();
+	opts.numa_local_workers = replayer_opts.numa_local_workers;
+	if (replayer_opts.worker_priority == WorkerPriority::Low)
+		opts.worker_priority = "low";
+	else if (replayer_opts.worker_priority == WorkerPriority::Idle)
+		opts.worker_priority = "idle";
+	opts.num_replay_device_indices = replayer_opts.device_indices.size();
+	opts.replayer_cache_path = replayer_opts.replayer_cache_path.empty() ?
+			nullptr : replayer_opts.replayer_cache_path.c_str();
+	opts.on_disk_replay_whitelist = whitelist;
+	opts.on_disk_replay_whitelist_mask = whitelist_mask;
+
+	ExternalReplayer replayer;
+	if (!replayer.start(opts))
+	{
+		LOGE("Failed to start external replayer.\n");
+		return EXIT_FAILURE;
+	}
 
-		unsigned memory_index = 0;
-		unsigned iteration = 0;
+	bool has_killed = false;
+	auto start_time = std::chrono::steady_clock::now();
 
-		// This makes sure that we interleave execution of N iterations. Essentially, we get an execution order:
-		// - Pass 0, chunk 0 (context 0)
-		// - Pass 0, chunk 1 (context 1)
-		// - Pass 1, chunk 0 (context 0)
-		// - Pass 1, chunk 1 (context 1)
-		// - ...
-		// - Pass 6, chunk 0 (reclaim memory for context 0)
-		// - Pass 6, chunk 1 (reclaim memory for context 1)
-		// - Pass 7, sync point
-		// - Pass 0, chunk 2 (context 0)
-		// - Pass 1, chunk 3 (context 1)
+	for (;;)
+	{
+		if (!has_killed && timeout > 0)
+		{
+			auto current_time = std::chrono::steady_clock::now();
+			auto delta = current_time - start_time;
+			if (std::chrono::duration_cast<std::chrono::seconds>(delta).count() >= timeout)
+			{
+				LOGE("Killing process due to timeout.\n");
+				replayer.kill();
+				has_killed = true;
+			}
+		}
 
-		const auto get_order_index = [&](unsigned pass) -> unsigned {
-			return (iteration / NUM_PIPELINE_MEMORY_CONTEXTS) * PASS_COUNT * NUM_PIPELINE_MEMORY_CONTEXTS +
-			       pass * NUM_PIPELINE_MEMORY_CONTEXTS +
-			       memory_index;
-		};
+		// Wakes up early if a child reports a crash or a faulty module.
+		replayer.wait_for_messages(100);
+		ExternalReplayer::Progress progress = {};
 
-		for (unsigned hash_offset = 0; hash_offset < hashes.size(); hash_offset += NUM_PIPELINES_PER_CONTEXT, iteration++)
+		if (replayer.is_process_complete(nullptr))
 		{
-			unsigned left_to_submit = hashes.size() - hash_offset;
-			unsigned to_submit = left_to_submit < NUM_PIPELINES_PER_CONTEXT ? left_to_submit : NUM_PIPELINES_PER_CONTEXT;
+			auto result = replayer.poll_progress(progress);
+			if (result != ExternalReplayer::PollResult::ResultNotReady)
+				log_progress(progress);
+			log_faulty_modules(replayer);
+			log_faulty_graphics(replayer);
+			log_faulty_compute(replayer);
+			return replayer.wait();
+		}
 
-			// State which is used between pipeline stages.
-			auto derived = make_shared<vector<DerivedInfo>>();
+		auto result = replayer.poll_progress(progress);
 
-			// Submit pipelines to be parsed.
-			work.push_back({ get_order_index(PARSE_ENQUEUE_OFFSET),
-			                 [this, &hashes, &pipelines, deferred, memory_index, to_submit, hash_offset]() {
-				                 // Drain old allocators.
-				                 sync_worker_memory_context(memory_index);
-				                 // Reset per memory-context allocators.
-				                 for (auto &data : per_thread_data)
-					                 if (data.per_thread_replayers)
-						                 data.per_thread_replayers[memory_index].get_allocator().reset();
+		switch (result)
+		{
+		case ExternalReplayer::PollResult::Error:
+			return EXIT_FAILURE;
 
-				                 deferred[memory_index].resize(to_submit);
-				                 for (unsigned index = hash_offset; index < hash_offset + to_submit; index++)
-				                 {
-					                 auto tag = DerivedInfo::get_tag();
-					                 if (cached_blobs[tag].count(hashes[index]) != 0)
-					                 {
-						                 // Do not do anything with this pipeline.
-						                 // Need to check here which is not optimal, since we need to maintain a stable pipeline index
-						                 // for the robust replayer mechanism.
-						                 // TODO: Consider pre-parsing various databases and emit a SHM block for child replayer processes.
-						                 deferred[memory_index][index - hash_offset] = {};
-						                 if (opts.control_block)
-						                 {
-							                 if (tag == RESOURCE_GRAPHICS_PIPELINE)
-							                 {
-								                 opts.control_block->total_graphics.fetch_add(1, std::memory_order_relaxed);
-								                 opts.control_block->cached_graphics.fetch_add(1, std::memory_order_relaxed);
-							                 }
-							                 else if (tag == RESOURCE_COMPUTE_PIPELINE)
-							                 {
-								                 opts.control_block->total_compute.fetch_add(1, std::memory_order_relaxed);
-								                 opts.control_block->cached_compute.fetch_add(1, std::memory_order_relaxed);
-							                 }
-						                 }
-					                 }
-					                 else if (pipelines.count(hashes[index]) == 0)
-					                 {
-						                 ThreadedReplayer::PipelineWorkItem work_item;
-						                 work_item.hash = hashes[index];
-						                 work_item.tag = DerivedInfo::get_tag();
-						                 work_item.parse_only = true;
-						                 work_item.memory_context_index = memory_index;
-						                 work_item.index = index - hash_offset;
+		case ExternalReplayer::PollResult::ResultNotReady:
+			break;
 
-						                 if (opts.control_block)
-						                 {
-							                 if (tag == RESOURCE_GRAPHICS_PIPELINE)
-								                 opts.control_block->total_graphics.fetch_add(1, std::memory_order_relaxed);
-							                 else if (tag == RESOURCE_COMPUTE_PIPELINE)
-								                 opts.control_block->total_compute.fetch_add(1, std::memory_order_relaxed);
-						                 }
+		case ExternalReplayer::PollResult::Complete:
+		case ExternalReplayer::PollResult::Running:
+		{
+			log_progress(progress);
 
-						                 enqueue_work_item(work_item);
-					                 }
-					                 else
-					                 {
-						                 // This pipeline has already been processed before in order to resolve parent pipelines.
-						                 // Don't do anything with it this iteration since it has already been compiled.
-						                 deferred[memory_index][index - hash_offset] = {};
-					                 }
-				                 }
-			                 }});
+			if (log_memory)
+			{
+				uint32_t num_processes;
 
-			if (memory_index == 0)
+				if (replayer.poll_memory_usage(&num_processes, nullptr))
+				{
+					std::vector<ExternalReplayer::ProcessStats> usage(num_processes);
+					if (replayer.poll_memory_usage(&num_processes, usage.data()))
+					{
+						usage.resize(num_processes);
+						ExternalReplayer::GlobalResourceUsage global_stats = {};
+						bool got_global_stats = replayer.poll_global_resource_usage(global_stats);
+						log_memory_usage(usage, got_global_stats ? &global_stats : nullptr);
+					}
+				}
+			}
+
+			if (result == ExternalReplayer::PollResult::Complete)
 			{
-				work.push_back({ get_order_index(MAINTAIN_SHADER_MODULE_LRU_CACHE),
-				                 [this]() {
-					                 // Now all worker threads are drained for any work which needs shader modules,
-					                 // so we can maintain the shader module LRU cache while we're parsing new pipelines in parallel.
-					                 shader_modules.prune_cache([this](Hash hash, VkShaderModule module) {
-						                 assert(enqueued_shader_modules.count((VkShaderModule) hash) != 0);
-						                 //LOGI("Removing shader module %016llx.\n", static_cast<unsigned long long>(hash));
-						                 enqueued_shader_modules.erase((VkShaderModule) hash);
-						                 if (module != VK_NULL_HANDLE)
-							                 vkDestroyShaderModule(device->get_device(), module, nullptr);
+				log_faulty_modules(replayer);
+				log_faulty_graphics(replayer);
+				log_faulty_compute(replayer);
+				return replayer.wait();
+			}
+			break;
+		}
+		}
+	}
+}
 
-						                 shader_module_evicted_count.fetch_add(1, std::memory_order_relaxed);
-					                 });
+static void log_process_memory();
+#endif
+
+static bool parse_json_stats(const std::string &foz_path, rapidjson::Document &doc)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(foz_path.c_str(), DatabaseMode::ReadOnly));
+	if (!db)
+		return false;
+	if (!db->prepare())
+		return false;
+
+	static const ResourceTag stat_tags[] = {
+		RESOURCE_GRAPHICS_PIPELINE,
+		RESOURCE_COMPUTE_PIPELINE,
+	};
+
+	doc.SetArray();
+
+	std::vector<char> json_buffer;
+
+	for (auto &tag : stat_tags)
+	{
+		size_t num_hashes = 0;
+		if (!db->get_hash_list_for_resource_tag(tag, &num_hashes, nullptr))
+			return false;
+		std::vector<Hash> hashes(num_hashes);
+		if (!db->get_hash_list_for_resource_tag(tag, &num_hashes, hashes.data()))
+			return false;
+
+		for (auto &hash : hashes)
+		{
+			rapidjson::Document tmp_doc;
+			size_t json_size = 0;
+			if (!db->read_entry(tag, hash, &json_size, nullptr, 0))
+				continue;
+			json_buffer.resize(json_size);
+			if (!db->read_entry(tag, hash, &json_size, json_buffer.data(), 0))
+				continue;
+			json_buffer.push_back('\0');
+
+			tmp_doc.Parse(rapidjson::StringRef(json_buffer.data()));
+			if (tmp_doc.HasParseError())
+				continue;
+
+			rapidjson::Value v;
+			v.CopyFrom(tmp_doc, doc.GetAllocator());
+			doc.PushBack(v, doc.GetAllocator());
+		}
+	}
+
+	return true;
+}
+
+static void stats_to_csv(const std::string &stats_path, rapidjson::Document &doc)
+{
+	std::vector<std::string> header;
+	std::unordered_map<std::string, size_t> columns;
+	std::vector<std::map<size_t, std::string>> rows;
+
+	header.push_back("Database");
+	header.push_back("Pipeline type");
+	header.push_back("Pipeline hash");
+	header.push_back("Compile time (ns)");
+	header.push_back("Executable name");
+	header.push_back("Subgroup size");
+
+	for (auto itr = doc.Begin(); itr != doc.End(); itr++)
+	{
+		std::map<size_t, std::string> row;
+
+		auto &st = *itr;
+
+		row[0] = st["db_path"].GetString();
+		row[1] = st["pipeline_type"].GetString();
+		row[2] = st["pipeline"].GetString();
+		if (st.HasMember("compile_time_ns"))
+			row[3] = std::to_string(st["compile_time_ns"].GetUint64());
+
+		auto &execs = st["executables"];
+		for (auto e_itr = execs.Begin(); e_itr != execs.End(); e_itr++)
+		{
+			auto &exec = *e_itr;
+			row[4] = exec["executable_name"].GetString();
+			row[5] = std::to_string(exec["subgroup_size"].GetUint());
+			for (auto st_itr = exec["stats"].Begin(); st_itr != exec["stats"].End(); st_itr++)
+			{
+				auto &stat = *st_itr;
+				std::string key = stat["name"].GetString();
+				size_t insert_at;
+
+				auto col = columns.find(key);
+				if (col == columns.end())
+				{
+					insert_at = header.size();
+					columns[key] = insert_at;
+					header.push_back(key);
+				}
+				else
+				{
+					insert_at = col->second;
+				}
 
-					                 // Need to forget that we have seen an object before so we can replay the same object multiple times.
-					                 for (auto &per_thread : per_thread_data)
-						                 if (per_thread.per_thread_replayers)
-							                 per_thread.per_thread_replayers[SHADER_MODULE_MEMORY_CONTEXT].forget_handle_references();
-				                 }});
+				row[insert_at] = stat["value"].GetString();
 			}
 
-			work.push_back({ get_order_index(ENQUEUE_SHADER_MODULES_PRIMARY_OFFSET),
-			                 [this, derived, deferred, memory_index]() {
-				                 // Make sure all parsing of pipelines is complete for this memory context.
-				                 sync_worker_memory_context(memory_index);
+			rows.push_back(row);
+		}
+	}
 
-				                 // Enqueue creation of all shader modules which are referenced by the pipelines.
-				                 for (auto &item : deferred[memory_index])
-					                 if (item.info)
-						                 enqueue_shader_modules(item.info);
+	FILE *fp = fopen(stats_path.c_str(), "w");
+	if (!fp)
+		return;
 
-				                 // There are two primary kinds of pipelines, derived and non-derived. We split compilation in two here.
-				                 // Non-derived pipelines have no dependencies on other pipelines, so we can go ahead,
-				                 // and we force that parent pipeline candidates cannot also be derived, which simplifies a lot of things.
-				                 // While decompressing modules, we can sort the pipeline infos here in parallel.
-				                 sort_deferred_derived_pipelines(*derived, deferred[memory_index]);
-			                 }});
+	size_t colnumber = 0;
+	for (auto &h : header)
+		fprintf(fp, "%s%s", h.c_str(), ++colnumber < header.size() ? "," : "\n");
 
-			work.push_back({ get_order_index(RESOLVE_SHADER_MODULE_AND_ENQUEUE_PIPELINES_PRIMARY_OFFSET),
-			                 [this, derived, deferred, memory_index, hash_offset, start_index]() {
-				                 // Make sure all VkShaderModules have been queued and completed.
-				                 // We reserve a special memory context for all shader modules since other memory indices
-				                 // might queue up shader module work which we need in our memory index.
-				                 // Remap VkShaderModule references from hashes to real handles and enqueue all non-derived pipelines for work.
-				                 sync_worker_memory_context(SHADER_MODULE_MEMORY_CONTEXT);
+	for (auto &r : rows)
+	{
+		colnumber = 0;
+		for (size_t i = 0; i < header.size(); i++)
+		{
+			auto col = r.find(i);
+			fprintf(fp, "%s%s", col == r.end() ? "" : col->second.c_str(), ++colnumber < header.size() ? "," : "\n");
+		}
+	}
 
-				                 for (auto &item : deferred[memory_index])
-				                 {
-					                 if (item.info)
-					                 {
-						                 resolve_shader_modules(item.info);
-						                 enqueue_pipeline(item.hash, item.info, item.pipeline,
-						                                  item.index + hash_offset + start_index, memory_index);
-					                 }
-				                 }
-			                 }});
+	fclose(fp);
+}
 
-			work.push_back({ get_order_index(ENQUEUE_OUT_OF_RANGE_PARENT_PIPELINES),
-			                 [this, &pipelines, derived, outside_range_hashes]() {
-				                 // Figure out which of the parent pipelines we need.
-				                 for (auto &d : *derived)
-				                 {
-					                 if (!d.info)
-						                 continue;
-					                 Hash h = (Hash)d.info->basePipelineHandle;
+#ifndef NO_ROBUST_REPLAYER
+static void dump_stats(const std::string &stats_path, const std::vector<std::string> &foz_paths)
+{
+	rapidjson::Document doc;
+	doc.SetArray();
+	auto &alloc = doc.GetAllocator();
 
-					                 // pipelines will have an entry if we called enqueue_pipeline() already for this hash,
-					                 // it's not necessarily complete yet!
-					                 bool is_inside_range = pipelines.count(h) != 0;
+	for (auto &sp : foz_paths)
+	{
+		rapidjson::Document tmp_doc;
+		if (!parse_json_stats(sp, tmp_doc))
+			continue;
 
-					                 if (!is_inside_range)
-					                 {
-						                 // We have not seen this parent pipeline before.
-						                 // Make sure this auxillary entry has been parsed and is not seen before.
-						                 if (!outside_range_hashes->count(h))
-						                 {
-							                 PipelineWorkItem work_item;
-							                 work_item.index = d.index;
-							                 work_item.hash = h;
-							                 work_item.parse_only = true;
-							                 work_item.force_outside_range = true;
-							                 work_item.memory_context_index = PARENT_PIPELINE_MEMORY_CONTEXT;
-							                 work_item.tag = DerivedInfo::get_tag();
-							                 outside_range_hashes->insert(h);
-							                 enqueue_work_item(work_item);
-						                 }
-					                 }
-				                 }
-			                 }});
+		doc.Reserve(doc.Size() + tmp_doc.Size(), alloc);
+		for (auto itr = tmp_doc.Begin(); itr != tmp_doc.End(); itr++)
+		{
+			rapidjson::Value v;
+			v.CopyFrom(*itr, alloc);
+			doc.PushBack(v, alloc);
+		}
+		remove(sp.c_str());
+	}
 
-			if (memory_index == 0)
-			{
-				// This is a join-like operation. We need to wait for all parent pipelines and all shader modules to have completed.
-				work.push_back({get_order_index(ENQUEUE_SHADER_MODULE_SECONDARY_OFFSET),
-				                [this, &parents, hash_offset, start_index]()
-				                {
-					                // Wait until all parent pipelines have been parsed.
-					                sync_worker_memory_context(PARENT_PIPELINE_MEMORY_CONTEXT);
+	stats_to_csv(stats_path, doc);
+}
+#endif
 
-					                // Queue up all shader modules if somehow the shader modules used by parent pipelines differ from children ...
-					                for (auto &parent : parents)
-					                {
-						                // If we enqueued something here, we have to wait for shader handles to resolve.
-						                if (parent.second.info)
-							                enqueue_shader_modules(parent.second.info);
-					                }
+static void dump_stats(const std::string &stats_path)
+{
+	rapidjson::Document doc;
+	auto foz_path = stats_path + ".__tmp.foz";
 
-					                if (opts.control_block)
-					                {
-						                auto tag = DerivedInfo::get_tag();
-						                if (tag == RESOURCE_GRAPHICS_PIPELINE)
-							                opts.control_block->total_graphics.fetch_add(parents.size(),
-							                                                             std::memory_order_relaxed);
-						                else if (tag == RESOURCE_COMPUTE_PIPELINE)
-							                opts.control_block->total_compute.fetch_add(parents.size(),
-							                                                            std::memory_order_relaxed);
-					                }
+	if (!parse_json_stats(foz_path, doc))
+		return;
+	stats_to_csv(stats_path, doc);
+	remove(foz_path.c_str());
+}
 
-					                sync_worker_memory_context(SHADER_MODULE_MEMORY_CONTEXT);
-					                // The shader module memory context recycles itself.
+// The benchmark report and trace are built in two steps. Every replayer process appends its raw data to <path>.__tmp
+// (<path>.N.__tmp for child process N > 0), since a crashed child is restarted and continues where it left off.
+// Once replay is done, the process which owns the output folds these into a single file.
+static std::string get_process_output_tmp_path(const std::string &path)
+{
+	return path + ".__tmp";
+}
 
-					                for (auto &parent : parents)
-					                {
-						                if (parent.second.info)
-						                {
-							                resolve_shader_modules(parent.second.info);
-							                assert((parent.second.info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) ==
-							                       0);
-							                enqueue_pipeline(parent.second.hash, parent.second.info,
-							                                 parent.second.pipeline,
-							                                 parent.second.index + hash_offset + start_index,
-							                                 PARENT_PIPELINE_MEMORY_CONTEXT);
-						                }
-					                }
+static std::vector<std::string> reset_process_output_paths(const std::string &path, unsigned num_processes)
+{
+	std::vector<std::string> paths;
+	for (unsigned idx = 0; idx < num_processes; idx++)
+	{
+		auto tmp_path = path;
+		if (idx != 0)
+		{
+			tmp_path += ".";
+			tmp_path += std::to_string(idx);
+		}
+		paths.push_back(get_process_output_tmp_path(tmp_path));
+		remove(paths.back().c_str());
+	}
+	return paths;
+}
 
-					                parents.clear();
+static void append_benchmark_report_samples(const ThreadedReplayer &replayer)
+{
+	auto path = get_process_output_tmp_path(replayer.opts.benchmark_report_path);
+	FILE *file = fopen(path.c_str(), "a");
+	if (!file)
+	{
+		LOGE("Failed to open benchmark report samples %s for writing.\n", path.c_str());
+		return;
+	}
 
-					                // We might be pulling in a parent pipeline from another memory context next iteration,
-					                // so we need to wait for all normal memory contexts.
-					                for (unsigned i = 0; i < NUM_PIPELINE_MEMORY_CONTEXTS; i++)
-						                sync_worker_memory_context(i);
-				                }});
-			}
+	for (size_t i = 0; i < replayer.per_thread_data.size(); i++)
+	{
+		auto &per_thread = replayer.per_thread_data[i];
+		for (auto &sample : per_thread.timing_samples)
+		{
+			fprintf(file, "s %u %016" PRIx64 " %" PRIu64 "\n",
+			        unsigned(sample.tag), sample.hash, sample.duration_ns);
+		}
 
-			work.push_back({ get_order_index(ENQUEUE_DERIVED_PIPELINES_OFFSET),
-			                 [this, &pipelines, derived, memory_index, hash_offset, start_index]() {
-				                 // Go over all pipelines. If there are no further dependencies to resolve, we can go ahead and queue them up.
-				                 // If an entry exists in pipelines, we have queued up that hash earlier, but it might not be done compiling yet.
-				                 auto itr = unstable_remove_if(begin(*derived), end(*derived), [&](const DerivedInfo &info) -> bool {
-					                 if (info.info)
-					                 {
-						                 Hash hash = (Hash)info.info->basePipelineHandle;
-						                 return pipelines.count(hash) != 0;
-					                 }
-					                 else
-						                 return false;
-				                 });
+		// Index 0 is the main thread, which only dispatches work.
+		if (i != 0)
+			fprintf(file, "t %" PRIu64 " %" PRIu64 "\n", per_thread.idle_ns, per_thread.busy_ns);
+	}
 
-				                 // Wait for parent pipelines to complete.
-				                 // Only needed for first memory index.
-				                 if (memory_index == 0)
-				                 {
-					                 sync_worker_memory_context(PARENT_PIPELINE_MEMORY_CONTEXT);
+	fprintf(file, "c %u %u\n", replayer.pipeline_cache_hits.load(), replayer.pipeline_cache_misses.load());
+	fclose(file);
+}
 
-					                 // Now we have replayed the pipelines, so we can reclaim parent pipeline memory for this iteration.
-					                 for (auto &per_thread : per_thread_data)
-						                 if (per_thread.per_thread_replayers)
-							                 per_thread.per_thread_replayers[PARENT_PIPELINE_MEMORY_CONTEXT].get_allocator().reset();
-				                 }
+static void add_benchmark_report_timings(rapidjson::Value &value, std::vector<uint64_t> &durations,
+                                         rapidjson::Document::AllocatorType &alloc)
+{
+	std::sort(durations.begin(), durations.end());
+
+	// Nearest-rank percentiles.
+	const auto percentile = [&](uint64_t pct) -> uint64_t {
+		if (durations.empty())
+			return 0;
+		size_t rank = size_t((durations.size() * pct + 99) / 100);
+		return durations[rank ? rank - 1 : 0];
+	};
 
-				                 // Now we can enqueue pipeline compilation with correct pipeline handles.
-				                 for (auto i = itr; i != end(*derived); ++i)
-				                 {
-					                 if (i->info)
-					                 {
-						                 resolve_shader_modules(i->info);
-						                 auto base_itr = pipelines.find((Hash) i->info->basePipelineHandle);
-						                 i->info->basePipelineHandle =
-								                 base_itr != end(pipelines) ? base_itr->second : VK_NULL_HANDLE;
-						                 enqueue_pipeline(i->hash, i->info, i->pipeline,
-						                                  i->index + hash_offset + start_index, memory_index);
-					                 }
-				                 }
+	uint64_t total_ns = 0;
+	for (auto &d : durations)
+		total_ns += d;
+
+	value.SetObject();
+	value.AddMember("count", uint64_t(durations.size()), alloc);
+	value.AddMember("total_ns", total_ns, alloc);
+	value.AddMember("p50_ns", percentile(50), alloc);
+	value.AddMember("p90_ns", percentile(90), alloc);
+	value.AddMember("p99_ns", percentile(99), alloc);
+	value.AddMember("max_ns", durations.empty() ? uint64_t(0) : durations.back(), alloc);
+}
 
-				                 // It might be possible that we couldn't resolve some dependencies, log this.
-				                 if (itr != begin(*derived))
-				                 {
-					                 auto skipped_count = unsigned(itr - begin(*derived));
-					                 LOGW("%u pipelines were not compiled because parent pipelines do not exist.\n", skipped_count);
+static void dump_benchmark_report(const std::string &report_path, const std::vector<std::string> &samples_paths)
+{
+	struct Sample
+	{
+		ResourceTag tag;
+		Hash hash;
+		uint64_t duration_ns;
+		unsigned process;
+	};
 
-					                 if (opts.control_block)
-					                 {
-						                 auto tag = DerivedInfo::get_tag();
-						                 if (tag == RESOURCE_GRAPHICS_PIPELINE)
-							                 opts.control_block->skipped_graphics.fetch_add(skipped_count, std::memory_order_relaxed);
-						                 else if (tag == RESOURCE_COMPUTE_PIPELINE)
-							                 opts.control_block->skipped_compute.fetch_add(skipped_count, std::memory_order_relaxed);
-					                 }
-				                 }
-			                 }});
+	struct ThreadTimes
+	{
+		uint64_t idle_ns;
+		uint64_t busy_ns;
+		unsigned process;
+	};
+
+	std::vector<Sample> samples;
+	std::vector<ThreadTimes> threads;
+	uint64_t cache_hits = 0;
+	uint64_t cache_misses = 0;
+
+	for (size_t process = 0; process < samples_paths.size(); process++)
+	{
+		FILE *file = fopen(samples_paths[process].c_str(), "r");
+		if (!file)
+			continue;
 
-			memory_index = (memory_index + 1) % NUM_PIPELINE_MEMORY_CONTEXTS;
+		char type;
+		while (fscanf(file, " %c", &type) == 1)
+		{
+			if (type == 's')
+			{
+				unsigned tag;
+				Sample sample = {};
+				if (fscanf(file, "%u %" SCNx64 " %" SCNu64, &tag, &sample.hash, &sample.duration_ns) != 3 ||
+				    tag >= RESOURCE_COUNT)
+					break;
+				sample.tag = ResourceTag(tag);
+				sample.process = unsigned(process);
+				samples.push_back(sample);
+			}
+			else if (type == 't')
+			{
+				ThreadTimes times = {};
+				if (fscanf(file, "%" SCNu64 " %" SCNu64, &times.idle_ns, &times.busy_ns) != 2)
+					break;
+				times.process = unsigned(process);
+				threads.push_back(times);
+			}
+			else if (type == 'c')
+			{
+				unsigned hits, misses;
+				if (fscanf(file, "%u %u", &hits, &misses) != 2)
+					break;
+				cache_hits += hits;
+				cache_misses += misses;
+			}
+			else
+				break;
 		}
+
+		fclose(file);
+		remove(samples_paths[process].c_str());
 	}
 
-	void sync_threads() override
+	rapidjson::Document doc;
+	doc.SetObject();
+	auto &alloc = doc.GetAllocator();
+
+	static const struct
 	{
-		sync_worker_threads();
+		ResourceTag tag;
+		const char *key;
+	} timing_types[] = {
+		{ RESOURCE_SHADER_MODULE, "shader_modules" },
+		{ RESOURCE_GRAPHICS_PIPELINE, "graphics_pipelines" },
+		{ RESOURCE_COMPUTE_PIPELINE, "compute_pipelines" },
+	};
+
+	for (auto &type : timing_types)
+	{
+		std::vector<uint64_t> durations;
+		for (auto &sample : samples)
+			if (sample.tag == type.tag)
+				durations.push_back(sample.duration_ns);
+
+		rapidjson::Value value;
+		add_benchmark_report_timings(value, durations, alloc);
+		doc.AddMember(rapidjson::StringRef(type.key), value, alloc);
 	}
 
-	// Support ignoring shader module which are known to cause crashes.
-	void mask_shader_module(Hash hash)
+	rapidjson::Value cache(rapidjson::kObjectType);
+	cache.AddMember("hits", cache_hits, alloc);
+	cache.AddMember("misses", cache_misses, alloc);
+	cache.AddMember("hit_ratio", cache_hits + cache_misses ? double(cache_hits) / double(cache_hits + cache_misses) : 0.0, alloc);
+	doc.AddMember("pipeline_cache", cache, alloc);
+
+	rapidjson::Value thread_values(rapidjson::kArrayType);
+	for (auto &times : threads)
 	{
-		masked_shader_modules.insert(hash);
+		rapidjson::Value value(rapidjson::kObjectType);
+		value.AddMember("process", times.process, alloc);
+		value.AddMember("idle_ns", times.idle_ns, alloc);
+		value.AddMember("busy_ns", times.busy_ns, alloc);
+		thread_values.PushBack(value, alloc);
 	}
+	doc.AddMember("threads", thread_values, alloc);
 
-	const vector<thread> &get_threads() const
+	// Shader modules are cheap and plentiful, only pipelines are interesting here.
+	static const size_t NUM_SLOWEST_PIPELINES = 32;
+	auto pipelines_end = std::partition(samples.begin(), samples.end(), [](const Sample &sample) {
+		return sample.tag != RESOURCE_SHADER_MODULE;
+	});
+	size_t slowest_count = std::min<size_t>(NUM_SLOWEST_PIPELINES, size_t(pipelines_end - samples.begin()));
+	std::partial_sort(samples.begin(), samples.begin() + slowest_count, pipelines_end, [](const Sample &a, const Sample &b) {
+		return a.duration_ns > b.duration_ns;
+	});
+
+	rapidjson::Value slowest(rapidjson::kArrayType);
+	for (size_t i = 0; i < slowest_count; i++)
 	{
-		return thread_pool;
+		char hash_str[17];
+		sprintf(hash_str, "%016" PRIx64, samples[i].hash);
+
+		rapidjson::Value value(rapidjson::kObjectType);
+		value.AddMember("type", rapidjson::StringRef(samples[i].tag == RESOURCE_GRAPHICS_PIPELINE ? "graphics" : "compute"), alloc);
+		value.AddMember("hash", rapidjson::Value(hash_str, alloc), alloc);
+		value.AddMember("duration_ns", samples[i].duration_ns, alloc);
+		slowest.PushBack(value, alloc);
 	}
+	doc.AddMember("slowest_pipelines", slowest, alloc);
 
-	void emergency_teardown()
+	rapidjson::StringBuffer buffer;
+	rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+	doc.Accept(writer);
+
+	FILE *file = fopen(report_path.c_str(), "w");
+	if (!file)
 	{
-#ifdef SIMULATE_UNSTABLE_DRIVER
-		spurious_deadlock();
-#endif
-		flush_pipeline_cache();
-		flush_validation_cache();
-		if (validation_whitelist_db)
-			validation_whitelist_db->flush();
-		if (validation_blacklist_db)
-			validation_blacklist_db->flush();
-		device.reset();
+		LOGE("Failed to open benchmark report %s for writing.\n", report_path.c_str());
+		return;
 	}
 
-	Options opts;
+	fwrite(buffer.GetString(), 1, buffer.GetSize(), file);
+	fputc('\n', file);
+	fclose(file);
+}
 
-	std::unordered_map<Hash, VkSampler> samplers;
-	std::unordered_map<Hash, VkDescriptorSetLayout> layouts;
-	std::unordered_map<Hash, VkPipelineLayout> pipeline_layouts;
+// Trace events are stored as one Chrome trace event object per line.
+// pid is the OS process ID, so restarted child processes show up separately, and tid is the thread index, 0 being the main thread.
+static void append_trace_events(const ThreadedReplayer &replayer)
+{
+#ifdef _WIN32
+	unsigned pid = unsigned(GetCurrentProcessId());
+#else
+	unsigned pid = unsigned(getpid());
+#endif
 
-	ObjectCache<VkShaderModule> shader_modules;
+	auto path = get_process_output_tmp_path(replayer.opts.trace_path);
+	FILE *file = fopen(path.c_str(), "a");
+	if (!file)
+	{
+		LOGE("Failed to open trace events %s for writing.\n", path.c_str());
+		return;
+	}
 
-	std::unordered_map<Hash, VkRenderPass> render_passes;
-	std::unordered_map<Hash, VkPipeline> compute_pipelines;
-	std::unordered_map<Hash, VkPipeline> graphics_pipelines;
-	std::unordered_set<Hash> masked_shader_modules;
-	std::unordered_map<VkShaderModule, Hash> shader_module_to_hash;
-	std::unordered_set<VkShaderModule> enqueued_shader_modules;
-	VkPipelineCache disk_pipeline_cache = VK_NULL_HANDLE;
-	VkValidationCacheEXT validation_cache = VK_NULL_HANDLE;
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"fossilize-replay %u\"}}\n",
+	        pid, pid);
 
-	// VALVE: multi-threaded work queue for replayer
+	for (size_t i = 0; i < replayer.per_thread_data.size(); i++)
+	{
+		unsigned tid = unsigned(i);
+		if (i == 0)
+			fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,\"args\":{\"name\":\"main\"}}\n", pid);
+		else
+		{
+			fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}}\n",
+			        pid, tid, tid);
+		}
 
-	void enqueue_work_item(const PipelineWorkItem &item)
+		for (auto &event : replayer.per_thread_data[i].trace_events)
+		{
+			fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+			        event.name, pid, tid, double(event.start_ns) * 1e-3, double(event.duration_ns) * 1e-3);
+			if (event.hash)
+				fprintf(file, ",\"args\":{\"hash\":\"%016" PRIx64 "\"}}\n", event.hash);
+			else if (event.memory_context_index != ~0u)
+				fprintf(file, ",\"args\":{\"memory_context\":%u}}\n", event.memory_context_index);
+			else
+				fprintf(file, "}\n");
+		}
+	}
+
+	fclose(file);
+}
+
+static void dump_trace(const std::string &trace_path, const std::vector<std::string> &events_paths)
+{
+	FILE *file = fopen(trace_path.c_str(), "w");
+	if (!file)
 	{
-		lock_guard<mutex> lock(pipeline_work_queue_mutex);
-		pipeline_work_queue.push(item);
-		work_available_condition.notify_one();
-		queued_count[item.memory_context_index]++;
+		LOGE("Failed to open trace %s for writing.\n", trace_path.c_str());
+		return;
 	}
 
-	unsigned num_worker_threads = 0;
-	unsigned loop_count = 0;
+	fprintf(file, "{\"traceEvents\":[\n");
 
-	unsigned queued_count[NUM_MEMORY_CONTEXTS] = {};
-	unsigned completed_count[NUM_MEMORY_CONTEXTS] = {};
-	unsigned thread_initialized_count = 0;
-	std::condition_variable work_available_condition;
-	std::condition_variable work_done_condition[NUM_MEMORY_CONTEXTS];
+	bool first = true;
+	for (auto &path : events_paths)
+	{
+		FILE *events = fopen(path.c_str(), "r");
+		if (!events)
+			continue;
 
-	std::vector<std::thread> thread_pool;
-	std::vector<PerThreadData> per_thread_data;
-	std::mutex pipeline_work_queue_mutex;
-	std::mutex internal_enqueue_mutex;
-	std::queue<PipelineWorkItem> pipeline_work_queue;
+		char line[1024];
+		while (fgets(line, sizeof(line), events))
+		{
+			size_t len = strlen(line);
+			if (len && line[len - 1] == '\n')
+				line[--len] = '\0';
+			if (!len)
+				continue;
 
-	std::mutex pipeline_stats_queue_mutex;
-	std::unique_ptr<DatabaseInterface> pipeline_stats_db;
+			fprintf(file, "%s%s", first ? "" : ",\n", line);
+			first = false;
+		}
 
-	std::mutex validation_db_mutex;
-	std::unique_ptr<DatabaseInterface> validation_whitelist_db;
-	std::unique_ptr<DatabaseInterface> validation_blacklist_db;
-	std::unordered_set<Hash> implicit_whitelist[RESOURCE_COUNT];
+		fclose(events);
+		remove(path.c_str());
+	}
 
-	std::mutex replayer_cache_mutex;
-	std::unique_ptr<DatabaseInterface> replayer_cache_db;
-	std::unordered_set<Hash> cached_blobs[RESOURCE_COUNT];
+	fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	fclose(file);
+}
 
-	std::mutex hash_lock;
-	std::unordered_map<Hash, DeferredGraphicsInfo> graphics_parents;
-	std::unordered_map<Hash, DeferredComputeInfo> compute_parents;
-	std::vector<DeferredGraphicsInfo> deferred_graphics[NUM_MEMORY_CONTEXTS];
-	std::vector<DeferredComputeInfo> deferred_compute[NUM_MEMORY_CONTEXTS];
-	VkPipelineCache memory_context_pipeline_cache[NUM_MEMORY_CONTEXTS] = {};
+// Folds the on-disk pipeline caches written by several replays, e.g. one per build farm node, into one cache.
+// Caches from a different driver or device are skipped, since the driver would just throw them away.
+static bool merge_pipeline_caches(const VulkanDevice::Options &device_opts, const char *output_path,
+                                  const vector<const char *> &input_paths)
+{
+	VulkanDevice device;
+	if (!device.init_device(device_opts))
+	{
+		LOGE("Failed to create Vulkan device.\n");
+		return false;
+	}
 
-	// Feed statistics from the worker threads.
-	std::atomic<std::uint64_t> graphics_pipeline_ns;
-	std::atomic<std::uint64_t> compute_pipeline_ns;
-	std::atomic<std::uint64_t> shader_module_ns;
-	std::atomic<std::uint64_t> total_idle_ns;
-	std::atomic<std::uint64_t> thread_total_ns;
-	std::atomic<std::uint32_t> graphics_pipeline_count;
-	std::atomic<std::uint32_t> compute_pipeline_count;
-	std::atomic<std::uint32_t> shader_module_count;
-	std::atomic<std::uint32_t> shader_module_evicted_count;
-	std::atomic<std::uint32_t> pipeline_cache_hits;
-	std::atomic<std::uint32_t> pipeline_cache_misses;
+	vector<VkPipelineCache> caches;
+	for (auto *path : input_paths)
+	{
+		MappedFile blob;
+		if (!blob.map(path))
+		{
+			LOGW("Failed to open pipeline cache %s, skipping.\n", path);
+			continue;
+		}
 
-	std::atomic<std::uint64_t> shader_module_total_size;
-	std::atomic<std::uint64_t> shader_module_total_compressed_size;
+		if (!validate_pipeline_cache_header(device.get_gpu(), blob.data(), blob.size()))
+		{
+			LOGW("Pipeline cache %s does not match this device, skipping.\n", path);
+			continue;
+		}
 
-	std::atomic<size_t> total_peak_memory;
+		VkPipelineCacheCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+		info.pInitialData = blob.data();
+		info.initialDataSize = blob.size();
+		VkPipelineCache cache = VK_NULL_HANDLE;
+		if (vkCreatePipelineCache(device.get_device(), &info, nullptr, &cache) != VK_SUCCESS)
+		{
+			LOGW("Failed to create pipeline cache from %s, skipping.\n", path);
+			continue;
+		}
+		caches.push_back(cache);
+	}
 
-	bool shutting_down = false;
+	VkPipelineCacheCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	VkPipelineCache merged = VK_NULL_HANDLE;
+	bool ok = vkCreatePipelineCache(device.get_device(), &info, nullptr, &merged) == VK_SUCCESS;
 
-	unique_ptr<VulkanDevice> device;
-	bool device_was_init = false;
-	VulkanDevice::Options device_opts;
+	if (ok && !caches.empty() &&
+	    vkMergePipelineCaches(device.get_device(), merged, uint32_t(caches.size()), caches.data()) != VK_SUCCESS)
+	{
+		LOGE("Failed to merge pipeline caches.\n");
+		ok = false;
+	}
 
-	// Crash recovery.
-	bool robustness = false;
+	vector<uint8_t> merged_data;
+	size_t merged_size = 0;
+	if (ok && vkGetPipelineCacheData(device.get_device(), merged, &merged_size, nullptr) == VK_SUCCESS)
+	{
+		merged_data.resize(merged_size);
+		ok = vkGetPipelineCacheData(device.get_device(), merged, &merged_size, merged_data.data()) == VK_SUCCESS;
+		merged_data.resize(merged_size);
+	}
+	else
+		ok = false;
 
-	const StateReplayer *global_replayer = nullptr;
-	DatabaseInterface *global_database = nullptr;
-};
+	for (auto cache : caches)
+		vkDestroyPipelineCache(device.get_device(), cache, nullptr);
+	if (merged != VK_NULL_HANDLE)
+		vkDestroyPipelineCache(device.get_device(), merged, nullptr);
 
-static void on_validation_error(void *userdata)
-{
-	auto *replayer = static_cast<ThreadedReplayer *>(userdata);
+	if (!ok)
+	{
+		LOGE("Failed to get merged pipeline cache data.\n");
+		return false;
+	}
 
-	auto &per_thread = replayer->get_per_thread_data();
-	per_thread.triggered_validation_error = true;
+	if (!write_buffer_to_file_atomic(output_path, merged_data.data(), merged_data.size()))
+	{
+		LOGE("Failed to write pipeline cache data to %s.\n", output_path);
+		return false;
+	}
 
-	if (per_thread.current_graphics_pipeline)
-		replayer->blacklist_resource(RESOURCE_GRAPHICS_PIPELINE, per_thread.current_graphics_pipeline);
-	if (per_thread.current_compute_pipeline)
-		replayer->blacklist_resource(RESOURCE_COMPUTE_PIPELINE, per_thread.current_compute_pipeline);
+	LOGI("Merged %u of %u pipeline caches into %s (%" PRIu64 " bytes).\n",
+	     unsigned(caches.size()), unsigned(input_paths.size()), output_path, uint64_t(merged_data.size()));
+	return true;
+}
 
-	if (replayer->opts.on_validation_error_callback)
-		replayer->opts.on_validation_error_callback(replayer);
+#ifndef NO_ROBUST_REPLAYER
+static int device_index_for_process(const VulkanDevice::Options &device_opts,
+                                    const ThreadedReplayer::Options &replayer_opts, unsigned process_index)
+{
+	if (replayer_opts.device_indices.empty())
+		return device_opts.device_index;
+	return int(replayer_opts.device_indices[process_index % replayer_opts.device_indices.size()]);
 }
 
-static void print_help()
+// Child process N > 0 writes its pipeline cache to <cache>.N, fold those into the cache child 0 wrote,
+// so the next replay starts out with everything every child compiled.
+// When children are spread over several devices, there is one merged cache per pipelineCacheUUID.
+// The first device's goes to <cache>, any other to <cache>.<uuid>, so identical GPUs share one cache.
+static void merge_process_pipeline_caches(const VulkanDevice::Options &device_opts,
+                                          const ThreadedReplayer::Options &replayer_opts,
+                                          const std::string &cache_path, unsigned num_processes)
 {
-#ifndef NO_ROBUST_REPLAYER
-#ifdef _WIN32
-#define EXTRA_OPTIONS \
-	"\t[--slave-process]\n" \
-	"\t[--master-process]\n" \
-	"\t[--timeout <seconds>]\n" \
-	"\t[--progress]\n" \
-	"\t[--quiet-slave]\n" \
-	"\t[--shm-name <name>]\n\t[--shm-mutex-name <name>]\n" \
-	"\t[--metadata-name <name>]\n"
-#else
-#define EXTRA_OPTIONS \
-	"\t[--slave-process]\n" \
-	"\t[--master-process]\n" \
-	"\t[--timeout <seconds>]\n" \
-	"\t[--progress]\n" \
-	"\t[--quiet-slave]\n" \
-	"\t[--shmem-fd <fd>]\n" \
-	"\t[--control-fd <fd>]\n"
-#endif
-#else
-#define EXTRA_OPTIONS ""
-#endif
-	LOGI("fossilize-replay\n"
-	     "\t[--help]\n"
-	     "\t[--device-index <index>]\n"
-	     "\t[--enable-validation]\n"
-	     "\t[--enable-pipeline-stats <path>]\n"
-	     "\t[--spirv-val]\n"
-	     "\t[--num-threads <count>]\n"
-	     "\t[--loop <count>]\n"
-	     "\t[--on-disk-pipeline-cache <path>]\n"
-	     "\t[--on-disk-validation-cache <path>]\n"
-	     "\t[--on-disk-validation-whitelist <path>]\n"
-	     "\t[--on-disk-validation-blacklist <path>]\n"
-	     "\t[--on-disk-replay-whitelist <path>]\n"
-	     "\t[--on-disk-replay-whitelist-mask <module/pipeline/hex>]\n"
-	     "\t[--pipeline-hash <hash>]\n"
-	     "\t[--graphics-pipeline-range <start> <end>]\n"
-	     "\t[--compute-pipeline-range <start> <end>]\n"
-	     "\t[--shader-cache-size <value (MiB)>]\n"
-	     "\t[--ignore-derived-pipelines]\n"
-	     "\t[--log-memory]\n"
-	     "\t[--null-device]\n"
-	     "\t[--timeout-seconds]\n"
-	     "\t[--implicit-whitelist <index>]\n"
-	     "\t[--replayer-cache <path>]\n"
-	     EXTRA_OPTIONS
-	     "\t<Database>\n");
+	std::vector<std::string> paths;
+	for (unsigned idx = 1; idx < num_processes; idx++)
+	{
+		auto path = cache_path + "." + std::to_string(idx);
+		FILE *file = fopen(path.c_str(), "rb");
+		if (!file)
+			continue;
+		fclose(file);
+		paths.push_back(std::move(path));
+	}
+
+	if (paths.empty())
+		return;
+
+	// Only one device per distinct pipelineCacheUUID needs to do the merging.
+	std::vector<int> merge_devices;
+	std::vector<std::string> merge_uuids;
+	unsigned num_devices = std::max<unsigned>(1u, unsigned(replayer_opts.device_indices.size()));
+	for (unsigned i = 0; i < num_devices && i < num_processes; i++)
+	{
+		int device_index = device_index_for_process(device_opts, replayer_opts, i);
+		if (std::find(merge_devices.begin(), merge_devices.end(), device_index) != merge_devices.end())
+			continue;
+
+		std::string uuid;
+		if (num_devices > 1)
+		{
+			auto opts = device_opts;
+			opts.device_index = device_index;
+			VulkanDevice device;
+			if (!device.init_device(opts))
+			{
+				LOGE("Failed to create Vulkan device %d for merging pipeline caches.\n", device_index);
+				continue;
+			}
+			uuid = pipeline_cache_uuid_string(device.get_gpu_properties());
+			if (std::find(merge_uuids.begin(), merge_uuids.end(), uuid) != merge_uuids.end())
+				continue;
+		}
+
+		merge_devices.push_back(device_index);
+		merge_uuids.push_back(std::move(uuid));
+	}
+
+	bool ok = !merge_devices.empty();
+	for (size_t i = 0; i < merge_devices.size(); i++)
+	{
+		auto output_path = i == 0 ? cache_path : (cache_path + "." + merge_uuids[i]);
+
+		std::vector<const char *> path_ptrs;
+		path_ptrs.push_back(cache_path.c_str());
+		if (i != 0)
+			path_ptrs.push_back(output_path.c_str());
+		for (auto &path : paths)
+			path_ptrs.push_back(path.c_str());
+
+		auto opts = device_opts;
+		opts.device_index = merge_devices[i];
+		if (!merge_pipeline_caches(opts, output_path.c_str(), path_ptrs))
+		{
+			LOGE("Failed to merge pipeline caches into %s.\n", output_path.c_str());
+			ok = false;
+		}
+	}
+
+	if (!ok)
+		return;
+
+	for (auto &path : paths)
+		remove(path.c_str());
 }
+#endif
 
 #ifndef NO_ROBUST_REPLAYER
-static void log_progress(const ExternalReplayer::Progress &progress)
+// Child process N > 0 captures pipeline binaries to <archive>.N, fold those into the archive child 0 wrote.
+static void merge_pipeline_binary_archives(const std::string &archive_path, unsigned num_processes)
 {
-	unsigned current_actions, total_actions;
-	ExternalReplayer::compute_condensed_progress(progress, current_actions, total_actions);
+	std::vector<std::string> paths;
+	for (unsigned idx = 1; idx < num_processes; idx++)
+	{
+		auto path = archive_path + "." + std::to_string(idx);
 
-	LOGI("=================\n");
-	LOGI(" Progress report:\n");
-	LOGI("   Overall %u / %u\n", current_actions, total_actions);
-	LOGI("   Parsed graphics %u / %u, failed %u, cached %u\n",
-	     progress.graphics.parsed, progress.graphics.total, progress.graphics.parsed_fail, progress.graphics.cached);
-	LOGI("   Parsed compute %u / %u, failed %u, cached %u\n",
-	     progress.compute.parsed, progress.compute.total, progress.compute.parsed_fail, progress.compute.cached);
-	LOGI("   Decompress modules %u / %u, skipped %u, failed validation %u, missing %u\n",
-	     progress.completed_modules, progress.total_modules, progress.banned_modules, progress.module_validation_failures, progress.missing_modules);
-	LOGI("   Compile graphics %u / %u, skipped %u, cached %u\n",
-	     progress.graphics.completed, progress.graphics.total, progress.graphics.skipped, progress.graphics.cached);
-	LOGI("   Compile compute %u / %u, skipped %u, cached %u\n",
-	     progress.compute.completed, progress.compute.total, progress.compute.skipped, progress.compute.cached);
-	LOGI("   Clean crashes %u\n", progress.clean_crashes);
-	LOGI("   Dirty crashes %u\n", progress.dirty_crashes);
-	LOGI("=================\n");
+		// Children which could not capture anything never create their archive.
+		FILE *file = fopen(path.c_str(), "rb");
+		if (!file)
+			continue;
+		fclose(file);
+		paths.push_back(std::move(path));
+	}
+
+	if (paths.empty())
+		return;
+
+	std::vector<const char *> path_ptrs;
+	for (auto &path : paths)
+		path_ptrs.push_back(path.c_str());
+
+	if (!merge_concurrent_databases(archive_path.c_str(), path_ptrs.data(), path_ptrs.size()))
+	{
+		LOGE("Failed to merge pipeline binary archives into %s.\n", archive_path.c_str());
+		return;
+	}
+
+	for (auto &path : paths)
+		remove(path.c_str());
 }
 
-static void log_memory_usage(const std::vector<ExternalReplayer::ProcessStats> &usage,
-                             const ExternalReplayer::GlobalResourceUsage *global_stats)
+// Loads the replayer cache once on behalf of all child processes.
+// Children import the bloom filters and sorted hash lists rather than each reading the cache into their own hash sets.
+static intptr_t export_replayer_cache(const VulkanDevice::Options &device_opts,
+                                      const ThreadedReplayer::Options &replayer_opts, const char *export_name)
 {
-	LOGI("=================\n");
-	LOGI(" Memory usage:\n");
-	unsigned index = 0;
-	for (auto &use : usage)
+	if (replayer_opts.replayer_cache_path.empty())
+		return DatabaseInterface::invalid_metadata_handle();
+
+	// Children spread over several devices can be running different drivers, let each load its own cache.
+	if (replayer_opts.device_indices.size() > 1)
+		return DatabaseInterface::invalid_metadata_handle();
+
+	std::string key;
 	{
-		LOGI("   #%u: %5u MiB resident %5u MiB shared (%u MiB shared metadata).\n", index++,
-		     use.resident_mib, use.shared_mib, use.shared_metadata_mib);
+		auto opts = device_opts;
+		opts.device_index = device_index_for_process(device_opts, replayer_opts, 0);
+		VulkanDevice device;
+		if (!device.init_device(opts))
+		{
+			LOGW("Failed to create Vulkan device for loading the replayer cache, children load it themselves.\n");
+			return DatabaseInterface::invalid_metadata_handle();
+		}
+		key = replayer_cache_key_string(device.get_gpu_properties());
 	}
 
-	if (global_stats)
-	{
-		if (global_stats->dirty_pages_mib >= 0)
-			LOGI(" Dirty filesystem writes: %u MiB.\n", global_stats->dirty_pages_mib);
-		else
-			LOGI(" Dirty filesystem writes: N/A.\n");
+	auto cache_path = replayer_opts.replayer_cache_path + "." + key;
+	fold_replayer_cache_deltas(cache_path);
 
-		if (global_stats->io_stall_percentage >= 0)
-			LOGI(" IO stall: %u%%.\n", global_stats->io_stall_percentage);
-		else
-			LOGI(" IO stall: N/A.\n");
+	std::unique_ptr<DatabaseInterface> db(create_concurrent_database(cache_path.c_str(), DatabaseMode::ReadOnly, nullptr, 0));
+	if (!db->prepare())
+		return DatabaseInterface::invalid_metadata_handle();
 
-		LOGI(" Num running child processes: %u.\n", global_stats->num_running_processes);
-	}
-	LOGI("=================\n");
+	intptr_t handle = db->export_metadata_to_os_handle(export_name);
+	if (!DatabaseInterface::metadata_handle_is_valid(handle))
+		LOGW("Failed to export replayer cache metadata, children load the cache themselves.\n");
+	return handle;
 }
 
-static void log_faulty_modules(ExternalReplayer &replayer)
+static void install_trivial_crash_handlers(ThreadedReplayer &replayer);
+#endif
+
+// Returns false if the entry could not be read, parse failures are only logged.
+static bool replay_main_thread_object(StateReplayer &state_replayer, ThreadedReplayer &replayer, DatabaseInterface &resolver,
+                                      ResourceTag tag, const char *tag_name, Hash hash, PayloadReadFlags read_flags,
+                                      vector<uint8_t> &state_json, size_t *total_size, size_t *total_size_compressed)
 {
-	size_t count;
-	if (!replayer.get_faulty_spirv_modules(&count, nullptr))
-		return;
-	vector<Hash> hashes(count);
-	if (!replayer.get_faulty_spirv_modules(&count, hashes.data()))
-		return;
+	size_t state_json_size = 0;
+	if (!resolver.read_entry(tag, hash, &state_json_size, nullptr, read_flags | PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+		return false;
+	*total_size_compressed += state_json_size;
 
-	sort(begin(hashes), end(hashes));
+	if (!resolver.read_entry(tag, hash, &state_json_size, nullptr, read_flags))
+		return false;
 
-	for (auto &h : hashes)
-		LOGI("Detected faulty SPIR-V module: %016" PRIx64 "\n", h);
+	state_json.resize(state_json_size);
+	*total_size += state_json_size;
+
+	if (!resolver.read_entry(tag, hash, &state_json_size, state_json.data(), read_flags))
+		return false;
+
+	if (!state_replayer.parse(replayer, &resolver, state_json.data(), state_json.size()))
+		LOGW("Did not replay blob (tag: %s, hash: %016" PRIx64 "). See previous logs for context.\n", tag_name, hash);
+	return true;
 }
 
-static void log_faulty_graphics(ExternalReplayer &replayer)
+// With fewer objects than this per thread, starting the threads costs more than parsing serially.
+enum { MIN_MAIN_THREAD_OBJECTS_PER_THREAD = 256 };
+
+// Samplers, layouts and render passes only depend on objects of earlier tags in the playback order,
+// so all objects of one tag can be parsed in parallel once the previous tags are done.
+// Each thread parses into its own StateReplayer, and the handles are gathered into state_replayer afterwards.
+static bool replay_main_thread_objects_threaded(StateReplayer &state_replayer, ThreadedReplayer &replayer,
+                                                DatabaseInterface &resolver, ResourceTag tag, const char *tag_name,
+                                                const vector<Hash> &hashes, unsigned num_threads,
+                                                size_t *total_size, size_t *total_size_compressed)
 {
-	size_t count;
-	if (!replayer.get_graphics_failed_validation(&count, nullptr))
-		return;
-	vector<Hash> hashes(count);
-	if (!replayer.get_graphics_failed_validation(&count, hashes.data()))
-		return;
+	enum { BatchSize = 64 };
+	std::atomic<size_t> next_index{0};
+	std::atomic<bool> read_failed{false};
 
-	sort(begin(hashes), end(hashes));
+	vector<unique_ptr<StateReplayer>> replayers(num_threads);
+	vector<size_t> sizes(num_threads), compressed_sizes(num_threads);
+	vector<std::thread> threads;
+	threads.reserve(num_threads);
 
-	for (auto &h : hashes)
+	for (unsigned i = 0; i < num_threads; i++)
 	{
-		LOGI("Graphics pipeline failed validation: %016" PRIx64 "\n", h);
-
-		// Ad-hoc hack to test automatic pruning ideas ...
-		//printf("--skip-graphics %016llx ", static_cast<unsigned long long>(h));
+		replayers[i].reset(new StateReplayer);
+		replayers[i]->copy_handle_references(state_replayer);
+		threads.emplace_back([&, i]() {
+			vector<uint8_t> state_json;
+			size_t begin_index;
+			while (!read_failed.load(std::memory_order_relaxed) &&
+			       (begin_index = next_index.fetch_add(BatchSize, std::memory_order_relaxed)) < hashes.size())
+			{
+				size_t end_index = min(begin_index + size_t(BatchSize), hashes.size());
+				for (size_t index = begin_index; index < end_index; index++)
+				{
+					if (!replay_main_thread_object(*replayers[i], replayer, resolver, tag, tag_name, hashes[index],
+					                               PAYLOAD_READ_CONCURRENT_BIT, state_json,
+					                               &sizes[i], &compressed_sizes[i]))
+					{
+						read_failed.store(true, std::memory_order_relaxed);
+						break;
+					}
+				}
+			}
+		});
 	}
 
-	vector<unsigned> indices;
-	if (!replayer.get_faulty_graphics_pipelines(&count, nullptr, nullptr))
-		return;
-	indices.resize(count);
-	hashes.resize(count);
-	if (!replayer.get_faulty_graphics_pipelines(&count, indices.data(), hashes.data()))
-		return;
+	for (auto &thread : threads)
+		thread.join();
 
-	for (unsigned i = 0; i < count; i++)
+	for (unsigned i = 0; i < num_threads; i++)
 	{
-		LOGI("Graphics pipeline crashed or hung: %016" PRIx64 ". Repro with: --graphics-pipeline-range %u %u\n",
-		     hashes[i], indices[i], indices[i] + 1);
+		state_replayer.merge_handle_references(*replayers[i]);
+		*total_size += sizes[i];
+		*total_size_compressed += compressed_sizes[i];
 	}
+
+	return !read_failed.load(std::memory_order_relaxed);
 }
 
-static void log_faulty_compute(ExternalReplayer &replayer)
+static bool load_pipeline_usage(StateReplayer &state_replayer, ThreadedReplayer &replayer, DatabaseInterface &iface)
 {
 	size_t count;
-	if (!replayer.get_compute_failed_validation(&count, nullptr))
-		return;
+	if (!iface.get_hash_list_for_resource_tag(RESOURCE_PIPELINE_USAGE, &count, nullptr))
+		return false;
 	vector<Hash> hashes(count);
-	if (!replayer.get_compute_failed_validation(&count, hashes.data()))
-		return;
-
-	sort(begin(hashes), end(hashes));
+	if (!iface.get_hash_list_for_resource_tag(RESOURCE_PIPELINE_USAGE, &count, hashes.data()))
+		return false;
 
-	for (auto &h : hashes)
+	vector<uint8_t> state_json;
+	for (auto hash : hashes)
 	{
-		LOGI("Compute pipeline failed validation: %016" PRIx64 "\n", h);
+		size_t state_json_size = 0;
+		if (!iface.read_entry(RESOURCE_PIPELINE_USAGE, hash, &state_json_size, nullptr, 0))
+			return false;
+		state_json.resize(state_json_size);
+		if (!iface.read_entry(RESOURCE_PIPELINE_USAGE, hash, &state_json_size, state_json.data(), 0))
+			return false;
 
-		// Ad-hoc hack to test automatic pruning ideas ...
-		//printf("--skip-compute %016llx ", static_cast<unsigned long long>(h));
+		if (!state_replayer.parse(replayer, &iface, state_json.data(), state_json.size()))
+			LOGW("Failed to parse pipeline usage (hash: %016" PRIx64 ").\n", hash);
 	}
 
-	vector<unsigned> indices;
-	if (!replayer.get_faulty_compute_pipelines(&count, nullptr, nullptr))
-		return;
-	indices.resize(count);
-	hashes.resize(count);
-	if (!replayer.get_faulty_compute_pipelines(&count, indices.data(), hashes.data()))
+	LOGI("Loaded pipeline usage for %u graphics and %u compute pipelines from %u entries.\n",
+	     unsigned(replayer.pipeline_usage[RESOURCE_GRAPHICS_PIPELINE].size()),
+	     unsigned(replayer.pipeline_usage[RESOURCE_COMPUTE_PIPELINE].size()),
+	     unsigned(count));
+	return true;
+}
+
+static void sort_hashes_by_weight(vector<Hash> &hashes, const unordered_map<Hash, uint64_t> &weights)
+{
+	if (weights.empty())
 		return;
 
-	for (unsigned i = 0; i < count; i++)
+	vector<pair<uint64_t, Hash>> sorted;
+	sorted.reserve(hashes.size());
+	for (auto hash : hashes)
 	{
-		LOGI("Compute pipeline crashed or hung: %016" PRIx64 ". Repro with: --compute-pipeline-range %u %u\n",
-		     hashes[i], indices[i], indices[i] + 1);
+		auto itr = weights.find(hash);
+		sorted.push_back({ itr != end(weights) ? itr->second : 0, hash });
 	}
+
+	// Pipelines without a weight, e.g. ones never seen bound, keep their relative order at the end.
+	stable_sort(begin(sorted), end(sorted), [](const pair<uint64_t, Hash> &a, const pair<uint64_t, Hash> &b) {
+		return a.first > b.first;
+	});
+
+	for (size_t i = 0; i < hashes.size(); i++)
+		hashes[i] = sorted[i].second;
 }
 
-static int run_progress_process(const VulkanDevice::Options &device_opts,
-                                const ThreadedReplayer::Options &replayer_opts,
-                                const vector<const char *> &databases,
-                                const char *whitelist, uint32_t whitelist_mask,
-                                int timeout, bool log_memory)
+// Shards are picked from the pipeline hash alone, so every node agrees on the split without any coordination.
+static bool hash_is_in_shard(Hash hash, unsigned shard_index, unsigned shard_count)
 {
-	ExternalReplayer::Options opts = {};
-	opts.on_disk_pipeline_cache = replayer_opts.on_disk_pipeline_cache_path.empty() ?
-	                              nullptr : replayer_opts.on_disk_pipeline_cache_path.c_str();
-	opts.on_disk_validation_cache = replayer_opts.on_disk_validation_cache_path.empty() ?
-	                                nullptr : replayer_opts.on_disk_validation_cache_path.c_str();
-	opts.on_disk_validation_whitelist = replayer_opts.on_disk_validation_whitelist_path.empty() ?
-	                                    nullptr : replayer_opts.on_disk_validation_whitelist_path.c_str();
-	opts.on_disk_validation_blacklist = replayer_opts.on_disk_validation_blacklist_path.empty() ?
-	                                    nullptr : replayer_opts.on_disk_validation_blacklist_path.c_str();
-	opts.pipeline_stats_path = replayer_opts.pipeline_stats_path.empty() ?
-	                           nullptr : replayer_opts.pipeline_stats_path.c_str();
-	opts.num_threads = replayer_opts.num_threads;
-	opts.quiet = true;
-	opts.databases = databases.data();
-	opts.num_databases = databases.size();
-	opts.external_replayer_path = nullptr;
-	opts.inherit_process_group = true;
-	opts.spirv_validate = replayer_opts.spirv_validate;
-	opts.device_index = device_opts.device_index;
-	opts.enable_validation = device_opts.enable_validation;
-	opts.ignore_derived_pipelines = replayer_opts.ignore_derived_pipelines;
-	opts.null_device = device_opts.null_device;
-	opts.start_graphics_index = replayer_opts.start_graphics_index;
-	opts.end_graphics_index = replayer_opts.end_graphics_index;
-	opts.start_compute_index = replayer_opts.start_compute_index;
-	opts.end_compute_index = replayer_opts.end_compute_index;
-	opts.use_pipeline_range =
-			(replayer_opts.start_graphics_index != 0) ||
-			(replayer_opts.end_graphics_index != ~0u) ||
-			(replayer_opts.start_compute_index != 0) ||
-			(replayer_opts.end_compute_index != ~0u);
-	opts.timeout_seconds = replayer_opts.timeout_seconds;
-	opts.implicit_whitelist_indices = replayer_opts.implicit_whitelist_database_indices.data();
-	opts.num_implicit_whitelist_indices = replayer_opts.implicit_whitelist_database_indices.size();
-	opts.replayer_cache_path = replayer_opts.replayer_cache_path.empty() ?
-			nullptr : replayer_opts.replayer_cache_path.c_str();
-	opts.on_disk_replay_whitelist = whitelist;
-	opts.on_disk_replay_whitelist_mask = whitelist_mask;
+	return ((hash ^ (hash >> 32)) % shard_count) == shard_index;
+}
 
-	ExternalReplayer replayer;
-	if (!replayer.start(opts))
-	{
-		LOGE("Failed to start external replayer.\n");
-		return EXIT_FAILURE;
-	}
+static void filter_hashes_by_shard(vector<Hash> &hashes, unsigned shard_index, unsigned shard_count)
+{
+	if (!shard_count)
+		return;
 
-	bool has_killed = false;
-	auto start_time = std::chrono::steady_clock::now();
+	hashes.erase(remove_if(begin(hashes), end(hashes), [&](Hash hash) {
+		return !hash_is_in_shard(hash, shard_index, shard_count);
+	}), end(hashes));
+}
 
-	for (;;)
-	{
-		if (!has_killed && timeout > 0)
-		{
-			auto current_time = std::chrono::steady_clock::now();
-			auto delta = current_time - start_time;
-			if (std::chrono::duration_cast<std::chrono::seconds>(delta).count() >= timeout)
-			{
-				LOGE("Killing process due to timeout.\n");
-				replayer.kill();
-				has_killed = true;
-			}
-		}
+// The recorder writes a link entry keyed on the application and the blob, so membership is a plain lookup.
+// Unrelated pipelines are never read, and neither are the link blobs themselves.
+static void filter_hashes_by_application(vector<Hash> &hashes, ResourceTag tag, Hash application_hash,
+                                         DatabaseInterface &iface)
+{
+	if (!application_hash)
+		return;
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(100));
-		ExternalReplayer::Progress progress = {};
+	hashes.erase(remove_if(begin(hashes), end(hashes), [&](Hash hash) {
+		Hash link_hash = Hashing::compute_hash_application_info_link(application_hash, tag, hash);
+		return !iface.has_entry(RESOURCE_APPLICATION_BLOB_LINK, link_hash);
+	}), end(hashes));
+}
 
-		if (replayer.is_process_complete(nullptr))
-		{
-			auto result = replayer.poll_progress(progress);
-			if (result != ExternalReplayer::PollResult::ResultNotReady)
-				log_progress(progress);
-			log_faulty_modules(replayer);
-			log_faulty_graphics(replayer);
-			log_faulty_compute(replayer);
-			return replayer.wait();
-		}
+static bool get_selected_pipeline_count(DatabaseInterface &iface, ResourceTag tag,
+                                        const ThreadedReplayer::Options &opts, size_t *count)
+{
+	if (!iface.get_hash_list_for_resource_tag(tag, count, nullptr))
+		return false;
+	if (!opts.shard_count && !opts.filter_application_hash)
+		return true;
 
-		auto result = replayer.poll_progress(progress);
+	vector<Hash> hashes(*count);
+	if (!iface.get_hash_list_for_resource_tag(tag, count, hashes.data()))
+		return false;
 
-		switch (result)
-		{
-		case ExternalReplayer::PollResult::Error:
-			return EXIT_FAILURE;
+	filter_hashes_by_application(hashes, tag, opts.filter_application_hash, iface);
+	filter_hashes_by_shard(hashes, opts.shard_index, opts.shard_count);
+	*count = hashes.size();
+	return true;
+}
 
-		case ExternalReplayer::PollResult::ResultNotReady:
-			break;
+static bool load_pipeline_cost_history(const string &path, ThreadedReplayer &replayer)
+{
+	auto csv = load_buffer_from_file(path.c_str());
+	if (csv.empty())
+		return false;
 
-		case ExternalReplayer::PollResult::Complete:
-		case ExternalReplayer::PollResult::Running:
-		{
-			log_progress(progress);
+	const char *ptr = reinterpret_cast<const char *>(csv.data());
+	const char *csv_end = ptr + csv.size();
+	int type_column = -1, hash_column = -1, time_column = -1;
+	vector<string> fields;
+	unsigned count = 0;
 
-			if (log_memory)
+	while (ptr < csv_end)
+	{
+		const char *line_end = static_cast<const char *>(memchr(ptr, '\n', csv_end - ptr));
+		if (!line_end)
+			line_end = csv_end;
+
+		fields.clear();
+		const char *field = ptr;
+		for (const char *c = ptr; c <= line_end; c++)
+		{
+			if (c == line_end || *c == ',')
 			{
-				uint32_t num_processes;
+				size_t len = c - field;
+				if (len && field[len - 1] == '\r')
+					len--;
+				fields.emplace_back(field, len);
+				field = c + 1;
+			}
+		}
+		ptr = line_end + 1;
 
-				if (replayer.poll_memory_usage(&num_processes, nullptr))
-				{
-					std::vector<ExternalReplayer::ProcessStats> usage(num_processes);
-					if (replayer.poll_memory_usage(&num_processes, usage.data()))
-					{
-						usage.resize(num_processes);
-						ExternalReplayer::GlobalResourceUsage global_stats = {};
-						bool got_global_stats = replayer.poll_global_resource_usage(global_stats);
-						log_memory_usage(usage, got_global_stats ? &global_stats : nullptr);
-					}
-				}
+		if (time_column < 0)
+		{
+			// The first line is the header written by stats_to_csv().
+			for (size_t i = 0; i < fields.size(); i++)
+			{
+				if (fields[i] == "Pipeline type")
+					type_column = int(i);
+				else if (fields[i] == "Pipeline hash")
+					hash_column = int(i);
+				else if (fields[i] == "Compile time (ns)")
+					time_column = int(i);
 			}
 
-			if (result == ExternalReplayer::PollResult::Complete)
+			if (type_column < 0 || hash_column < 0 || time_column < 0)
 			{
-				log_faulty_modules(replayer);
-				log_faulty_graphics(replayer);
-				log_faulty_compute(replayer);
-				return replayer.wait();
+				LOGE("%s is not a pipeline stats file with compile times.\n", path.c_str());
+				return false;
 			}
-			break;
-		}
+			continue;
 		}
+
+		int max_column = std::max(type_column, std::max(hash_column, time_column));
+		if (int(fields.size()) <= max_column || fields[time_column].empty())
+			continue;
+
+		ResourceTag tag;
+		if (fields[type_column] == "GRAPHICS")
+			tag = RESOURCE_GRAPHICS_PIPELINE;
+		else if (fields[type_column] == "COMPUTE")
+			tag = RESOURCE_COMPUTE_PIPELINE;
+		else
+			continue;
+
+		// There is one row per pipeline executable, all with the same compile time.
+		Hash hash = strtoull(fields[hash_column].c_str(), nullptr, 16);
+		replayer.pipeline_cost_history[tag][hash] = strtoull(fields[time_column].c_str(), nullptr, 10);
+		count++;
 	}
-}
 
-static void log_process_memory();
-#endif
+	LOGI("Loaded compile times for %u graphics and %u compute pipelines from %s.\n",
+	     unsigned(replayer.pipeline_cost_history[RESOURCE_GRAPHICS_PIPELINE].size()),
+	     unsigned(replayer.pipeline_cost_history[RESOURCE_COMPUTE_PIPELINE].size()),
+	     path.c_str());
+	return count != 0;
+}
 
-static bool parse_json_stats(const std::string &foz_path, rapidjson::Document &doc)
+// Lists the shader module referenced by each stage of a pipeline, 0 for stages without one.
+static bool get_pipeline_stage_modules(ResourceTag tag, Hash hash, DatabaseInterface &iface,
+                                       vector<char> &json_buffer, vector<Hash> &modules)
 {
-	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(foz_path.c_str(), DatabaseMode::ReadOnly));
-	if (!db)
+	modules.clear();
+
+	size_t json_size = 0;
+	if (!iface.read_entry(tag, hash, &json_size, nullptr, 0))
 		return false;
-	if (!db->prepare())
+	json_buffer.resize(json_size);
+	if (!iface.read_entry(tag, hash, &json_size, json_buffer.data(), 0))
 		return false;
+	json_buffer.push_back('\0');
 
-	static const ResourceTag stat_tags[] = {
-		RESOURCE_GRAPHICS_PIPELINE,
-		RESOURCE_COMPUTE_PIPELINE,
-	};
+	rapidjson::Document doc;
+	doc.Parse(rapidjson::StringRef(json_buffer.data()));
+	if (doc.HasParseError() || !doc.IsObject())
+		return false;
 
-	doc.SetArray();
+	const char *member = tag == RESOURCE_GRAPHICS_PIPELINE ? "graphicsPipelines" : "computePipelines";
+	if (!doc.HasMember(member) || !doc[member].IsObject() || doc[member].MemberCount() == 0)
+		return false;
+	auto &pipe = doc[member].MemberBegin()->value;
 
-	std::vector<char> json_buffer;
+	const auto add_stage = [&](const rapidjson::Value &stage) {
+		modules.push_back(stage.HasMember("module") ? strtoull(stage["module"].GetString(), nullptr, 16) : 0);
+	};
 
-	for (auto &tag : stat_tags)
+	if (tag == RESOURCE_COMPUTE_PIPELINE)
 	{
-		size_t num_hashes = 0;
-		if (!db->get_hash_list_for_resource_tag(tag, &num_hashes, nullptr))
-			return false;
-		std::vector<Hash> hashes(num_hashes);
-		if (!db->get_hash_list_for_resource_tag(tag, &num_hashes, hashes.data()))
-			return false;
-
-		for (auto &hash : hashes)
-		{
-			rapidjson::Document tmp_doc;
-			size_t json_size = 0;
-			if (!db->read_entry(tag, hash, &json_size, nullptr, 0))
-				continue;
-			json_buffer.resize(json_size);
-			if (!db->read_entry(tag, hash, &json_size, json_buffer.data(), 0))
-				continue;
-			json_buffer.push_back('\0');
-
-			tmp_doc.Parse(rapidjson::StringRef(json_buffer.data()));
-			if (tmp_doc.HasParseError())
-				continue;
-
-			rapidjson::Value v;
-			v.CopyFrom(tmp_doc, doc.GetAllocator());
-			doc.PushBack(v, doc.GetAllocator());
-		}
+		if (pipe.HasMember("stage"))
+			add_stage(pipe["stage"]);
+	}
+	else if (pipe.HasMember("stages"))
+	{
+		auto &stages = pipe["stages"];
+		for (auto itr = stages.Begin(); itr != stages.End(); itr++)
+			add_stage(*itr);
 	}
 
 	return true;
 }
 
-static void stats_to_csv(const std::string &stats_path, rapidjson::Document &doc)
+// Static compile cost estimate, in units of SPIR-V payload bytes.
+static uint64_t estimate_pipeline_cost(ResourceTag tag, Hash hash, DatabaseInterface &iface,
+                                       vector<char> &json_buffer, vector<Hash> &modules,
+                                       unordered_map<Hash, uint64_t> &module_sizes)
 {
-	std::vector<std::string> header;
-	std::unordered_map<std::string, size_t> columns;
-	std::vector<std::map<size_t, std::string>> rows;
+	// Accounts for the fixed cost of compiling and linking a stage, regardless of its size.
+	constexpr uint64_t stage_cost = 4096;
 
-	header.push_back("Database");
-	header.push_back("Pipeline type");
-	header.push_back("Pipeline hash");
-	header.push_back("Executable name");
-	header.push_back("Subgroup size");
+	if (!get_pipeline_stage_modules(tag, hash, iface, json_buffer, modules))
+		return 0;
 
-	for (auto itr = doc.Begin(); itr != doc.End(); itr++)
+	uint64_t cost = 0;
+	for (auto module : modules)
 	{
-		std::map<size_t, std::string> row;
-
-		auto &st = *itr;
+		auto itr = module_sizes.find(module);
+		if (itr == end(module_sizes))
+		{
+			size_t module_size = 0;
+			if (module == 0 || !iface.read_entry(RESOURCE_SHADER_MODULE, module, &module_size, nullptr, 0))
+				module_size = 0;
+			itr = module_sizes.insert({ module, module_size }).first;
+		}
+		cost += stage_cost + itr->second;
+	}
 
-		row[0] = st["db_path"].GetString();
-		row[1] = st["pipeline_type"].GetString();
-		row[2] = st["pipeline"].GetString();
+	return cost;
+}
 
-		auto &execs = st["executables"];
-		for (auto e_itr = execs.Begin(); e_itr != execs.End(); e_itr++)
-		{
-			auto &exec = *e_itr;
-			row[3] = exec["executable_name"].GetString();
-			row[4] = std::to_string(exec["subgroup_size"].GetUint());
-			for (auto st_itr = exec["stats"].Begin(); st_itr != exec["stats"].End(); st_itr++)
-			{
-				auto &stat = *st_itr;
-				std::string key = stat["name"].GetString();
-				size_t insert_at;
+static void sort_hashes_by_cost(vector<Hash> &hashes, ResourceTag tag, DatabaseInterface &iface,
+                                const unordered_map<Hash, uint64_t> &history)
+{
+	unordered_map<Hash, uint64_t> costs;
+	unordered_map<Hash, uint64_t> module_sizes;
+	vector<char> json_buffer;
+	vector<Hash> modules;
+	costs.reserve(hashes.size());
 
-				auto col = columns.find(key);
-				if (col == columns.end())
-				{
-					insert_at = header.size();
-					columns[key] = insert_at;
-					header.push_back(key);
-				}
-				else
-				{
-					insert_at = col->second;
-				}
+	double history_ns = 0.0;
+	double history_cost = 0.0;
 
-				row[insert_at] = stat["value"].GetString();
-			}
+	for (auto hash : hashes)
+	{
+		uint64_t cost = estimate_pipeline_cost(tag, hash, iface, json_buffer, modules, module_sizes);
+		costs[hash] = cost;
 
-			rows.push_back(row);
+		auto itr = history.find(hash);
+		if (itr != end(history))
+		{
+			history_ns += double(itr->second);
+			history_cost += double(cost);
 		}
 	}
 
-	FILE *fp = fopen(stats_path.c_str(), "w");
-	if (!fp)
-		return;
-
-	size_t colnumber = 0;
-	for (auto &h : header)
-		fprintf(fp, "%s%s", h.c_str(), ++colnumber < header.size() ? "," : "\n");
-
-	for (auto &r : rows)
+	// Measured compile times win over the estimate. Scale the estimate into nanoseconds
+	// based on the pipelines we have measurements for, so both can be compared.
+	if (history_ns > 0.0 && history_cost > 0.0)
 	{
-		colnumber = 0;
-		for (size_t i = 0; i < header.size(); i++)
+		double ns_per_cost = history_ns / history_cost;
+		for (auto &cost : costs)
 		{
-			auto col = r.find(i);
-			fprintf(fp, "%s%s", col == r.end() ? "" : col->second.c_str(), ++colnumber < header.size() ? "," : "\n");
+			auto itr = history.find(cost.first);
+			if (itr != end(history))
+				cost.second = itr->second;
+			else
+				cost.second = uint64_t(double(cost.second) * ns_per_cost);
 		}
 	}
 
-	fclose(fp);
+	sort_hashes_by_weight(hashes, costs);
 }
 
-#ifndef NO_ROBUST_REPLAYER
-static void dump_stats(const std::string &stats_path, const std::vector<std::string> &foz_paths)
+// Reorders pipelines so that pipelines sharing shader modules are replayed close together.
+// This is a depth-first traversal of the pipeline - module graph: once a pipeline is placed,
+// all other pipelines using one of its modules follow before we move on to modules seen earlier.
+// Modules then tend to be used while they are still resident in the shader module cache.
+static void sort_hashes_by_module_affinity(vector<Hash> &hashes, ResourceTag tag, DatabaseInterface &iface)
 {
-	rapidjson::Document doc;
-	doc.SetArray();
-	auto &alloc = doc.GetAllocator();
+	vector<vector<Hash>> pipeline_modules(hashes.size());
+	unordered_map<Hash, vector<size_t>> module_pipelines;
+	vector<char> json_buffer;
 
-	for (auto &sp : foz_paths)
+	for (size_t i = 0; i < hashes.size(); i++)
 	{
-		rapidjson::Document tmp_doc;
-		if (!parse_json_stats(sp, tmp_doc))
+		get_pipeline_stage_modules(tag, hashes[i], iface, json_buffer, pipeline_modules[i]);
+		for (auto module : pipeline_modules[i])
+			if (module != 0)
+				module_pipelines[module].push_back(i);
+	}
+
+	vector<Hash> sorted;
+	sorted.reserve(hashes.size());
+	vector<bool> placed(hashes.size());
+	unordered_set<Hash> visited_modules;
+	vector<Hash> module_stack;
+
+	const auto place_pipeline = [&](size_t index) {
+		placed[index] = true;
+		sorted.push_back(hashes[index]);
+		// Push in reverse so the first stage's module is visited first.
+		for (auto itr = pipeline_modules[index].rbegin(); itr != pipeline_modules[index].rend(); ++itr)
+			if (*itr != 0 && !visited_modules.count(*itr))
+				module_stack.push_back(*itr);
+	};
+
+	for (size_t i = 0; i < hashes.size(); i++)
+	{
+		if (placed[i])
 			continue;
 
-		doc.Reserve(doc.Size() + tmp_doc.Size(), alloc);
-		for (auto itr = tmp_doc.Begin(); itr != tmp_doc.End(); itr++)
+		place_pipeline(i);
+		while (!module_stack.empty())
 		{
-			rapidjson::Value v;
-			v.CopyFrom(*itr, alloc);
-			doc.PushBack(v, alloc);
+			Hash module = module_stack.back();
+			module_stack.pop_back();
+			if (!visited_modules.insert(module).second)
+				continue;
+
+			// Pipelines keep their original relative order within a module.
+			for (auto index : module_pipelines[module])
+				if (!placed[index])
+					place_pipeline(index);
 		}
-		remove(sp.c_str());
 	}
 
-	stats_to_csv(stats_path, doc);
-}
-#endif
-
-static void dump_stats(const std::string &stats_path)
-{
-	rapidjson::Document doc;
-	auto foz_path = stats_path + ".__tmp.foz";
-
-	if (!parse_json_stats(foz_path, doc))
-		return;
-	stats_to_csv(stats_path, doc);
-	remove(foz_path.c_str());
+	hashes = move(sorted);
 }
 
-#ifndef NO_ROBUST_REPLAYER
-static void install_trivial_crash_handlers(ThreadedReplayer &replayer);
-#endif
-
-static void populate_blob_hash_set(std::unordered_set<Hash> &hashes, ResourceTag tag, DatabaseInterface &iface)
+// Lets the shader module cache know how many of the pipelines we are about to replay use each module.
+static void count_shader_module_uses(ThreadedReplayer &replayer, ResourceTag tag, const vector<Hash> &hashes,
+                                     DatabaseInterface &iface)
 {
-	std::vector<Hash> remove_hashes;
-	size_t count;
-	if (!iface.get_hash_list_for_resource_tag(tag, &count, nullptr))
-		return;
-	if (count == 0)
-		return;
-	remove_hashes.resize(count);
-	if (!iface.get_hash_list_for_resource_tag(tag, &count, remove_hashes.data()))
-		return;
+	vector<char> json_buffer;
+	vector<Hash> modules;
+	for (auto hash : hashes)
+	{
+		// Cached and memoized unsupported pipelines are skipped by the replayer and never release their uses.
+		if (replayer.is_cached_blob(tag, hash) || replayer.is_unsupported_blob(tag, hash))
+			continue;
 
-	hashes.reserve(count);
-	for (auto h : remove_hashes)
-		hashes.insert(h);
+		get_pipeline_stage_modules(tag, hash, iface, json_buffer, modules);
+		for (auto module : modules)
+			if (module != 0)
+				replayer.shader_modules.add_remaining_uses(module, 1);
+	}
 }
 
 static int run_normal_process(ThreadedReplayer &replayer, const vector<const char *> &databases,
@@ -2966,6 +6505,7 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	state_replayer.set_resolve_shader_module_handles(false);
 	replayer.global_replayer = &state_replayer;
 	replayer.global_database = resolver.get();
+	replayer.database_index_bytes = resolver->get_lookup_memory_usage();
 
 	if (!replayer.init_implicit_whitelist())
 	{
@@ -3002,6 +6542,10 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 
 	for (auto &tag : initial_playback_order)
 	{
+		// Workers replay these when a pipeline first refers to them, so pipelines can be queued right away.
+		if (tag != RESOURCE_APPLICATION_INFO && replayer.opts.lazy_trivial_objects)
+			continue;
+
 		auto main_thread_start = std::chrono::steady_clock::now();
 		size_t tag_total_size = 0;
 		size_t tag_total_size_compressed = 0;
@@ -3021,33 +6565,39 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 			return EXIT_FAILURE;
 		}
 
-		for (auto &hash : resource_hashes)
+		// The application info entry is keyed on the application feature hash,
+		// so the device is created for the selected application.
+		if (tag == RESOURCE_APPLICATION_INFO && replayer.opts.filter_application_hash)
 		{
-			size_t state_json_size = 0;
-			if (!resolver->read_entry(tag, hash, &state_json_size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
-			{
-				LOGE("Failed to load blob from cache.\n");
-				return EXIT_FAILURE;
-			}
-			tag_total_size_compressed += state_json_size;
+			resource_hashes.erase(remove_if(begin(resource_hashes), end(resource_hashes), [&](Hash hash) {
+				return hash != replayer.opts.filter_application_hash;
+			}), end(resource_hashes));
+		}
 
-			if (!resolver->read_entry(tag, hash, &state_json_size, nullptr, 0))
+		// The application info creates the device, so it always goes first on its own.
+		unsigned num_parse_threads = min(replayer.opts.num_threads,
+		                                 unsigned(resource_hashes.size() / MIN_MAIN_THREAD_OBJECTS_PER_THREAD));
+		if (tag != RESOURCE_APPLICATION_INFO && num_parse_threads > 1)
+		{
+			if (!replay_main_thread_objects_threaded(state_replayer, replayer, *resolver, tag, tag_names[tag],
+			                                         resource_hashes, num_parse_threads,
+			                                         &tag_total_size, &tag_total_size_compressed))
 			{
 				LOGE("Failed to load blob from cache.\n");
 				return EXIT_FAILURE;
 			}
-
-			state_json.resize(state_json_size);
-			tag_total_size += state_json_size;
-
-			if (!resolver->read_entry(tag, hash, &state_json_size, state_json.data(), 0))
+		}
+		else
+		{
+			for (auto &hash : resource_hashes)
 			{
-				LOGE("Failed to load blob from cache.\n");
-				return EXIT_FAILURE;
+				if (!replay_main_thread_object(state_replayer, replayer, *resolver, tag, tag_names[tag], hash, 0,
+				                               state_json, &tag_total_size, &tag_total_size_compressed))
+				{
+					LOGE("Failed to load blob from cache.\n");
+					return EXIT_FAILURE;
+				}
 			}
-
-			if (!state_replayer.parse(replayer, resolver.get(), state_json.data(), state_json.size()))
-				LOGW("Did not replay blob (tag: %s, hash: %016" PRIx64 "). See previous logs for context.\n", tag_names[tag], hash);
 		}
 
 		if (tag == RESOURCE_APPLICATION_INFO)
@@ -3066,8 +6616,32 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 		LOGI("Total time decoding %s in main thread: %.3f s\n", tag_names[tag], duration * 1e-9);
 	}
 
+	if (replayer.opts.on_warmup_complete_callback && !replayer.opts.on_warmup_complete_callback(&replayer))
+		return EXIT_SUCCESS;
+
 	// Now we've laid the initial ground work, kick off worker threads.
 	replayer.start_worker_threads();
+	replayer.publish_tracked_memory();
+
+#ifdef FOSSILIZE_REPLAYER_SPIRV_VAL
+	// When this process replays the whole archive, every module will be needed, so start on all of them.
+	// Otherwise, modules are queued as the pipelines which need them are parsed.
+	if (replayer.opts.spirv_validate && replayer.opts.pipeline_hash == 0)
+	{
+		vector<Hash> module_hashes;
+		size_t module_count = 0;
+		if (replayer.opts.start_graphics_index == 0 && replayer.opts.end_graphics_index == ~0u &&
+		    replayer.opts.start_compute_index == 0 && replayer.opts.end_compute_index == ~0u &&
+		    replayer.opts.shard_count == 0 && replayer.opts.filter_application_hash == 0 &&
+		    resolver->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &module_count, nullptr))
+		{
+			module_hashes.resize(module_count);
+			if (!resolver->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &module_count, module_hashes.data()))
+				module_hashes.clear();
+		}
+		replayer.start_spirv_validation_pool(module_hashes);
+	}
+#endif
 
 	vector<Hash> graphics_hashes;
 	vector<Hash> compute_hashes;
@@ -3097,6 +6671,19 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	}
 	else
 	{
+		if (replayer.opts.prioritize_hot_pipelines && !load_pipeline_usage(state_replayer, replayer, *resolver))
+		{
+			LOGE("Failed to load pipeline usage.\n");
+			return EXIT_FAILURE;
+		}
+
+		if (!replayer.opts.pipeline_cost_history_path.empty() &&
+		    !load_pipeline_cost_history(replayer.opts.pipeline_cost_history_path, replayer))
+		{
+			LOGE("Failed to load pipeline cost history from %s.\n", replayer.opts.pipeline_cost_history_path.c_str());
+			return EXIT_FAILURE;
+		}
+
 		for (auto &tag : threaded_playback_order)
 		{
 			size_t tag_total_size = 0;
@@ -3143,11 +6730,34 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 				return EXIT_FAILURE;
 			}
 
+			// The pipeline ranges index into this node's selection, not the full database.
+			if (replayer.opts.shard_count || replayer.opts.filter_application_hash)
+			{
+				filter_hashes_by_application(*hashes, tag, replayer.opts.filter_application_hash, *resolver);
+				filter_hashes_by_shard(*hashes, replayer.opts.shard_index, replayer.opts.shard_count);
+				end_index = min(end_index, unsigned(hashes->size()));
+				start_index = min(end_index, start_index);
+				if (tag == RESOURCE_GRAPHICS_PIPELINE)
+					graphics_start_index = start_index;
+				else
+					compute_start_index = start_index;
+			}
+
+			// Sort before carving out the range, so every replayer process agrees on pipeline indices.
+			// Usage goes last, so expensive pipelines only break ties between equally hot ones.
+			// The weighted sorts are stable, so module clusters survive among pipelines of equal weight.
+			if (replayer.opts.module_affinity_order)
+				sort_hashes_by_module_affinity(*hashes, tag, *resolver);
+			if (replayer.opts.prioritize_expensive_pipelines)
+				sort_hashes_by_cost(*hashes, tag, *resolver, replayer.pipeline_cost_history[tag]);
+			if (replayer.opts.prioritize_hot_pipelines)
+				sort_hashes_by_weight(*hashes, replayer.pipeline_usage[tag]);
+
 			move(begin(*hashes) + start_index, begin(*hashes) + end_index, begin(*hashes));
 			hashes->erase(begin(*hashes) + (end_index - start_index), end(*hashes));
 
-			if (replayer.replayer_cache_db)
-				populate_blob_hash_set(replayer.cached_blobs[tag], tag, *replayer.replayer_cache_db);
+			if (replayer.opts.shader_cache_policy == ObjectCacheEvictionPolicy::FewestRemainingUses)
+				count_shader_module_uses(replayer, tag, *hashes, *resolver);
 
 			for (auto &hash : *hashes)
 			{
@@ -3192,10 +6802,21 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 		return a.order_index < b.order_index;
 	});
 
+	// Once the budget runs out, don't bother parsing the remaining chunks. Workers skip whatever is still queued.
 	for (auto &work : graphics_workload)
+	{
+		if (replayer.time_budget.exhausted())
+			break;
 		work.func();
+		replayer.flush_work_items();
+	}
 	for (auto &work : compute_workload)
+	{
+		if (replayer.time_budget.exhausted())
+			break;
 		work.func();
+		replayer.flush_work_items();
+	}
 
 	// VALVE: drain all outstanding pipeline compiles
 	replayer.sync_worker_threads();
@@ -3221,7 +6842,8 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	LOGI("Opening archive took %ld ms:\n", elapsed_ms_read_archive);
 	LOGI("Parsing archive took %ld ms:\n", elapsed_ms_prepare);
 
-	if (!replayer.opts.on_disk_pipeline_cache_path.empty() && replayer.device->pipeline_feedback_enabled())
+	if (replayer.use_pipeline_cache_probe ||
+	    (!replayer.opts.on_disk_pipeline_cache_path.empty() && replayer.device->pipeline_feedback_enabled()))
 	{
 		LOGI("Pipeline cache hits reported: %u\n", replayer.pipeline_cache_hits.load());
 		LOGI("Pipeline cache misses reported: %u\n", replayer.pipeline_cache_misses.load());
@@ -3238,6 +6860,29 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	     replayer.graphics_pipeline_count.load(),
 	     replayer.graphics_pipeline_ns.load() * 1e-9);
 
+	if (replayer.use_inline_shader_modules)
+		LOGI("Shader modules were passed inline to pipeline creation, no VkShaderModules were created\n");
+
+	if (replayer.use_graphics_pipeline_library)
+	{
+		LOGI("Linked %u graphics pipelines from %u pipeline libraries (%u library cache hits)\n",
+		     replayer.graphics_linked_pipeline_count.load(),
+		     replayer.graphics_library_count.load(),
+		     replayer.graphics_library_hits.load());
+	}
+
+	if (replayer.pipeline_binary_db)
+		LOGI("Captured %u pipeline binaries.\n", replayer.pipeline_binary_count.load());
+
+	if (replayer.time_budget.exhausted())
+	{
+		LOGI("Time budget ran out, %u queued pipelines were left for a later session.\n",
+		     replayer.time_budget_skipped_count.load());
+	}
+
+	if (replayer.opts.shared_module_cache)
+		LOGI("Created %u shader modules from the shared module cache.\n", replayer.shared_module_cache_hits.load());
+
 	LOGI("Playing back %u compute pipelines took %.3f s (accumulated time)\n",
 	     replayer.compute_pipeline_count.load(),
 	     replayer.compute_pipeline_ns.load() * 1e-9);
@@ -3248,8 +6893,29 @@ static int run_normal_process(ThreadedReplayer &replayer, const vector<const cha
 	LOGI("Threads were active in total for %.3f s (accumulated time)\n",
 	     replayer.thread_total_ns.load() * 1e-9);
 
+	LOGI("Replayed with %u pipeline memory contexts, drained early %u times due to memory pressure.\n",
+	     replayer.num_pipeline_memory_contexts, replayer.memory_pressure_drain_count);
+	for (unsigned i = 0; i < replayer.num_pipeline_memory_contexts; i++)
+		LOGI("Waited for pipeline memory context %u for %.3f s\n", i, replayer.memory_context_stall_ns[i] * 1e-9);
+	LOGI("Waited for parent pipeline memory context for %.3f s\n",
+	     replayer.memory_context_stall_ns[PARENT_PIPELINE_MEMORY_CONTEXT] * 1e-9);
+	LOGI("Waited for shader module memory context for %.3f s\n",
+	     replayer.memory_context_stall_ns[SHADER_MODULE_MEMORY_CONTEXT] * 1e-9);
+
 	LOGI("Total peak memory consumption by parser: %.3f MB.\n",
 	     (replayer.total_peak_memory.load() + state_replayer.get_allocator().get_peak_memory_consumption()) * 1e-6);
+	LOGI("Parser scratch blocks: %zu allocated, %zu reused.\n",
+	     replayer.scratch_block_allocations.load(), replayer.scratch_block_reuses.load());
+	if (replayer.feature_filter_memo_db)
+		LOGI("Objects skipped by memoized feature filter results: %u.\n", replayer.feature_filter_memo_hits.load());
+
+	LOGI("Memory used by database lookup tables: %.3f MB.\n",
+	     resolver->get_lookup_memory_usage() * 1e-6);
+
+	if (!replayer.opts.benchmark_report_path.empty())
+		append_benchmark_report_samples(replayer);
+	if (!replayer.opts.trace_path.empty())
+		append_trace_events(replayer);
 
 	LOGI("Replayed %lu objects in %ld ms:\n", total_size, elapsed_ms);
 	LOGI("  samplers:              %7lu\n", (unsigned long)replayer.samplers.size());
@@ -3294,20 +6960,25 @@ int main(int argc, char *argv[])
 	const char *shm_name = nullptr;
 	const char *shm_mutex_name = nullptr;
 	const char *metadata_name = nullptr;
+	const char *replayer_cache_metadata_name = nullptr;
 #else
 	int shmem_fd = -1;
 	int control_fd = -1;
+	int progress_fd = -1;
 #endif
 #endif
 
 	bool log_memory = false;
+	const char *merge_pipeline_cache_path = nullptr;
 
 	CLICallbacks cbs;
 	cbs.default_handler = [&](const char *arg) { databases.push_back(arg); };
 	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
 	cbs.add("--device-index", [&](CLIParser &parser) { opts.device_index = parser.next_uint(); });
+	cbs.add("--replay-device-index", [&](CLIParser &parser) { replayer_opts.device_indices.push_back(parser.next_uint()); });
 	cbs.add("--enable-validation", [&](CLIParser &) { opts.enable_validation = true; });
 	cbs.add("--spirv-val", [&](CLIParser &) { replayer_opts.spirv_validate = true; });
+	cbs.add("--spirv-val-threads", [&](CLIParser &parser) { replayer_opts.spirv_validation_threads = parser.next_uint(); });
 	cbs.add("--on-disk-pipeline-cache", [&](CLIParser &parser) { replayer_opts.on_disk_pipeline_cache_path = parser.next_string(); });
 	cbs.add("--on-disk-validation-cache", [&](CLIParser &parser) {
 		replayer_opts.on_disk_validation_cache_path = parser.next_string();
@@ -3360,6 +7031,8 @@ int main(int argc, char *argv[])
 		replayer_opts.end_compute_index = parser.next_uint();
 	});
 	cbs.add("--enable-pipeline-stats", [&](CLIParser &parser) { replayer_opts.pipeline_stats_path = parser.next_string(); });
+	cbs.add("--benchmark-report", [&](CLIParser &parser) { replayer_opts.benchmark_report_path = parser.next_string(); });
+	cbs.add("--trace", [&](CLIParser &parser) { replayer_opts.trace_path = parser.next_string(); });
 
 #ifndef NO_ROBUST_REPLAYER
 	cbs.add("--quiet-slave", [&](CLIParser &) { quiet_slave = true; });
@@ -3372,14 +7045,104 @@ int main(int argc, char *argv[])
 	cbs.add("--shm-name", [&](CLIParser &parser) { shm_name = parser.next_string(); });
 	cbs.add("--shm-mutex-name", [&](CLIParser &parser) { shm_mutex_name = parser.next_string(); });
 	cbs.add("--metadata-name", [&](CLIParser &parser) { metadata_name = parser.next_string(); });
+	cbs.add("--replayer-cache-metadata-name", [&](CLIParser &parser) { replayer_cache_metadata_name = parser.next_string(); });
+	cbs.add("--worker-slot", [&](CLIParser &parser) { replayer_opts.worker_slot_offset = parser.next_uint(); });
+	cbs.add("--job-memory-limit", [&](CLIParser &parser) { replayer_opts.job_memory_limit_mb = parser.next_uint(); });
 #else
 	cbs.add("--shmem-fd", [&](CLIParser &parser) { shmem_fd = parser.next_uint(); });
 	cbs.add("--control-fd", [&](CLIParser &parser) { control_fd = parser.next_uint(); });
+	cbs.add("--progress-fd", [&](CLIParser &parser) { progress_fd = parser.next_uint(); });
 #endif
 #endif
 
 	cbs.add("--shader-cache-size", [&](CLIParser &parser) { replayer_opts.shader_cache_size_mb = parser.next_uint(); });
+	cbs.add("--pipeline-batch-size", [&](CLIParser &parser) { replayer_opts.pipeline_batch_size = max(parser.next_uint(), 1u); });
+	cbs.add("--shared-module-cache", [&](CLIParser &parser) { replayer_opts.shared_module_cache_mb = parser.next_uint(); });
+	cbs.add("--spare-processes", [&](CLIParser &) { replayer_opts.spare_processes = true; });
+	cbs.add("--cgroup", [&](CLIParser &parser) { replayer_opts.cgroup_path = parser.next_string(); });
+	cbs.add("--cgroup-memory-high", [&](CLIParser &parser) { replayer_opts.cgroup_memory_high_mb = parser.next_uint(); });
+	cbs.add("--cgroup-cpu-weight", [&](CLIParser &parser) {
+		replayer_opts.cgroup_cpu_weight = parser.next_uint();
+		if (replayer_opts.cgroup_cpu_weight < 1 || replayer_opts.cgroup_cpu_weight > 10000)
+		{
+			LOGE("cgroup CPU weight must be in range [1, 10000].\n");
+			exit(EXIT_FAILURE);
+		}
+	});
+	cbs.add("--shard", [&](CLIParser &parser) {
+		replayer_opts.shard_index = parser.next_uint();
+		replayer_opts.shard_count = parser.next_uint();
+		if (replayer_opts.shard_index >= replayer_opts.shard_count)
+		{
+			LOGE("Shard index must be smaller than shard count.\n");
+			exit(EXIT_FAILURE);
+		}
+	});
+	cbs.add("--filter-application", [&](CLIParser &parser) {
+		replayer_opts.filter_application_hash = strtoull(parser.next_string(), nullptr, 16);
+	});
+	cbs.add("--time-budget", [&](CLIParser &parser) { replayer_opts.time_budget_seconds = parser.next_uint(); });
+	cbs.add("--merge-pipeline-caches", [&](CLIParser &parser) { merge_pipeline_cache_path = parser.next_string(); });
+	cbs.add("--memory-contexts", [&](CLIParser &parser) {
+		replayer_opts.pipeline_memory_contexts = parser.next_uint();
+		if (replayer_opts.pipeline_memory_contexts > MAX_PIPELINE_MEMORY_CONTEXTS)
+		{
+			LOGE("--memory-contexts must be at most %u.\n", unsigned(MAX_PIPELINE_MEMORY_CONTEXTS));
+			exit(EXIT_FAILURE);
+		}
+	});
+	cbs.add("--shader-cache-policy", [&](CLIParser &parser) {
+		const char *policy = parser.next_string();
+		if (strcmp(policy, "lru") == 0)
+			replayer_opts.shader_cache_policy = ObjectCacheEvictionPolicy::LeastRecentlyUsed;
+		else if (strcmp(policy, "remaining-uses") == 0)
+			replayer_opts.shader_cache_policy = ObjectCacheEvictionPolicy::FewestRemainingUses;
+		else
+		{
+			LOGE("Unknown shader cache policy: %s.\n", policy);
+			exit(EXIT_FAILURE);
+		}
+	});
+	cbs.add("--worker-cpus", [&](CLIParser &parser) {
+		const char *list = parser.next_string();
+		if (!parse_cpu_list(list, replayer_opts.worker_cpus))
+		{
+			LOGE("Invalid CPU list: %s.\n", list);
+			exit(EXIT_FAILURE);
+		}
+	});
+	cbs.add("--adaptive-workers", [&](CLIParser &) { replayer_opts.adaptive_workers = true; });
+	cbs.add("--numa-local-workers", [&](CLIParser &) { replayer_opts.numa_local_workers = true; });
+	cbs.add("--worker-priority", [&](CLIParser &parser) {
+		const char *priority = parser.next_string();
+		if (strcmp(priority, "normal") == 0)
+			replayer_opts.worker_priority = WorkerPriority::Normal;
+		else if (strcmp(priority, "low") == 0)
+			replayer_opts.worker_priority = WorkerPriority::Low;
+		else if (strcmp(priority, "idle") == 0)
+			replayer_opts.worker_priority = WorkerPriority::Idle;
+		else
+		{
+			LOGE("Unknown worker priority: %s.\n", priority);
+			exit(EXIT_FAILURE);
+		}
+	});
 	cbs.add("--ignore-derived-pipelines", [&](CLIParser &) { replayer_opts.ignore_derived_pipelines = true; });
+	cbs.add("--prioritize-hot-pipelines", [&](CLIParser &) { replayer_opts.prioritize_hot_pipelines = true; });
+	cbs.add("--prioritize-expensive-pipelines", [&](CLIParser &) { replayer_opts.prioritize_expensive_pipelines = true; });
+	cbs.add("--module-affinity-order", [&](CLIParser &) { replayer_opts.module_affinity_order = true; });
+	cbs.add("--lazy-trivial-objects", [&](CLIParser &) { replayer_opts.lazy_trivial_objects = true; });
+	cbs.add("--scratch-huge-pages", [&](CLIParser &) { replayer_opts.scratch_huge_pages = true; });
+	cbs.add("--graphics-pipeline-library", [&](CLIParser &) { replayer_opts.graphics_pipeline_library = true; });
+	cbs.add("--inline-shader-modules", [&](CLIParser &) { replayer_opts.inline_shader_modules = true; });
+	cbs.add("--probe-pipeline-cache", [&](CLIParser &) { replayer_opts.probe_pipeline_cache = true; });
+	cbs.add("--pipeline-binary-archive", [&](CLIParser &parser) {
+		replayer_opts.pipeline_binary_archive_path = parser.next_string();
+	});
+	cbs.add("--pipeline-cost-history", [&](CLIParser &parser) {
+		replayer_opts.pipeline_cost_history_path = parser.next_string();
+		replayer_opts.prioritize_expensive_pipelines = true;
+	});
 	cbs.add("--log-memory", [&](CLIParser &) { log_memory = true; });
 	cbs.add("--null-device", [&](CLIParser &) { opts.null_device = true; });
 	cbs.add("--timeout-seconds", [&](CLIParser &parser) { replayer_opts.timeout_seconds = parser.next_uint(); });
@@ -3405,6 +7168,9 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (merge_pipeline_cache_path)
+		return merge_pipeline_caches(opts, merge_pipeline_cache_path, databases) ? EXIT_SUCCESS : EXIT_FAILURE;
+
 	if (replayer_opts.pipeline_hash != 0)
 	{
 		if (replayer_opts.start_graphics_index != 0u ||
@@ -3432,6 +7198,14 @@ int main(int argc, char *argv[])
 
 	if (replayer_opts.num_threads < 1)
 		replayer_opts.num_threads = 1;
+
+	// A ThreadedReplayer drives one device, spreading work over devices is done with one child process per device.
+	if (!replayer_opts.device_indices.empty() && !master_process && !progress)
+	{
+		LOGW("--replay-device-index requires --master-process, replaying on device %u only.\n", replayer_opts.device_indices.front());
+		opts.device_index = int(replayer_opts.device_indices.front());
+		replayer_opts.device_indices.clear();
+	}
 #endif
 
 	if (!replayer_opts.pipeline_stats_path.empty())
@@ -3445,6 +7219,32 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	// Benchmark samples and trace events are gathered per process and merged once replay is done.
+	// Child processes must not reset them, they may be restarted after a crash.
+	bool owns_process_outputs = true;
+	unsigned num_processes = 1;
+#ifndef NO_ROBUST_REPLAYER
+	if (slave_process || progress)
+		owns_process_outputs = false;
+	if (master_process)
+		num_processes = replayer_opts.num_threads;
+#endif
+	std::vector<std::string> benchmark_report_samples_paths;
+	std::vector<std::string> trace_events_paths;
+	if (owns_process_outputs && !replayer_opts.benchmark_report_path.empty())
+		benchmark_report_samples_paths = reset_process_output_paths(replayer_opts.benchmark_report_path, num_processes);
+	if (owns_process_outputs && !replayer_opts.trace_path.empty())
+		trace_events_paths = reset_process_output_paths(replayer_opts.trace_path, num_processes);
+
+	if (replayer_opts.time_budget_seconds)
+	{
+		// With a deadline, the pipelines which matter most should be done first.
+		if (!replayer_opts.prioritize_expensive_pipelines)
+			replayer_opts.prioritize_hot_pipelines = true;
+		if (replayer_opts.replayer_cache_path.empty() && owns_process_outputs)
+			LOGW("--time-budget is used without --replayer-cache, a later session cannot resume where this one stopped.\n");
+	}
+
 	int ret;
 #ifndef NO_ROBUST_REPLAYER
 	if (progress)
@@ -3460,13 +7260,14 @@ int main(int argc, char *argv[])
 #else
 		ret = run_master_process(opts, replayer_opts,
 		                         databases, whitelist_path, whitelist_mask,
-		                         quiet_slave, shmem_fd, control_fd);
+		                         quiet_slave, shmem_fd, control_fd, progress_fd);
 #endif
 	}
 	else if (slave_process)
 	{
 #ifdef _WIN32
-		ret = run_slave_process(opts, replayer_opts, databases, shm_name, shm_mutex_name, metadata_name);
+		ret = run_slave_process(opts, replayer_opts, databases, shm_name, shm_mutex_name, metadata_name,
+		                        replayer_cache_metadata_name);
 #else
 		ret = run_slave_process(opts, replayer_opts, databases);
 #endif
@@ -3516,5 +7317,17 @@ int main(int argc, char *argv[])
 			dump_stats(replayer_opts.pipeline_stats_path);
 	}
 
+	if (!benchmark_report_samples_paths.empty())
+		dump_benchmark_report(replayer_opts.benchmark_report_path, benchmark_report_samples_paths);
+	if (!trace_events_paths.empty())
+		dump_trace(replayer_opts.trace_path, trace_events_paths);
+
+#ifndef NO_ROBUST_REPLAYER
+	if (!replayer_opts.pipeline_binary_archive_path.empty() && master_process)
+		merge_pipeline_binary_archives(replayer_opts.pipeline_binary_archive_path, replayer_opts.num_threads);
+	if (!replayer_opts.on_disk_pipeline_cache_path.empty() && master_process && !opts.null_device)
+		merge_process_pipeline_caches(opts, replayer_opts, replayer_opts.on_disk_pipeline_cache_path, replayer_opts.num_threads);
+#endif
+
 	return ret;
 }
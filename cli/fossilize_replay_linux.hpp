@@ -59,10 +59,21 @@ static bool write_all(int fd, const char *str)
 static int run_slave_process(const VulkanDevice::Options &opts,
                              const ThreadedReplayer::Options &replayer_opts,
                              const vector<const char *> &databases);
+static bool receive_standby_pipeline_range(ThreadedReplayer *replayer);
+
+struct PipelineChunk
+{
+	unsigned start_graphics_index;
+	unsigned end_graphics_index;
+	unsigned start_compute_index;
+	unsigned end_compute_index;
+};
 
 namespace Global
 {
 static unordered_set<Hash> faulty_spirv_modules;
+static vector<PipelineChunk> pipeline_chunks;
+static size_t next_pipeline_chunk;
 static unsigned active_processes;
 static unsigned running_processes;
 static unsigned target_running_processes;
@@ -81,9 +92,19 @@ static VulkanDevice::Options device_options;
 static bool quiet_slave;
 static bool control_fd_is_sentinel;
 static int control_fd = -1;
+// eventfd owned by the ExternalReplayer client, written to when there is progress to report.
+static int progress_fd = -1;
+static TimeBudget time_budget;
+// Child processes are moved into this cgroup if --cgroup is used.
+static std::string cgroup_path;
+static int cgroup_procs_fd = -1;
+static int cgroup_events_fd = -1;
+static uint64_t cgroup_high_events;
 
 static SharedControlBlock *control_block;
 static int metadata_fd = -1;
+// Standby children which were killed because they were no longer useful. Reaped silently.
+static unordered_set<pid_t> retired_standby_pids;
 }
 
 struct ProcessProgress
@@ -98,16 +119,72 @@ struct ProcessProgress
 
 	int compute_progress = -1;
 	int graphics_progress = -1;
+	// Set once a child crashed inside a batched pipeline creation call.
+	// Later children for this range compile one pipeline at a time, so the faulty pipeline can be found.
+	bool crashed_in_pipeline_batch = false;
+	// Index into Global::pipeline_chunks of the range we are working on.
+	unsigned chunk_index = 0;
+	// Set by process_shutdown() if nothing is left to do in the current chunk.
+	bool finished_chunk = false;
+
+	// A child which has created its device and replayed the trivial objects, then blocks until it is handed
+	// a pipeline range over its stdin. It takes over right away when the running child crashes.
+	pid_t standby_pid = -1;
+	FILE *standby_crash_file = nullptr;
+	int standby_input_fd = -1;
+	// Set if a standby child died before it was used. We do not try again for this slot.
+	bool standby_failed = false;
 
 	bool process_once();
 	bool process_shutdown(int wstatus);
 	bool start_child_process();
+	bool start_standby_process();
+	void retire_standby_process();
+	bool standby_process_shutdown(pid_t wait_pid, int wstatus);
+	bool fork_child_process(bool standby, pid_t &child_pid, FILE *&child_crash_file, int &input_fd);
 	void parse(const char *cmd);
 
 	uint32_t index = 0;
 	bool stopped = false;
 };
 
+static void signal_progress_fd()
+{
+	if (Global::progress_fd < 0)
+		return;
+
+	uint64_t count = 1;
+	if (write(Global::progress_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		LOGW("Failed to signal progress eventfd.\n");
+}
+
+static void write_control_block_message(const char *msg)
+{
+	if (!shared_control_block_write(Global::control_block, msg, ControlBlockMessageSize))
+	{
+		LOGW("Control block message ring is full, dropping message.\n");
+		return;
+	}
+
+	if (shared_control_block_needs_wake(Global::control_block))
+		futex_wrapper_wake_all(reinterpret_cast<uint32_t *>(&Global::control_block->message_serial));
+	signal_progress_fd();
+}
+
+static void signal_progress_if_changed()
+{
+	static uint32_t last_signature;
+	if (!Global::control_block)
+		return;
+
+	uint32_t signature = shared_control_block_progress_signature(Global::control_block);
+	if (signature != last_signature)
+	{
+		last_signature = signature;
+		signal_progress_fd();
+	}
+}
+
 void ProcessProgress::parse(const char *cmd)
 {
 	if (strncmp(cmd, "CRASH", 5) == 0)
@@ -141,9 +218,7 @@ void ProcessProgress::parse(const char *cmd)
 			char buffer[ControlBlockMessageSize] = {};
 			strcpy(buffer, cmd);
 
-			futex_wrapper_lock(&Global::control_block->futex_lock);
-			shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
-			futex_wrapper_unlock(&Global::control_block->futex_lock);
+			write_control_block_message(buffer);
 		}
 	}
 	else if (strncmp(cmd, "GRAPHICS", 8) == 0)
@@ -158,9 +233,7 @@ void ProcessProgress::parse(const char *cmd)
 			{
 				char buffer[ControlBlockMessageSize];
 				sprintf(buffer, "GRAPHICS %d %" PRIx64 "\n", graphics_progress - 1, graphics_pipeline);
-				futex_wrapper_lock(&Global::control_block->futex_lock);
-				shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
-				futex_wrapper_unlock(&Global::control_block->futex_lock);
+				write_control_block_message(buffer);
 			}
 		}
 	}
@@ -176,12 +249,14 @@ void ProcessProgress::parse(const char *cmd)
 			{
 				char buffer[ControlBlockMessageSize];
 				sprintf(buffer, "COMPUTE %d %" PRIx64 "\n", compute_progress - 1, compute_pipeline);
-				futex_wrapper_lock(&Global::control_block->futex_lock);
-				shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
-				futex_wrapper_unlock(&Global::control_block->futex_lock);
+				write_control_block_message(buffer);
 			}
 		}
 	}
+	else if (strncmp(cmd, "BATCH", 5) == 0)
+	{
+		crashed_in_pipeline_batch = true;
+	}
 	else if (strncmp(cmd, "MODULE", 6) == 0)
 	{
 		auto hash = strtoull(cmd + 6, nullptr, 16);
@@ -193,9 +268,7 @@ void ProcessProgress::parse(const char *cmd)
 			char buffer[ControlBlockMessageSize] = {};
 			strcpy(buffer, cmd);
 
-			futex_wrapper_lock(&Global::control_block->futex_lock);
-			shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
-			futex_wrapper_unlock(&Global::control_block->futex_lock);
+			write_control_block_message(buffer);
 		}
 	}
 	else
@@ -236,10 +309,14 @@ bool ProcessProgress::process_shutdown(int wstatus)
 	Global::active_processes--;
 	auto wait_pid = pid;
 	pid = -1;
+	finished_chunk = false;
 
 	// If application exited in normal manner, we are done.
 	if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0)
+	{
+		finished_chunk = true;
 		return false;
+	}
 
 	if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGKILL)
 	{
@@ -278,18 +355,35 @@ bool ProcessProgress::process_shutdown(int wstatus)
 	start_compute_index = uint32_t(compute_progress);
 	if (start_graphics_index >= end_graphics_index && start_compute_index >= end_compute_index)
 	{
-		LOGE("Process index %u (PID: %d) crashed, but there is nothing more to replay.\n", index, wait_pid);
+		LOGE("Process index %u (PID: %d) crashed in pipeline chunk %u, but there is nothing more to replay.\n",
+		     index, wait_pid, chunk_index);
+		finished_chunk = true;
 		return false;
 	}
 	else
 	{
-		LOGE("Process index %u (PID: %d) crashed, but will retry.\n", index, wait_pid);
+		LOGE("Process index %u (PID: %d) crashed in pipeline chunk %u, but will retry.\n", index, wait_pid, chunk_index);
 		LOGE("  New graphics range (%u, %u)\n", start_graphics_index, end_graphics_index);
 		LOGE("  New compute range (%u, %u)\n", start_compute_index, end_compute_index);
 		return true;
 	}
 }
 
+static bool claim_next_pipeline_chunk(ProcessProgress &progress)
+{
+	if (Global::next_pipeline_chunk >= Global::pipeline_chunks.size())
+		return false;
+
+	auto &chunk = Global::pipeline_chunks[Global::next_pipeline_chunk];
+	progress.start_graphics_index = chunk.start_graphics_index;
+	progress.end_graphics_index = chunk.end_graphics_index;
+	progress.start_compute_index = chunk.start_compute_index;
+	progress.end_compute_index = chunk.end_compute_index;
+	progress.chunk_index = unsigned(Global::next_pipeline_chunk++);
+	progress.crashed_in_pipeline_batch = false;
+	return true;
+}
+
 static void send_faulty_modules_and_close(int fd)
 {
 	for (auto &m : Global::faulty_spirv_modules)
@@ -362,6 +456,11 @@ static void poll_self_child_memory_usage(const std::vector<ProcessProgress> &pro
 		{
 			Global::control_block->process_reserved_memory_mib[i].store(stats.resident_mib, std::memory_order_relaxed);
 			Global::control_block->process_shared_memory_mib[i].store(stats.shared_mib, std::memory_order_relaxed);
+
+			// The child publishes its own subsystem counters, forget them once it is gone.
+			if (processes[i - 1].pid < 0)
+				for (auto &subsystem : Global::control_block->process_subsystem_memory_kib[i])
+					subsystem.store(0, std::memory_order_relaxed);
 		}
 		else
 		{
@@ -377,19 +476,8 @@ static void poll_self_child_memory_usage(const std::vector<ProcessProgress> &pro
 	}
 }
 
-bool ProcessProgress::start_child_process()
+bool ProcessProgress::fork_child_process(bool standby, pid_t &child_pid, FILE *&child_crash_file, int &input_fd)
 {
-	graphics_progress = -1;
-	compute_progress = -1;
-	stopped = false;
-
-	if (start_graphics_index >= end_graphics_index &&
-	    start_compute_index >= end_compute_index)
-	{
-		// Nothing to do.
-		return true;
-	}
-
 	int crash_fds[2];
 	int input_fds[2];
 	if (pipe(crash_fds) < 0)
@@ -400,26 +488,21 @@ bool ProcessProgress::start_child_process()
 	pid_t new_pid = fork(); // Fork off a child.
 	if (new_pid > 0)
 	{
-		// We're the parent, keep track of the process in a thread to avoid a lot of complex multiplexing code.
-		crash_file = fdopen(crash_fds[0], "r");
-		if (!crash_file)
+		child_crash_file = fdopen(crash_fds[0], "r");
+		if (!child_crash_file)
 			return false;
-		pid = new_pid;
+		child_pid = new_pid;
 
-		send_faulty_modules_and_close(input_fds[1]);
-		close(crash_fds[1]);
-		close(input_fds[0]);
-		Global::active_processes++;
-
-		epoll_event event = {};
-		event.data.u32 = index;
-		event.events = EPOLLIN | EPOLLRDHUP;
-		if (epoll_ctl(Global::epoll_fd, EPOLL_CTL_ADD, fileno(crash_file), &event) < 0)
+		if (Global::cgroup_procs_fd >= 0)
 		{
-			LOGE("Failed to add file to epoll.\n");
-			return false;
+			char pid_str[16];
+			sprintf(pid_str, "%d", int(new_pid));
+			if (!write_all(Global::cgroup_procs_fd, pid_str))
+				LOGW("Failed to move child process %d into cgroup.\n", int(new_pid));
 		}
-
+		input_fd = input_fds[1];
+		close(crash_fds[1]);
+		close(input_fds[0]);
 		return true;
 	}
 	else if (new_pid == 0)
@@ -433,6 +516,12 @@ bool ProcessProgress::start_child_process()
 		close(Global::signal_fd);
 		close(Global::epoll_fd);
 		close(Global::timer_fd);
+		if (Global::progress_fd >= 0)
+			close(Global::progress_fd);
+		if (Global::cgroup_procs_fd >= 0)
+			close(Global::cgroup_procs_fd);
+		if (Global::cgroup_events_fd >= 0)
+			close(Global::cgroup_events_fd);
 		close(crash_fds[0]);
 		close(input_fds[1]);
 
@@ -463,6 +552,13 @@ bool ProcessProgress::start_child_process()
 		copy_opts.start_compute_index = start_compute_index;
 		copy_opts.end_compute_index = end_compute_index;
 		copy_opts.control_block = Global::control_block;
+		copy_opts.worker_slot_offset = index;
+		if (Global::time_budget.enabled)
+			copy_opts.time_budget_seconds = Global::time_budget.remaining_seconds();
+		if (crashed_in_pipeline_batch)
+			copy_opts.pipeline_batch_size = 1;
+		if (standby)
+			copy_opts.on_warmup_complete_callback = receive_standby_pipeline_range;
 		if (!copy_opts.on_disk_pipeline_cache_path.empty() && index != 0)
 		{
 			copy_opts.on_disk_pipeline_cache_path += ".";
@@ -481,19 +577,242 @@ bool ProcessProgress::start_child_process()
 			copy_opts.pipeline_stats_path += std::to_string(index);
 		}
 
-		exit(run_slave_process(Global::device_options, copy_opts, Global::databases));
+		if (!copy_opts.pipeline_binary_archive_path.empty() && index != 0)
+		{
+			copy_opts.pipeline_binary_archive_path += ".";
+			copy_opts.pipeline_binary_archive_path += std::to_string(index);
+		}
+
+		if (!copy_opts.benchmark_report_path.empty() && index != 0)
+		{
+			copy_opts.benchmark_report_path += ".";
+			copy_opts.benchmark_report_path += std::to_string(index);
+		}
+
+		if (!copy_opts.trace_path.empty() && index != 0)
+		{
+			copy_opts.trace_path += ".";
+			copy_opts.trace_path += std::to_string(index);
+		}
+
+		auto copy_device_opts = Global::device_options;
+		copy_device_opts.device_index = device_index_for_process(Global::device_options, copy_opts, index);
+		exit(run_slave_process(copy_device_opts, copy_opts, Global::databases));
 	}
 	else
 		return false;
 }
 
+static bool add_crash_file_to_epoll(FILE *file, uint32_t index)
+{
+	epoll_event event = {};
+	event.data.u32 = index;
+	event.events = EPOLLIN | EPOLLRDHUP;
+	if (epoll_ctl(Global::epoll_fd, EPOLL_CTL_ADD, fileno(file), &event) < 0)
+	{
+		LOGE("Failed to add file to epoll.\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool ProcessProgress::start_child_process()
+{
+	graphics_progress = -1;
+	compute_progress = -1;
+	stopped = false;
+
+	if (start_graphics_index >= end_graphics_index &&
+	    start_compute_index >= end_compute_index)
+	{
+		// Nothing to do.
+		return true;
+	}
+
+	// Past the deadline, neither crashed children nor new chunks are started. What is left is for a later session.
+	if (Global::time_budget.exhausted())
+		return true;
+
+	if (standby_pid > 0)
+	{
+		// Hand our range to the standby child. It already has a device, so it starts compiling right away.
+		// The hash list is terminated explicitly, since other children may hold on to the write end of the pipe.
+		char buffer[128];
+		sprintf(buffer, "RANGE %u %u %u %u %u\n", start_graphics_index, end_graphics_index,
+		        start_compute_index, end_compute_index, crashed_in_pipeline_batch ? 1u : 0u);
+		write_all(standby_input_fd, buffer);
+		for (auto &m : Global::faulty_spirv_modules)
+		{
+			sprintf(buffer, "%" PRIx64 "\n", m);
+			write_all(standby_input_fd, buffer);
+		}
+		write_all(standby_input_fd, "0\n");
+		close(standby_input_fd);
+
+		pid = standby_pid;
+		crash_file = standby_crash_file;
+		standby_pid = -1;
+		standby_crash_file = nullptr;
+		standby_input_fd = -1;
+	}
+	else
+	{
+		int input_fd = -1;
+		if (!fork_child_process(false, pid, crash_file, input_fd))
+			return false;
+		send_faulty_modules_and_close(input_fd);
+	}
+
+	// We're the parent, keep track of the process in a thread to avoid a lot of complex multiplexing code.
+	Global::active_processes++;
+	if (!add_crash_file_to_epoll(crash_file, index))
+		return false;
+
+	if (Global::base_replayer_options.spare_processes && !standby_failed && !start_standby_process())
+		LOGW("Failed to start standby process for process index %u.\n", index);
+
+	return true;
+}
+
+bool ProcessProgress::start_standby_process()
+{
+	return fork_child_process(true, standby_pid, standby_crash_file, standby_input_fd);
+}
+
+void ProcessProgress::retire_standby_process()
+{
+	if (standby_pid <= 0)
+		return;
+
+	kill(standby_pid, SIGKILL);
+	Global::retired_standby_pids.insert(standby_pid);
+	fclose(standby_crash_file);
+	close(standby_input_fd);
+	standby_pid = -1;
+	standby_crash_file = nullptr;
+	standby_input_fd = -1;
+}
+
+bool ProcessProgress::standby_process_shutdown(pid_t wait_pid, int wstatus)
+{
+	if (wait_pid != standby_pid)
+		return false;
+
+	LOGW("Standby process for process index %u (PID: %d) died before it was used (status %d). "
+	     "Crashes will start new processes from scratch.\n", index, wait_pid, wstatus);
+	fclose(standby_crash_file);
+	close(standby_input_fd);
+	standby_pid = -1;
+	standby_crash_file = nullptr;
+	standby_input_fd = -1;
+	standby_failed = true;
+	return true;
+}
+
 struct StallState
 {
 	int32_t dirty_pages_mib = 0;
 	int64_t io_stalled_us = 0;
 	int64_t timestamp_ns = 0;
+	uint64_t cgroup_high_events = 0;
 };
 
+static bool write_cgroup_file(const std::string &path, const char *value)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	bool ret = write_all(fd, value);
+	close(fd);
+	return ret;
+}
+
+// Number of times the cgroup went over memory.high and the kernel started throttling it.
+static bool read_cgroup_high_events(uint64_t &count)
+{
+	if (Global::cgroup_events_fd < 0)
+		return false;
+
+	char buffer[512];
+	ssize_t ret = pread(Global::cgroup_events_fd, buffer, sizeof(buffer) - 1, 0);
+	if (ret <= 0)
+		return false;
+	buffer[ret] = '\0';
+
+	const char *high = strstr(buffer, "high ");
+	if (!high)
+		return false;
+
+	errno = 0;
+	count = strtoull(high + 5, nullptr, 10);
+	return errno == 0;
+}
+
+static bool setup_replay_cgroup(const ThreadedReplayer::Options &opts)
+{
+	// Controllers must be enabled in the delegated group before our group gets their interface files.
+	// This fails if the delegated group has processes of its own, since cgroup v2 does not allow internal processes.
+	auto subtree_control = opts.cgroup_path + "/cgroup.subtree_control";
+	if (opts.cgroup_memory_high_mb && !write_cgroup_file(subtree_control, "+memory"))
+		LOGW("Failed to enable memory controller in %s.\n", opts.cgroup_path.c_str());
+	if (opts.cgroup_cpu_weight && !write_cgroup_file(subtree_control, "+cpu"))
+		LOGW("Failed to enable cpu controller in %s.\n", opts.cgroup_path.c_str());
+
+	auto path = opts.cgroup_path + "/fossilize-replay-" + std::to_string(getpid());
+	if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST)
+	{
+		LOGE("Failed to create cgroup %s (errno = %d).\n", path.c_str(), errno);
+		return false;
+	}
+	Global::cgroup_path = path;
+
+	if (opts.cgroup_memory_high_mb)
+	{
+		auto bytes = std::to_string(uint64_t(opts.cgroup_memory_high_mb) * 1024 * 1024);
+		if (!write_cgroup_file(Global::cgroup_path + "/memory.high", bytes.c_str()))
+			LOGW("Failed to set memory.high for %s.\n", Global::cgroup_path.c_str());
+	}
+
+	if (opts.cgroup_cpu_weight)
+	{
+		auto weight = std::to_string(opts.cgroup_cpu_weight);
+		if (!write_cgroup_file(Global::cgroup_path + "/cpu.weight", weight.c_str()))
+			LOGW("Failed to set cpu.weight for %s.\n", Global::cgroup_path.c_str());
+	}
+
+	Global::cgroup_procs_fd = open((Global::cgroup_path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+	if (Global::cgroup_procs_fd < 0)
+	{
+		LOGE("Failed to open cgroup.procs in %s.\n", Global::cgroup_path.c_str());
+		return false;
+	}
+
+	Global::cgroup_events_fd = open((Global::cgroup_path + "/memory.events").c_str(), O_RDONLY | O_CLOEXEC);
+	if (Global::cgroup_events_fd >= 0)
+		read_cgroup_high_events(Global::cgroup_high_events);
+	else if (opts.cgroup_memory_high_mb)
+		LOGW("Failed to open memory.events in %s, cannot react to memory pressure.\n", Global::cgroup_path.c_str());
+
+	LOGI("Replaying in cgroup %s.\n", Global::cgroup_path.c_str());
+	return true;
+}
+
+static void teardown_replay_cgroup()
+{
+	if (Global::cgroup_procs_fd >= 0)
+		close(Global::cgroup_procs_fd);
+	if (Global::cgroup_events_fd >= 0)
+		close(Global::cgroup_events_fd);
+	Global::cgroup_procs_fd = -1;
+	Global::cgroup_events_fd = -1;
+
+	// Only works once every child has been reaped.
+	if (!Global::cgroup_path.empty() && rmdir(Global::cgroup_path.c_str()) < 0)
+		LOGW("Failed to remove cgroup %s.\n", Global::cgroup_path.c_str());
+	Global::cgroup_path.clear();
+}
+
 static bool get_dirty_page_info(StallState &state)
 {
 	FILE *file = fopen("/proc/meminfo", "r");
@@ -562,6 +881,7 @@ static bool poll_stall_information(StallState &state)
 		state.dirty_pages_mib = -1;
 	if (!get_stall_info("/proc/pressure/io", state.io_stalled_us))
 		state.io_stalled_us = -1;
+	read_cgroup_high_events(state.cgroup_high_events);
 
 	timespec ts = {};
 	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
@@ -618,6 +938,11 @@ static void manage_thrashing_behavior(std::vector<ProcessProgress> &child_proces
 			go_up = true;
 	}
 
+	// The memory.events handler already lowered the target when the cgroup hit memory.high.
+	// Do not raise it again until a tick passes without throttling.
+	if (new_state.cgroup_high_events != old_state.cgroup_high_events)
+		go_up = false;
+
 	// Ensure forward progress. Make at least one process active
 	// if we have had a period of complete sleep.
 	if (target_running_processes == 0)
@@ -756,18 +1081,54 @@ static int run_master_process(const VulkanDevice::Options &opts,
                               const ThreadedReplayer::Options &replayer_opts,
                               const vector<const char *> &databases,
                               const char *whitelist, uint32_t whitelist_mask,
-                              bool quiet_slave, int shmem_fd, int control_fd)
+                              bool quiet_slave, int shmem_fd, int control_fd, int progress_fd)
 {
 	Global::quiet_slave = quiet_slave;
+	Global::progress_fd = progress_fd;
 	Global::device_options = opts;
 	Global::base_replayer_options = replayer_opts;
+	Global::time_budget = TimeBudget(replayer_opts.time_budget_seconds);
 	Global::databases = databases;
 	unsigned processes = replayer_opts.num_threads;
 
+	// Standby processes open these archives for appending when they start, long before they are used.
+	// A crashed child can leave them in a state which the standby has not seen.
+	if (Global::base_replayer_options.spare_processes &&
+	    (Global::base_replayer_options.pipeline_stats || !Global::base_replayer_options.pipeline_binary_archive_path.empty()))
+	{
+		LOGW("Spare processes are not supported with pipeline stats or pipeline binary capture, disabling.\n");
+		Global::base_replayer_options.spare_processes = false;
+	}
+
 	// Split shader cache overhead across all processes.
 	Global::base_replayer_options.shader_cache_size_mb /= max(Global::base_replayer_options.num_threads, 1u);
 	Global::base_replayer_options.num_threads = 1;
 
+	// Child processes inherit the mapping through fork(), so it does not need a name or FD.
+	// Anonymous memory starts out zeroed, which is what the cache expects.
+	if (replayer_opts.shared_module_cache_mb)
+	{
+		size_t size = size_t(replayer_opts.shared_module_cache_mb) * 1024 * 1024;
+		void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (mapped != MAP_FAILED)
+		{
+			Global::base_replayer_options.shared_module_cache = SharedModuleCache::init(mapped, size);
+			if (!Global::base_replayer_options.shared_module_cache)
+				munmap(mapped, size);
+		}
+
+		if (!Global::base_replayer_options.shared_module_cache)
+			LOGE("Failed to create shared module cache, continuing without it.\n");
+	}
+
+	// Children inherit the FD through fork(), and each maps it when it sets up its replayer cache.
+	if (!replayer_opts.replayer_cache_path.empty())
+	{
+		char export_name[DatabaseInterface::OSHandleNameSize];
+		DatabaseInterface::get_unique_os_export_name(export_name, sizeof(export_name));
+		Global::base_replayer_options.replayer_cache_metadata = export_replayer_cache(opts, replayer_opts, export_name);
+	}
+
 	// Try to map the shared control block.
 	if (shmem_fd >= 0)
 	{
@@ -785,7 +1146,7 @@ static int run_master_process(const VulkanDevice::Options &opts,
 				Global::control_block = static_cast<SharedControlBlock *>(mapped);
 				if (Global::control_block->version_cookie != ControlBlockMagic ||
 				    Global::control_block->ring_buffer_offset < sizeof(SharedControlBlock) ||
-				    Global::control_block->ring_buffer_size == 0 ||
+				    Global::control_block->ring_buffer_size < sizeof(SharedControlBlockMessageSlot) ||
 				    !is_pot(Global::control_block->ring_buffer_size) ||
 				    Global::control_block->ring_buffer_offset + Global::control_block->ring_buffer_size > size_t(s.st_size))
 				{
@@ -844,14 +1205,14 @@ static int run_master_process(const VulkanDevice::Options &opts,
 				Global::control_block->metadata_shared_size_mib.store(uint32_t(s.st_size / (1024 * 1024)), std::memory_order_relaxed);
 		}
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &num_graphics_pipelines, nullptr))
+		if (!get_selected_pipeline_count(*db, RESOURCE_GRAPHICS_PIPELINE, replayer_opts, &num_graphics_pipelines))
 		{
 			for (auto &path : databases)
 				LOGE("Failed to parse database %s.\n", path);
 			return EXIT_FAILURE;
 		}
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &num_compute_pipelines, nullptr))
+		if (!get_selected_pipeline_count(*db, RESOURCE_COMPUTE_PIPELINE, replayer_opts, &num_compute_pipelines))
 		{
 			for (auto &path : databases)
 				LOGE("Failed to parse database %s.\n", path);
@@ -880,6 +1241,12 @@ static int run_master_process(const VulkanDevice::Options &opts,
 	if (Global::control_block)
 		Global::control_block->progress_started.store(1, std::memory_order_release);
 
+	if (!replayer_opts.cgroup_path.empty() && !setup_replay_cgroup(replayer_opts))
+	{
+		LOGW("Failed to set up cgroup, replaying without it.\n");
+		teardown_replay_cgroup();
+	}
+
 	Global::active_processes = 0;
 	StallState stall_state;
 	bool use_stall_state = poll_stall_information(stall_state);
@@ -923,7 +1290,8 @@ static int run_master_process(const VulkanDevice::Options &opts,
 	static constexpr uint32_t POLL_VALUE_SIGNAL_FD = UINT32_MAX;
 	static constexpr uint32_t POLL_VALUE_CONTROL_FD = UINT32_MAX - 1u;
 	static constexpr uint32_t POLL_VALUE_TIMER_FD = UINT32_MAX - 2u;
-	static constexpr uint32_t POLL_VALUE_MAX_CHILD = UINT32_MAX - 3u;
+	static constexpr uint32_t POLL_VALUE_CGROUP_EVENTS = UINT32_MAX - 3u;
+	static constexpr uint32_t POLL_VALUE_MAX_CHILD = UINT32_MAX - 4u;
 
 	{
 		epoll_event event = {};
@@ -964,6 +1332,16 @@ static int run_master_process(const VulkanDevice::Options &opts,
 		}
 	}
 
+	// cgroup files signal modification with EPOLLPRI.
+	if (Global::cgroup_events_fd >= 0)
+	{
+		epoll_event event = {};
+		event.events = EPOLLPRI;
+		event.data.u32 = POLL_VALUE_CGROUP_EVENTS;
+		if (epoll_ctl(Global::epoll_fd, EPOLL_CTL_ADD, Global::cgroup_events_fd, &event) < 0)
+			LOGW("Failed to add memory.events to epoll.\n");
+	}
+
 	// We can receive commands which can be used to dynamically adjust for various parameters.
 	if (control_fd >= 0)
 	{
@@ -989,14 +1367,32 @@ static int run_master_process(const VulkanDevice::Options &opts,
 	else
 		LOGI("Not using control_fd.\n");
 
+	// Rather than giving each process one fixed slice, pipelines are split into chunks which are handed out in order.
+	// A process which is done with its chunk is restarted on the next one, so a slice full of expensive
+	// or crashing pipelines does not leave the other processes idle at the end.
+	// Every chunk costs a process restart, so small archives keep one chunk per process.
+	static const unsigned MAX_CHUNKS_PER_PROCESS = 4;
+	static const size_t MIN_PIPELINES_PER_CHUNK = 2048;
+	size_t num_chunks = (num_graphics_pipelines + num_compute_pipelines) / MIN_PIPELINES_PER_CHUNK;
+	num_chunks = std::min<size_t>(num_chunks, processes * MAX_CHUNKS_PER_PROCESS);
+	num_chunks = std::max<size_t>(num_chunks, processes);
+
+	Global::pipeline_chunks.resize(num_chunks);
+	Global::next_pipeline_chunk = 0;
+	for (size_t i = 0; i < num_chunks; i++)
+	{
+		auto &chunk = Global::pipeline_chunks[i];
+		chunk.start_graphics_index = graphics_pipeline_offset + unsigned((i * num_graphics_pipelines) / num_chunks);
+		chunk.end_graphics_index = graphics_pipeline_offset + unsigned(((i + 1) * num_graphics_pipelines) / num_chunks);
+		chunk.start_compute_index = compute_pipeline_offset + unsigned((i * num_compute_pipelines) / num_chunks);
+		chunk.end_compute_index = compute_pipeline_offset + unsigned(((i + 1) * num_compute_pipelines) / num_chunks);
+	}
+
 	// fork() and pipe() strategy.
 	for (unsigned i = 0; i < processes; i++)
 	{
 		auto &progress = child_processes[i];
-		progress.start_graphics_index = graphics_pipeline_offset + (i * unsigned(num_graphics_pipelines)) / processes;
-		progress.end_graphics_index = graphics_pipeline_offset + ((i + 1) * unsigned(num_graphics_pipelines)) / processes;
-		progress.start_compute_index = compute_pipeline_offset + (i * unsigned(num_compute_pipelines)) / processes;
-		progress.end_compute_index = compute_pipeline_offset + ((i + 1) * unsigned(num_compute_pipelines)) / processes;
+		claim_next_pipeline_chunk(progress);
 		progress.index = i;
 		if (!progress.start_child_process())
 		{
@@ -1025,7 +1421,20 @@ static int run_master_process(const VulkanDevice::Options &opts,
 		for (int i = 0; i < ret; i++)
 		{
 			auto &e = events[i];
-			if (e.events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))
+			if (e.data.u32 == POLL_VALUE_CGROUP_EVENTS)
+			{
+				// The kernel is already reclaiming from our children, so back off right away
+				// instead of waiting for IO stalls to show up on the next tick.
+				uint64_t high_events = 0;
+				if (read_cgroup_high_events(high_events) && high_events != Global::cgroup_high_events)
+				{
+					Global::cgroup_high_events = high_events;
+					if (Global::target_running_processes > 1)
+						Global::target_running_processes--;
+					update_target_running_processes(child_processes);
+				}
+			}
+			else if (e.events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))
 			{
 				if (e.data.u32 <= POLL_VALUE_MAX_CHILD)
 				{
@@ -1085,15 +1494,34 @@ static int run_master_process(const VulkanDevice::Options &opts,
 
 							if (itr != end(child_processes))
 							{
-								if (itr->process_shutdown(wstatus) && !itr->start_child_process())
+								bool restart = itr->process_shutdown(wstatus);
+
+								// The standby is only used to recover from crashes. After a normal exit,
+								// the standby might have loaded on-disk caches which are now stale.
+								if (!restart)
+									itr->retire_standby_process();
+
+								// Move on to the next chunk if there is one.
+								if (!restart && itr->finished_chunk)
+									restart = claim_next_pipeline_chunk(*itr);
+
+								if (restart && !itr->start_child_process())
 								{
 									LOGE("Failed to start child process.\n");
 									return EXIT_FAILURE;
 								}
 								update_target_running_processes(child_processes);
 							}
-							else
-								LOGE("Got SIGCHLD from unknown process PID %d.\n", pid);
+							else if (Global::retired_standby_pids.erase(pid) == 0)
+							{
+								bool was_standby = false;
+								for (auto &progress : child_processes)
+									if (progress.standby_process_shutdown(pid, wstatus))
+										was_standby = true;
+
+								if (!was_standby)
+									LOGE("Got SIGCHLD from unknown process PID %d.\n", pid);
+							}
 						}
 					}
 				}
@@ -1115,6 +1543,7 @@ static int run_master_process(const VulkanDevice::Options &opts,
 							manage_thrashing_behavior(child_processes, stall_state, new_stall_state);
 						update_target_running_processes(child_processes);
 						poll_self_child_memory_usage(child_processes);
+						signal_progress_if_changed();
 					}
 				}
 			}
@@ -1133,8 +1562,16 @@ static int run_master_process(const VulkanDevice::Options &opts,
 		}
 	}
 
+	for (auto &progress : child_processes)
+		progress.retire_standby_process();
+	for (auto standby_pid : Global::retired_standby_pids)
+		waitpid(standby_pid, nullptr, 0);
+	Global::retired_standby_pids.clear();
+	teardown_replay_cgroup();
+
 	if (Global::control_block)
 		Global::control_block->progress_complete.store(1, std::memory_order_release);
+	signal_progress_fd();
 
 	return EXIT_SUCCESS;
 }
@@ -1165,6 +1602,11 @@ static void crash_handler(ThreadedReplayer &replayer, ThreadedReplayer::PerThrea
 {
 	char buffer[64];
 
+	// We don't know which pipeline in the batch is at fault, so there are no modules or pipeline hashes to report.
+	// Progress points to the start of the batch, so the next attempt will retry it without batching.
+	if (per_thread.in_pipeline_batch && !write_all(crash_fd, "BATCH\n"))
+		_exit(2);
+
 	// Report to parent process which VkShaderModule's might have contributed to our untimely death.
 	// This allows a new process to ignore these modules.
 	for (unsigned i = 0; i < per_thread.num_failed_module_hashes; i++)
@@ -1230,6 +1672,12 @@ static void report_failed_pipeline()
 			LOGE("Compute pipeline crashed or hung, hash: %016" PRIx64 ". Rerun with: --compute-pipeline-range %u %u.\n",
 			     per_thread->current_compute_pipeline, index, index + 1);
 		}
+		else if (per_thread->in_pipeline_batch)
+		{
+			LOGE("Crashed or hung in a batch of pipelines starting at graphics index %u, compute index %u. "
+			     "Rerun with: --pipeline-batch-size 1.\n",
+			     per_thread->current_graphics_index, per_thread->current_compute_index);
+		}
 	}
 }
 
@@ -1288,6 +1736,51 @@ static void thread_callback(void *)
 		LOGE("Failed to set signal mask.\n");
 }
 
+static void read_masked_shader_modules(ThreadedReplayer &replayer)
+{
+	// In slave mode, we can receive a list of shader module hashes we should ignore.
+	// This is to avoid trying to replay the same faulty shader modules again and again.
+	char ignored_shader_module_hash[16 + 2];
+	while (fgets(ignored_shader_module_hash, sizeof(ignored_shader_module_hash), stdin))
+	{
+		errno = 0;
+		auto hash = strtoull(ignored_shader_module_hash, nullptr, 16);
+		if (hash == 0)
+			break;
+		if (errno == 0)
+		{
+			//LOGE("Ignoring module %llx\n", hash);
+			replayer.mask_shader_module(Hash(hash));
+		}
+	}
+}
+
+static bool receive_standby_pipeline_range(ThreadedReplayer *replayer)
+{
+	// The master closes or kills us if we are never needed.
+	char range[128];
+	if (!fgets(range, sizeof(range), stdin))
+		return false;
+
+	unsigned start_graphics, end_graphics, start_compute, end_compute, single_pipeline_batch;
+	if (sscanf(range, "RANGE %u %u %u %u %u", &start_graphics, &end_graphics,
+	           &start_compute, &end_compute, &single_pipeline_batch) != 5)
+	{
+		LOGE("Standby process got unexpected message: %s\n", range);
+		return false;
+	}
+
+	replayer->opts.start_graphics_index = start_graphics;
+	replayer->opts.end_graphics_index = end_graphics;
+	replayer->opts.start_compute_index = start_compute;
+	replayer->opts.end_compute_index = end_compute;
+	if (single_pipeline_batch)
+		replayer->opts.pipeline_batch_size = 1;
+
+	read_masked_shader_modules(*replayer);
+	return true;
+}
+
 static int run_slave_process(const VulkanDevice::Options &opts,
                              const ThreadedReplayer::Options &replayer_opts,
                              const vector<const char *> &databases)
@@ -1307,21 +1800,9 @@ static int run_slave_process(const VulkanDevice::Options &opts,
 	ThreadedReplayer replayer(opts, tmp_opts);
 	replayer.robustness = true;
 
-	// In slave mode, we can receive a list of shader module hashes we should ignore.
-	// This is to avoid trying to replay the same faulty shader modules again and again.
-	char ignored_shader_module_hash[16 + 2];
-	while (fgets(ignored_shader_module_hash, sizeof(ignored_shader_module_hash), stdin))
-	{
-		errno = 0;
-		auto hash = strtoull(ignored_shader_module_hash, nullptr, 16);
-		if (hash == 0)
-			break;
-		if (errno == 0)
-		{
-			//LOGE("Ignoring module %llx\n", hash);
-			replayer.mask_shader_module(Hash(hash));
-		}
-	}
+	// Standby processes get the list along with their pipeline range once they are woken up.
+	if (!replayer_opts.on_warmup_complete_callback)
+		read_masked_shader_modules(replayer);
 
 	// Make sure that the driver cannot mess up the master process by writing random data to stdout.
 	crash_fd = dup(STDOUT_FILENO);
@@ -1373,11 +1854,9 @@ static int run_slave_process(const VulkanDevice::Options &opts,
 #if 0
 	if (Global::control_block)
 	{
-		futex_wrapper_lock(&Global::control_block->futex_lock);
 		char msg[ControlBlockMessageSize] = {};
 		sprintf(msg, "SLAVE_FINISHED\n");
-		shared_control_block_write(Global::control_block, msg, sizeof(msg));
-		futex_wrapper_unlock(&Global::control_block->futex_lock);
+		write_control_block_message(msg);
 	}
 #endif
 
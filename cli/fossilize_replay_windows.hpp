@@ -24,6 +24,8 @@
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <tlhelp32.h>
+#include <psapi.h>
 #include <io.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -61,10 +63,17 @@ static bool quiet_slave;
 static SharedControlBlock *control_block;
 static const char *shm_name;
 static const char *shm_mutex_name;
-static HANDLE shared_mutex;
+static HANDLE message_event;
 static HANDLE job_handle;
 static char metadata_export_name[DatabaseInterface::OSHandleNameSize];
 static HANDLE metadata_handle;
+static char replayer_cache_export_name[DatabaseInterface::OSHandleNameSize];
+static TimeBudget time_budget;
+
+// Throttling of child processes, see manage_thrashing_behavior().
+static HANDLE low_memory_notification;
+static unsigned running_processes;
+static unsigned target_running_processes;
 }
 
 struct ProcessProgress
@@ -83,6 +92,9 @@ struct ProcessProgress
 
 	int compute_progress = -1;
 	int graphics_progress = -1;
+	// Set once a child crashed inside a batched pipeline creation call.
+	// Later children for this range compile one pipeline at a time, so the faulty pipeline can be found.
+	bool crashed_in_pipeline_batch = false;
 
 	bool process_once();
 	bool process_shutdown();
@@ -91,6 +103,7 @@ struct ProcessProgress
 	bool kick_overlapped_io();
 
 	uint32_t index = 0;
+	bool stopped = false;
 };
 
 bool ProcessProgress::kick_overlapped_io()
@@ -109,6 +122,34 @@ bool ProcessProgress::kick_overlapped_io()
 	return true;
 }
 
+static void write_control_block_message(const char *msg)
+{
+	if (!shared_control_block_write(Global::control_block, msg, ControlBlockMessageSize))
+	{
+		LOGW("Control block message ring is full, dropping message.\n");
+		return;
+	}
+
+	// Clients can wait on the event directly through ExternalReplayer::get_progress_wait_handle(),
+	// so always signal it. Messages are rare.
+	if (Global::message_event)
+		SetEvent(Global::message_event);
+}
+
+static void signal_progress_if_changed()
+{
+	static uint32_t last_signature;
+	if (!Global::control_block || !Global::message_event)
+		return;
+
+	uint32_t signature = shared_control_block_progress_signature(Global::control_block);
+	if (signature != last_signature)
+	{
+		last_signature = signature;
+		SetEvent(Global::message_event);
+	}
+}
+
 void ProcessProgress::parse(const char *cmd)
 {
 	if (strncmp(cmd, "CRASH", 5) == 0)
@@ -139,11 +180,7 @@ void ProcessProgress::parse(const char *cmd)
 			char buffer[ControlBlockMessageSize] = {};
 			strcpy(buffer, cmd);
 
-			if (WaitForSingleObject(Global::shared_mutex, INFINITE) == WAIT_OBJECT_0)
-			{
-				shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
-				ReleaseMutex(Global::shared_mutex);
-			}
+			write_control_block_message(buffer);
 		}
 	}
 	else if (strncmp(cmd, "GRAPHICS", 8) == 0)
@@ -159,11 +196,7 @@ void ProcessProgress::parse(const char *cmd)
 				char buffer[ControlBlockMessageSize];
 				sprintf(buffer, "GRAPHICS %d %" PRIx64 "\n", graphics_progress - 1, graphics_pipeline);
 
-				if (WaitForSingleObject(Global::shared_mutex, INFINITE) == WAIT_OBJECT_0)
-				{
-					shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
-					ReleaseMutex(Global::shared_mutex);
-				}
+				write_control_block_message(buffer);
 			}
 		}
 	}
@@ -180,14 +213,14 @@ void ProcessProgress::parse(const char *cmd)
 				char buffer[ControlBlockMessageSize];
 				sprintf(buffer, "COMPUTE %d %" PRIx64 "\n", compute_progress - 1, compute_pipeline);
 
-				if (WaitForSingleObject(Global::shared_mutex, INFINITE) == WAIT_OBJECT_0)
-				{
-					shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
-					ReleaseMutex(Global::shared_mutex);
-				}
+				write_control_block_message(buffer);
 			}
 		}
 	}
+	else if (strncmp(cmd, "BATCH", 5) == 0)
+	{
+		crashed_in_pipeline_batch = true;
+	}
 	else if (strncmp(cmd, "MODULE", 6) == 0)
 	{
 		auto hash = strtoull(cmd + 6, nullptr, 16);
@@ -199,11 +232,7 @@ void ProcessProgress::parse(const char *cmd)
 			char buffer[ControlBlockMessageSize] = {};
 			strcpy(buffer, cmd);
 
-			if (WaitForSingleObject(Global::shared_mutex, INFINITE) == WAIT_OBJECT_0)
-			{
-				shared_control_block_write(Global::control_block, buffer, sizeof(buffer));
-				ReleaseMutex(Global::shared_mutex);
-			}
+			write_control_block_message(buffer);
 		}
 	}
 	else
@@ -353,6 +382,7 @@ bool ProcessProgress::start_child_process()
 {
 	graphics_progress = -1;
 	compute_progress = -1;
+	stopped = false;
 
 	if (start_graphics_index >= end_graphics_index && start_compute_index >= end_compute_index)
 	{
@@ -360,6 +390,10 @@ bool ProcessProgress::start_child_process()
 		return true;
 	}
 
+	// Past the deadline, crashed children are not restarted. What is left is for a later session.
+	if (Global::time_budget.exhausted())
+		return true;
+
 	// We cannot use fork() on Windows, so we need to create a new process which references ourselves.
 
 	char filename[MAX_PATH];
@@ -390,7 +424,7 @@ bool ProcessProgress::start_child_process()
 	cmdline += to_string(end_compute_index);
 
 	cmdline += " --device-index ";
-	cmdline += std::to_string(Global::device_options.device_index);
+	cmdline += std::to_string(device_index_for_process(Global::device_options, Global::base_replayer_options, index));
 
 	if (Global::device_options.enable_validation)
 		cmdline += " --enable-validation";
@@ -413,6 +447,12 @@ bool ProcessProgress::start_child_process()
 		cmdline += Global::metadata_export_name;
 	}
 
+	if (*Global::replayer_cache_export_name != '\0')
+	{
+		cmdline += " --replayer-cache-metadata-name ";
+		cmdline += Global::replayer_cache_export_name;
+	}
+
 	if (Global::base_replayer_options.spirv_validate)
 		cmdline += " --spirv-val";
 	if (Global::device_options.null_device)
@@ -469,6 +509,105 @@ bool ProcessProgress::start_child_process()
 	if (Global::base_replayer_options.ignore_derived_pipelines)
 		cmdline += " --ignore-derived-pipelines";
 
+	if (Global::base_replayer_options.prioritize_hot_pipelines)
+		cmdline += " --prioritize-hot-pipelines";
+
+	if (Global::base_replayer_options.prioritize_expensive_pipelines)
+		cmdline += " --prioritize-expensive-pipelines";
+
+	if (Global::base_replayer_options.module_affinity_order)
+		cmdline += " --module-affinity-order";
+
+	if (Global::base_replayer_options.lazy_trivial_objects)
+		cmdline += " --lazy-trivial-objects";
+
+	if (Global::base_replayer_options.scratch_huge_pages)
+		cmdline += " --scratch-huge-pages";
+
+	if (Global::base_replayer_options.graphics_pipeline_library)
+		cmdline += " --graphics-pipeline-library";
+
+	if (Global::base_replayer_options.inline_shader_modules)
+		cmdline += " --inline-shader-modules";
+
+	if (Global::base_replayer_options.probe_pipeline_cache)
+		cmdline += " --probe-pipeline-cache";
+
+	if (!Global::base_replayer_options.worker_cpus.empty())
+	{
+		cmdline += " --worker-cpus ";
+		cmdline += format_cpu_list(Global::base_replayer_options.worker_cpus);
+	}
+
+	if (Global::base_replayer_options.numa_local_workers)
+		cmdline += " --numa-local-workers";
+
+	if (Global::base_replayer_options.worker_priority == WorkerPriority::Low)
+		cmdline += " --worker-priority low";
+	else if (Global::base_replayer_options.worker_priority == WorkerPriority::Idle)
+		cmdline += " --worker-priority idle";
+
+	cmdline += " --worker-slot ";
+	cmdline += std::to_string(index);
+
+	if (Global::base_replayer_options.shard_count)
+	{
+		cmdline += " --shard ";
+		cmdline += std::to_string(Global::base_replayer_options.shard_index);
+		cmdline += " ";
+		cmdline += std::to_string(Global::base_replayer_options.shard_count);
+	}
+
+	if (Global::base_replayer_options.filter_application_hash)
+	{
+		char hash_str[17];
+		snprintf(hash_str, sizeof(hash_str), "%016" PRIx64, Global::base_replayer_options.filter_application_hash);
+		cmdline += " --filter-application ";
+		cmdline += hash_str;
+	}
+
+	if (Global::time_budget.enabled)
+	{
+		cmdline += " --time-budget ";
+		cmdline += std::to_string(Global::time_budget.remaining_seconds());
+	}
+
+	if (Global::base_replayer_options.pipeline_memory_contexts)
+	{
+		cmdline += " --memory-contexts ";
+		cmdline += std::to_string(Global::base_replayer_options.pipeline_memory_contexts);
+	}
+
+	if (Global::base_replayer_options.pipeline_batch_size > 1 && !crashed_in_pipeline_batch)
+	{
+		cmdline += " --pipeline-batch-size ";
+		cmdline += std::to_string(Global::base_replayer_options.pipeline_batch_size);
+	}
+
+	if (Global::base_replayer_options.shader_cache_policy == ObjectCacheEvictionPolicy::FewestRemainingUses)
+		cmdline += " --shader-cache-policy remaining-uses";
+
+	if (!Global::base_replayer_options.pipeline_cost_history_path.empty())
+	{
+		cmdline += " --pipeline-cost-history ";
+		cmdline += "\"";
+		cmdline += Global::base_replayer_options.pipeline_cost_history_path;
+		cmdline += "\"";
+	}
+
+	if (!Global::base_replayer_options.pipeline_binary_archive_path.empty())
+	{
+		cmdline += " --pipeline-binary-archive ";
+		cmdline += "\"";
+		cmdline += Global::base_replayer_options.pipeline_binary_archive_path;
+		if (index != 0)
+		{
+			cmdline += ".";
+			cmdline += std::to_string(index);
+		}
+		cmdline += "\"";
+	}
+
 	if (!Global::base_replayer_options.pipeline_stats_path.empty())
 	{
 		cmdline += " --enable-pipeline-stats ";
@@ -482,6 +621,32 @@ bool ProcessProgress::start_child_process()
 		cmdline += "\"";
 	}
 
+	if (!Global::base_replayer_options.benchmark_report_path.empty())
+	{
+		cmdline += " --benchmark-report ";
+		cmdline += "\"";
+		cmdline += Global::base_replayer_options.benchmark_report_path;
+		if (index != 0)
+		{
+			cmdline += ".";
+			cmdline += std::to_string(index);
+		}
+		cmdline += "\"";
+	}
+
+	if (!Global::base_replayer_options.trace_path.empty())
+	{
+		cmdline += " --trace ";
+		cmdline += "\"";
+		cmdline += Global::base_replayer_options.trace_path;
+		if (index != 0)
+		{
+			cmdline += ".";
+			cmdline += std::to_string(index);
+		}
+		cmdline += "\"";
+	}
+
 	if (Global::base_replayer_options.timeout_seconds)
 	{
 		cmdline += " --timeout-seconds ";
@@ -644,6 +809,16 @@ static bool open_metadata_shm(const char *metadata_path)
 	return true;
 }
 
+static bool open_replayer_cache_shm(const char *metadata_path, ThreadedReplayer::Options &replayer_opts)
+{
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, metadata_path);
+	if (!mapping)
+		return false;
+
+	replayer_opts.replayer_cache_metadata = reinterpret_cast<intptr_t>(mapping);
+	return true;
+}
+
 static bool open_shm(const char *shm_path, const char *shm_mutex_path)
 {
 	HANDLE mapping = OpenFileMappingA(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, shm_path);
@@ -666,7 +841,7 @@ static bool open_shm(const char *shm_path, const char *shm_mutex_path)
 	Global::control_block = static_cast<SharedControlBlock *>(mapped);
 	if (Global::control_block->version_cookie != ControlBlockMagic ||
 	    Global::control_block->ring_buffer_offset < sizeof(SharedControlBlock) ||
-	    Global::control_block->ring_buffer_size == 0 ||
+	    Global::control_block->ring_buffer_size < sizeof(SharedControlBlockMessageSlot) ||
 	    !is_pot(Global::control_block->ring_buffer_size))
 	{
 		LOGE("Control block is corrupt.\n");
@@ -675,13 +850,210 @@ static bool open_shm(const char *shm_path, const char *shm_mutex_path)
 		Global::control_block = nullptr;
 	}
 
-	Global::shared_mutex = OpenMutexA(MUTEX_ALL_ACCESS, FALSE, shm_mutex_path);
-	if (!Global::shared_mutex)
+	// Despite the name, this is the event used to wake up readers of the message ring.
+	Global::message_event = OpenEventA(EVENT_MODIFY_STATE, FALSE, shm_mutex_path);
+	if (!Global::message_event)
 		return false;
 
 	return true;
 }
 
+// Windows has no SIGSTOP, so suspend or resume every thread of the process.
+static bool set_process_suspended(HANDLE process, bool suspend)
+{
+	DWORD pid = GetProcessId(process);
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+	if (snapshot == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool ret = true;
+	THREADENTRY32 entry = {};
+	entry.dwSize = sizeof(entry);
+	if (Thread32First(snapshot, &entry))
+	{
+		do
+		{
+			if (entry.th32OwnerProcessID != pid)
+				continue;
+
+			HANDLE thread = OpenThread(THREAD_SUSPEND_RESUME, FALSE, entry.th32ThreadID);
+			if (!thread)
+			{
+				ret = false;
+				continue;
+			}
+
+			if ((suspend ? SuspendThread(thread) : ResumeThread(thread)) == DWORD(-1))
+				ret = false;
+			CloseHandle(thread);
+		} while (Thread32Next(snapshot, &entry));
+	}
+
+	CloseHandle(snapshot);
+	return ret;
+}
+
+// Same role as the Linux master's dirty page and PSI polling.
+// Windows has neither, so IO and CPU accounting of the job stand in for them:
+// - Bytes written by the children stand in for new dirty pages.
+// - Time running children did not spend on a CPU stands in for stall time. It covers waiting on IO and
+//   page faults, as well as losing the CPU to a foreground application, which is what we want to back off from.
+struct StallState
+{
+	uint64_t cpu_time_100ns = 0;
+	uint64_t write_bytes = 0;
+	uint64_t committed_bytes = 0;
+	int64_t timestamp_ns = 0;
+	unsigned running_processes = 0;
+	bool low_memory = false;
+	bool valid = false;
+};
+
+static void poll_stall_information(const vector<ProcessProgress> &child_processes, StallState &state)
+{
+	state = {};
+	state.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	state.running_processes = Global::running_processes;
+
+	JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION accounting = {};
+	if (Global::job_handle &&
+	    QueryInformationJobObject(Global::job_handle, JobObjectBasicAndIoAccountingInformation,
+	                              &accounting, sizeof(accounting), nullptr))
+	{
+		state.cpu_time_100ns = uint64_t(accounting.BasicInfo.TotalUserTime.QuadPart) +
+		                       uint64_t(accounting.BasicInfo.TotalKernelTime.QuadPart);
+		state.write_bytes = accounting.IoInfo.WriteTransferCount;
+		state.valid = true;
+	}
+
+	// The job memory limit applies to committed memory, which is PrivateUsage.
+	for (auto &process : child_processes)
+	{
+		PROCESS_MEMORY_COUNTERS_EX counters = {};
+		if (process.process &&
+		    GetProcessMemoryInfo(process.process, reinterpret_cast<PROCESS_MEMORY_COUNTERS *>(&counters),
+		                         sizeof(counters)))
+		{
+			state.committed_bytes += counters.PrivateUsage;
+		}
+	}
+
+	BOOL low_memory = FALSE;
+	if (Global::low_memory_notification &&
+	    QueryMemoryResourceNotification(Global::low_memory_notification, &low_memory))
+	{
+		state.low_memory = low_memory != FALSE;
+	}
+}
+
+static void manage_thrashing_behavior(StallState &old_state, const StallState &new_state, size_t num_processes)
+{
+	float delta_us = 1e-3f * float(new_state.timestamp_ns - old_state.timestamp_ns);
+	if (delta_us <= 0.0f)
+		return;
+
+	int32_t written_mib = -1;
+	float io_stall_ratio = -1.0f;
+	if (old_state.valid && new_state.valid)
+	{
+		written_mib = int32_t((new_state.write_bytes - old_state.write_bytes) / (1024 * 1024));
+		if (old_state.running_processes)
+		{
+			float cpu_us = 0.1f * float(new_state.cpu_time_100ns - old_state.cpu_time_100ns);
+			io_stall_ratio = 1.0f - cpu_us / (delta_us * float(old_state.running_processes));
+			io_stall_ratio = max(0.0f, min(1.0f, io_stall_ratio));
+		}
+	}
+
+	unsigned target_running_processes = Global::target_running_processes;
+	bool go_down = false;
+	bool go_up = false;
+
+	if (written_mib > 50)
+		go_down = true;
+	else if (written_mib >= 0 && written_mib < 10)
+		go_up = true;
+
+	if (io_stall_ratio > 0.3f)
+		go_down = true;
+	else if (io_stall_ratio >= 0.1f)
+		go_up = false;
+
+	// Windows signals this when available physical memory gets low, i.e. a foreground application is about to page.
+	if (new_state.low_memory)
+		go_down = true;
+
+	// Back off before the children hit the job memory limit and start failing allocations.
+	uint64_t memory_limit = uint64_t(Global::base_replayer_options.job_memory_limit_mb) * 1024 * 1024;
+	if (memory_limit && new_state.committed_bytes > memory_limit - memory_limit / 10)
+		go_down = true;
+	else if (memory_limit && new_state.committed_bytes > memory_limit - memory_limit / 5)
+		go_up = false;
+
+	if (go_down && target_running_processes > 1)
+		target_running_processes--;
+	else if (go_up && !go_down)
+		target_running_processes++;
+
+	if (Global::control_block)
+	{
+		Global::control_block->dirty_pages_mib.store(written_mib, std::memory_order_relaxed);
+		Global::control_block->io_stall_percentage.store(
+				io_stall_ratio < 0.0f ? -1 : int32_t(io_stall_ratio * 100.0f), std::memory_order_relaxed);
+	}
+
+	old_state = new_state;
+	Global::target_running_processes = min(target_running_processes, unsigned(num_processes));
+}
+
+static void update_target_running_processes(vector<ProcessProgress> &child_processes, bool low_memory)
+{
+	Global::running_processes = 0;
+	for (auto &process : child_processes)
+		if (process.process && !process.stopped)
+			Global::running_processes++;
+
+	if (Global::running_processes > Global::target_running_processes)
+	{
+		// Put processes to sleep. A process which is busy crashing is left alone, its timer would kill it.
+		unsigned to_stop = Global::running_processes - Global::target_running_processes;
+		for (size_t i = child_processes.size(); i && to_stop; i--)
+		{
+			auto &process = child_processes[i - 1];
+			if (process.process && !process.stopped && !process.timer_handle &&
+			    set_process_suspended(process.process, true))
+			{
+				// Under memory pressure, hand the sleeping process' pages back to whoever needs them.
+				if (low_memory)
+					SetProcessWorkingSetSize(process.process, SIZE_T(-1), SIZE_T(-1));
+
+				to_stop--;
+				process.stopped = true;
+				Global::running_processes--;
+			}
+		}
+	}
+	else if (Global::running_processes < Global::target_running_processes)
+	{
+		// Wake up sleeping processes.
+		unsigned to_wake_up = Global::target_running_processes - Global::running_processes;
+		for (size_t i = 0; i < child_processes.size() && to_wake_up; i++)
+		{
+			auto &process = child_processes[i];
+			if (process.process && process.stopped && set_process_suspended(process.process, false))
+			{
+				to_wake_up--;
+				process.stopped = false;
+				Global::running_processes++;
+			}
+		}
+	}
+
+	if (Global::control_block)
+		Global::control_block->num_running_processes.store(Global::running_processes, std::memory_order_relaxed);
+}
+
 static int run_master_process(const VulkanDevice::Options &opts,
                               const ThreadedReplayer::Options &replayer_opts,
                               const vector<const char *> &databases,
@@ -691,6 +1063,7 @@ static int run_master_process(const VulkanDevice::Options &opts,
 	Global::quiet_slave = quiet_slave;
 	Global::device_options = opts;
 	Global::base_replayer_options = replayer_opts;
+	Global::time_budget = TimeBudget(replayer_opts.time_budget_seconds);
 	Global::databases = databases;
 	unsigned processes = replayer_opts.num_threads;
 
@@ -721,6 +1094,11 @@ static int run_master_process(const VulkanDevice::Options &opts,
 		// Kill all child processes if the parent dies.
 		JOBOBJECT_EXTENDED_LIMIT_INFORMATION jeli = {};
 		jeli.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+		if (replayer_opts.job_memory_limit_mb)
+		{
+			jeli.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+			jeli.JobMemoryLimit = SIZE_T(replayer_opts.job_memory_limit_mb) * 1024 * 1024;
+		}
 		if (!SetInformationJobObject(Global::job_handle, JobObjectExtendedLimitInformation, &jeli, sizeof(jeli)))
 		{
 			LOGE("Failed to set information for job object.\n");
@@ -734,6 +1112,10 @@ static int run_master_process(const VulkanDevice::Options &opts,
 		return EXIT_FAILURE;
 	}
 
+	Global::low_memory_notification = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+	if (!Global::low_memory_notification)
+		LOGW("Failed to create low memory notification.\n");
+
 	size_t num_graphics_pipelines;
 	size_t num_compute_pipelines;
 
@@ -771,14 +1153,23 @@ static int run_master_process(const VulkanDevice::Options &opts,
 			return EXIT_FAILURE;
 		}
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &num_graphics_pipelines, nullptr))
+		// Same for the replayer cache. Children only get the name if the export worked.
+		if (!replayer_opts.replayer_cache_path.empty())
+		{
+			char export_name[DatabaseInterface::OSHandleNameSize];
+			DatabaseInterface::get_unique_os_export_name(export_name, sizeof(export_name));
+			if (DatabaseInterface::metadata_handle_is_valid(export_replayer_cache(opts, replayer_opts, export_name)))
+				memcpy(Global::replayer_cache_export_name, export_name, sizeof(export_name));
+		}
+
+		if (!get_selected_pipeline_count(*db, RESOURCE_GRAPHICS_PIPELINE, replayer_opts, &num_graphics_pipelines))
 		{
 			for (auto &path : databases)
 				LOGE("Failed to parse database %s.\n", path);
 			return EXIT_FAILURE;
 		}
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &num_compute_pipelines, nullptr))
+		if (!get_selected_pipeline_count(*db, RESOURCE_COMPUTE_PIPELINE, replayer_opts, &num_compute_pipelines))
 		{
 			for (auto &path : databases)
 				LOGE("Failed to parse database %s.\n", path);
@@ -829,6 +1220,11 @@ static int run_master_process(const VulkanDevice::Options &opts,
 
 	wait_handles.reserve(3 * processes);
 
+	Global::target_running_processes = processes;
+	update_target_running_processes(child_processes, false);
+	StallState stall_state;
+	poll_stall_information(child_processes, stall_state);
+
 	while (Global::active_processes != 0)
 	{
 		wait_handles.clear();
@@ -850,7 +1246,17 @@ static int run_master_process(const VulkanDevice::Options &opts,
 		}
 
 		// Basically like poll(), except we had to a lot of work to get here ...
-		DWORD ret = WaitForMultipleObjects(wait_handles.size(), wait_handles.data(), FALSE, INFINITE);
+		// Wake up once a second to let clients know about progress.
+		DWORD ret = WaitForMultipleObjects(wait_handles.size(), wait_handles.data(), FALSE, 1000);
+		signal_progress_if_changed();
+
+		// Re-evaluate about once a second, the wait wakes up far more often when children are busy.
+		StallState new_stall_state;
+		poll_stall_information(child_processes, new_stall_state);
+		if (new_stall_state.timestamp_ns - stall_state.timestamp_ns >= 1000000000ll)
+			manage_thrashing_behavior(stall_state, new_stall_state, child_processes.size());
+		update_target_running_processes(child_processes, new_stall_state.low_memory);
+
 		if (ret == WAIT_FAILED)
 		{
 			LOGE("WaitForMultipleObjects failed.\n");
@@ -912,9 +1318,12 @@ static int run_master_process(const VulkanDevice::Options &opts,
 
 	if (Global::job_handle)
 		CloseHandle(Global::job_handle);
+	if (Global::low_memory_notification)
+		CloseHandle(Global::low_memory_notification);
 
 	if (Global::control_block)
 		Global::control_block->progress_complete.store(1, std::memory_order_release);
+	signal_progress_if_changed();
 
 	return EXIT_SUCCESS;
 }
@@ -944,6 +1353,11 @@ static void crash_handler(ThreadedReplayer &replayer, ThreadedReplayer::PerThrea
 {
 	char buffer[64];
 
+	// We don't know which pipeline in the batch is at fault, so there are no modules or pipeline hashes to report.
+	// Progress points to the start of the batch, so the next attempt will retry it without batching.
+	if (per_thread.in_pipeline_batch && !write_all(crash_handle, "BATCH\n"))
+		ExitProcess(2);
+
 	// Report to parent process which VkShaderModule's might have contributed to our untimely death.
 	// This allows a new process to ignore these modules.
 	for (unsigned i = 0; i < per_thread.num_failed_module_hashes; i++)
@@ -1021,6 +1435,12 @@ static void report_failed_pipeline()
 			LOGE("Compute pipeline crashed or hung, hash: %016" PRIx64 ". Rerun with: --compute-pipeline-range %u %u.\n",
 			     per_thread->current_compute_pipeline, index, index + 1);
 		}
+		else if (per_thread->in_pipeline_batch)
+		{
+			LOGE("Crashed or hung in a batch of pipelines starting at graphics index %u, compute index %u. "
+			     "Rerun with: --pipeline-batch-size 1.\n",
+			     per_thread->current_graphics_index, per_thread->current_compute_index);
+		}
 	}
 }
 
@@ -1090,7 +1510,8 @@ static void abort_handler(int)
 static int run_slave_process(const VulkanDevice::Options &opts,
                              const ThreadedReplayer::Options &replayer_opts,
                              const vector<const char *> &databases,
-                             const char *shm_name, const char *shm_mutex_name, const char *metadata_name)
+                             const char *shm_name, const char *shm_mutex_name, const char *metadata_name,
+                             const char *replayer_cache_metadata_name)
 {
 	if (shm_name && shm_mutex_name && !open_shm(shm_name, shm_mutex_name))
 	{
@@ -1107,6 +1528,10 @@ static int run_slave_process(const VulkanDevice::Options &opts,
 	auto tmp_opts = replayer_opts;
 	tmp_opts.control_block = Global::control_block;
 	tmp_opts.on_validation_error_callback = validation_error_cb;
+
+	// Not fatal, the replayer cache is read directly instead.
+	if (replayer_cache_metadata_name && !open_replayer_cache_shm(replayer_cache_metadata_name, tmp_opts))
+		LOGW("Failed to map replayer cache metadata.\n");
 	ThreadedReplayer replayer(opts, tmp_opts);
 	replayer.robustness = true;
 
@@ -1162,13 +1587,9 @@ static int run_slave_process(const VulkanDevice::Options &opts,
 #if 0
 	if (Global::control_block)
 	{
-		if (WaitForSingleObject(Global::shared_mutex, INFINITE) == WAIT_OBJECT_0)
-		{
-			char msg[ControlBlockMessageSize] = {};
-			sprintf(msg, "SLAVE_FINISHED\n");
-			shared_control_block_write(Global::control_block, msg, sizeof(msg));
-			ReleaseMutex(Global::shared_mutex);
-		}
+		char msg[ControlBlockMessageSize] = {};
+		sprintf(msg, "SLAVE_FINISHED\n");
+		write_control_block_message(msg);
 	}
 #endif
 
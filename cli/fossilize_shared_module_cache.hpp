@@ -0,0 +1,169 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace Fossilize
+{
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "Atomic size mismatch. This type likely requires a lock to work.");
+
+// Decoded SPIR-V which is shared between replayer processes through a block of shared memory.
+// The first process to decode a module publishes it, and other processes create their VkShaderModule straight from it.
+// The block is laid out as this header, a fixed size open addressing table, and an arena for the SPIR-V.
+// Entries are never removed, so everything is lock-free. A process which dies while publishing
+// leaves an entry which never becomes ready, and lookups for it simply miss.
+// Memory must be zero-initialized before init() is called.
+struct SharedModuleCache
+{
+	enum { Magic = 0x464f5a4d, CodeAlignment = 64, MaxProbes = 64, BytesPerEntry = 8 * 1024, MinEntries = 1024 };
+
+	struct Entry
+	{
+		std::atomic<uint64_t> hash;
+		// Offset into the arena plus one, stored once the code is written.
+		std::atomic<uint64_t> code_offset;
+		uint64_t code_size;
+		uint32_t flags;
+		uint32_t padding;
+	};
+
+	uint32_t magic;
+	uint32_t num_entries;
+	uint64_t arena_offset;
+	uint64_t arena_size;
+	std::atomic<uint64_t> arena_allocated;
+
+	static SharedModuleCache *init(void *mapped, size_t size)
+	{
+		size_t num_entries = MinEntries;
+		while (num_entries < size / BytesPerEntry)
+			num_entries *= 2;
+
+		size_t arena_offset = sizeof(SharedModuleCache) + num_entries * sizeof(Entry);
+		arena_offset = (arena_offset + CodeAlignment - 1) & ~size_t(CodeAlignment - 1);
+		if (arena_offset >= size)
+			return nullptr;
+
+		auto *cache = static_cast<SharedModuleCache *>(mapped);
+		cache->magic = Magic;
+		cache->num_entries = uint32_t(num_entries);
+		cache->arena_offset = arena_offset;
+		cache->arena_size = size - arena_offset;
+		return cache;
+	}
+
+	bool find(uint64_t hash, const uint32_t **code, size_t *code_size, uint32_t *flags) const
+	{
+		if (!hash)
+			return false;
+
+		uint32_t mask = num_entries - 1;
+		for (unsigned i = 0; i < MaxProbes; i++)
+		{
+			auto &entry = get_entries()[(hash + i) & mask];
+			uint64_t entry_hash = entry.hash.load(std::memory_order_acquire);
+
+			// Entries are claimed in probe order and never removed, so an empty slot ends the search.
+			if (entry_hash == 0)
+				return false;
+
+			if (entry_hash == hash)
+			{
+				uint64_t offset = entry.code_offset.load(std::memory_order_acquire);
+				if (!offset)
+					return false;
+
+				*code = reinterpret_cast<const uint32_t *>(get_arena() + offset - 1);
+				*code_size = size_t(entry.code_size);
+				*flags = entry.flags;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void publish(uint64_t hash, const uint32_t *code, size_t code_size, uint32_t flags)
+	{
+		if (!hash || arena_allocated.load(std::memory_order_relaxed) >= arena_size)
+			return;
+
+		uint32_t mask = num_entries - 1;
+		for (unsigned i = 0; i < MaxProbes; i++)
+		{
+			auto &entry = get_entries()[(hash + i) & mask];
+			uint64_t expected = 0;
+			if (!entry.hash.compare_exchange_strong(expected, hash, std::memory_order_acq_rel))
+			{
+				// Someone else already published this module, or is in the middle of it.
+				if (expected == hash)
+					return;
+				continue;
+			}
+
+			uint64_t aligned_size = (code_size + CodeAlignment - 1) & ~uint64_t(CodeAlignment - 1);
+			uint64_t offset = arena_allocated.fetch_add(aligned_size, std::memory_order_relaxed);
+
+			// If the arena is full, the entry is never made ready.
+			if (offset + aligned_size > arena_size)
+				return;
+
+			memcpy(get_arena() + offset, code, code_size);
+			entry.code_size = code_size;
+			entry.flags = flags;
+			entry.code_offset.store(offset + 1, std::memory_order_release);
+			return;
+		}
+	}
+
+	bool contains(const void *ptr) const
+	{
+		auto *p = static_cast<const uint8_t *>(ptr);
+		return p >= get_arena() && p < get_arena() + arena_size;
+	}
+
+	Entry *get_entries()
+	{
+		return reinterpret_cast<Entry *>(this + 1);
+	}
+
+	const Entry *get_entries() const
+	{
+		return reinterpret_cast<const Entry *>(this + 1);
+	}
+
+	uint8_t *get_arena()
+	{
+		return reinterpret_cast<uint8_t *>(this) + arena_offset;
+	}
+
+	const uint8_t *get_arena() const
+	{
+		return reinterpret_cast<const uint8_t *>(this) + arena_offset;
+	}
+};
+}
@@ -27,8 +27,14 @@
 #include "vulkan.h"
 #include "spirv_cross_c.h"
 #include "file.hpp"
+#include "path.hpp"
 #include <algorithm>
+#include <atomic>
 #include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <string.h>
 
 using namespace Fossilize;
@@ -44,7 +50,9 @@ static void print_help()
 	     "\t[--comp shader.spv]\n"
 	     "\t[--output out.foz]\n"
 	     "\t[--spec <ID> <f32/u32/i32> <value>\n"
-	     "\t[--multi-spec <index> <count>\n");
+	     "\t[--multi-spec <index> <count>\n"
+	     "\t[--manifest <path>]\n"
+	     "\t[--num-threads <count>]\n");
 }
 
 enum ShaderStage
@@ -70,47 +78,49 @@ struct SpecConstant
 	} iteration = {};
 };
 
-static bool load_shader_modules(const std::string *stages, std::vector<uint8_t> *modules)
+// Synthesized objects are never created, so handles only have to be unique within the recorder.
+struct HandleAllocator
 {
-	for (unsigned i = 0; i < STAGE_COUNT; i++)
-	{
-		if (stages[i].empty())
-			continue;
+	uint64_t next;
 
-		modules[i] = load_buffer_from_file(stages[i].c_str());
-		if (modules[i].empty())
-		{
-			LOGE("Failed to load file: %s\n", stages[i].c_str());
-			return false;
-		}
+	template <typename T>
+	T allocate()
+	{
+		return (T)next++;
 	}
+};
 
-	return true;
-}
+struct ReflectedModule
+{
+	std::vector<uint8_t> code;
+	spvc_compiler compiler = nullptr;
+	VkShaderModule handle = VK_NULL_HANDLE;
+};
 
-static bool reflect_shader_modules(spvc_context ctx, const std::vector<uint8_t> *modules, spvc_compiler *compilers)
+static bool reflect_shader_module(spvc_context ctx, const std::string &path, ReflectedModule &module)
 {
-	for (unsigned i = 0; i < STAGE_COUNT; i++)
+	module.code = load_buffer_from_file(path.c_str());
+	if (module.code.empty())
 	{
-		if (modules[i].empty())
-			continue;
+		LOGE("Failed to load file: %s\n", path.c_str());
+		return false;
+	}
 
-		auto *data = reinterpret_cast<const uint32_t *>(modules[i].data());
-		auto size = modules[i].size() / sizeof(uint32_t);
+	auto *data = reinterpret_cast<const uint32_t *>(module.code.data());
+	auto size = module.code.size() / sizeof(uint32_t);
 
-		spvc_parsed_ir parsed;
-		if (spvc_context_parse_spirv(ctx, data, size, &parsed) != SPVC_SUCCESS)
-		{
-			LOGE("Failed to parse SPIR-V.\n");
-			return false;
-		}
+	spvc_parsed_ir parsed;
+	if (spvc_context_parse_spirv(ctx, data, size, &parsed) != SPVC_SUCCESS)
+	{
+		LOGE("Failed to parse SPIR-V.\n");
+		return false;
+	}
 
-		if (spvc_context_create_compiler(ctx, SPVC_BACKEND_NONE, parsed,
-		                                 SPVC_CAPTURE_MODE_TAKE_OWNERSHIP, &compilers[i]) != SPVC_SUCCESS)
-		{
-			LOGE("Failed to create compiler.\n");
-			return false;
-		}
+	if (spvc_context_create_compiler(ctx, SPVC_BACKEND_NONE, parsed,
+	                                 SPVC_CAPTURE_MODE_TAKE_OWNERSHIP, &module.compiler) != SPVC_SUCCESS)
+	{
+		LOGE("Failed to create compiler.\n");
+		return false;
 	}
 
 	return true;
@@ -286,7 +296,7 @@ static bool add_bindings(spvc_compiler compiler,
 	return true;
 }
 
-static VkPipelineLayout synthesize_pipeline_layout(StateRecorder &recorder, spvc_compiler *compilers)
+static VkPipelineLayout synthesize_pipeline_layout(StateRecorder &recorder, HandleAllocator &handles, spvc_compiler *compilers)
 {
 	VkDescriptorSetLayout set_layouts[8] = {};
 	unsigned num_set_layouts = 0;
@@ -327,7 +337,7 @@ static VkPipelineLayout synthesize_pipeline_layout(StateRecorder &recorder, spvc
 			}
 		}
 
-		set_layouts[i] = (VkDescriptorSetLayout)uint64_t(i + 1);
+		set_layouts[i] = handles.allocate<VkDescriptorSetLayout>();
 		if (!recorder.record_descriptor_set_layout(set_layouts[i], set_info))
 			return VK_NULL_HANDLE;
 	}
@@ -338,13 +348,14 @@ static VkPipelineLayout synthesize_pipeline_layout(StateRecorder &recorder, spvc
 	pipeline_layout_info.pushConstantRangeCount = push_constant_range.size != 0 ? 1 : 0;
 	pipeline_layout_info.pPushConstantRanges = &push_constant_range;
 
-	if (!recorder.record_pipeline_layout((VkPipelineLayout)uint64_t(1), pipeline_layout_info))
+	auto pipeline_layout = handles.allocate<VkPipelineLayout>();
+	if (!recorder.record_pipeline_layout(pipeline_layout, pipeline_layout_info))
 		return VK_NULL_HANDLE;
 
-	return (VkPipelineLayout)uint64_t(1);
+	return pipeline_layout;
 }
 
-static VkRenderPass synthesize_render_pass(StateRecorder &recorder, spvc_compiler frag, uint8_t &active_rt_mask)
+static VkRenderPass synthesize_render_pass(StateRecorder &recorder, HandleAllocator &handles, spvc_compiler frag, uint8_t &active_rt_mask)
 {
 	if (!frag)
 		return VK_NULL_HANDLE;
@@ -558,22 +569,34 @@ static VkRenderPass synthesize_render_pass(StateRecorder &recorder, spvc_compile
 	info.pSubpasses = &subpass;
 	info.pAttachments = attachments;
 
-	if (!recorder.record_render_pass((VkRenderPass)uint64_t(1), info))
+	auto render_pass = handles.allocate<VkRenderPass>();
+	if (!recorder.record_render_pass(render_pass, info))
 		return VK_NULL_HANDLE;
 
-	return (VkRenderPass)uint64_t(1);
+	return render_pass;
 }
 
-static VkPipeline synthesize_compute_pipeline(StateRecorder &recorder,
-                                              const std::vector<uint8_t> *modules, VkPipelineLayout layout,
-                                              SpecConstant &specs)
+static VkShaderModule record_shader_module(StateRecorder &recorder, HandleAllocator &handles, ReflectedModule &module)
 {
+	if (module.handle != VK_NULL_HANDLE)
+		return module.handle;
+
 	VkShaderModuleCreateInfo module_info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-	module_info.codeSize = modules[STAGE_COMP].size();
-	module_info.pCode = reinterpret_cast<const uint32_t *>(modules[STAGE_COMP].data());
-	if (!recorder.record_shader_module((VkShaderModule)uint64_t(1), module_info))
+	module_info.codeSize = module.code.size();
+	module_info.pCode = reinterpret_cast<const uint32_t *>(module.code.data());
+
+	auto handle = handles.allocate<VkShaderModule>();
+	if (!recorder.record_shader_module(handle, module_info))
 		return VK_NULL_HANDLE;
 
+	module.handle = handle;
+	return handle;
+}
+
+static VkPipeline synthesize_compute_pipeline(StateRecorder &recorder, HandleAllocator &handles,
+                                              VkShaderModule module, VkPipelineLayout layout,
+                                              SpecConstant &specs)
+{
 	VkComputePipelineCreateInfo info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
 	VkSpecializationInfo spec_info = {};
 
@@ -584,13 +607,14 @@ static VkPipeline synthesize_compute_pipeline(StateRecorder &recorder,
 
 	info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-	info.stage.module = (VkShaderModule)uint64_t(1);
+	info.stage.module = module;
 	info.stage.pName = "main";
 	if (spec_info.dataSize != 0)
 		info.stage.pSpecializationInfo = &spec_info;
 	info.layout = layout;
 
-	if (!recorder.record_compute_pipeline((VkPipeline) uint64_t(1), info, nullptr, 0))
+	auto pipeline = handles.allocate<VkPipeline>();
+	if (!recorder.record_compute_pipeline(pipeline, info, nullptr, 0))
 		return VK_NULL_HANDLE;
 
 	if (specs.iteration.count && specs.iteration.index < specs.data.size())
@@ -598,12 +622,12 @@ static VkPipeline synthesize_compute_pipeline(StateRecorder &recorder,
 		for (uint32_t i = 0; i < specs.iteration.count; i++)
 		{
 			specs.data[specs.iteration.index] = i;
-			if (!recorder.record_compute_pipeline((VkPipeline) uint64_t(2 + i), info, nullptr, 0))
+			if (!recorder.record_compute_pipeline(handles.allocate<VkPipeline>(), info, nullptr, 0))
 				return VK_NULL_HANDLE;
 		}
 	}
 
-	return (VkPipeline)uint64_t(1);
+	return pipeline;
 }
 
 static bool append_attributes(spvc_compiler vert,
@@ -665,8 +689,8 @@ static bool append_attributes(spvc_compiler vert,
 	return true;
 }
 
-static VkPipeline synthesize_graphics_pipeline(StateRecorder &recorder,
-                                               const std::vector<uint8_t> *modules,
+static VkPipeline synthesize_graphics_pipeline(StateRecorder &recorder, HandleAllocator &handles,
+                                               const VkShaderModule *modules,
                                                spvc_compiler *compilers,
                                                VkPipelineLayout layout,
                                                VkRenderPass render_pass,
@@ -685,16 +709,10 @@ static VkPipeline synthesize_graphics_pipeline(StateRecorder &recorder,
 
 	for (unsigned i = 0; i <= STAGE_FRAG; i++)
 	{
-		if (!modules[i].empty())
+		if (modules[i] != VK_NULL_HANDLE)
 		{
-			VkShaderModuleCreateInfo module_info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-			module_info.codeSize = modules[i].size();
-			module_info.pCode = reinterpret_cast<const uint32_t *>(modules[i].data());
-			if (!recorder.record_shader_module((VkShaderModule)uint64_t(1 + i), module_info))
-				return VK_NULL_HANDLE;
-
 			VkPipelineShaderStageCreateInfo stage = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
-			stage.module = (VkShaderModule)uint64_t(1 + i);
+			stage.module = modules[i];
 			stage.pName = "main";
 			stage.stage = VkShaderStageFlagBits(1u << i);
 			if (spec_info.dataSize != 0)
@@ -783,7 +801,8 @@ static VkPipeline synthesize_graphics_pipeline(StateRecorder &recorder,
 	info.layout = layout;
 	info.renderPass = render_pass;
 
-	if (!recorder.record_graphics_pipeline((VkPipeline)uint64_t(1), info, nullptr, 0))
+	auto pipeline = handles.allocate<VkPipeline>();
+	if (!recorder.record_graphics_pipeline(pipeline, info, nullptr, 0))
 		return VK_NULL_HANDLE;
 
 	if (specs.iteration.count && specs.iteration.index < specs.data.size())
@@ -791,30 +810,146 @@ static VkPipeline synthesize_graphics_pipeline(StateRecorder &recorder,
 		for (uint32_t i = 0; i < specs.iteration.count; i++)
 		{
 			specs.data[specs.iteration.index] = i;
-			if (!recorder.record_graphics_pipeline((VkPipeline) uint64_t(2 + i), info, nullptr, 0))
+			if (!recorder.record_graphics_pipeline(handles.allocate<VkPipeline>(), info, nullptr, 0))
 				return VK_NULL_HANDLE;
 		}
 	}
 
-	return (VkPipeline)uint64_t(1);
+	return pipeline;
 }
 
-int main(int argc, char *argv[])
+struct SynthJob
 {
-	CLICallbacks cbs;
 	std::string spv_paths[STAGE_COUNT];
-	std::string output_path;
 	SpecConstant spec_constants;
+};
 
-	cbs.add("--vert", [&](CLIParser &parser) { spv_paths[STAGE_VERT] = parser.next_string(); });
-	cbs.add("--tesc", [&](CLIParser &parser) { spv_paths[STAGE_TESC] = parser.next_string(); });
-	cbs.add("--tese", [&](CLIParser &parser) { spv_paths[STAGE_TESE] = parser.next_string(); });
-	cbs.add("--geom", [&](CLIParser &parser) { spv_paths[STAGE_GEOM] = parser.next_string(); });
-	cbs.add("--frag", [&](CLIParser &parser) { spv_paths[STAGE_FRAG] = parser.next_string(); });
-	cbs.add("--comp", [&](CLIParser &parser) { spv_paths[STAGE_COMP] = parser.next_string(); });
-	cbs.add("--output", [&](CLIParser &parser) { output_path = parser.next_string(); });
-	cbs.add("--help", [&](CLIParser &parser) { parser.end(); });
+// Every thread reflects a shader module, and synthesizes a pipeline layout or render pass, once and reuses it
+// for all pipelines it synthesizes. SPIRV-Cross contexts are not thread-safe, so nothing here is shared between threads.
+struct SynthThread
+{
+	SynthThread(StateRecorder &recorder_, uint64_t first_handle)
+		: recorder(recorder_), handles{ first_handle }
+	{
+	}
+
+	~SynthThread()
+	{
+		if (context)
+			spvc_context_destroy(context);
+	}
+
+	StateRecorder &recorder;
+	HandleAllocator handles;
+	spvc_context context = nullptr;
+
+	struct RenderPass
+	{
+		VkRenderPass handle;
+		uint8_t active_rt_mask;
+	};
+
+	std::unordered_map<std::string, std::unique_ptr<ReflectedModule>> modules;
+	std::unordered_map<std::string, VkPipelineLayout> pipeline_layouts;
+	std::unordered_map<std::string, RenderPass> render_passes;
+
+	SynthThread(const SynthThread &) = delete;
+	void operator=(const SynthThread &) = delete;
+
+	ReflectedModule *get_module(const std::string &path)
+	{
+		auto itr = modules.find(path);
+		if (itr != modules.end())
+			return itr->second.get();
+
+		std::unique_ptr<ReflectedModule> module(new ReflectedModule);
+		if (!reflect_shader_module(context, path, *module))
+			return nullptr;
+		return modules.insert({ path, std::move(module) }).first->second.get();
+	}
+
+	bool synthesize(SynthJob &job)
+	{
+		if (!context && spvc_context_create(&context) != SPVC_SUCCESS)
+			return false;
+
+		ReflectedModule *reflected[STAGE_COUNT] = {};
+		spvc_compiler compilers[STAGE_COUNT] = {};
+		std::string layout_key;
+
+		for (unsigned i = 0; i < STAGE_COUNT; i++)
+		{
+			if (job.spv_paths[i].empty())
+				continue;
+			reflected[i] = get_module(job.spv_paths[i]);
+			if (!reflected[i])
+				return false;
+			compilers[i] = reflected[i]->compiler;
+			layout_key += std::to_string(i) + ":" + job.spv_paths[i] + "\n";
+		}
+
+		auto layout_itr = pipeline_layouts.find(layout_key);
+		if (layout_itr == pipeline_layouts.end())
+		{
+			VkPipelineLayout layout = synthesize_pipeline_layout(recorder, handles, compilers);
+			if (layout == VK_NULL_HANDLE)
+				return false;
+			layout_itr = pipeline_layouts.insert({ layout_key, layout }).first;
+		}
+
+		RenderPass render_pass = {};
+		if (compilers[STAGE_FRAG])
+		{
+			auto &frag_path = job.spv_paths[STAGE_FRAG];
+			auto render_pass_itr = render_passes.find(frag_path);
+			if (render_pass_itr == render_passes.end())
+			{
+				render_pass.handle = synthesize_render_pass(recorder, handles, compilers[STAGE_FRAG], render_pass.active_rt_mask);
+				if (render_pass.handle == VK_NULL_HANDLE)
+					return false;
+				render_pass_itr = render_passes.insert({ frag_path, render_pass }).first;
+			}
+			render_pass = render_pass_itr->second;
+		}
+
+		VkPipeline pipeline;
+		if (compilers[STAGE_COMP])
+		{
+			VkShaderModule module = record_shader_module(recorder, handles, *reflected[STAGE_COMP]);
+			if (module == VK_NULL_HANDLE)
+				return false;
+			pipeline = synthesize_compute_pipeline(recorder, handles, module, layout_itr->second, job.spec_constants);
+		}
+		else
+		{
+			VkShaderModule stage_modules[STAGE_COUNT] = {};
+			for (unsigned i = 0; i <= STAGE_FRAG; i++)
+			{
+				if (!reflected[i])
+					continue;
+				stage_modules[i] = record_shader_module(recorder, handles, *reflected[i]);
+				if (stage_modules[i] == VK_NULL_HANDLE)
+					return false;
+			}
+
+			pipeline = synthesize_graphics_pipeline(recorder, handles, stage_modules, compilers, layout_itr->second,
+			                                        render_pass.handle, render_pass.active_rt_mask, job.spec_constants);
+		}
+
+		return pipeline != VK_NULL_HANDLE;
+	}
+};
+
+static void add_pipeline_options(CLICallbacks &cbs, SynthJob &job)
+{
+	cbs.add("--vert", [&](CLIParser &parser) { job.spv_paths[STAGE_VERT] = parser.next_string(); });
+	cbs.add("--tesc", [&](CLIParser &parser) { job.spv_paths[STAGE_TESC] = parser.next_string(); });
+	cbs.add("--tese", [&](CLIParser &parser) { job.spv_paths[STAGE_TESE] = parser.next_string(); });
+	cbs.add("--geom", [&](CLIParser &parser) { job.spv_paths[STAGE_GEOM] = parser.next_string(); });
+	cbs.add("--frag", [&](CLIParser &parser) { job.spv_paths[STAGE_FRAG] = parser.next_string(); });
+	cbs.add("--comp", [&](CLIParser &parser) { job.spv_paths[STAGE_COMP] = parser.next_string(); });
 	cbs.add("--spec", [&](CLIParser &parser) {
+		auto &spec_constants = job.spec_constants;
 		VkSpecializationMapEntry map_entry = {};
 		map_entry.size = sizeof(uint32_t);
 		map_entry.offset = spec_constants.data.size() * sizeof(uint32_t);
@@ -845,8 +980,73 @@ int main(int argc, char *argv[])
 	cbs.add("--multi-spec", [&](CLIParser &parser) {
 		uint32_t index = parser.next_uint();
 		uint32_t count = parser.next_uint();
-		spec_constants.iteration = { index, count };
+		job.spec_constants.iteration = { index, count };
 	});
+}
+
+static bool job_has_stages(const SynthJob &job)
+{
+	for (auto &path : job.spv_paths)
+		if (!path.empty())
+			return true;
+	return false;
+}
+
+// Every line of a manifest holds the per-pipeline options for one pipeline, e.g. "--vert a.spv --frag b.spv".
+// Empty lines and lines starting with # are ignored. Relative paths are relative to the manifest.
+static bool parse_manifest(const std::string &manifest_path, std::vector<SynthJob> &jobs)
+{
+	auto buffer = load_buffer_from_file(manifest_path.c_str());
+	if (buffer.empty())
+	{
+		LOGE("Failed to load manifest: %s\n", manifest_path.c_str());
+		return false;
+	}
+
+	auto lines = Path::split(std::string(buffer.begin(), buffer.end()), "\n");
+	for (size_t line_index = 0; line_index < lines.size(); line_index++)
+	{
+		auto line = Path::strip_whitespace(lines[line_index]);
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		auto args = Path::split_no_empty(line, " \t");
+		std::vector<char *> argv;
+		for (auto &arg : args)
+			argv.push_back(&arg[0]);
+
+		SynthJob job;
+		CLICallbacks cbs;
+		add_pipeline_options(cbs, job);
+		CLIParser parser(std::move(cbs), int(argv.size()), argv.data());
+		if (!parser.parse() || !job_has_stages(job))
+		{
+			LOGE("Invalid pipeline on line %u of manifest %s.\n", unsigned(line_index + 1), manifest_path.c_str());
+			return false;
+		}
+
+		for (auto &path : job.spv_paths)
+			if (!path.empty())
+				path = Path::relpath(manifest_path, path);
+		jobs.push_back(std::move(job));
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	CLICallbacks cbs;
+	std::string output_path;
+	std::string manifest_path;
+	unsigned num_threads = 0;
+	SynthJob job;
+
+	add_pipeline_options(cbs, job);
+	cbs.add("--output", [&](CLIParser &parser) { output_path = parser.next_string(); });
+	cbs.add("--manifest", [&](CLIParser &parser) { manifest_path = parser.next_string(); });
+	cbs.add("--num-threads", [&](CLIParser &parser) { num_threads = parser.next_uint(); });
+	cbs.add("--help", [&](CLIParser &parser) { parser.end(); });
 
 	CLIParser parser(std::move(cbs), argc - 1, argv + 1);
 	if (!parser.parse())
@@ -867,6 +1067,22 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	std::vector<SynthJob> jobs;
+	if (!manifest_path.empty())
+	{
+		if (job_has_stages(job))
+		{
+			LOGE("Shader stages cannot be combined with --manifest.\n");
+			print_help();
+			return EXIT_FAILURE;
+		}
+
+		if (!parse_manifest(manifest_path, jobs))
+			return EXIT_FAILURE;
+	}
+	else
+		jobs.push_back(std::move(job));
+
 	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(output_path.c_str(), DatabaseMode::OverWrite));
 	if (!db->prepare())
 	{
@@ -877,42 +1093,38 @@ int main(int argc, char *argv[])
 	StateRecorder recorder;
 	recorder.init_recording_thread(db.get());
 
-	spvc_context context;
-	if (spvc_context_create(&context) != SPVC_SUCCESS)
-		return VK_NULL_HANDLE;
-
-	struct ContextDeleter { void operator()(spvc_context ctx) { spvc_context_destroy(ctx); }};
-	std::unique_ptr<spvc_context_s, ContextDeleter> holder(context);
+	if (num_threads == 0)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	num_threads = unsigned(std::max<size_t>(1, std::min<size_t>(num_threads, jobs.size())));
 
-	std::vector<uint8_t> modules[STAGE_COUNT];
-	spvc_compiler compilers[STAGE_COUNT] = {};
-	if (!load_shader_modules(spv_paths, modules))
-		return EXIT_FAILURE;
-	if (!reflect_shader_modules(context, modules, compilers))
-		return EXIT_FAILURE;
+	std::atomic<size_t> next_index(0);
+	std::atomic<bool> success(true);
 
-	VkPipelineLayout layout = synthesize_pipeline_layout(recorder, compilers);
-	if (layout == VK_NULL_HANDLE)
-		return EXIT_FAILURE;
-
-	VkRenderPass render_pass = VK_NULL_HANDLE;
-	uint8_t active_rt_mask = 0;
-	if (compilers[STAGE_FRAG])
-	{
-		render_pass = synthesize_render_pass(recorder, compilers[STAGE_FRAG], active_rt_mask);
-		if (render_pass == VK_NULL_HANDLE)
-			return EXIT_FAILURE;
-	}
+	// Each thread hands out handles from its own range, since all of them record into the same recorder.
+	const auto worker = [&](unsigned thread_index) {
+		SynthThread synth(recorder, (uint64_t(thread_index) << 40) + 1);
+		size_t index;
+		while ((index = next_index.fetch_add(1, std::memory_order_relaxed)) < jobs.size())
+		{
+			if (!synth.synthesize(jobs[index]))
+			{
+				if (jobs.size() > 1)
+					LOGE("Failed to synthesize pipeline %u from manifest.\n", unsigned(index));
+				success = false;
+			}
+		}
+	};
 
-	VkPipeline pipeline;
-	if (compilers[STAGE_COMP])
-		pipeline = synthesize_compute_pipeline(recorder, modules, layout, spec_constants);
-	else
-		pipeline = synthesize_graphics_pipeline(recorder, modules, compilers, layout, render_pass, active_rt_mask, spec_constants);
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < num_threads; i++)
+		threads.emplace_back(worker, i);
+	worker(0);
+	for (auto &t : threads)
+		t.join();
 
-	if (pipeline == VK_NULL_HANDLE)
+	recorder.tear_down_recording_thread();
+	if (!success.load())
 		return EXIT_FAILURE;
 
-	recorder.tear_down_recording_thread();
-	LOGI("Successfully synthesized a FOZ archive to %s.\n", output_path.c_str());
+	LOGI("Successfully synthesized %u pipeline(s) to FOZ archive %s.\n", unsigned(jobs.size()), output_path.c_str());
 }
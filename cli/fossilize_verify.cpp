@@ -0,0 +1,496 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "fossilize_inttypes.h"
+#include "fossilize_db.hpp"
+#include "fossilize.hpp"
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "layer/utils.hpp"
+#include "cli_parser.hpp"
+
+using namespace Fossilize;
+using namespace std;
+
+static void print_help()
+{
+	LOGI("Usage: fossilize-verify\n"
+	     "\t<database path>\n"
+	     "\t[--num-threads <count>]\n"
+	     "\t[--skip-references]\n"
+	     "\t[--max-reports <count>]\n");
+}
+
+template <typename T>
+static inline T fake_handle(uint64_t v)
+{
+	return (T)v;
+}
+
+static const char *tag_names[RESOURCE_COUNT] = {
+	"application info",
+	"sampler",
+	"descriptor set layout",
+	"pipeline layout",
+	"shader module",
+	"render pass",
+	"graphics pipeline",
+	"compute pipeline",
+	"application blob link",
+	"pipeline usage",
+	"dependency graph",
+};
+
+struct VerifyEntry
+{
+	ResourceTag tag;
+	Hash hash;
+	uint64_t offset;
+};
+
+struct CorruptEntry
+{
+	ResourceTag tag;
+	Hash hash;
+	string reason;
+};
+
+struct VerifyState
+{
+	DatabaseInterface *db = nullptr;
+	bool check_references = true;
+
+	std::mutex lock;
+	vector<CorruptEntry> corrupt_entries;
+	std::atomic<uint64_t> payload_bytes;
+	std::atomic<uint64_t> verified_entries;
+
+	VerifyState()
+	{
+		payload_bytes.store(0, std::memory_order_relaxed);
+		verified_entries.store(0, std::memory_order_relaxed);
+	}
+
+	void report(ResourceTag tag, Hash hash, string reason)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		corrupt_entries.push_back({ tag, hash, std::move(reason) });
+	}
+};
+
+// Walks the instruction stream, so truncated or garbled modules are caught without a full validator.
+static const char *check_spirv(const uint32_t *code, size_t size)
+{
+	if (size % sizeof(uint32_t) != 0)
+		return "SPIR-V size is not a multiple of 4";
+	size_t word_count = size / sizeof(uint32_t);
+	if (word_count < 5)
+		return "SPIR-V is too small to hold a header";
+	if (code[0] != 0x07230203u)
+		return "bad SPIR-V magic";
+	if (code[3] == 0)
+		return "SPIR-V ID bound is 0";
+
+	size_t offset = 5;
+	while (offset < word_count)
+	{
+		uint32_t instruction_words = code[offset] >> 16;
+		if (instruction_words == 0 || offset + instruction_words > word_count)
+			return "truncated SPIR-V instruction";
+		offset += instruction_words;
+	}
+
+	return nullptr;
+}
+
+// Hands out hashes as handles, and checks that the objects a create info refers to are in the database.
+struct VerifyCreator : StateCreatorInterface
+{
+	VerifyState *state = nullptr;
+	Hash current_hash = 0;
+	ResourceTag current_tag = RESOURCE_COUNT;
+	const char *spirv_error = nullptr;
+
+	void check_dependencies(ResourceTag tag, Hash hash, const void *create_info)
+	{
+		if (!state->check_references)
+			return;
+
+		size_t count = 0;
+		if (!DependencyGraph::get_dependencies(tag, create_info, &count, nullptr))
+			return;
+		vector<DependencyGraph::Dependency> dependencies(count);
+		if (!DependencyGraph::get_dependencies(tag, create_info, &count, dependencies.data()))
+			return;
+
+		for (auto &dep : dependencies)
+		{
+			if (!state->db->has_entry(dep.tag, dep.hash))
+			{
+				char reason[128];
+				snprintf(reason, sizeof(reason), "refers to missing %s %016" PRIx64, tag_names[dep.tag], dep.hash);
+				state->report(tag, hash, reason);
+			}
+		}
+	}
+
+	void notify_application_info_link(Hash link_hash, Hash, ResourceTag tag, Hash hash) override
+	{
+		if (state->check_references && tag < RESOURCE_COUNT && !state->db->has_entry(tag, hash))
+		{
+			char reason[128];
+			snprintf(reason, sizeof(reason), "links to missing %s %016" PRIx64, tag_names[tag], hash);
+			state->report(RESOURCE_APPLICATION_BLOB_LINK, link_hash, reason);
+		}
+	}
+
+	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *, VkSampler *sampler) override
+	{
+		*sampler = fake_handle<VkSampler>(hash);
+		return true;
+	}
+
+	bool enqueue_create_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo *create_info,
+	                                          VkDescriptorSetLayout *layout) override
+	{
+		*layout = fake_handle<VkDescriptorSetLayout>(hash);
+		check_dependencies(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, create_info);
+		return true;
+	}
+
+	bool enqueue_create_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo *create_info,
+	                                    VkPipelineLayout *layout) override
+	{
+		*layout = fake_handle<VkPipelineLayout>(hash);
+		check_dependencies(RESOURCE_PIPELINE_LAYOUT, hash, create_info);
+		return true;
+	}
+
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module) override
+	{
+		*module = fake_handle<VkShaderModule>(hash);
+		if (hash == current_hash && current_tag == RESOURCE_SHADER_MODULE)
+			spirv_error = check_spirv(create_info->pCode, create_info->codeSize);
+		return true;
+	}
+
+	bool enqueue_create_render_pass(Hash hash, const VkRenderPassCreateInfo *, VkRenderPass *render_pass) override
+	{
+		*render_pass = fake_handle<VkRenderPass>(hash);
+		return true;
+	}
+
+	bool enqueue_create_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		*pipeline = fake_handle<VkPipeline>(hash);
+		check_dependencies(RESOURCE_COMPUTE_PIPELINE, hash, create_info);
+		return true;
+	}
+
+	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *create_info, VkPipeline *pipeline) override
+	{
+		*pipeline = fake_handle<VkPipeline>(hash);
+		check_dependencies(RESOURCE_GRAPHICS_PIPELINE, hash, create_info);
+		return true;
+	}
+};
+
+static bool read_payload(VerifyState &state, const VerifyEntry &entry, vector<uint8_t> &payload)
+{
+	size_t raw_size = 0;
+	if (!state.db->read_entry(entry.tag, entry.hash, &raw_size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+	{
+		state.report(entry.tag, entry.hash, "payload header cannot be read");
+		return false;
+	}
+
+	size_t size = 0;
+	if (!state.db->read_entry(entry.tag, entry.hash, &size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
+	{
+		state.report(entry.tag, entry.hash, "payload header cannot be read");
+		return false;
+	}
+
+	// Leave room for in-situ parsing.
+	payload.resize(size + 1);
+	if (!state.db->read_entry(entry.tag, entry.hash, &size, payload.data(), PAYLOAD_READ_CONCURRENT_BIT))
+	{
+		state.report(entry.tag, entry.hash, "checksum mismatch or payload fails to decompress");
+		return false;
+	}
+
+	payload.resize(size);
+	state.payload_bytes.fetch_add(raw_size, std::memory_order_relaxed);
+	state.verified_entries.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+// Returns false if the payload is well-formed, but has to be parsed once the objects it refers to are known.
+static bool verify_payload(VerifyState &state, StateReplayer &replayer, VerifyCreator &creator,
+                           const VerifyEntry &entry, vector<uint8_t> &payload)
+{
+	switch (entry.tag)
+	{
+	case RESOURCE_DEPENDENCY_GRAPH:
+	{
+		ResourceTag graph_tag;
+		size_t count = 0;
+		if (!DependencyGraph::decode_entry(payload.data(), payload.size(), &graph_tag, &count, nullptr))
+			state.report(entry.tag, entry.hash, "malformed dependency graph entry");
+		return true;
+	}
+
+	case RESOURCE_SAMPLER:
+	case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+	case RESOURCE_PIPELINE_LAYOUT:
+	case RESOURCE_RENDER_PASS:
+	case RESOURCE_APPLICATION_INFO:
+		return false;
+
+	default:
+		break;
+	}
+
+	creator.current_tag = entry.tag;
+	creator.current_hash = entry.hash;
+	creator.spirv_error = nullptr;
+
+	payload.push_back(0);
+	if (!replayer.parse_insitu(creator, state.db, payload.data(), payload.size() - 1))
+		state.report(entry.tag, entry.hash, "failed to parse, malformed payload or missing dependency");
+	else if (creator.spirv_error)
+		state.report(entry.tag, entry.hash, creator.spirv_error);
+
+	replayer.get_allocator().reset();
+	return true;
+}
+
+// Entries are handed out in storage order in small runs, so every thread reads mostly sequentially.
+static void verify_entries(VerifyState &state, const StateReplayer *base_replayer, const vector<VerifyEntry> &entries,
+                           vector<vector<uint8_t>> *deferred_payloads, unsigned num_threads)
+{
+	static const size_t RunSize = 64;
+	std::atomic<size_t> next_index(0);
+	num_threads = unsigned(std::max<size_t>(1, std::min<size_t>(num_threads, (entries.size() + RunSize - 1) / RunSize)));
+
+	const auto worker = [&]() {
+		StateReplayer replayer;
+		replayer.set_resolve_shader_module_handles(false);
+		replayer.set_resolve_derivative_pipeline_handles(false);
+		if (base_replayer)
+			replayer.copy_handle_references(*base_replayer);
+
+		VerifyCreator creator;
+		creator.state = &state;
+		vector<uint8_t> payload;
+
+		size_t begin;
+		while ((begin = next_index.fetch_add(RunSize, std::memory_order_relaxed)) < entries.size())
+		{
+			size_t end = std::min(begin + RunSize, entries.size());
+			for (size_t i = begin; i < end; i++)
+			{
+				auto &entry = entries[i];
+				if (!read_payload(state, entry, payload))
+					continue;
+
+				if (!verify_payload(state, replayer, creator, entry, payload) && deferred_payloads)
+					(*deferred_payloads)[i] = std::move(payload);
+
+				// Parsed objects are never looked up again.
+				if (!base_replayer)
+					replayer.forget_handle_references();
+			}
+		}
+	};
+
+	vector<thread> threads;
+	for (unsigned i = 1; i < num_threads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto &t : threads)
+		t.join();
+}
+
+static void gather_entries(DatabaseInterface &db, const ResourceTag *tags, size_t tag_count, vector<VerifyEntry> &entries)
+{
+	vector<Hash> hashes;
+	bool has_offsets = true;
+
+	for (size_t i = 0; i < tag_count; i++)
+	{
+		size_t count = 0;
+		if (!db.get_hash_list_for_resource_tag(tags[i], &count, nullptr))
+			continue;
+		hashes.resize(count);
+		if (!db.get_hash_list_for_resource_tag(tags[i], &count, hashes.data()))
+			continue;
+
+		for (auto hash : hashes)
+		{
+			uint64_t offset = 0;
+			if (has_offsets && !db.get_entry_storage_offset(tags[i], hash, &offset))
+				has_offsets = false;
+			entries.push_back({ tags[i], hash, offset });
+		}
+	}
+
+	// Backends which do not know where entries are stored are read in hash order.
+	if (has_offsets)
+	{
+		std::stable_sort(entries.begin(), entries.end(), [](const VerifyEntry &a, const VerifyEntry &b) {
+			return a.offset < b.offset;
+		});
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	CLICallbacks cbs;
+	string db_path;
+	unsigned num_threads = 0;
+	unsigned max_reports = 100;
+	bool skip_references = false;
+
+	cbs.default_handler = [&](const char *path) { db_path = path; };
+	cbs.add("--help", [](CLIParser &parser) { print_help(); parser.end(); });
+	cbs.add("--num-threads", [&](CLIParser &parser) { num_threads = parser.next_uint(); });
+	cbs.add("--skip-references", [&](CLIParser &) { skip_references = true; });
+	cbs.add("--max-reports", [&](CLIParser &parser) { max_reports = parser.next_uint(); });
+	cbs.error_handler = [] { print_help(); };
+
+	CLIParser parser(move(cbs), argc - 1, argv + 1);
+	if (!parser.parse())
+		return EXIT_FAILURE;
+	if (parser.is_ended_state())
+		return EXIT_SUCCESS;
+
+	if (db_path.empty())
+	{
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	if (!num_threads)
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	auto db = unique_ptr<DatabaseInterface>(create_database(db_path.c_str(), DatabaseMode::ReadOnly));
+	if (!db || !db->prepare())
+	{
+		LOGE("Failed to load database: %s\n", db_path.c_str());
+		return EXIT_FAILURE;
+	}
+
+	auto start_time = std::chrono::steady_clock::now();
+
+	VerifyState state;
+	state.db = db.get();
+	state.check_references = !skip_references;
+
+	// Pipelines can only be parsed once the layouts and render passes they refer to are known,
+	// so everything else is read first. Every entry is still read only once.
+	static const ResourceTag object_tags[] = {
+		RESOURCE_APPLICATION_INFO,
+		RESOURCE_SAMPLER,
+		RESOURCE_DESCRIPTOR_SET_LAYOUT,
+		RESOURCE_PIPELINE_LAYOUT,
+		RESOURCE_SHADER_MODULE,
+		RESOURCE_RENDER_PASS,
+		RESOURCE_APPLICATION_BLOB_LINK,
+		RESOURCE_PIPELINE_USAGE,
+		RESOURCE_DEPENDENCY_GRAPH,
+	};
+	static const ResourceTag pipeline_tags[] = {
+		RESOURCE_GRAPHICS_PIPELINE,
+		RESOURCE_COMPUTE_PIPELINE,
+	};
+
+	vector<VerifyEntry> object_entries;
+	gather_entries(*db, object_tags, sizeof(object_tags) / sizeof(object_tags[0]), object_entries);
+	vector<vector<uint8_t>> deferred_payloads(object_entries.size());
+	verify_entries(state, nullptr, object_entries, &deferred_payloads, num_threads);
+
+	// Small objects refer to each other, so parse them in dependency order on one thread.
+	StateReplayer base_replayer;
+	VerifyCreator base_creator;
+	base_creator.state = &state;
+	for (auto tag : object_tags)
+	{
+		for (size_t i = 0; i < object_entries.size(); i++)
+		{
+			auto &entry = object_entries[i];
+			auto &payload = deferred_payloads[i];
+			if (entry.tag != tag || payload.empty())
+				continue;
+
+			if (!base_replayer.parse(base_creator, db.get(), payload.data(), payload.size()))
+				state.report(entry.tag, entry.hash, "failed to parse, malformed payload or missing dependency");
+			vector<uint8_t>().swap(payload);
+		}
+	}
+
+	vector<VerifyEntry> pipeline_entries;
+	gather_entries(*db, pipeline_tags, sizeof(pipeline_tags) / sizeof(pipeline_tags[0]), pipeline_entries);
+	verify_entries(state, &base_replayer, pipeline_entries, nullptr, num_threads);
+
+	double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	double mib = double(state.payload_bytes.load()) / (1024.0 * 1024.0);
+
+	auto &corrupt = state.corrupt_entries;
+	std::sort(corrupt.begin(), corrupt.end(), [](const CorruptEntry &a, const CorruptEntry &b) {
+		if (a.tag != b.tag)
+			return a.tag < b.tag;
+		return a.hash < b.hash;
+	});
+
+	for (size_t i = 0; i < corrupt.size() && i < max_reports; i++)
+		LOGE("%s %016" PRIx64 ": %s.\n", tag_names[corrupt[i].tag], corrupt[i].hash, corrupt[i].reason.c_str());
+	if (corrupt.size() > max_reports)
+		LOGE("... and %zu more.\n", corrupt.size() - max_reports);
+
+	size_t corrupt_per_tag[RESOURCE_COUNT] = {};
+	for (auto &entry : corrupt)
+		corrupt_per_tag[entry.tag]++;
+	for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
+		if (corrupt_per_tag[tag])
+			LOGE("  %zu problems in %s entries.\n", corrupt_per_tag[tag], tag_names[tag]);
+
+	LOGI("Verified %" PRIu64 " of %zu entries (%.1f MiB) in %.2f s, %.1f MiB/s.\n",
+	     state.verified_entries.load(), object_entries.size() + pipeline_entries.size(),
+	     mib, duration, duration > 0.0 ? mib / duration : 0.0);
+
+	if (!corrupt.empty())
+	{
+		LOGE("%zu problems found.\n", corrupt.size());
+		return EXIT_FAILURE;
+	}
+
+	LOGI("No problems found.\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,185 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "crc32c.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define FOSSILIZE_CRC32C_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <nmmintrin.h>
+#endif
+#elif defined(__ARM_FEATURE_CRC32)
+// Only used when the target guarantees the CRC32 extension, e.g. -march=armv8.1-a or +crc.
+#define FOSSILIZE_CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+namespace Fossilize
+{
+static const uint32_t Crc32cPolynomial = 0x82f63b78u;
+
+struct Crc32cTables
+{
+	// Slicing-by-8, so the fallback path consumes 8 bytes per iteration.
+	uint32_t table[8][256];
+
+	Crc32cTables()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t crc = i;
+			for (unsigned bit = 0; bit < 8; bit++)
+				crc = (crc >> 1) ^ ((crc & 1u) ? Crc32cPolynomial : 0u);
+			table[0][i] = crc;
+		}
+
+		for (uint32_t i = 0; i < 256; i++)
+			for (unsigned slice = 1; slice < 8; slice++)
+				table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xffu];
+	}
+};
+
+static const Crc32cTables &get_crc32c_tables()
+{
+	static const Crc32cTables tables;
+	return tables;
+}
+
+static inline uint32_t load_le32(const uint8_t *data)
+{
+	return uint32_t(data[0]) | (uint32_t(data[1]) << 8) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24);
+}
+
+uint32_t compute_crc32c_portable(uint32_t crc, const void *data, size_t size)
+{
+	auto &t = get_crc32c_tables().table;
+	auto *bytes = static_cast<const uint8_t *>(data);
+	crc = ~crc;
+
+	while (size >= 8)
+	{
+		uint32_t lo = load_le32(bytes) ^ crc;
+		uint32_t hi = load_le32(bytes + 4);
+		crc = t[7][lo & 0xffu] ^ t[6][(lo >> 8) & 0xffu] ^ t[5][(lo >> 16) & 0xffu] ^ t[4][lo >> 24] ^
+		      t[3][hi & 0xffu] ^ t[2][(hi >> 8) & 0xffu] ^ t[1][(hi >> 16) & 0xffu] ^ t[0][hi >> 24];
+		bytes += 8;
+		size -= 8;
+	}
+
+	while (size--)
+		crc = (crc >> 8) ^ t[0][(crc ^ *bytes++) & 0xffu];
+
+	return ~crc;
+}
+
+#if defined(FOSSILIZE_CRC32C_X86)
+#ifndef _MSC_VER
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t compute_crc32c_hardware(uint32_t crc, const void *data, size_t size)
+{
+	auto *bytes = static_cast<const uint8_t *>(data);
+	crc = ~crc;
+
+#if defined(__x86_64__) || defined(_M_X64)
+	uint64_t crc64 = crc;
+	while (size >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		bytes += 8;
+		size -= 8;
+	}
+	crc = uint32_t(crc64);
+#endif
+
+	while (size >= 4)
+	{
+		uint32_t word;
+		memcpy(&word, bytes, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+		bytes += 4;
+		size -= 4;
+	}
+
+	while (size--)
+		crc = _mm_crc32_u8(crc, *bytes++);
+
+	return ~crc;
+}
+
+static bool supports_crc32c_hardware()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 20)) != 0;
+#else
+	unsigned eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ecx & bit_SSE4_2) != 0;
+#endif
+}
+#elif defined(FOSSILIZE_CRC32C_ARM)
+static uint32_t compute_crc32c_hardware(uint32_t crc, const void *data, size_t size)
+{
+	auto *bytes = static_cast<const uint8_t *>(data);
+	crc = ~crc;
+
+	while (size >= 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes, sizeof(word));
+		crc = __crc32cd(crc, word);
+		bytes += 8;
+		size -= 8;
+	}
+
+	while (size--)
+		crc = __crc32cb(crc, *bytes++);
+
+	return ~crc;
+}
+
+static bool supports_crc32c_hardware()
+{
+	return true;
+}
+#endif
+
+uint32_t compute_crc32c(uint32_t crc, const void *data, size_t size)
+{
+#if defined(FOSSILIZE_CRC32C_X86) || defined(FOSSILIZE_CRC32C_ARM)
+	static const bool has_hardware = supports_crc32c_hardware();
+	if (has_hardware)
+		return compute_crc32c_hardware(crc, data, size);
+#endif
+	return compute_crc32c_portable(crc, data, size);
+}
+}
@@ -24,18 +24,29 @@
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <chrono>
+#include <memory>
 #include <stddef.h>
 #include "fossilize_inttypes.h"
 #include "fossilize.hpp"
 #include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <queue>
+#include <deque>
+#include <type_traits>
 #include <string.h>
 #include <stdarg.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 #include "varint.hpp"
+#include "xxhash64.hpp"
+#include "spirv_delta.hpp"
 #include "path.hpp"
 #include "fossilize_db.hpp"
 #include "layer/utils.hpp"
+#include "util/flat_hash_map.hpp"
 #include "fossilize_errors.hpp"
 #include "fossilize_application_filter.hpp"
 
@@ -45,15 +56,30 @@
 #include "rapidjson/writer.h"
 using namespace rapidjson;
 
-
-#ifdef PRETTY_WRITER
-using CustomWriter = PrettyWriter<StringBuffer>;
-#else
-using CustomWriter = Writer<StringBuffer>;
+#ifdef FOSSILIZE_HAVE_SIMDJSON
+#include "simdjson.h"
 #endif
 
+
 using namespace std;
 
+// Every pNext struct Fossilize can record and replay, as X(sType, struct type).
+// Hashing, copying, JSON and binary serialization all dispatch through this list,
+// so supporting a new struct means adding it here and providing hash_pnext_struct(), copy_pnext_struct(),
+// json_value(), parse_pnext_struct() and binary_transfer() overloads for it.
+#define FOSSILIZE_PNEXT_STRUCTS(X) \
+	X(VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_DOMAIN_ORIGIN_STATE_CREATE_INFO, VkPipelineTessellationDomainOriginStateCreateInfo) \
+	X(VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_DIVISOR_STATE_CREATE_INFO_EXT, VkPipelineVertexInputDivisorStateCreateInfoEXT) \
+	X(VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_DEPTH_CLIP_STATE_CREATE_INFO_EXT, VkPipelineRasterizationDepthClipStateCreateInfoEXT) \
+	X(VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_STREAM_CREATE_INFO_EXT, VkPipelineRasterizationStateStreamCreateInfoEXT) \
+	X(VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO, VkRenderPassMultiviewCreateInfo) \
+	X(VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT, VkDescriptorSetLayoutBindingFlagsCreateInfoEXT) \
+	X(VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_ADVANCED_STATE_CREATE_INFO_EXT, VkPipelineColorBlendAdvancedStateCreateInfoEXT) \
+	X(VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT, VkPipelineRasterizationConservativeStateCreateInfoEXT) \
+	X(VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_LINE_STATE_CREATE_INFO_EXT, VkPipelineRasterizationLineStateCreateInfoEXT) \
+	X(VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT, VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT) \
+	X(VK_STRUCTURE_TYPE_MUTABLE_DESCRIPTOR_TYPE_CREATE_INFO_VALVE, VkMutableDescriptorTypeCreateInfoVALVE)
+
 namespace Fossilize
 {
 class Hasher
@@ -64,14 +90,27 @@ public:
 	{
 	}
 
+	explicit Hasher(HashAlgorithm algorithm_)
+		: algorithm(algorithm_)
+	{
+	}
+
 	Hasher() = default;
 
 	template <typename T>
 	inline void data(const T *data_, size_t size)
 	{
 		size /= sizeof(*data_);
-		for (size_t i = 0; i < size; i++)
-			h = (h * 0x100000001b3ull) ^ data_[i];
+		if (algorithm == HashAlgorithm::XXH64)
+		{
+			// Bulk data is hashed separately and folded into the running hash.
+			u64(compute_xxh64(data_, size * sizeof(*data_), h));
+		}
+		else
+		{
+			for (size_t i = 0; i < size; i++)
+				h = (h * 0x100000001b3ull) ^ data_[i];
+		}
 	}
 
 	inline void u32(uint32_t value)
@@ -129,6 +168,7 @@ public:
 
 private:
 	Hash h = 0xcbf29ce484222325ull;
+	HashAlgorithm algorithm = HashAlgorithm::FNV1A;
 };
 
 template <typename T>
@@ -138,19 +178,40 @@ struct HashedInfo
 	T info;
 };
 
-template <typename Allocator>
-static Value uint64_string(uint64_t value, Allocator &alloc)
-{
-	char str[17]; // 16 digits + null
-	sprintf(str, "%016" PRIx64, value);
-	return Value(str, alloc);
-}
+// Starts every binary payload. Can never begin a JSON document.
+static const uint8_t binary_payload_magic[4] = { 0x89, 'F', 'Z', 'B' };
 
 struct StateReplayer::Impl
 {
 	bool parse(StateCreatorInterface &iface, DatabaseInterface *resolver, const void *buffer, size_t size) FOSSILIZE_WARN_UNUSED;
+	bool parse_insitu(StateCreatorInterface &iface, DatabaseInterface *resolver, void *buffer, size_t size) FOSSILIZE_WARN_UNUSED;
+	bool parse_payload(StateCreatorInterface &iface, DatabaseInterface *resolver,
+	                   const uint8_t *buffer, uint8_t *insitu_buffer, size_t size) FOSSILIZE_WARN_UNUSED;
+	bool parse_json_payload(StateCreatorInterface &iface, DatabaseInterface *resolver,
+	                        const uint8_t *buffer, uint8_t *insitu_buffer, size_t size) FOSSILIZE_WARN_UNUSED;
+	bool parse_document(StateCreatorInterface &iface, DatabaseInterface *resolver, Document &doc,
+	                    const char *json, char *insitu_json, size_t json_size,
+	                    const uint8_t *varint, size_t varint_size) FOSSILIZE_WARN_UNUSED;
+	bool parse_json_text(Document &doc, const char *json, char *insitu_json, size_t json_size) FOSSILIZE_WARN_UNUSED;
 	ScratchAllocator allocator;
 
+	// Backing memory for the document allocator, grown to the largest document seen so far.
+	// Reused across parses so steady-state parsing does not have to allocate document chunks.
+	std::vector<uint8_t> json_pool;
+	unsigned json_parse_depth = 0;
+
+#ifdef FOSSILIZE_HAVE_SIMDJSON
+	JsonParseBackend json_parse_backend = JsonParseBackend::Simdjson;
+	// The document is fully built before anything in it is replayed, so nested parses can reuse these.
+	// Strings are copied into the document, as the parser's string buffer is overwritten by the next parse.
+	simdjson::ondemand::parser simdjson_parser;
+	// simdjson reads past the end of the input, payloads are copied here with the padding it needs.
+	std::vector<char> simdjson_input;
+	bool parse_json_simdjson(Document &doc, const char *json, size_t json_size) FOSSILIZE_WARN_UNUSED;
+#else
+	JsonParseBackend json_parse_backend = JsonParseBackend::RapidJSON;
+#endif
+
 	std::unordered_map<Hash, VkSampler> replayed_samplers;
 	std::unordered_map<Hash, VkDescriptorSetLayout> replayed_descriptor_set_layouts;
 	std::unordered_map<Hash, VkPipelineLayout> replayed_pipeline_layouts;
@@ -160,6 +221,7 @@ struct StateReplayer::Impl
 	std::unordered_map<Hash, VkPipeline> replayed_graphics_pipelines;
 
 	void copy_handle_references(const Impl &impl);
+	void merge_handle_references(const Impl &impl);
 	void forget_handle_references();
 	bool parse_samplers(StateCreatorInterface &iface, const Value &samplers) FOSSILIZE_WARN_UNUSED;
 	bool parse_descriptor_set_layouts(StateCreatorInterface &iface, const Value &layouts) FOSSILIZE_WARN_UNUSED;
@@ -172,6 +234,15 @@ struct StateReplayer::Impl
 	bool parse_graphics_pipeline(StateCreatorInterface &iface, DatabaseInterface *resolver, const Value &pipelines, const Value &member) FOSSILIZE_WARN_UNUSED;
 	bool parse_application_info(StateCreatorInterface &iface, const Value &app_info, const Value &pdf_info) FOSSILIZE_WARN_UNUSED;
 	bool parse_application_info_link(StateCreatorInterface &iface, const Value &link) FOSSILIZE_WARN_UNUSED;
+	bool parse_pipeline_usage(StateCreatorInterface &iface, const Value &usage) FOSSILIZE_WARN_UNUSED;
+	bool parse_binary(StateCreatorInterface &iface, DatabaseInterface *resolver, const uint8_t *buffer, size_t size) FOSSILIZE_WARN_UNUSED;
+
+	class BinaryPayloadReader;
+
+	template <typename T, typename Handle>
+	bool parse_binary_object(BinaryPayloadReader &reader, StateCreatorInterface &iface, Hash hash,
+	                         std::unordered_map<Hash, Handle> &replayed,
+	                         bool (StateCreatorInterface::*enqueue)(Hash, const T *, Handle *)) FOSSILIZE_WARN_UNUSED;
 
 	bool parse_push_constant_ranges(const Value &ranges, const VkPushConstantRange **out_ranges) FOSSILIZE_WARN_UNUSED;
 	bool parse_set_layouts(const Value &layouts, const VkDescriptorSetLayout **out_layouts) FOSSILIZE_WARN_UNUSED;
@@ -200,22 +271,34 @@ struct StateReplayer::Impl
 	bool parse_vertex_attributes(const Value &attributes, const VkVertexInputAttributeDescription **out_desc) FOSSILIZE_WARN_UNUSED;
 	bool parse_vertex_bindings(const Value &bindings, const VkVertexInputBindingDescription **out_desc) FOSSILIZE_WARN_UNUSED;
 	bool parse_blend_attachments(const Value &attachments, const VkPipelineColorBlendAttachmentState **out_state) FOSSILIZE_WARN_UNUSED;
-	bool parse_tessellation_domain_origin_state(const Value &state, VkPipelineTessellationDomainOriginStateCreateInfo **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_vertex_input_divisor_state(const Value &state, VkPipelineVertexInputDivisorStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_rasterization_depth_clip_state(const Value &state, VkPipelineRasterizationDepthClipStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_rasterization_stream_state(const Value &state, VkPipelineRasterizationStateStreamCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_multiview_state(const Value &state, VkRenderPassMultiviewCreateInfo **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_descriptor_set_binding_flags(const Value &state, VkDescriptorSetLayoutBindingFlagsCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_color_blend_advanced_state(const Value &state, VkPipelineColorBlendAdvancedStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_rasterization_conservative_state(const Value &state, VkPipelineRasterizationConservativeStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_rasterization_line_state(const Value &state, VkPipelineRasterizationLineStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_shader_stage_required_subgroup_size(const Value &state, VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
-	bool parse_mutable_descriptor_type(const Value &state, VkMutableDescriptorTypeCreateInfoVALVE **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkPipelineTessellationDomainOriginStateCreateInfo **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkPipelineVertexInputDivisorStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkPipelineRasterizationDepthClipStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkPipelineRasterizationStateStreamCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkRenderPassMultiviewCreateInfo **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkDescriptorSetLayoutBindingFlagsCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkPipelineColorBlendAdvancedStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkPipelineRasterizationConservativeStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkPipelineRasterizationLineStateCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT **out_info) FOSSILIZE_WARN_UNUSED;
+	bool parse_pnext_struct(const Value &state, VkMutableDescriptorTypeCreateInfoVALVE **out_info) FOSSILIZE_WARN_UNUSED;
 	bool parse_uints(const Value &attachments, const uint32_t **out_uints) FOSSILIZE_WARN_UNUSED;
 	bool parse_sints(const Value &attachments, const int32_t **out_uints) FOSSILIZE_WARN_UNUSED;
 	const char *duplicate_string(const char *str, size_t len);
+
+	template <typename T>
+	bool resolve_handle(const char *type, ResourceTag tag, std::unordered_map<Hash, T> &replayed, Hash hash, T *handle) FOSSILIZE_WARN_UNUSED;
+	bool resolve_shader_module(StateCreatorInterface &iface, DatabaseInterface *resolver, Hash module, VkShaderModule *out_module) FOSSILIZE_WARN_UNUSED;
+	bool resolve_base_pipeline(StateCreatorInterface &iface, DatabaseInterface *resolver, ResourceTag tag, Hash pipeline, VkPipeline *out_pipeline) FOSSILIZE_WARN_UNUSED;
+	bool replay_missing_trivial_object(ResourceTag tag, Hash hash);
 	bool resolve_derivative_pipelines = true;
 	bool resolve_shader_modules = true;
+	bool resolve_trivial_objects = false;
+
+	// The creator and database of the payload being parsed.
+	// Trivial objects resolved on demand are replayed through these.
+	StateCreatorInterface *active_iface = nullptr;
+	DatabaseInterface *active_resolver = nullptr;
 
 	template <typename T>
 	T *copy(const T *src, size_t count);
@@ -226,10 +309,49 @@ struct WorkItem
 	uint64_t handle;
 	void *create_info;
 	Hash custom_hash;
+	// Set for objects the database held from a prior session. Only the handle mapping is recorded,
+	// and there is no create info.
+	ResourceTag prior_tag;
+};
+
+// One entry in the ring of objects pending for the recording thread.
+// sequence follows the bounded MPMC queue scheme by Dmitry Vyukov:
+// sequence == position means the slot is free for the producer claiming position,
+// sequence == position + 1 means the item is published for the recording thread.
+// Each slot owns the memory its create info is copied into, so producers never share an allocator.
+struct RecordSlot
+{
+	std::atomic<uint64_t> sequence;
+	WorkItem item;
+	ScratchAllocator allocator { 4 * 1024 };
+};
+
+// An object handed to a serialization worker. The worker owns it until it sets completed.
+struct SerializeJob
+{
+	ResourceTag tag;
+	Hash hash;
+	const void *create_info;
+	bool success;
+	bool completed;
+	std::vector<uint8_t> blob;
+	ScratchAllocator allocator;
+};
+
+// A database write which has to wait for objects recorded before it to be serialized.
+// job is nullptr if the entry was written by the recording thread itself.
+struct OrderedWrite
+{
+	SerializeJob *job;
+	ResourceTag tag;
+	Hash hash;
+	PayloadWriteFlags payload_flags;
+	std::vector<uint8_t> blob;
 };
 
 struct StateRecorder::Impl
 {
+	Impl();
 	~Impl();
 	void sync_thread();
 	void record_end();
@@ -247,13 +369,15 @@ struct StateRecorder::Impl
 	std::unordered_map<Hash, VkRenderPassCreateInfo *> render_passes;
 	std::unordered_map<Hash, VkSamplerCreateInfo *> samplers;
 
-	std::unordered_map<VkDescriptorSetLayout, Hash> descriptor_set_layout_to_hash;
-	std::unordered_map<VkPipelineLayout, Hash> pipeline_layout_to_hash;
-	std::unordered_map<VkShaderModule, Hash> shader_module_to_hash;
-	std::unordered_map<VkPipeline, Hash> graphics_pipeline_to_hash;
-	std::unordered_map<VkPipeline, Hash> compute_pipeline_to_hash;
-	std::unordered_map<VkRenderPass, Hash> render_pass_to_hash;
-	std::unordered_map<VkSampler, Hash> sampler_to_hash;
+	// Keyed by the 64-bit handle value. With a database, these tables are all that is kept
+	// of an object once it has been written, so they must stay compact.
+	FlatHashMap<Hash> descriptor_set_layout_to_hash;
+	FlatHashMap<Hash> pipeline_layout_to_hash;
+	FlatHashMap<Hash> shader_module_to_hash;
+	FlatHashMap<Hash> graphics_pipeline_to_hash;
+	FlatHashMap<Hash> compute_pipeline_to_hash;
+	FlatHashMap<Hash> render_pass_to_hash;
+	FlatHashMap<Hash> sampler_to_hash;
 
 	VkApplicationInfo *application_info = nullptr;
 	VkPhysicalDeviceFeatures2 *physical_device_features = nullptr;
@@ -312,6 +436,8 @@ struct StateRecorder::Impl
 	bool remap_pipeline_layout_ci(VkPipelineLayoutCreateInfo *create_info) FOSSILIZE_WARN_UNUSED;
 	bool remap_shader_module_ci(VkShaderModuleCreateInfo *create_info) FOSSILIZE_WARN_UNUSED;
 	bool remap_graphics_pipeline_ci(VkGraphicsPipelineCreateInfo *create_info) FOSSILIZE_WARN_UNUSED;
+	bool hash_and_remap_graphics_pipeline_ci(const StateRecorder *recorder, VkGraphicsPipelineCreateInfo *create_info,
+	                                         Hash *out_hash) const FOSSILIZE_WARN_UNUSED;
 	bool remap_compute_pipeline_ci(VkComputePipelineCreateInfo *create_info) FOSSILIZE_WARN_UNUSED;
 	bool remap_sampler_ci(VkSamplerCreateInfo *create_info) FOSSILIZE_WARN_UNUSED;
 	bool remap_render_pass_ci(VkRenderPassCreateInfo *create_info) FOSSILIZE_WARN_UNUSED;
@@ -328,13 +454,161 @@ struct StateRecorder::Impl
 	bool serialize_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo &create_info, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
 	bool serialize_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo &create_info, std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
 
+	// Objects are handed to the recording thread through a lock-free ring of slots.
+	// When the ring is full in RecordQueueMode::Unbounded, objects spill into overflow_queue under record_lock.
+	// While overflow_pending is set, every producer spills, so objects stay in order:
+	// the recording thread drains the ring before the spilled objects.
+	// record_lock also serves the recording thread going to sleep, producers only take it
+	// to wake up the recording thread if it is actually asleep.
+	std::unique_ptr<RecordSlot[]> record_ring;
+	uint64_t record_ring_mask = 0;
+	std::atomic<uint64_t> record_enqueue_pos;
+	uint64_t record_dequeue_pos = 0;
+	RecordQueueMode record_queue_mode = RecordQueueMode::Unbounded;
+
 	std::mutex record_lock;
 	std::condition_variable record_cv;
-	std::queue<WorkItem> record_queue;
+	std::condition_variable record_space_cv;
+	std::queue<WorkItem> overflow_queue;
+	std::atomic<bool> overflow_pending;
+	std::atomic<bool> record_thread_sleeping;
+	std::atomic<uint32_t> record_space_waiters;
+	std::atomic<uint64_t> dropped_records;
+	// Published once the recording thread has prepared database_iface, for lookups from other threads.
+	std::atomic<DatabaseInterface *> prepared_database;
+	bool skip_prior_objects = false;
+	bool canonicalize_pipeline_state = false;
+	bool flush_on_idle = true;
+	std::atomic<bool> flush_requested;
+
+	// Bind counts from record_pipeline_usage() are resolved to pipeline hashes by the recording thread
+	// once the ring is drained, as a pipeline is always recorded before it can be bound.
+	struct PendingPipelineUsage
+	{
+		ResourceTag tag;
+		uint64_t handle;
+		uint64_t count;
+	};
+
+	struct PipelineUsage
+	{
+		ResourceTag tag;
+		uint64_t count;
+	};
+
+	std::mutex pipeline_usage_lock;
+	std::vector<PendingPipelineUsage> pending_pipeline_usage;
+	std::atomic<bool> pipeline_usage_pending;
+	// Only used by the recording thread. Each write gets its own key, derived from a per-session nonce.
+	std::unordered_map<Hash, PipelineUsage> unwritten_pipeline_usage;
+	std::chrono::steady_clock::time_point last_pipeline_usage_write;
+	Hash pipeline_usage_session = 0;
+	uint32_t pipeline_usage_generation = 0;
+
+	void resolve_pipeline_usage(bool write_database_entries);
+	bool write_pipeline_usage(std::vector<uint8_t> &blob, PayloadWriteFlags payload_flags);
+	bool serialize_pipeline_usage(std::vector<uint8_t> &blob) const FOSSILIZE_WARN_UNUSED;
+
+	// Scratch space for RESOURCE_DEPENDENCY_GRAPH entries, only used by the recording thread.
+	bool record_dependency_graph = false;
+	std::vector<DependencyGraph::Dependency> dependencies;
+	std::vector<uint8_t> dependency_blob;
+	void write_dependency_graph_entry(ResourceTag tag, Hash hash, const void *create_info, PayloadWriteFlags payload_flags);
+
+	// Counters for RecorderStatistics, which are only updated if statistics_enabled is set.
+	struct LatencyCounters
+	{
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> total_ns;
+		std::atomic<uint64_t> max_ns;
+		std::atomic<uint64_t> buckets[RecorderStatistics::LatencyBucketCount];
+	};
+
+	// Adds the duration of a record_*() call to record_latency when it goes out of scope.
+	struct LatencyScope
+	{
+		LatencyScope(Impl &impl, ResourceTag tag);
+		~LatencyScope();
+		Impl &impl;
+		ResourceTag tag;
+		std::chrono::steady_clock::time_point start_time;
+	};
+
+	bool statistics_enabled = false;
+	LatencyCounters record_latency[RESOURCE_COUNT];
+	std::atomic<uint64_t> bytes_copied;
+	std::atomic<uint64_t> queue_high_water_mark;
+	std::atomic<uint64_t> allocator_peak_bytes;
+	// Updated from const helpers on the recording thread.
+	mutable std::atomic<uint64_t> database_entries_written;
+	mutable std::atomic<uint64_t> database_bytes_written;
+	mutable std::atomic<uint64_t> database_write_ns;
+	mutable std::atomic<uint64_t> uncompressed_backlog_payloads;
+	// Compression totals of the database as of the end of recording, once it is no longer referenced.
+	std::mutex final_compression_lock;
+	DatabaseCompressionStatistics final_compression = {};
+
+	void reset_statistics();
+	void update_queue_high_water_mark(uint64_t depth);
+	void write_database_entry(ResourceTag tag, Hash hash, const std::vector<uint8_t> &blob, PayloadWriteFlags payload_flags) const;
+	void commit_database_entry(ResourceTag tag, Hash hash, const std::vector<uint8_t> &blob, PayloadWriteFlags payload_flags) const;
 	std::thread worker_thread;
+	std::mutex inline_record_lock;
+
+	void init_record_ring(uint32_t capacity);
+	bool record_ring_has_data() const;
+	void wake_record_thread();
+	bool is_prior_object(ResourceTag tag, Hash hash) const;
+	template <typename HashFunc>
+	Hash compute_early_hash(Hash custom_hash, const HashFunc &hash_func) const;
+	template <typename CopyFunc>
+	bool push_work_item(StateRecorder *recorder, ResourceTag tag, uint64_t handle, Hash custom_hash,
+	                    const CopyFunc &copy_func) FOSSILIZE_WARN_UNUSED;
+	void push_overflow_item(const WorkItem &item);
+	bool record_work_item(StateRecorder *recorder, const WorkItem &record_item, std::vector<uint8_t> &blob,
+	                      PayloadWriteFlags payload_flags, bool write_database_entries);
+	bool record_prior_object(const WorkItem &record_item, std::vector<uint8_t> &blob, bool write_database_entries);
+
+	// The recording thread hashes and remaps objects in order, since later objects refer to earlier ones.
+	// Serialization of objects which go to the database can be farmed out to worker threads however.
+	// Only the recording thread writes to the database, and entries are written in the order they were recorded,
+	// so the output does not depend on how fast each worker is.
+	unsigned serialize_worker_count = 0;
+	std::vector<std::thread> serialize_workers;
+	std::vector<std::unique_ptr<SerializeJob>> serialize_jobs;
+	std::vector<SerializeJob *> free_jobs;
+	std::queue<SerializeJob *> pending_jobs;
+	mutable std::deque<OrderedWrite> ordered_writes;
+	std::unordered_set<Hash> in_flight_hashes[RESOURCE_COUNT];
+	std::mutex serialize_lock;
+	std::condition_variable serialize_cv;
+	std::condition_variable serialize_done_cv;
+	std::atomic<bool> serialize_completed_pending;
+	bool serialize_workers_done = false;
+
+	void start_serialize_workers();
+	void stop_serialize_workers();
+	void serialize_worker();
+	void wait_for_oldest_job();
+	bool serialize_object(ResourceTag tag, Hash hash, const void *create_info,
+	                      std::vector<uint8_t> &blob, ScratchAllocator &blob_allocator) const FOSSILIZE_WARN_UNUSED;
+	bool copy_object(ResourceTag tag, const void *create_info, ScratchAllocator &alloc, const void **out_info) FOSSILIZE_WARN_UNUSED;
+	bool write_object(ResourceTag tag, Hash hash, const void *create_info, std::vector<uint8_t> &blob,
+	                  PayloadWriteFlags payload_flags);
+	bool write_completed_jobs();
 
 	bool compression = false;
 	bool checksum = false;
+	DatabaseCompressionAlgorithm compression_algorithm = DatabaseCompressionAlgorithm::Deflate;
+	// Only used by the recording thread. Compression stays off from adaptive_compression_backlog queued objects
+	// until the queue drains to half of that, so it does not flip back and forth on every object.
+	uint32_t adaptive_compression_backlog = 0;
+	bool compression_bypassed = false;
+	PayloadWriteFlags get_backlog_payload_flags(PayloadWriteFlags payload_flags, uint64_t backlog);
+	DatabaseChecksumAlgorithm checksum_algorithm = DatabaseChecksumAlgorithm::CRC32;
+	HashAlgorithm hash_algorithm = HashAlgorithm::FNV1A;
+	ShaderModuleEncoding shader_module_encoding = ShaderModuleEncoding::Varint;
+	PayloadEncoding payload_encoding = PayloadEncoding::JSON;
 
 	void record_task(StateRecorder *recorder, bool looping);
 
@@ -414,7 +688,7 @@ static Hash compute_hash_application_info_link(const StateRecorderApplicationFea
 	return h.get();
 }
 
-static Hash compute_hash_application_info_link(Hash app_hash, ResourceTag tag, Hash hash)
+Hash compute_hash_application_info_link(Hash app_hash, ResourceTag tag, Hash hash)
 {
 	Hasher h;
 	h.u64(app_hash);
@@ -518,9 +792,9 @@ bool compute_hash_pipeline_layout(const StateRecorder &recorder, const VkPipelin
 	return true;
 }
 
-bool compute_hash_shader_module(const VkShaderModuleCreateInfo &create_info, Hash *out_hash)
+bool compute_hash_shader_module(const VkShaderModuleCreateInfo &create_info, Hash *out_hash, HashAlgorithm algorithm)
 {
-	Hasher h;
+	Hasher h(algorithm);
 	h.data(create_info.pCode, create_info.codeSize);
 	h.u32(create_info.flags);
 	*out_hash = h.get();
@@ -657,49 +931,12 @@ static bool hash_pnext_chain(const StateRecorder *recorder, Hasher &h, const voi
 
 		switch (pin->sType)
 		{
-		case VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_DOMAIN_ORIGIN_STATE_CREATE_INFO:
-			hash_pnext_struct(recorder, h, *static_cast<const VkPipelineTessellationDomainOriginStateCreateInfo *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_DIVISOR_STATE_CREATE_INFO_EXT:
-			hash_pnext_struct(recorder, h, *static_cast<const VkPipelineVertexInputDivisorStateCreateInfoEXT *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_DEPTH_CLIP_STATE_CREATE_INFO_EXT:
-			hash_pnext_struct(recorder, h, *static_cast<const VkPipelineRasterizationDepthClipStateCreateInfoEXT *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_STREAM_CREATE_INFO_EXT:
-			hash_pnext_struct(recorder, h, *static_cast<const VkPipelineRasterizationStateStreamCreateInfoEXT *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO:
-			hash_pnext_struct(recorder, h, *static_cast<const VkRenderPassMultiviewCreateInfo *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT:
-			hash_pnext_struct(recorder, h, *static_cast<const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_ADVANCED_STATE_CREATE_INFO_EXT:
-			hash_pnext_struct(recorder, h, *static_cast<const VkPipelineColorBlendAdvancedStateCreateInfoEXT *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT:
-			hash_pnext_struct(recorder, h, *static_cast<const VkPipelineRasterizationConservativeStateCreateInfoEXT *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_LINE_STATE_CREATE_INFO_EXT:
-			hash_pnext_struct(recorder, h, *static_cast<const VkPipelineRasterizationLineStateCreateInfoEXT *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT:
-			hash_pnext_struct(recorder, h, *static_cast<const VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT *>(pNext));
-			break;
-
-		case VK_STRUCTURE_TYPE_MUTABLE_DESCRIPTOR_TYPE_CREATE_INFO_VALVE:
-			hash_pnext_struct(recorder, h, *static_cast<const VkMutableDescriptorTypeCreateInfoVALVE *>(pNext));
+#define FOSSILIZE_HASH_PNEXT_STRUCT(stype, T) \
+		case stype: \
+			hash_pnext_struct(recorder, h, *static_cast<const T *>(pNext)); \
 			break;
+		FOSSILIZE_PNEXT_STRUCTS(FOSSILIZE_HASH_PNEXT_STRUCT)
+#undef FOSSILIZE_HASH_PNEXT_STRUCT
 
 		default:
 			log_error_pnext_chain("Unsupported pNext found, cannot hash.", pNext);
@@ -712,26 +949,55 @@ static bool hash_pnext_chain(const StateRecorder *recorder, Hasher &h, const voi
 	return true;
 }
 
-bool compute_hash_graphics_pipeline(const StateRecorder &recorder, const VkGraphicsPipelineCreateInfo &create_info, Hash *out_hash)
+// Looks up the hashes of the objects a pipeline refers to.
+struct PipelineHandleLookup
 {
-	Hasher h;
+	const StateRecorder &recorder;
+
+	bool resolve_base_pipeline(const VkPipeline &pipeline, Hash *hash) const
+	{
+		return recorder.get_hash_for_graphics_pipeline_handle(pipeline, hash);
+	}
+
+	bool resolve_layout(const VkPipelineLayout &layout, Hash *hash) const
+	{
+		return recorder.get_hash_for_pipeline_layout(layout, hash);
+	}
+
+	bool resolve_render_pass(const VkRenderPass &render_pass, Hash *hash) const
+	{
+		return recorder.get_hash_for_render_pass(render_pass, hash);
+	}
+
+	bool resolve_shader_module(const VkShaderModule &module, Hash *hash) const
+	{
+		return recorder.get_hash_for_shader_module(module, hash);
+	}
+};
+
+// Every handle in create_info goes through the resolver exactly once, which may also rewrite it.
+template <typename Resolver>
+static bool hash_graphics_pipeline(const StateRecorder &recorder, const VkGraphicsPipelineCreateInfo &create_info,
+                                   const Resolver &resolver, Hash *out_hash)
+{
+	Hasher h(recorder.get_hash_algorithm());
 	Hash hash;
 
 	h.u32(create_info.flags);
 
 	if (create_info.basePipelineHandle != VK_NULL_HANDLE)
 	{
-		if (!recorder.get_hash_for_graphics_pipeline_handle(create_info.basePipelineHandle, &hash))
+		if (!resolver.resolve_base_pipeline(create_info.basePipelineHandle, &hash))
 			return false;
 		h.u64(hash);
 		h.s32(create_info.basePipelineIndex);
 	}
 
-	if (!recorder.get_hash_for_pipeline_layout(create_info.layout, &hash))
+	if (!resolver.resolve_layout(create_info.layout, &hash))
 		return false;
 	h.u64(hash);
 
-	if (!recorder.get_hash_for_render_pass(create_info.renderPass, &hash))
+	if (!resolver.resolve_render_pass(create_info.renderPass, &hash))
 		return false;
 	h.u64(hash);
 
@@ -1040,7 +1306,7 @@ bool compute_hash_graphics_pipeline(const StateRecorder &recorder, const VkGraph
 		h.string(stage.pName);
 		h.u32(stage.stage);
 
-		if (!recorder.get_hash_for_shader_module(stage.module, &hash))
+		if (!resolver.resolve_shader_module(stage.module, &hash))
 			return false;
 		h.u64(hash);
 
@@ -1057,9 +1323,14 @@ bool compute_hash_graphics_pipeline(const StateRecorder &recorder, const VkGraph
 	return true;
 }
 
+bool compute_hash_graphics_pipeline(const StateRecorder &recorder, const VkGraphicsPipelineCreateInfo &create_info, Hash *out_hash)
+{
+	return hash_graphics_pipeline(recorder, create_info, PipelineHandleLookup{ recorder }, out_hash);
+}
+
 bool compute_hash_compute_pipeline(const StateRecorder &recorder, const VkComputePipelineCreateInfo &create_info, Hash *out_hash)
 {
-	Hasher h;
+	Hasher h(recorder.get_hash_algorithm());
 	Hash hash;
 
 	if (!recorder.get_hash_for_pipeline_layout(create_info.layout, &hash))
@@ -1287,6 +1558,8 @@ bool StateReplayer::Impl::parse_immutable_samplers(const Value &samplers, const
 		if (index > 0)
 		{
 			auto sampler_itr = replayed_samplers.find(index);
+			if (sampler_itr == end(replayed_samplers) && replay_missing_trivial_object(RESOURCE_SAMPLER, index))
+				sampler_itr = replayed_samplers.find(index);
 			if (sampler_itr == end(replayed_samplers))
 			{
 				log_missing_resource("Immutable sampler", index);
@@ -1315,6 +1588,20 @@ void StateRecorder::Impl::sync_thread()
 	}
 }
 
+StateRecorder::Impl::Impl()
+{
+	overflow_pending.store(false);
+	serialize_completed_pending.store(false);
+	record_thread_sleeping.store(false);
+	record_space_waiters.store(0);
+	dropped_records.store(0);
+	prepared_database.store(nullptr);
+	pipeline_usage_pending.store(false);
+	flush_requested.store(false);
+	reset_statistics();
+	init_record_ring(256);
+}
+
 StateRecorder::Impl::~Impl()
 {
 	sync_thread();
@@ -1369,6 +1656,8 @@ bool StateReplayer::Impl::parse_set_layouts(const Value &layouts, const VkDescri
 		if (index > 0)
 		{
 			auto set_itr = replayed_descriptor_set_layouts.find(index);
+			if (set_itr == end(replayed_descriptor_set_layouts) && replay_missing_trivial_object(RESOURCE_DESCRIPTOR_SET_LAYOUT, index))
+				set_itr = replayed_descriptor_set_layouts.find(index);
 			if (set_itr == end(replayed_descriptor_set_layouts))
 			{
 				log_missing_resource("Descriptor set layout", index);
@@ -1425,6 +1714,25 @@ bool StateReplayer::Impl::parse_shader_modules(StateCreatorInterface &iface, con
 
 			info.pCode = decoded;
 		}
+		else if (obj.HasMember("spirvOffset") && obj.HasMember("spirvSize"))
+		{
+			uint32_t *decoded = static_cast<uint32_t *>(allocator.allocate_raw(info.codeSize, 64));
+			auto offset = obj["spirvOffset"].GetUint64();
+			auto size = obj["spirvSize"].GetUint64();
+			if (offset + size > varint_size)
+			{
+				LOGE_LEVEL("Binary SPIR-V buffer overflows payload.\n");
+				return false;
+			}
+
+			if (!decode_spirv_delta(decoded, info.codeSize / 4, varint + offset, size))
+			{
+				LOGE_LEVEL("Invalid SPIR-V delta format.\n");
+				return false;
+			}
+
+			info.pCode = decoded;
+		}
 		else
 			info.pCode = reinterpret_cast<uint32_t *>(decode_base64(allocator, obj["code"].GetString(), info.codeSize));
 
@@ -1565,6 +1873,18 @@ bool StateReplayer::Impl::parse_application_info_link(StateCreatorInterface &ifa
 	return true;
 }
 
+bool StateReplayer::Impl::parse_pipeline_usage(StateCreatorInterface &iface, const Value &usage)
+{
+	for (auto itr = usage.Begin(); itr != usage.End(); ++itr)
+	{
+		auto &entry = *itr;
+		auto tag = static_cast<ResourceTag>(entry["tag"].GetInt());
+		Hash hash = string_to_uint64(entry["hash"].GetString());
+		iface.notify_pipeline_usage(tag, hash, entry["count"].GetUint64());
+	}
+	return true;
+}
+
 bool StateReplayer::Impl::parse_samplers(StateCreatorInterface &iface, const Value &samplers)
 {
 	auto *infos = allocator.allocate_n_cleared<VkSamplerCreateInfo>(samplers.MemberCount());
@@ -1823,6 +2143,69 @@ bool StateReplayer::Impl::parse_specialization_info(const Value &spec_info, cons
 	return true;
 }
 
+bool StateReplayer::Impl::replay_missing_trivial_object(ResourceTag tag, Hash hash)
+{
+	if (!resolve_trivial_objects || !active_iface || !active_resolver)
+		return false;
+
+	size_t external_state_size = 0;
+	if (!active_resolver->read_entry(tag, hash, &external_state_size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
+		return false;
+
+	vector<uint8_t> external_state(external_state_size + 1);
+	if (!active_resolver->read_entry(tag, hash, &external_state_size, external_state.data(), PAYLOAD_READ_CONCURRENT_BIT))
+		return false;
+
+	return parse_insitu(*active_iface, active_resolver, external_state.data(), external_state_size);
+}
+
+bool StateReplayer::Impl::resolve_shader_module(StateCreatorInterface &iface, DatabaseInterface *resolver,
+                                                Hash module, VkShaderModule *out_module)
+{
+	if (module == 0 || !resolve_shader_modules)
+	{
+		*out_module = api_object_cast<VkShaderModule>(module);
+		return true;
+	}
+
+	auto module_iter = replayed_shader_modules.find(module);
+	if (module_iter == replayed_shader_modules.end())
+	{
+		size_t external_state_size = 0;
+		if (!resolver || !resolver->read_entry(RESOURCE_SHADER_MODULE, module, &external_state_size, nullptr,
+		                                       PAYLOAD_READ_NO_FLAGS))
+		{
+			log_missing_resource("Shader module", module);
+			return false;
+		}
+
+		vector<uint8_t> external_state(external_state_size + 1);
+
+		if (!resolver->read_entry(RESOURCE_SHADER_MODULE, module, &external_state_size, external_state.data(),
+		                          PAYLOAD_READ_NO_FLAGS))
+		{
+			log_missing_resource("Shader module", module);
+			return false;
+		}
+
+		if (!this->parse_insitu(iface, resolver, external_state.data(), external_state_size))
+			return false;
+
+		iface.sync_shader_modules();
+		module_iter = replayed_shader_modules.find(module);
+		if (module_iter == replayed_shader_modules.end())
+		{
+			log_missing_resource("Shader module", module);
+			return false;
+		}
+	}
+	else
+		iface.sync_shader_modules();
+
+	*out_module = module_iter->second;
+	return true;
+}
+
 bool StateReplayer::Impl::parse_compute_pipeline(StateCreatorInterface &iface, DatabaseInterface *resolver,
                                                  const Value &pipelines, const Value &member)
 {
@@ -1864,7 +2247,7 @@ bool StateReplayer::Impl::parse_compute_pipeline(StateCreatorInterface &iface, D
 				return false;
 			}
 
-			vector<uint8_t> external_state(external_state_size);
+			vector<uint8_t> external_state(external_state_size + 1);
 
 			if (!resolver->read_entry(RESOURCE_COMPUTE_PIPELINE, pipeline, &external_state_size, external_state.data(),
 			                          PAYLOAD_READ_NO_FLAGS))
@@ -1873,7 +2256,7 @@ bool StateReplayer::Impl::parse_compute_pipeline(StateCreatorInterface &iface, D
 				return false;
 			}
 
-			if (!this->parse(iface, resolver, external_state.data(), external_state.size()))
+			if (!this->parse_insitu(iface, resolver, external_state.data(), external_state_size))
 				return false;
 			iface.sync_threads();
 
@@ -1893,6 +2276,8 @@ bool StateReplayer::Impl::parse_compute_pipeline(StateCreatorInterface &iface, D
 	if (layout > 0)
 	{
 		auto layout_itr = replayed_pipeline_layouts.find(layout);
+		if (layout_itr == end(replayed_pipeline_layouts) && replay_missing_trivial_object(RESOURCE_PIPELINE_LAYOUT, layout))
+			layout_itr = replayed_pipeline_layouts.find(layout);
 		if (layout_itr == end(replayed_pipeline_layouts))
 		{
 			log_missing_resource("Pipeline layout", layout);
@@ -1916,45 +2301,8 @@ bool StateReplayer::Impl::parse_compute_pipeline(StateCreatorInterface &iface, D
 			return false;
 
 	auto module = string_to_uint64(stage["module"].GetString());
-	if (module > 0 && resolve_shader_modules)
-	{
-		auto module_iter = replayed_shader_modules.find(module);
-		if (module_iter == replayed_shader_modules.end())
-		{
-			size_t external_state_size = 0;
-			if (!resolver || !resolver->read_entry(RESOURCE_SHADER_MODULE, module, &external_state_size, nullptr,
-			                                       PAYLOAD_READ_NO_FLAGS))
-			{
-				log_missing_resource("Shader module", module);
-				return false;
-			}
-
-			vector<uint8_t> external_state(external_state_size);
-
-			if (!resolver->read_entry(RESOURCE_SHADER_MODULE, module, &external_state_size, external_state.data(),
-			                          PAYLOAD_READ_NO_FLAGS))
-			{
-				log_missing_resource("Shader module", module);
-				return false;
-			}
-
-			if (!this->parse(iface, resolver, external_state.data(), external_state.size()))
-				return false;
-
-			iface.sync_shader_modules();
-			module_iter = replayed_shader_modules.find(module);
-			if (module_iter == replayed_shader_modules.end())
-			{
-				log_missing_resource("Shader module", module);
-				return false;
-			}
-		}
-		else
-			iface.sync_shader_modules();
-		info.stage.module = module_iter->second;
-	}
-	else
-		info.stage.module = api_object_cast<VkShaderModule>(module);
+	if (!resolve_shader_module(iface, resolver, module, &info.stage.module))
+		return false;
 
 	info.stage.pName = duplicate_string(stage["name"].GetString(), stage["name"].GetStringLength());
 	if (stage.HasMember("specializationInfo"))
@@ -2293,46 +2641,8 @@ bool StateReplayer::Impl::parse_stages(StateCreatorInterface &iface, DatabaseInt
 				return false;
 
 		auto module = string_to_uint64(obj["module"].GetString());
-		if (module > 0 && resolve_shader_modules)
-		{
-			auto module_iter = replayed_shader_modules.find(module);
-			if (module_iter == replayed_shader_modules.end())
-			{
-				size_t external_state_size = 0;
-				if (!resolver || !resolver->read_entry(RESOURCE_SHADER_MODULE, module, &external_state_size, nullptr,
-				                                       PAYLOAD_READ_NO_FLAGS))
-				{
-					log_missing_resource("Shader module", module);
-					return false;
-				}
-
-				vector<uint8_t> external_state(external_state_size);
-
-				if (!resolver->read_entry(RESOURCE_SHADER_MODULE, module, &external_state_size, external_state.data(),
-				                          PAYLOAD_READ_NO_FLAGS))
-				{
-					log_missing_resource("Shader module", module);
-					return false;
-				}
-
-				if (!this->parse(iface, resolver, external_state.data(), external_state.size()))
-					return false;
-
-				iface.sync_shader_modules();
-				module_iter = replayed_shader_modules.find(module);
-				if (module_iter == replayed_shader_modules.end())
-				{
-					log_missing_resource("Shader module", module);
-					return false;
-				}
-			}
-			else
-				iface.sync_shader_modules();
-
-			state->module = module_iter->second;
-		}
-		else
-			state->module = api_object_cast<VkShaderModule>(module);
+		if (!resolve_shader_module(iface, resolver, module, &state->module))
+			return false;
 	}
 
 	*out_info = ret;
@@ -2379,7 +2689,7 @@ bool StateReplayer::Impl::parse_graphics_pipeline(StateCreatorInterface &iface,
 				return false;
 			}
 
-			vector<uint8_t> external_state(external_state_size);
+			vector<uint8_t> external_state(external_state_size + 1);
 
 			if (!resolver->read_entry(RESOURCE_GRAPHICS_PIPELINE, pipeline, &external_state_size, external_state.data(),
 			                          PAYLOAD_READ_NO_FLAGS))
@@ -2388,7 +2698,7 @@ bool StateReplayer::Impl::parse_graphics_pipeline(StateCreatorInterface &iface,
 				return false;
 			}
 
-			if (!this->parse(iface, resolver, external_state.data(), external_state.size()))
+			if (!this->parse_insitu(iface, resolver, external_state.data(), external_state_size))
 				return false;
 
 			iface.sync_threads();
@@ -2413,6 +2723,8 @@ bool StateReplayer::Impl::parse_graphics_pipeline(StateCreatorInterface &iface,
 	if (layout > 0)
 	{
 		auto layout_itr = replayed_pipeline_layouts.find(layout);
+		if (layout_itr == end(replayed_pipeline_layouts) && replay_missing_trivial_object(RESOURCE_PIPELINE_LAYOUT, layout))
+			layout_itr = replayed_pipeline_layouts.find(layout);
 		if (layout_itr == end(replayed_pipeline_layouts))
 		{
 			log_missing_resource("Pipeline layout", layout);
@@ -2431,6 +2743,8 @@ bool StateReplayer::Impl::parse_graphics_pipeline(StateCreatorInterface &iface,
 	if (render_pass > 0)
 	{
 		auto rp_itr = replayed_render_passes.find(render_pass);
+		if (rp_itr == end(replayed_render_passes) && replay_missing_trivial_object(RESOURCE_RENDER_PASS, render_pass))
+			rp_itr = replayed_render_passes.find(render_pass);
 		if (rp_itr == end(replayed_render_passes))
 		{
 			log_missing_resource("Render pass", render_pass);
@@ -2505,7 +2819,7 @@ bool StateReplayer::Impl::parse_graphics_pipelines(StateCreatorInterface &iface,
 	return true;
 }
 
-bool StateReplayer::Impl::parse_tessellation_domain_origin_state(const Value &state, VkPipelineTessellationDomainOriginStateCreateInfo **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state, VkPipelineTessellationDomainOriginStateCreateInfo **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkPipelineTessellationDomainOriginStateCreateInfo>();
 	info->domainOrigin = static_cast<VkTessellationDomainOrigin>(state["domainOrigin"].GetUint());
@@ -2513,7 +2827,7 @@ bool StateReplayer::Impl::parse_tessellation_domain_origin_state(const Value &st
 	return true;
 }
 
-bool StateReplayer::Impl::parse_vertex_input_divisor_state(const Value &state, VkPipelineVertexInputDivisorStateCreateInfoEXT **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state, VkPipelineVertexInputDivisorStateCreateInfoEXT **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkPipelineVertexInputDivisorStateCreateInfoEXT>();
 	info->vertexBindingDivisorCount = state["vertexBindingDivisorCount"].GetUint();
@@ -2536,7 +2850,7 @@ bool StateReplayer::Impl::parse_vertex_input_divisor_state(const Value &state, V
 	return true;
 }
 
-bool StateReplayer::Impl::parse_rasterization_depth_clip_state(const Value &state, VkPipelineRasterizationDepthClipStateCreateInfoEXT **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state, VkPipelineRasterizationDepthClipStateCreateInfoEXT **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkPipelineRasterizationDepthClipStateCreateInfoEXT>();
 
@@ -2547,7 +2861,7 @@ bool StateReplayer::Impl::parse_rasterization_depth_clip_state(const Value &stat
 	return true;
 }
 
-bool StateReplayer::Impl::parse_rasterization_stream_state(const Value &state, VkPipelineRasterizationStateStreamCreateInfoEXT **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state, VkPipelineRasterizationStateStreamCreateInfoEXT **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkPipelineRasterizationStateStreamCreateInfoEXT>();
 
@@ -2558,8 +2872,8 @@ bool StateReplayer::Impl::parse_rasterization_stream_state(const Value &state, V
 	return true;
 }
 
-bool StateReplayer::Impl::parse_descriptor_set_binding_flags(const Value &state,
-                                                             VkDescriptorSetLayoutBindingFlagsCreateInfoEXT **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state,
+                                             VkDescriptorSetLayoutBindingFlagsCreateInfoEXT **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkDescriptorSetLayoutBindingFlagsCreateInfoEXT>();
 	if (state.HasMember("bindingFlags"))
@@ -2573,8 +2887,8 @@ bool StateReplayer::Impl::parse_descriptor_set_binding_flags(const Value &state,
 	return true;
 }
 
-bool StateReplayer::Impl::parse_color_blend_advanced_state(const Value &state,
-                                                           VkPipelineColorBlendAdvancedStateCreateInfoEXT **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state,
+                                             VkPipelineColorBlendAdvancedStateCreateInfoEXT **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkPipelineColorBlendAdvancedStateCreateInfoEXT>();
 
@@ -2586,8 +2900,8 @@ bool StateReplayer::Impl::parse_color_blend_advanced_state(const Value &state,
 	return true;
 }
 
-bool StateReplayer::Impl::parse_rasterization_conservative_state(const Value &state,
-                                                                 VkPipelineRasterizationConservativeStateCreateInfoEXT **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state,
+                                             VkPipelineRasterizationConservativeStateCreateInfoEXT **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkPipelineRasterizationConservativeStateCreateInfoEXT>();
 
@@ -2599,8 +2913,8 @@ bool StateReplayer::Impl::parse_rasterization_conservative_state(const Value &st
 	return true;
 }
 
-bool StateReplayer::Impl::parse_rasterization_line_state(const Value &state,
-                                                         VkPipelineRasterizationLineStateCreateInfoEXT **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state,
+                                             VkPipelineRasterizationLineStateCreateInfoEXT **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkPipelineRasterizationLineStateCreateInfoEXT>();
 
@@ -2613,8 +2927,8 @@ bool StateReplayer::Impl::parse_rasterization_line_state(const Value &state,
 	return true;
 }
 
-bool StateReplayer::Impl::parse_shader_stage_required_subgroup_size(const Value &state,
-                                                                    VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state,
+                                             VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT>();
 
@@ -2624,8 +2938,8 @@ bool StateReplayer::Impl::parse_shader_stage_required_subgroup_size(const Value
 	return true;
 }
 
-bool StateReplayer::Impl::parse_mutable_descriptor_type(const Value &state,
-                                                        VkMutableDescriptorTypeCreateInfoVALVE **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state,
+                                             VkMutableDescriptorTypeCreateInfoVALVE **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkMutableDescriptorTypeCreateInfoVALVE>();
 	*out_info = info;
@@ -2661,7 +2975,7 @@ bool StateReplayer::Impl::parse_mutable_descriptor_type(const Value &state,
 	return true;
 }
 
-bool StateReplayer::Impl::parse_multiview_state(const Value &state, VkRenderPassMultiviewCreateInfo **out_info)
+bool StateReplayer::Impl::parse_pnext_struct(const Value &state, VkRenderPassMultiviewCreateInfo **out_info)
 {
 	auto *info = allocator.allocate_cleared<VkRenderPassMultiviewCreateInfo>();
 
@@ -2703,104 +3017,17 @@ bool StateReplayer::Impl::parse_pnext_chain(const Value &pnext, const void **out
 
 		switch (sType)
 		{
-		case VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_DOMAIN_ORIGIN_STATE_CREATE_INFO:
-		{
-			VkPipelineTessellationDomainOriginStateCreateInfo *info = nullptr;
-			if (!parse_tessellation_domain_origin_state(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_DIVISOR_STATE_CREATE_INFO_EXT:
-		{
-			VkPipelineVertexInputDivisorStateCreateInfoEXT *info = nullptr;
-			if (!parse_vertex_input_divisor_state(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_DEPTH_CLIP_STATE_CREATE_INFO_EXT:
-		{
-			VkPipelineRasterizationDepthClipStateCreateInfoEXT *info = nullptr;
-			if (!parse_rasterization_depth_clip_state(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_STREAM_CREATE_INFO_EXT:
-		{
-			VkPipelineRasterizationStateStreamCreateInfoEXT *info = nullptr;
-			if (!parse_rasterization_stream_state(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO:
-		{
-			VkRenderPassMultiviewCreateInfo *info = nullptr;
-			if (!parse_multiview_state(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT:
-		{
-			VkDescriptorSetLayoutBindingFlagsCreateInfoEXT *info = nullptr;
-			if (!parse_descriptor_set_binding_flags(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_ADVANCED_STATE_CREATE_INFO_EXT:
-		{
-			VkPipelineColorBlendAdvancedStateCreateInfoEXT *info = nullptr;
-			if (!parse_color_blend_advanced_state(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT:
-		{
-			VkPipelineRasterizationConservativeStateCreateInfoEXT *info = nullptr;
-			if (!parse_rasterization_conservative_state(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_LINE_STATE_CREATE_INFO_EXT:
-		{
-			VkPipelineRasterizationLineStateCreateInfoEXT *info = nullptr;
-			if (!parse_rasterization_line_state(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT:
-		{
-			VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT *info = nullptr;
-			if (!parse_shader_stage_required_subgroup_size(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_MUTABLE_DESCRIPTOR_TYPE_CREATE_INFO_VALVE:
-		{
-			VkMutableDescriptorTypeCreateInfoVALVE *info = nullptr;
-			if (!parse_mutable_descriptor_type(next, &info))
-				return false;
-			new_struct = reinterpret_cast<VkBaseInStructure *>(info);
-			break;
+#define FOSSILIZE_PARSE_PNEXT_STRUCT(stype, T) \
+		case stype: \
+		{ \
+			T *info = nullptr; \
+			if (!parse_pnext_struct(next, &info)) \
+				return false; \
+			new_struct = reinterpret_cast<VkBaseInStructure *>(info); \
+			break; \
 		}
+		FOSSILIZE_PNEXT_STRUCTS(FOSSILIZE_PARSE_PNEXT_STRUCT)
+#undef FOSSILIZE_PARSE_PNEXT_STRUCT
 
 		default:
 			LOGE_LEVEL("Failed to parse pNext chain for sType: %d\n", int(sType));
@@ -2846,6 +3073,11 @@ bool StateReplayer::parse(StateCreatorInterface &iface, DatabaseInterface *resol
 	return impl->parse(iface, resolver, buffer, size);
 }
 
+bool StateReplayer::parse_insitu(StateCreatorInterface &iface, DatabaseInterface *resolver, void *buffer, size_t size)
+{
+	return impl->parse_insitu(iface, resolver, buffer, size);
+}
+
 void StateReplayer::set_resolve_derivative_pipeline_handles(bool enable)
 {
 	impl->resolve_derivative_pipelines = enable;
@@ -2856,9 +3088,29 @@ void StateReplayer::set_resolve_shader_module_handles(bool enable)
 	impl->resolve_shader_modules = enable;
 }
 
-void StateReplayer::copy_handle_references(const StateReplayer &replayer)
+void StateReplayer::set_resolve_trivial_object_handles(bool enable)
 {
-	impl->copy_handle_references(*replayer.impl);
+	impl->resolve_trivial_objects = enable;
+}
+
+bool StateReplayer::set_json_parse_backend(JsonParseBackend backend)
+{
+#ifndef FOSSILIZE_HAVE_SIMDJSON
+	if (backend == JsonParseBackend::Simdjson)
+		return false;
+#endif
+	impl->json_parse_backend = backend;
+	return true;
+}
+
+void StateReplayer::copy_handle_references(const StateReplayer &replayer)
+{
+	impl->copy_handle_references(*replayer.impl);
+}
+
+void StateReplayer::merge_handle_references(const StateReplayer &replayer)
+{
+	impl->merge_handle_references(*replayer.impl);
 }
 
 void StateReplayer::forget_handle_references()
@@ -2866,6 +3118,15 @@ void StateReplayer::forget_handle_references()
 	impl->forget_handle_references();
 }
 
+size_t StateReplayer::get_parse_buffer_memory_usage() const
+{
+	size_t usage = impl->json_pool.capacity();
+#ifdef FOSSILIZE_HAVE_SIMDJSON
+	usage += impl->simdjson_input.capacity() + impl->simdjson_parser.capacity();
+#endif
+	return usage;
+}
+
 void StateReplayer::Impl::copy_handle_references(const StateReplayer::Impl &other)
 {
 	replayed_samplers = other.replayed_samplers;
@@ -2877,6 +3138,18 @@ void StateReplayer::Impl::copy_handle_references(const StateReplayer::Impl &othe
 	replayed_graphics_pipelines = other.replayed_graphics_pipelines;
 }
 
+void StateReplayer::Impl::merge_handle_references(const StateReplayer::Impl &other)
+{
+	// References we already have take precedence.
+	replayed_samplers.insert(other.replayed_samplers.begin(), other.replayed_samplers.end());
+	replayed_descriptor_set_layouts.insert(other.replayed_descriptor_set_layouts.begin(), other.replayed_descriptor_set_layouts.end());
+	replayed_pipeline_layouts.insert(other.replayed_pipeline_layouts.begin(), other.replayed_pipeline_layouts.end());
+	replayed_shader_modules.insert(other.replayed_shader_modules.begin(), other.replayed_shader_modules.end());
+	replayed_render_passes.insert(other.replayed_render_passes.begin(), other.replayed_render_passes.end());
+	replayed_compute_pipelines.insert(other.replayed_compute_pipelines.begin(), other.replayed_compute_pipelines.end());
+	replayed_graphics_pipelines.insert(other.replayed_graphics_pipelines.begin(), other.replayed_graphics_pipelines.end());
+}
+
 void StateReplayer::Impl::forget_handle_references()
 {
 	replayed_samplers.clear();
@@ -2888,11 +3161,43 @@ void StateReplayer::Impl::forget_handle_references()
 	replayed_graphics_pipelines.clear();
 }
 
-bool StateReplayer::Impl::parse(StateCreatorInterface &iface, DatabaseInterface *resolver, const void *buffer_, size_t total_size)
+bool StateReplayer::Impl::parse(StateCreatorInterface &iface, DatabaseInterface *resolver, const void *buffer, size_t size)
+{
+	return parse_payload(iface, resolver, static_cast<const uint8_t *>(buffer), nullptr, size);
+}
+
+bool StateReplayer::Impl::parse_insitu(StateCreatorInterface &iface, DatabaseInterface *resolver, void *buffer_, size_t size)
+{
+	auto *buffer = static_cast<uint8_t *>(buffer_);
+	return parse_payload(iface, resolver, buffer, buffer, size);
+}
+
+bool StateReplayer::Impl::parse_payload(StateCreatorInterface &iface, DatabaseInterface *resolver,
+                                        const uint8_t *buffer, uint8_t *insitu_buffer, size_t total_size)
+{
+	// Payloads can nest, restore the outer payload's creator when done.
+	auto *outer_iface = active_iface;
+	auto *outer_resolver = active_resolver;
+	active_iface = &iface;
+	active_resolver = resolver;
+
+	bool ret;
+	if (total_size >= sizeof(binary_payload_magic) &&
+	    memcmp(buffer, binary_payload_magic, sizeof(binary_payload_magic)) == 0)
+		ret = parse_binary(iface, resolver, buffer, total_size);
+	else
+		ret = parse_json_payload(iface, resolver, buffer, insitu_buffer, total_size);
+
+	active_iface = outer_iface;
+	active_resolver = outer_resolver;
+	return ret;
+}
+
+bool StateReplayer::Impl::parse_json_payload(StateCreatorInterface &iface, DatabaseInterface *resolver,
+                                             const uint8_t *buffer, uint8_t *insitu_buffer, size_t total_size)
 {
 	// All data after a string terminating '\0' is considered binary payload
 	// which can be read for various purposes (SPIR-V varint for example).
-	const uint8_t *buffer = static_cast<const uint8_t *>(buffer_);
 	auto itr = find(buffer, buffer + total_size, '\0');
 	const uint8_t *varint_buffer = nullptr;
 	size_t varint_size = 0;
@@ -2904,16 +3209,56 @@ bool StateReplayer::Impl::parse(StateCreatorInterface &iface, DatabaseInterface
 		varint_size = (buffer + total_size) - varint_buffer;
 	}
 
-	Document doc;
-	doc.Parse(reinterpret_cast<const char *>(buffer), json_size);
+	// In-situ parsing needs the JSON to be terminated. This either rewrites the existing terminator
+	// or uses the spare byte the caller provides past the end of the payload.
+	char *insitu_json = nullptr;
+	if (insitu_buffer)
+	{
+		insitu_buffer[json_size] = '\0';
+		insitu_json = reinterpret_cast<char *>(insitu_buffer);
+	}
+
+	const char *json = reinterpret_cast<const char *>(buffer);
 
-	if (doc.HasParseError())
+	// Base pipelines and shader modules can be pulled in from the database while the outer
+	// document is still live. Such nested parses cannot reuse the pool.
+	if (json_parse_depth != 0)
 	{
-		auto error = doc.GetParseError();
-		LOGE_LEVEL("Got parse error: %d\n", int(error));
-		return false;
+		Document doc;
+		json_parse_depth++;
+		bool ret = parse_document(iface, resolver, doc, json, insitu_json, json_size, varint_buffer, varint_size);
+		json_parse_depth--;
+		return ret;
+	}
+
+	if (json_pool.empty())
+		json_pool.resize(64 * 1024);
+
+	bool ret;
+	size_t pool_capacity;
+	{
+		MemoryPoolAllocator<> pool(json_pool.data(), json_pool.size());
+		Document doc(&pool);
+		json_parse_depth++;
+		ret = parse_document(iface, resolver, doc, json, insitu_json, json_size, varint_buffer, varint_size);
+		json_parse_depth--;
+		pool_capacity = pool.Capacity();
 	}
 
+	// The document spilled into chunks allocated on the side, grow so the next one fits.
+	if (pool_capacity > json_pool.size())
+		json_pool.resize(pool_capacity);
+
+	return ret;
+}
+
+bool StateReplayer::Impl::parse_document(StateCreatorInterface &iface, DatabaseInterface *resolver, Document &doc,
+                                         const char *json, char *insitu_json, size_t json_size,
+                                         const uint8_t *varint_buffer, size_t varint_size)
+{
+	if (!parse_json_text(doc, json, insitu_json, json_size))
+		return false;
+
 	int version = doc["version"].GetInt();
 	if (version > FOSSILIZE_FORMAT_VERSION || version < FOSSILIZE_FORMAT_MIN_COMPAT_VERSION)
 	{
@@ -2932,6 +3277,10 @@ bool StateReplayer::Impl::parse(StateCreatorInterface &iface, DatabaseInterface
 		if (!parse_application_info_link(iface, doc["link"]))
 			return false;
 
+	if (doc.HasMember("usage"))
+		if (!parse_pipeline_usage(iface, doc["usage"]))
+			return false;
+
 	if (doc.HasMember("shaderModules"))
 		if (!parse_shader_modules(iface, doc["shaderModules"], varint_buffer, varint_size))
 			return false;
@@ -2963,6 +3312,217 @@ bool StateReplayer::Impl::parse(StateCreatorInterface &iface, DatabaseInterface
 	return true;
 }
 
+#ifdef FOSSILIZE_HAVE_SIMDJSON
+// Feeds an on-demand document to a rapidjson Document as SAX events, so the rest of the replayer
+// sees the same DOM with either backend. Integers are classified the way rapidjson's reader does,
+// so IsUint(), IsInt64() and friends give the same answers.
+static bool emit_simdjson_value(simdjson::ondemand::value &value, Document &handler);
+
+static bool emit_simdjson_number(simdjson::ondemand::value &value, Document &handler)
+{
+	simdjson::ondemand::number_type number_type;
+	if (value.get_number_type().get(number_type) != simdjson::SUCCESS)
+		return false;
+
+	switch (number_type)
+	{
+	case simdjson::ondemand::number_type::signed_integer:
+	{
+		int64_t v;
+		if (value.get_int64().get(v) != simdjson::SUCCESS)
+			return false;
+		if (v >= 0)
+			return v <= int64_t(UINT32_MAX) ? handler.Uint(unsigned(v)) : handler.Uint64(uint64_t(v));
+		else
+			return v >= int64_t(INT32_MIN) ? handler.Int(int(v)) : handler.Int64(v);
+	}
+
+	case simdjson::ondemand::number_type::unsigned_integer:
+	{
+		uint64_t v;
+		if (value.get_uint64().get(v) != simdjson::SUCCESS)
+			return false;
+		return handler.Uint64(v);
+	}
+
+	case simdjson::ondemand::number_type::floating_point_number:
+	{
+		double v;
+		if (value.get_double().get(v) != simdjson::SUCCESS)
+			return false;
+		return handler.Double(v);
+	}
+
+	default:
+		// Integers beyond 64 bits are never written by Fossilize.
+		return false;
+	}
+}
+
+static bool emit_simdjson_object(simdjson::ondemand::object &object, Document &handler)
+{
+	if (!handler.StartObject())
+		return false;
+
+	SizeType count = 0;
+	for (auto field_result : object)
+	{
+		simdjson::ondemand::field field;
+		if (std::move(field_result).get(field) != simdjson::SUCCESS)
+			return false;
+
+		std::string_view key;
+		if (field.unescaped_key().get(key) != simdjson::SUCCESS)
+			return false;
+		if (!handler.Key(key.data(), SizeType(key.size()), true))
+			return false;
+		if (!emit_simdjson_value(field.value(), handler))
+			return false;
+		count++;
+	}
+
+	return handler.EndObject(count);
+}
+
+static bool emit_simdjson_array(simdjson::ondemand::array &array, Document &handler)
+{
+	if (!handler.StartArray())
+		return false;
+
+	SizeType count = 0;
+	for (auto element_result : array)
+	{
+		simdjson::ondemand::value element;
+		if (std::move(element_result).get(element) != simdjson::SUCCESS)
+			return false;
+		if (!emit_simdjson_value(element, handler))
+			return false;
+		count++;
+	}
+
+	return handler.EndArray(count);
+}
+
+static bool emit_simdjson_value(simdjson::ondemand::value &value, Document &handler)
+{
+	simdjson::ondemand::json_type type;
+	if (value.type().get(type) != simdjson::SUCCESS)
+		return false;
+
+	switch (type)
+	{
+	case simdjson::ondemand::json_type::object:
+	{
+		simdjson::ondemand::object object;
+		if (value.get_object().get(object) != simdjson::SUCCESS)
+			return false;
+		return emit_simdjson_object(object, handler);
+	}
+
+	case simdjson::ondemand::json_type::array:
+	{
+		simdjson::ondemand::array array;
+		if (value.get_array().get(array) != simdjson::SUCCESS)
+			return false;
+		return emit_simdjson_array(array, handler);
+	}
+
+	case simdjson::ondemand::json_type::string:
+	{
+		std::string_view str;
+		if (value.get_string().get(str) != simdjson::SUCCESS)
+			return false;
+		return handler.String(str.data(), SizeType(str.size()), true);
+	}
+
+	case simdjson::ondemand::json_type::number:
+		return emit_simdjson_number(value, handler);
+
+	case simdjson::ondemand::json_type::boolean:
+	{
+		bool b;
+		if (value.get_bool().get(b) != simdjson::SUCCESS)
+			return false;
+		return handler.Bool(b);
+	}
+
+	case simdjson::ondemand::json_type::null:
+	{
+		bool is_null;
+		if (value.is_null().get(is_null) != simdjson::SUCCESS || !is_null)
+			return false;
+		return handler.Null();
+	}
+
+	default:
+		return false;
+	}
+}
+
+struct SimdjsonGenerator
+{
+	simdjson::ondemand::document &document;
+
+	bool operator()(Document &handler)
+	{
+		// Every Fossilize payload is a single object.
+		simdjson::ondemand::object object;
+		if (document.get_object().get(object) != simdjson::SUCCESS)
+			return false;
+		if (!emit_simdjson_object(object, handler))
+			return false;
+		return document.at_end();
+	}
+};
+
+bool StateReplayer::Impl::parse_json_simdjson(Document &doc, const char *json, size_t json_size)
+{
+	simdjson_input.resize(json_size + simdjson::SIMDJSON_PADDING);
+	memcpy(simdjson_input.data(), json, json_size);
+
+	simdjson::ondemand::document simdjson_doc;
+	auto error = simdjson_parser.iterate(simdjson_input.data(), json_size, simdjson_input.size()).get(simdjson_doc);
+	if (error != simdjson::SUCCESS)
+	{
+		LOGE_LEVEL("Got simdjson parse error: %s\n", simdjson::error_message(error));
+		return false;
+	}
+
+	// The document is left untouched if the generator fails part way through.
+	SimdjsonGenerator generator = { simdjson_doc };
+	doc.Populate(generator);
+	if (!doc.IsObject())
+	{
+		LOGE_LEVEL("Got simdjson parse error.\n");
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+bool StateReplayer::Impl::parse_json_text(Document &doc, const char *json, char *insitu_json, size_t json_size)
+{
+#ifdef FOSSILIZE_HAVE_SIMDJSON
+	if (json_parse_backend == JsonParseBackend::Simdjson)
+		return parse_json_simdjson(doc, json, json_size);
+#endif
+
+	if (insitu_json)
+		doc.ParseInsitu(insitu_json);
+	else
+		doc.Parse(json, json_size);
+
+	if (doc.HasParseError())
+	{
+		auto error = doc.GetParseError();
+		LOGE_LEVEL("Got parse error: %d\n", int(error));
+		return false;
+	}
+
+	return true;
+}
+
 template <typename T>
 T *StateRecorder::Impl::copy(const T *src, size_t count, ScratchAllocator &alloc)
 {
@@ -3087,82 +3647,12 @@ bool StateRecorder::Impl::copy_pnext_chain(const void *pNext, ScratchAllocator &
 
 		switch (pin->sType)
 		{
-		case VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_DOMAIN_ORIGIN_STATE_CREATE_INFO:
-		{
-			auto ci = static_cast<const VkPipelineTessellationDomainOriginStateCreateInfo *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_DIVISOR_STATE_CREATE_INFO_EXT:
-		{
-			auto *ci = static_cast<const VkPipelineVertexInputDivisorStateCreateInfoEXT *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_DEPTH_CLIP_STATE_CREATE_INFO_EXT:
-		{
-			auto *ci = static_cast<const VkPipelineRasterizationDepthClipStateCreateInfoEXT *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_STREAM_CREATE_INFO_EXT:
-		{
-			auto *ci = static_cast<const VkPipelineRasterizationStateStreamCreateInfoEXT *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO:
-		{
-			auto *ci = static_cast<const VkRenderPassMultiviewCreateInfo *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT:
-		{
-			auto *ci = static_cast<const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_ADVANCED_STATE_CREATE_INFO_EXT:
-		{
-			auto *ci = static_cast<const VkPipelineColorBlendAdvancedStateCreateInfoEXT *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT:
-		{
-			auto *ci = static_cast<const VkPipelineRasterizationConservativeStateCreateInfoEXT *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_LINE_STATE_CREATE_INFO_EXT:
-		{
-			auto *ci = static_cast<const VkPipelineRasterizationLineStateCreateInfoEXT *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT:
-		{
-			auto *ci = static_cast<const VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
-			break;
-		}
-
-		case VK_STRUCTURE_TYPE_MUTABLE_DESCRIPTOR_TYPE_CREATE_INFO_VALVE:
-		{
-			auto *ci = static_cast<const VkMutableDescriptorTypeCreateInfoVALVE *>(pNext);
-			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(ci, alloc));
+#define FOSSILIZE_COPY_PNEXT_STRUCT(stype, T) \
+		case stype: \
+			*ppNext = static_cast<VkBaseInStructure *>(copy_pnext_struct(static_cast<const T *>(pNext), alloc)); \
 			break;
-		}
+		FOSSILIZE_PNEXT_STRUCTS(FOSSILIZE_COPY_PNEXT_STRUCT)
+#undef FOSSILIZE_COPY_PNEXT_STRUCT
 
 		default:
 			LOGE_LEVEL("Cannot copy unknown pNext sType: %d.\n", int(pin->sType));
@@ -3178,18 +3668,38 @@ bool StateRecorder::Impl::copy_pnext_chain(const void *pNext, ScratchAllocator &
 	return true;
 }
 
+// Bytes held by the blocks of every ScratchAllocator, see ScratchAllocator::get_process_memory_usage().
+static std::atomic<size_t> scratch_allocator_process_bytes{ 0 };
+
+struct ScratchBlockDeleter
+{
+	// Non-zero if the block was mapped directly rather than allocated with new[].
+	size_t mapped_size = 0;
+	// Size of the block, taken out of scratch_allocator_process_bytes when it is freed.
+	size_t tracked_size = 0;
+	void operator()(uint8_t *ptr) const;
+};
+
 struct ScratchAllocator::Impl
 {
 	struct Block
 	{
-		Block(size_t size);
+		Block(size_t size, size_t huge_page_threshold);
 		size_t offset = 0;
-		std::vector<uint8_t> blob;
+		size_t size = 0;
+		// Left uninitialized, captures overwrite all of it anyway. Use allocate_raw_cleared() when zeroes are needed.
+		std::unique_ptr<uint8_t[], ScratchBlockDeleter> blob;
 	};
 	std::vector<Block> blocks;
+	// Retained by reset(), sorted from largest to smallest.
+	std::vector<Block> free_blocks;
 
 	void add_block(size_t minimum_size);
 	size_t peak_history_size = 0;
+	size_t minimum_block_size = 64 * 1024;
+	size_t max_retained_size = SIZE_MAX;
+	size_t huge_page_threshold = 0;
+	Statistics stats = {};
 };
 
 ScratchAllocator::ScratchAllocator()
@@ -3197,21 +3707,112 @@ ScratchAllocator::ScratchAllocator()
 	impl = new Impl;
 }
 
+ScratchAllocator::ScratchAllocator(size_t minimum_block_size)
+{
+	impl = new Impl;
+	impl->minimum_block_size = minimum_block_size;
+}
+
 ScratchAllocator::~ScratchAllocator()
 {
 	delete impl;
 }
 
-ScratchAllocator::Impl::Block::Block(size_t size)
+void ScratchBlockDeleter::operator()(uint8_t *ptr) const
+{
+	scratch_allocator_process_bytes.fetch_sub(tracked_size, std::memory_order_relaxed);
+#ifdef __linux__
+	if (mapped_size)
+	{
+		munmap(ptr, mapped_size);
+		return;
+	}
+#endif
+	delete[] ptr;
+}
+
+static constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+#ifdef __linux__
+static uint8_t *map_huge_page_block(size_t size)
+{
+	// Over-allocate so the block can start on a huge page boundary, then trim the ends.
+	size_t mapped_size = size + HugePageSize;
+	void *mapped = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED)
+		return nullptr;
+
+	auto *begin = static_cast<uint8_t *>(mapped);
+	auto *aligned = reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(begin) + HugePageSize - 1) & ~uintptr_t(HugePageSize - 1));
+	if (aligned != begin)
+		munmap(begin, size_t(aligned - begin));
+	if (aligned + size != begin + mapped_size)
+		munmap(aligned + size, size_t(begin + mapped_size - (aligned + size)));
+
+#ifdef MADV_HUGEPAGE
+	// This is only a hint, the kernel may still back the block with regular pages.
+	madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+	return aligned;
+}
+#endif
+
+ScratchAllocator::Impl::Block::Block(size_t size_, size_t huge_page_threshold)
+	: size(size_)
 {
-	blob.resize(size);
+#ifdef __linux__
+	if (huge_page_threshold && size >= huge_page_threshold)
+	{
+		// Huge pages are only worth it for whole pages.
+		size = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+		ScratchBlockDeleter deleter;
+		deleter.mapped_size = size;
+		deleter.tracked_size = size;
+		blob = std::unique_ptr<uint8_t[], ScratchBlockDeleter>(map_huge_page_block(size), deleter);
+		if (blob)
+		{
+			scratch_allocator_process_bytes.fetch_add(size, std::memory_order_relaxed);
+			return;
+		}
+		size = size_;
+	}
+#else
+	(void)huge_page_threshold;
+#endif
+	ScratchBlockDeleter deleter;
+	deleter.tracked_size = size;
+	blob = std::unique_ptr<uint8_t[], ScratchBlockDeleter>(new uint8_t[size], deleter);
+	scratch_allocator_process_bytes.fetch_add(size, std::memory_order_relaxed);
 }
 
 void ScratchAllocator::Impl::add_block(size_t minimum_size)
 {
-	if (minimum_size < 64 * 1024)
-		minimum_size = 64 * 1024;
-	blocks.emplace_back(minimum_size);
+	if (minimum_size < minimum_block_size)
+		minimum_size = minimum_block_size;
+
+	// Take the smallest retained block which fits.
+	for (auto itr = free_blocks.rbegin(); itr != free_blocks.rend(); ++itr)
+	{
+		if (itr->size >= minimum_size)
+		{
+			stats.block_reuses++;
+			stats.reused_bytes += itr->size;
+			blocks.push_back(std::move(*itr));
+			free_blocks.erase(std::next(itr).base());
+			return;
+		}
+	}
+
+	// Round up to a power of two, so blocks retained from earlier cycles fit similar requests later.
+	size_t block_size = minimum_block_size;
+	while (block_size < minimum_size && block_size <= SIZE_MAX / 2)
+		block_size *= 2;
+	if (block_size < minimum_size)
+		block_size = minimum_size;
+
+	blocks.emplace_back(block_size, huge_page_threshold);
+	stats.block_allocations++;
+	stats.allocated_bytes += blocks.back().size;
 }
 
 void *ScratchAllocator::allocate_raw_cleared(size_t size, size_t alignment)
@@ -3231,9 +3832,9 @@ void *ScratchAllocator::allocate_raw(size_t size, size_t alignment)
 
 	size_t offset = (block.offset + alignment - 1) & ~(alignment - 1);
 	size_t required_size = offset + size;
-	if (required_size <= block.blob.size())
+	if (required_size <= block.size)
 	{
-		void *ret = block.blob.data() + offset;
+		void *ret = block.blob.get() + offset;
 		block.offset = required_size;
 		return ret;
 	}
@@ -3249,24 +3850,71 @@ void ScratchAllocator::reset()
 	if (peak > impl->peak_history_size)
 		impl->peak_history_size = peak;
 
-	if (impl->blocks.size() > 0)
+	for (auto &block : impl->blocks)
+	{
+		block.offset = 0;
+		impl->free_blocks.push_back(std::move(block));
+	}
+	impl->blocks.clear();
+
+	// Larger blocks fit more requests, so they are the last to go.
+	std::stable_sort(impl->free_blocks.begin(), impl->free_blocks.end(), [](const Impl::Block &a, const Impl::Block &b) {
+		return a.size > b.size;
+	});
+
+	size_t retain_limit = std::min(impl->peak_history_size, impl->max_retained_size);
+	size_t retained = 0;
+	auto itr = impl->free_blocks.begin();
+	while (itr != impl->free_blocks.end() && retained + itr->size <= retain_limit)
 	{
-		// free all but first block
-		if (impl->blocks.size() > 1)
-			impl->blocks.erase(impl->blocks.begin() + 1, impl->blocks.end());
-		// reset offset on first block
-		impl->blocks[0].offset = 0;
+		retained += itr->size;
+		++itr;
 	}
+	impl->free_blocks.erase(itr, impl->free_blocks.end());
 }
 
-size_t ScratchAllocator::get_peak_memory_consumption() const
+void ScratchAllocator::set_max_retained_size(size_t size)
 {
-	size_t current_size = 0;
-	for (auto &block : impl->blocks)
-		current_size += block.blob.size();
+	impl->max_retained_size = size;
+}
 
-	if (impl->peak_history_size > current_size)
-		return impl->peak_history_size;
+void ScratchAllocator::set_huge_page_threshold(size_t size)
+{
+	impl->huge_page_threshold = size;
+}
+
+ScratchAllocator::Statistics ScratchAllocator::get_statistics() const
+{
+	Statistics stats = impl->stats;
+	stats.retained_bytes = 0;
+	for (auto &block : impl->blocks)
+		stats.retained_bytes += block.size;
+	for (auto &block : impl->free_blocks)
+		stats.retained_bytes += block.size;
+	return stats;
+}
+
+size_t ScratchAllocator::get_process_memory_usage()
+{
+	return scratch_allocator_process_bytes.load(std::memory_order_relaxed);
+}
+
+size_t ScratchAllocator::get_current_usage() const
+{
+	size_t usage = 0;
+	for (auto &block : impl->blocks)
+		usage += block.offset;
+	return usage;
+}
+
+size_t ScratchAllocator::get_peak_memory_consumption() const
+{
+	size_t current_size = 0;
+	for (auto &block : impl->blocks)
+		current_size += block.size;
+
+	if (impl->peak_history_size > current_size)
+		return impl->peak_history_size;
 	else
 		return current_size;
 }
@@ -3286,2221 +3934,4716 @@ void StateRecorder::set_database_enable_compression(bool enable)
 	impl->compression = enable;
 }
 
-bool StateRecorder::record_application_info(const VkApplicationInfo &info)
+void StateRecorder::set_database_compression_algorithm(DatabaseCompressionAlgorithm algorithm)
 {
-	if (info.pNext)
-	{
-		log_error_pnext_chain("pNext in VkApplicationInfo not supported.", info.pNext);
-		return false;
-	}
+	impl->compression_algorithm = algorithm;
+}
 
-	std::lock_guard<std::mutex> lock(impl->record_lock);
-	if (!impl->copy_application_info(&info, impl->allocator, &impl->application_info))
-		return false;
-	impl->application_feature_hash.application_info_hash = Hashing::compute_hash_application_info(*impl->application_info);
-	return true;
+void StateRecorder::set_database_adaptive_compression(uint32_t backlog)
+{
+	impl->adaptive_compression_backlog = backlog;
 }
 
-bool StateRecorder::record_physical_device_features(const VkPhysicalDeviceFeatures2 &device_features)
+void StateRecorder::set_database_checksum_algorithm(DatabaseChecksumAlgorithm algorithm)
 {
-	// We just ignore pNext, but it's okay to keep it. We will not need to serialize it for now.
-	std::lock_guard<std::mutex> lock(impl->record_lock);
-	if (!impl->copy_physical_device_features(&device_features, impl->allocator, &impl->physical_device_features))
-		return false;
-	impl->application_feature_hash.physical_device_features_hash = Hashing::compute_hash_physical_device_features(*impl->physical_device_features);
-	return true;
+	impl->checksum_algorithm = algorithm;
 }
 
-void StateRecorder::set_application_info_filter(ApplicationInfoFilter *filter)
+void StateRecorder::set_database_shader_module_encoding(ShaderModuleEncoding encoding)
 {
-	impl->application_info_filter = filter;
+	impl->shader_module_encoding = encoding;
 }
 
-const StateRecorderApplicationFeatureHash &StateRecorder::get_application_feature_hash() const
+void StateRecorder::set_database_payload_encoding(PayloadEncoding encoding)
 {
-	return impl->application_feature_hash;
+	impl->payload_encoding = encoding;
 }
 
-bool StateRecorder::record_physical_device_features(const VkPhysicalDeviceFeatures &device_features)
+void StateRecorder::set_hash_algorithm(HashAlgorithm algorithm)
 {
-	VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
-	features.features = device_features;
-	return record_physical_device_features(features);
+	impl->hash_algorithm = algorithm;
 }
 
-bool StateRecorder::record_sampler(VkSampler sampler, const VkSamplerCreateInfo &create_info, Hash custom_hash)
+HashAlgorithm StateRecorder::get_hash_algorithm() const
 {
-	{
-		if (create_info.pNext)
-		{
-			log_error_pnext_chain("pNext in VkSamplerCreateInfo not supported.", create_info.pNext);
-			return false;
-		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+	return impl->hash_algorithm;
+}
 
-		VkSamplerCreateInfo *new_info = nullptr;
-		if (!impl->copy_sampler(&create_info, impl->temp_allocator, &new_info))
-			return false;
+void StateRecorder::set_serialization_worker_count(unsigned count)
+{
+	impl->serialize_worker_count = count;
+}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(sampler), new_info, custom_hash});
-		impl->record_cv.notify_one();
-	}
+void StateRecorder::set_record_queue_mode(RecordQueueMode mode, uint32_t capacity)
+{
+	impl->record_queue_mode = mode;
+	impl->init_record_ring(capacity);
+}
 
-	// Thread is not running, drain the queue ourselves.
-	if (!impl->worker_thread.joinable())
-		impl->record_task(this, false);
+uint64_t StateRecorder::get_dropped_record_count() const
+{
+	return impl->dropped_records.load(std::memory_order_relaxed);
+}
 
-	return true;
+void StateRecorder::set_skip_prior_objects(bool enable)
+{
+	impl->skip_prior_objects = enable;
 }
 
-bool StateRecorder::record_descriptor_set_layout(VkDescriptorSetLayout set_layout, const VkDescriptorSetLayoutCreateInfo &create_info,
-                                                 Hash custom_hash)
+void StateRecorder::set_canonicalize_pipeline_state(bool enable)
 {
-	{
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+	impl->canonicalize_pipeline_state = enable;
+}
 
-		VkDescriptorSetLayoutCreateInfo *new_info = nullptr;
-		if (!impl->copy_descriptor_set_layout(&create_info, impl->temp_allocator, &new_info))
-			return false;
+void StateRecorder::set_database_flush_on_idle(bool enable)
+{
+	impl->flush_on_idle = enable;
+}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(set_layout), new_info, custom_hash});
-		impl->record_cv.notify_one();
-	}
+void StateRecorder::request_database_flush()
+{
+	std::lock_guard<std::mutex> lock(impl->record_lock);
+	impl->flush_requested.store(true);
+	impl->record_cv.notify_one();
+}
 
-	// Thread is not running, drain the queue ourselves.
-	if (!impl->worker_thread.joinable())
-		impl->record_task(this, false);
+bool StateRecorder::has_prior_object(ResourceTag tag, Hash hash) const
+{
+	return impl->is_prior_object(tag, hash);
+}
 
-	return true;
+void StateRecorder::set_statistics_enabled(bool enable)
+{
+	impl->statistics_enabled = enable;
 }
 
-bool StateRecorder::record_pipeline_layout(VkPipelineLayout pipeline_layout, const VkPipelineLayoutCreateInfo &create_info,
-                                           Hash custom_hash)
+void StateRecorder::set_record_dependency_graph(bool enable)
 {
-	{
-		if (create_info.pNext)
-		{
-			log_error_pnext_chain("pNext in VkPipelineLayoutCreateInfo not supported.", create_info.pNext);
-			return false;
-		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+	impl->record_dependency_graph = enable;
+}
 
-		VkPipelineLayoutCreateInfo *new_info = nullptr;
-		if (!impl->copy_pipeline_layout(&create_info, impl->temp_allocator, &new_info))
-			return false;
+bool StateRecorder::get_statistics(RecorderStatistics *stats) const
+{
+	if (!impl->statistics_enabled)
+		return false;
 
-		impl->record_queue.push({api_object_cast<uint64_t>(pipeline_layout), new_info, custom_hash});
-		impl->record_cv.notify_one();
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		auto &counters = impl->record_latency[i];
+		auto &latency = stats->record_latency[i];
+		latency.count = counters.count.load(std::memory_order_relaxed);
+		latency.total_ns = counters.total_ns.load(std::memory_order_relaxed);
+		latency.max_ns = counters.max_ns.load(std::memory_order_relaxed);
+		for (unsigned j = 0; j < RecorderStatistics::LatencyBucketCount; j++)
+			latency.buckets[j] = counters.buckets[j].load(std::memory_order_relaxed);
 	}
 
-	// Thread is not running, drain the queue ourselves.
-	if (!impl->worker_thread.joinable())
-		impl->record_task(this, false);
+	stats->bytes_copied = impl->bytes_copied.load(std::memory_order_relaxed);
+	stats->queue_high_water_mark = impl->queue_high_water_mark.load(std::memory_order_relaxed);
+	stats->allocator_peak_bytes = impl->allocator_peak_bytes.load(std::memory_order_relaxed);
+	stats->database_entries_written = impl->database_entries_written.load(std::memory_order_relaxed);
+	stats->database_bytes_written = impl->database_bytes_written.load(std::memory_order_relaxed);
+	stats->database_write_ns = impl->database_write_ns.load(std::memory_order_relaxed);
 
+	DatabaseCompressionStatistics compression;
+	{
+		std::lock_guard<std::mutex> lock(impl->final_compression_lock);
+		if (auto *iface = impl->prepared_database.load(std::memory_order_acquire))
+			iface->get_compression_statistics(&compression);
+		else
+			compression = impl->final_compression;
+	}
+	stats->compressed_payloads = compression.payload_count;
+	stats->compression_input_bytes = compression.input_bytes;
+	stats->compression_output_bytes = compression.output_bytes;
+	stats->compression_ns = compression.compression_ns;
+	stats->uncompressed_backlog_payloads = impl->uncompressed_backlog_payloads.load(std::memory_order_relaxed);
 	return true;
 }
 
-bool StateRecorder::record_graphics_pipeline(VkPipeline pipeline, const VkGraphicsPipelineCreateInfo &create_info,
-                                             const VkPipeline *base_pipelines, uint32_t base_pipeline_count,
-                                             Hash custom_hash)
+StateRecorder::Impl::LatencyScope::LatencyScope(Impl &impl_, ResourceTag tag_)
+	: impl(impl_), tag(tag_)
 {
-	{
-		if (create_info.pNext)
-		{
-			log_error_pnext_chain("pNext in VkGraphicsPipelineCreateInfo not supported.", create_info.pNext);
-			return false;
-		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+	if (impl.statistics_enabled)
+		start_time = std::chrono::steady_clock::now();
+}
 
-		VkGraphicsPipelineCreateInfo *new_info = nullptr;
-		if (!impl->copy_graphics_pipeline(&create_info, impl->temp_allocator, base_pipelines, base_pipeline_count, &new_info))
-			return false;
+StateRecorder::Impl::LatencyScope::~LatencyScope()
+{
+	if (!impl.statistics_enabled)
+		return;
 
-		impl->record_queue.push({api_object_cast<uint64_t>(pipeline), new_info, custom_hash});
-		impl->record_cv.notify_one();
-	}
+	auto ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start_time).count());
 
-	// Thread is not running, drain the queue ourselves.
-	if (!impl->worker_thread.joinable())
-		impl->record_task(this, false);
+	unsigned bucket = 0;
+	while (bucket + 1 < RecorderStatistics::LatencyBucketCount && (ns >> (bucket + 1)) != 0)
+		bucket++;
 
-	return true;
+	auto &counters = impl.record_latency[tag];
+	counters.count.fetch_add(1, std::memory_order_relaxed);
+	counters.total_ns.fetch_add(ns, std::memory_order_relaxed);
+	counters.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t max_ns = counters.max_ns.load(std::memory_order_relaxed);
+	while (ns > max_ns && !counters.max_ns.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed))
+		;
 }
 
-bool StateRecorder::record_compute_pipeline(VkPipeline pipeline, const VkComputePipelineCreateInfo &create_info,
-                                            const VkPipeline *base_pipelines, uint32_t base_pipeline_count,
-                                            Hash custom_hash)
+void StateRecorder::Impl::reset_statistics()
 {
+	for (auto &counters : record_latency)
 	{
-		if (create_info.pNext)
-		{
-			log_error_pnext_chain("pNext in VkComputePipelineCreateInfo not supported.", create_info.pNext);
-			return false;
-		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
-
-		VkComputePipelineCreateInfo *new_info = nullptr;
-		if (!impl->copy_compute_pipeline(&create_info, impl->temp_allocator, base_pipelines, base_pipeline_count, &new_info))
-			return false;
-
-		impl->record_queue.push({api_object_cast<uint64_t>(pipeline), new_info, custom_hash});
-		impl->record_cv.notify_one();
+		counters.count.store(0);
+		counters.total_ns.store(0);
+		counters.max_ns.store(0);
+		for (auto &bucket : counters.buckets)
+			bucket.store(0);
 	}
 
-	// Thread is not running, drain the queue ourselves.
-	if (!impl->worker_thread.joinable())
-		impl->record_task(this, false);
-
-	return true;
+	bytes_copied.store(0);
+	queue_high_water_mark.store(0);
+	allocator_peak_bytes.store(0);
+	database_entries_written.store(0);
+	database_bytes_written.store(0);
+	database_write_ns.store(0);
+	uncompressed_backlog_payloads.store(0);
 }
 
-bool StateRecorder::record_render_pass(VkRenderPass render_pass, const VkRenderPassCreateInfo &create_info,
-                                       Hash custom_hash)
+void StateRecorder::Impl::update_queue_high_water_mark(uint64_t depth)
 {
-	{
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+	// Only the recording thread updates this.
+	if (depth > queue_high_water_mark.load(std::memory_order_relaxed))
+		queue_high_water_mark.store(depth, std::memory_order_relaxed);
+}
 
-		VkRenderPassCreateInfo *new_info = nullptr;
-		if (!impl->copy_render_pass(&create_info, impl->temp_allocator, &new_info))
-			return false;
+void StateRecorder::Impl::write_database_entry(ResourceTag tag, Hash hash, const vector<uint8_t> &blob,
+                                               PayloadWriteFlags payload_flags) const
+{
+	if (!ordered_writes.empty())
+		ordered_writes.push_back({ nullptr, tag, hash, payload_flags, blob });
+	else
+		commit_database_entry(tag, hash, blob, payload_flags);
+}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(render_pass), new_info, custom_hash});
-		impl->record_cv.notify_one();
-	}
+PayloadWriteFlags StateRecorder::Impl::get_backlog_payload_flags(PayloadWriteFlags payload_flags, uint64_t backlog)
+{
+	if (!adaptive_compression_backlog || (payload_flags & PAYLOAD_WRITE_COMPRESS_BIT) == 0)
+		return payload_flags;
 
-	// Thread is not running, drain the queue ourselves.
-	if (!impl->worker_thread.joinable())
-		impl->record_task(this, false);
+	if (backlog >= adaptive_compression_backlog)
+		compression_bypassed = true;
+	else if (backlog <= adaptive_compression_backlog / 2)
+		compression_bypassed = false;
 
-	return true;
+	if (compression_bypassed)
+	{
+		payload_flags &= ~(PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_BEST_COMPRESSION_BIT |
+		                   PAYLOAD_WRITE_COMPRESS_ZSTD_BIT | PAYLOAD_WRITE_COMPRESS_LZ4_BIT);
+	}
+	return payload_flags;
 }
 
-bool StateRecorder::record_shader_module(VkShaderModule module, const VkShaderModuleCreateInfo &create_info,
-                                         Hash custom_hash)
+void StateRecorder::Impl::commit_database_entry(ResourceTag tag, Hash hash, const vector<uint8_t> &blob,
+                                                PayloadWriteFlags payload_flags) const
 {
+	if (!statistics_enabled)
 	{
-		if (create_info.pNext)
-		{
-			log_error_pnext_chain("pNext in VkShaderModuleCreateInfo not supported.", create_info.pNext);
-			return false;
-		}
-		std::lock_guard<std::mutex> lock(impl->record_lock);
+		database_iface->write_entry(tag, hash, blob.data(), blob.size(), payload_flags);
+		return;
+	}
 
-		VkShaderModuleCreateInfo *new_info = nullptr;
-		if (!impl->copy_shader_module(&create_info, impl->temp_allocator, &new_info))
-			return false;
+	auto start_time = std::chrono::steady_clock::now();
+	database_iface->write_entry(tag, hash, blob.data(), blob.size(), payload_flags);
+	auto end_time = std::chrono::steady_clock::now();
+
+	database_entries_written.fetch_add(1, std::memory_order_relaxed);
+	database_bytes_written.fetch_add(blob.size(), std::memory_order_relaxed);
+	// Application links are never compressed, everything else only skips compression under backlog.
+	if (compression && tag != RESOURCE_APPLICATION_BLOB_LINK && (payload_flags & PAYLOAD_WRITE_COMPRESS_BIT) == 0)
+		uncompressed_backlog_payloads.fetch_add(1, std::memory_order_relaxed);
+	database_write_ns.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count()),
+	                            std::memory_order_relaxed);
+}
 
-		impl->record_queue.push({api_object_cast<uint64_t>(module), new_info, custom_hash});
-		impl->record_cv.notify_one();
+bool StateRecorder::record_application_info(const VkApplicationInfo &info)
+{
+	if (info.pNext)
+	{
+		log_error_pnext_chain("pNext in VkApplicationInfo not supported.", info.pNext);
+		return false;
 	}
 
-	// Thread is not running, drain the queue ourselves.
-	if (!impl->worker_thread.joinable())
-		impl->record_task(this, false);
+	std::lock_guard<std::mutex> lock(impl->record_lock);
+	if (!impl->copy_application_info(&info, impl->allocator, &impl->application_info))
+		return false;
+	impl->application_feature_hash.application_info_hash = Hashing::compute_hash_application_info(*impl->application_info);
+	return true;
+}
 
+bool StateRecorder::record_physical_device_features(const VkPhysicalDeviceFeatures2 &device_features)
+{
+	// We just ignore pNext, but it's okay to keep it. We will not need to serialize it for now.
+	std::lock_guard<std::mutex> lock(impl->record_lock);
+	if (!impl->copy_physical_device_features(&device_features, impl->allocator, &impl->physical_device_features))
+		return false;
+	impl->application_feature_hash.physical_device_features_hash = Hashing::compute_hash_physical_device_features(*impl->physical_device_features);
 	return true;
 }
 
-void StateRecorder::Impl::record_end()
+void StateRecorder::set_application_info_filter(ApplicationInfoFilter *filter)
 {
-	// Signal end of recording with empty work item
-	std::lock_guard<std::mutex> lock(record_lock);
-	record_queue.push({ 0, nullptr, 0 });
-	record_cv.notify_one();
+	impl->application_info_filter = filter;
 }
 
-bool StateRecorder::get_hash_for_compute_pipeline_handle(VkPipeline pipeline, Hash *hash) const
+const StateRecorderApplicationFeatureHash &StateRecorder::get_application_feature_hash() const
 {
-	auto itr = impl->compute_pipeline_to_hash.find(pipeline);
-	if (itr == end(impl->compute_pipeline_to_hash))
-	{
-		log_failed_hash("Compute pipeline", pipeline);
-		return false;
-	}
-	else
-	{
-		*hash = itr->second;
-		return true;
-	}
+	return impl->application_feature_hash;
 }
 
-bool StateRecorder::get_hash_for_graphics_pipeline_handle(VkPipeline pipeline, Hash *hash) const
+bool StateRecorder::record_physical_device_features(const VkPhysicalDeviceFeatures &device_features)
 {
-	auto itr = impl->graphics_pipeline_to_hash.find(pipeline);
-	if (itr == end(impl->graphics_pipeline_to_hash))
-	{
-		log_failed_hash("Graphics pipeline", pipeline);
-		return false;
-	}
-	else
-	{
-		*hash = itr->second;
-		return true;
-	}
+	VkPhysicalDeviceFeatures2 features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	features.features = device_features;
+	return record_physical_device_features(features);
 }
 
-bool StateRecorder::get_hash_for_sampler(VkSampler sampler, Hash *hash) const
+bool StateRecorder::record_sampler(VkSampler sampler, const VkSamplerCreateInfo &create_info, Hash custom_hash)
 {
-	auto itr = impl->sampler_to_hash.find(sampler);
-	if (itr == end(impl->sampler_to_hash))
+	Impl::LatencyScope latency_scope(*impl, RESOURCE_SAMPLER);
+
+	if (create_info.pNext)
 	{
-		log_failed_hash("Sampler", sampler);
+		log_error_pnext_chain("pNext in VkSamplerCreateInfo not supported.", create_info.pNext);
 		return false;
 	}
-	else
-	{
-		*hash = itr->second;
-		return true;
-	}
+
+	Hash hash = impl->compute_early_hash(custom_hash, [&](Hash *early_hash) {
+		return Hashing::compute_hash_sampler(create_info, early_hash);
+	});
+
+	return impl->push_work_item(this, RESOURCE_SAMPLER, api_object_cast<uint64_t>(sampler), hash, [&](ScratchAllocator &alloc) -> void * {
+		VkSamplerCreateInfo *new_info = nullptr;
+		if (!impl->copy_sampler(&create_info, alloc, &new_info))
+			return nullptr;
+		return new_info;
+	});
 }
 
-bool StateRecorder::get_hash_for_shader_module(VkShaderModule module, Hash *hash) const
+bool StateRecorder::record_descriptor_set_layout(VkDescriptorSetLayout set_layout, const VkDescriptorSetLayoutCreateInfo &create_info,
+                                                 Hash custom_hash)
 {
-	auto itr = impl->shader_module_to_hash.find(module);
-	if (itr == end(impl->shader_module_to_hash))
-	{
-		log_failed_hash("Shader module", module);
-		return false;
-	}
-	else
-	{
-		*hash = itr->second;
-		return true;
-	}
+	Impl::LatencyScope latency_scope(*impl, RESOURCE_DESCRIPTOR_SET_LAYOUT);
+
+	return impl->push_work_item(this, RESOURCE_DESCRIPTOR_SET_LAYOUT, api_object_cast<uint64_t>(set_layout), custom_hash, [&](ScratchAllocator &alloc) -> void * {
+		VkDescriptorSetLayoutCreateInfo *new_info = nullptr;
+		if (!impl->copy_descriptor_set_layout(&create_info, alloc, &new_info))
+			return nullptr;
+		return new_info;
+	});
 }
 
-bool StateRecorder::get_hash_for_pipeline_layout(VkPipelineLayout layout, Hash *hash) const
+bool StateRecorder::record_pipeline_layout(VkPipelineLayout pipeline_layout, const VkPipelineLayoutCreateInfo &create_info,
+                                           Hash custom_hash)
 {
-	auto itr = impl->pipeline_layout_to_hash.find(layout);
-	if (itr == end(impl->pipeline_layout_to_hash))
+	Impl::LatencyScope latency_scope(*impl, RESOURCE_PIPELINE_LAYOUT);
+
+	if (create_info.pNext)
 	{
-		log_failed_hash("Pipeline layout", layout);
+		log_error_pnext_chain("pNext in VkPipelineLayoutCreateInfo not supported.", create_info.pNext);
 		return false;
 	}
-	else
+
+	return impl->push_work_item(this, RESOURCE_PIPELINE_LAYOUT, api_object_cast<uint64_t>(pipeline_layout), custom_hash, [&](ScratchAllocator &alloc) -> void * {
+		VkPipelineLayoutCreateInfo *new_info = nullptr;
+		if (!impl->copy_pipeline_layout(&create_info, alloc, &new_info))
+			return nullptr;
+		return new_info;
+	});
+}
+
+static bool blend_attachment_uses_constants(const VkPipelineColorBlendAttachmentState &att)
+{
+	const VkBlendFactor factors[] = {
+		att.srcColorBlendFactor, att.dstColorBlendFactor,
+		att.srcAlphaBlendFactor, att.dstAlphaBlendFactor,
+	};
+
+	for (auto factor : factors)
 	{
-		*hash = itr->second;
-		return true;
+		if (factor == VK_BLEND_FACTOR_CONSTANT_COLOR || factor == VK_BLEND_FACTOR_ONE_MINUS_CONSTANT_COLOR ||
+		    factor == VK_BLEND_FACTOR_CONSTANT_ALPHA || factor == VK_BLEND_FACTOR_ONE_MINUS_CONSTANT_ALPHA)
+			return true;
 	}
+	return false;
 }
 
-bool StateRecorder::get_hash_for_descriptor_set_layout(VkDescriptorSetLayout layout, Hash *hash) const
+// Works on a deep copy made by copy_graphics_pipeline(). State is only reset when the spec says it is ignored,
+// and state which is enabled through dynamic state is left alone.
+static void canonicalize_graphics_pipeline(VkGraphicsPipelineCreateInfo &info)
 {
-	auto itr = impl->descriptor_set_layout_to_hash.find(layout);
-	if (itr == end(impl->descriptor_set_layout_to_hash))
+	bool dynamic_viewport = false;
+	bool dynamic_scissor = false;
+	bool dynamic_line_width = false;
+	bool dynamic_depth_bias = false;
+	bool dynamic_blend_constants = false;
+	bool dynamic_depth_bounds = false;
+	bool dynamic_stencil_compare = false;
+	bool dynamic_stencil_write_mask = false;
+	bool dynamic_stencil_reference = false;
+	bool dynamic_depth_test_enable = false;
+	bool dynamic_depth_write_enable = false;
+	bool dynamic_depth_compare_op = false;
+	bool dynamic_depth_bounds_test_enable = false;
+	bool dynamic_stencil_test_enable = false;
+	bool dynamic_stencil_op = false;
+
+	if (info.pDynamicState)
 	{
-		log_failed_hash("Descriptor set layout", layout);
-		return false;
+		for (uint32_t i = 0; i < info.pDynamicState->dynamicStateCount; i++)
+		{
+			switch (info.pDynamicState->pDynamicStates[i])
+			{
+			case VK_DYNAMIC_STATE_VIEWPORT:
+			case VK_DYNAMIC_STATE_VIEWPORT_WITH_COUNT_EXT:
+				dynamic_viewport = true;
+				break;
+			case VK_DYNAMIC_STATE_SCISSOR:
+			case VK_DYNAMIC_STATE_SCISSOR_WITH_COUNT_EXT:
+				dynamic_scissor = true;
+				break;
+			case VK_DYNAMIC_STATE_LINE_WIDTH:
+				dynamic_line_width = true;
+				break;
+			case VK_DYNAMIC_STATE_DEPTH_BIAS:
+				dynamic_depth_bias = true;
+				break;
+			case VK_DYNAMIC_STATE_BLEND_CONSTANTS:
+				dynamic_blend_constants = true;
+				break;
+			case VK_DYNAMIC_STATE_DEPTH_BOUNDS:
+				dynamic_depth_bounds = true;
+				break;
+			case VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK:
+				dynamic_stencil_compare = true;
+				break;
+			case VK_DYNAMIC_STATE_STENCIL_WRITE_MASK:
+				dynamic_stencil_write_mask = true;
+				break;
+			case VK_DYNAMIC_STATE_STENCIL_REFERENCE:
+				dynamic_stencil_reference = true;
+				break;
+			case VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT:
+				dynamic_depth_test_enable = true;
+				break;
+			case VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT:
+				dynamic_depth_write_enable = true;
+				break;
+			case VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT:
+				dynamic_depth_compare_op = true;
+				break;
+			case VK_DYNAMIC_STATE_DEPTH_BOUNDS_TEST_ENABLE_EXT:
+				dynamic_depth_bounds_test_enable = true;
+				break;
+			case VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE_EXT:
+				dynamic_stencil_test_enable = true;
+				break;
+			case VK_DYNAMIC_STATE_STENCIL_OP_EXT:
+				dynamic_stencil_op = true;
+				break;
+			default:
+				break;
+			}
+		}
 	}
-	else
+
+	if (info.pViewportState)
 	{
-		*hash = itr->second;
-		return true;
+		auto &vp = const_cast<VkPipelineViewportStateCreateInfo &>(*info.pViewportState);
+		if (dynamic_viewport)
+			vp.pViewports = nullptr;
+		if (dynamic_scissor)
+			vp.pScissors = nullptr;
 	}
-}
 
-bool StateRecorder::get_hash_for_render_pass(VkRenderPass render_pass, Hash *hash) const
-{
-	auto itr = impl->render_pass_to_hash.find(render_pass);
-	if (itr == end(impl->render_pass_to_hash))
+	if (info.pRasterizationState)
 	{
-		log_failed_hash("Render pass", render_pass);
-		return false;
+		auto &rs = const_cast<VkPipelineRasterizationStateCreateInfo &>(*info.pRasterizationState);
+		if (dynamic_line_width)
+			rs.lineWidth = 1.0f;
+		if (dynamic_depth_bias || !rs.depthBiasEnable)
+		{
+			rs.depthBiasConstantFactor = 0.0f;
+			rs.depthBiasClamp = 0.0f;
+			rs.depthBiasSlopeFactor = 0.0f;
+		}
 	}
-	else
+
+	if (info.pMultisampleState)
 	{
-		*hash = itr->second;
-		return true;
+		auto &ms = const_cast<VkPipelineMultisampleStateCreateInfo &>(*info.pMultisampleState);
+		if (!ms.sampleShadingEnable)
+			ms.minSampleShading = 0.0f;
 	}
-}
 
-bool StateRecorder::Impl::copy_shader_module(const VkShaderModuleCreateInfo *create_info, ScratchAllocator &alloc,
-                                             VkShaderModuleCreateInfo **out_create_info)
-{
-	if (create_info->pNext)
-		return false;
+	if (info.pDepthStencilState)
+	{
+		auto &ds = const_cast<VkPipelineDepthStencilStateCreateInfo &>(*info.pDepthStencilState);
 
-	auto *info = copy(create_info, 1, alloc);
-	info->pCode = copy(info->pCode, info->codeSize / sizeof(uint32_t), alloc);
+		if (dynamic_depth_test_enable)
+			ds.depthTestEnable = VK_FALSE;
+		if (dynamic_depth_write_enable || (!dynamic_depth_test_enable && !ds.depthTestEnable))
+			ds.depthWriteEnable = VK_FALSE;
+		if (dynamic_depth_compare_op || (!dynamic_depth_test_enable && !ds.depthTestEnable))
+			ds.depthCompareOp = VK_COMPARE_OP_NEVER;
 
-	*out_create_info = info;
-	return true;
+		if (dynamic_depth_bounds_test_enable)
+			ds.depthBoundsTestEnable = VK_FALSE;
+		if (dynamic_depth_bounds || (!dynamic_depth_bounds_test_enable && !ds.depthBoundsTestEnable))
+		{
+			ds.minDepthBounds = 0.0f;
+			ds.maxDepthBounds = 0.0f;
+		}
+
+		if (dynamic_stencil_test_enable)
+			ds.stencilTestEnable = VK_FALSE;
+
+		if (!dynamic_stencil_test_enable && !ds.stencilTestEnable)
+		{
+			ds.front = {};
+			ds.back = {};
+		}
+		else
+		{
+			for (auto *op : { &ds.front, &ds.back })
+			{
+				if (dynamic_stencil_op)
+				{
+					op->failOp = VK_STENCIL_OP_KEEP;
+					op->passOp = VK_STENCIL_OP_KEEP;
+					op->depthFailOp = VK_STENCIL_OP_KEEP;
+					op->compareOp = VK_COMPARE_OP_NEVER;
+				}
+				if (dynamic_stencil_compare)
+					op->compareMask = 0;
+				if (dynamic_stencil_write_mask)
+					op->writeMask = 0;
+				if (dynamic_stencil_reference)
+					op->reference = 0;
+			}
+		}
+	}
+
+	if (info.pColorBlendState)
+	{
+		auto &blend = const_cast<VkPipelineColorBlendStateCreateInfo &>(*info.pColorBlendState);
+		if (!blend.logicOpEnable)
+			blend.logicOp = VK_LOGIC_OP_CLEAR;
+
+		bool need_blend_constants = false;
+		for (uint32_t i = 0; i < blend.attachmentCount; i++)
+		{
+			auto &att = const_cast<VkPipelineColorBlendAttachmentState &>(blend.pAttachments[i]);
+			if (att.blendEnable)
+			{
+				if (blend_attachment_uses_constants(att))
+					need_blend_constants = true;
+			}
+			else
+			{
+				// The write mask applies whether or not blending is enabled.
+				VkColorComponentFlags write_mask = att.colorWriteMask;
+				att = {};
+				att.colorWriteMask = write_mask;
+			}
+		}
+
+		if (dynamic_blend_constants || !need_blend_constants)
+			memset(blend.blendConstants, 0, sizeof(blend.blendConstants));
+	}
 }
 
-bool StateRecorder::Impl::copy_sampler(const VkSamplerCreateInfo *create_info, ScratchAllocator &alloc,
-                                       VkSamplerCreateInfo **out_create_info)
+bool StateRecorder::record_graphics_pipeline(VkPipeline pipeline, const VkGraphicsPipelineCreateInfo &create_info,
+                                             const VkPipeline *base_pipelines, uint32_t base_pipeline_count,
+                                             Hash custom_hash)
 {
-	if (create_info->pNext)
+	Impl::LatencyScope latency_scope(*impl, RESOURCE_GRAPHICS_PIPELINE);
+
+	if (create_info.pNext)
+	{
+		log_error_pnext_chain("pNext in VkGraphicsPipelineCreateInfo not supported.", create_info.pNext);
 		return false;
+	}
 
-	*out_create_info = copy(create_info, 1, alloc);
-	return true;
+	return impl->push_work_item(this, RESOURCE_GRAPHICS_PIPELINE, api_object_cast<uint64_t>(pipeline), custom_hash, [&](ScratchAllocator &alloc) -> void * {
+		VkGraphicsPipelineCreateInfo *new_info = nullptr;
+		if (!impl->copy_graphics_pipeline(&create_info, alloc, base_pipelines, base_pipeline_count, &new_info))
+			return nullptr;
+		if (impl->canonicalize_pipeline_state)
+			canonicalize_graphics_pipeline(*new_info);
+		return new_info;
+	});
 }
 
-bool StateRecorder::Impl::copy_physical_device_features(const VkPhysicalDeviceFeatures2 *pdf,
-                                                        ScratchAllocator &alloc,
-                                                        VkPhysicalDeviceFeatures2 **out_pdf)
+bool StateRecorder::record_compute_pipeline(VkPipeline pipeline, const VkComputePipelineCreateInfo &create_info,
+                                            const VkPipeline *base_pipelines, uint32_t base_pipeline_count,
+                                            Hash custom_hash)
 {
-	// Ignore pNext. We don't need to serialize it.
-	auto *features = copy(pdf, 1, alloc);
-	features->pNext = nullptr;
+	Impl::LatencyScope latency_scope(*impl, RESOURCE_COMPUTE_PIPELINE);
 
-	*out_pdf = features;
-	return true;
+	if (create_info.pNext)
+	{
+		log_error_pnext_chain("pNext in VkComputePipelineCreateInfo not supported.", create_info.pNext);
+		return false;
+	}
+
+	return impl->push_work_item(this, RESOURCE_COMPUTE_PIPELINE, api_object_cast<uint64_t>(pipeline), custom_hash, [&](ScratchAllocator &alloc) -> void * {
+		VkComputePipelineCreateInfo *new_info = nullptr;
+		if (!impl->copy_compute_pipeline(&create_info, alloc, base_pipelines, base_pipeline_count, &new_info))
+			return nullptr;
+		return new_info;
+	});
 }
 
-bool StateRecorder::Impl::copy_application_info(const VkApplicationInfo *app_info, ScratchAllocator &alloc,
-                                                VkApplicationInfo **out_app_info)
+bool StateRecorder::record_render_pass(VkRenderPass render_pass, const VkRenderPassCreateInfo &create_info,
+                                       Hash custom_hash)
 {
-	auto *app = copy(app_info, 1, alloc);
-	if (app->pEngineName)
-		app->pEngineName = copy(app->pEngineName, strlen(app->pEngineName) + 1, alloc);
-	if (app->pApplicationName)
-		app->pApplicationName = copy(app->pApplicationName, strlen(app->pApplicationName) + 1, alloc);
+	Impl::LatencyScope latency_scope(*impl, RESOURCE_RENDER_PASS);
 
-	*out_app_info = app;
-	return true;
+	Hash hash = impl->compute_early_hash(custom_hash, [&](Hash *early_hash) {
+		return Hashing::compute_hash_render_pass(create_info, early_hash);
+	});
+
+	return impl->push_work_item(this, RESOURCE_RENDER_PASS, api_object_cast<uint64_t>(render_pass), hash, [&](ScratchAllocator &alloc) -> void * {
+		VkRenderPassCreateInfo *new_info = nullptr;
+		if (!impl->copy_render_pass(&create_info, alloc, &new_info))
+			return nullptr;
+		return new_info;
+	});
 }
 
-bool StateRecorder::Impl::copy_descriptor_set_layout(
-	const VkDescriptorSetLayoutCreateInfo *create_info, ScratchAllocator &alloc,
-	VkDescriptorSetLayoutCreateInfo **out_create_info)
+bool StateRecorder::record_shader_module(VkShaderModule module, const VkShaderModuleCreateInfo &create_info,
+                                         Hash custom_hash)
 {
-	auto *info = copy(create_info, 1, alloc);
-	info->pBindings = copy(info->pBindings, info->bindingCount, alloc);
+	Impl::LatencyScope latency_scope(*impl, RESOURCE_SHADER_MODULE);
 
-	for (uint32_t i = 0; i < info->bindingCount; i++)
+	if (create_info.pNext)
 	{
-		auto &b = const_cast<VkDescriptorSetLayoutBinding &>(info->pBindings[i]);
-		if (b.pImmutableSamplers &&
-		    (b.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER ||
-		     b.descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER))
-		{
-			b.pImmutableSamplers = copy(b.pImmutableSamplers, b.descriptorCount, alloc);
-		}
+		log_error_pnext_chain("pNext in VkShaderModuleCreateInfo not supported.", create_info.pNext);
+		return false;
 	}
 
-	if (!copy_pnext_chain(create_info->pNext, alloc, &info->pNext))
-		return false;
+	Hash hash = impl->compute_early_hash(custom_hash, [&](Hash *early_hash) {
+		return Hashing::compute_hash_shader_module(create_info, early_hash, impl->hash_algorithm);
+	});
 
-	*out_create_info = info;
-	return true;
+	return impl->push_work_item(this, RESOURCE_SHADER_MODULE, api_object_cast<uint64_t>(module), hash, [&](ScratchAllocator &alloc) -> void * {
+		VkShaderModuleCreateInfo *new_info = nullptr;
+		if (!impl->copy_shader_module(&create_info, alloc, &new_info))
+			return nullptr;
+		return new_info;
+	});
 }
 
-bool StateRecorder::Impl::copy_pipeline_layout(const VkPipelineLayoutCreateInfo *create_info, ScratchAllocator &alloc,
-                                               VkPipelineLayoutCreateInfo **out_create_info)
+void StateRecorder::record_pipeline_usage(ResourceTag tag, VkPipeline pipeline, uint64_t bind_count)
 {
-	if (create_info->pNext)
-		return false;
+	// database_iface belongs to the recording thread by now, it drops the counts if there is no database.
+	if (!impl->worker_thread.joinable() || bind_count == 0)
+		return;
 
-	auto *info = copy(create_info, 1, alloc);
-	info->pPushConstantRanges = copy(info->pPushConstantRanges, info->pushConstantRangeCount, alloc);
-	info->pSetLayouts = copy(info->pSetLayouts, info->setLayoutCount, alloc);
+	if (tag != RESOURCE_GRAPHICS_PIPELINE && tag != RESOURCE_COMPUTE_PIPELINE)
+	{
+		LOGW_LEVEL("Pipeline usage can only be recorded for graphics and compute pipelines.\n");
+		return;
+	}
 
-	*out_create_info = info;
-	return true;
+	{
+		std::lock_guard<std::mutex> lock(impl->pipeline_usage_lock);
+		impl->pending_pipeline_usage.push_back({ tag, api_object_cast<uint64_t>(pipeline), bind_count });
+		impl->pipeline_usage_pending.store(true);
+	}
+	impl->wake_record_thread();
 }
 
-bool StateRecorder::Impl::copy_specialization_info(const VkSpecializationInfo *info, ScratchAllocator &alloc,
-                                                   const VkSpecializationInfo **out_info)
+void StateRecorder::Impl::record_end()
 {
-	auto *ret = copy(info, 1, alloc);
-	ret->pMapEntries = copy(ret->pMapEntries, ret->mapEntryCount, alloc);
-	ret->pData = copy(static_cast<const uint8_t *>(ret->pData), ret->dataSize, alloc);
+	// Signal end of recording with empty work item.
+	// It must never be dropped or wait for a slot, so it always takes the overflow path.
+	push_overflow_item({ 0, nullptr, 0, RESOURCE_COUNT });
+}
 
-	*out_info = ret;
-	return true;
+void StateRecorder::Impl::init_record_ring(uint32_t capacity)
+{
+	uint64_t count = 2;
+	while (count < capacity)
+		count <<= 1;
+
+	record_ring.reset(new RecordSlot[count]);
+	for (uint64_t i = 0; i < count; i++)
+		record_ring[i].sequence.store(i, std::memory_order_relaxed);
+	record_ring_mask = count - 1;
+	record_enqueue_pos.store(0);
+	record_dequeue_pos = 0;
 }
 
-bool StateRecorder::Impl::copy_compute_pipeline(const VkComputePipelineCreateInfo *create_info, ScratchAllocator &alloc,
-                                                const VkPipeline *base_pipelines, uint32_t base_pipeline_count,
-                                                VkComputePipelineCreateInfo **out_create_info)
+bool StateRecorder::Impl::record_ring_has_data() const
 {
-	auto *info = copy(create_info, 1, alloc);
+	return record_ring[record_dequeue_pos & record_ring_mask].sequence.load() == record_dequeue_pos + 1;
+}
 
-	// Check for case where application made use of derivative pipelines and relied on the indexing behavior
-	// into an array of pCreateInfos. In the replayer, we only do it one by one,
-	// so we need to pass the correct handle to the create pipeline calls.
-	if ((info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
+void StateRecorder::Impl::wake_record_thread()
+{
+	// Only pay for the lock if the recording thread went to sleep.
+	// Publishing and testing the flag are both sequentially consistent, which pairs with
+	// the recording thread setting the flag before it re-checks the queue.
+	if (record_thread_sleeping.load())
 	{
-		if (info->basePipelineHandle == VK_NULL_HANDLE &&
-		    info->basePipelineIndex >= 0)
-		{
-			if (uint32_t(info->basePipelineIndex) >= base_pipeline_count)
-			{
-				LOGE_LEVEL("Base pipeline index is out of range.\n");
-				return false;
-			}
-
-			info->basePipelineHandle = base_pipelines[info->basePipelineIndex];
-			info->basePipelineIndex = -1;
-		}
+		std::lock_guard<std::mutex> lock(record_lock);
+		record_cv.notify_one();
 	}
+}
 
-	if (info->stage.pSpecializationInfo)
-		if (!copy_specialization_info(info->stage.pSpecializationInfo, alloc, &info->stage.pSpecializationInfo))
-			return false;
+void StateRecorder::Impl::push_overflow_item(const WorkItem &item)
+{
+	std::lock_guard<std::mutex> lock(record_lock);
+	overflow_queue.push(item);
+	overflow_pending.store(true);
+	record_cv.notify_one();
+}
 
-	info->stage.pName = copy(info->stage.pName, strlen(info->stage.pName) + 1, alloc);
+bool StateRecorder::Impl::is_prior_object(ResourceTag tag, Hash hash) const
+{
+	// The read-only part of the database never changes once prepared.
+	auto *iface = prepared_database.load(std::memory_order_acquire);
+	return hash != 0 && iface && iface->has_prior_entry(tag, hash);
+}
 
-	if (!copy_pnext_chain(info->stage.pNext, alloc, &info->stage.pNext))
-		return false;
+template <typename HashFunc>
+Hash StateRecorder::Impl::compute_early_hash(Hash custom_hash, const HashFunc &hash_func) const
+{
+	// Hashing on the calling thread only pays off if the database can tell us to skip the copy.
+	if (custom_hash != 0 || !skip_prior_objects || !prepared_database.load(std::memory_order_relaxed))
+		return custom_hash;
 
-	*out_create_info = info;
-	return true;
+	// The recording thread hashes again if this fails.
+	Hash hash = 0;
+	if (!hash_func(&hash))
+		return 0;
+	return hash;
 }
 
-bool StateRecorder::Impl::copy_graphics_pipeline(const VkGraphicsPipelineCreateInfo *create_info, ScratchAllocator &alloc,
-                                                 const VkPipeline *base_pipelines, uint32_t base_pipeline_count,
-                                                 VkGraphicsPipelineCreateInfo **out_create_info)
+template <typename CopyFunc>
+bool StateRecorder::Impl::push_work_item(StateRecorder *recorder, ResourceTag tag, uint64_t handle, Hash custom_hash,
+                                         const CopyFunc &copy_func)
 {
-	auto *info = copy(create_info, 1, alloc);
+	bool threaded = worker_thread.joinable();
+	// Objects from a prior session are never written again, the recording thread only needs their handle.
+	ResourceTag prior_tag = is_prior_object(tag, custom_hash) ? tag : RESOURCE_COUNT;
+	RecordSlot *slot = nullptr;
+	uint64_t pos = record_enqueue_pos.load(std::memory_order_relaxed);
 
-	// Check for case where application made use of derivative pipelines and relied on the indexing behavior
-	// into an array of pCreateInfos. In the replayer, we only do it one by one,
-	// so we need to pass the correct handle to the create pipeline calls.
-	if ((info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
+	// Once anything has spilled, keep spilling until the recording thread catches up, so objects stay in order.
+	while (!slot && !overflow_pending.load())
 	{
-		if (info->basePipelineHandle == VK_NULL_HANDLE &&
-		    info->basePipelineIndex >= 0)
-		{
-			if (uint32_t(info->basePipelineIndex) >= base_pipeline_count)
-			{
-				LOGE_LEVEL("Base pipeline index is out of range.\n");
-				return false;
-			}
+		auto &candidate = record_ring[pos & record_ring_mask];
+		auto diff = int64_t(candidate.sequence.load(std::memory_order_acquire) - pos);
 
-			info->basePipelineHandle = base_pipelines[info->basePipelineIndex];
-			info->basePipelineIndex = -1;
+		if (diff == 0)
+		{
+			if (record_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				slot = &candidate;
 		}
-	}
-
-	info->pStages = copy(info->pStages, info->stageCount, alloc);
-	if (info->pTessellationState)
-	{
-		info->pTessellationState = copy(info->pTessellationState, 1, alloc);
-
-		const void *pNext = nullptr;
-		if (!copy_pnext_chain(info->pTessellationState->pNext, alloc, &pNext))
-			return false;
-		const_cast<VkPipelineTessellationStateCreateInfo *>(info->pTessellationState)->pNext = pNext;
-	}
-
-	if (info->pColorBlendState)
-	{
-		info->pColorBlendState = copy(info->pColorBlendState, 1, alloc);
-		const void *pNext = nullptr;
-		if (!copy_pnext_chain(info->pColorBlendState->pNext, alloc, &pNext))
-			return false;
-
-		const_cast<VkPipelineColorBlendStateCreateInfo *>(info->pColorBlendState)->pNext = pNext;
-	}
-
-	if (info->pVertexInputState)
-	{
-		info->pVertexInputState = copy(info->pVertexInputState, 1, alloc);
-
-		const void *pNext = nullptr;
-		if (!copy_pnext_chain(info->pVertexInputState->pNext, alloc, &pNext))
-			return false;
-
-		const_cast<VkPipelineVertexInputStateCreateInfo *>(info->pVertexInputState)->pNext = pNext;
-	}
-
-	if (info->pMultisampleState)
-	{
-		if (info->pMultisampleState->pNext)
-		{
-			log_error_pnext_chain("pNext in VkPipelineMultisampleStateCreateInfo not supported.",
-			                      info->pMultisampleState->pNext);
-			return false;
-		}
-		info->pMultisampleState = copy(info->pMultisampleState, 1, alloc);
-	}
-
-	if (info->pViewportState)
-	{
-		if (info->pViewportState->pNext)
+		else if (diff > 0)
 		{
-			log_error_pnext_chain("pNext in VkPipelineViewportStateCreateInfo not supported.",
-			                      info->pViewportState->pNext);
-			return false;
+			// Another producer claimed this slot first.
+			pos = record_enqueue_pos.load(std::memory_order_relaxed);
 		}
-		info->pViewportState = copy(info->pViewportState, 1, alloc);
-	}
-
-	if (info->pInputAssemblyState)
-	{
-		if (info->pInputAssemblyState->pNext)
+		else if (!threaded)
 		{
-			log_error_pnext_chain("pNext in VkPipelineInputAssemblyStateCreateInfo not supported.",
-			                      info->pInputAssemblyState->pNext);
-			return false;
+			// Only happens when several threads record inline at the same time.
+			record_task(recorder, false);
+			pos = record_enqueue_pos.load(std::memory_order_relaxed);
 		}
-		info->pInputAssemblyState = copy(info->pInputAssemblyState, 1, alloc);
-	}
-
-	if (info->pDepthStencilState)
-	{
-		if (info->pDepthStencilState->pNext)
+		else if (record_queue_mode == RecordQueueMode::Drop)
 		{
-			log_error_pnext_chain("pNext in VkPipelineDepthStencilStateCreateInfo not supported.",
-			                      info->pDepthStencilState->pNext);
-			return false;
+			dropped_records.fetch_add(1, std::memory_order_relaxed);
+			return true;
 		}
-		info->pDepthStencilState = copy(info->pDepthStencilState, 1, alloc);
-	}
-
-	if (info->pRasterizationState)
-	{
-		info->pRasterizationState = copy(info->pRasterizationState, 1, alloc);
-		if (!info->pRasterizationState)
-			return false;
-
-		const void *pNext = nullptr;
-		if (!copy_pnext_chain(info->pRasterizationState->pNext, alloc, &pNext))
-			return false;
-
-		const_cast<VkPipelineRasterizationStateCreateInfo *>(info->pRasterizationState)->pNext = pNext;
-	}
-
-	if (info->pDynamicState)
-	{
-		if (info->pDynamicState->pNext)
+		else if (record_queue_mode == RecordQueueMode::Block)
 		{
-			log_error_pnext_chain("pNext in VkPipelineDynamicStateCreateInfo not supported.",
-			                      info->pDynamicState->pNext);
-			return false;
+			std::unique_lock<std::mutex> lock(record_lock);
+			record_space_waiters.fetch_add(1);
+			record_space_cv.wait(lock, [&]() {
+				pos = record_enqueue_pos.load();
+				return int64_t(record_ring[pos & record_ring_mask].sequence.load() - pos) >= 0;
+			});
+			record_space_waiters.fetch_sub(1);
 		}
-		info->pDynamicState = copy(info->pDynamicState, 1, alloc);
-	}
-
-	for (uint32_t i = 0; i < info->stageCount; i++)
-	{
-		auto &stage = const_cast<VkPipelineShaderStageCreateInfo &>(info->pStages[i]);
-
-		stage.pName = copy(stage.pName, strlen(stage.pName) + 1, alloc);
-		if (stage.pSpecializationInfo)
-			if (!copy_specialization_info(stage.pSpecializationInfo, alloc, &stage.pSpecializationInfo))
-				return false;
-
-		const void *pNext = nullptr;
-		if (!copy_pnext_chain(stage.pNext, alloc, &pNext))
-			return false;
-		stage.pNext = pNext;
-	}
-
-	if (info->pColorBlendState)
-	{
-		auto &blend = const_cast<VkPipelineColorBlendStateCreateInfo &>(*info->pColorBlendState);
-		blend.pAttachments = copy(blend.pAttachments, blend.attachmentCount, alloc);
+		else
+			break;
 	}
 
-	if (info->pVertexInputState)
-	{
-		auto &vs = const_cast<VkPipelineVertexInputStateCreateInfo &>(*info->pVertexInputState);
-		vs.pVertexAttributeDescriptions = copy(vs.pVertexAttributeDescriptions, vs.vertexAttributeDescriptionCount, alloc);
-		vs.pVertexBindingDescriptions = copy(vs.pVertexBindingDescriptions, vs.vertexBindingDescriptionCount, alloc);
-	}
+	bool ret = true;
 
-	if (info->pViewportState)
+	if (slot)
 	{
-		auto &vp = const_cast<VkPipelineViewportStateCreateInfo &>(*info->pViewportState);
-		if (vp.pViewports)
-			vp.pViewports = copy(vp.pViewports, vp.viewportCount, alloc);
-		if (vp.pScissors)
-			vp.pScissors = copy(vp.pScissors, vp.scissorCount, alloc);
-	}
+		void *create_info = prior_tag == RESOURCE_COUNT ? copy_func(slot->allocator) : nullptr;
+		if (statistics_enabled)
+			bytes_copied.fetch_add(slot->allocator.get_current_usage(), std::memory_order_relaxed);
 
-	if (info->pMultisampleState)
-	{
-		auto &ms = const_cast<VkPipelineMultisampleStateCreateInfo &>(*info->pMultisampleState);
-		if (ms.pSampleMask)
-			ms.pSampleMask = copy(ms.pSampleMask, (ms.rasterizationSamples + 31) / 32, alloc);
+		// The slot is claimed and has to be published either way, the recording thread skips empty slots.
+		slot->item = { handle, create_info, custom_hash, prior_tag };
+		slot->sequence.store(pos + 1);
+		wake_record_thread();
+		ret = create_info != nullptr || prior_tag != RESOURCE_COUNT;
 	}
-
-	if (info->pDynamicState)
+	else
 	{
-		const_cast<VkPipelineDynamicStateCreateInfo *>(info->pDynamicState)->pDynamicStates =
-				copy(info->pDynamicState->pDynamicStates, info->pDynamicState->dynamicStateCount, alloc);
-	}
-
-	*out_create_info = info;
-	return true;
-}
-
-bool StateRecorder::Impl::copy_render_pass(const VkRenderPassCreateInfo *create_info, ScratchAllocator &alloc,
-                                           VkRenderPassCreateInfo **out_create_info)
-{
-	auto *info = copy(create_info, 1, alloc);
-	info->pAttachments = copy(info->pAttachments, info->attachmentCount, alloc);
-	info->pSubpasses = copy(info->pSubpasses, info->subpassCount, alloc);
-	info->pDependencies = copy(info->pDependencies, info->dependencyCount, alloc);
+		std::lock_guard<std::mutex> lock(record_lock);
+		size_t usage = temp_allocator.get_current_usage();
+		void *create_info = prior_tag == RESOURCE_COUNT ? copy_func(temp_allocator) : nullptr;
+		if (statistics_enabled)
+			bytes_copied.fetch_add(temp_allocator.get_current_usage() - usage, std::memory_order_relaxed);
+		if (!create_info && prior_tag == RESOURCE_COUNT)
+			return false;
 
-	for (uint32_t i = 0; i < info->subpassCount; i++)
-	{
-		auto &sub = const_cast<VkSubpassDescription &>(info->pSubpasses[i]);
-		if (sub.pDepthStencilAttachment)
-			sub.pDepthStencilAttachment = copy(sub.pDepthStencilAttachment, 1, alloc);
-		if (sub.pColorAttachments)
-			sub.pColorAttachments = copy(sub.pColorAttachments, sub.colorAttachmentCount, alloc);
-		if (sub.pResolveAttachments)
-			sub.pResolveAttachments = copy(sub.pResolveAttachments, sub.colorAttachmentCount, alloc);
-		if (sub.pInputAttachments)
-			sub.pInputAttachments = copy(sub.pInputAttachments, sub.inputAttachmentCount, alloc);
-		if (sub.pPreserveAttachments)
-			sub.pPreserveAttachments = copy(sub.pPreserveAttachments, sub.preserveAttachmentCount, alloc);
+		overflow_queue.push({ handle, create_info, custom_hash, prior_tag });
+		overflow_pending.store(true);
+		record_cv.notify_one();
 	}
 
-	if (!copy_pnext_chain(create_info->pNext, alloc, &info->pNext))
-		return false;
+	// Thread is not running, drain the queue ourselves.
+	if (!threaded)
+		record_task(recorder, false);
 
-	*out_create_info = info;
-	return true;
+	return ret;
 }
 
-bool StateRecorder::Impl::remap_sampler_handle(VkSampler sampler, VkSampler *out_sampler) const
+bool StateRecorder::get_hash_for_compute_pipeline_handle(VkPipeline pipeline, Hash *hash) const
 {
-	auto itr = sampler_to_hash.find(sampler);
-	if (itr == end(sampler_to_hash))
+	auto itr = impl->compute_pipeline_to_hash.find(api_object_cast<uint64_t>(pipeline));
+	if (itr == end(impl->compute_pipeline_to_hash))
 	{
-		LOGW_LEVEL("Cannot find sampler in hashmap.\n"
-		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		log_failed_hash("Compute pipeline", pipeline);
 		return false;
 	}
 	else
 	{
-		*out_sampler = api_object_cast<VkSampler>(uint64_t(itr->second));
+		*hash = itr->second;
 		return true;
 	}
 }
 
-bool StateRecorder::Impl::remap_descriptor_set_layout_handle(VkDescriptorSetLayout layout,
-                                                             VkDescriptorSetLayout *out_layout) const
+bool StateRecorder::get_hash_for_graphics_pipeline_handle(VkPipeline pipeline, Hash *hash) const
 {
-	auto itr = descriptor_set_layout_to_hash.find(layout);
-	if (itr == end(descriptor_set_layout_to_hash))
+	auto itr = impl->graphics_pipeline_to_hash.find(api_object_cast<uint64_t>(pipeline));
+	if (itr == end(impl->graphics_pipeline_to_hash))
 	{
-		LOGW_LEVEL("Cannot find descriptor set layout in hashmap.\n"
-		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		log_failed_hash("Graphics pipeline", pipeline);
 		return false;
 	}
 	else
 	{
-		*out_layout = api_object_cast<VkDescriptorSetLayout>(uint64_t(itr->second));
+		*hash = itr->second;
 		return true;
 	}
 }
 
-bool StateRecorder::Impl::remap_pipeline_layout_handle(VkPipelineLayout layout, VkPipelineLayout *out_layout) const
+bool StateRecorder::get_hash_for_sampler(VkSampler sampler, Hash *hash) const
 {
-	auto itr = pipeline_layout_to_hash.find(layout);
-	if (itr == end(pipeline_layout_to_hash))
+	auto itr = impl->sampler_to_hash.find(api_object_cast<uint64_t>(sampler));
+	if (itr == end(impl->sampler_to_hash))
 	{
-		LOGW_LEVEL("Cannot find pipeline layout in hashmap.\n"
-		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		log_failed_hash("Sampler", sampler);
 		return false;
 	}
 	else
 	{
-		*out_layout = api_object_cast<VkPipelineLayout>(uint64_t(itr->second));
+		*hash = itr->second;
 		return true;
 	}
 }
 
-bool StateRecorder::Impl::remap_shader_module_handle(VkShaderModule module, VkShaderModule *out_module) const
+bool StateRecorder::get_hash_for_shader_module(VkShaderModule module, Hash *hash) const
 {
-	auto itr = shader_module_to_hash.find(module);
-	if (itr == end(shader_module_to_hash))
+	auto itr = impl->shader_module_to_hash.find(api_object_cast<uint64_t>(module));
+	if (itr == end(impl->shader_module_to_hash))
 	{
-		LOGW_LEVEL("Cannot find shader module in hashmap.\n"
-		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		log_failed_hash("Shader module", module);
 		return false;
 	}
 	else
 	{
-		*out_module = api_object_cast<VkShaderModule>(uint64_t(itr->second));
+		*hash = itr->second;
 		return true;
 	}
 }
 
-bool StateRecorder::Impl::remap_render_pass_handle(VkRenderPass render_pass, VkRenderPass *out_render_pass) const
+bool StateRecorder::get_hash_for_pipeline_layout(VkPipelineLayout layout, Hash *hash) const
 {
-	auto itr = render_pass_to_hash.find(render_pass);
-	if (itr == end(render_pass_to_hash))
+	auto itr = impl->pipeline_layout_to_hash.find(api_object_cast<uint64_t>(layout));
+	if (itr == end(impl->pipeline_layout_to_hash))
 	{
-		LOGW_LEVEL("Cannot find render pass in hashmap.\n"
-		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		log_failed_hash("Pipeline layout", layout);
 		return false;
 	}
 	else
 	{
-		*out_render_pass = api_object_cast<VkRenderPass>(uint64_t(itr->second));
+		*hash = itr->second;
 		return true;
 	}
 }
 
-bool StateRecorder::Impl::remap_graphics_pipeline_handle(VkPipeline pipeline, VkPipeline *out_pipeline) const
+bool StateRecorder::get_hash_for_descriptor_set_layout(VkDescriptorSetLayout layout, Hash *hash) const
 {
-	auto itr = graphics_pipeline_to_hash.find(pipeline);
-	if (itr == end(graphics_pipeline_to_hash))
+	auto itr = impl->descriptor_set_layout_to_hash.find(api_object_cast<uint64_t>(layout));
+	if (itr == end(impl->descriptor_set_layout_to_hash))
 	{
-		LOGW_LEVEL("Cannot find graphics pipeline in hashmap.\n"
-		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		log_failed_hash("Descriptor set layout", layout);
 		return false;
 	}
 	else
 	{
-		*out_pipeline = api_object_cast<VkPipeline>(uint64_t(itr->second));
+		*hash = itr->second;
 		return true;
 	}
 }
 
-bool StateRecorder::Impl::remap_compute_pipeline_handle(VkPipeline pipeline, VkPipeline *out_pipeline) const
+bool StateRecorder::get_hash_for_render_pass(VkRenderPass render_pass, Hash *hash) const
 {
-	auto itr = compute_pipeline_to_hash.find(pipeline);
-	if (itr == end(compute_pipeline_to_hash))
+	auto itr = impl->render_pass_to_hash.find(api_object_cast<uint64_t>(render_pass));
+	if (itr == end(impl->render_pass_to_hash))
 	{
-		LOGW_LEVEL("Cannot find compute pipeline in hashmap.\n"
-		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		log_failed_hash("Render pass", render_pass);
 		return false;
 	}
 	else
 	{
-		*out_pipeline = api_object_cast<VkPipeline>(uint64_t(itr->second));
+		*hash = itr->second;
 		return true;
 	}
 }
 
-bool StateRecorder::Impl::remap_descriptor_set_layout_ci(VkDescriptorSetLayoutCreateInfo *info)
+bool StateRecorder::Impl::copy_shader_module(const VkShaderModuleCreateInfo *create_info, ScratchAllocator &alloc,
+                                             VkShaderModuleCreateInfo **out_create_info)
 {
-	for (uint32_t i = 0; i < info->bindingCount; i++)
-	{
-		auto &b = const_cast<VkDescriptorSetLayoutBinding &>(info->pBindings[i]);
-		if (b.pImmutableSamplers &&
-		    (b.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER ||
-		     b.descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER))
-		{
-			auto *immutable_samplers = const_cast<VkSampler *>(b.pImmutableSamplers);
-			for (uint32_t j = 0; j < b.descriptorCount; j++)
-				if (!remap_sampler_handle(immutable_samplers[j], &immutable_samplers[j]))
-					return false;
-		}
-	}
+	if (create_info->pNext)
+		return false;
 
-	return true;
-}
-
-bool StateRecorder::Impl::remap_pipeline_layout_ci(VkPipelineLayoutCreateInfo *info)
-{
-	for (uint32_t i = 0; i < info->setLayoutCount; i++)
-		if (!remap_descriptor_set_layout_handle(info->pSetLayouts[i], &const_cast<VkDescriptorSetLayout *>(info->pSetLayouts)[i]))
-			return false;
+	auto *info = copy(create_info, 1, alloc);
+	info->pCode = copy(info->pCode, info->codeSize / sizeof(uint32_t), alloc);
 
+	*out_create_info = info;
 	return true;
 }
 
-bool StateRecorder::Impl::remap_shader_module_ci(VkShaderModuleCreateInfo *)
+bool StateRecorder::Impl::copy_sampler(const VkSamplerCreateInfo *create_info, ScratchAllocator &alloc,
+                                       VkSamplerCreateInfo **out_create_info)
 {
-	// nothing to do
+	if (create_info->pNext)
+		return false;
+
+	*out_create_info = copy(create_info, 1, alloc);
 	return true;
 }
 
-bool StateRecorder::Impl::remap_graphics_pipeline_ci(VkGraphicsPipelineCreateInfo *info)
+bool StateRecorder::Impl::copy_physical_device_features(const VkPhysicalDeviceFeatures2 *pdf,
+                                                        ScratchAllocator &alloc,
+                                                        VkPhysicalDeviceFeatures2 **out_pdf)
 {
-	if (!remap_render_pass_handle(info->renderPass, &info->renderPass))
-		return false;
-	if (!remap_pipeline_layout_handle(info->layout, &info->layout))
-		return false;
+	// Ignore pNext. We don't need to serialize it.
+	auto *features = copy(pdf, 1, alloc);
+	features->pNext = nullptr;
 
-	if (info->basePipelineHandle != VK_NULL_HANDLE)
-		if (!remap_graphics_pipeline_handle(info->basePipelineHandle, &info->basePipelineHandle))
-			return false;
+	*out_pdf = features;
+	return true;
+}
 
-	for (uint32_t i = 0; i < info->stageCount; i++)
-	{
-		auto &stage = const_cast<VkPipelineShaderStageCreateInfo &>(info->pStages[i]);
-		if (!remap_shader_module_handle(stage.module, &stage.module))
-			return false;
-	}
+bool StateRecorder::Impl::copy_application_info(const VkApplicationInfo *app_info, ScratchAllocator &alloc,
+                                                VkApplicationInfo **out_app_info)
+{
+	auto *app = copy(app_info, 1, alloc);
+	if (app->pEngineName)
+		app->pEngineName = copy(app->pEngineName, strlen(app->pEngineName) + 1, alloc);
+	if (app->pApplicationName)
+		app->pApplicationName = copy(app->pApplicationName, strlen(app->pApplicationName) + 1, alloc);
 
+	*out_app_info = app;
 	return true;
 }
 
-bool StateRecorder::Impl::remap_compute_pipeline_ci(VkComputePipelineCreateInfo *info)
+bool StateRecorder::Impl::copy_descriptor_set_layout(
+	const VkDescriptorSetLayoutCreateInfo *create_info, ScratchAllocator &alloc,
+	VkDescriptorSetLayoutCreateInfo **out_create_info)
 {
-	if (!remap_shader_module_handle(info->stage.module, &info->stage.module))
-		return false;
+	auto *info = copy(create_info, 1, alloc);
+	info->pBindings = copy(info->pBindings, info->bindingCount, alloc);
 
-	if (info->basePipelineHandle != VK_NULL_HANDLE)
-		if (!remap_compute_pipeline_handle(info->basePipelineHandle, &info->basePipelineHandle))
-			return false;
+	for (uint32_t i = 0; i < info->bindingCount; i++)
+	{
+		auto &b = const_cast<VkDescriptorSetLayoutBinding &>(info->pBindings[i]);
+		if (b.pImmutableSamplers &&
+		    (b.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER ||
+		     b.descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER))
+		{
+			b.pImmutableSamplers = copy(b.pImmutableSamplers, b.descriptorCount, alloc);
+		}
+	}
 
-	if (!remap_pipeline_layout_handle(info->layout, &info->layout))
+	if (!copy_pnext_chain(create_info->pNext, alloc, &info->pNext))
 		return false;
 
+	*out_create_info = info;
 	return true;
 }
 
-bool StateRecorder::Impl::remap_sampler_ci(VkSamplerCreateInfo *)
+bool StateRecorder::Impl::copy_pipeline_layout(const VkPipelineLayoutCreateInfo *create_info, ScratchAllocator &alloc,
+                                               VkPipelineLayoutCreateInfo **out_create_info)
 {
-	// nothing to do
+	if (create_info->pNext)
+		return false;
+
+	auto *info = copy(create_info, 1, alloc);
+	info->pPushConstantRanges = copy(info->pPushConstantRanges, info->pushConstantRangeCount, alloc);
+	info->pSetLayouts = copy(info->pSetLayouts, info->setLayoutCount, alloc);
+
+	*out_create_info = info;
 	return true;
 }
 
-bool StateRecorder::Impl::remap_render_pass_ci(VkRenderPassCreateInfo *)
+bool StateRecorder::Impl::copy_specialization_info(const VkSpecializationInfo *info, ScratchAllocator &alloc,
+                                                   const VkSpecializationInfo **out_info)
 {
-	// nothing to do
+	auto *ret = copy(info, 1, alloc);
+	ret->pMapEntries = copy(ret->pMapEntries, ret->mapEntryCount, alloc);
+	ret->pData = copy(static_cast<const uint8_t *>(ret->pData), ret->dataSize, alloc);
+
+	*out_info = ret;
 	return true;
 }
 
-void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
+bool StateRecorder::Impl::copy_compute_pipeline(const VkComputePipelineCreateInfo *create_info, ScratchAllocator &alloc,
+                                                const VkPipeline *base_pipelines, uint32_t base_pipeline_count,
+                                                VkComputePipelineCreateInfo **out_create_info)
 {
-	PayloadWriteFlags payload_flags = 0;
-	if (compression)
-		payload_flags |= PAYLOAD_WRITE_COMPRESS_BIT;
-	if (checksum)
-		payload_flags |= PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
-
-	bool write_database_entries = true;
+	auto *info = copy(create_info, 1, alloc);
 
-	// Start by preparing in the thread since we need to parse an archive potentially, and that might block a little bit.
-	if (database_iface)
+	// Check for case where application made use of derivative pipelines and relied on the indexing behavior
+	// into an array of pCreateInfos. In the replayer, we only do it one by one,
+	// so we need to pass the correct handle to the create pipeline calls.
+	if ((info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
 	{
-		assert(looping);
-		if (!database_iface->prepare())
+		if (info->basePipelineHandle == VK_NULL_HANDLE &&
+		    info->basePipelineIndex >= 0)
 		{
-			LOGE_LEVEL("Failed to prepare database, will not dump data to database.\n");
-			database_iface = nullptr;
-		}
+			if (uint32_t(info->basePipelineIndex) >= base_pipeline_count)
+			{
+				LOGE_LEVEL("Base pipeline index is out of range.\n");
+				return false;
+			}
 
-		// Check here in the worker thread if we should write database entries for this application info.
-		if (application_info_filter)
-			write_database_entries = application_info_filter->test_application_info(application_info);
+			info->basePipelineHandle = base_pipelines[info->basePipelineIndex];
+			info->basePipelineIndex = -1;
+		}
 	}
 
-	// Keep a single, pre-allocated buffer.
-	vector<uint8_t> blob;
-	blob.reserve(64 * 1024);
+	if (info->stage.pSpecializationInfo)
+		if (!copy_specialization_info(info->stage.pSpecializationInfo, alloc, &info->stage.pSpecializationInfo))
+			return false;
 
-	if (database_iface && write_database_entries)
-	{
-		assert(looping);
-		Hasher h;
-		Hashing::hash_application_feature_info(h, application_feature_hash);
-		if (serialize_application_info(blob))
-			database_iface->write_entry(RESOURCE_APPLICATION_INFO, h.get(), blob.data(), blob.size(), payload_flags);
-		else
-			LOGE_LEVEL("Failed to serialize application info.\n");
-	}
+	info->stage.pName = copy(info->stage.pName, strlen(info->stage.pName) + 1, alloc);
 
-	bool need_flush = false;
+	if (!copy_pnext_chain(info->stage.pNext, alloc, &info->stage.pNext))
+		return false;
 
-	for (;;)
-	{
-		WorkItem record_item = {};
-		{
-			std::unique_lock<std::mutex> lock(record_lock);
-			if (record_queue.empty())
-				temp_allocator.reset();
+	*out_create_info = info;
+	return true;
+}
 
-			// Having this check here allows us to call record_task from a single threaded variant.
-			// This is mostly used for testing purposes.
-			if (!looping && record_queue.empty())
-				break;
+bool StateRecorder::Impl::copy_graphics_pipeline(const VkGraphicsPipelineCreateInfo *create_info, ScratchAllocator &alloc,
+                                                 const VkPipeline *base_pipelines, uint32_t base_pipeline_count,
+                                                 VkGraphicsPipelineCreateInfo **out_create_info)
+{
+	auto *info = copy(create_info, 1, alloc);
 
-			// If we have written something to the database, wake up to flush whatever files are
-			// necessary. Do not flush after every single write, as that might bog down the file system.
-			// Once no new writes have occured for a second, we flush, and go to deep sleep.
-			bool has_data;
-			if (need_flush)
-			{
-				has_data = record_cv.wait_for(lock, std::chrono::seconds(1),
-				                              [&]()
-				                              {
-					                              return !record_queue.empty();
-				                              });
-			}
-			else
+	// Check for case where application made use of derivative pipelines and relied on the indexing behavior
+	// into an array of pCreateInfos. In the replayer, we only do it one by one,
+	// so we need to pass the correct handle to the create pipeline calls.
+	if ((info->flags & VK_PIPELINE_CREATE_DERIVATIVE_BIT) != 0)
+	{
+		if (info->basePipelineHandle == VK_NULL_HANDLE &&
+		    info->basePipelineIndex >= 0)
+		{
+			if (uint32_t(info->basePipelineIndex) >= base_pipeline_count)
 			{
-				record_cv.wait(lock, [&]()
-				{
-					return !record_queue.empty();
-				});
-				has_data = true;
+				LOGE_LEVEL("Base pipeline index is out of range.\n");
+				return false;
 			}
 
-			if (database_iface && !has_data && need_flush)
-			{
-				database_iface->flush();
-				need_flush = false;
-				continue;
-			}
-			else
-			{
-				record_item = record_queue.front();
-				record_queue.pop();
-			}
+			info->basePipelineHandle = base_pipelines[info->basePipelineIndex];
+			info->basePipelineIndex = -1;
 		}
+	}
 
-		if (!record_item.create_info)
-			break;
-
-		switch (reinterpret_cast<VkBaseInStructure *>(record_item.create_info)->sType)
-		{
-		case VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO:
-		{
-			auto *create_info = reinterpret_cast<VkSamplerCreateInfo *>(record_item.create_info);
-			auto hash = record_item.custom_hash;
-			if (hash == 0)
-				if (!Hashing::compute_hash_sampler(*create_info, &hash))
-					break;
+	info->pStages = copy(info->pStages, info->stageCount, alloc);
+	if (info->pTessellationState)
+	{
+		info->pTessellationState = copy(info->pTessellationState, 1, alloc);
 
-			sampler_to_hash[api_object_cast<VkSampler>(record_item.handle)] = hash;
+		const void *pNext = nullptr;
+		if (!copy_pnext_chain(info->pTessellationState->pNext, alloc, &pNext))
+			return false;
+		const_cast<VkPipelineTessellationStateCreateInfo *>(info->pTessellationState)->pNext = pNext;
+	}
 
-			if (database_iface)
-			{
-				if (write_database_entries)
-				{
-					if (register_application_link_hash(RESOURCE_SAMPLER, hash, blob))
-						need_flush = true;
+	if (info->pColorBlendState)
+	{
+		info->pColorBlendState = copy(info->pColorBlendState, 1, alloc);
+		const void *pNext = nullptr;
+		if (!copy_pnext_chain(info->pColorBlendState->pNext, alloc, &pNext))
+			return false;
 
-					if (!database_iface->has_entry(RESOURCE_SAMPLER, hash))
-					{
-						if (serialize_sampler(hash, *create_info, blob))
-						{
-							database_iface->write_entry(RESOURCE_SAMPLER, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
-					}
-				}
-			}
-			else
-			{
-				// Retain for combined serialize() later.
-				if (!samplers.count(hash))
-				{
-					VkSamplerCreateInfo *create_info_copy = nullptr;
-					if (copy_sampler(create_info, allocator, &create_info_copy))
-						samplers[hash] = create_info_copy;
-				}
-			}
-			break;
-		}
+		const_cast<VkPipelineColorBlendStateCreateInfo *>(info->pColorBlendState)->pNext = pNext;
+	}
 
-		case VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO:
-		{
-			auto *create_info = reinterpret_cast<VkRenderPassCreateInfo *>(record_item.create_info);
-			auto hash = record_item.custom_hash;
-			if (hash == 0)
-				if (!Hashing::compute_hash_render_pass(*create_info, &hash))
-					break;
+	if (info->pVertexInputState)
+	{
+		info->pVertexInputState = copy(info->pVertexInputState, 1, alloc);
 
-			render_pass_to_hash[api_object_cast<VkRenderPass>(record_item.handle)] = hash;
+		const void *pNext = nullptr;
+		if (!copy_pnext_chain(info->pVertexInputState->pNext, alloc, &pNext))
+			return false;
 
-			if (database_iface)
-			{
-				if (write_database_entries)
-				{
-					if (register_application_link_hash(RESOURCE_RENDER_PASS, hash, blob))
-						need_flush = true;
+		const_cast<VkPipelineVertexInputStateCreateInfo *>(info->pVertexInputState)->pNext = pNext;
+	}
 
-					if (!database_iface->has_entry(RESOURCE_RENDER_PASS, hash))
-					{
-						if (serialize_render_pass(hash, *create_info, blob))
-						{
-							database_iface->write_entry(RESOURCE_RENDER_PASS, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
-					}
-				}
-			}
-			else
-			{
-				// Retain for combined serialize() later.
-				if (!render_passes.count(hash))
-				{
-					VkRenderPassCreateInfo *create_info_copy = nullptr;
-					if (copy_render_pass(create_info, allocator, &create_info_copy))
-						render_passes[hash] = create_info_copy;
-				}
-			}
-			break;
+	if (info->pMultisampleState)
+	{
+		if (info->pMultisampleState->pNext)
+		{
+			log_error_pnext_chain("pNext in VkPipelineMultisampleStateCreateInfo not supported.",
+			                      info->pMultisampleState->pNext);
+			return false;
 		}
+		info->pMultisampleState = copy(info->pMultisampleState, 1, alloc);
+	}
 
-		case VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO:
+	if (info->pViewportState)
+	{
+		if (info->pViewportState->pNext)
 		{
-			auto *create_info = reinterpret_cast<VkShaderModuleCreateInfo *>(record_item.create_info);
-			auto hash = record_item.custom_hash;
-			if (hash == 0)
-				if (!Hashing::compute_hash_shader_module(*create_info, &hash))
-					break;
+			log_error_pnext_chain("pNext in VkPipelineViewportStateCreateInfo not supported.",
+			                      info->pViewportState->pNext);
+			return false;
+		}
+		info->pViewportState = copy(info->pViewportState, 1, alloc);
+	}
+
+	if (info->pInputAssemblyState)
+	{
+		if (info->pInputAssemblyState->pNext)
+		{
+			log_error_pnext_chain("pNext in VkPipelineInputAssemblyStateCreateInfo not supported.",
+			                      info->pInputAssemblyState->pNext);
+			return false;
+		}
+		info->pInputAssemblyState = copy(info->pInputAssemblyState, 1, alloc);
+	}
+
+	if (info->pDepthStencilState)
+	{
+		if (info->pDepthStencilState->pNext)
+		{
+			log_error_pnext_chain("pNext in VkPipelineDepthStencilStateCreateInfo not supported.",
+			                      info->pDepthStencilState->pNext);
+			return false;
+		}
+		info->pDepthStencilState = copy(info->pDepthStencilState, 1, alloc);
+	}
+
+	if (info->pRasterizationState)
+	{
+		info->pRasterizationState = copy(info->pRasterizationState, 1, alloc);
+		if (!info->pRasterizationState)
+			return false;
+
+		const void *pNext = nullptr;
+		if (!copy_pnext_chain(info->pRasterizationState->pNext, alloc, &pNext))
+			return false;
+
+		const_cast<VkPipelineRasterizationStateCreateInfo *>(info->pRasterizationState)->pNext = pNext;
+	}
+
+	if (info->pDynamicState)
+	{
+		if (info->pDynamicState->pNext)
+		{
+			log_error_pnext_chain("pNext in VkPipelineDynamicStateCreateInfo not supported.",
+			                      info->pDynamicState->pNext);
+			return false;
+		}
+		info->pDynamicState = copy(info->pDynamicState, 1, alloc);
+	}
+
+	for (uint32_t i = 0; i < info->stageCount; i++)
+	{
+		auto &stage = const_cast<VkPipelineShaderStageCreateInfo &>(info->pStages[i]);
+
+		stage.pName = copy(stage.pName, strlen(stage.pName) + 1, alloc);
+		if (stage.pSpecializationInfo)
+			if (!copy_specialization_info(stage.pSpecializationInfo, alloc, &stage.pSpecializationInfo))
+				return false;
+
+		const void *pNext = nullptr;
+		if (!copy_pnext_chain(stage.pNext, alloc, &pNext))
+			return false;
+		stage.pNext = pNext;
+	}
+
+	if (info->pColorBlendState)
+	{
+		auto &blend = const_cast<VkPipelineColorBlendStateCreateInfo &>(*info->pColorBlendState);
+		blend.pAttachments = copy(blend.pAttachments, blend.attachmentCount, alloc);
+	}
+
+	if (info->pVertexInputState)
+	{
+		auto &vs = const_cast<VkPipelineVertexInputStateCreateInfo &>(*info->pVertexInputState);
+		vs.pVertexAttributeDescriptions = copy(vs.pVertexAttributeDescriptions, vs.vertexAttributeDescriptionCount, alloc);
+		vs.pVertexBindingDescriptions = copy(vs.pVertexBindingDescriptions, vs.vertexBindingDescriptionCount, alloc);
+	}
+
+	if (info->pViewportState)
+	{
+		auto &vp = const_cast<VkPipelineViewportStateCreateInfo &>(*info->pViewportState);
+		if (vp.pViewports)
+			vp.pViewports = copy(vp.pViewports, vp.viewportCount, alloc);
+		if (vp.pScissors)
+			vp.pScissors = copy(vp.pScissors, vp.scissorCount, alloc);
+	}
+
+	if (info->pMultisampleState)
+	{
+		auto &ms = const_cast<VkPipelineMultisampleStateCreateInfo &>(*info->pMultisampleState);
+		if (ms.pSampleMask)
+			ms.pSampleMask = copy(ms.pSampleMask, (ms.rasterizationSamples + 31) / 32, alloc);
+	}
+
+	if (info->pDynamicState)
+	{
+		const_cast<VkPipelineDynamicStateCreateInfo *>(info->pDynamicState)->pDynamicStates =
+				copy(info->pDynamicState->pDynamicStates, info->pDynamicState->dynamicStateCount, alloc);
+	}
+
+	*out_create_info = info;
+	return true;
+}
+
+bool StateRecorder::Impl::copy_render_pass(const VkRenderPassCreateInfo *create_info, ScratchAllocator &alloc,
+                                           VkRenderPassCreateInfo **out_create_info)
+{
+	auto *info = copy(create_info, 1, alloc);
+	info->pAttachments = copy(info->pAttachments, info->attachmentCount, alloc);
+	info->pSubpasses = copy(info->pSubpasses, info->subpassCount, alloc);
+	info->pDependencies = copy(info->pDependencies, info->dependencyCount, alloc);
+
+	for (uint32_t i = 0; i < info->subpassCount; i++)
+	{
+		auto &sub = const_cast<VkSubpassDescription &>(info->pSubpasses[i]);
+		if (sub.pDepthStencilAttachment)
+			sub.pDepthStencilAttachment = copy(sub.pDepthStencilAttachment, 1, alloc);
+		if (sub.pColorAttachments)
+			sub.pColorAttachments = copy(sub.pColorAttachments, sub.colorAttachmentCount, alloc);
+		if (sub.pResolveAttachments)
+			sub.pResolveAttachments = copy(sub.pResolveAttachments, sub.colorAttachmentCount, alloc);
+		if (sub.pInputAttachments)
+			sub.pInputAttachments = copy(sub.pInputAttachments, sub.inputAttachmentCount, alloc);
+		if (sub.pPreserveAttachments)
+			sub.pPreserveAttachments = copy(sub.pPreserveAttachments, sub.preserveAttachmentCount, alloc);
+	}
+
+	if (!copy_pnext_chain(create_info->pNext, alloc, &info->pNext))
+		return false;
+
+	*out_create_info = info;
+	return true;
+}
+
+bool StateRecorder::Impl::remap_sampler_handle(VkSampler sampler, VkSampler *out_sampler) const
+{
+	auto itr = sampler_to_hash.find(api_object_cast<uint64_t>(sampler));
+	if (itr == end(sampler_to_hash))
+	{
+		LOGW_LEVEL("Cannot find sampler in hashmap.\n"
+		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		return false;
+	}
+	else
+	{
+		*out_sampler = api_object_cast<VkSampler>(uint64_t(itr->second));
+		return true;
+	}
+}
+
+bool StateRecorder::Impl::remap_descriptor_set_layout_handle(VkDescriptorSetLayout layout,
+                                                             VkDescriptorSetLayout *out_layout) const
+{
+	auto itr = descriptor_set_layout_to_hash.find(api_object_cast<uint64_t>(layout));
+	if (itr == end(descriptor_set_layout_to_hash))
+	{
+		LOGW_LEVEL("Cannot find descriptor set layout in hashmap.\n"
+		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		return false;
+	}
+	else
+	{
+		*out_layout = api_object_cast<VkDescriptorSetLayout>(uint64_t(itr->second));
+		return true;
+	}
+}
+
+bool StateRecorder::Impl::remap_pipeline_layout_handle(VkPipelineLayout layout, VkPipelineLayout *out_layout) const
+{
+	auto itr = pipeline_layout_to_hash.find(api_object_cast<uint64_t>(layout));
+	if (itr == end(pipeline_layout_to_hash))
+	{
+		LOGW_LEVEL("Cannot find pipeline layout in hashmap.\n"
+		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		return false;
+	}
+	else
+	{
+		*out_layout = api_object_cast<VkPipelineLayout>(uint64_t(itr->second));
+		return true;
+	}
+}
+
+bool StateRecorder::Impl::remap_shader_module_handle(VkShaderModule module, VkShaderModule *out_module) const
+{
+	auto itr = shader_module_to_hash.find(api_object_cast<uint64_t>(module));
+	if (itr == end(shader_module_to_hash))
+	{
+		LOGW_LEVEL("Cannot find shader module in hashmap.\n"
+		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		return false;
+	}
+	else
+	{
+		*out_module = api_object_cast<VkShaderModule>(uint64_t(itr->second));
+		return true;
+	}
+}
+
+bool StateRecorder::Impl::remap_render_pass_handle(VkRenderPass render_pass, VkRenderPass *out_render_pass) const
+{
+	auto itr = render_pass_to_hash.find(api_object_cast<uint64_t>(render_pass));
+	if (itr == end(render_pass_to_hash))
+	{
+		LOGW_LEVEL("Cannot find render pass in hashmap.\n"
+		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		return false;
+	}
+	else
+	{
+		*out_render_pass = api_object_cast<VkRenderPass>(uint64_t(itr->second));
+		return true;
+	}
+}
+
+bool StateRecorder::Impl::remap_graphics_pipeline_handle(VkPipeline pipeline, VkPipeline *out_pipeline) const
+{
+	auto itr = graphics_pipeline_to_hash.find(api_object_cast<uint64_t>(pipeline));
+	if (itr == end(graphics_pipeline_to_hash))
+	{
+		LOGW_LEVEL("Cannot find graphics pipeline in hashmap.\n"
+		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		return false;
+	}
+	else
+	{
+		*out_pipeline = api_object_cast<VkPipeline>(uint64_t(itr->second));
+		return true;
+	}
+}
+
+bool StateRecorder::Impl::remap_compute_pipeline_handle(VkPipeline pipeline, VkPipeline *out_pipeline) const
+{
+	auto itr = compute_pipeline_to_hash.find(api_object_cast<uint64_t>(pipeline));
+	if (itr == end(compute_pipeline_to_hash))
+	{
+		LOGW_LEVEL("Cannot find compute pipeline in hashmap.\n"
+		           "Object has either not been recorded, or it was not supported by Fossilize.\n");
+		return false;
+	}
+	else
+	{
+		*out_pipeline = api_object_cast<VkPipeline>(uint64_t(itr->second));
+		return true;
+	}
+}
+
+bool StateRecorder::Impl::remap_descriptor_set_layout_ci(VkDescriptorSetLayoutCreateInfo *info)
+{
+	for (uint32_t i = 0; i < info->bindingCount; i++)
+	{
+		auto &b = const_cast<VkDescriptorSetLayoutBinding &>(info->pBindings[i]);
+		if (b.pImmutableSamplers &&
+		    (b.descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER ||
+		     b.descriptorType == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER))
+		{
+			auto *immutable_samplers = const_cast<VkSampler *>(b.pImmutableSamplers);
+			for (uint32_t j = 0; j < b.descriptorCount; j++)
+				if (!remap_sampler_handle(immutable_samplers[j], &immutable_samplers[j]))
+					return false;
+		}
+	}
+
+	return true;
+}
+
+bool StateRecorder::Impl::remap_pipeline_layout_ci(VkPipelineLayoutCreateInfo *info)
+{
+	for (uint32_t i = 0; i < info->setLayoutCount; i++)
+		if (!remap_descriptor_set_layout_handle(info->pSetLayouts[i], &const_cast<VkDescriptorSetLayout *>(info->pSetLayouts)[i]))
+			return false;
+
+	return true;
+}
+
+bool StateRecorder::Impl::remap_shader_module_ci(VkShaderModuleCreateInfo *)
+{
+	// nothing to do
+	return true;
+}
+
+bool StateRecorder::Impl::remap_graphics_pipeline_ci(VkGraphicsPipelineCreateInfo *info)
+{
+	if (!remap_render_pass_handle(info->renderPass, &info->renderPass))
+		return false;
+	if (!remap_pipeline_layout_handle(info->layout, &info->layout))
+		return false;
+
+	if (info->basePipelineHandle != VK_NULL_HANDLE)
+		if (!remap_graphics_pipeline_handle(info->basePipelineHandle, &info->basePipelineHandle))
+			return false;
+
+	for (uint32_t i = 0; i < info->stageCount; i++)
+	{
+		auto &stage = const_cast<VkPipelineShaderStageCreateInfo &>(info->pStages[i]);
+		if (!remap_shader_module_handle(stage.module, &stage.module))
+			return false;
+	}
+
+	return true;
+}
+
+// Resolves handles like PipelineHandleLookup and replaces them with their hashes as it goes,
+// so the recording thread walks a pipeline once rather than hashing and remapping it separately.
+struct PipelineHandleRemap
+{
+	const StateRecorder::Impl &impl;
+
+	bool resolve_base_pipeline(const VkPipeline &pipeline, Hash *hash) const
+	{
+		auto &remapped = const_cast<VkPipeline &>(pipeline);
+		if (!impl.remap_graphics_pipeline_handle(pipeline, &remapped))
+			return false;
+		*hash = api_object_cast<uint64_t>(remapped);
+		return true;
+	}
+
+	bool resolve_layout(const VkPipelineLayout &layout, Hash *hash) const
+	{
+		auto &remapped = const_cast<VkPipelineLayout &>(layout);
+		if (!impl.remap_pipeline_layout_handle(layout, &remapped))
+			return false;
+		*hash = api_object_cast<uint64_t>(remapped);
+		return true;
+	}
+
+	bool resolve_render_pass(const VkRenderPass &render_pass, Hash *hash) const
+	{
+		auto &remapped = const_cast<VkRenderPass &>(render_pass);
+		if (!impl.remap_render_pass_handle(render_pass, &remapped))
+			return false;
+		*hash = api_object_cast<uint64_t>(remapped);
+		return true;
+	}
+
+	bool resolve_shader_module(const VkShaderModule &module, Hash *hash) const
+	{
+		auto &remapped = const_cast<VkShaderModule &>(module);
+		if (!impl.remap_shader_module_handle(module, &remapped))
+			return false;
+		*hash = api_object_cast<uint64_t>(remapped);
+		return true;
+	}
+};
+
+bool StateRecorder::Impl::hash_and_remap_graphics_pipeline_ci(const StateRecorder *recorder,
+                                                              VkGraphicsPipelineCreateInfo *info,
+                                                              Hash *out_hash) const
+{
+	return Hashing::hash_graphics_pipeline(*recorder, *info, PipelineHandleRemap{ *this }, out_hash);
+}
+
+bool StateRecorder::Impl::remap_compute_pipeline_ci(VkComputePipelineCreateInfo *info)
+{
+	if (!remap_shader_module_handle(info->stage.module, &info->stage.module))
+		return false;
+
+	if (info->basePipelineHandle != VK_NULL_HANDLE)
+		if (!remap_compute_pipeline_handle(info->basePipelineHandle, &info->basePipelineHandle))
+			return false;
+
+	if (!remap_pipeline_layout_handle(info->layout, &info->layout))
+		return false;
+
+	return true;
+}
+
+bool StateRecorder::Impl::remap_sampler_ci(VkSamplerCreateInfo *)
+{
+	// nothing to do
+	return true;
+}
+
+bool StateRecorder::Impl::remap_render_pass_ci(VkRenderPassCreateInfo *)
+{
+	// nothing to do
+	return true;
+}
+
+bool StateRecorder::Impl::serialize_object(ResourceTag tag, Hash hash, const void *create_info,
+                                           vector<uint8_t> &blob, ScratchAllocator &blob_allocator) const
+{
+	switch (tag)
+	{
+	case RESOURCE_SAMPLER:
+		return serialize_sampler(hash, *static_cast<const VkSamplerCreateInfo *>(create_info), blob);
+	case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+		return serialize_descriptor_set_layout(hash, *static_cast<const VkDescriptorSetLayoutCreateInfo *>(create_info), blob);
+	case RESOURCE_PIPELINE_LAYOUT:
+		return serialize_pipeline_layout(hash, *static_cast<const VkPipelineLayoutCreateInfo *>(create_info), blob);
+	case RESOURCE_SHADER_MODULE:
+		return serialize_shader_module(hash, *static_cast<const VkShaderModuleCreateInfo *>(create_info), blob, blob_allocator);
+	case RESOURCE_RENDER_PASS:
+		return serialize_render_pass(hash, *static_cast<const VkRenderPassCreateInfo *>(create_info), blob);
+	case RESOURCE_GRAPHICS_PIPELINE:
+		return serialize_graphics_pipeline(hash, *static_cast<const VkGraphicsPipelineCreateInfo *>(create_info), blob);
+	case RESOURCE_COMPUTE_PIPELINE:
+		return serialize_compute_pipeline(hash, *static_cast<const VkComputePipelineCreateInfo *>(create_info), blob);
+	default:
+		return false;
+	}
+}
+
+bool StateRecorder::Impl::copy_object(ResourceTag tag, const void *create_info, ScratchAllocator &alloc, const void **out_info)
+{
+	switch (tag)
+	{
+	case RESOURCE_SAMPLER:
+	{
+		VkSamplerCreateInfo *info = nullptr;
+		bool ret = copy_sampler(static_cast<const VkSamplerCreateInfo *>(create_info), alloc, &info);
+		*out_info = info;
+		return ret;
+	}
+
+	case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+	{
+		VkDescriptorSetLayoutCreateInfo *info = nullptr;
+		bool ret = copy_descriptor_set_layout(static_cast<const VkDescriptorSetLayoutCreateInfo *>(create_info), alloc, &info);
+		*out_info = info;
+		return ret;
+	}
+
+	case RESOURCE_PIPELINE_LAYOUT:
+	{
+		VkPipelineLayoutCreateInfo *info = nullptr;
+		bool ret = copy_pipeline_layout(static_cast<const VkPipelineLayoutCreateInfo *>(create_info), alloc, &info);
+		*out_info = info;
+		return ret;
+	}
+
+	case RESOURCE_SHADER_MODULE:
+	{
+		VkShaderModuleCreateInfo *info = nullptr;
+		bool ret = copy_shader_module(static_cast<const VkShaderModuleCreateInfo *>(create_info), alloc, &info);
+		*out_info = info;
+		return ret;
+	}
+
+	case RESOURCE_RENDER_PASS:
+	{
+		VkRenderPassCreateInfo *info = nullptr;
+		bool ret = copy_render_pass(static_cast<const VkRenderPassCreateInfo *>(create_info), alloc, &info);
+		*out_info = info;
+		return ret;
+	}
+
+	case RESOURCE_GRAPHICS_PIPELINE:
+	{
+		VkGraphicsPipelineCreateInfo *info = nullptr;
+		bool ret = copy_graphics_pipeline(static_cast<const VkGraphicsPipelineCreateInfo *>(create_info), alloc, nullptr, 0, &info);
+		*out_info = info;
+		return ret;
+	}
+
+	case RESOURCE_COMPUTE_PIPELINE:
+	{
+		VkComputePipelineCreateInfo *info = nullptr;
+		bool ret = copy_compute_pipeline(static_cast<const VkComputePipelineCreateInfo *>(create_info), alloc, nullptr, 0, &info);
+		*out_info = info;
+		return ret;
+	}
+
+	default:
+		return false;
+	}
+}
+
+void StateRecorder::Impl::start_serialize_workers()
+{
+	// Enough jobs to keep every worker busy while the recording thread writes out finished ones.
+	for (unsigned i = 0; i < serialize_worker_count * 4; i++)
+	{
+		serialize_jobs.emplace_back(new SerializeJob);
+		free_jobs.push_back(serialize_jobs.back().get());
+	}
+
+	serialize_workers_done = false;
+	serialize_completed_pending.store(false);
+
+	auto level = get_thread_log_level();
+	auto cb = Internal::get_thread_log_callback();
+	auto userdata = Internal::get_thread_log_userdata();
+	for (unsigned i = 0; i < serialize_worker_count; i++)
+	{
+		serialize_workers.emplace_back([=]() {
+			set_thread_log_level(level);
+			set_thread_log_callback(cb, userdata);
+			serialize_worker();
+		});
+	}
+}
+
+void StateRecorder::Impl::stop_serialize_workers()
+{
+	// Everything in flight has to make it to the database before we return.
+	write_completed_jobs();
+	while (!ordered_writes.empty())
+	{
+		wait_for_oldest_job();
+		write_completed_jobs();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(serialize_lock);
+		serialize_workers_done = true;
+		serialize_cv.notify_all();
+	}
+
+	for (auto &worker : serialize_workers)
+		worker.join();
+
+	serialize_workers.clear();
+	free_jobs.clear();
+	serialize_jobs.clear();
+}
+
+void StateRecorder::Impl::serialize_worker()
+{
+	for (;;)
+	{
+		SerializeJob *job;
+		{
+			std::unique_lock<std::mutex> lock(serialize_lock);
+			serialize_cv.wait(lock, [&]() { return !pending_jobs.empty() || serialize_workers_done; });
+			if (pending_jobs.empty())
+				break;
+			job = pending_jobs.front();
+			pending_jobs.pop();
+		}
+
+		job->success = serialize_object(job->tag, job->hash, job->create_info, job->blob, job->allocator);
+
+		{
+			std::lock_guard<std::mutex> lock(serialize_lock);
+			job->completed = true;
+			serialize_done_cv.notify_one();
+		}
+
+		serialize_completed_pending.store(true);
+		wake_record_thread();
+	}
+}
+
+void StateRecorder::Impl::wait_for_oldest_job()
+{
+	// write_completed_jobs() leaves an unfinished job at the front, if anything.
+	auto *job = ordered_writes.front().job;
+	std::unique_lock<std::mutex> lock(serialize_lock);
+	serialize_done_cv.wait(lock, [&]() { return job->completed; });
+}
+
+bool StateRecorder::Impl::write_completed_jobs()
+{
+	serialize_completed_pending.store(false);
+
+	bool wrote_entries = false;
+	while (!ordered_writes.empty())
+	{
+		auto &write = ordered_writes.front();
+		auto *job = write.job;
+
+		if (!job)
+		{
+			commit_database_entry(write.tag, write.hash, write.blob, write.payload_flags);
+			wrote_entries = true;
+			ordered_writes.pop_front();
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(serialize_lock);
+			if (!job->completed)
+				break;
+		}
+
+		if (job->success)
+		{
+			commit_database_entry(job->tag, job->hash, job->blob, write.payload_flags);
+			wrote_entries = true;
+		}
+
+		in_flight_hashes[job->tag].erase(job->hash);
+		job->allocator.reset();
+		free_jobs.push_back(job);
+		ordered_writes.pop_front();
+	}
+
+	return wrote_entries;
+}
+
+void StateRecorder::Impl::write_dependency_graph_entry(ResourceTag tag, Hash hash, const void *create_info,
+                                                       PayloadWriteFlags payload_flags)
+{
+	if (database_iface->has_entry(RESOURCE_DEPENDENCY_GRAPH, hash))
+		return;
+
+	size_t count = 0;
+	if (!DependencyGraph::get_dependencies(tag, create_info, &count, nullptr))
+		return;
+	dependencies.resize(count);
+	if (count && !DependencyGraph::get_dependencies(tag, create_info, &count, dependencies.data()))
+		return;
+
+	dependency_blob.resize(DependencyGraph::compute_entry_size(count));
+	DependencyGraph::encode_entry(tag, dependencies.data(), count, dependency_blob.data());
+	write_database_entry(RESOURCE_DEPENDENCY_GRAPH, hash, dependency_blob, payload_flags);
+}
+
+bool StateRecorder::Impl::write_object(ResourceTag tag, Hash hash, const void *create_info, vector<uint8_t> &blob,
+                                       PayloadWriteFlags payload_flags)
+{
+	// The create info is already remapped to hashes, so this is cheap enough to do right away.
+	if (record_dependency_graph)
+		write_dependency_graph_entry(tag, hash, create_info, payload_flags);
+
+	if (serialize_workers.empty())
+	{
+		if (!serialize_object(tag, hash, create_info, blob, allocator))
+			return false;
+		write_database_entry(tag, hash, blob, payload_flags);
+		return true;
+	}
+
+	// has_entry() cannot see objects which are still being serialized.
+	if (in_flight_hashes[tag].count(hash))
+		return false;
+
+	bool wrote_entries = false;
+	if (serialize_completed_pending.load())
+		wrote_entries = write_completed_jobs();
+
+	while (free_jobs.empty())
+	{
+		wait_for_oldest_job();
+		if (write_completed_jobs())
+			wrote_entries = true;
+	}
+
+	// The create info might only live until we return, so the worker gets its own copy.
+	auto *job = free_jobs.back();
+	if (!copy_object(tag, create_info, job->allocator, &job->create_info))
+	{
+		job->allocator.reset();
+		return wrote_entries;
+	}
+
+	free_jobs.pop_back();
+	job->tag = tag;
+	job->hash = hash;
+	job->completed = false;
+	in_flight_hashes[tag].insert(hash);
+	ordered_writes.push_back({ job, tag, hash, payload_flags, {} });
+
+	std::lock_guard<std::mutex> lock(serialize_lock);
+	pending_jobs.push(job);
+	serialize_cv.notify_one();
+	return wrote_entries;
+}
+
+bool StateRecorder::Impl::record_prior_object(const WorkItem &record_item, vector<uint8_t> &blob, bool write_database_entries)
+{
+	switch (record_item.prior_tag)
+	{
+	case RESOURCE_SAMPLER:
+		sampler_to_hash[record_item.handle] = record_item.custom_hash;
+		break;
+	case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+		descriptor_set_layout_to_hash[record_item.handle] = record_item.custom_hash;
+		break;
+	case RESOURCE_PIPELINE_LAYOUT:
+		pipeline_layout_to_hash[record_item.handle] = record_item.custom_hash;
+		break;
+	case RESOURCE_SHADER_MODULE:
+		shader_module_to_hash[record_item.handle] = record_item.custom_hash;
+		break;
+	case RESOURCE_RENDER_PASS:
+		render_pass_to_hash[record_item.handle] = record_item.custom_hash;
+		break;
+	case RESOURCE_GRAPHICS_PIPELINE:
+		graphics_pipeline_to_hash[record_item.handle] = record_item.custom_hash;
+		break;
+	case RESOURCE_COMPUTE_PIPELINE:
+		compute_pipeline_to_hash[record_item.handle] = record_item.custom_hash;
+		break;
+	default:
+		return false;
+	}
+
+	// The object itself is in the database already, but this application might not have been linked to it yet.
+	return write_database_entries && register_application_link_hash(record_item.prior_tag, record_item.custom_hash, blob);
+}
+
+void StateRecorder::Impl::resolve_pipeline_usage(bool write_database_entries)
+{
+	std::vector<PendingPipelineUsage> pending;
+	{
+		std::lock_guard<std::mutex> lock(pipeline_usage_lock);
+		pending.swap(pending_pipeline_usage);
+		pipeline_usage_pending.store(false);
+	}
+
+	if (!database_iface || !write_database_entries)
+		return;
+
+	for (auto &usage : pending)
+	{
+		auto &to_hash = usage.tag == RESOURCE_GRAPHICS_PIPELINE ? graphics_pipeline_to_hash : compute_pipeline_to_hash;
+		auto itr = to_hash.find(usage.handle);
+		// The pipeline failed to record or was dropped, so there is nothing to count against.
+		if (itr == end(to_hash))
+			continue;
+
+		auto &entry = unwritten_pipeline_usage[itr->second];
+		entry.tag = usage.tag;
+		entry.count += usage.count;
+	}
+}
+
+bool StateRecorder::Impl::write_pipeline_usage(vector<uint8_t> &blob, PayloadWriteFlags payload_flags)
+{
+	last_pipeline_usage_write = std::chrono::steady_clock::now();
+	if (!database_iface || unwritten_pipeline_usage.empty())
+		return false;
+
+	if (!serialize_pipeline_usage(blob))
+	{
+		LOGE_LEVEL("Failed to serialize pipeline usage.\n");
+		return false;
+	}
+
+	// Entries are only ever appended, the replayer adds up the counts of all of them.
+	Hash hash;
+	do
+	{
+		Hasher h;
+		h.u64(pipeline_usage_session);
+		h.u32(pipeline_usage_generation++);
+		hash = h.get();
+	} while (database_iface->has_entry(RESOURCE_PIPELINE_USAGE, hash));
+
+	write_database_entry(RESOURCE_PIPELINE_USAGE, hash, blob, payload_flags);
+	unwritten_pipeline_usage.clear();
+	return true;
+}
+
+bool StateRecorder::Impl::record_work_item(StateRecorder *recorder, const WorkItem &record_item, vector<uint8_t> &blob,
+                                           PayloadWriteFlags payload_flags, bool write_database_entries)
+{
+	bool wrote_entries = false;
+
+	switch (reinterpret_cast<VkBaseInStructure *>(record_item.create_info)->sType)
+	{
+	case VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO:
+	{
+		auto *create_info = reinterpret_cast<VkSamplerCreateInfo *>(record_item.create_info);
+		auto hash = record_item.custom_hash;
+		if (hash == 0)
+			if (!Hashing::compute_hash_sampler(*create_info, &hash))
+				break;
+
+		sampler_to_hash[record_item.handle] = hash;
+
+		if (database_iface)
+		{
+			if (write_database_entries)
+			{
+				if (register_application_link_hash(RESOURCE_SAMPLER, hash, blob))
+					wrote_entries = true;
+
+				if (!database_iface->has_entry(RESOURCE_SAMPLER, hash))
+				{
+					if (write_object(RESOURCE_SAMPLER, hash, create_info, blob, payload_flags))
+						wrote_entries = true;
+				}
+			}
+		}
+		else
+		{
+			// Retain for combined serialize() later.
+			if (!samplers.count(hash))
+			{
+				VkSamplerCreateInfo *create_info_copy = nullptr;
+				if (copy_sampler(create_info, allocator, &create_info_copy))
+					samplers[hash] = create_info_copy;
+			}
+		}
+		break;
+	}
+
+	case VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO:
+	{
+		auto *create_info = reinterpret_cast<VkRenderPassCreateInfo *>(record_item.create_info);
+		auto hash = record_item.custom_hash;
+		if (hash == 0)
+			if (!Hashing::compute_hash_render_pass(*create_info, &hash))
+				break;
+
+		render_pass_to_hash[record_item.handle] = hash;
+
+		if (database_iface)
+		{
+			if (write_database_entries)
+			{
+				if (register_application_link_hash(RESOURCE_RENDER_PASS, hash, blob))
+					wrote_entries = true;
+
+				if (!database_iface->has_entry(RESOURCE_RENDER_PASS, hash))
+				{
+					if (write_object(RESOURCE_RENDER_PASS, hash, create_info, blob, payload_flags))
+						wrote_entries = true;
+				}
+			}
+		}
+		else
+		{
+			// Retain for combined serialize() later.
+			if (!render_passes.count(hash))
+			{
+				VkRenderPassCreateInfo *create_info_copy = nullptr;
+				if (copy_render_pass(create_info, allocator, &create_info_copy))
+					render_passes[hash] = create_info_copy;
+			}
+		}
+		break;
+	}
+
+	case VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO:
+	{
+		auto *create_info = reinterpret_cast<VkShaderModuleCreateInfo *>(record_item.create_info);
+		auto hash = record_item.custom_hash;
+		if (hash == 0)
+			if (!Hashing::compute_hash_shader_module(*create_info, &hash, hash_algorithm))
+				break;
+
+		shader_module_to_hash[record_item.handle] = hash;
+
+		if (database_iface)
+		{
+			if (write_database_entries)
+			{
+				if (register_application_link_hash(RESOURCE_SHADER_MODULE, hash, blob))
+					wrote_entries = true;
+
+				if (!database_iface->has_entry(RESOURCE_SHADER_MODULE, hash))
+				{
+					if (write_object(RESOURCE_SHADER_MODULE, hash, create_info, blob, payload_flags))
+						wrote_entries = true;
+					allocator.reset();
+				}
+			}
+		}
+		else
+		{
+			// Retain for combined serialize() later.
+			if (!shader_modules.count(hash))
+			{
+				VkShaderModuleCreateInfo *create_info_copy = nullptr;
+				if (copy_shader_module(create_info, allocator, &create_info_copy))
+					shader_modules[hash] = create_info_copy;
+			}
+		}
+		break;
+	}
+
+	case VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO:
+	{
+		auto *create_info = reinterpret_cast<VkDescriptorSetLayoutCreateInfo *>(record_item.create_info);
+		auto hash = record_item.custom_hash;
+		if (hash == 0)
+			if (!Hashing::compute_hash_descriptor_set_layout(*recorder, *create_info, &hash))
+				break;
+
+		// The captured create info belongs to the recorder. When it is only written out, remap it in place
+		// and skip a second deep copy. It only has to outlive this work item when retained for serialize().
+		VkDescriptorSetLayoutCreateInfo *create_info_copy = create_info;
+		if (!database_iface && !copy_descriptor_set_layout(create_info, allocator, &create_info_copy))
+			break;
+		if (!remap_descriptor_set_layout_ci(create_info_copy))
+			break;
+
+		descriptor_set_layout_to_hash[record_item.handle] = hash;
+
+		if (database_iface)
+		{
+			if (write_database_entries)
+			{
+				if (register_application_link_hash(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, blob))
+					wrote_entries = true;
+
+				if (!database_iface->has_entry(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash))
+				{
+					if (write_object(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, create_info_copy, blob, payload_flags))
+						wrote_entries = true;
+				}
+			}
+
+			// Don't need to keep copied data around, reset the allocator.
+			allocator.reset();
+		}
+		else
+		{
+
+			// Retain for combined serialize() later.
+			if (!descriptor_sets.count(hash))
+				descriptor_sets[hash] = create_info_copy;
+		}
+		break;
+	}
+
+	case VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO:
+	{
+		auto *create_info = reinterpret_cast<VkPipelineLayoutCreateInfo *>(record_item.create_info);
+		auto hash = record_item.custom_hash;
+		if (hash == 0)
+			if (!Hashing::compute_hash_pipeline_layout(*recorder, *create_info, &hash))
+				break;
+
+		// Remapped in place unless it has to be retained, as for set layouts.
+		VkPipelineLayoutCreateInfo *create_info_copy = create_info;
+		if (!database_iface && !copy_pipeline_layout(create_info, allocator, &create_info_copy))
+			break;
+		if (!remap_pipeline_layout_ci(create_info_copy))
+			break;
+
+		pipeline_layout_to_hash[record_item.handle] = hash;
+
+		if (database_iface)
+		{
+			if (write_database_entries)
+			{
+				if (register_application_link_hash(RESOURCE_PIPELINE_LAYOUT, hash, blob))
+					wrote_entries = true;
+
+				if (!database_iface->has_entry(RESOURCE_PIPELINE_LAYOUT, hash))
+				{
+					if (write_object(RESOURCE_PIPELINE_LAYOUT, hash, create_info_copy, blob, payload_flags))
+						wrote_entries = true;
+				}
+			}
+
+			// Don't need to keep copied data around, reset the allocator.
+			allocator.reset();
+		}
+		else
+		{
+			// Retain for combined serialize() later.
+			if (!pipeline_layouts.count(hash))
+				pipeline_layouts[hash] = create_info_copy;
+		}
+		break;
+	}
+
+	case VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO:
+	{
+		auto *create_info = reinterpret_cast<VkGraphicsPipelineCreateInfo *>(record_item.create_info);
+		auto hash = record_item.custom_hash;
+
+		// Hashed and remapped in place in one pass. The remapped info is copied if it has to be retained.
+		if (hash == 0)
+		{
+			if (!hash_and_remap_graphics_pipeline_ci(recorder, create_info, &hash))
+				break;
+		}
+		else if (!remap_graphics_pipeline_ci(create_info))
+			break;
+
+		VkGraphicsPipelineCreateInfo *create_info_copy = create_info;
+		if (!database_iface && !copy_graphics_pipeline(create_info, allocator, nullptr, 0, &create_info_copy))
+			break;
+
+		graphics_pipeline_to_hash[record_item.handle] = hash;
+
+		if (database_iface)
+		{
+			if (write_database_entries)
+			{
+				if (register_application_link_hash(RESOURCE_GRAPHICS_PIPELINE, hash, blob))
+					wrote_entries = true;
+
+				if (!database_iface->has_entry(RESOURCE_GRAPHICS_PIPELINE, hash))
+				{
+					if (write_object(RESOURCE_GRAPHICS_PIPELINE, hash, create_info_copy, blob, payload_flags))
+						wrote_entries = true;
+				}
+			}
+
+			// Don't need to keep copied data around, reset the allocator.
+			allocator.reset();
+		}
+		else
+		{
+			// Retain for combined serialize() later.
+			if (!graphics_pipelines.count(hash))
+				graphics_pipelines[hash] = create_info_copy;
+		}
+		break;
+	}
+
+	case VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO:
+	{
+		auto *create_info = reinterpret_cast<VkComputePipelineCreateInfo *>(record_item.create_info);
+		auto hash = record_item.custom_hash;
+		if (hash == 0)
+			if (!Hashing::compute_hash_compute_pipeline(*recorder, *create_info, &hash))
+				break;
+
+		// Remapped in place unless it has to be retained, as for set layouts.
+		VkComputePipelineCreateInfo *create_info_copy = create_info;
+		if (!database_iface && !copy_compute_pipeline(create_info, allocator, nullptr, 0, &create_info_copy))
+			break;
+		if (!remap_compute_pipeline_ci(create_info_copy))
+			break;
+
+		compute_pipeline_to_hash[record_item.handle] = hash;
+
+		if (database_iface)
+		{
+			if (write_database_entries)
+			{
+				if (register_application_link_hash(RESOURCE_COMPUTE_PIPELINE, hash, blob))
+					wrote_entries = true;
+
+				if (!database_iface->has_entry(RESOURCE_COMPUTE_PIPELINE, hash))
+				{
+					if (write_object(RESOURCE_COMPUTE_PIPELINE, hash, create_info_copy, blob, payload_flags))
+						wrote_entries = true;
+				}
+			}
+
+			// Don't need to keep copied data around, reset the allocator.
+			allocator.reset();
+		}
+		else
+		{
+			// Retain for combined serialize() later.
+			if (!compute_pipelines.count(hash))
+				compute_pipelines[hash] = create_info_copy;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	return wrote_entries;
+}
+
+void StateRecorder::Impl::record_task(StateRecorder *recorder, bool looping)
+{
+	// Without a recording thread, whichever thread records drains the queue, one at a time.
+	std::unique_lock<std::mutex> inline_lock(inline_record_lock, std::defer_lock);
+	if (!looping)
+		inline_lock.lock();
+
+	PayloadWriteFlags payload_flags = 0;
+	if (compression)
+	{
+		payload_flags |= PAYLOAD_WRITE_COMPRESS_BIT;
+		if (compression_algorithm == DatabaseCompressionAlgorithm::Zstd)
+			payload_flags |= PAYLOAD_WRITE_COMPRESS_ZSTD_BIT;
+		else if (compression_algorithm == DatabaseCompressionAlgorithm::LZ4)
+			payload_flags |= PAYLOAD_WRITE_COMPRESS_LZ4_BIT;
+	}
+	if (checksum)
+	{
+		payload_flags |= PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+		if (checksum_algorithm == DatabaseChecksumAlgorithm::CRC32C)
+			payload_flags |= PAYLOAD_WRITE_CHECKSUM_CRC32C_BIT;
+	}
+
+	bool write_database_entries = true;
+
+	// Start by preparing in the thread since we need to parse an archive potentially, and that might block a little bit.
+	if (database_iface)
+	{
+		assert(looping);
+		if (!database_iface->prepare())
+		{
+			LOGE_LEVEL("Failed to prepare database, will not dump data to database.\n");
+			database_iface = nullptr;
+		}
+		else
+			prepared_database.store(database_iface, std::memory_order_release);
+
+		// Check here in the worker thread if we should write database entries for this application info.
+		if (application_info_filter)
+			write_database_entries = application_info_filter->test_application_info(application_info);
+	}
+
+	// Keep a single, pre-allocated buffer.
+	vector<uint8_t> blob;
+	blob.reserve(64 * 1024);
+
+	if (database_iface && write_database_entries)
+	{
+		assert(looping);
+		Hasher h;
+		Hashing::hash_application_feature_info(h, application_feature_hash);
+		if (serialize_application_info(blob))
+			write_database_entry(RESOURCE_APPLICATION_INFO, h.get(), blob, payload_flags);
+		else
+			LOGE_LEVEL("Failed to serialize application info.\n");
+	}
+
+	if (database_iface && write_database_entries && serialize_worker_count)
+		start_serialize_workers();
+
+	if (database_iface && write_database_entries)
+	{
+		Hasher h;
+		h.u64(uint64_t(std::chrono::system_clock::now().time_since_epoch().count()));
+		h.pointer(this);
+		pipeline_usage_session = h.get();
+		last_pipeline_usage_write = std::chrono::steady_clock::now();
+	}
+
+	bool need_flush = false;
+	std::queue<WorkItem> overflow_items;
+	bool done = false;
+
+	while (!done)
+	{
+		if (statistics_enabled)
+			allocator_peak_bytes.store(allocator.get_peak_memory_consumption(), std::memory_order_relaxed);
+
+		if (serialize_completed_pending.load() && write_completed_jobs())
+			need_flush = true;
+
+		if (record_ring_has_data())
+		{
+			auto &slot = record_ring[record_dequeue_pos & record_ring_mask];
+			if (statistics_enabled)
+				update_queue_high_water_mark(record_enqueue_pos.load(std::memory_order_relaxed) - record_dequeue_pos);
+
+			// Slots without create info were claimed by a producer which then failed to copy its object.
+			if (slot.item.prior_tag != RESOURCE_COUNT)
+			{
+				if (record_prior_object(slot.item, blob, write_database_entries))
+					need_flush = true;
+			}
+			else if (slot.item.create_info)
+			{
+				uint64_t backlog = record_enqueue_pos.load(std::memory_order_relaxed) - record_dequeue_pos;
+				if (record_work_item(recorder, slot.item, blob, get_backlog_payload_flags(payload_flags, backlog),
+				                     write_database_entries))
+					need_flush = true;
+			}
+
+			slot.allocator.reset();
+			slot.sequence.store(record_dequeue_pos + record_ring_mask + 1);
+			record_dequeue_pos++;
+
+			if (record_space_waiters.load() != 0)
+			{
+				std::lock_guard<std::mutex> lock(record_lock);
+				record_space_cv.notify_all();
+			}
+			continue;
+		}
+
+		if (overflow_pending.load())
+		{
+			{
+				std::lock_guard<std::mutex> lock(record_lock);
+				overflow_items.swap(overflow_queue);
+				overflow_pending.store(false);
+			}
+
+			// Objects only spill once the ring is full. The sentinel from record_end() does not count.
+			if (statistics_enabled)
+			{
+				uint64_t spilled = overflow_items.size();
+				if (spilled && !overflow_items.back().create_info && overflow_items.back().prior_tag == RESOURCE_COUNT)
+					spilled--;
+				if (spilled)
+					update_queue_high_water_mark(record_ring_mask + 1 + spilled);
+			}
+
+			while (!overflow_items.empty())
+			{
+				WorkItem record_item = overflow_items.front();
+				overflow_items.pop();
+
+				if (record_item.prior_tag != RESOURCE_COUNT)
+				{
+					if (record_prior_object(record_item, blob, write_database_entries))
+						need_flush = true;
+					continue;
+				}
+
+				// record_end() always goes through the overflow queue.
+				if (!record_item.create_info)
+				{
+					done = true;
+					break;
+				}
+
+				// The ring may have filled up again behind the spilled objects.
+				uint64_t backlog = overflow_items.size() + 1 +
+				                   (record_enqueue_pos.load(std::memory_order_relaxed) - record_dequeue_pos);
+				if (record_work_item(recorder, record_item, blob, get_backlog_payload_flags(payload_flags, backlog),
+				                     write_database_entries))
+					need_flush = true;
+			}
+
+			std::lock_guard<std::mutex> lock(record_lock);
+			if (overflow_queue.empty())
+				temp_allocator.reset();
+			continue;
+		}
+
+		if (pipeline_usage_pending.load())
+		{
+			resolve_pipeline_usage(write_database_entries);
+			if (std::chrono::steady_clock::now() - last_pipeline_usage_write >= std::chrono::seconds(30) &&
+			    write_pipeline_usage(blob, payload_flags))
+			{
+				need_flush = true;
+			}
+			continue;
+		}
+
+		// Having this check here allows us to call record_task from a single threaded variant.
+		// This is mostly used for testing purposes.
+		if (!looping)
+			break;
+
+		// Everything queued before the request has been written by now.
+		if (flush_requested.exchange(false))
+		{
+			if (database_iface && need_flush)
+				database_iface->flush();
+			need_flush = false;
+			continue;
+		}
+
+		// If we have written something to the database, wake up to flush whatever files are
+		// necessary. Do not flush after every single write, as that might bog down the file system.
+		// Once no new writes have occured for a second, we flush, and go to deep sleep.
+		bool has_data;
+		{
+			std::unique_lock<std::mutex> lock(record_lock);
+			record_thread_sleeping.store(true);
+			auto has_work = [&]() {
+				return record_ring_has_data() || overflow_pending.load() || serialize_completed_pending.load() ||
+				       pipeline_usage_pending.load() || flush_requested.load();
+			};
+
+			if (need_flush && flush_on_idle)
+			{
+				has_data = record_cv.wait_for(lock, std::chrono::seconds(1), has_work);
+			}
+			else
+			{
+				record_cv.wait(lock, has_work);
+				has_data = true;
+			}
+			record_thread_sleeping.store(false);
+		}
+
+		if (database_iface && !has_data && need_flush)
+		{
+			database_iface->flush();
+			need_flush = false;
+		}
+	}
+
+	if (!serialize_workers.empty())
+		stop_serialize_workers();
+
+	resolve_pipeline_usage(write_database_entries);
+	write_pipeline_usage(blob, payload_flags);
+
+	if (database_iface)
+		database_iface->flush();
+
+	if (statistics_enabled)
+		allocator_peak_bytes.store(allocator.get_peak_memory_consumption(), std::memory_order_relaxed);
+
+	uint64_t dropped = dropped_records.load();
+	if (looping && dropped)
+		LOGW_LEVEL("Dropped %" PRIu64 " objects since the record queue was full.\n", dropped);
+
+	// We no longer need a reference to this.
+	// This should allow us to call init_recording_thread again if we want,
+	// or emit some final single threaded recording tasks.
+	{
+		std::lock_guard<std::mutex> lock(final_compression_lock);
+		if (statistics_enabled && prepared_database.load())
+			database_iface->get_compression_statistics(&final_compression);
+		prepared_database.store(nullptr);
+	}
+	database_iface = nullptr;
+}
+
+static char base64(uint32_t v)
+{
+	if (v == 63)
+		return '/';
+	else if (v == 62)
+		return '+';
+	else if (v >= 52)
+		return char('0' + (v - 52));
+	else if (v >= 26)
+		return char('a' + (v - 26));
+	else
+		return char('A' + v);
+}
+
+static std::string encode_base64(const void *data_, size_t size)
+{
+	auto *data = static_cast<const uint8_t *>(data_);
+	size_t num_chars = 4 * ((size + 2) / 3);
+	std::string ret;
+	ret.reserve(num_chars);
+
+	for (size_t i = 0; i < size; i += 3)
+	{
+		uint32_t code = data[i] << 16;
+		if (i + 1 < size)
+			code |= data[i + 1] << 8;
+		if (i + 2 < size)
+			code |= data[i + 2] << 0;
+
+		auto c0 = base64((code >> 18) & 63);
+		auto c1 = base64((code >> 12) & 63);
+		auto c2 = base64((code >>  6) & 63);
+		auto c3 = base64((code >>  0) & 63);
+
+		auto outbytes = std::min(size - i, size_t(3));
+		if (outbytes == 1)
+		{
+			c2 = '=';
+			c3 = '=';
+		}
+		else if (outbytes == 2)
+			c3 = '=';
+
+		ret.push_back(c0);
+		ret.push_back(c1);
+		ret.push_back(c2);
+		ret.push_back(c3);
+	}
+
+	return ret;
+}
+
+// The JSON is emitted straight through a rapidjson writer rather than building a Document first.
+// This avoids allocating a DOM tree for every object we record, which gets heavy for large pipelines.
+// Member order is part of the format, since hashes of the serialized blobs depend on the exact output.
+template <typename WriterType>
+static void json_write(WriterType &writer, uint32_t value)
+{
+	writer.Uint(value);
+}
+
+template <typename WriterType>
+static void json_write(WriterType &writer, int32_t value)
+{
+	writer.Int(value);
+}
+
+template <typename WriterType>
+static void json_write(WriterType &writer, uint64_t value)
+{
+	writer.Uint64(value);
+}
+
+template <typename WriterType>
+static void json_write(WriterType &writer, float value)
+{
+	writer.Double(value);
+}
+
+template <typename WriterType>
+static void json_write(WriterType &writer, const char *value)
+{
+	writer.String(value);
+}
+
+template <typename WriterType>
+static void json_write(WriterType &writer, const std::string &value)
+{
+	writer.String(value.data(), SizeType(value.size()));
+}
+
+template <typename WriterType>
+static void json_write_uint64_string(WriterType &writer, uint64_t value)
+{
+	char str[17]; // 16 digits + null
+	sprintf(str, "%016" PRIx64, value);
+	writer.String(str, 16);
+}
+
+template <typename WriterType>
+static void json_key_uint64_string(WriterType &writer, uint64_t value)
+{
+	char str[17]; // 16 digits + null
+	sprintf(str, "%016" PRIx64, value);
+	writer.Key(str, 16);
+}
+
+template <typename WriterType, typename T>
+static void json_member(WriterType &writer, const char *name, const T &value)
+{
+	writer.Key(name);
+	json_write(writer, value);
+}
+
+template <typename WriterType>
+static void json_member_uint64_string(WriterType &writer, const char *name, uint64_t value)
+{
+	writer.Key(name);
+	json_write_uint64_string(writer, value);
+}
+
+// Appends directly to a blob, so the recording thread can reuse its buffer across objects.
+struct BlobOutputStream
+{
+	typedef char Ch;
+
+	explicit BlobOutputStream(vector<uint8_t> &blob_)
+		: blob(blob_)
+	{
+	}
+
+	void Put(char c)
+	{
+		blob.push_back(uint8_t(c));
+	}
+
+	void Flush()
+	{
+	}
+
+	vector<uint8_t> &blob;
+};
+
+#ifdef PRETTY_WRITER
+using CustomWriter = PrettyWriter<BlobOutputStream>;
+#else
+using CustomWriter = Writer<BlobOutputStream>;
+#endif
+
+template <typename WriterType>
+static bool json_value(const VkSamplerCreateInfo& sampler, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "flags", sampler.flags);
+	json_member(writer, "minFilter", sampler.minFilter);
+	json_member(writer, "magFilter", sampler.magFilter);
+	json_member(writer, "maxAnisotropy", sampler.maxAnisotropy);
+	json_member(writer, "compareOp", sampler.compareOp);
+	json_member(writer, "anisotropyEnable", sampler.anisotropyEnable);
+	json_member(writer, "mipmapMode", sampler.mipmapMode);
+	json_member(writer, "addressModeU", sampler.addressModeU);
+	json_member(writer, "addressModeV", sampler.addressModeV);
+	json_member(writer, "addressModeW", sampler.addressModeW);
+	json_member(writer, "borderColor", sampler.borderColor);
+	json_member(writer, "unnormalizedCoordinates", sampler.unnormalizedCoordinates);
+	json_member(writer, "compareEnable", sampler.compareEnable);
+	json_member(writer, "mipLodBias", sampler.mipLodBias);
+	json_member(writer, "minLod", sampler.minLod);
+	json_member(writer, "maxLod", sampler.maxLod);
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkPipelineLayoutCreateInfo& layout, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "flags", layout.flags);
+
+	writer.Key("pushConstantRanges");
+	writer.StartArray();
+	for (uint32_t i = 0; i < layout.pushConstantRangeCount; i++)
+	{
+		writer.StartObject();
+		json_member(writer, "stageFlags", layout.pPushConstantRanges[i].stageFlags);
+		json_member(writer, "size", layout.pPushConstantRanges[i].size);
+		json_member(writer, "offset", layout.pPushConstantRanges[i].offset);
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	writer.Key("setLayouts");
+	writer.StartArray();
+	for (uint32_t i = 0; i < layout.setLayoutCount; i++)
+		json_write_uint64_string(writer, api_object_cast<uint64_t>(layout.pSetLayouts[i]));
+	writer.EndArray();
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkShaderModuleCreateInfo& module, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "flags", module.flags);
+	json_member(writer, "codeSize", uint64_t(module.codeSize));
+	json_member(writer, "code", encode_base64(module.pCode, module.codeSize));
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkPipelineTessellationDomainOriginStateCreateInfo &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+	json_member(writer, "domainOrigin", create_info.domainOrigin);
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkPipelineVertexInputDivisorStateCreateInfoEXT &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+	json_member(writer, "vertexBindingDivisorCount", create_info.vertexBindingDivisorCount);
+
+	if (create_info.pVertexBindingDivisors)
+	{
+		writer.Key("vertexBindingDivisors");
+		writer.StartArray();
+		for (uint32_t i = 0; i < create_info.vertexBindingDivisorCount; i++)
+		{
+			writer.StartObject();
+			json_member(writer, "binding", create_info.pVertexBindingDivisors[i].binding);
+			json_member(writer, "divisor", create_info.pVertexBindingDivisors[i].divisor);
+			writer.EndObject();
+		}
+		writer.EndArray();
+	}
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkPipelineRasterizationDepthClipStateCreateInfoEXT &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+	json_member(writer, "flags", create_info.flags);
+	json_member(writer, "depthClipEnable", create_info.depthClipEnable);
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkPipelineRasterizationStateStreamCreateInfoEXT &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+	json_member(writer, "flags", create_info.flags);
+	json_member(writer, "rasterizationStream", create_info.rasterizationStream);
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkRenderPassMultiviewCreateInfo &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+
+	if (create_info.subpassCount)
+	{
+		writer.Key("viewMasks");
+		writer.StartArray();
+		for (uint32_t i = 0; i < create_info.subpassCount; i++)
+			json_write(writer, create_info.pViewMasks[i]);
+		writer.EndArray();
+	}
+
+	if (create_info.dependencyCount)
+	{
+		writer.Key("viewOffsets");
+		writer.StartArray();
+		for (uint32_t i = 0; i < create_info.dependencyCount; i++)
+			json_write(writer, create_info.pViewOffsets[i]);
+		writer.EndArray();
+	}
+
+	if (create_info.correlationMaskCount)
+	{
+		writer.Key("correlationMasks");
+		writer.StartArray();
+		for (uint32_t i = 0; i < create_info.correlationMaskCount; i++)
+			json_write(writer, create_info.pCorrelationMasks[i]);
+		writer.EndArray();
+	}
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+
+	if (create_info.bindingCount)
+	{
+		writer.Key("bindingFlags");
+		writer.StartArray();
+		for (uint32_t i = 0; i < create_info.bindingCount; i++)
+			json_write(writer, create_info.pBindingFlags[i]);
+		writer.EndArray();
+	}
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkPipelineColorBlendAdvancedStateCreateInfoEXT &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+
+	json_member(writer, "srcPremultiplied", uint32_t(create_info.srcPremultiplied));
+	json_member(writer, "dstPremultiplied", uint32_t(create_info.dstPremultiplied));
+	json_member(writer, "blendOverlap", create_info.blendOverlap);
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkPipelineRasterizationConservativeStateCreateInfoEXT &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+
+	json_member(writer, "flags", create_info.flags);
+	json_member(writer, "conservativeRasterizationMode", create_info.conservativeRasterizationMode);
+	json_member(writer, "extraPrimitiveOverestimationSize", create_info.extraPrimitiveOverestimationSize);
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkPipelineRasterizationLineStateCreateInfoEXT &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+
+	json_member(writer, "lineRasterizationMode", create_info.lineRasterizationMode);
+	json_member(writer, "stippledLineEnable", create_info.stippledLineEnable);
+	json_member(writer, "lineStippleFactor", create_info.lineStippleFactor);
+	json_member(writer, "lineStipplePattern", create_info.lineStipplePattern);
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+	json_member(writer, "requiredSubgroupSize", create_info.requiredSubgroupSize);
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkMutableDescriptorTypeCreateInfoVALVE &create_info, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "sType", create_info.sType);
+
+	writer.Key("mutableDescriptorTypeLists");
+	writer.StartArray();
+	for (uint32_t i = 0; i < create_info.mutableDescriptorTypeListCount; i++)
+	{
+		auto &l = create_info.pMutableDescriptorTypeLists[i];
+		writer.StartArray();
+		for (uint32_t j = 0; j < l.descriptorTypeCount; j++)
+			json_write(writer, l.pDescriptorTypes[j]);
+		writer.EndArray();
+	}
+	writer.EndArray();
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool pnext_chain_json_value(const void *pNext, WriterType &writer)
+{
+	writer.StartArray();
+
+	while (pNext != nullptr)
+	{
+		auto *pin = static_cast<const VkBaseInStructure *>(pNext);
+		switch (pin->sType)
+		{
+#define FOSSILIZE_JSON_PNEXT_STRUCT(stype, T) \
+		case stype: \
+			if (!json_value(*static_cast<const T *>(pNext), writer)) \
+				return false; \
+			break;
+		FOSSILIZE_PNEXT_STRUCTS(FOSSILIZE_JSON_PNEXT_STRUCT)
+#undef FOSSILIZE_JSON_PNEXT_STRUCT
+
+		default:
+			log_error_pnext_chain("Unsupported pNext found, cannot hash sType.", pNext);
+			return false;
+		}
+
+		pNext = pin->pNext;
+	}
+
+	writer.EndArray();
+	return true;
+}
+
+template <typename WriterType>
+static void json_value(const VkSpecializationInfo &spec, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "dataSize", uint64_t(spec.dataSize));
+	json_member(writer, "data", encode_base64(spec.pData, spec.dataSize));
+	writer.Key("mapEntries");
+	writer.StartArray();
+	for (uint32_t i = 0; i < spec.mapEntryCount; i++)
+	{
+		auto &e = spec.pMapEntries[i];
+		writer.StartObject();
+		json_member(writer, "offset", e.offset);
+		json_member(writer, "size", uint64_t(e.size));
+		json_member(writer, "constantID", e.constantID);
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+}
+
+template <typename WriterType>
+static bool json_value(const VkComputePipelineCreateInfo& pipe, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "flags", pipe.flags);
+	json_member_uint64_string(writer, "layout", api_object_cast<uint64_t>(pipe.layout));
+	json_member_uint64_string(writer, "basePipelineHandle", api_object_cast<uint64_t>(pipe.basePipelineHandle));
+	json_member(writer, "basePipelineIndex", pipe.basePipelineIndex);
+
+	writer.Key("stage");
+	writer.StartObject();
+	json_member(writer, "flags", pipe.stage.flags);
+	json_member(writer, "stage", pipe.stage.stage);
+	json_member_uint64_string(writer, "module", api_object_cast<uint64_t>(pipe.stage.module));
+	json_member(writer, "name", pipe.stage.pName);
+	if (pipe.stage.pSpecializationInfo)
+	{
+		writer.Key("specializationInfo");
+		json_value(*pipe.stage.pSpecializationInfo, writer);
+	}
+
+	if (pipe.stage.pNext)
+	{
+		writer.Key("pNext");
+		if (!pnext_chain_json_value(pipe.stage.pNext, writer))
+			return false;
+	}
+	writer.EndObject();
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static bool json_value(const VkDescriptorSetLayoutCreateInfo& layout, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "flags", layout.flags);
+
+	writer.Key("bindings");
+	writer.StartArray();
+	for (uint32_t i = 0; i < layout.bindingCount; i++)
+	{
+		auto &b = layout.pBindings[i];
+		writer.StartObject();
+		json_member(writer, "descriptorType", b.descriptorType);
+		json_member(writer, "descriptorCount", b.descriptorCount);
+		json_member(writer, "stageFlags", b.stageFlags);
+		json_member(writer, "binding", b.binding);
+		if (b.pImmutableSamplers)
+		{
+			writer.Key("immutableSamplers");
+			writer.StartArray();
+			for (uint32_t j = 0; j < b.descriptorCount; j++)
+				json_write_uint64_string(writer, api_object_cast<uint64_t>(b.pImmutableSamplers[j]));
+			writer.EndArray();
+		}
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	if (layout.pNext)
+	{
+		writer.Key("pNext");
+		if (!pnext_chain_json_value(layout.pNext, writer))
+			return false;
+	}
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static void json_value(const VkAttachmentReference &ref, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "attachment", ref.attachment);
+	json_member(writer, "layout", ref.layout);
+	writer.EndObject();
+}
+
+template <typename WriterType>
+static bool json_value(const VkRenderPassCreateInfo& pass, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "flags", pass.flags);
+
+	if (pass.pDependencies)
+	{
+		writer.Key("dependencies");
+		writer.StartArray();
+		for (uint32_t i = 0; i < pass.dependencyCount; i++)
+		{
+			auto &d = pass.pDependencies[i];
+			writer.StartObject();
+			json_member(writer, "dependencyFlags", d.dependencyFlags);
+			json_member(writer, "dstAccessMask", d.dstAccessMask);
+			json_member(writer, "srcAccessMask", d.srcAccessMask);
+			json_member(writer, "dstStageMask", d.dstStageMask);
+			json_member(writer, "srcStageMask", d.srcStageMask);
+			json_member(writer, "dstSubpass", d.dstSubpass);
+			json_member(writer, "srcSubpass", d.srcSubpass);
+			writer.EndObject();
+		}
+		writer.EndArray();
+	}
+
+	if (pass.pAttachments)
+	{
+		writer.Key("attachments");
+		writer.StartArray();
+		for (uint32_t i = 0; i < pass.attachmentCount; i++)
+		{
+			auto &a = pass.pAttachments[i];
+			writer.StartObject();
+			json_member(writer, "flags", a.flags);
+			json_member(writer, "format", a.format);
+			json_member(writer, "finalLayout", a.finalLayout);
+			json_member(writer, "initialLayout", a.initialLayout);
+			json_member(writer, "loadOp", a.loadOp);
+			json_member(writer, "storeOp", a.storeOp);
+			json_member(writer, "samples", a.samples);
+			json_member(writer, "stencilLoadOp", a.stencilLoadOp);
+			json_member(writer, "stencilStoreOp", a.stencilStoreOp);
+			writer.EndObject();
+		}
+		writer.EndArray();
+	}
+
+	writer.Key("subpasses");
+	writer.StartArray();
+	for (uint32_t i = 0; i < pass.subpassCount; i++)
+	{
+		auto &sub = pass.pSubpasses[i];
+		writer.StartObject();
+		json_member(writer, "flags", sub.flags);
+		json_member(writer, "pipelineBindPoint", sub.pipelineBindPoint);
+
+		if (sub.pPreserveAttachments)
+		{
+			writer.Key("preserveAttachments");
+			writer.StartArray();
+			for (uint32_t j = 0; j < sub.preserveAttachmentCount; j++)
+				json_write(writer, sub.pPreserveAttachments[j]);
+			writer.EndArray();
+		}
+
+		if (sub.pInputAttachments)
+		{
+			writer.Key("inputAttachments");
+			writer.StartArray();
+			for (uint32_t j = 0; j < sub.inputAttachmentCount; j++)
+				json_value(sub.pInputAttachments[j], writer);
+			writer.EndArray();
+		}
+
+		if (sub.pColorAttachments)
+		{
+			writer.Key("colorAttachments");
+			writer.StartArray();
+			for (uint32_t j = 0; j < sub.colorAttachmentCount; j++)
+				json_value(sub.pColorAttachments[j], writer);
+			writer.EndArray();
+		}
+
+		if (sub.pResolveAttachments)
+		{
+			writer.Key("resolveAttachments");
+			writer.StartArray();
+			for (uint32_t j = 0; j < sub.colorAttachmentCount; j++)
+				json_value(sub.pResolveAttachments[j], writer);
+			writer.EndArray();
+		}
+
+		if (sub.pDepthStencilAttachment)
+		{
+			writer.Key("depthStencilAttachment");
+			json_value(*sub.pDepthStencilAttachment, writer);
+		}
+
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	if (pass.pNext)
+	{
+		writer.Key("pNext");
+		if (!pnext_chain_json_value(pass.pNext, writer))
+			return false;
+	}
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static void json_value(const VkStencilOpState &state, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "compareOp", state.compareOp);
+	json_member(writer, "writeMask", state.writeMask);
+	json_member(writer, "reference", state.reference);
+	json_member(writer, "compareMask", state.compareMask);
+	json_member(writer, "passOp", state.passOp);
+	json_member(writer, "failOp", state.failOp);
+	json_member(writer, "depthFailOp", state.depthFailOp);
+	writer.EndObject();
+}
+
+template <typename WriterType>
+static bool json_value(const VkGraphicsPipelineCreateInfo& pipe, WriterType &writer)
+{
+	writer.StartObject();
+	json_member(writer, "flags", pipe.flags);
+	json_member_uint64_string(writer, "basePipelineHandle", api_object_cast<uint64_t>(pipe.basePipelineHandle));
+	json_member(writer, "basePipelineIndex", pipe.basePipelineIndex);
+	json_member_uint64_string(writer, "layout", api_object_cast<uint64_t>(pipe.layout));
+	json_member_uint64_string(writer, "renderPass", api_object_cast<uint64_t>(pipe.renderPass));
+	json_member(writer, "subpass", pipe.subpass);
+
+	if (pipe.pTessellationState)
+	{
+		writer.Key("tessellationState");
+		writer.StartObject();
+		json_member(writer, "flags", pipe.pTessellationState->flags);
+		json_member(writer, "patchControlPoints", pipe.pTessellationState->patchControlPoints);
+
+		if (pipe.pTessellationState->pNext)
+		{
+			writer.Key("pNext");
+			if (!pnext_chain_json_value(pipe.pTessellationState->pNext, writer))
+				return false;
+		}
+
+		writer.EndObject();
+	}
+
+	if (pipe.pDynamicState)
+	{
+		writer.Key("dynamicState");
+		writer.StartObject();
+		json_member(writer, "flags", pipe.pDynamicState->flags);
+		writer.Key("dynamicState");
+		writer.StartArray();
+		for (uint32_t i = 0; i < pipe.pDynamicState->dynamicStateCount; i++)
+			json_write(writer, pipe.pDynamicState->pDynamicStates[i]);
+		writer.EndArray();
+		writer.EndObject();
+	}
+
+	if (pipe.pMultisampleState)
+	{
+		writer.Key("multisampleState");
+		writer.StartObject();
+		json_member(writer, "flags", pipe.pMultisampleState->flags);
+		json_member(writer, "rasterizationSamples", pipe.pMultisampleState->rasterizationSamples);
+		json_member(writer, "sampleShadingEnable", pipe.pMultisampleState->sampleShadingEnable);
+		json_member(writer, "minSampleShading", pipe.pMultisampleState->minSampleShading);
+		json_member(writer, "alphaToOneEnable", pipe.pMultisampleState->alphaToOneEnable);
+		json_member(writer, "alphaToCoverageEnable", pipe.pMultisampleState->alphaToCoverageEnable);
+
+		if (pipe.pMultisampleState->pSampleMask)
+		{
+			writer.Key("sampleMask");
+			writer.StartArray();
+			auto entries = uint32_t(pipe.pMultisampleState->rasterizationSamples + 31) / 32;
+			for (uint32_t i = 0; i < entries; i++)
+				json_write(writer, pipe.pMultisampleState->pSampleMask[i]);
+			writer.EndArray();
+		}
+
+		writer.EndObject();
+	}
+
+	if (pipe.pVertexInputState)
+	{
+		writer.Key("vertexInputState");
+		writer.StartObject();
+		json_member(writer, "flags", pipe.pVertexInputState->flags);
+
+		writer.Key("attributes");
+		writer.StartArray();
+		for (uint32_t i = 0; i < pipe.pVertexInputState->vertexAttributeDescriptionCount; i++)
+		{
+			auto &a = pipe.pVertexInputState->pVertexAttributeDescriptions[i];
+			writer.StartObject();
+			json_member(writer, "location", a.location);
+			json_member(writer, "binding", a.binding);
+			json_member(writer, "offset", a.offset);
+			json_member(writer, "format", a.format);
+			writer.EndObject();
+		}
+		writer.EndArray();
+
+		writer.Key("bindings");
+		writer.StartArray();
+		for (uint32_t i = 0; i < pipe.pVertexInputState->vertexBindingDescriptionCount; i++)
+		{
+			auto &b = pipe.pVertexInputState->pVertexBindingDescriptions[i];
+			writer.StartObject();
+			json_member(writer, "binding", b.binding);
+			json_member(writer, "stride", b.stride);
+			json_member(writer, "inputRate", b.inputRate);
+			writer.EndObject();
+		}
+		writer.EndArray();
+
+		if (pipe.pVertexInputState->pNext)
+		{
+			writer.Key("pNext");
+			if (!pnext_chain_json_value(pipe.pVertexInputState->pNext, writer))
+				return false;
+		}
+
+		writer.EndObject();
+	}
+
+	if (pipe.pRasterizationState)
+	{
+		writer.Key("rasterizationState");
+		writer.StartObject();
+		json_member(writer, "flags", pipe.pRasterizationState->flags);
+		json_member(writer, "depthBiasConstantFactor", pipe.pRasterizationState->depthBiasConstantFactor);
+		json_member(writer, "depthBiasSlopeFactor", pipe.pRasterizationState->depthBiasSlopeFactor);
+		json_member(writer, "depthBiasClamp", pipe.pRasterizationState->depthBiasClamp);
+		json_member(writer, "depthBiasEnable", pipe.pRasterizationState->depthBiasEnable);
+		json_member(writer, "depthClampEnable", pipe.pRasterizationState->depthClampEnable);
+		json_member(writer, "polygonMode", pipe.pRasterizationState->polygonMode);
+		json_member(writer, "rasterizerDiscardEnable", pipe.pRasterizationState->rasterizerDiscardEnable);
+		json_member(writer, "frontFace", pipe.pRasterizationState->frontFace);
+		json_member(writer, "lineWidth", pipe.pRasterizationState->lineWidth);
+		json_member(writer, "cullMode", pipe.pRasterizationState->cullMode);
+
+		if (pipe.pRasterizationState->pNext)
+		{
+			writer.Key("pNext");
+			if (!pnext_chain_json_value(pipe.pRasterizationState->pNext, writer))
+				return false;
+		}
+
+		writer.EndObject();
+	}
+
+	if (pipe.pInputAssemblyState)
+	{
+		writer.Key("inputAssemblyState");
+		writer.StartObject();
+		json_member(writer, "flags", pipe.pInputAssemblyState->flags);
+		json_member(writer, "topology", pipe.pInputAssemblyState->topology);
+		json_member(writer, "primitiveRestartEnable", pipe.pInputAssemblyState->primitiveRestartEnable);
+		writer.EndObject();
+	}
+
+	if (pipe.pColorBlendState)
+	{
+		writer.Key("colorBlendState");
+		writer.StartObject();
+		json_member(writer, "flags", pipe.pColorBlendState->flags);
+		json_member(writer, "logicOp", pipe.pColorBlendState->logicOp);
+		json_member(writer, "logicOpEnable", pipe.pColorBlendState->logicOpEnable);
+
+		writer.Key("blendConstants");
+		writer.StartArray();
+		for (auto &c : pipe.pColorBlendState->blendConstants)
+			json_write(writer, c);
+		writer.EndArray();
+
+		writer.Key("attachments");
+		writer.StartArray();
+		for (uint32_t i = 0; i < pipe.pColorBlendState->attachmentCount; i++)
+		{
+			auto &a = pipe.pColorBlendState->pAttachments[i];
+			writer.StartObject();
+			json_member(writer, "dstAlphaBlendFactor", a.dstAlphaBlendFactor);
+			json_member(writer, "srcAlphaBlendFactor", a.srcAlphaBlendFactor);
+			json_member(writer, "dstColorBlendFactor", a.dstColorBlendFactor);
+			json_member(writer, "srcColorBlendFactor", a.srcColorBlendFactor);
+			json_member(writer, "colorWriteMask", a.colorWriteMask);
+			json_member(writer, "alphaBlendOp", a.alphaBlendOp);
+			json_member(writer, "colorBlendOp", a.colorBlendOp);
+			json_member(writer, "blendEnable", a.blendEnable);
+			writer.EndObject();
+		}
+		writer.EndArray();
+
+		if (pipe.pColorBlendState->pNext)
+		{
+			writer.Key("pNext");
+			if (!pnext_chain_json_value(pipe.pColorBlendState->pNext, writer))
+				return false;
+		}
+
+		writer.EndObject();
+	}
+
+	if (pipe.pViewportState)
+	{
+		writer.Key("viewportState");
+		writer.StartObject();
+		json_member(writer, "flags", pipe.pViewportState->flags);
+		json_member(writer, "viewportCount", pipe.pViewportState->viewportCount);
+		json_member(writer, "scissorCount", pipe.pViewportState->scissorCount);
+		if (pipe.pViewportState->pViewports)
+		{
+			writer.Key("viewports");
+			writer.StartArray();
+			for (uint32_t i = 0; i < pipe.pViewportState->viewportCount; i++)
+			{
+				writer.StartObject();
+				json_member(writer, "x", pipe.pViewportState->pViewports[i].x);
+				json_member(writer, "y", pipe.pViewportState->pViewports[i].y);
+				json_member(writer, "width", pipe.pViewportState->pViewports[i].width);
+				json_member(writer, "height", pipe.pViewportState->pViewports[i].height);
+				json_member(writer, "minDepth", pipe.pViewportState->pViewports[i].minDepth);
+				json_member(writer, "maxDepth", pipe.pViewportState->pViewports[i].maxDepth);
+				writer.EndObject();
+			}
+			writer.EndArray();
+		}
+
+		if (pipe.pViewportState->pScissors)
+		{
+			writer.Key("scissors");
+			writer.StartArray();
+			for (uint32_t i = 0; i < pipe.pViewportState->scissorCount; i++)
+			{
+				writer.StartObject();
+				json_member(writer, "x", pipe.pViewportState->pScissors[i].offset.x);
+				json_member(writer, "y", pipe.pViewportState->pScissors[i].offset.y);
+				json_member(writer, "width", pipe.pViewportState->pScissors[i].extent.width);
+				json_member(writer, "height", pipe.pViewportState->pScissors[i].extent.height);
+				writer.EndObject();
+			}
+			writer.EndArray();
+		}
+		writer.EndObject();
+	}
+
+	if (pipe.pDepthStencilState)
+	{
+		writer.Key("depthStencilState");
+		writer.StartObject();
+		json_member(writer, "flags", pipe.pDepthStencilState->flags);
+		json_member(writer, "stencilTestEnable", pipe.pDepthStencilState->stencilTestEnable);
+		json_member(writer, "maxDepthBounds", pipe.pDepthStencilState->maxDepthBounds);
+		json_member(writer, "minDepthBounds", pipe.pDepthStencilState->minDepthBounds);
+		json_member(writer, "depthBoundsTestEnable", pipe.pDepthStencilState->depthBoundsTestEnable);
+		json_member(writer, "depthWriteEnable", pipe.pDepthStencilState->depthWriteEnable);
+		json_member(writer, "depthTestEnable", pipe.pDepthStencilState->depthTestEnable);
+		json_member(writer, "depthCompareOp", pipe.pDepthStencilState->depthCompareOp);
+		writer.Key("front");
+		json_value(pipe.pDepthStencilState->front, writer);
+		writer.Key("back");
+		json_value(pipe.pDepthStencilState->back, writer);
+		writer.EndObject();
+	}
+
+	writer.Key("stages");
+	writer.StartArray();
+	for (uint32_t i = 0; i < pipe.stageCount; i++)
+	{
+		auto &s = pipe.pStages[i];
+		writer.StartObject();
+		json_member(writer, "flags", s.flags);
+		json_member(writer, "name", s.pName);
+		json_member_uint64_string(writer, "module", api_object_cast<uint64_t>(s.module));
+		json_member(writer, "stage", s.stage);
+		if (s.pSpecializationInfo)
+		{
+			writer.Key("specializationInfo");
+			json_value(*s.pSpecializationInfo, writer);
+		}
+
+		if (s.pNext)
+		{
+			writer.Key("pNext");
+			if (!pnext_chain_json_value(s.pNext, writer))
+				return false;
+		}
+
+		writer.EndObject();
+	}
+	writer.EndArray();
+
+	writer.EndObject();
+	return true;
+}
+
+template <typename WriterType>
+static void serialize_application_info_inline(WriterType &writer, const VkApplicationInfo &info)
+{
+	if (info.pApplicationName)
+		json_member(writer, "applicationName", info.pApplicationName);
+	if (info.pEngineName)
+		json_member(writer, "engineName", info.pEngineName);
+	json_member(writer, "applicationVersion", info.applicationVersion);
+	json_member(writer, "engineVersion", info.engineVersion);
+	json_member(writer, "apiVersion", info.apiVersion);
+}
+
+template <typename WriterType>
+static void serialize_physical_device_features_inline(WriterType &writer, const VkPhysicalDeviceFeatures2 &features)
+{
+	// TODO: For now, we only care about this feature, which can definitely affect compilation.
+	// Deal with other device features if proven to be required.
+	json_member(writer, "robustBufferAccess", features.features.robustBufferAccess);
+}
+
+// Wraps a single object as { "version": N, "<category>": { "<hash>": <object> } }.
+template <typename T>
+static bool serialize_single_object(vector<uint8_t> &blob, const char *category, Hash hash, const T &create_info)
+{
+	blob.clear();
+	BlobOutputStream stream(blob);
+	CustomWriter writer(stream);
+
+	writer.StartObject();
+	json_member(writer, "version", FOSSILIZE_FORMAT_VERSION);
+	writer.Key(category);
+	writer.StartObject();
+	json_key_uint64_string(writer, hash);
+	if (!json_value(create_info, writer))
+		return false;
+	writer.EndObject();
+	writer.EndObject();
+	return true;
+}
+
+// Compact binary payloads.
+// JSON stays the interchange format, but parsing it dominates replay of large archives.
+// A binary payload starts with binary_payload_magic, followed by the format version,
+// the resource tag and the object hash, then the create info itself.
+// Fields are stored in declaration order without names. Integers and enums are LEB128 varints
+// (zigzag for signed), floats and handles are stored at full width in little-endian.
+// Pointers are stored as a presence flag, or as count + 1 for arrays which carry their own count,
+// so that nullptr and empty arrays round-trip exactly.
+// The same binary_transfer() visitor drives both the writer and the reader, so the two cannot drift apart.
+class BinaryPayloadWriter
+{
+public:
+	explicit BinaryPayloadWriter(vector<uint8_t> &blob_)
+		: blob(blob_)
+	{
+	}
 
-			shader_module_to_hash[api_object_cast<VkShaderModule>(record_item.handle)] = hash;
+	void header(ResourceTag tag, Hash hash)
+	{
+		blob.insert(blob.end(), binary_payload_magic, binary_payload_magic + sizeof(binary_payload_magic));
+		write_varint(FOSSILIZE_FORMAT_VERSION);
+		write_varint(uint32_t(tag));
+		write_fixed(hash, 8);
+	}
 
-			if (database_iface)
-			{
-				if (write_database_entries)
-				{
-					if (register_application_link_hash(RESOURCE_SHADER_MODULE, hash, blob))
-						need_flush = true;
+	void value(const uint32_t &v)
+	{
+		write_varint(v);
+	}
 
-					if (!database_iface->has_entry(RESOURCE_SHADER_MODULE, hash))
-					{
-						if (serialize_shader_module(hash, *create_info, blob, allocator))
-						{
-							database_iface->write_entry(RESOURCE_SHADER_MODULE, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
-						allocator.reset();
-					}
-				}
-			}
-			else
-			{
-				// Retain for combined serialize() later.
-				if (!shader_modules.count(hash))
-				{
-					VkShaderModuleCreateInfo *create_info_copy = nullptr;
-					if (copy_shader_module(create_info, allocator, &create_info_copy))
-						shader_modules[hash] = create_info_copy;
-				}
-			}
-			break;
-		}
+	void value(const uint16_t &v)
+	{
+		write_varint(v);
+	}
 
-		case VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO:
-		{
-			auto *create_info = reinterpret_cast<VkDescriptorSetLayoutCreateInfo *>(record_item.create_info);
-			auto hash = record_item.custom_hash;
-			if (hash == 0)
-				if (!Hashing::compute_hash_descriptor_set_layout(*recorder, *create_info, &hash))
-					break;
+	void value(const int32_t &v)
+	{
+		write_varint((uint32_t(v) << 1) ^ uint32_t(v >> 31));
+	}
 
-			VkDescriptorSetLayoutCreateInfo *create_info_copy = nullptr;
-			if (!copy_descriptor_set_layout(create_info, allocator, &create_info_copy))
-				break;
-			if (!remap_descriptor_set_layout_ci(create_info_copy))
-				break;
+	void value(const float &v)
+	{
+		uint32_t u;
+		memcpy(&u, &v, sizeof(u));
+		write_fixed(u, 4);
+	}
+
+	template <typename T>
+	typename std::enable_if<std::is_enum<T>::value>::type value(const T &v)
+	{
+		write_varint(uint32_t(v));
+	}
 
-			descriptor_set_layout_to_hash[api_object_cast<VkDescriptorSetLayout>(record_item.handle)] = hash;
+	void size(const size_t &v)
+	{
+		write_varint(v);
+	}
 
-			if (database_iface)
-			{
-				if (write_database_entries)
-				{
-					if (register_application_link_hash(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, blob))
-						need_flush = true;
+	template <typename T>
+	void stype(T &, VkStructureType)
+	{
+	}
 
-					if (!database_iface->has_entry(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash))
-					{
-						if (serialize_descriptor_set_layout(hash, *create_info_copy, blob))
-						{
-							database_iface->write_entry(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
-					}
-				}
+	template <typename T> void sampler(const T &h) { write_handle(h); }
+	template <typename T> void set_layout(const T &h) { write_handle(h); }
+	template <typename T> void pipeline_layout(const T &h) { write_handle(h); }
+	template <typename T> void render_pass(const T &h) { write_handle(h); }
+	template <typename T> void shader_module(const T &h) { write_handle(h); }
+	template <typename T> void base_pipeline(const T &h, ResourceTag) { write_handle(h); }
 
-				// Don't need to keep copied data around, reset the allocator.
-				allocator.reset();
-			}
-			else
-			{
+	void string(const char *const &str)
+	{
+		size_t len = strlen(str);
+		write_varint(len);
+		blob.insert(blob.end(), str, str + len);
+	}
 
-				// Retain for combined serialize() later.
-				if (!descriptor_sets.count(hash))
-					descriptor_sets[hash] = create_info_copy;
-			}
-			break;
+	void bytes(const void *const &data, const size_t &size)
+	{
+		write_varint(size);
+		if (size)
+		{
+			auto *ptr = static_cast<const uint8_t *>(data);
+			blob.insert(blob.end(), ptr, ptr + size);
 		}
+	}
 
-		case VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO:
+	template <typename T, typename Func>
+	void array(const T *const &ptr, const uint32_t &count, const Func &func)
+	{
+		if (!ptr)
 		{
-			auto *create_info = reinterpret_cast<VkPipelineLayoutCreateInfo *>(record_item.create_info);
-			auto hash = record_item.custom_hash;
-			if (hash == 0)
-				if (!Hashing::compute_hash_pipeline_layout(*recorder, *create_info, &hash))
-					break;
+			write_varint(0);
+			return;
+		}
 
-			VkPipelineLayoutCreateInfo *create_info_copy = nullptr;
-			if (!copy_pipeline_layout(create_info, allocator, &create_info_copy))
-				break;
-			if (!remap_pipeline_layout_ci(create_info_copy))
-				break;
+		write_varint(uint64_t(count) + 1);
+		for (uint32_t i = 0; i < count; i++)
+			func(const_cast<T &>(ptr[i]));
+	}
 
-			pipeline_layout_to_hash[api_object_cast<VkPipelineLayout>(record_item.handle)] = hash;
+	template <typename T, typename Func>
+	void sized_array(const T *const &ptr, uint32_t count, const Func &func)
+	{
+		write_varint(ptr ? 1 : 0);
+		if (ptr)
+			for (uint32_t i = 0; i < count; i++)
+				func(const_cast<T &>(ptr[i]));
+	}
 
-			if (database_iface)
-			{
-				if (write_database_entries)
-				{
-					if (register_application_link_hash(RESOURCE_PIPELINE_LAYOUT, hash, blob))
-						need_flush = true;
+	template <typename T, typename Func>
+	void optional(const T *const &ptr, const Func &func)
+	{
+		write_varint(ptr ? 1 : 0);
+		if (ptr)
+			func(const_cast<T &>(*ptr));
+	}
 
-					if (!database_iface->has_entry(RESOURCE_PIPELINE_LAYOUT, hash))
-					{
-						if (serialize_pipeline_layout(hash, *create_info_copy, blob))
-						{
-							database_iface->write_entry(RESOURCE_PIPELINE_LAYOUT, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
-					}
-				}
+	uint32_t pnext_count(const void *pNext) const
+	{
+		uint32_t count = 0;
+		for (; pNext; pNext = static_cast<const VkBaseInStructure *>(pNext)->pNext)
+			count++;
+		return count;
+	}
 
-				// Don't need to keep copied data around, reset the allocator.
-				allocator.reset();
-			}
-			else
-			{
-				// Retain for combined serialize() later.
-				if (!pipeline_layouts.count(hash))
-					pipeline_layouts[hash] = create_info_copy;
-			}
-			break;
-		}
+	template <typename T>
+	T *pnext_struct(const void *in)
+	{
+		return const_cast<T *>(static_cast<const T *>(in));
+	}
 
-		case VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO:
-		{
-			auto *create_info = reinterpret_cast<VkGraphicsPipelineCreateInfo *>(record_item.create_info);
-			auto hash = record_item.custom_hash;
-			if (hash == 0)
-				if (!Hashing::compute_hash_graphics_pipeline(*recorder, *create_info, &hash))
-					break;
+	void link_pnext(const void *&, VkBaseInStructure *&, VkBaseInStructure *, VkStructureType)
+	{
+	}
 
-			VkGraphicsPipelineCreateInfo *create_info_copy = nullptr;
-			if (!copy_graphics_pipeline(create_info, allocator, nullptr, 0, &create_info_copy))
-				break;
-			if (!remap_graphics_pipeline_ci(create_info_copy))
-				break;
+	bool check_count(uint64_t)
+	{
+		return true;
+	}
 
-			graphics_pipeline_to_hash[api_object_cast<VkPipeline>(record_item.handle)] = hash;
+	void fail()
+	{
+		failed = true;
+	}
 
-			if (database_iface)
-			{
-				if (write_database_entries)
-				{
-					if (register_application_link_hash(RESOURCE_GRAPHICS_PIPELINE, hash, blob))
-						need_flush = true;
+	bool ok() const
+	{
+		return !failed;
+	}
 
-					if (!database_iface->has_entry(RESOURCE_GRAPHICS_PIPELINE, hash))
-					{
-						if (serialize_graphics_pipeline(hash, *create_info_copy, blob))
-						{
-							database_iface->write_entry(RESOURCE_GRAPHICS_PIPELINE, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
-					}
-				}
+private:
+	vector<uint8_t> &blob;
+	bool failed = false;
 
-				// Don't need to keep copied data around, reset the allocator.
-				allocator.reset();
-			}
-			else
-			{
-				// Retain for combined serialize() later.
-				if (!graphics_pipelines.count(hash))
-					graphics_pipelines[hash] = create_info_copy;
-			}
-			break;
+	void write_varint(uint64_t v)
+	{
+		while (v >= 0x80)
+		{
+			blob.push_back(uint8_t(v | 0x80));
+			v >>= 7;
 		}
+		blob.push_back(uint8_t(v));
+	}
 
-		case VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO:
-		{
-			auto *create_info = reinterpret_cast<VkComputePipelineCreateInfo *>(record_item.create_info);
-			auto hash = record_item.custom_hash;
-			if (hash == 0)
-				if (!Hashing::compute_hash_compute_pipeline(*recorder, *create_info, &hash))
-					break;
+	void write_fixed(uint64_t v, unsigned bytes)
+	{
+		for (unsigned i = 0; i < bytes; i++)
+			blob.push_back(uint8_t(v >> (8 * i)));
+	}
 
-			VkComputePipelineCreateInfo *create_info_copy = nullptr;
-			if (!copy_compute_pipeline(create_info, allocator, nullptr, 0, &create_info_copy))
-				break;
-			if (!remap_compute_pipeline_ci(create_info_copy))
-				break;
+	template <typename T>
+	void write_handle(const T &h)
+	{
+		write_fixed(api_object_cast<uint64_t>(h), 8);
+	}
+};
 
-			compute_pipeline_to_hash[api_object_cast<VkPipeline>(record_item.handle)] = hash;
+class StateReplayer::Impl::BinaryPayloadReader
+{
+public:
+	BinaryPayloadReader(StateReplayer::Impl &impl_, StateCreatorInterface &iface_, DatabaseInterface *resolver_,
+	                    const uint8_t *data_, size_t size_)
+		: impl(impl_), iface(iface_), resolver(resolver_), data(data_), size_bytes(size_)
+	{
+	}
 
-			if (database_iface)
-			{
-				if (write_database_entries)
-				{
-					if (register_application_link_hash(RESOURCE_COMPUTE_PIPELINE, hash, blob))
-						need_flush = true;
+	void value(uint32_t &v)
+	{
+		uint64_t u = read_varint();
+		if (u > UINT32_MAX)
+			fail();
+		v = uint32_t(u);
+	}
 
-					if (!database_iface->has_entry(RESOURCE_COMPUTE_PIPELINE, hash))
-					{
-						if (serialize_compute_pipeline(hash, *create_info_copy, blob))
-						{
-							database_iface->write_entry(RESOURCE_COMPUTE_PIPELINE, hash, blob.data(), blob.size(),
-							                            payload_flags);
-							need_flush = true;
-						}
-					}
-				}
+	void value(uint16_t &v)
+	{
+		uint64_t u = read_varint();
+		if (u > UINT16_MAX)
+			fail();
+		v = uint16_t(u);
+	}
 
-				// Don't need to keep copied data around, reset the allocator.
-				allocator.reset();
-			}
-			else
-			{
-				// Retain for combined serialize() later.
-				if (!compute_pipelines.count(hash))
-					compute_pipelines[hash] = create_info_copy;
-			}
-			break;
+	void value(int32_t &v)
+	{
+		uint32_t u;
+		value(u);
+		v = int32_t((u >> 1) ^ (0u - (u & 1)));
+	}
+
+	void value(float &v)
+	{
+		uint32_t u = uint32_t(read_fixed(4));
+		memcpy(&v, &u, sizeof(v));
+	}
+
+	template <typename T>
+	typename std::enable_if<std::is_enum<T>::value>::type value(T &v)
+	{
+		uint32_t u;
+		value(u);
+		v = static_cast<T>(u);
+	}
+
+	void size(size_t &v)
+	{
+		uint64_t u = read_varint();
+		if (u > SIZE_MAX)
+			fail();
+		v = size_t(u);
+	}
+
+	template <typename T>
+	void stype(T &info, VkStructureType sType)
+	{
+		info.sType = sType;
+	}
+
+	void sampler(VkSampler &h)
+	{
+		if (!impl.resolve_handle("Immutable sampler", RESOURCE_SAMPLER, impl.replayed_samplers, read_fixed(8), &h))
+			fail();
+	}
+
+	void set_layout(VkDescriptorSetLayout &h)
+	{
+		if (!impl.resolve_handle("Descriptor set layout", RESOURCE_DESCRIPTOR_SET_LAYOUT, impl.replayed_descriptor_set_layouts, read_fixed(8), &h))
+			fail();
+	}
+
+	void pipeline_layout(VkPipelineLayout &h)
+	{
+		if (!impl.resolve_handle("Pipeline layout", RESOURCE_PIPELINE_LAYOUT, impl.replayed_pipeline_layouts, read_fixed(8), &h))
+			fail();
+	}
+
+	void render_pass(VkRenderPass &h)
+	{
+		if (!impl.resolve_handle("Render pass", RESOURCE_RENDER_PASS, impl.replayed_render_passes, read_fixed(8), &h))
+			fail();
+	}
+
+	void shader_module(VkShaderModule &h)
+	{
+		Hash hash = read_fixed(8);
+		if (!failed && !impl.resolve_shader_module(iface, resolver, hash, &h))
+			fail();
+	}
+
+	void base_pipeline(VkPipeline &h, ResourceTag tag)
+	{
+		Hash hash = read_fixed(8);
+		if (!failed && !impl.resolve_base_pipeline(iface, resolver, tag, hash, &h))
+			fail();
+	}
+
+	void string(const char *&str)
+	{
+		uint64_t len = read_varint();
+		if (!check_count(len))
+			return;
+		str = impl.duplicate_string(reinterpret_cast<const char *>(data + offset), size_t(len));
+		offset += size_t(len);
+	}
+
+	void bytes(const void *&ptr, size_t &size)
+	{
+		uint64_t len = read_varint();
+		if (!check_count(len))
+			return;
+		auto *copied = impl.allocator.allocate_n<uint8_t>(size_t(len));
+		if (len)
+			memcpy(copied, data + offset, size_t(len));
+		offset += size_t(len);
+		ptr = copied;
+		size = size_t(len);
+	}
+
+	template <typename T, typename Func>
+	void array(const T *&ptr, uint32_t &count, const Func &func)
+	{
+		uint64_t encoded = read_varint();
+		if (encoded == 0 || !check_count(encoded - 1))
+		{
+			ptr = nullptr;
+			count = 0;
+			return;
 		}
-		default:
-			break;
+
+		count = uint32_t(encoded - 1);
+		auto *elements = impl.allocator.allocate_n_cleared<T>(count);
+		for (uint32_t i = 0; i < count && !failed; i++)
+			func(elements[i]);
+		ptr = elements;
+	}
+
+	template <typename T, typename Func>
+	void sized_array(const T *&ptr, uint32_t count, const Func &func)
+	{
+		ptr = nullptr;
+		if (!read_varint() || !check_count(count))
+			return;
+
+		auto *elements = impl.allocator.allocate_n_cleared<T>(count);
+		for (uint32_t i = 0; i < count && !failed; i++)
+			func(elements[i]);
+		ptr = elements;
+	}
+
+	template <typename T, typename Func>
+	void optional(const T *&ptr, const Func &func)
+	{
+		ptr = nullptr;
+		if (!read_varint() || failed)
+			return;
+
+		auto *element = impl.allocator.allocate_cleared<T>();
+		func(*element);
+		ptr = element;
+	}
+
+	uint32_t pnext_count(const void *) const
+	{
+		return 0;
+	}
+
+	template <typename T>
+	T *pnext_struct(const void *)
+	{
+		return impl.allocator.allocate_cleared<T>();
+	}
+
+	void link_pnext(const void *&pNext, VkBaseInStructure *&tail, VkBaseInStructure *s, VkStructureType sType)
+	{
+		s->sType = sType;
+		s->pNext = nullptr;
+		if (tail)
+			tail->pNext = s;
+		else
+			pNext = s;
+		tail = s;
+	}
+
+	// Every encoded element occupies at least one byte, which bounds allocations by the payload size.
+	bool check_count(uint64_t count)
+	{
+		if (failed || count > size_bytes - offset)
+		{
+			fail();
+			return false;
 		}
+		return true;
 	}
 
-	if (database_iface)
-		database_iface->flush();
+	template <typename T>
+	T *allocate()
+	{
+		return impl.allocator.allocate_cleared<T>();
+	}
 
-	// We no longer need a reference to this.
-	// This should allow us to call init_recording_thread again if we want,
-	// or emit some final single threaded recording tasks.
-	database_iface = nullptr;
-}
+	Hash read_hash()
+	{
+		return read_fixed(8);
+	}
 
-static char base64(uint32_t v)
-{
-	if (v == 63)
-		return '/';
-	else if (v == 62)
-		return '+';
-	else if (v >= 52)
-		return char('0' + (v - 52));
-	else if (v >= 26)
-		return char('a' + (v - 26));
-	else
-		return char('A' + v);
-}
+	void fail()
+	{
+		failed = true;
+	}
 
-static std::string encode_base64(const void *data_, size_t size)
-{
-	auto *data = static_cast<const uint8_t *>(data_);
-	size_t num_chars = 4 * ((size + 2) / 3);
-	std::string ret;
-	ret.reserve(num_chars);
+	bool ok() const
+	{
+		return !failed;
+	}
 
-	for (size_t i = 0; i < size; i += 3)
+	bool at_end() const
 	{
-		uint32_t code = data[i] << 16;
-		if (i + 1 < size)
-			code |= data[i + 1] << 8;
-		if (i + 2 < size)
-			code |= data[i + 2] << 0;
+		return offset == size_bytes;
+	}
 
-		auto c0 = base64((code >> 18) & 63);
-		auto c1 = base64((code >> 12) & 63);
-		auto c2 = base64((code >>  6) & 63);
-		auto c3 = base64((code >>  0) & 63);
+private:
+	StateReplayer::Impl &impl;
+	StateCreatorInterface &iface;
+	DatabaseInterface *resolver;
+	const uint8_t *data;
+	size_t size_bytes;
+	size_t offset = 0;
+	bool failed = false;
+
+	uint64_t read_varint()
+	{
+		uint64_t v = 0;
+		for (unsigned shift = 0; shift < 64; shift += 7)
+		{
+			if (failed || offset >= size_bytes)
+				break;
 
-		auto outbytes = std::min(size - i, size_t(3));
-		if (outbytes == 1)
+			uint8_t c = data[offset++];
+			v |= uint64_t(c & 0x7f) << shift;
+			if ((c & 0x80) == 0)
+				return v;
+		}
+
+		fail();
+		return 0;
+	}
+
+	uint64_t read_fixed(unsigned bytes)
+	{
+		if (failed || size_bytes - offset < bytes)
 		{
-			c2 = '=';
-			c3 = '=';
+			fail();
+			return 0;
 		}
-		else if (outbytes == 2)
-			c3 = '=';
 
-		ret.push_back(c0);
-		ret.push_back(c1);
-		ret.push_back(c2);
-		ret.push_back(c3);
+		uint64_t v = 0;
+		for (unsigned i = 0; i < bytes; i++)
+			v |= uint64_t(data[offset++]) << (8 * i);
+		return v;
 	}
+};
 
-	return ret;
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineTessellationDomainOriginStateCreateInfo &info)
+{
+	c.value(info.domainOrigin);
 }
 
-template <typename Allocator>
-static bool json_value(const VkSamplerCreateInfo& sampler, Allocator& alloc, Value *out_value)
-{
-	Value s(kObjectType);
-	s.AddMember("flags", sampler.flags, alloc);
-	s.AddMember("minFilter", sampler.minFilter, alloc);
-	s.AddMember("magFilter", sampler.magFilter, alloc);
-	s.AddMember("maxAnisotropy", sampler.maxAnisotropy, alloc);
-	s.AddMember("compareOp", sampler.compareOp, alloc);
-	s.AddMember("anisotropyEnable", sampler.anisotropyEnable, alloc);
-	s.AddMember("mipmapMode", sampler.mipmapMode, alloc);
-	s.AddMember("addressModeU", sampler.addressModeU, alloc);
-	s.AddMember("addressModeV", sampler.addressModeV, alloc);
-	s.AddMember("addressModeW", sampler.addressModeW, alloc);
-	s.AddMember("borderColor", sampler.borderColor, alloc);
-	s.AddMember("unnormalizedCoordinates", sampler.unnormalizedCoordinates, alloc);
-	s.AddMember("compareEnable", sampler.compareEnable, alloc);
-	s.AddMember("mipLodBias", sampler.mipLodBias, alloc);
-	s.AddMember("minLod", sampler.minLod, alloc);
-	s.AddMember("maxLod", sampler.maxLod, alloc);
-
-	*out_value = s;
-	return true;
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineVertexInputDivisorStateCreateInfoEXT &info)
+{
+	c.value(info.vertexBindingDivisorCount);
+	c.sized_array(info.pVertexBindingDivisors, info.vertexBindingDivisorCount, [&](VkVertexInputBindingDivisorDescriptionEXT &d) {
+		c.value(d.binding);
+		c.value(d.divisor);
+	});
 }
 
-template <typename Allocator>
-static bool json_value(const VkPipelineLayoutCreateInfo& layout, Allocator& alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineRasterizationDepthClipStateCreateInfoEXT &info)
 {
-	Value p(kObjectType);
-	p.AddMember("flags", layout.flags, alloc);
-	Value push(kArrayType);
-	for (uint32_t i = 0; i < layout.pushConstantRangeCount; i++)
-	{
-		Value range(kObjectType);
-		range.AddMember("stageFlags", layout.pPushConstantRanges[i].stageFlags, alloc);
-		range.AddMember("size", layout.pPushConstantRanges[i].size, alloc);
-		range.AddMember("offset", layout.pPushConstantRanges[i].offset, alloc);
-		push.PushBack(range, alloc);
-	}
-	p.AddMember("pushConstantRanges", push, alloc);
-
-	Value set_layouts(kArrayType);
-	for (uint32_t i = 0; i < layout.setLayoutCount; i++)
-		set_layouts.PushBack(uint64_string(api_object_cast<uint64_t>(layout.pSetLayouts[i]), alloc), alloc);
-	p.AddMember("setLayouts", set_layouts, alloc);
-
-	*out_value = p;
-	return true;
+	c.value(info.flags);
+	c.value(info.depthClipEnable);
 }
 
-template <typename Allocator>
-static bool json_value(const VkShaderModuleCreateInfo& module, Allocator& alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineRasterizationStateStreamCreateInfoEXT &info)
 {
-	Value m(kObjectType);
-	m.AddMember("flags", module.flags, alloc);
-	m.AddMember("codeSize", uint64_t(module.codeSize), alloc);
-	m.AddMember("code", encode_base64(module.pCode, module.codeSize), alloc);
-
-	*out_value = m;
-	return true;
+	c.value(info.flags);
+	c.value(info.rasterizationStream);
 }
 
-template <typename Allocator>
-static bool json_value(const VkPipelineTessellationDomainOriginStateCreateInfo &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkRenderPassMultiviewCreateInfo &info)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
-	value.AddMember("domainOrigin", create_info.domainOrigin, alloc);
-
-	*out_value = value;
-	return true;
+	c.array(info.pViewMasks, info.subpassCount, [&](uint32_t &v) { c.value(v); });
+	c.array(info.pViewOffsets, info.dependencyCount, [&](int32_t &v) { c.value(v); });
+	c.array(info.pCorrelationMasks, info.correlationMaskCount, [&](uint32_t &v) { c.value(v); });
 }
 
-template <typename Allocator>
-static bool json_value(const VkPipelineVertexInputDivisorStateCreateInfoEXT &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkDescriptorSetLayoutBindingFlagsCreateInfoEXT &info)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
-	value.AddMember("vertexBindingDivisorCount", create_info.vertexBindingDivisorCount, alloc);
-
-	if (create_info.pVertexBindingDivisors)
-	{
-		Value divisors(kArrayType);
-		for (uint32_t i = 0; i < create_info.vertexBindingDivisorCount; i++)
-		{
-			Value divisor(kObjectType);
-			divisor.AddMember("binding", create_info.pVertexBindingDivisors[i].binding, alloc);
-			divisor.AddMember("divisor", create_info.pVertexBindingDivisors[i].divisor, alloc);
-			divisors.PushBack(divisor, alloc);
-		}
-		value.AddMember("vertexBindingDivisors", divisors, alloc);
-	}
-
-	*out_value = value;
-	return true;
+	c.array(info.pBindingFlags, info.bindingCount, [&](VkDescriptorBindingFlagsEXT &v) { c.value(v); });
 }
 
-template <typename Allocator>
-static bool json_value(const VkPipelineRasterizationDepthClipStateCreateInfoEXT &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineColorBlendAdvancedStateCreateInfoEXT &info)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
-	value.AddMember("flags", create_info.flags, alloc);
-	value.AddMember("depthClipEnable", create_info.depthClipEnable, alloc);
-
-	*out_value = value;
-	return true;
+	c.value(info.srcPremultiplied);
+	c.value(info.dstPremultiplied);
+	c.value(info.blendOverlap);
 }
 
-template <typename Allocator>
-static bool json_value(const VkPipelineRasterizationStateStreamCreateInfoEXT &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineRasterizationConservativeStateCreateInfoEXT &info)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
-	value.AddMember("flags", create_info.flags, alloc);
-	value.AddMember("rasterizationStream", create_info.rasterizationStream, alloc);
+	c.value(info.flags);
+	c.value(info.conservativeRasterizationMode);
+	c.value(info.extraPrimitiveOverestimationSize);
+}
 
-	*out_value = value;
-	return true;
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineRasterizationLineStateCreateInfoEXT &info)
+{
+	c.value(info.lineRasterizationMode);
+	c.value(info.stippledLineEnable);
+	c.value(info.lineStippleFactor);
+	c.value(info.lineStipplePattern);
 }
 
-template <typename Allocator>
-static bool json_value(const VkRenderPassMultiviewCreateInfo &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT &info)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
+	c.value(info.requiredSubgroupSize);
+}
 
-	if (create_info.subpassCount)
-	{
-		Value view_masks(kArrayType);
-		for (uint32_t i = 0; i < create_info.subpassCount; i++)
-			view_masks.PushBack(create_info.pViewMasks[i], alloc);
-		value.AddMember("viewMasks", view_masks, alloc);
-	}
+template <typename Codec>
+static void binary_transfer(Codec &c, VkMutableDescriptorTypeCreateInfoVALVE &info)
+{
+	c.array(info.pMutableDescriptorTypeLists, info.mutableDescriptorTypeListCount, [&](VkMutableDescriptorTypeListVALVE &l) {
+		c.array(l.pDescriptorTypes, l.descriptorTypeCount, [&](VkDescriptorType &t) { c.value(t); });
+	});
+}
 
-	if (create_info.dependencyCount)
-	{
-		Value view_offsets(kArrayType);
-		for (uint32_t i = 0; i < create_info.dependencyCount; i++)
-			view_offsets.PushBack(create_info.pViewOffsets[i], alloc);
-		value.AddMember("viewOffsets", view_offsets, alloc);
-	}
+template <typename T, typename Codec>
+static VkBaseInStructure *binary_transfer_pnext_struct(Codec &c, const void *in)
+{
+	auto *s = c.template pnext_struct<T>(in);
+	binary_transfer(c, *s);
+	return reinterpret_cast<VkBaseInStructure *>(s);
+}
 
-	if (create_info.correlationMaskCount)
+template <typename Codec>
+static VkBaseInStructure *binary_transfer_pnext_struct(Codec &c, VkStructureType sType, const void *in)
+{
+	switch (sType)
 	{
-		Value correlation_masks(kArrayType);
-		for (uint32_t i = 0; i < create_info.correlationMaskCount; i++)
-			correlation_masks.PushBack(create_info.pCorrelationMasks[i], alloc);
-		value.AddMember("correlationMasks", correlation_masks, alloc);
+#define FOSSILIZE_BINARY_PNEXT_STRUCT(stype, T) \
+	case stype: \
+		return binary_transfer_pnext_struct<T>(c, in);
+	FOSSILIZE_PNEXT_STRUCTS(FOSSILIZE_BINARY_PNEXT_STRUCT)
+#undef FOSSILIZE_BINARY_PNEXT_STRUCT
+	default:
+		return nullptr;
 	}
-
-	*out_value = value;
-	return true;
 }
 
-template <typename Allocator>
-static bool json_value(const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer_pnext_chain(Codec &c, const void *&pNext)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
+	uint32_t count = c.pnext_count(pNext);
+	c.value(count);
+	if (!c.check_count(count))
+		return;
 
-	if (create_info.bindingCount)
+	const void *in = pNext;
+	VkBaseInStructure *tail = nullptr;
+	for (uint32_t i = 0; i < count && c.ok(); i++)
 	{
-		Value binding_flags(kArrayType);
-		for (uint32_t i = 0; i < create_info.bindingCount; i++)
-			binding_flags.PushBack(create_info.pBindingFlags[i], alloc);
-		value.AddMember("bindingFlags", binding_flags, alloc);
-	}
+		auto sType = in ? static_cast<const VkBaseInStructure *>(in)->sType : VkStructureType(0);
+		c.value(sType);
+		if (!c.ok())
+			return;
 
-	*out_value = value;
-	return true;
+		auto *s = binary_transfer_pnext_struct(c, sType, in);
+		if (!s)
+		{
+			LOGE_LEVEL("Unsupported pNext sType %d in binary payload.\n", int(sType));
+			c.fail();
+			return;
+		}
+
+		c.link_pnext(pNext, tail, s, sType);
+		in = s->pNext;
+	}
+}
+
+template <typename Codec>
+static void binary_transfer(Codec &c, VkSamplerCreateInfo &info)
+{
+	c.stype(info, VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO);
+	c.value(info.flags);
+	c.value(info.magFilter);
+	c.value(info.minFilter);
+	c.value(info.mipmapMode);
+	c.value(info.addressModeU);
+	c.value(info.addressModeV);
+	c.value(info.addressModeW);
+	c.value(info.mipLodBias);
+	c.value(info.anisotropyEnable);
+	c.value(info.maxAnisotropy);
+	c.value(info.compareEnable);
+	c.value(info.compareOp);
+	c.value(info.minLod);
+	c.value(info.maxLod);
+	c.value(info.borderColor);
+	c.value(info.unnormalizedCoordinates);
+}
+
+template <typename Codec>
+static void binary_transfer(Codec &c, VkDescriptorSetLayoutCreateInfo &info)
+{
+	c.stype(info, VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO);
+	c.value(info.flags);
+	c.array(info.pBindings, info.bindingCount, [&](VkDescriptorSetLayoutBinding &b) {
+		c.value(b.binding);
+		c.value(b.descriptorType);
+		c.value(b.descriptorCount);
+		c.value(b.stageFlags);
+		c.sized_array(b.pImmutableSamplers, b.descriptorCount, [&](VkSampler &s) { c.sampler(s); });
+	});
+	binary_transfer_pnext_chain(c, info.pNext);
 }
 
-template <typename Allocator>
-static bool json_value(const VkPipelineColorBlendAdvancedStateCreateInfoEXT &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineLayoutCreateInfo &info)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
-
-	value.AddMember("srcPremultiplied", uint32_t(create_info.srcPremultiplied), alloc);
-	value.AddMember("dstPremultiplied", uint32_t(create_info.dstPremultiplied), alloc);
-	value.AddMember("blendOverlap", create_info.blendOverlap, alloc);
-
-	*out_value = value;
-	return true;
+	c.stype(info, VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO);
+	c.value(info.flags);
+	c.array(info.pSetLayouts, info.setLayoutCount, [&](VkDescriptorSetLayout &l) { c.set_layout(l); });
+	c.array(info.pPushConstantRanges, info.pushConstantRangeCount, [&](VkPushConstantRange &r) {
+		c.value(r.stageFlags);
+		c.value(r.offset);
+		c.value(r.size);
+	});
 }
 
-template <typename Allocator>
-static bool json_value(const VkPipelineRasterizationConservativeStateCreateInfoEXT &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkAttachmentReference &ref)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
-
-	value.AddMember("flags", create_info.flags, alloc);
-	value.AddMember("conservativeRasterizationMode", create_info.conservativeRasterizationMode, alloc);
-	value.AddMember("extraPrimitiveOverestimationSize", create_info.extraPrimitiveOverestimationSize, alloc);
-
-	*out_value = value;
-	return true;
+	c.value(ref.attachment);
+	c.value(ref.layout);
 }
 
-template <typename Allocator>
-static bool json_value(const VkPipelineRasterizationLineStateCreateInfoEXT &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkRenderPassCreateInfo &info)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
+	c.stype(info, VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO);
+	c.value(info.flags);
 
-	value.AddMember("lineRasterizationMode", create_info.lineRasterizationMode, alloc);
-	value.AddMember("stippledLineEnable", create_info.stippledLineEnable, alloc);
-	value.AddMember("lineStippleFactor", create_info.lineStippleFactor, alloc);
-	value.AddMember("lineStipplePattern", create_info.lineStipplePattern, alloc);
+	c.array(info.pAttachments, info.attachmentCount, [&](VkAttachmentDescription &a) {
+		c.value(a.flags);
+		c.value(a.format);
+		c.value(a.samples);
+		c.value(a.loadOp);
+		c.value(a.storeOp);
+		c.value(a.stencilLoadOp);
+		c.value(a.stencilStoreOp);
+		c.value(a.initialLayout);
+		c.value(a.finalLayout);
+	});
 
-	*out_value = value;
-	return true;
-}
+	c.array(info.pSubpasses, info.subpassCount, [&](VkSubpassDescription &sub) {
+		const auto transfer_ref = [&](VkAttachmentReference &ref) { binary_transfer(c, ref); };
+		c.value(sub.flags);
+		c.value(sub.pipelineBindPoint);
+		c.array(sub.pInputAttachments, sub.inputAttachmentCount, transfer_ref);
+		c.array(sub.pColorAttachments, sub.colorAttachmentCount, transfer_ref);
+		c.sized_array(sub.pResolveAttachments, sub.colorAttachmentCount, transfer_ref);
+		c.optional(sub.pDepthStencilAttachment, transfer_ref);
+		c.array(sub.pPreserveAttachments, sub.preserveAttachmentCount, [&](uint32_t &v) { c.value(v); });
+	});
 
-template <typename Allocator>
-static bool json_value(const VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT &create_info, Allocator &alloc, Value *out_value)
-{
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
-	value.AddMember("requiredSubgroupSize", create_info.requiredSubgroupSize, alloc);
+	c.array(info.pDependencies, info.dependencyCount, [&](VkSubpassDependency &d) {
+		c.value(d.srcSubpass);
+		c.value(d.dstSubpass);
+		c.value(d.srcStageMask);
+		c.value(d.dstStageMask);
+		c.value(d.srcAccessMask);
+		c.value(d.dstAccessMask);
+		c.value(d.dependencyFlags);
+	});
 
-	*out_value = value;
-	return true;
+	binary_transfer_pnext_chain(c, info.pNext);
 }
 
-template <typename Allocator>
-static bool json_value(const VkMutableDescriptorTypeCreateInfoVALVE &create_info, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkPipelineShaderStageCreateInfo &stage)
 {
-	Value value(kObjectType);
-	value.AddMember("sType", create_info.sType, alloc);
-
-	Value lists(kArrayType);
-	for (uint32_t i = 0; i < create_info.mutableDescriptorTypeListCount; i++)
-	{
-		Value list(kArrayType);
-		auto &l = create_info.pMutableDescriptorTypeLists[i];
-		for (uint32_t j = 0; j < l.descriptorTypeCount; j++)
-			list.PushBack(l.pDescriptorTypes[j], alloc);
-		lists.PushBack(list, alloc);
-	}
-	value.AddMember("mutableDescriptorTypeLists", lists, alloc);
-
-	*out_value = value;
-	return true;
+	c.stype(stage, VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO);
+	c.value(stage.flags);
+	c.value(stage.stage);
+	c.shader_module(stage.module);
+	c.string(stage.pName);
+	c.optional(stage.pSpecializationInfo, [&](VkSpecializationInfo &spec) {
+		c.array(spec.pMapEntries, spec.mapEntryCount, [&](VkSpecializationMapEntry &e) {
+			c.value(e.constantID);
+			c.value(e.offset);
+			c.size(e.size);
+		});
+		c.bytes(spec.pData, spec.dataSize);
+	});
+	binary_transfer_pnext_chain(c, stage.pNext);
 }
 
-template <typename Allocator>
-static bool pnext_chain_json_value(const void *pNext, Allocator &alloc, Value *out_value)
+template <typename Codec>
+static void binary_transfer(Codec &c, VkComputePipelineCreateInfo &info)
 {
-	Value nexts(kArrayType);
-
-	while (pNext != nullptr)
-	{
-		auto *pin = static_cast<const VkBaseInStructure *>(pNext);
-		Value next;
-		switch (pin->sType)
-		{
-		case VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_DOMAIN_ORIGIN_STATE_CREATE_INFO:
-			if (!json_value(*static_cast<const VkPipelineTessellationDomainOriginStateCreateInfo *>(pNext), alloc, &next))
-				return false;
-			break;
+	c.stype(info, VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO);
+	c.value(info.flags);
+	c.base_pipeline(info.basePipelineHandle, RESOURCE_COMPUTE_PIPELINE);
+	c.value(info.basePipelineIndex);
+	c.pipeline_layout(info.layout);
+	binary_transfer(c, info.stage);
+}
 
-		case VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_DIVISOR_STATE_CREATE_INFO_EXT:
-			if (!json_value(*static_cast<const VkPipelineVertexInputDivisorStateCreateInfoEXT *>(pNext), alloc, &next))
-				return false;
-			break;
+template <typename Codec>
+static void binary_transfer(Codec &c, VkStencilOpState &state)
+{
+	c.value(state.failOp);
+	c.value(state.passOp);
+	c.value(state.depthFailOp);
+	c.value(state.compareOp);
+	c.value(state.compareMask);
+	c.value(state.writeMask);
+	c.value(state.reference);
+}
 
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_DEPTH_CLIP_STATE_CREATE_INFO_EXT:
-			if (!json_value(*static_cast<const VkPipelineRasterizationDepthClipStateCreateInfoEXT *>(pNext), alloc, &next))
-				return false;
-			break;
+template <typename Codec>
+static void binary_transfer(Codec &c, VkGraphicsPipelineCreateInfo &info)
+{
+	c.stype(info, VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO);
+	c.value(info.flags);
+	c.base_pipeline(info.basePipelineHandle, RESOURCE_GRAPHICS_PIPELINE);
+	c.value(info.basePipelineIndex);
+	c.pipeline_layout(info.layout);
+	c.render_pass(info.renderPass);
+	c.value(info.subpass);
 
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_STREAM_CREATE_INFO_EXT:
-			if (!json_value(*static_cast<const VkPipelineRasterizationStateStreamCreateInfoEXT *>(pNext), alloc, &next))
-				return false;
-			break;
+	c.array(info.pStages, info.stageCount, [&](VkPipelineShaderStageCreateInfo &stage) {
+		binary_transfer(c, stage);
+	});
 
-		case VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO:
-			if (!json_value(*static_cast<const VkRenderPassMultiviewCreateInfo *>(pNext), alloc, &next))
-				return false;
-			break;
+	c.optional(info.pVertexInputState, [&](VkPipelineVertexInputStateCreateInfo &vi) {
+		c.stype(vi, VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO);
+		c.value(vi.flags);
+		c.array(vi.pVertexBindingDescriptions, vi.vertexBindingDescriptionCount, [&](VkVertexInputBindingDescription &b) {
+			c.value(b.binding);
+			c.value(b.stride);
+			c.value(b.inputRate);
+		});
+		c.array(vi.pVertexAttributeDescriptions, vi.vertexAttributeDescriptionCount, [&](VkVertexInputAttributeDescription &a) {
+			c.value(a.location);
+			c.value(a.binding);
+			c.value(a.format);
+			c.value(a.offset);
+		});
+		binary_transfer_pnext_chain(c, vi.pNext);
+	});
 
-		case VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT:
-			if (!json_value(*static_cast<const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT *>(pNext), alloc, &next))
-				return false;
-			break;
+	c.optional(info.pInputAssemblyState, [&](VkPipelineInputAssemblyStateCreateInfo &ia) {
+		c.stype(ia, VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO);
+		c.value(ia.flags);
+		c.value(ia.topology);
+		c.value(ia.primitiveRestartEnable);
+	});
 
-		case VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_ADVANCED_STATE_CREATE_INFO_EXT:
-			if (!json_value(*static_cast<const VkPipelineColorBlendAdvancedStateCreateInfoEXT *>(pNext), alloc, &next))
-				return false;
-			break;
+	c.optional(info.pTessellationState, [&](VkPipelineTessellationStateCreateInfo &tess) {
+		c.stype(tess, VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO);
+		c.value(tess.flags);
+		c.value(tess.patchControlPoints);
+		binary_transfer_pnext_chain(c, tess.pNext);
+	});
 
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_CONSERVATIVE_STATE_CREATE_INFO_EXT:
-			if (!json_value(*static_cast<const VkPipelineRasterizationConservativeStateCreateInfoEXT *>(pNext), alloc, &next))
-				return false;
-			break;
+	c.optional(info.pViewportState, [&](VkPipelineViewportStateCreateInfo &vp) {
+		c.stype(vp, VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO);
+		c.value(vp.flags);
+		c.value(vp.viewportCount);
+		c.sized_array(vp.pViewports, vp.viewportCount, [&](VkViewport &v) {
+			c.value(v.x);
+			c.value(v.y);
+			c.value(v.width);
+			c.value(v.height);
+			c.value(v.minDepth);
+			c.value(v.maxDepth);
+		});
+		c.value(vp.scissorCount);
+		c.sized_array(vp.pScissors, vp.scissorCount, [&](VkRect2D &r) {
+			c.value(r.offset.x);
+			c.value(r.offset.y);
+			c.value(r.extent.width);
+			c.value(r.extent.height);
+		});
+	});
 
-		case VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_LINE_STATE_CREATE_INFO_EXT:
-			if (!json_value(*static_cast<const VkPipelineRasterizationLineStateCreateInfoEXT *>(pNext), alloc, &next))
-				return false;
-			break;
+	c.optional(info.pRasterizationState, [&](VkPipelineRasterizationStateCreateInfo &rs) {
+		c.stype(rs, VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO);
+		c.value(rs.flags);
+		c.value(rs.depthClampEnable);
+		c.value(rs.rasterizerDiscardEnable);
+		c.value(rs.polygonMode);
+		c.value(rs.cullMode);
+		c.value(rs.frontFace);
+		c.value(rs.depthBiasEnable);
+		c.value(rs.depthBiasConstantFactor);
+		c.value(rs.depthBiasClamp);
+		c.value(rs.depthBiasSlopeFactor);
+		c.value(rs.lineWidth);
+		binary_transfer_pnext_chain(c, rs.pNext);
+	});
 
-		case VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO_EXT:
-			if (!json_value(*static_cast<const VkPipelineShaderStageRequiredSubgroupSizeCreateInfoEXT *>(pNext), alloc, &next))
-				return false;
-			break;
+	c.optional(info.pMultisampleState, [&](VkPipelineMultisampleStateCreateInfo &ms) {
+		c.stype(ms, VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO);
+		c.value(ms.flags);
+		c.value(ms.rasterizationSamples);
+		c.value(ms.sampleShadingEnable);
+		c.value(ms.minSampleShading);
+		c.sized_array(ms.pSampleMask, (uint32_t(ms.rasterizationSamples) + 31) / 32, [&](VkSampleMask &m) { c.value(m); });
+		c.value(ms.alphaToCoverageEnable);
+		c.value(ms.alphaToOneEnable);
+	});
 
-		case VK_STRUCTURE_TYPE_MUTABLE_DESCRIPTOR_TYPE_CREATE_INFO_VALVE:
-			if (!json_value(*static_cast<const VkMutableDescriptorTypeCreateInfoVALVE *>(pNext), alloc, &next))
-				return false;
-			break;
+	c.optional(info.pDepthStencilState, [&](VkPipelineDepthStencilStateCreateInfo &ds) {
+		c.stype(ds, VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO);
+		c.value(ds.flags);
+		c.value(ds.depthTestEnable);
+		c.value(ds.depthWriteEnable);
+		c.value(ds.depthCompareOp);
+		c.value(ds.depthBoundsTestEnable);
+		c.value(ds.stencilTestEnable);
+		binary_transfer(c, ds.front);
+		binary_transfer(c, ds.back);
+		c.value(ds.minDepthBounds);
+		c.value(ds.maxDepthBounds);
+	});
 
-		default:
-			log_error_pnext_chain("Unsupported pNext found, cannot hash sType.", pNext);
-			return false;
-		}
+	c.optional(info.pColorBlendState, [&](VkPipelineColorBlendStateCreateInfo &cb) {
+		c.stype(cb, VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO);
+		c.value(cb.flags);
+		c.value(cb.logicOpEnable);
+		c.value(cb.logicOp);
+		c.array(cb.pAttachments, cb.attachmentCount, [&](VkPipelineColorBlendAttachmentState &a) {
+			c.value(a.blendEnable);
+			c.value(a.srcColorBlendFactor);
+			c.value(a.dstColorBlendFactor);
+			c.value(a.colorBlendOp);
+			c.value(a.srcAlphaBlendFactor);
+			c.value(a.dstAlphaBlendFactor);
+			c.value(a.alphaBlendOp);
+			c.value(a.colorWriteMask);
+		});
+		for (auto &constant : cb.blendConstants)
+			c.value(constant);
+		binary_transfer_pnext_chain(c, cb.pNext);
+	});
 
-		nexts.PushBack(next, alloc);
-		pNext = pin->pNext;
-	}
+	c.optional(info.pDynamicState, [&](VkPipelineDynamicStateCreateInfo &dyn) {
+		c.stype(dyn, VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO);
+		c.value(dyn.flags);
+		c.array(dyn.pDynamicStates, dyn.dynamicStateCount, [&](VkDynamicState &state) { c.value(state); });
+	});
+}
 
-	*out_value = nexts;
-	return true;
+template <typename T>
+static bool serialize_binary_object(vector<uint8_t> &blob, ResourceTag tag, Hash hash, const T &create_info)
+{
+	blob.clear();
+	BinaryPayloadWriter writer(blob);
+	writer.header(tag, hash);
+	// The writer only ever reads through the reference.
+	binary_transfer(writer, const_cast<T &>(create_info));
+	return writer.ok();
 }
 
-template <typename Allocator>
-static bool json_value(const VkComputePipelineCreateInfo& pipe, Allocator& alloc, Value *out_value)
+template <typename T>
+bool StateReplayer::Impl::resolve_handle(const char *type, ResourceTag tag, std::unordered_map<Hash, T> &replayed,
+                                         Hash hash, T *handle)
 {
-	Value p(kObjectType);
-	p.AddMember("flags", pipe.flags, alloc);
-	p.AddMember("layout", uint64_string(api_object_cast<uint64_t>(pipe.layout), alloc), alloc);
-	p.AddMember("basePipelineHandle", uint64_string(api_object_cast<uint64_t>(pipe.basePipelineHandle), alloc), alloc);
-	p.AddMember("basePipelineIndex", pipe.basePipelineIndex, alloc);
-	Value stage(kObjectType);
-	stage.AddMember("flags", pipe.stage.flags, alloc);
-	stage.AddMember("stage", pipe.stage.stage, alloc);
-	stage.AddMember("module", uint64_string(api_object_cast<uint64_t>(pipe.stage.module), alloc), alloc);
-	stage.AddMember("name", StringRef(pipe.stage.pName), alloc);
-	if (pipe.stage.pSpecializationInfo)
+	if (hash == 0)
 	{
-		Value spec(kObjectType);
-		spec.AddMember("dataSize", uint64_t(pipe.stage.pSpecializationInfo->dataSize), alloc);
-		spec.AddMember("data",
-		               encode_base64(pipe.stage.pSpecializationInfo->pData,
-		                             pipe.stage.pSpecializationInfo->dataSize), alloc);
-		Value map_entries(kArrayType);
-		for (uint32_t i = 0; i < pipe.stage.pSpecializationInfo->mapEntryCount; i++)
-		{
-			auto &e = pipe.stage.pSpecializationInfo->pMapEntries[i];
-			Value map_entry(kObjectType);
-			map_entry.AddMember("offset", e.offset, alloc);
-			map_entry.AddMember("size", uint64_t(e.size), alloc);
-			map_entry.AddMember("constantID", e.constantID, alloc);
-			map_entries.PushBack(map_entry, alloc);
-		}
-		spec.AddMember("mapEntries", map_entries, alloc);
-		stage.AddMember("specializationInfo", spec, alloc);
+		*handle = api_object_cast<T>(uint64_t(0));
+		return true;
 	}
 
-	if (pipe.stage.pNext)
+	auto itr = replayed.find(hash);
+	if (itr == end(replayed) && replay_missing_trivial_object(tag, hash))
+		itr = replayed.find(hash);
+	if (itr == end(replayed))
 	{
-		Value nexts;
-		if (!pnext_chain_json_value(pipe.stage.pNext, alloc, &nexts))
-			return false;
-		stage.AddMember("pNext", nexts, alloc);
+		log_missing_resource(type, hash);
+		return false;
+	}
+	else if (itr->second == VK_NULL_HANDLE)
+	{
+		log_invalid_resource(type, hash);
+		return false;
 	}
 
-	p.AddMember("stage", stage, alloc);
-
-	*out_value = p;
+	*handle = itr->second;
 	return true;
 }
 
-template <typename Allocator>
-static bool json_value(const VkDescriptorSetLayoutCreateInfo& layout, Allocator& alloc, Value *out_value)
+bool StateReplayer::Impl::resolve_base_pipeline(StateCreatorInterface &iface, DatabaseInterface *resolver,
+                                                ResourceTag tag, Hash pipeline, VkPipeline *out_pipeline)
 {
-	Value l(kObjectType);
-	l.AddMember("flags", layout.flags, alloc);
-
-	Value bindings(kArrayType);
-	for (uint32_t i = 0; i < layout.bindingCount; i++)
+	if (pipeline == 0 || !resolve_derivative_pipelines)
 	{
-		auto &b = layout.pBindings[i];
-		Value binding(kObjectType);
-		binding.AddMember("descriptorType", b.descriptorType, alloc);
-		binding.AddMember("descriptorCount", b.descriptorCount, alloc);
-		binding.AddMember("stageFlags", b.stageFlags, alloc);
-		binding.AddMember("binding", b.binding, alloc);
-		if (b.pImmutableSamplers)
-		{
-			Value immutables(kArrayType);
-			for (uint32_t j = 0; j < b.descriptorCount; j++)
-				immutables.PushBack(uint64_string(api_object_cast<uint64_t>(b.pImmutableSamplers[j]), alloc), alloc);
-			binding.AddMember("immutableSamplers", immutables, alloc);
-		}
-		bindings.PushBack(binding, alloc);
+		*out_pipeline = api_object_cast<VkPipeline>(pipeline);
+		return true;
 	}
-	l.AddMember("bindings", bindings, alloc);
 
-	if (layout.pNext)
+	auto &replayed = tag == RESOURCE_GRAPHICS_PIPELINE ? replayed_graphics_pipelines : replayed_compute_pipelines;
+
+	// This is pretty bad for multithreaded replay, but this should be very rare.
+	iface.sync_threads();
+
+	// A binary payload only ever holds one pipeline, so the parent has to come from the database.
+	auto itr = replayed.find(pipeline);
+	if (itr == end(replayed))
 	{
-		Value nexts;
-		if (!pnext_chain_json_value(layout.pNext, alloc, &nexts))
+		size_t external_state_size = 0;
+		if (!resolver || !resolver->read_entry(tag, pipeline, &external_state_size, nullptr, PAYLOAD_READ_NO_FLAGS))
+		{
+			log_missing_resource("Base pipeline", pipeline);
 			return false;
-		l.AddMember("pNext", nexts, alloc);
-	}
+		}
 
-	*out_value = l;
-	return true;
-}
+		vector<uint8_t> external_state(external_state_size + 1);
 
-template <typename Allocator>
-static bool json_value(const VkRenderPassCreateInfo& pass, Allocator& alloc, Value *out_value)
-{
-	Value json_object(kObjectType);
-	json_object.AddMember("flags", pass.flags, alloc);
+		if (!resolver->read_entry(tag, pipeline, &external_state_size, external_state.data(), PAYLOAD_READ_NO_FLAGS))
+		{
+			log_missing_resource("Base pipeline", pipeline);
+			return false;
+		}
 
-	Value deps(kArrayType);
-	Value subpasses(kArrayType);
-	Value attachments(kArrayType);
+		if (!this->parse_insitu(iface, resolver, external_state.data(), external_state_size))
+			return false;
 
-	if (pass.pDependencies)
-	{
-		for (uint32_t i = 0; i < pass.dependencyCount; i++)
+		iface.sync_threads();
+		itr = replayed.find(pipeline);
+		if (itr == end(replayed))
 		{
-			auto &d = pass.pDependencies[i];
-			Value dep(kObjectType);
-			dep.AddMember("dependencyFlags", d.dependencyFlags, alloc);
-			dep.AddMember("dstAccessMask", d.dstAccessMask, alloc);
-			dep.AddMember("srcAccessMask", d.srcAccessMask, alloc);
-			dep.AddMember("dstStageMask", d.dstStageMask, alloc);
-			dep.AddMember("srcStageMask", d.srcStageMask, alloc);
-			dep.AddMember("dstSubpass", d.dstSubpass, alloc);
-			dep.AddMember("srcSubpass", d.srcSubpass, alloc);
-			deps.PushBack(dep, alloc);
+			log_missing_resource("Base pipeline", pipeline);
+			return false;
 		}
-		json_object.AddMember("dependencies", deps, alloc);
 	}
 
-	if (pass.pAttachments)
-	{
-		for (uint32_t i = 0; i < pass.attachmentCount; i++)
-		{
-			auto &a = pass.pAttachments[i];
-			Value att(kObjectType);
+	*out_pipeline = itr->second;
+	return true;
+}
 
-			att.AddMember("flags", a.flags, alloc);
-			att.AddMember("format", a.format, alloc);
-			att.AddMember("finalLayout", a.finalLayout, alloc);
-			att.AddMember("initialLayout", a.initialLayout, alloc);
-			att.AddMember("loadOp", a.loadOp, alloc);
-			att.AddMember("storeOp", a.storeOp, alloc);
-			att.AddMember("samples", a.samples, alloc);
-			att.AddMember("stencilLoadOp", a.stencilLoadOp, alloc);
-			att.AddMember("stencilStoreOp", a.stencilStoreOp, alloc);
+template <typename T, typename Handle>
+bool StateReplayer::Impl::parse_binary_object(BinaryPayloadReader &reader, StateCreatorInterface &iface, Hash hash,
+                                              std::unordered_map<Hash, Handle> &replayed,
+                                              bool (StateCreatorInterface::*enqueue)(Hash, const T *, Handle *))
+{
+	if (replayed.count(hash))
+		return true;
 
-			attachments.PushBack(att, alloc);
-		}
-		json_object.AddMember("attachments", attachments, alloc);
-	}
+	auto *info = reader.allocate<T>();
+	binary_transfer(reader, *info);
 
-	for (uint32_t i = 0; i < pass.subpassCount; i++)
+	if (!reader.ok() || !reader.at_end())
 	{
-		auto &sub = pass.pSubpasses[i];
-		Value p(kObjectType);
-		p.AddMember("flags", sub.flags, alloc);
-		p.AddMember("pipelineBindPoint", sub.pipelineBindPoint, alloc);
-
-		if (sub.pPreserveAttachments)
-		{
-			Value preserves(kArrayType);
-			for (uint32_t j = 0; j < sub.preserveAttachmentCount; j++)
-				preserves.PushBack(sub.pPreserveAttachments[j], alloc);
-			p.AddMember("preserveAttachments", preserves, alloc);
-		}
+		LOGE_LEVEL("Malformed binary payload for object %016" PRIx64 ".\n", hash);
+		return false;
+	}
 
-		if (sub.pInputAttachments)
-		{
-			Value inputs(kArrayType);
-			for (uint32_t j = 0; j < sub.inputAttachmentCount; j++)
-			{
-				Value input(kObjectType);
-				auto &ia = sub.pInputAttachments[j];
-				input.AddMember("attachment", ia.attachment, alloc);
-				input.AddMember("layout", ia.layout, alloc);
-				inputs.PushBack(input, alloc);
-			}
-			p.AddMember("inputAttachments", inputs, alloc);
-		}
+	if (!(iface.*enqueue)(hash, info, &replayed[hash]))
+		return false;
 
-		if (sub.pColorAttachments)
-		{
-			Value colors(kArrayType);
-			for (uint32_t j = 0; j < sub.colorAttachmentCount; j++)
-			{
-				Value color(kObjectType);
-				auto &c = sub.pColorAttachments[j];
-				color.AddMember("attachment", c.attachment, alloc);
-				color.AddMember("layout", c.layout, alloc);
-				colors.PushBack(color, alloc);
-			}
-			p.AddMember("colorAttachments", colors, alloc);
-		}
+	iface.notify_replayed_resources_for_type();
+	return true;
+}
 
-		if (sub.pResolveAttachments)
-		{
-			Value resolves(kArrayType);
-			for (uint32_t j = 0; j < sub.colorAttachmentCount; j++)
-			{
-				Value resolve(kObjectType);
-				auto &r = sub.pResolveAttachments[j];
-				resolve.AddMember("attachment", r.attachment, alloc);
-				resolve.AddMember("layout", r.layout, alloc);
-				resolves.PushBack(resolve, alloc);
-			}
-			p.AddMember("resolveAttachments", resolves, alloc);
-		}
+bool StateReplayer::Impl::parse_binary(StateCreatorInterface &iface, DatabaseInterface *resolver,
+                                       const uint8_t *buffer, size_t size)
+{
+	BinaryPayloadReader reader(*this, iface, resolver,
+	                           buffer + sizeof(binary_payload_magic), size - sizeof(binary_payload_magic));
 
-		if (sub.pDepthStencilAttachment)
-		{
-			Value depth_stencil(kObjectType);
-			depth_stencil.AddMember("attachment", sub.pDepthStencilAttachment->attachment, alloc);
-			depth_stencil.AddMember("layout", sub.pDepthStencilAttachment->layout, alloc);
-			p.AddMember("depthStencilAttachment", depth_stencil, alloc);
-		}
+	uint32_t version = 0;
+	uint32_t tag = 0;
+	reader.value(version);
+	reader.value(tag);
+	Hash hash = reader.read_hash();
 
-		subpasses.PushBack(p, alloc);
+	if (!reader.ok())
+	{
+		LOGE_LEVEL("Truncated binary payload header.\n");
+		return false;
 	}
-	json_object.AddMember("subpasses", subpasses, alloc);
 
-	if (pass.pNext)
+	if (version > FOSSILIZE_FORMAT_VERSION || version < FOSSILIZE_FORMAT_MIN_COMPAT_VERSION)
 	{
-		Value nexts;
-		if (!pnext_chain_json_value(pass.pNext, alloc, &nexts))
-			return false;
-		json_object.AddMember("pNext", nexts, alloc);
+		LOGE_LEVEL("Binary payload version mismatches.\n");
+		return false;
 	}
 
-	*out_value = json_object;
-	return true;
+	switch (ResourceTag(tag))
+	{
+	case RESOURCE_SAMPLER:
+		return parse_binary_object(reader, iface, hash, replayed_samplers,
+		                           &StateCreatorInterface::enqueue_create_sampler);
+	case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+		return parse_binary_object(reader, iface, hash, replayed_descriptor_set_layouts,
+		                           &StateCreatorInterface::enqueue_create_descriptor_set_layout);
+	case RESOURCE_PIPELINE_LAYOUT:
+		return parse_binary_object(reader, iface, hash, replayed_pipeline_layouts,
+		                           &StateCreatorInterface::enqueue_create_pipeline_layout);
+	case RESOURCE_RENDER_PASS:
+		return parse_binary_object(reader, iface, hash, replayed_render_passes,
+		                           &StateCreatorInterface::enqueue_create_render_pass);
+	case RESOURCE_COMPUTE_PIPELINE:
+		return parse_binary_object(reader, iface, hash, replayed_compute_pipelines,
+		                           &StateCreatorInterface::enqueue_create_compute_pipeline);
+	case RESOURCE_GRAPHICS_PIPELINE:
+		return parse_binary_object(reader, iface, hash, replayed_graphics_pipelines,
+		                           &StateCreatorInterface::enqueue_create_graphics_pipeline);
+	default:
+		LOGE_LEVEL("Unsupported resource tag %u in binary payload.\n", tag);
+		return false;
+	}
 }
 
-template <typename Allocator>
-static bool json_value(const VkGraphicsPipelineCreateInfo& pipe, Allocator& alloc, Value *out_value)
+struct PayloadConverter::Impl : StateCreatorInterface
 {
-	Value p(kObjectType);
-	p.AddMember("flags", pipe.flags, alloc);
-	p.AddMember("basePipelineHandle", uint64_string(api_object_cast<uint64_t>(pipe.basePipelineHandle), alloc), alloc);
-	p.AddMember("basePipelineIndex", pipe.basePipelineIndex, alloc);
-	p.AddMember("layout", uint64_string(api_object_cast<uint64_t>(pipe.layout), alloc), alloc);
-	p.AddMember("renderPass", uint64_string(api_object_cast<uint64_t>(pipe.renderPass), alloc), alloc);
-	p.AddMember("subpass", pipe.subpass, alloc);
+	StateReplayer replayer;
+	vector<uint8_t> blob;
+	unsigned captured_count = 0;
+	ResourceTag captured_tag = RESOURCE_COUNT;
+	Hash captured_hash = 0;
+	const void *captured_info = nullptr;
+
+	template <typename T, typename Handle>
+	bool capture(ResourceTag tag, Hash hash, const T *info, Handle *handle)
+	{
+		captured_count++;
+		captured_tag = tag;
+		captured_hash = hash;
+		captured_info = info;
+		// Objects are referenced by hash in every encoding, so hand the hash back as the handle.
+		*handle = api_object_cast<Handle>(uint64_t(hash));
+		return true;
+	}
 
-	if (pipe.pTessellationState)
+	bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *info, VkSampler *sampler) override
 	{
-		Value tess(kObjectType);
-		tess.AddMember("flags", pipe.pTessellationState->flags, alloc);
-		tess.AddMember("patchControlPoints", pipe.pTessellationState->patchControlPoints, alloc);
+		return capture(RESOURCE_SAMPLER, hash, info, sampler);
+	}
 
-		if (pipe.pTessellationState->pNext)
-		{
-			Value nexts;
-			if (!pnext_chain_json_value(pipe.pTessellationState->pNext, alloc, &nexts))
-				return false;
-			tess.AddMember("pNext", nexts, alloc);
-		}
+	bool enqueue_create_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo *info, VkDescriptorSetLayout *layout) override
+	{
+		return capture(RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, info, layout);
+	}
+
+	bool enqueue_create_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo *info, VkPipelineLayout *layout) override
+	{
+		return capture(RESOURCE_PIPELINE_LAYOUT, hash, info, layout);
+	}
+
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *info, VkShaderModule *module) override
+	{
+		return capture(RESOURCE_SHADER_MODULE, hash, info, module);
+	}
 
-		p.AddMember("tessellationState", tess, alloc);
+	bool enqueue_create_render_pass(Hash hash, const VkRenderPassCreateInfo *info, VkRenderPass *render_pass) override
+	{
+		return capture(RESOURCE_RENDER_PASS, hash, info, render_pass);
 	}
 
-	if (pipe.pDynamicState)
+	bool enqueue_create_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo *info, VkPipeline *pipeline) override
 	{
-		Value dyn(kObjectType);
-		dyn.AddMember("flags", pipe.pDynamicState->flags, alloc);
-		Value dynamics(kArrayType);
-		for (uint32_t i = 0; i < pipe.pDynamicState->dynamicStateCount; i++)
-			dynamics.PushBack(pipe.pDynamicState->pDynamicStates[i], alloc);
-		dyn.AddMember("dynamicState", dynamics, alloc);
-		p.AddMember("dynamicState", dyn, alloc);
+		return capture(RESOURCE_COMPUTE_PIPELINE, hash, info, pipeline);
 	}
 
-	if (pipe.pMultisampleState)
+	bool enqueue_create_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo *info, VkPipeline *pipeline) override
 	{
-		Value ms(kObjectType);
-		ms.AddMember("flags", pipe.pMultisampleState->flags, alloc);
-		ms.AddMember("rasterizationSamples", pipe.pMultisampleState->rasterizationSamples, alloc);
-		ms.AddMember("sampleShadingEnable", pipe.pMultisampleState->sampleShadingEnable, alloc);
-		ms.AddMember("minSampleShading", pipe.pMultisampleState->minSampleShading, alloc);
-		ms.AddMember("alphaToOneEnable", pipe.pMultisampleState->alphaToOneEnable, alloc);
-		ms.AddMember("alphaToCoverageEnable", pipe.pMultisampleState->alphaToCoverageEnable, alloc);
+		return capture(RESOURCE_GRAPHICS_PIPELINE, hash, info, pipeline);
+	}
 
-		Value sm(kArrayType);
-		if (pipe.pMultisampleState->pSampleMask)
+	template <typename T>
+	bool encode(PayloadEncoding encoding, const char *category)
+	{
+		auto &info = *static_cast<const T *>(captured_info);
+		if (encoding == PayloadEncoding::Binary)
+			return serialize_binary_object(blob, captured_tag, captured_hash, info);
+		else
+			return serialize_single_object(blob, category, captured_hash, info);
+	}
+
+	bool encode(PayloadEncoding encoding)
+	{
+		switch (captured_tag)
 		{
-			auto entries = uint32_t(pipe.pMultisampleState->rasterizationSamples + 31) / 32;
-			for (uint32_t i = 0; i < entries; i++)
-				sm.PushBack(pipe.pMultisampleState->pSampleMask[i], alloc);
-			ms.AddMember("sampleMask", sm, alloc);
+		case RESOURCE_SAMPLER:
+			return encode<VkSamplerCreateInfo>(encoding, "samplers");
+		case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+			return encode<VkDescriptorSetLayoutCreateInfo>(encoding, "setLayouts");
+		case RESOURCE_PIPELINE_LAYOUT:
+			return encode<VkPipelineLayoutCreateInfo>(encoding, "pipelineLayouts");
+		case RESOURCE_RENDER_PASS:
+			return encode<VkRenderPassCreateInfo>(encoding, "renderPasses");
+		case RESOURCE_COMPUTE_PIPELINE:
+			return encode<VkComputePipelineCreateInfo>(encoding, "computePipelines");
+		case RESOURCE_GRAPHICS_PIPELINE:
+			return encode<VkGraphicsPipelineCreateInfo>(encoding, "graphicsPipelines");
+		default:
+			return false;
 		}
-
-		p.AddMember("multisampleState", ms, alloc);
 	}
 
-	if (pipe.pVertexInputState)
+	bool convert(ResourceTag tag, const void *payload, size_t size, PayloadEncoding encoding)
 	{
-		Value vi(kObjectType);
-
-		Value attribs(kArrayType);
-		Value bindings(kArrayType);
-		vi.AddMember("flags", pipe.pVertexInputState->flags, alloc);
-
-		for (uint32_t i = 0; i < pipe.pVertexInputState->vertexAttributeDescriptionCount; i++)
+		switch (tag)
 		{
-			auto &a = pipe.pVertexInputState->pVertexAttributeDescriptions[i];
-			Value attrib(kObjectType);
-			attrib.AddMember("location", a.location, alloc);
-			attrib.AddMember("binding", a.binding, alloc);
-			attrib.AddMember("offset", a.offset, alloc);
-			attrib.AddMember("format", a.format, alloc);
-			attribs.PushBack(attrib, alloc);
-		}
+		case RESOURCE_SAMPLER:
+		case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+		case RESOURCE_PIPELINE_LAYOUT:
+		case RESOURCE_RENDER_PASS:
+		case RESOURCE_COMPUTE_PIPELINE:
+		case RESOURCE_GRAPHICS_PIPELINE:
+			break;
 
-		for (uint32_t i = 0; i < pipe.pVertexInputState->vertexBindingDescriptionCount; i++)
+		default:
 		{
-			auto &b = pipe.pVertexInputState->pVertexBindingDescriptions[i];
-			Value binding(kObjectType);
-			binding.AddMember("binding", b.binding, alloc);
-			binding.AddMember("stride", b.stride, alloc);
-			binding.AddMember("inputRate", b.inputRate, alloc);
-			bindings.PushBack(binding, alloc);
+			// No alternative encoding for these.
+			auto *bytes = static_cast<const uint8_t *>(payload);
+			blob.assign(bytes, bytes + size);
+			return true;
+		}
 		}
-		vi.AddMember("attributes", attribs, alloc);
-		vi.AddMember("bindings", bindings, alloc);
 
-		if (pipe.pVertexInputState->pNext)
+		captured_count = 0;
+		captured_tag = RESOURCE_COUNT;
+		captured_info = nullptr;
+		blob.clear();
+
+		bool ret = replayer.parse(*this, nullptr, payload, size);
+		if (ret && (captured_count != 1 || captured_tag != tag))
 		{
-			Value nexts;
-			if (!pnext_chain_json_value(pipe.pVertexInputState->pNext, alloc, &nexts))
-				return false;
-			vi.AddMember("pNext", nexts, alloc);
+			LOGE_LEVEL("Payload converter expected exactly one object of tag %u, got %u.\n",
+			           unsigned(tag), captured_count);
+			ret = false;
 		}
 
-		p.AddMember("vertexInputState", vi, alloc);
+		if (ret)
+			ret = encode(encoding);
+
+		replayer.get_allocator().reset();
+		return ret;
 	}
+};
 
-	if (pipe.pRasterizationState)
-	{
-		Value rs(kObjectType);
-		rs.AddMember("flags", pipe.pRasterizationState->flags, alloc);
-		rs.AddMember("depthBiasConstantFactor", pipe.pRasterizationState->depthBiasConstantFactor, alloc);
-		rs.AddMember("depthBiasSlopeFactor", pipe.pRasterizationState->depthBiasSlopeFactor, alloc);
-		rs.AddMember("depthBiasClamp", pipe.pRasterizationState->depthBiasClamp, alloc);
-		rs.AddMember("depthBiasEnable", pipe.pRasterizationState->depthBiasEnable, alloc);
-		rs.AddMember("depthClampEnable", pipe.pRasterizationState->depthClampEnable, alloc);
-		rs.AddMember("polygonMode", pipe.pRasterizationState->polygonMode, alloc);
-		rs.AddMember("rasterizerDiscardEnable", pipe.pRasterizationState->rasterizerDiscardEnable, alloc);
-		rs.AddMember("frontFace", pipe.pRasterizationState->frontFace, alloc);
-		rs.AddMember("lineWidth", pipe.pRasterizationState->lineWidth, alloc);
-		rs.AddMember("cullMode", pipe.pRasterizationState->cullMode, alloc);
+PayloadConverter::PayloadConverter()
+{
+	impl = new Impl;
+	// Keep references as hashes, shader modules and parent pipelines might not be converted yet.
+	impl->replayer.set_resolve_shader_module_handles(false);
+	impl->replayer.set_resolve_derivative_pipeline_handles(false);
+}
 
-		if (pipe.pRasterizationState->pNext)
-		{
-			Value nexts;
-			if (!pnext_chain_json_value(pipe.pRasterizationState->pNext, alloc, &nexts))
-				return false;
-			rs.AddMember("pNext", nexts, alloc);
-		}
+PayloadConverter::~PayloadConverter()
+{
+	delete impl;
+}
 
-		p.AddMember("rasterizationState", rs, alloc);
-	}
+bool PayloadConverter::convert(ResourceTag tag, const void *payload, size_t size, PayloadEncoding encoding)
+{
+	return impl->convert(tag, payload, size, encoding);
+}
 
-	if (pipe.pInputAssemblyState)
-	{
-		Value ia(kObjectType);
-		ia.AddMember("flags", pipe.pInputAssemblyState->flags, alloc);
-		ia.AddMember("topology", pipe.pInputAssemblyState->topology, alloc);
-		ia.AddMember("primitiveRestartEnable", pipe.pInputAssemblyState->primitiveRestartEnable, alloc);
-		p.AddMember("inputAssemblyState", ia, alloc);
-	}
+const void *PayloadConverter::get_data() const
+{
+	return impl->blob.data();
+}
 
-	if (pipe.pColorBlendState)
-	{
-		Value cb(kObjectType);
-		cb.AddMember("flags", pipe.pColorBlendState->flags, alloc);
-		cb.AddMember("logicOp", pipe.pColorBlendState->logicOp, alloc);
-		cb.AddMember("logicOpEnable", pipe.pColorBlendState->logicOpEnable, alloc);
-		Value blend_constants(kArrayType);
-		for (auto &c : pipe.pColorBlendState->blendConstants)
-			blend_constants.PushBack(c, alloc);
-		cb.AddMember("blendConstants", blend_constants, alloc);
-		Value attachments(kArrayType);
-		for (uint32_t i = 0; i < pipe.pColorBlendState->attachmentCount; i++)
-		{
-			auto &a = pipe.pColorBlendState->pAttachments[i];
-			Value att(kObjectType);
-			att.AddMember("dstAlphaBlendFactor", a.dstAlphaBlendFactor, alloc);
-			att.AddMember("srcAlphaBlendFactor", a.srcAlphaBlendFactor, alloc);
-			att.AddMember("dstColorBlendFactor", a.dstColorBlendFactor, alloc);
-			att.AddMember("srcColorBlendFactor", a.srcColorBlendFactor, alloc);
-			att.AddMember("colorWriteMask", a.colorWriteMask, alloc);
-			att.AddMember("alphaBlendOp", a.alphaBlendOp, alloc);
-			att.AddMember("colorBlendOp", a.colorBlendOp, alloc);
-			att.AddMember("blendEnable", a.blendEnable, alloc);
-			attachments.PushBack(att, alloc);
-		}
-		cb.AddMember("attachments", attachments, alloc);
+size_t PayloadConverter::get_size() const
+{
+	return impl->blob.size();
+}
 
-		if (pipe.pColorBlendState->pNext)
-		{
-			Value nexts;
-			if (!pnext_chain_json_value(pipe.pColorBlendState->pNext, alloc, &nexts))
-				return false;
-			cb.AddMember("pNext", nexts, alloc);
-		}
+namespace DependencyGraph
+{
+// Header is magic, version, tag of the referring object and count, followed by all hashes, then by all tags.
+enum
+{
+	EntryMagic = 0x50454446, // FDEP
+	EntryVersion = 1,
+	EntryHeaderSize = 16
+};
 
-		p.AddMember("colorBlendState", cb, alloc);
-	}
+static void add_dependency(vector<Dependency> &deps, ResourceTag tag, uint64_t hash)
+{
+	if (!hash)
+		return;
+	for (auto &dep : deps)
+		if (dep.tag == tag && dep.hash == hash)
+			return;
+	deps.push_back({ tag, hash });
+}
 
-	if (pipe.pViewportState)
+bool get_dependencies(ResourceTag tag, const void *create_info, size_t *count, Dependency *dependencies)
+{
+	vector<Dependency> deps;
+
+	switch (tag)
 	{
-		Value vp(kObjectType);
-		vp.AddMember("flags", pipe.pViewportState->flags, alloc);
-		vp.AddMember("viewportCount", pipe.pViewportState->viewportCount, alloc);
-		vp.AddMember("scissorCount", pipe.pViewportState->scissorCount, alloc);
-		if (pipe.pViewportState->pViewports)
+	case RESOURCE_DESCRIPTOR_SET_LAYOUT:
+	{
+		auto *info = static_cast<const VkDescriptorSetLayoutCreateInfo *>(create_info);
+		for (uint32_t binding = 0; binding < info->bindingCount; binding++)
 		{
-			Value viewports(kArrayType);
-			for (uint32_t i = 0; i < pipe.pViewportState->viewportCount; i++)
-			{
-				Value viewport(kObjectType);
-				viewport.AddMember("x", pipe.pViewportState->pViewports[i].x, alloc);
-				viewport.AddMember("y", pipe.pViewportState->pViewports[i].y, alloc);
-				viewport.AddMember("width", pipe.pViewportState->pViewports[i].width, alloc);
-				viewport.AddMember("height", pipe.pViewportState->pViewports[i].height, alloc);
-				viewport.AddMember("minDepth", pipe.pViewportState->pViewports[i].minDepth, alloc);
-				viewport.AddMember("maxDepth", pipe.pViewportState->pViewports[i].maxDepth, alloc);
-				viewports.PushBack(viewport, alloc);
-			}
-			vp.AddMember("viewports", viewports, alloc);
+			auto &bind = info->pBindings[binding];
+			if (bind.pImmutableSamplers)
+				for (uint32_t i = 0; i < bind.descriptorCount; i++)
+					add_dependency(deps, RESOURCE_SAMPLER, api_object_cast<uint64_t>(bind.pImmutableSamplers[i]));
 		}
+		break;
+	}
 
-		if (pipe.pViewportState->pScissors)
-		{
-			Value scissors(kArrayType);
-			for (uint32_t i = 0; i < pipe.pViewportState->scissorCount; i++)
-			{
-				Value scissor(kObjectType);
-				scissor.AddMember("x", pipe.pViewportState->pScissors[i].offset.x, alloc);
-				scissor.AddMember("y", pipe.pViewportState->pScissors[i].offset.y, alloc);
-				scissor.AddMember("width", pipe.pViewportState->pScissors[i].extent.width, alloc);
-				scissor.AddMember("height", pipe.pViewportState->pScissors[i].extent.height, alloc);
-				scissors.PushBack(scissor, alloc);
-			}
-			vp.AddMember("scissors", scissors, alloc);
-		}
-		p.AddMember("viewportState", vp, alloc);
+	case RESOURCE_PIPELINE_LAYOUT:
+	{
+		auto *info = static_cast<const VkPipelineLayoutCreateInfo *>(create_info);
+		for (uint32_t i = 0; i < info->setLayoutCount; i++)
+			add_dependency(deps, RESOURCE_DESCRIPTOR_SET_LAYOUT, api_object_cast<uint64_t>(info->pSetLayouts[i]));
+		break;
 	}
 
-	if (pipe.pDepthStencilState)
+	case RESOURCE_GRAPHICS_PIPELINE:
 	{
-		Value ds(kObjectType);
-		ds.AddMember("flags", pipe.pDepthStencilState->flags, alloc);
-		ds.AddMember("stencilTestEnable", pipe.pDepthStencilState->stencilTestEnable, alloc);
-		ds.AddMember("maxDepthBounds", pipe.pDepthStencilState->maxDepthBounds, alloc);
-		ds.AddMember("minDepthBounds", pipe.pDepthStencilState->minDepthBounds, alloc);
-		ds.AddMember("depthBoundsTestEnable", pipe.pDepthStencilState->depthBoundsTestEnable, alloc);
-		ds.AddMember("depthWriteEnable", pipe.pDepthStencilState->depthWriteEnable, alloc);
-		ds.AddMember("depthTestEnable", pipe.pDepthStencilState->depthTestEnable, alloc);
-		ds.AddMember("depthCompareOp", pipe.pDepthStencilState->depthCompareOp, alloc);
-
-		const auto serialize_stencil = [&](Value &v, const VkStencilOpState &state) {
-			v.AddMember("compareOp", state.compareOp, alloc);
-			v.AddMember("writeMask", state.writeMask, alloc);
-			v.AddMember("reference", state.reference, alloc);
-			v.AddMember("compareMask", state.compareMask, alloc);
-			v.AddMember("passOp", state.passOp, alloc);
-			v.AddMember("failOp", state.failOp, alloc);
-			v.AddMember("depthFailOp", state.depthFailOp, alloc);
-		};
-		Value front(kObjectType);
-		Value back(kObjectType);
-		serialize_stencil(front, pipe.pDepthStencilState->front);
-		serialize_stencil(back, pipe.pDepthStencilState->back);
-		ds.AddMember("front", front, alloc);
-		ds.AddMember("back", back, alloc);
-		p.AddMember("depthStencilState", ds, alloc);
-	}
-
-	Value stages(kArrayType);
-	for (uint32_t i = 0; i < pipe.stageCount; i++)
+		auto *info = static_cast<const VkGraphicsPipelineCreateInfo *>(create_info);
+		add_dependency(deps, RESOURCE_PIPELINE_LAYOUT, api_object_cast<uint64_t>(info->layout));
+		add_dependency(deps, RESOURCE_RENDER_PASS, api_object_cast<uint64_t>(info->renderPass));
+		for (uint32_t i = 0; i < info->stageCount; i++)
+			add_dependency(deps, RESOURCE_SHADER_MODULE, api_object_cast<uint64_t>(info->pStages[i].module));
+		add_dependency(deps, RESOURCE_GRAPHICS_PIPELINE, api_object_cast<uint64_t>(info->basePipelineHandle));
+		break;
+	}
+
+	case RESOURCE_COMPUTE_PIPELINE:
 	{
-		auto &s = pipe.pStages[i];
-		Value stage(kObjectType);
-		stage.AddMember("flags", s.flags, alloc);
-		stage.AddMember("name", StringRef(s.pName), alloc);
-		stage.AddMember("module", uint64_string(api_object_cast<uint64_t>(s.module), alloc), alloc);
-		stage.AddMember("stage", s.stage, alloc);
-		if (s.pSpecializationInfo)
-		{
-			Value spec(kObjectType);
-			spec.AddMember("dataSize", uint64_t(s.pSpecializationInfo->dataSize), alloc);
-			spec.AddMember("data",
-						   encode_base64(s.pSpecializationInfo->pData,
-										 s.pSpecializationInfo->dataSize), alloc);
-			Value map_entries(kArrayType);
-			for (uint32_t j = 0; j < s.pSpecializationInfo->mapEntryCount; j++)
-			{
-				auto &e = s.pSpecializationInfo->pMapEntries[j];
-				Value map_entry(kObjectType);
-				map_entry.AddMember("offset", e.offset, alloc);
-				map_entry.AddMember("size", uint64_t(e.size), alloc);
-				map_entry.AddMember("constantID", e.constantID, alloc);
-				map_entries.PushBack(map_entry, alloc);
-			}
-			spec.AddMember("mapEntries", map_entries, alloc);
-			stage.AddMember("specializationInfo", spec, alloc);
-		}
+		auto *info = static_cast<const VkComputePipelineCreateInfo *>(create_info);
+		add_dependency(deps, RESOURCE_PIPELINE_LAYOUT, api_object_cast<uint64_t>(info->layout));
+		add_dependency(deps, RESOURCE_SHADER_MODULE, api_object_cast<uint64_t>(info->stage.module));
+		add_dependency(deps, RESOURCE_COMPUTE_PIPELINE, api_object_cast<uint64_t>(info->basePipelineHandle));
+		break;
+	}
 
-		if (s.pNext)
-		{
-			Value nexts;
-			if (!pnext_chain_json_value(s.pNext, alloc, &nexts))
-				return false;
-			stage.AddMember("pNext", nexts, alloc);
-		}
+	default:
+		return false;
+	}
 
-		stages.PushBack(stage, alloc);
+	if (dependencies)
+	{
+		if (*count != deps.size())
+			return false;
+		std::copy(deps.begin(), deps.end(), dependencies);
 	}
-	p.AddMember("stages", stages, alloc);
+	else
+		*count = deps.size();
 
-	*out_value = p;
 	return true;
 }
 
-template <typename AllocType>
-static void serialize_application_info_inline(Value &value, const VkApplicationInfo &info, AllocType &alloc)
+size_t compute_entry_size(size_t count)
 {
-	if (info.pApplicationName)
-		value.AddMember("applicationName", StringRef(info.pApplicationName), alloc);
-	if (info.pEngineName)
-		value.AddMember("engineName", StringRef(info.pEngineName), alloc);
-	value.AddMember("applicationVersion", info.applicationVersion, alloc);
-	value.AddMember("engineVersion", info.engineVersion, alloc);
-	value.AddMember("apiVersion", info.apiVersion, alloc);
+	return EntryHeaderSize + count * (sizeof(uint64_t) + sizeof(uint8_t));
 }
 
-template <typename AllocType>
-static void serialize_physical_device_features_inline(Value &value, const VkPhysicalDeviceFeatures2 &features, AllocType &alloc)
+void encode_entry(ResourceTag tag, const Dependency *dependencies, size_t count, void *entry)
 {
-	// TODO: For now, we only care about this feature, which can definitely affect compilation.
-	// Deal with other device features if proven to be required.
-	value.AddMember("robustBufferAccess", features.features.robustBufferAccess, alloc);
+	auto *data = static_cast<uint8_t *>(entry);
+	const uint32_t header[4] = { EntryMagic, EntryVersion | (uint32_t(tag) << 16), uint32_t(count), 0 };
+	memcpy(data, header, sizeof(header));
+
+	uint8_t *hashes = data + EntryHeaderSize;
+	uint8_t *tags = hashes + count * sizeof(uint64_t);
+	for (size_t i = 0; i < count; i++)
+	{
+		memcpy(hashes + i * sizeof(uint64_t), &dependencies[i].hash, sizeof(uint64_t));
+		tags[i] = uint8_t(dependencies[i].tag);
+	}
 }
 
-bool StateRecorder::Impl::serialize_application_info(vector<uint8_t> &blob) const
+bool decode_entry(const void *entry, size_t size, ResourceTag *tag, size_t *count, Dependency *dependencies)
 {
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
+	auto *data = static_cast<const uint8_t *>(entry);
+	uint32_t header[4];
+	if (size < EntryHeaderSize)
+		return false;
+	memcpy(header, data, sizeof(header));
 
-	Value app_info(kObjectType);
-	Value pdf_info(kObjectType);
-	if (application_info)
-		serialize_application_info_inline(app_info, *application_info, alloc);
-	if (physical_device_features)
-		serialize_physical_device_features_inline(pdf_info, *physical_device_features, alloc);
+	if (header[0] != EntryMagic || (header[1] & 0xffff) != EntryVersion ||
+	    compute_entry_size(header[2]) != size || (header[1] >> 16) >= RESOURCE_COUNT)
+	{
+		return false;
+	}
 
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
-	doc.AddMember("applicationInfo", app_info, alloc);
-	doc.AddMember("physicalDeviceFeatures", pdf_info, alloc);
+	*tag = static_cast<ResourceTag>(header[1] >> 16);
 
-	StringBuffer buffer;
-	CustomWriter writer(buffer);
-	doc.Accept(writer);
+	if (!dependencies)
+	{
+		*count = header[2];
+		return true;
+	}
+
+	if (*count != header[2])
+		return false;
 
-	blob.resize(buffer.GetSize());
-	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
+	const uint8_t *hashes = data + EntryHeaderSize;
+	const uint8_t *tags = hashes + *count * sizeof(uint64_t);
+	for (size_t i = 0; i < *count; i++)
+	{
+		if (tags[i] >= RESOURCE_COUNT)
+			return false;
+		memcpy(&dependencies[i].hash, hashes + i * sizeof(uint64_t), sizeof(uint64_t));
+		dependencies[i].tag = static_cast<ResourceTag>(tags[i]);
+	}
+
+	return true;
+}
+}
+
+bool StateRecorder::Impl::serialize_application_info(vector<uint8_t> &blob) const
+{
+	blob.clear();
+	BlobOutputStream stream(blob);
+	CustomWriter writer(stream);
+
+	writer.StartObject();
+	json_member(writer, "version", FOSSILIZE_FORMAT_VERSION);
+	writer.Key("applicationInfo");
+	writer.StartObject();
+	if (application_info)
+		serialize_application_info_inline(writer, *application_info);
+	writer.EndObject();
+	writer.Key("physicalDeviceFeatures");
+	writer.StartObject();
+	if (physical_device_features)
+		serialize_physical_device_features_inline(writer, *physical_device_features);
+	writer.EndObject();
+	writer.EndObject();
 	return true;
 }
 
@@ -5513,14 +8656,18 @@ bool StateRecorder::Impl::register_application_link_hash(ResourceTag tag, Hash h
 {
 	PayloadWriteFlags payload_flags = 0;
 	if (checksum)
+	{
 		payload_flags |= PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+		if (checksum_algorithm == DatabaseChecksumAlgorithm::CRC32C)
+			payload_flags |= PAYLOAD_WRITE_CHECKSUM_CRC32C_BIT;
+	}
 
 	Hash link_hash = get_application_link_hash(tag, hash);
 	if (!database_iface->has_entry(RESOURCE_APPLICATION_BLOB_LINK, link_hash))
 	{
 		if (!serialize_application_blob_link(hash, tag, blob))
 			return false;
-		database_iface->write_entry(RESOURCE_APPLICATION_BLOB_LINK, link_hash, blob.data(), blob.size(), payload_flags);
+		write_database_entry(RESOURCE_APPLICATION_BLOB_LINK, link_hash, blob, payload_flags);
 		return true;
 	}
 	else
@@ -5529,216 +8676,137 @@ bool StateRecorder::Impl::register_application_link_hash(ResourceTag tag, Hash h
 
 bool StateRecorder::Impl::serialize_application_blob_link(Hash hash, ResourceTag tag, vector<uint8_t> &blob) const
 {
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
-
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
-
-	Value links(kArrayType);
-	Value link(kObjectType);
+	blob.clear();
+	BlobOutputStream stream(blob);
+	CustomWriter writer(stream);
 
 	Hasher h;
 	Hashing::hash_application_feature_info(h, application_feature_hash);
-	link.AddMember("application", uint64_string(h.get(), alloc), alloc);
-	link.AddMember("tag", uint32_t(tag), alloc);
-	link.AddMember("hash", uint64_string(hash, alloc), alloc);
-	doc.AddMember("link", link, alloc);
-
-	StringBuffer buffer;
-	CustomWriter writer(buffer);
-	doc.Accept(writer);
 
-	blob.resize(buffer.GetSize());
-	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
+	writer.StartObject();
+	json_member(writer, "version", FOSSILIZE_FORMAT_VERSION);
+	writer.Key("link");
+	writer.StartObject();
+	json_member_uint64_string(writer, "application", h.get());
+	json_member(writer, "tag", uint32_t(tag));
+	json_member_uint64_string(writer, "hash", hash);
+	writer.EndObject();
+	writer.EndObject();
 	return true;
 }
 
-bool StateRecorder::Impl::serialize_sampler(Hash hash, const VkSamplerCreateInfo &create_info, vector<uint8_t> &blob) const
+bool StateRecorder::Impl::serialize_pipeline_usage(vector<uint8_t> &blob) const
 {
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
-
-	Value value;
-	if (!json_value(create_info, alloc, &value))
-		return false;
-
-	Value serialized_samplers(kObjectType);
-	serialized_samplers.AddMember(uint64_string(hash, alloc), value, alloc);
-
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
-	doc.AddMember("samplers", serialized_samplers, alloc);
+	blob.clear();
+	BlobOutputStream stream(blob);
+	CustomWriter writer(stream);
 
-	StringBuffer buffer;
-	CustomWriter writer(buffer);
-	doc.Accept(writer);
-
-	blob.resize(buffer.GetSize());
-	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
+	writer.StartObject();
+	json_member(writer, "version", FOSSILIZE_FORMAT_VERSION);
+	writer.Key("usage");
+	writer.StartArray();
+	for (auto &usage : unwritten_pipeline_usage)
+	{
+		writer.StartObject();
+		json_member(writer, "tag", uint32_t(usage.second.tag));
+		json_member_uint64_string(writer, "hash", usage.first);
+		json_member(writer, "count", usage.second.count);
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
 	return true;
 }
 
+bool StateRecorder::Impl::serialize_sampler(Hash hash, const VkSamplerCreateInfo &create_info, vector<uint8_t> &blob) const
+{
+	if (payload_encoding == PayloadEncoding::Binary)
+		return serialize_binary_object(blob, RESOURCE_SAMPLER, hash, create_info);
+	return serialize_single_object(blob, "samplers", hash, create_info);
+}
+
 bool StateRecorder::Impl::serialize_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo &create_info,
                                                           vector<uint8_t> &blob) const
 {
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
-
-	Value value;
-	if (!json_value(create_info, alloc, &value))
-		return false;
-
-	Value layouts(kObjectType);
-	layouts.AddMember(uint64_string(hash, alloc), value, alloc);
-
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
-	doc.AddMember("setLayouts", layouts, alloc);
-
-	StringBuffer buffer;
-	CustomWriter writer(buffer);
-	doc.Accept(writer);
-
-	blob.resize(buffer.GetSize());
-	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
-	return true;
+	if (payload_encoding == PayloadEncoding::Binary)
+		return serialize_binary_object(blob, RESOURCE_DESCRIPTOR_SET_LAYOUT, hash, create_info);
+	return serialize_single_object(blob, "setLayouts", hash, create_info);
 }
 
 bool StateRecorder::Impl::serialize_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo &create_info,
                                                     vector<uint8_t> &blob) const
 {
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
-
-	Value value;
-	if (!json_value(create_info, alloc, &value))
-		return false;
-
-	Value layouts(kObjectType);
-	layouts.AddMember(uint64_string(hash, alloc), value, alloc);
-
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
-	doc.AddMember("pipelineLayouts", layouts, alloc);
-
-	StringBuffer buffer;
-	CustomWriter writer(buffer);
-	doc.Accept(writer);
-
-	blob.resize(buffer.GetSize());
-	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
-	return true;
+	if (payload_encoding == PayloadEncoding::Binary)
+		return serialize_binary_object(blob, RESOURCE_PIPELINE_LAYOUT, hash, create_info);
+	return serialize_single_object(blob, "pipelineLayouts", hash, create_info);
 }
 
 bool StateRecorder::Impl::serialize_render_pass(Hash hash, const VkRenderPassCreateInfo &create_info, vector<uint8_t> &blob) const
 {
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
-
-	Value value;
-	if (!json_value(create_info, alloc, &value))
-		return false;
-
-	Value serialized_render_passes(kObjectType);
-	serialized_render_passes.AddMember(uint64_string(hash, alloc), value, alloc);
-
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
-	doc.AddMember("renderPasses", serialized_render_passes, alloc);
-
-	StringBuffer buffer;
-	CustomWriter writer(buffer);
-	doc.Accept(writer);
-
-	blob.resize(buffer.GetSize());
-	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
-	return true;
+	if (payload_encoding == PayloadEncoding::Binary)
+		return serialize_binary_object(blob, RESOURCE_RENDER_PASS, hash, create_info);
+	return serialize_single_object(blob, "renderPasses", hash, create_info);
 }
 
 bool StateRecorder::Impl::serialize_graphics_pipeline(Hash hash, const VkGraphicsPipelineCreateInfo &create_info, vector<uint8_t> &blob) const
 {
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
-
-	Value value;
-	if (!json_value(create_info, alloc, &value))
-		return false;
-
-	Value serialized_graphics_pipelines(kObjectType);
-	serialized_graphics_pipelines.AddMember(uint64_string(hash, alloc), value, alloc);
-
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
-	doc.AddMember("graphicsPipelines", serialized_graphics_pipelines, alloc);
-
-	StringBuffer buffer;
-	CustomWriter writer(buffer);
-	doc.Accept(writer);
-
-	blob.resize(buffer.GetSize());
-	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
-	return true;
+	if (payload_encoding == PayloadEncoding::Binary)
+		return serialize_binary_object(blob, RESOURCE_GRAPHICS_PIPELINE, hash, create_info);
+	return serialize_single_object(blob, "graphicsPipelines", hash, create_info);
 }
 
 bool StateRecorder::Impl::serialize_compute_pipeline(Hash hash, const VkComputePipelineCreateInfo &create_info, vector<uint8_t> &blob) const
 {
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
-
-	Value value;
-	if (!json_value(create_info, alloc, &value))
-		return false;
-
-	Value serialized_compute_pipelines(kObjectType);
-	serialized_compute_pipelines.AddMember(uint64_string(hash, alloc), value, alloc);
-
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
-	doc.AddMember("computePipelines", serialized_compute_pipelines, alloc);
-
-	StringBuffer buffer;
-	CustomWriter writer(buffer);
-	doc.Accept(writer);
-
-	blob.resize(buffer.GetSize());
-	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
-	return true;
+	if (payload_encoding == PayloadEncoding::Binary)
+		return serialize_binary_object(blob, RESOURCE_COMPUTE_PIPELINE, hash, create_info);
+	return serialize_single_object(blob, "computePipelines", hash, create_info);
 }
 
 bool StateRecorder::Impl::serialize_shader_module(Hash hash, const VkShaderModuleCreateInfo &create_info,
                                                   vector<uint8_t> &blob, ScratchAllocator &blob_allocator) const
 {
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
+	const uint8_t *encoded = nullptr;
+	size_t size = 0;
+	bool spirv_delta_encoded = false;
 
-	Value serialized_shader_modules(kObjectType);
-
-	size_t size = compute_size_varint(create_info.pCode, create_info.codeSize / 4);
-	uint8_t *encoded = static_cast<uint8_t *>(blob_allocator.allocate_raw(size, 64));
-	encode_varint(encoded, create_info.pCode, create_info.codeSize / 4);
-
-	Value varint(kObjectType);
-	varint.AddMember("varintOffset", 0, alloc);
-	varint.AddMember("varintSize", uint64_t(size), alloc);
-	varint.AddMember("codeSize", uint64_t(create_info.codeSize), alloc);
-	varint.AddMember("flags", 0, alloc);
-
-	// Varint binary form, starts at offset 0 after the delim '\0' character.
-	serialized_shader_modules.AddMember(uint64_string(hash, alloc), varint, alloc);
-
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
-	doc.AddMember("shaderModules", serialized_shader_modules, alloc);
-
-	StringBuffer buffer;
-	CustomWriter writer(buffer);
-	doc.Accept(writer);
-
-	blob.resize(buffer.GetSize() + 1 + size);
-	memcpy(blob.data(), buffer.GetString(), buffer.GetSize());
-	blob[buffer.GetSize()] = '\0';
-	memcpy(blob.data() + buffer.GetSize() + 1, encoded, size);
+	// Falls back to plain varint if the module does not parse as SPIR-V.
+	std::vector<uint8_t> spirv_delta;
+	if (shader_module_encoding == ShaderModuleEncoding::SPIRVDelta &&
+	    encode_spirv_delta(spirv_delta, create_info.pCode, create_info.codeSize / 4))
+	{
+		encoded = spirv_delta.data();
+		size = spirv_delta.size();
+		spirv_delta_encoded = true;
+	}
+	else
+	{
+		size = compute_size_varint(create_info.pCode, create_info.codeSize / 4);
+		auto *varint_encoded = static_cast<uint8_t *>(blob_allocator.allocate_raw(size, 64));
+		encode_varint(varint_encoded, create_info.pCode, create_info.codeSize / 4);
+		encoded = varint_encoded;
+	}
+
+	blob.clear();
+	BlobOutputStream stream(blob);
+	CustomWriter writer(stream);
+
+	writer.StartObject();
+	json_member(writer, "version", FOSSILIZE_FORMAT_VERSION);
+	writer.Key("shaderModules");
+	writer.StartObject();
+	json_key_uint64_string(writer, hash);
+	writer.StartObject();
+	json_member(writer, spirv_delta_encoded ? "spirvOffset" : "varintOffset", 0);
+	json_member(writer, spirv_delta_encoded ? "spirvSize" : "varintSize", uint64_t(size));
+	json_member(writer, "codeSize", uint64_t(create_info.codeSize));
+	json_member(writer, "flags", 0);
+	writer.EndObject();
+	writer.EndObject();
+	writer.EndObject();
+
+	// Binary form, starts at offset 0 after the delim '\0' character.
+	blob.push_back('\0');
+	blob.insert(blob.end(), encoded, encoded + size);
 	return true;
 }
 
@@ -5749,90 +8817,53 @@ bool StateRecorder::serialize(uint8_t **serialized_data, size_t *serialized_size
 
 	impl->sync_thread();
 
-	Document doc;
-	doc.SetObject();
-	auto &alloc = doc.GetAllocator();
-
-	doc.AddMember("version", FOSSILIZE_FORMAT_VERSION, alloc);
+	StringBuffer buffer;
+	PrettyWriter<StringBuffer> writer(buffer);
 
-	Value app_info(kObjectType);
-	Value pdf_info(kObjectType);
-	Value value;
+	writer.StartObject();
+	json_member(writer, "version", FOSSILIZE_FORMAT_VERSION);
 
+	writer.Key("applicationInfo");
+	writer.StartObject();
 	if (impl->application_info)
-		serialize_application_info_inline(app_info, *impl->application_info, alloc);
-	if (impl->physical_device_features)
-		serialize_physical_device_features_inline(pdf_info, *impl->physical_device_features, alloc);
-
-	doc.AddMember("applicationInfo", app_info, alloc);
-	doc.AddMember("physicalDeviceFeatures", pdf_info, alloc);
-
-	Value samplers(kObjectType);
-	for (auto &sampler : impl->samplers)
-	{
-		if (!json_value(*sampler.second, alloc, &value))
-			return false;
-		samplers.AddMember(uint64_string(sampler.first, alloc), value, alloc);
-	}
-	doc.AddMember("samplers", samplers, alloc);
-
-	Value set_layouts(kObjectType);
-	for (auto &layout : impl->descriptor_sets)
-	{
-		if (!json_value(*layout.second, alloc, &value))
-			return false;
-		set_layouts.AddMember(uint64_string(layout.first, alloc), value, alloc);
-	}
-	doc.AddMember("setLayouts", set_layouts, alloc);
+		serialize_application_info_inline(writer, *impl->application_info);
+	writer.EndObject();
 
-	Value pipeline_layouts(kObjectType);
-	for (auto &layout : impl->pipeline_layouts)
-	{
-		if (!json_value(*layout.second, alloc, &value))
-			return false;
-		pipeline_layouts.AddMember(uint64_string(layout.first, alloc), value, alloc);
-	}
-	doc.AddMember("pipelineLayouts", pipeline_layouts, alloc);
-
-	Value shader_modules(kObjectType);
-	for (auto &module : impl->shader_modules)
-	{
-		if (!json_value(*module.second, alloc, &value))
-			return false;
-		shader_modules.AddMember(uint64_string(module.first, alloc), value, alloc);
-	}
-	doc.AddMember("shaderModules", shader_modules, alloc);
-
-	Value render_passes(kObjectType);
-	for (auto &pass : impl->render_passes)
-	{
-		if (!json_value(*pass.second, alloc, &value))
-			return false;
-		render_passes.AddMember(uint64_string(pass.first, alloc), value, alloc);
-	}
-	doc.AddMember("renderPasses", render_passes, alloc);
+	writer.Key("physicalDeviceFeatures");
+	writer.StartObject();
+	if (impl->physical_device_features)
+		serialize_physical_device_features_inline(writer, *impl->physical_device_features);
+	writer.EndObject();
 
-	Value compute_pipelines(kObjectType);
-	for (auto &pipe : impl->compute_pipelines)
-	{
-		if (!json_value(*pipe.second, alloc, &value))
-			return false;
-		compute_pipelines.AddMember(uint64_string(pipe.first, alloc), value, alloc);
-	}
-	doc.AddMember("computePipelines", compute_pipelines, alloc);
+	const auto serialize_objects = [&](const char *category, const auto &objects) -> bool {
+		writer.Key(category);
+		writer.StartObject();
+		for (auto &obj : objects)
+		{
+			json_key_uint64_string(writer, obj.first);
+			if (!json_value(*obj.second, writer))
+				return false;
+		}
+		writer.EndObject();
+		return true;
+	};
 
-	Value graphics_pipelines(kObjectType);
-	for (auto &pipe : impl->graphics_pipelines)
-	{
-		if (!json_value(*pipe.second, alloc, &value))
-			return false;
-		graphics_pipelines.AddMember(uint64_string(pipe.first, alloc), value, alloc);
-	}
-	doc.AddMember("graphicsPipelines", graphics_pipelines, alloc);
+	if (!serialize_objects("samplers", impl->samplers))
+		return false;
+	if (!serialize_objects("setLayouts", impl->descriptor_sets))
+		return false;
+	if (!serialize_objects("pipelineLayouts", impl->pipeline_layouts))
+		return false;
+	if (!serialize_objects("shaderModules", impl->shader_modules))
+		return false;
+	if (!serialize_objects("renderPasses", impl->render_passes))
+		return false;
+	if (!serialize_objects("computePipelines", impl->compute_pipelines))
+		return false;
+	if (!serialize_objects("graphicsPipelines", impl->graphics_pipelines))
+		return false;
 
-	StringBuffer buffer;
-	PrettyWriter<StringBuffer> writer(buffer);
-	doc.Accept(writer);
+	writer.EndObject();
 
 	*serialized_size = buffer.GetSize();
 	*serialized_data = new uint8_t[buffer.GetSize()];
@@ -42,6 +42,8 @@ class ScratchAllocator
 {
 public:
 	ScratchAllocator();
+	// Memory is carved out of blocks of at least minimum_block_size bytes. Default is 64 KiB.
+	explicit ScratchAllocator(size_t minimum_block_size);
 	~ScratchAllocator();
 
 	// alignof(T) doesn't work on MSVC 2013.
@@ -76,8 +78,33 @@ public:
 	void *allocate_raw(size_t size, size_t alignment);
 	void *allocate_raw_cleared(size_t size, size_t alignment);
 
+	// Makes all memory available again. Blocks are kept for reuse, up to the peak memory consumption
+	// seen so far and at most set_max_retained_size() bytes.
 	void reset();
 	size_t get_peak_memory_consumption() const;
+	// Bytes handed out since the last reset(), including alignment padding.
+	size_t get_current_usage() const;
+
+	// Limits how many bytes of blocks reset() keeps around. Default is no limit beyond the peak consumption, 0 frees all blocks.
+	void set_max_retained_size(size_t size);
+	// Blocks of at least size bytes are backed by transparent huge pages where supported. Default is 0, which disables it.
+	void set_huge_page_threshold(size_t size);
+
+	struct Statistics
+	{
+		// Blocks allocated from the system, and blocks reused after a reset(), since the allocator was created.
+		size_t block_allocations;
+		size_t block_reuses;
+		size_t allocated_bytes;
+		size_t reused_bytes;
+		// Bytes held by blocks in use or retained for reuse.
+		size_t retained_bytes;
+	};
+	Statistics get_statistics() const;
+
+	// Bytes held by the blocks of all ScratchAllocators in the process, in use or retained for reuse.
+	// Can be called from any thread.
+	static size_t get_process_memory_usage();
 
 	// Disable copies (and moves).
 	ScratchAllocator(const ScratchAllocator &) = delete;
@@ -115,6 +142,10 @@ public:
 	                                          ResourceTag /*blob_tag*/,
 	                                          Hash /*blob_hash*/) {}
 
+	// Called when parsing blobs of type RESOURCE_PIPELINE_USAGE.
+	// A pipeline can appear in any number of these blobs, and its bind counts add up.
+	virtual void notify_pipeline_usage(ResourceTag /*pipeline_tag*/, Hash /*pipeline_hash*/, uint64_t /*bind_count*/) {}
+
 	virtual bool enqueue_create_sampler(Hash hash, const VkSamplerCreateInfo *create_info, VkSampler *sampler) = 0;
 	virtual bool enqueue_create_descriptor_set_layout(Hash hash, const VkDescriptorSetLayoutCreateInfo *create_info, VkDescriptorSetLayout *layout) = 0;
 	virtual bool enqueue_create_pipeline_layout(Hash hash, const VkPipelineLayoutCreateInfo *create_info, VkPipelineLayout *layout) = 0;
@@ -135,6 +166,15 @@ public:
 	virtual void notify_replayed_resources_for_type() {}
 };
 
+// Selects the parser StateReplayer uses for JSON payloads. Both build the same document,
+// so replay results do not depend on the backend.
+// Simdjson requires building with FOSSILIZE_SIMDJSON, and is the default if so.
+enum class JsonParseBackend
+{
+	RapidJSON,
+	Simdjson
+};
+
 class StateReplayer
 {
 public:
@@ -142,6 +182,12 @@ public:
 	~StateReplayer();
 	bool parse(StateCreatorInterface &iface, DatabaseInterface *database, const void *buffer, size_t size) FOSSILIZE_WARN_UNUSED;
 
+	// Same as parse(), but the payload is parsed in place and strings are not copied out of it.
+	// buffer must have room for size + 1 bytes; the JSON part and the byte following the payload
+	// may be overwritten, so the buffer contents are unspecified afterwards.
+	// Nothing parsed refers back into buffer once this returns.
+	bool parse_insitu(StateCreatorInterface &iface, DatabaseInterface *database, void *buffer, size_t size) FOSSILIZE_WARN_UNUSED;
+
 	// Default is true. If true, the replayer will make sure the derivative pipeline handles provided to
 	// the API is a correct VkPipeline. If false, pipelines with VK_PIPELINE_CREATE_DERIVATIVE_BIT will have its basePipelineHandle
 	// set to the hash of the pipeline. It is up to the caller to resolve this hash to a real pipeline later.
@@ -153,11 +199,27 @@ public:
 	// It is up to the application to overwrite the correct VkShaderModule later.
 	void set_resolve_shader_module_handles(bool enable);
 
+	// Default is false. If true, samplers, descriptor set layouts, pipeline layouts and render passes which have not been
+	// replayed yet are read from the database on first reference and replayed with the same StateCreatorInterface.
+	// This lets pipelines be parsed without replaying every trivial object up front.
+	// Entries are read with PAYLOAD_READ_CONCURRENT_BIT, so several StateReplayers can share a database.
+	void set_resolve_trivial_object_handles(bool enable);
+
+	// Returns false and keeps the current backend if this build does not support the requested one.
+	bool set_json_parse_backend(JsonParseBackend backend);
+
 	// Lets other StateReplayers have the same references to objects.
 	void copy_handle_references(const StateReplayer &replayer);
 
+	// Adds the references of another StateReplayer, keeping the ones this replayer already has.
+	// Lets objects be parsed by several StateReplayers in parallel and gathered afterwards.
+	void merge_handle_references(const StateReplayer &replayer);
+
 	void forget_handle_references();
 
+	// Bytes held by the document pool which is reused between JSON parses. Must not be called while parsing.
+	size_t get_parse_buffer_memory_usage() const;
+
 	ScratchAllocator &get_allocator();
 
 	// Disable copies (and moves).
@@ -169,6 +231,99 @@ private:
 	Impl *impl;
 };
 
+enum class DatabaseCompressionAlgorithm
+{
+	Deflate,
+	Zstd,
+	LZ4
+};
+
+enum class DatabaseChecksumAlgorithm
+{
+	CRC32,
+	CRC32C
+};
+
+enum class ShaderModuleEncoding
+{
+	// Every SPIR-V word is stored as a varint.
+	Varint,
+	// Opcodes and operands are stored in separate streams, and operands are delta coded.
+	// Compresses considerably better, but requires FOSSILIZE_FORMAT_VERSION 7 to replay.
+	SPIRVDelta
+};
+
+// Selects how create infos other than shader modules are encoded in database payloads.
+// JSON is the interchange and debugging format.
+// Binary is a compact field-by-field encoding which replays without any JSON parsing.
+// Shader modules, application info and application links are always stored as JSON.
+// fossilize-convert-db can re-encode existing archives in either direction.
+enum class PayloadEncoding
+{
+	JSON,
+	Binary
+};
+
+// Selects how bulk data like SPIR-V and specialization constants is hashed.
+// FNV1A is the classic scheme, XXH64 requires FOSSILIZE_FORMAT_VERSION 7.
+// Hashes of the two schemes are unrelated, so use fossilize-rehash to migrate existing archives.
+enum class HashAlgorithm
+{
+	FNV1A,
+	XXH64
+};
+
+// Selects what happens when recording threads outpace the recording thread.
+// Objects waiting for the recording thread are held in a fixed number of slots, see set_record_queue_mode().
+enum class RecordQueueMode
+{
+	// Objects which do not fit in a slot spill into a locked queue without limit.
+	Unbounded,
+	// Recording threads wait until the recording thread frees up a slot.
+	Block,
+	// Objects which do not fit in a slot are discarded and counted.
+	// Objects referring to a discarded object will fail to record as well.
+	Drop
+};
+
+// See StateRecorder::get_statistics().
+struct RecorderStatistics
+{
+	enum { LatencyBucketCount = 32 };
+
+	// Time spent in StateRecorder::record_*() on the calling thread, by tag of the recorded object.
+	// Bucket i counts calls which took [2^i, 2^(i+1)) ns, the last bucket also counts anything slower.
+	struct Latency
+	{
+		uint64_t count;
+		uint64_t total_ns;
+		uint64_t max_ns;
+		uint64_t buckets[LatencyBucketCount];
+	};
+	Latency record_latency[RESOURCE_COUNT];
+
+	// Bytes copied by calling threads to keep create infos alive for the recording thread.
+	uint64_t bytes_copied;
+	// Most objects which were waiting for the recording thread at once.
+	uint64_t queue_high_water_mark;
+	// Peak memory of the allocator which holds objects retained by the recorder.
+	uint64_t allocator_peak_bytes;
+
+	// Entries the recording thread wrote to the database, and the time spent in DatabaseInterface::write_entry().
+	uint64_t database_entries_written;
+	uint64_t database_bytes_written;
+	uint64_t database_write_ns;
+
+	// From DatabaseInterface::get_compression_statistics() of the database being recorded to.
+	uint64_t compressed_payloads;
+	uint64_t compression_input_bytes;
+	uint64_t compression_output_bytes;
+	uint64_t compression_ns;
+
+	// Payloads written uncompressed because the queue was backed up, see set_database_adaptive_compression().
+	uint64_t uncompressed_backlog_payloads;
+};
+
 struct StateRecorderApplicationFeatureHash
 {
 	Hash application_info_hash = 0;
@@ -185,6 +340,59 @@ public:
 	// Call before init_recording_thread.
 	void set_database_enable_compression(bool enable);
 	void set_database_enable_checksum(bool enable);
+	// Only meaningful if compression is enabled.
+	// Algorithms which are not supported by the build fall back to Deflate.
+	void set_database_compression_algorithm(DatabaseCompressionAlgorithm algorithm);
+	// Only meaningful if compression is enabled. Call before init_recording_thread.
+	// Once backlog objects are waiting for the recording thread, payloads are written uncompressed
+	// until the queue has drained to half of that, so a burst of objects does not stall on compression.
+	// fossilize-convert-db can compress such entries later. Default is 0, i.e. always compress.
+	void set_database_adaptive_compression(uint32_t backlog);
+	// Only meaningful if checksums are enabled.
+	void set_database_checksum_algorithm(DatabaseChecksumAlgorithm algorithm);
+	void set_database_shader_module_encoding(ShaderModuleEncoding encoding);
+	void set_database_payload_encoding(PayloadEncoding encoding);
+	// Must be set before anything is recorded, as it affects the hash of shader modules and pipelines.
+	void set_hash_algorithm(HashAlgorithm algorithm);
+	// Must be set before anything is recorded. capacity is rounded up to a power of two.
+	// Default is Unbounded with 256 slots.
+	void set_record_queue_mode(RecordQueueMode mode, uint32_t capacity);
+	// Number of objects discarded by RecordQueueMode::Drop so far.
+	uint64_t get_dropped_record_count() const;
+	// Call before init_recording_thread. Objects are still hashed in order on the recording thread,
+	// but up to count worker threads serialize them for the database. Entries are written in the same order
+	// as without workers. Default is 0, i.e. no workers.
+	void set_serialization_worker_count(unsigned count);
+	// Lets shader modules, samplers and render passes be hashed on the calling thread once the database is prepared,
+	// so that objects the database already held from a prior session are not copied or queued at all.
+	// Layouts and pipelines depend on other objects for their hash, so this only applies to them
+	// when they are recorded with a custom hash, which is always checked. Default is off.
+	void set_skip_prior_objects(bool enable);
+	// Checks whether the database passed to init_recording_thread() held this object when it was prepared.
+	// Can be called from any thread. Returns false until the recording thread has prepared the database.
+	bool has_prior_object(ResourceTag tag, Hash hash) const;
+	// Call before recording anything. Collects RecorderStatistics, which costs two clock reads
+	// and a few relaxed atomic adds per recorded object. Default is off.
+	void set_statistics_enabled(bool enable);
+	// Can be called from any thread while recording. Returns false if statistics are not enabled.
+	bool get_statistics(RecorderStatistics *stats) const;
+	// Call before init_recording_thread. Writes a RESOURCE_DEPENDENCY_GRAPH entry along with
+	// every layout and pipeline which refers to other objects. Default is off.
+	void set_record_dependency_graph(bool enable);
+	// Resets graphics pipeline state the driver ignores before hashing, e.g. blend factors of attachments
+	// with blending disabled, stencil ops with the stencil test off, or viewports which are dynamic.
+	// Pipelines which only differ in such state then share one hash and one database entry.
+	// Pipelines recorded with a custom hash keep it. Call before recording anything. Default is off.
+	void set_canonicalize_pipeline_state(bool enable);
+	// Call before init_recording_thread. If disabled, the recording thread no longer flushes the database
+	// once it has been idle for a second, only when request_database_flush() is called and on teardown.
+	// Together with a DatabaseAsyncWritePolicy without flush interval, entries then stay in memory
+	// until the batch is full or the application reaches a point where it is fine to touch the disk. Default is on.
+	void set_database_flush_on_idle(bool enable);
+	// Can be called from any thread. The recording thread flushes the database once it has written
+	// everything recorded before this call. Objects still being serialized by workers are flushed later.
+	void request_database_flush();
+	HashAlgorithm get_hash_algorithm() const;
 
 	// These methods should only be called at the very beginning of the application lifetime.
 	// It will affect the hash of all create info structures.
@@ -216,6 +424,13 @@ public:
 	bool record_sampler(VkSampler sampler, const VkSamplerCreateInfo &create_info,
 	                    Hash custom_hash = 0) FOSSILIZE_WARN_UNUSED;
 
+	// Adds bind_count binds of a pipeline recorded earlier with record_graphics_pipeline() or
+	// record_compute_pipeline(), as given by tag. Can be called from any thread, but takes a lock,
+	// so batch up counts rather than calling this for every bind.
+	// Counts are only kept with a recording thread and a database. The recording thread writes them
+	// as RESOURCE_PIPELINE_USAGE entries at most every 30 seconds, and when recording ends.
+	void record_pipeline_usage(ResourceTag tag, VkPipeline pipeline, uint64_t bind_count);
+
 	// Used by hashing functions in Hashing namespace. Should be considered an implementation detail.
 	bool get_hash_for_descriptor_set_layout(VkDescriptorSetLayout layout, Hash *hash) const FOSSILIZE_WARN_UNUSED;
 	bool get_hash_for_pipeline_layout(VkPipelineLayout layout, Hash *hash) const FOSSILIZE_WARN_UNUSED;
@@ -257,6 +472,56 @@ private:
 	Impl *impl;
 };
 
+// Re-encodes single database payloads between PayloadEncodings.
+// Objects refer to their dependencies by hash, and those dependencies must have been converted
+// by the same PayloadConverter first, so feed payloads in increasing ResourceTag order.
+// Payloads of types which only have a JSON encoding are passed through untouched.
+class PayloadConverter
+{
+public:
+	PayloadConverter();
+	~PayloadConverter();
+
+	bool convert(ResourceTag tag, const void *payload, size_t size, PayloadEncoding encoding) FOSSILIZE_WARN_UNUSED;
+
+	// Result of the last successful convert(). Valid until the next call to convert().
+	const void *get_data() const;
+	size_t get_size() const;
+
+	// Disable copies (and moves).
+	PayloadConverter(const PayloadConverter &) = delete;
+	void operator=(const PayloadConverter &) = delete;
+
+private:
+	struct Impl;
+	Impl *impl;
+};
+
+// RESOURCE_DEPENDENCY_GRAPH entries list the objects another object refers to directly, in a compact binary form,
+// so that tools can walk from pipelines to modules and layouts without parsing any JSON.
+// Every descriptor set layout, pipeline layout and pipeline gets an entry keyed by its hash, even if it refers to nothing,
+// so a missing entry means the graph is incomplete, e.g. because only some sessions recorded it.
+// Referenced objects might not be in the database, e.g. shader modules of a pruned archive.
+namespace DependencyGraph
+{
+struct Dependency
+{
+	ResourceTag tag;
+	Hash hash;
+};
+
+// create_info must refer to other objects by hash instead of by handle, like the objects a StateReplayer
+// hands to a StateCreatorInterface which returns hashes as handles, with shader module and derivative pipeline
+// resolution disabled. Duplicates are only listed once. If dependencies is nullptr, only the count is returned.
+// Returns false for types which get no entry.
+bool get_dependencies(ResourceTag tag, const void *create_info, size_t *count, Dependency *dependencies) FOSSILIZE_WARN_UNUSED;
+
+size_t compute_entry_size(size_t count);
+void encode_entry(ResourceTag tag, const Dependency *dependencies, size_t count, void *entry);
+// tag receives the type of the object the entry belongs to. If dependencies is nullptr, only the count is returned.
+bool decode_entry(const void *entry, size_t size, ResourceTag *tag, size_t *count, Dependency *dependencies) FOSSILIZE_WARN_UNUSED;
+}
+
 namespace Hashing
 {
 // Computes a base hash which can be used to compute some other hashes without having to create a full StateRecorder.
@@ -266,8 +531,14 @@ StateRecorderApplicationFeatureHash compute_application_feature_hash(const VkApp
 
 Hash compute_combined_application_feature_hash(const StateRecorderApplicationFeatureHash &base_hash);
 
+// Hash of the RESOURCE_APPLICATION_BLOB_LINK entry which records that the blob tag/hash was seen for an application,
+// where application_feature_hash is the combined hash above.
+// Looking this up with has_entry() tells whether a blob belongs to an application without parsing any link blobs.
+Hash compute_hash_application_info_link(Hash application_feature_hash, ResourceTag tag, Hash hash);
+
 // Shader modules, samplers and render passes are standalone modules, so they can be hashed in isolation.
-bool compute_hash_shader_module(const VkShaderModuleCreateInfo &create_info, Hash *hash);
+bool compute_hash_shader_module(const VkShaderModuleCreateInfo &create_info, Hash *hash,
+                                HashAlgorithm algorithm = HashAlgorithm::FNV1A);
 bool compute_hash_sampler(const VkSamplerCreateInfo &create_info, Hash *hash);
 bool compute_hash_render_pass(const VkRenderPassCreateInfo &create_info, Hash *hash);
 
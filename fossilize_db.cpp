@@ -29,19 +29,42 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
 #include <fcntl.h>
 #endif
 
 #include "fossilize_db.hpp"
 #include "path.hpp"
+#include "crc32c.hpp"
+#include "xxhash64.hpp"
 #include "layer/utils.hpp"
+#include "util/flat_hash_map.hpp"
+#include "util/object_cache.hpp"
 #include "miniz.h"
+#ifdef FOSSILIZE_HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+#ifdef FOSSILIZE_HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
 #include <memory>
-#include <mutex>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <chrono>
+#include <climits>
 #include <dirent.h>
 
 #include "fossilize_inttypes.h"
@@ -58,27 +81,6 @@ static_assert(FOSSILIZE_BLOB_HASH_LENGTH >= 32, "Blob hash length must be at lea
 
 namespace Fossilize
 {
-class ConditionalLockGuard
-{
-public:
-	ConditionalLockGuard(std::mutex &lock_, bool enable_)
-		: lock(lock_), enable(enable_)
-	{
-		if (enable)
-			lock.lock();
-	}
-
-	~ConditionalLockGuard()
-	{
-		if (enable)
-			lock.unlock();
-	}
-
-private:
-	std::mutex &lock;
-	bool enable;
-};
-
 struct PayloadHeader
 {
 	uint32_t payload_size;
@@ -110,6 +112,10 @@ static_assert(sizeof(ExportedMetadataList) % 8 == 0, "Alignment of ExportedMetad
 // Only for sanity checking when importing blobs, not a true file format.
 static const uint64_t ExportedMetadataMagic = 0xb10bf05511153ull;
 static const uint64_t ExportedMetadataMagicConcurrent = 0xb10b5f05511153ull;
+// Follows the concurrent block. Lists hold bloom filters for the concurrent hashes, and the count is in filter blocks.
+static const uint64_t ExportedMetadataMagicConcurrentFilter = 0xb10b5f0551115full;
+// Like ExportedMetadataMagic, but the header is followed by ExportedMetadataPerfectHashLists.
+static const uint64_t ExportedMetadataMagicPerfectHash = 0xb10bf0551115full;
 
 struct ExportedMetadataHeader
 {
@@ -119,24 +125,238 @@ struct ExportedMetadataHeader
 };
 static_assert(sizeof(ExportedMetadataHeader) % 8 == 0, "Alignment of ExportedMetadataHeader must be 8.");
 
+// Perfect hash tables over the sorted blocks of each list, see HashPerfectHashTable.
+// The count is in buckets. A list with a count of 0 has no table and is binary searched instead.
+struct ExportedMetadataPerfectHashLists
+{
+	ExportedMetadataList lists[RESOURCE_COUNT];
+};
+static_assert(sizeof(ExportedMetadataPerfectHashLists) % 8 == 0, "Alignment of ExportedMetadataPerfectHashLists must be 8.");
+
+// Blocked bloom filter over hashes, used to quickly reject lookups for entries we do not have.
+// Each hash maps to a single 64-byte block, so a test touches only one cache line.
+// A filter is a plain array of words, so it can live in shared memory as exported metadata.
+struct HashBloomFilter
+{
+	enum { BlockWords = 8, BlockBits = BlockWords * 64, BitsPerHash = 12, ProbeCount = 6 };
+
+	// Roughly 1-2% false positives depending on how the block count rounds.
+	static size_t compute_block_count(size_t hash_count)
+	{
+		if (!hash_count)
+			return 0;
+
+		size_t block_count = 1;
+		while (block_count * BlockBits < hash_count * BitsPerHash)
+			block_count *= 2;
+		return block_count;
+	}
+
+	static uint64_t mix(uint64_t hash)
+	{
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		hash *= 0xc4ceb9fe1a85ec53ull;
+		hash ^= hash >> 33;
+		return hash;
+	}
+
+	static void insert(uint64_t *words, size_t block_count, Hash hash)
+	{
+		uint64_t block_hash = mix(hash);
+		uint64_t bit_hash = mix(block_hash);
+		uint64_t *block = words + (block_hash & (block_count - 1)) * BlockWords;
+
+		for (unsigned i = 0; i < ProbeCount; i++, bit_hash >>= 9)
+		{
+			unsigned bit = unsigned(bit_hash & (BlockBits - 1));
+			block[bit >> 6] |= 1ull << (bit & 63);
+		}
+	}
+
+	// Returns false if hash is definitely not in the filter.
+	static bool test(const uint64_t *words, size_t block_count, Hash hash)
+	{
+		if (!block_count)
+			return false;
+
+		uint64_t block_hash = mix(hash);
+		uint64_t bit_hash = mix(block_hash);
+		const uint64_t *block = words + (block_hash & (block_count - 1)) * BlockWords;
+
+		for (unsigned i = 0; i < ProbeCount; i++, bit_hash >>= 9)
+		{
+			unsigned bit = unsigned(bit_hash & (BlockBits - 1));
+			if ((block[bit >> 6] & (1ull << (bit & 63))) == 0)
+				return false;
+		}
+
+		return true;
+	}
+
+	static void build(std::vector<uint64_t> &words, const Hash *hashes, size_t hash_count)
+	{
+		size_t block_count = compute_block_count(hash_count);
+		words.assign(block_count * BlockWords, 0);
+		for (size_t i = 0; i < hash_count; i++)
+			insert(words.data(), block_count, hashes[i]);
+	}
+};
+
+// PTHash-style minimal perfect hash over a sorted list of blocks.
+// Hashes are split into buckets, and every bucket gets a pilot value which moves all its hashes into free slots
+// of a table with exactly one slot per block. A slot holds the index of its block in the sorted list,
+// so a lookup reads one pilot and one slot instead of doing a binary search with a cache miss per step.
+// The table is a plain array of pilots followed by slots, so it can live in shared memory as exported metadata.
+struct HashPerfectHashTable
+{
+	// Binary searching small lists is cheap enough, since the upper levels of the search stay in cache.
+	enum { MinBlockCount = 4096, BlocksPerBucket = 3, MaxPilotTriesPerBlock = 256 };
+
+	static size_t compute_bucket_count(size_t block_count)
+	{
+		if (block_count < MinBlockCount || block_count >= UINT32_MAX)
+			return 0;
+		return (block_count + BlocksPerBucket - 1) / BlocksPerBucket;
+	}
+
+	static size_t compute_size(size_t block_count)
+	{
+		size_t bucket_count = compute_bucket_count(block_count);
+		if (!bucket_count)
+			return 0;
+		return ((bucket_count + block_count) * sizeof(uint32_t) + 7) & ~size_t(7);
+	}
+
+	// 60% of hashes go to 30% of the buckets. Placing the big buckets first while the table is mostly empty
+	// keeps pilot searches short, even with no spare slots.
+	static size_t get_bucket(uint64_t key, size_t bucket_count)
+	{
+		size_t dense_bucket_count = bucket_count * 3 / 10;
+		if ((key >> 32) < 0x9999999aull)
+			return size_t(key % dense_bucket_count);
+		else
+			return dense_bucket_count + size_t(key % (bucket_count - dense_bucket_count));
+	}
+
+	static size_t get_slot(uint64_t key, uint32_t pilot, size_t block_count)
+	{
+		return size_t(HashBloomFilter::mix(key ^ (pilot * 0x9e3779b97f4a7c15ull)) % block_count);
+	}
+
+	// Returns the index of the only block which can hold hash. The caller still has to compare hashes.
+	static size_t lookup(const uint32_t *table, size_t bucket_count, size_t block_count, Hash hash)
+	{
+		uint64_t key = HashBloomFilter::mix(hash);
+		uint32_t pilot = table[get_bucket(key, bucket_count)];
+		return table[bucket_count + get_slot(key, pilot, block_count)];
+	}
+
+	// Hashes in blocks must be unique. Returns false if pilot search takes too long,
+	// in which case the list should be binary searched instead.
+	static bool build(uint32_t *table, size_t bucket_count, const ExportedMetadataBlock *blocks, size_t block_count)
+	{
+		std::vector<uint64_t> keys(block_count);
+		std::vector<uint32_t> bucket_offsets(bucket_count + 1);
+		for (size_t i = 0; i < block_count; i++)
+		{
+			keys[i] = HashBloomFilter::mix(blocks[i].hash);
+			bucket_offsets[get_bucket(keys[i], bucket_count) + 1]++;
+		}
+
+		for (size_t i = 0; i < bucket_count; i++)
+			bucket_offsets[i + 1] += bucket_offsets[i];
+
+		std::vector<uint32_t> bucket_blocks(block_count);
+		{
+			std::vector<uint32_t> fill_offsets(bucket_offsets.begin(), bucket_offsets.end() - 1);
+			for (size_t i = 0; i < block_count; i++)
+				bucket_blocks[fill_offsets[get_bucket(keys[i], bucket_count)]++] = uint32_t(i);
+		}
+
+		std::vector<uint32_t> bucket_order(bucket_count);
+		for (size_t i = 0; i < bucket_count; i++)
+			bucket_order[i] = uint32_t(i);
+		std::stable_sort(bucket_order.begin(), bucket_order.end(), [&](uint32_t a, uint32_t b) {
+			return bucket_offsets[a + 1] - bucket_offsets[a] > bucket_offsets[b + 1] - bucket_offsets[b];
+		});
+
+		uint32_t *pilots = table;
+		uint32_t *slots = table + bucket_count;
+		std::fill(pilots, pilots + bucket_count, 0u);
+
+		// Most pilots are rejected, and a bitmap of taken slots stays in cache far better than the slots themselves.
+		std::vector<uint64_t> taken((block_count + 63) / 64);
+		const auto is_taken = [&](size_t slot) { return (taken[slot >> 6] & (1ull << (slot & 63))) != 0; };
+
+		uint64_t tries_left = uint64_t(block_count) * MaxPilotTriesPerBlock;
+		std::vector<size_t> bucket_slots;
+
+		for (uint32_t bucket : bucket_order)
+		{
+			uint32_t begin = bucket_offsets[bucket];
+			uint32_t end = bucket_offsets[bucket + 1];
+
+			// Empty buckets are sorted last.
+			if (begin == end)
+				break;
+
+			for (uint32_t pilot = 0;; pilot++)
+			{
+				if (!tries_left--)
+					return false;
+
+				bucket_slots.clear();
+				bool free_slots = true;
+				for (uint32_t i = begin; i < end && free_slots; i++)
+				{
+					size_t slot = get_slot(keys[bucket_blocks[i]], pilot, block_count);
+					free_slots = !is_taken(slot) &&
+					             std::find(bucket_slots.begin(), bucket_slots.end(), slot) == bucket_slots.end();
+					bucket_slots.push_back(slot);
+				}
+
+				if (free_slots)
+				{
+					for (uint32_t i = begin; i < end; i++)
+					{
+						size_t slot = bucket_slots[i - begin];
+						slots[slot] = bucket_blocks[i];
+						taken[slot >> 6] |= 1ull << (slot & 63);
+					}
+					pilots[bucket] = pilot;
+					break;
+				}
+			}
+		}
+
+		return true;
+	}
+};
+
 struct DatabaseInterface::Impl
 {
 	std::unique_ptr<DatabaseInterface> whitelist;
 	std::unique_ptr<DatabaseInterface> blacklist;
 	std::vector<unsigned> sub_databases_in_whitelist;
 	std::unordered_set<Hash> implicit_whitelisted[RESOURCE_COUNT];
+	// Used instead of copying hashes into implicit_whitelisted when the sub-database can expose its own table.
+	std::vector<DatabaseHashView> implicit_whitelisted_views[RESOURCE_COUNT];
 	DatabaseMode mode;
 	uint32_t whitelist_tag_mask = (1u << RESOURCE_SHADER_MODULE) |
 	                              (1u << RESOURCE_GRAPHICS_PIPELINE) |
 	                              (1u << RESOURCE_COMPUTE_PIPELINE);
 
 	const ExportedMetadataHeader *imported_concurrent_metadata = nullptr;
+	const ExportedMetadataHeader *imported_concurrent_filters = nullptr;
 
 	std::vector<const ExportedMetadataHeader *> imported_metadata;
 	const uint8_t *mapped_metadata = nullptr;
 	size_t mapped_metadata_size = 0;
 
 	bool parse_imported_metadata(const void *data, size_t size);
+	bool is_implicitly_whitelisted(ResourceTag tag, Hash hash) const;
 };
 
 DatabaseInterface::DatabaseInterface(DatabaseMode mode)
@@ -155,6 +375,69 @@ DatabaseInterface *DatabaseInterface::get_sub_database(unsigned)
 	return nullptr;
 }
 
+bool DatabaseInterface::read_entry_zero_copy(ResourceTag, Hash, size_t *, const void **, PayloadReadFlags)
+{
+	return false;
+}
+
+bool DatabaseInterface::prefetch_entries(ResourceTag, const Hash *, size_t)
+{
+	return false;
+}
+
+bool DatabaseInterface::get_entry_storage_offset(ResourceTag, Hash, uint64_t *)
+{
+	return false;
+}
+
+bool DatabaseInterface::add_compression_dictionary(ResourceTag, const void *, size_t)
+{
+	return false;
+}
+
+bool DatabaseInterface::set_async_write_policy(const DatabaseAsyncWritePolicy &)
+{
+	return false;
+}
+
+bool DatabaseInterface::has_prior_entry(ResourceTag, Hash) const
+{
+	return false;
+}
+
+bool DatabaseInterface::get_hash_view_for_resource_tag(ResourceTag, DatabaseHashView *)
+{
+	return false;
+}
+
+bool DatabaseHashView::contains(Hash hash) const
+{
+	size_t lo = 0;
+	size_t hi = count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		Hash h = (*this)[mid];
+		if (h == hash)
+			return true;
+		else if (h < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return false;
+}
+
+size_t DatabaseInterface::get_lookup_memory_usage() const
+{
+	return 0;
+}
+
+void DatabaseInterface::get_compression_statistics(DatabaseCompressionStatistics *stats) const
+{
+	*stats = {};
+}
+
 void DatabaseInterface::set_whitelist_tag_mask(uint32_t mask)
 {
 	impl->whitelist_tag_mask = mask;
@@ -224,6 +507,14 @@ bool DatabaseInterface::add_to_implicit_whitelist(DatabaseInterface &iface)
 	size_t size = 0;
 
 	const auto promote = [&](ResourceTag tag) -> bool {
+		DatabaseHashView view;
+		if (iface.get_hash_view_for_resource_tag(tag, &view))
+		{
+			if (!view.empty())
+				impl->implicit_whitelisted_views[tag].push_back(view);
+			return true;
+		}
+
 		if (!iface.get_hash_list_for_resource_tag(tag, &size, nullptr))
 			return false;
 		hashes.resize(size);
@@ -256,11 +547,23 @@ DatabaseInterface::~DatabaseInterface()
 	delete impl;
 }
 
+bool DatabaseInterface::Impl::is_implicitly_whitelisted(ResourceTag tag, Hash hash) const
+{
+	if (implicit_whitelisted[tag].count(hash) != 0)
+		return true;
+
+	for (auto &view : implicit_whitelisted_views[tag])
+		if (view.contains(hash))
+			return true;
+
+	return false;
+}
+
 bool DatabaseInterface::test_resource_filter(ResourceTag tag, Hash hash) const
 {
 	if ((impl->whitelist_tag_mask & (1u << tag)) != 0 &&
 	    impl->whitelist &&
-	    impl->implicit_whitelisted[tag].count(hash) == 0 &&
+	    !impl->is_implicitly_whitelisted(tag, hash) &&
 	    !impl->whitelist->has_entry(tag, hash))
 	{
 		return false;
@@ -398,7 +701,8 @@ static size_t deduce_imported_size(const void *mapped, size_t maximum_size)
 		auto *header = reinterpret_cast<const ExportedMetadataHeader *>(static_cast<const uint8_t *>(mapped) + total_size);
 		if (header->size + total_size > maximum_size)
 			break;
-		if (header->magic != ExportedMetadataMagic && header->magic != ExportedMetadataMagicConcurrent)
+		if (header->magic != ExportedMetadataMagic && header->magic != ExportedMetadataMagicConcurrent &&
+		    header->magic != ExportedMetadataMagicConcurrentFilter && header->magic != ExportedMetadataMagicPerfectHash)
 			break;
 		total_size += header->size;
 	}
@@ -418,10 +722,28 @@ bool DatabaseInterface::Impl::parse_imported_metadata(const void *data_, size_t
 		return false;
 
 	auto *concurrent_header = reinterpret_cast<const ExportedMetadataHeader *>(data);
+	const ExportedMetadataHeader *filter_header = nullptr;
 	if (concurrent_header->magic == ExportedMetadataMagicConcurrent)
 	{
 		data += concurrent_header->size;
 		size -= concurrent_header->size;
+
+		// Bloom filters are optional.
+		if (size >= sizeof(ExportedMetadataHeader) &&
+		    reinterpret_cast<const ExportedMetadataHeader *>(data)->magic == ExportedMetadataMagicConcurrentFilter)
+		{
+			filter_header = reinterpret_cast<const ExportedMetadataHeader *>(data);
+			for (auto &list : filter_header->lists)
+			{
+				if (list.offset + list.count * HashBloomFilter::BlockWords * sizeof(uint64_t) > filter_header->size)
+					return false;
+				if (list.count & (list.count - 1))
+					return false;
+			}
+
+			data += filter_header->size;
+			size -= filter_header->size;
+		}
 	}
 	else
 		concurrent_header = nullptr;
@@ -432,7 +754,7 @@ bool DatabaseInterface::Impl::parse_imported_metadata(const void *data_, size_t
 			return false;
 
 		auto *header = reinterpret_cast<const ExportedMetadataHeader *>(data);
-		if (header->magic != ExportedMetadataMagic)
+		if (header->magic != ExportedMetadataMagic && header->magic != ExportedMetadataMagicPerfectHash)
 			return false;
 		if (header->size > size)
 			return false;
@@ -441,6 +763,24 @@ bool DatabaseInterface::Impl::parse_imported_metadata(const void *data_, size_t
 			if (list.offset + list.count * sizeof(ExportedMetadataBlock) > size)
 				return false;
 
+		if (header->magic == ExportedMetadataMagicPerfectHash)
+		{
+			if (sizeof(ExportedMetadataHeader) + sizeof(ExportedMetadataPerfectHashLists) > header->size)
+				return false;
+
+			auto *perfect_hash = reinterpret_cast<const ExportedMetadataPerfectHashLists *>(header + 1);
+			for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
+			{
+				auto &list = perfect_hash->lists[tag];
+				if (list.count == 0)
+					continue;
+				if (list.count != HashPerfectHashTable::compute_bucket_count(header->lists[tag].count))
+					return false;
+				if (list.offset + HashPerfectHashTable::compute_size(header->lists[tag].count) > header->size)
+					return false;
+			}
+		}
+
 		data += header->size;
 		size -= header->size;
 		headers.push_back(header);
@@ -457,6 +797,7 @@ bool DatabaseInterface::Impl::parse_imported_metadata(const void *data_, size_t
 	mapped_metadata_size = size_;
 	imported_metadata = std::move(headers);
 	imported_concurrent_metadata = concurrent_header;
+	imported_concurrent_filters = filter_header;
 	return true;
 }
 
@@ -512,19 +853,133 @@ bool DatabaseInterface::import_metadata_from_os_handle(intptr_t handle)
 #endif
 }
 
+// Reads at an absolute file offset without going through the stdio cursor.
+static bool read_file_at(FILE *file, void *data, size_t size, uint64_t offset)
+{
+	auto *ptr = static_cast<uint8_t *>(data);
+
+#ifdef _WIN32
+	HANDLE file_handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)));
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	while (size)
+	{
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = DWORD(offset & 0xffffffffu);
+		overlapped.OffsetHigh = DWORD(offset >> 32);
+
+		DWORD to_read = DWORD(std::min<size_t>(size, 0x40000000u));
+		DWORD did_read = 0;
+		if (!ReadFile(file_handle, ptr, to_read, &did_read, &overlapped) || did_read == 0)
+			return false;
+
+		ptr += did_read;
+		offset += did_read;
+		size -= did_read;
+	}
+#else
+	int fd = fileno(file);
+	while (size)
+	{
+		ssize_t ret = pread(fd, ptr, size, off_t(offset));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+
+		ptr += ret;
+		offset += uint64_t(ret);
+		size -= size_t(ret);
+	}
+#endif
+
+	return true;
+}
+
+/* The folder database stores every entry as its own file.
+ * To keep directories small, entries are sharded by the two top bytes of the hash:
+ *     base/hh/hh/tt.hhhhhhhhhhhhhhhh.json
+ * Entries in the older flat layout, directly in base/, can still be read. */
 struct DumbDirectoryDatabase : DatabaseInterface
 {
-	DumbDirectoryDatabase(const string &base, DatabaseMode mode_)
-		: DatabaseInterface(mode_), base_directory(base), mode(mode_)
+	enum { MaxOpenFiles = 64 };
+
+	DumbDirectoryDatabase(const string &base, DatabaseMode mode_, unsigned num_scan_threads_)
+		: DatabaseInterface(mode_), base_directory(base), mode(mode_), num_scan_threads(num_scan_threads_)
 	{
 		if (mode == DatabaseMode::ExclusiveOverWrite)
 			mode = DatabaseMode::OverWrite;
+		if (num_scan_threads == 0)
+			num_scan_threads = std::max(1u, std::thread::hardware_concurrency());
+		open_files.set_target_size(MaxOpenFiles);
+	}
+
+	~DumbDirectoryDatabase()
+	{
+		open_files.delete_cache([](Hash, CachedFile *cached_file) { delete cached_file; });
 	}
 
 	void flush() override
 	{
 	}
 
+	struct ScannedEntry
+	{
+		ResourceTag tag;
+		Hash hash;
+	};
+
+	static bool parse_entry_name(const char *name, ScannedEntry &entry)
+	{
+		unsigned tag;
+		uint64_t value;
+		if (sscanf(name, "%x.%" SCNx64 ".json", &tag, &value) != 2)
+			return false;
+		if (tag >= RESOURCE_COUNT)
+			return false;
+
+		entry.tag = static_cast<ResourceTag>(tag);
+		entry.hash = value;
+		return true;
+	}
+
+	static bool parse_shard_name(const char *name, unsigned *shard)
+	{
+		if (strlen(name) != 2 || !isxdigit(uint8_t(name[0])) || !isxdigit(uint8_t(name[1])))
+			return false;
+		*shard = unsigned(strtoul(name, nullptr, 16));
+		return true;
+	}
+
+	// Lists entry files in dir, or shard directories if subdirs is non-null.
+	static void scan_directory(const string &dir, std::vector<ScannedEntry> &entries, std::vector<string> *subdirs)
+	{
+		DIR *dp = opendir(dir.c_str());
+		if (!dp)
+			return;
+
+		while (auto *pEntry = readdir(dp))
+		{
+			unsigned shard;
+			ScannedEntry entry;
+			if (pEntry->d_type == DT_REG && parse_entry_name(pEntry->d_name, entry))
+				entries.push_back(entry);
+			else if (subdirs && pEntry->d_type == DT_DIR && parse_shard_name(pEntry->d_name, &shard))
+				subdirs->push_back(Path::join(dir, pEntry->d_name));
+		}
+
+		closedir(dp);
+	}
+
+	static void scan_shard(const string &dir, std::vector<ScannedEntry> &entries)
+	{
+		std::vector<string> subdirs;
+		scan_directory(dir, entries, &subdirs);
+		for (auto &subdir : subdirs)
+			scan_directory(subdir, entries, nullptr);
+	}
+
 	bool prepare() override
 	{
 		if (mode == DatabaseMode::OverWrite)
@@ -533,25 +988,48 @@ struct DumbDirectoryDatabase : DatabaseInterface
 		DIR *dp = opendir(base_directory.c_str());
 		if (!dp)
 			return false;
+		closedir(dp);
 
-		while (auto *pEntry = readdir(dp))
+		std::vector<ScannedEntry> flat_entries;
+		std::vector<string> shards;
+		scan_directory(base_directory, flat_entries, &shards);
+
+		// With many entries, most of the time is spent waiting for the file system, so scan shards in parallel.
+		unsigned thread_count = unsigned(std::min<size_t>(num_scan_threads, shards.size()));
+		std::vector<std::vector<ScannedEntry>> shard_entries(std::max(1u, thread_count));
+		if (thread_count > 1)
 		{
-			if (pEntry->d_type != DT_REG)
-				continue;
+			std::atomic<size_t> next_shard(0);
+			std::vector<std::thread> workers;
+			for (unsigned i = 0; i < thread_count; i++)
+			{
+				workers.emplace_back([&, i]() {
+					size_t shard;
+					while ((shard = next_shard.fetch_add(1, std::memory_order_relaxed)) < shards.size())
+						scan_shard(shards[shard], shard_entries[i]);
+				});
+			}
 
-			unsigned tag;
-			uint64_t value;
-			if (sscanf(pEntry->d_name, "%x.%" SCNx64 ".json", &tag, &value) != 2)
-				continue;
+			for (auto &worker : workers)
+				worker.join();
+		}
+		else
+		{
+			for (auto &shard : shards)
+				scan_shard(shard, shard_entries.front());
+		}
 
-			if (tag >= RESOURCE_COUNT)
-				continue;
+		for (auto &entries : shard_entries)
+			for (auto &entry : entries)
+				if (test_resource_filter(entry.tag, entry.hash))
+					seen_blobs[entry.tag].insert(entry.hash);
 
-			if (test_resource_filter(static_cast<ResourceTag>(tag), value))
-				seen_blobs[tag].insert(value);
+		for (auto &entry : flat_entries)
+		{
+			if (test_resource_filter(entry.tag, entry.hash) && seen_blobs[entry.tag].insert(entry.hash).second)
+				flat_blobs[entry.tag].insert(entry.hash);
 		}
 
-		closedir(dp);
 		return true;
 	}
 
@@ -562,63 +1040,155 @@ struct DumbDirectoryDatabase : DatabaseInterface
 		return seen_blobs[tag].count(hash) != 0;
 	}
 
-	bool read_entry(ResourceTag tag, Hash hash, size_t *blob_size, void *blob, PayloadReadFlags flags) override
+	static string get_shard_directory(const string &base, Hash hash, unsigned level)
 	{
-		if ((flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0)
-			return false;
+		char shard[3];
+		sprintf(shard, "%02x", unsigned(hash >> 56));
+		auto dir = Path::join(base, shard);
+		if (level > 1)
+		{
+			sprintf(shard, "%02x", unsigned((hash >> 48) & 0xff));
+			dir = Path::join(dir, shard);
+		}
+		return dir;
+	}
 
-		if (mode != DatabaseMode::ReadOnly)
-			return false;
+	string get_entry_path(ResourceTag tag, Hash hash) const
+	{
+		char filename[25]; // 2 digits + "." + 16 digits + ".json" + null
+		sprintf(filename, "%02x.%016" PRIx64 ".json", static_cast<unsigned>(tag), hash);
+		if (flat_blobs[tag].count(hash))
+			return Path::join(base_directory, filename);
+		else
+			return Path::join(get_shard_directory(base_directory, hash, 2), filename);
+	}
 
-		if (!has_entry(tag, hash))
-			return false;
+	static bool make_directory(const string &path)
+	{
+#ifdef _WIN32
+		if (CreateDirectoryA(path.c_str(), nullptr) || GetLastError() == ERROR_ALREADY_EXISTS)
+			return true;
+#else
+		if (mkdir(path.c_str(), 0777) == 0 || errno == EEXIST)
+			return true;
+#endif
+		LOGE_LEVEL("Failed to create directory: %s\n", path.c_str());
+		return false;
+	}
 
-		if (!blob_size)
+	bool make_shard_directories(Hash hash)
+	{
+		unsigned shard = unsigned(hash >> 48);
+		if (created_shards.count(shard))
+			return true;
+
+		// Create the base directory as well if this is the very first entry.
+		if ((created_shards.empty() && !make_directory(base_directory)) ||
+		    !make_directory(get_shard_directory(base_directory, hash, 1)) ||
+		    !make_directory(get_shard_directory(base_directory, hash, 2)))
 			return false;
 
-		char filename[25]; // 2 digits + "." + 16 digits + ".json" + null
-		sprintf(filename, "%02x.%016" PRIx64 ".json", static_cast<unsigned>(tag), hash);
-		auto path = Path::join(base_directory, filename);
+		created_shards.insert(shard);
+		return true;
+	}
+
+	// Replayers query the size of an entry before reading it, so keep recently used files open.
+	struct OpenFile
+	{
+		~OpenFile()
+		{
+			fclose(file);
+		}
+
+		FILE *file;
+		size_t size;
+		ResourceTag tag;
+		Hash hash;
+		std::mutex lock;
+	};
+
+	// Readers hold on to the file while reading, even if it is concurrently evicted from the cache.
+	struct CachedFile
+	{
+		std::shared_ptr<OpenFile> file;
+	};
+
+	static Hash get_open_file_key(ResourceTag tag, Hash hash)
+	{
+		return hash ^ (Hash(tag) * 0x9e3779b97f4a7c15ull);
+	}
+
+	std::shared_ptr<OpenFile> open_entry(ResourceTag tag, Hash hash)
+	{
+		Hash key = get_open_file_key(tag, hash);
+		{
+			std::lock_guard<std::mutex> holder(open_files_lock);
+			auto cached = open_files.find_object(key);
+			if (cached.second && cached.first->file->tag == tag && cached.first->file->hash == hash)
+				return cached.first->file;
+		}
 
+		auto path = get_entry_path(tag, hash);
 		FILE *file = fopen(path.c_str(), "rb");
 		if (!file)
 		{
 			LOGE_LEVEL("Failed to open file: %s\n", path.c_str());
-			return false;
+			return {};
 		}
 
 		if (fseek(file, 0, SEEK_END) < 0)
 		{
 			fclose(file);
 			LOGE_LEVEL("Failed to seek in file: %s\n", path.c_str());
-			return false;
+			return {};
 		}
 
-		size_t file_size = size_t(ftell(file));
-		rewind(file);
+		std::shared_ptr<OpenFile> open_file(new OpenFile);
+		open_file->file = file;
+		open_file->size = size_t(ftell(file));
+		open_file->tag = tag;
+		open_file->hash = hash;
 
-		if (blob)
+		std::lock_guard<std::mutex> holder(open_files_lock);
+		auto cached = open_files.find_object(key);
+		if (!cached.second)
 		{
-			if (*blob_size != file_size)
-			{
-				fclose(file);
-				return false;
-			}
+			open_files.insert_object(key, new CachedFile{ open_file }, 1);
+			open_files.prune_cache([](Hash, CachedFile *cached_file) { delete cached_file; });
 		}
-		else
-			*blob_size = file_size;
+		return open_file;
+	}
 
-		if (blob)
+	bool read_entry(ResourceTag tag, Hash hash, size_t *blob_size, void *blob, PayloadReadFlags flags) override
+	{
+		if ((flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0)
+			return false;
+
+		if (mode != DatabaseMode::ReadOnly)
+			return false;
+
+		if (!has_entry(tag, hash))
+			return false;
+
+		if (!blob_size)
+			return false;
+
+		auto open_file = open_entry(tag, hash);
+		if (!open_file)
+			return false;
+
+		if (!blob)
 		{
-			if (fread(blob, 1, file_size, file) != file_size)
-			{
-				fclose(file);
-				return false;
-			}
+			*blob_size = open_file->size;
+			return true;
 		}
 
-		fclose(file);
-		return true;
+		if (*blob_size != open_file->size)
+			return false;
+
+		std::lock_guard<std::mutex> holder(open_file->lock);
+		rewind(open_file->file);
+		return fread(blob, 1, open_file->size, open_file->file) == open_file->size;
 	}
 
 	bool write_entry(ResourceTag tag, Hash hash, const void *blob, size_t size, PayloadWriteFlags flags) override
@@ -632,9 +1202,10 @@ struct DumbDirectoryDatabase : DatabaseInterface
 		if (has_entry(tag, hash))
 			return true;
 
-		char filename[25]; // 2 digits + "." + 16 digits + ".json" + null
-		sprintf(filename, "%02x.%016" PRIx64 ".json", static_cast<unsigned>(tag), hash);
-		auto path = Path::join(base_directory, filename);
+		if (!make_shard_directories(hash))
+			return false;
+
+		auto path = get_entry_path(tag, hash);
 
 		FILE *file = fopen(path.c_str(), "wb");
 		if (!file)
@@ -651,6 +1222,7 @@ struct DumbDirectoryDatabase : DatabaseInterface
 		}
 
 		fclose(file);
+		seen_blobs[tag].insert(hash);
 		return true;
 	}
 
@@ -687,17 +1259,32 @@ struct DumbDirectoryDatabase : DatabaseInterface
 
 	string base_directory;
 	DatabaseMode mode;
+	unsigned num_scan_threads;
 	unordered_set<Hash> seen_blobs[RESOURCE_COUNT];
+	unordered_set<Hash> flat_blobs[RESOURCE_COUNT];
+	unordered_set<unsigned> created_shards;
+	ObjectCache<CachedFile *> open_files;
+	std::mutex open_files_lock;
 };
 
-DatabaseInterface *create_dumb_folder_database(const char *directory_path, DatabaseMode mode)
+DatabaseInterface *create_dumb_folder_database(const char *directory_path, DatabaseMode mode, unsigned num_scan_threads)
 {
-	auto *db = new DumbDirectoryDatabase(directory_path, mode);
+	auto *db = new DumbDirectoryDatabase(directory_path, mode, num_scan_threads);
 	return db;
 }
 
 struct ZipDatabase : DatabaseInterface
 {
+	struct Entry
+	{
+		unsigned index;
+		size_t size;
+		uint64_t local_header_offset;
+		uint64_t compressed_size;
+		uint32_t crc;
+		unsigned method;
+	};
+
 	ZipDatabase(const string &path_, DatabaseMode mode_)
 		: DatabaseInterface(mode_), path(path_), mode(mode_)
 	{
@@ -708,6 +1295,9 @@ struct ZipDatabase : DatabaseInterface
 
 	~ZipDatabase()
 	{
+		if (file)
+			fclose(file);
+
 		if (alive)
 		{
 			if (mode != DatabaseMode::ReadOnly)
@@ -772,12 +1362,27 @@ struct ZipDatabase : DatabaseInterface
 				uint64_t value = strtoull(value_str, nullptr, 16);
 
 				if (test_resource_filter(static_cast<ResourceTag>(tag), value))
-					seen_blobs[tag].emplace(value, Entry{i, size_t(s.m_uncomp_size)});
+				{
+					seen_blobs[tag].emplace(value, Entry{i, size_t(s.m_uncomp_size), s.m_local_header_ofs,
+					                                     s.m_comp_size, s.m_crc32, s.m_method});
+				}
 			}
 
-			// In-place update the archive. Should we consider emitting a new archive instead?
-			if (!mz_zip_writer_init_from_reader(&mz, path.c_str()))
+			if (mode == DatabaseMode::ReadOnly)
+			{
+				// Entries are read straight from the file with the offsets from the central directory,
+				// so reads do not have to go through the shared miniz state.
+				file = fopen(path.c_str(), "rb");
+				if (!file)
+				{
+					LOGE_LEVEL("Failed to open ZIP archive for reading.\n");
+					mz_zip_end(&mz);
+					return false;
+				}
+			}
+			else if (!mz_zip_writer_init_from_reader(&mz, path.c_str()))
 			{
+				// In-place update the archive. Should we consider emitting a new archive instead?
 				LOGE_LEVEL("Failed to initialize ZIP writer from reader.\n");
 				mz_zip_end(&mz);
 				return false;
@@ -825,18 +1430,59 @@ struct ZipDatabase : DatabaseInterface
 		else
 			*blob_size = itr->second.size;
 
-		if (blob)
+		if (blob && !extract_entry(itr->second, static_cast<uint8_t *>(blob)))
 		{
-			if (!mz_zip_reader_extract_to_mem(&mz, itr->second.index, blob, itr->second.size, 0))
-			{
-				LOGE_LEVEL("Failed to extract blob.\n");
-				return false;
-			}
+			LOGE_LEVEL("Failed to extract blob.\n");
+			return false;
 		}
 
 		return true;
 	}
 
+	enum
+	{
+		LocalHeaderSignature = 0x04034b50,
+		LocalHeaderSize = 30,
+		LocalHeaderFilenameLengthOffset = 26,
+		LocalHeaderExtraLengthOffset = 28
+	};
+
+	// Every call uses its own inflate state and positional reads, so entries can be extracted concurrently.
+	bool extract_entry(const Entry &entry, uint8_t *blob) const
+	{
+		uint8_t header[LocalHeaderSize];
+		if (!read_file_at(file, header, sizeof(header), entry.local_header_offset))
+			return false;
+
+		const auto read_u16 = [&](unsigned offset) { return unsigned(header[offset]) | (unsigned(header[offset + 1]) << 8); };
+		uint32_t signature = read_u16(0) | (uint32_t(read_u16(2)) << 16);
+		if (signature != LocalHeaderSignature)
+			return false;
+
+		uint64_t data_offset = entry.local_header_offset + LocalHeaderSize +
+		                       read_u16(LocalHeaderFilenameLengthOffset) + read_u16(LocalHeaderExtraLengthOffset);
+
+		if (entry.method == 0)
+		{
+			if (entry.compressed_size != entry.size || !read_file_at(file, blob, entry.size, data_offset))
+				return false;
+		}
+		else if (entry.method == MZ_DEFLATED)
+		{
+			static thread_local std::vector<uint8_t> compressed;
+			compressed.resize(entry.compressed_size);
+			if (!read_file_at(file, compressed.data(), compressed.size(), data_offset))
+				return false;
+
+			if (tinfl_decompress_mem_to_mem(blob, entry.size, compressed.data(), compressed.size(), 0) != entry.size)
+				return false;
+		}
+		else
+			return false;
+
+		return uint32_t(mz_crc32(MZ_CRC32_INIT, blob, entry.size)) == entry.crc;
+	}
+
 	bool write_entry(ResourceTag tag, Hash hash, const void *blob, size_t size, PayloadWriteFlags flags) override
 	{
 		if ((flags & PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT) != 0)
@@ -872,7 +1518,7 @@ struct ZipDatabase : DatabaseInterface
 
 		// The index is irrelevant, we're not going to read from this archive any time soon.
 		if (test_resource_filter(static_cast<ResourceTag>(tag), hash))
-			seen_blobs[tag].emplace(hash, Entry{~0u, size});
+			seen_blobs[tag].emplace(hash, Entry{~0u, size, 0, 0, 0, 0});
 		return true;
 	}
 
@@ -917,13 +1563,8 @@ struct ZipDatabase : DatabaseInterface
 	string path;
 	mz_zip_archive mz;
 
-	struct Entry
-	{
-		unsigned index;
-		size_t size;
-	};
-
 	unordered_map<Hash, Entry> seen_blobs[RESOURCE_COUNT];
+	FILE *file = nullptr;
 	DatabaseMode mode;
 	bool alive = false;
 };
@@ -966,12 +1607,55 @@ DatabaseInterface *create_zip_archive_database(const char *path, DatabaseMode mo
  * The flags field must contain one of:
  *     0x1: No compression.
  *     0x2: Deflate compression.
+ *     0x3: Zstandard compression.
+ *     0x4: LZ4 block compression.
+ *     0x5: Zstandard compression using the archive's dictionary for the tag of the entry.
+ *
+ * The flags field may additionally contain:
+ *     0x100: crc32 is a CRC32C (Castagnoli) checksum instead of a zlib CRC32 checksum.
  *
  * Entries should have a unique tag and hash combination. Implementations may
  * ignore duplicated tag and hash combinations.
  *
  * It is acceptable for the last entry to be truncated. In this case, that
  * entry should be ignored.
+ *
+ *
+ * Optionally, writers append an index entry when an archive is closed.
+ * It uses the tag 0xffffffff, which is out of range for any resource tag,
+ * so readers which are unaware of the index will skip it like any unknown entry.
+ * The index entry is uncompressed and has the following payload:
+ *
+ * Field           Type                              Description
+ * -----           ----                              -----------
+ * magic           uint64_t                          Constant value: 0xf055111de4b10bull
+ * version         uint32_t                          Index version: 1
+ * tag_count       uint32_t                          Number of tag lists which follow.
+ * counts          uint64_t[tag_count]               Number of index blocks for each tag.
+ * blocks          block[sum(counts)]                Index blocks for each tag in order, sorted by hash.
+ * index_offset    uint64_t                          File offset of the index entry itself.
+ * magic           uint64_t                          Same as the first magic.
+ *
+ * Each block is as follows:
+ *
+ * Field           Type                              Description
+ * -----           ----                              -----------
+ * hash            uint64_t                          Hash of the entry.
+ * offset          uint64_t                          File offset of the payload of the entry.
+ * stored_size     uint32_t                          Same as stored_size of the entry.
+ * flags           uint32_t                          Same as flags of the entry.
+ * crc32           uint32_t                          Same as crc32 of the entry.
+ * payload_size    uint32_t                          Same as payload_size of the entry.
+ *
+ * The index is only valid if it is the last entry in the file.
+ * If entries are appended by a writer which is not aware of the index,
+ * readers must fall back to scanning all entries.
+ *
+ *
+ * Compression dictionaries are stored as uncompressed entries with the tag 0xfffffffe,
+ * where the hash holds the resource tag the dictionary applies to.
+ * Dictionary entries must be placed right after the file header, before any other entry.
+ * There can be at most one dictionary per resource tag.
  */
 
 static const uint8_t stream_reference_magic_and_version[16] = {
@@ -982,10 +1666,26 @@ static const uint8_t stream_reference_magic_and_version[16] = {
 	FOSSILIZE_FORMAT_VERSION,
 };
 
+static const uint64_t stream_index_magic = 0xf055111de4b10bull;
+static const uint32_t stream_index_version = 1;
+static const uint32_t stream_index_tag = 0xffffffffu;
+static const uint32_t stream_dictionary_tag = 0xfffffffeu;
+
 struct StreamArchive : DatabaseInterface
 {
 	enum { MagicSize = sizeof(stream_reference_magic_and_version) };
-	enum { FOSSILIZE_COMPRESSION_NONE = 1, FOSSILIZE_COMPRESSION_DEFLATE = 2 };
+	enum
+	{
+		FOSSILIZE_COMPRESSION_NONE = 1,
+		FOSSILIZE_COMPRESSION_DEFLATE = 2,
+		FOSSILIZE_COMPRESSION_ZSTD = 3,
+		FOSSILIZE_COMPRESSION_LZ4 = 4,
+		FOSSILIZE_COMPRESSION_ZSTD_DICTIONARY = 5,
+		FOSSILIZE_COMPRESSION_MASK = 0xff,
+
+		FOSSILIZE_CHECKSUM_CRC32C_BIT = 0x100
+	};
+	enum { IndexHeaderSize = 16, IndexBlockSize = 32, IndexTrailerSize = 16 };
 
 	struct PayloadHeaderRaw
 	{
@@ -998,6 +1698,77 @@ struct StreamArchive : DatabaseInterface
 		PayloadHeader header;
 	};
 
+	// Scratch state for compressing payloads. Every thread which compresses needs its own.
+	struct CompressionContext
+	{
+		~CompressionContext()
+		{
+			free(buffer);
+#ifdef FOSSILIZE_HAVE_ZSTD
+			ZSTD_freeCCtx(zstd_cctx);
+#endif
+		}
+
+		bool reserve(size_t size)
+		{
+			if (buffer_size >= size)
+				return true;
+
+			// Contents do not need to be preserved.
+			free(buffer);
+			buffer = static_cast<uint8_t *>(malloc(size));
+			buffer_size = buffer ? size : 0;
+			return buffer != nullptr;
+		}
+
+		uint8_t *buffer = nullptr;
+		size_t buffer_size = 0;
+#ifdef FOSSILIZE_HAVE_ZSTD
+		ZSTD_CCtx *zstd_cctx = nullptr;
+#endif
+	};
+
+	// State for set_async_write_policy().
+	// Compression workers turn jobs into encoded entries in batch, and the writer thread writes out batches.
+	// While asynchronous writes are active, only the writer thread touches the file and write_offset.
+	struct AsyncWriter
+	{
+		struct Job
+		{
+			ResourceTag tag;
+			Hash hash;
+			PayloadWriteFlags flags;
+			std::vector<uint8_t> data;
+		};
+
+		struct PendingEntry
+		{
+			ResourceTag tag;
+			Hash hash;
+			// Relative to the start of the batch until the batch has been written.
+			uint64_t offset;
+			PayloadHeader header;
+		};
+
+		DatabaseAsyncWritePolicy policy;
+		std::mutex lock;
+		std::condition_variable job_cond;
+		std::condition_variable batch_cond;
+		std::condition_variable space_cond;
+		std::deque<Job> jobs;
+		std::vector<uint8_t> batch;
+		std::vector<PendingEntry> batch_entries;
+		std::vector<PendingEntry> written_entries;
+		std::vector<std::pair<ResourceTag, Hash>> dropped_entries;
+		size_t queued_bytes = 0;
+		bool flush_requested = false;
+		bool stop_workers = false;
+		bool stop_writer = false;
+		bool write_failed = false;
+		std::vector<std::thread> workers;
+		std::thread writer;
+	};
+
 	StreamArchive(const string &path_, DatabaseMode mode_)
 		: DatabaseInterface(mode_), path(path_), mode(mode_)
 	{
@@ -1005,17 +1776,122 @@ struct StreamArchive : DatabaseInterface
 
 	~StreamArchive()
 	{
+		if (async_writer && async_writer->writer.joinable())
+			stop_async_writes();
+
+		if (file && alive && index_dirty && mode != DatabaseMode::ReadOnly)
+			if (!write_index())
+				LOGW_LEVEL("Failed to write index to archive, it will be scanned on next open.\n");
+
 		free(zlib_buffer);
+		unmap_archive();
 		if (file)
 			fclose(file);
 	}
 
+	// In read-only mode, we map the entire archive so payloads can be read concurrently
+	// without locking, and uncompressed payloads can be consumed directly from the mapping.
+	// If mapping fails, e.g. on 32-bit systems with huge archives, we fall back to stdio.
+	void map_archive()
+	{
+#ifdef _WIN32
+		HANDLE file_handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)));
+		if (file_handle == INVALID_HANDLE_VALUE)
+			return;
+
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+			return;
+		if (uint64_t(file_size.QuadPart) > uint64_t(SIZE_MAX))
+			return;
+
+		HANDLE mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping_handle)
+			return;
+
+		// The view holds a reference to the mapping object, so we can close the handle right away.
+		void *mapped = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping_handle);
+		if (!mapped)
+			return;
+
+		mapped_file = static_cast<const uint8_t *>(mapped);
+		mapped_file_size = size_t(file_size.QuadPart);
+#else
+		struct stat s = {};
+		if (fstat(fileno(file), &s) < 0 || s.st_size == 0)
+			return;
+		if (uint64_t(s.st_size) > uint64_t(SIZE_MAX))
+			return;
+
+		void *mapped = mmap(nullptr, size_t(s.st_size), PROT_READ, MAP_SHARED, fileno(file), 0);
+		if (mapped == MAP_FAILED)
+			return;
+
+		// With imported metadata we will only do scattered reads, prefetching is detrimental.
+		if (!impl->imported_metadata.empty() && madvise(mapped, size_t(s.st_size), MADV_RANDOM) != 0)
+			LOGE_LEVEL("Failed to advise of mapping usage. This is not fatal, but might compromise disk performance.\n");
+
+		mapped_file = static_cast<const uint8_t *>(mapped);
+		mapped_file_size = size_t(s.st_size);
+#endif
+	}
+
+	void unmap_archive()
+	{
+		if (!mapped_file)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(mapped_file);
+#else
+		munmap(const_cast<uint8_t *>(mapped_file), mapped_file_size);
+#endif
+		mapped_file = nullptr;
+		mapped_file_size = 0;
+	}
+
+	const uint8_t *get_mapped_payload(const Entry &entry) const
+	{
+		if (entry.offset < sizeof(PayloadHeaderRaw) ||
+		    entry.offset + entry.header.payload_size > mapped_file_size)
+		{
+			LOGE_LEVEL("Payload is out of range of mapped archive.\n");
+			return nullptr;
+		}
+
+		return mapped_file + entry.offset;
+	}
+
+	// Positional read which does not touch the stdio cursor, so it is safe to call from multiple threads at once.
+	// Only used in read-only mode where the FILE is not used after prepare().
+	bool read_file_at(void *data, size_t size, uint64_t offset) const
+	{
+		return Fossilize::read_file_at(file, data, size, offset);
+	}
+
 	void flush() override
 	{
-		if (file && mode != DatabaseMode::ReadOnly)
+		if (async_writer && async_writer->writer.joinable())
+		{
+			// The writer thread flushes after every batch, so just ask for the pending batch to go out early.
+			std::lock_guard<std::mutex> holder(async_writer->lock);
+			async_writer->flush_requested = true;
+			async_writer->batch_cond.notify_one();
+		}
+		else if (file && mode != DatabaseMode::ReadOnly)
 			fflush(file);
 	}
 
+	bool set_async_write_policy(const DatabaseAsyncWritePolicy &policy) override
+	{
+		if (alive || mode == DatabaseMode::ReadOnly || policy.batch_size == 0)
+			return false;
+
+		async_writer.reset(new AsyncWriter);
+		async_writer->policy = policy;
+		return true;
+	}
+
 	bool prepare() override
 	{
 		if (!impl->imported_metadata.empty() && mode != DatabaseMode::ReadOnly)
@@ -1068,10 +1944,19 @@ struct StreamArchive : DatabaseInterface
 		if (!file)
 			return false;
 
+		if (mode == DatabaseMode::ReadOnly)
+			map_archive();
+
 		if (!impl->imported_metadata.empty())
 		{
 			// Do nothing here. TODO: Set fadvise to RANDOM here.
 			imported_metadata = impl->imported_metadata[0];
+
+			fseek(file, 0, SEEK_END);
+			size_t len = ftell(file);
+			if (!load_dictionaries(len))
+				return false;
+
 #ifdef __linux__
 			// We're going to be doing scattered reads, which hopefully have been cached earlier.
 			// However, if the archive has been paged out, RANDOM is the correct approach,
@@ -1090,13 +1975,6 @@ struct StreamArchive : DatabaseInterface
 			}
 #endif
 
-#ifdef __linux__
-			// We're going to scan through the archive sequentially to discover metadata, so some prefetching is welcome.
-			if (posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL) != 0)
-				LOGE_LEVEL("Failed to advise of file usage. This is not fatal, but might compromise disk performance.\n");
-#endif
-
-			// Scan through the archive and get the list of files.
 			fseek(file, 0, SEEK_END);
 			size_t len = ftell(file);
 			rewind(file);
@@ -1113,65 +1991,25 @@ struct StreamArchive : DatabaseInterface
 				if (version > FOSSILIZE_FORMAT_VERSION || version < FOSSILIZE_FORMAT_MIN_COMPAT_VERSION)
 					return false;
 
-				size_t offset = MagicSize;
-				size_t begin_append_offset = len;
+				if (!load_dictionaries(len))
+					return false;
 
-				while (offset < len)
+				if (load_index(len))
 				{
-					begin_append_offset = offset;
-
-					PayloadHeaderRaw *header_raw = nullptr;
-					char bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw)];
-					PayloadHeader header = {};
-
-					// Corrupt entry. Our process might have been killed before we could write all data.
-					if (offset + sizeof(bytes_to_read) > len)
-					{
-						LOGE_LEVEL("Detected sliced file. Dropping entries from here.\n");
-						break;
-					}
-
-					// NAME + HEADER in one read
-					if (fread(bytes_to_read, 1, sizeof(bytes_to_read), file) != sizeof(bytes_to_read))
-						return false;
-					offset += sizeof(bytes_to_read);
-					header_raw = (PayloadHeaderRaw*)&bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH];
-					convert_from_le(header, *header_raw);
-
-					// Corrupt entry. Our process might have been killed before we could write all data.
-					if (offset + header.payload_size > len)
-					{
-						LOGE_LEVEL("Detected sliced file. Dropping entries from here.\n");
-						break;
-					}
-
-					char tag_str[16 + 1] = {};
-					char value_str[16 + 1] = {};
-					memcpy(tag_str, bytes_to_read + FOSSILIZE_BLOB_HASH_LENGTH - 32, 16);
-					memcpy(value_str, bytes_to_read + FOSSILIZE_BLOB_HASH_LENGTH - 16, 16);
-
-					auto tag = unsigned(strtoul(tag_str, nullptr, 16));
-					if (tag < RESOURCE_COUNT)
-					{
-						uint64_t value = strtoull(value_str, nullptr, 16);
-						Entry entry = {};
-						entry.header = header;
-						entry.offset = offset;
-						if (test_resource_filter(static_cast<ResourceTag>(tag), value))
-							seen_blobs[tag].emplace(value, entry);
-					}
-
-					if (fseek(file, header.payload_size, SEEK_CUR) < 0)
+					// Any new entries go after the existing index, and a new index is written when we close.
+					// The old index is skipped over like any other unknown entry.
+					if (mode == DatabaseMode::Append && fseek(file, 0, SEEK_END) < 0)
 						return false;
+					write_offset = len;
 
-					offset += header.payload_size;
-				}
-
-				if (mode == DatabaseMode::Append && offset != len)
-				{
-					if (fseek(file, begin_append_offset, SEEK_SET) < 0)
-						return false;
+#ifdef __linux__
+					// Lookups through the index will be scattered reads.
+					if (mode == DatabaseMode::ReadOnly && posix_fadvise(fileno(file), 0, 0, POSIX_FADV_RANDOM) != 0)
+						LOGE_LEVEL("Failed to advise of file usage. This is not fatal, but might compromise disk performance.\n");
+#endif
 				}
+				else if (!scan_archive(len))
+					return false;
 			}
 			else
 			{
@@ -1179,6 +2017,7 @@ struct StreamArchive : DatabaseInterface
 				if (fwrite(stream_reference_magic_and_version, 1,
 				           sizeof(stream_reference_magic_and_version), file) != sizeof(stream_reference_magic_and_version))
 					return false;
+				write_offset = MagicSize;
 			}
 		}
 		else
@@ -1188,485 +2027,2626 @@ struct StreamArchive : DatabaseInterface
 			{
 				return false;
 			}
+			write_offset = MagicSize;
 		}
 
 		alive = true;
+		if (async_writer)
+			start_async_writes();
 		return true;
 	}
 
-	static bool find_entry_from_metadata(const ExportedMetadataHeader *header, ResourceTag tag, Hash hash, Entry *entry)
+	static void format_entry_name(char *str, uint32_t tag, Hash hash)
 	{
-		size_t count = header->lists[tag].count;
-		if (!count)
+		sprintf(str, "%0*x", FOSSILIZE_BLOB_HASH_LENGTH - 16, tag);
+		sprintf(str + FOSSILIZE_BLOB_HASH_LENGTH - 16, "%016" PRIx64, hash);
+	}
+
+	// Writes an internal entry which is not subject to deduplication.
+	bool write_uncompressed_entry(uint32_t tag, Hash hash, const void *data, size_t size)
+	{
+		if (size > UINT32_MAX)
 			return false;
 
-		// Binary search in-place.
-		auto *blocks = reinterpret_cast<const ExportedMetadataBlock *>(
-				reinterpret_cast<const uint8_t *>(header) + header->lists[tag].offset);
+		uint32_t crc = uint32_t(mz_crc32(MZ_CRC32_INIT, static_cast<const unsigned char *>(data), size));
+		PayloadHeader header = { uint32_t(size), FOSSILIZE_COMPRESSION_NONE, crc, uint32_t(size) };
+		return write_encoded_entry(tag, hash, header, data, nullptr);
+	}
 
-		auto itr = std::lower_bound(blocks, blocks + count, hash, [](const ExportedMetadataBlock &a, Hash hash_) {
-			return a.hash < hash_;
-		});
+	// Dictionaries come before any other entry, so we only need to look at the start of the archive.
+	bool load_dictionaries(size_t len)
+	{
+		char dictionary_name[FOSSILIZE_BLOB_HASH_LENGTH + 1];
+		format_entry_name(dictionary_name, stream_dictionary_tag, 0);
 
-		if (itr != blocks + count && itr->hash == hash)
+		size_t offset = MagicSize;
+		while (offset + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw) <= len)
 		{
-			if (entry)
+			char bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw)];
+			if (fseek(file, long(offset), SEEK_SET) < 0)
+				return false;
+			if (fread(bytes_to_read, 1, sizeof(bytes_to_read), file) != sizeof(bytes_to_read))
+				return false;
+
+			// Only compare the tag part of the name.
+			if (memcmp(bytes_to_read, dictionary_name, FOSSILIZE_BLOB_HASH_LENGTH - 16) != 0)
+				break;
+
+			PayloadHeader header = {};
+			convert_from_le(header, *reinterpret_cast<const PayloadHeaderRaw *>(bytes_to_read + FOSSILIZE_BLOB_HASH_LENGTH));
+			offset += sizeof(bytes_to_read);
+
+			if (header.format != FOSSILIZE_COMPRESSION_NONE || header.payload_size != header.uncompressed_size ||
+			    offset + header.payload_size > len)
 			{
-				entry->offset = itr->file_offset;
-				entry->header = itr->payload;
+				LOGE_LEVEL("Compression dictionary in archive is corrupt.\n");
+				return false;
 			}
-			return true;
-		}
-		else
-			return false;
-	}
 
-	bool find_entry(ResourceTag tag, Hash hash, Entry &entry) const
-	{
-		if (imported_metadata)
-		{
-			return find_entry_from_metadata(imported_metadata, tag, hash, &entry);
-		}
-		else
-		{
-			auto itr = seen_blobs[tag].find(hash);
-			if (itr == end(seen_blobs[tag]))
+			char value_str[16 + 1] = {};
+			memcpy(value_str, bytes_to_read + FOSSILIZE_BLOB_HASH_LENGTH - 16, 16);
+			auto tag = unsigned(strtoul(value_str, nullptr, 16));
+
+			std::vector<uint8_t> dictionary(header.payload_size);
+			if (fread(dictionary.data(), 1, dictionary.size(), file) != dictionary.size())
 				return false;
 
-			entry = itr->second;
-			return true;
+			if (header.crc != 0 && uint32_t(mz_crc32(MZ_CRC32_INIT, dictionary.data(), dictionary.size())) != header.crc)
+			{
+				LOGE_LEVEL("CRC mismatch in compression dictionary!\n");
+				return false;
+			}
+
+			if (tag < RESOURCE_COUNT && !install_dictionary(static_cast<ResourceTag>(tag), std::move(dictionary)))
+				return false;
+
+			offset += header.payload_size;
 		}
+
+		return true;
 	}
 
-	bool read_entry(ResourceTag tag, Hash hash, size_t *blob_size, void *blob, PayloadReadFlags flags) override
+	bool scan_archive(size_t len)
 	{
-		if (!alive || mode != DatabaseMode::ReadOnly)
-			return false;
+#ifdef __linux__
+		// We're going to scan through the archive sequentially to discover metadata, so some prefetching is welcome.
+		if (posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL) != 0)
+			LOGE_LEVEL("Failed to advise of file usage. This is not fatal, but might compromise disk performance.\n");
+#endif
 
-		Entry entry;
-		if (!find_entry(tag, hash, entry))
+		// Scan through the archive and get the list of files.
+		if (fseek(file, MagicSize, SEEK_SET) < 0)
 			return false;
 
-		if (!blob_size)
-			return false;
+		size_t offset = MagicSize;
+		size_t begin_append_offset = len;
 
-		uint32_t out_size = (flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0 ?
-		                    (entry.header.payload_size + sizeof(PayloadHeaderRaw)) :
-		                    entry.header.uncompressed_size;
+		// In read-only mode the set of entries is frozen once we are done, so we build sorted arrays
+		// for binary search instead of hash tables.
+		std::vector<ExportedMetadataBlock> scanned_blocks[RESOURCE_COUNT];
 
-		if (blob)
+		while (offset < len)
 		{
-			if (*blob_size != out_size)
+			begin_append_offset = offset;
+
+			PayloadHeaderRaw *header_raw = nullptr;
+			char bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw)];
+			PayloadHeader header = {};
+
+			// Corrupt entry. Our process might have been killed before we could write all data.
+			if (offset + sizeof(bytes_to_read) > len)
+			{
+				LOGE_LEVEL("Detected sliced file. Dropping entries from here.\n");
+				break;
+			}
+
+			// NAME + HEADER in one read
+			if (fread(bytes_to_read, 1, sizeof(bytes_to_read), file) != sizeof(bytes_to_read))
+				return false;
+			offset += sizeof(bytes_to_read);
+			header_raw = (PayloadHeaderRaw*)&bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH];
+			convert_from_le(header, *header_raw);
+
+			// Corrupt entry. Our process might have been killed before we could write all data.
+			if (offset + header.payload_size > len)
+			{
+				LOGE_LEVEL("Detected sliced file. Dropping entries from here.\n");
+				break;
+			}
+
+			char tag_str[16 + 1] = {};
+			char value_str[16 + 1] = {};
+			memcpy(tag_str, bytes_to_read + FOSSILIZE_BLOB_HASH_LENGTH - 32, 16);
+			memcpy(value_str, bytes_to_read + FOSSILIZE_BLOB_HASH_LENGTH - 16, 16);
+
+			auto tag = unsigned(strtoul(tag_str, nullptr, 16));
+			if (tag < RESOURCE_COUNT)
+			{
+				uint64_t value = strtoull(value_str, nullptr, 16);
+				Entry entry = {};
+				entry.header = header;
+				entry.offset = offset;
+
+				// When appending, we need to know about every entry to deduplicate writes and to write a complete index.
+				if (mode == DatabaseMode::Append)
+					seen_blobs[tag].emplace(value, entry);
+				else if (test_resource_filter(static_cast<ResourceTag>(tag), value))
+					scanned_blocks[tag].push_back({ value, entry.offset, entry.header });
+			}
+
+			if (fseek(file, header.payload_size, SEEK_CUR) < 0)
 				return false;
+
+			offset += header.payload_size;
 		}
-		else
-			*blob_size = out_size;
 
-		if (blob)
+		if (mode == DatabaseMode::Append)
 		{
-			if ((flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0)
+			if (offset != len)
 			{
-				// Include the header.
-				ConditionalLockGuard holder(read_lock, (flags & PAYLOAD_READ_CONCURRENT_BIT) != 0);
-				if (fseek(file, entry.offset - sizeof(PayloadHeaderRaw), SEEK_SET) < 0)
-					return false;
-
-				size_t read_size = entry.header.payload_size + sizeof(PayloadHeaderRaw);
-				if (fread(blob, 1, read_size, file) != read_size)
+				if (fseek(file, begin_append_offset, SEEK_SET) < 0)
 					return false;
+				write_offset = begin_append_offset;
 			}
 			else
+				write_offset = len;
+
+			// The archive has no valid index, so make sure we write one when closing.
+			for (auto &blobs : seen_blobs)
+				if (!blobs.empty())
+					index_dirty = true;
+		}
+		else
+		{
+			std::vector<ExportedMetadataBlock> blocks;
+			uint64_t counts[RESOURCE_COUNT] = {};
+
+			size_t total_count = 0;
+			for (auto &tag_blocks : scanned_blocks)
+				total_count += tag_blocks.size();
+			blocks.reserve(total_count);
+
+			for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
 			{
-				if (!decode_payload(blob, out_size, entry, (flags & PAYLOAD_READ_CONCURRENT_BIT) != 0))
-					return false;
+				// Duplicates are allowed in the archive, and the first entry takes precedence.
+				auto &tag_blocks = scanned_blocks[tag];
+				std::stable_sort(tag_blocks.begin(), tag_blocks.end(), [](const ExportedMetadataBlock &a, const ExportedMetadataBlock &b) {
+					return a.hash < b.hash;
+				});
+				auto unique_end = std::unique(tag_blocks.begin(), tag_blocks.end(), [](const ExportedMetadataBlock &a, const ExportedMetadataBlock &b) {
+					return a.hash == b.hash;
+				});
+
+				counts[tag] = uint64_t(unique_end - tag_blocks.begin());
+				blocks.insert(blocks.end(), tag_blocks.begin(), unique_end);
+				tag_blocks = {};
 			}
+
+			set_index_metadata(blocks, counts);
 		}
 
 		return true;
 	}
 
-	static void convert_from_le(uint32_t *output, const uint8_t *le_input, unsigned word_count)
+	static bool metadata_uses_perfect_hash(const uint64_t *counts)
 	{
-		for (unsigned i = 0; i < word_count; i++)
-		{
-			uint32_t v =
-					(uint32_t(le_input[0]) << 0) |
-					(uint32_t(le_input[1]) << 8) |
-					(uint32_t(le_input[2]) << 16) |
-					(uint32_t(le_input[3]) << 24);
+		for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
+			if (HashPerfectHashTable::compute_bucket_count(counts[tag]))
+				return true;
+		return false;
+	}
 
-			*output++ = v;
-			le_input += 4;
+	// Sorted blocks for all lists come first, followed by perfect hash tables for lists which are large enough.
+	// Metadata without any large list keeps the plain layout.
+	static size_t compute_metadata_size(const uint64_t *counts)
+	{
+		bool perfect_hash = metadata_uses_perfect_hash(counts);
+		size_t size = sizeof(ExportedMetadataHeader);
+		if (perfect_hash)
+			size += sizeof(ExportedMetadataPerfectHashLists);
+
+		for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
+		{
+			size += counts[tag] * sizeof(ExportedMetadataBlock);
+			if (perfect_hash)
+				size += HashPerfectHashTable::compute_size(counts[tag]);
 		}
+
+		return size;
 	}
 
-	static void convert_from_le(PayloadHeader &header, const PayloadHeaderRaw &raw)
+	static void init_metadata_header(ExportedMetadataHeader *header, size_t size, const uint64_t *counts)
 	{
-		convert_from_le(&header.payload_size, raw.data + 0, 1);
-		convert_from_le(&header.format, raw.data + 4, 1);
-		convert_from_le(&header.crc, raw.data + 8, 1);
-		convert_from_le(&header.uncompressed_size, raw.data + 12, 1);
+		bool perfect_hash = metadata_uses_perfect_hash(counts);
+		header->magic = perfect_hash ? ExportedMetadataMagicPerfectHash : ExportedMetadataMagic;
+		header->size = size;
+
+		size_t offset = sizeof(ExportedMetadataHeader);
+		if (perfect_hash)
+			offset += sizeof(ExportedMetadataPerfectHashLists);
+
+		for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
+		{
+			header->lists[tag].offset = offset;
+			header->lists[tag].count = counts[tag];
+			offset += counts[tag] * sizeof(ExportedMetadataBlock);
+		}
+
+		if (perfect_hash)
+		{
+			auto *perfect_hash_lists = reinterpret_cast<ExportedMetadataPerfectHashLists *>(header + 1);
+			for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
+			{
+				perfect_hash_lists->lists[tag].offset = offset;
+				perfect_hash_lists->lists[tag].count = 0;
+				offset += HashPerfectHashTable::compute_size(counts[tag]);
+			}
+		}
 	}
 
-	static void convert_to_le(uint8_t *le_output, const uint32_t *value_input, unsigned count)
+	// Must be called after the sorted blocks have been written.
+	static void build_perfect_hash_tables(ExportedMetadataHeader *header)
 	{
-		for (unsigned i = 0; i < count; i++)
+		if (header->magic != ExportedMetadataMagicPerfectHash)
+			return;
+
+		auto *perfect_hash_lists = reinterpret_cast<ExportedMetadataPerfectHashLists *>(header + 1);
+		for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
 		{
-			uint32_t v = value_input[i];
-			*le_output++ = uint8_t((v >> 0) & 0xffu);
-			*le_output++ = uint8_t((v >> 8) & 0xffu);
-			*le_output++ = uint8_t((v >> 16) & 0xffu);
-			*le_output++ = uint8_t((v >> 24) & 0xffu);
+			size_t count = header->lists[tag].count;
+			size_t bucket_count = HashPerfectHashTable::compute_bucket_count(count);
+			if (!bucket_count)
+				continue;
+
+			auto *blocks = reinterpret_cast<const ExportedMetadataBlock *>(
+					reinterpret_cast<const uint8_t *>(header) + header->lists[tag].offset);
+			auto *table = reinterpret_cast<uint32_t *>(
+					reinterpret_cast<uint8_t *>(header) + perfect_hash_lists->lists[tag].offset);
+
+			if (HashPerfectHashTable::build(table, bucket_count, blocks, count))
+				perfect_hash_lists->lists[tag].count = bucket_count;
+			else
+				LOGW_LEVEL("Failed to build perfect hash for tag %u, falling back to binary search.\n", tag);
 		}
 	}
 
-	static void convert_to_le(PayloadHeaderRaw &raw, const PayloadHeader &header)
+	// Builds sorted lookup tables for read-only use.
+	// They are laid out just like exported metadata, so we get lookups and sharing with child processes for free.
+	void set_index_metadata(const std::vector<ExportedMetadataBlock> &blocks, const uint64_t *counts)
 	{
-		uint8_t *le_output = raw.data;
-		convert_to_le(le_output + 0, &header.payload_size, 1);
-		convert_to_le(le_output + 4, &header.format, 1);
-		convert_to_le(le_output + 8, &header.crc, 1);
-		convert_to_le(le_output + 12, &header.uncompressed_size, 1);
+		size_t metadata_size = compute_metadata_size(counts);
+		index_metadata.assign(metadata_size / sizeof(uint64_t), 0);
+		auto *header = reinterpret_cast<ExportedMetadataHeader *>(index_metadata.data());
+		init_metadata_header(header, metadata_size, counts);
+
+		if (!blocks.empty())
+		{
+			memcpy(reinterpret_cast<uint8_t *>(header) + header->lists[0].offset,
+			       blocks.data(), blocks.size() * sizeof(ExportedMetadataBlock));
+		}
+
+		build_perfect_hash_tables(header);
+		imported_metadata = header;
 	}
 
-	bool write_entry(ResourceTag tag, Hash hash, const void *blob, size_t size, PayloadWriteFlags flags) override
+	bool load_index(size_t len)
 	{
-		if (!alive || mode == DatabaseMode::ReadOnly)
+		// Cannot possibly hold an index.
+		if (len < MagicSize + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw) + IndexHeaderSize + IndexTrailerSize)
 			return false;
 
-		auto itr = seen_blobs[tag].find(hash);
-		if (itr != end(seen_blobs[tag]))
-			return true;
-
-		char str[FOSSILIZE_BLOB_HASH_LENGTH + 1]; // 40 digits + null
-		sprintf(str, "%0*x", FOSSILIZE_BLOB_HASH_LENGTH - 16, tag);
-		sprintf(str + FOSSILIZE_BLOB_HASH_LENGTH - 16, "%016" PRIx64, hash);
-
-		if (fwrite(str, 1, FOSSILIZE_BLOB_HASH_LENGTH, file) != FOSSILIZE_BLOB_HASH_LENGTH)
+		uint8_t trailer[IndexTrailerSize];
+		if (fseek(file, long(len - IndexTrailerSize), SEEK_SET) < 0)
+			return false;
+		if (fread(trailer, 1, sizeof(trailer), file) != sizeof(trailer))
 			return false;
 
-		if ((flags & PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT) != 0)
-		{
-			// The raw payload already contains the header, so just dump it straight to disk.
-			if (size < sizeof(PayloadHeaderRaw))
-				return false;
-			if (fwrite(blob, 1, size, file) != size)
-				return false;
-		}
-		else if ((flags & PAYLOAD_WRITE_COMPRESS_BIT) != 0)
-		{
-			auto compressed_bound = mz_compressBound(size);
+		uint64_t index_offset, trailer_magic;
+		convert_from_le(index_offset, trailer + 0);
+		convert_from_le(trailer_magic, trailer + 8);
+		if (trailer_magic != stream_index_magic)
+			return false;
 
-			if (zlib_buffer_size < compressed_bound)
-			{
-				auto *new_zlib_buffer = static_cast<uint8_t *>(realloc(zlib_buffer, compressed_bound));
-				if (new_zlib_buffer)
-				{
-					zlib_buffer = new_zlib_buffer;
-					zlib_buffer_size = compressed_bound;
-				}
-				else
-				{
-					free(zlib_buffer);
-					zlib_buffer = nullptr;
-					zlib_buffer_size = 0;
-				}
-			}
+		if (index_offset < MagicSize ||
+		    index_offset + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw) > len)
+			return false;
 
-			if (!zlib_buffer)
-				return false;
+		char bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw)];
+		if (fseek(file, long(index_offset), SEEK_SET) < 0)
+			return false;
+		if (fread(bytes_to_read, 1, sizeof(bytes_to_read), file) != sizeof(bytes_to_read))
+			return false;
 
-			PayloadHeader header = {};
-			PayloadHeaderRaw header_raw = {};
-			header.uncompressed_size = uint32_t(size);
-			header.format = FOSSILIZE_COMPRESSION_DEFLATE;
+		char expected_name[FOSSILIZE_BLOB_HASH_LENGTH + 1];
+		format_entry_name(expected_name, stream_index_tag, 0);
+		if (memcmp(bytes_to_read, expected_name, FOSSILIZE_BLOB_HASH_LENGTH) != 0)
+			return false;
 
-			mz_ulong zsize = zlib_buffer_size;
-			if (mz_compress2(zlib_buffer, &zsize, static_cast<const unsigned char *>(blob), size,
-			                 (flags & PAYLOAD_WRITE_BEST_COMPRESSION_BIT) != 0 ? MZ_BEST_COMPRESSION : MZ_BEST_SPEED) != MZ_OK)
-				return false;
+		PayloadHeader header = {};
+		convert_from_le(header, *reinterpret_cast<const PayloadHeaderRaw *>(bytes_to_read + FOSSILIZE_BLOB_HASH_LENGTH));
+		uint64_t payload_offset = index_offset + sizeof(bytes_to_read);
 
-			header.payload_size = uint32_t(zsize);
-			if ((flags & PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT) != 0)
-				header.crc = uint32_t(mz_crc32(MZ_CRC32_INIT, zlib_buffer, zsize));
+		// The index must be the very last entry, otherwise entries were appended without updating it.
+		if (header.format != FOSSILIZE_COMPRESSION_NONE ||
+		    header.payload_size != header.uncompressed_size ||
+		    payload_offset + header.payload_size != len)
+			return false;
 
-			convert_to_le(header_raw, header);
-			if (fwrite(&header_raw, 1, sizeof(header_raw), file) != sizeof(header_raw))
-				return false;
+		std::vector<uint8_t> payload(header.payload_size);
+		if (fread(payload.data(), 1, payload.size(), file) != payload.size())
+			return false;
 
-			if (fwrite(zlib_buffer, 1, header.payload_size, file) != header.payload_size)
-				return false;
-		}
-		else
+		if (header.crc != 0 && uint32_t(mz_crc32(MZ_CRC32_INIT, payload.data(), payload.size())) != header.crc)
 		{
-			uint32_t crc = 0;
-			if ((flags & PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT) != 0)
-				crc = uint32_t(mz_crc32(MZ_CRC32_INIT, static_cast<const unsigned char *>(blob), size));
-
-			PayloadHeader header = { uint32_t(size), FOSSILIZE_COMPRESSION_NONE, crc, uint32_t(size) };
-			PayloadHeaderRaw raw = {};
-			convert_to_le(raw, header);
-
-			if (fwrite(&raw, 1, sizeof(raw), file) != sizeof(raw))
-				return false;
+			LOGW_LEVEL("CRC mismatch in archive index, falling back to scanning the archive.\n");
+			return false;
+		}
 
-			if (fwrite(blob, 1, size, file) != size)
-				return false;
+		if (!parse_index(payload.data(), payload.size(), index_offset))
+		{
+			LOGW_LEVEL("Archive index is invalid, falling back to scanning the archive.\n");
+			return false;
 		}
 
-		// The entry is irrelevant, we're not going to read from this archive any time soon.
-		seen_blobs[tag].emplace(hash, Entry{});
 		return true;
 	}
 
-	bool has_entry(ResourceTag tag, Hash hash) override
+	bool parse_index(const uint8_t *data, size_t size, uint64_t index_offset)
 	{
-		if (!test_resource_filter(tag, hash))
+		if (size < IndexHeaderSize + IndexTrailerSize)
 			return false;
 
-		if (imported_metadata)
-			return find_entry_from_metadata(imported_metadata, tag, hash, nullptr);
-		else
-			return seen_blobs[tag].count(hash) != 0;
-	}
+		uint64_t magic;
+		uint32_t version, tag_count;
+		convert_from_le(magic, data + 0);
+		convert_from_le(&version, data + 8, 1);
+		convert_from_le(&tag_count, data + 12, 1);
 
-	bool get_hash_list_for_resource_tag(ResourceTag tag, size_t *hash_count, Hash *hashes) override
-	{
-		if (imported_metadata)
-		{
-			size_t size = imported_metadata->lists[tag].count;
-			if (hashes)
-			{
-				if (size != *hash_count)
-					return false;
-			}
-			else
-				*hash_count = size;
+		if (magic != stream_index_magic || version != stream_index_version)
+			return false;
 
-			if (hashes)
-			{
-				const auto *blocks = reinterpret_cast<const ExportedMetadataBlock *>(
-						reinterpret_cast<const uint8_t *>(imported_metadata) + imported_metadata->lists[tag].offset);
-				for (size_t i = 0; i < size; i++)
-					hashes[i] = blocks[i].hash;
-			}
+		size_t max_blocks = size / IndexBlockSize;
+		if (tag_count > size / sizeof(uint64_t))
+			return false;
+
+		const uint8_t *counts = data + IndexHeaderSize;
+		uint64_t total_count = 0;
+		for (uint32_t i = 0; i < tag_count; i++)
+		{
+			uint64_t count;
+			convert_from_le(count, counts + i * sizeof(uint64_t));
+			if (count > max_blocks)
+				return false;
+			total_count += count;
 		}
-		else
+
+		if (IndexHeaderSize + tag_count * sizeof(uint64_t) + total_count * IndexBlockSize + IndexTrailerSize != size)
+			return false;
+
+		const uint8_t *block_data = counts + tag_count * sizeof(uint64_t);
+		std::vector<ExportedMetadataBlock> blocks;
+		uint64_t kept_counts[RESOURCE_COUNT] = {};
+		blocks.reserve(total_count);
+
+		for (uint32_t tag = 0; tag < tag_count; tag++)
 		{
-			size_t size = seen_blobs[tag].size();
-			if (hashes)
+			uint64_t count;
+			convert_from_le(count, counts + tag * sizeof(uint64_t));
+
+			for (uint64_t i = 0; i < count; i++, block_data += IndexBlockSize)
 			{
-				if (size != *hash_count)
+				ExportedMetadataBlock block = {};
+				Hash prev_hash = blocks.empty() ? 0 : blocks.back().hash;
+				convert_from_le(block.hash, block_data + 0);
+				convert_from_le(block.file_offset, block_data + 8);
+				convert_from_le(block.payload, *reinterpret_cast<const PayloadHeaderRaw *>(block_data + 16));
+
+				if (block.file_offset < MagicSize + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw) ||
+				    block.file_offset + block.payload.payload_size > index_offset)
+					return false;
+
+				// Tags this version is not aware of are skipped.
+				if (tag >= RESOURCE_COUNT)
+					continue;
+
+				// Lookups rely on binary search.
+				if (kept_counts[tag] != 0 && block.hash <= prev_hash)
 					return false;
+
+				if (mode == DatabaseMode::Append || test_resource_filter(static_cast<ResourceTag>(tag), block.hash))
+				{
+					blocks.push_back(block);
+					kept_counts[tag]++;
+				}
 			}
-			else
-				*hash_count = size;
+		}
 
-			if (hashes)
+		if (mode == DatabaseMode::Append)
+		{
+			const ExportedMetadataBlock *block = blocks.data();
+			for (unsigned tag = 0; tag < RESOURCE_COUNT; tag++)
 			{
-				Hash *iter = hashes;
-				for (auto &blob : seen_blobs[tag])
-					*iter++ = blob.first;
-
-				// Make replay more deterministic.
-				sort(hashes, hashes + size);
+				seen_blobs[tag].reserve(kept_counts[tag]);
+				for (uint64_t i = 0; i < kept_counts[tag]; i++, block++)
+					seen_blobs[tag].emplace(block->hash, Entry{block->file_offset, block->payload});
 			}
 		}
+		else
+			set_index_metadata(blocks, kept_counts);
 
 		return true;
 	}
 
-	bool decode_payload_uncompressed(void *blob, size_t blob_size, const Entry &entry, bool concurrent)
+	bool write_index()
 	{
-		if (entry.header.uncompressed_size != blob_size || entry.header.payload_size != blob_size)
+		// If a write failed half-way through, we cannot trust our offsets.
+		if (uint64_t(ftell(file)) != write_offset)
 			return false;
 
-		{
-			ConditionalLockGuard holder(read_lock, concurrent);
-			if (fseek(file, entry.offset, SEEK_SET) < 0)
-				return false;
+		size_t total_count = 0;
+		for (auto &blobs : seen_blobs)
+			total_count += blobs.size();
 
-			size_t read_size = entry.header.payload_size;
-			if (fread(blob, 1, read_size, file) != read_size)
-				return false;
+		size_t payload_size = IndexHeaderSize + RESOURCE_COUNT * sizeof(uint64_t) +
+		                      total_count * IndexBlockSize + IndexTrailerSize;
+
+		std::vector<uint8_t> payload(payload_size);
+		uint8_t *data = payload.data();
+
+		convert_to_le(data + 0, stream_index_magic);
+		convert_to_le(data + 8, &stream_index_version, 1);
+		uint32_t tag_count = RESOURCE_COUNT;
+		convert_to_le(data + 12, &tag_count, 1);
+		data += IndexHeaderSize;
+
+		for (auto &blobs : seen_blobs)
+		{
+			convert_to_le(data, uint64_t(blobs.size()));
+			data += sizeof(uint64_t);
 		}
 
-		if (entry.header.crc != 0) // Verify checksum.
+		std::vector<ExportedMetadataBlock> blocks;
+		for (auto &blobs : seen_blobs)
 		{
-			auto disk_crc = uint32_t(mz_crc32(MZ_CRC32_INIT, static_cast<unsigned char *>(blob), blob_size));
-			if (disk_crc != entry.header.crc)
+			blocks.clear();
+			blocks.reserve(blobs.size());
+			for (auto &blob : blobs)
+				blocks.push_back({ blob.first, blob.second.offset, blob.second.header });
+			std::sort(blocks.begin(), blocks.end(), [](const ExportedMetadataBlock &a, const ExportedMetadataBlock &b) {
+				return a.hash < b.hash;
+			});
+
+			for (auto &block : blocks)
 			{
-				LOGE_LEVEL("CRC mismatch!\n");
-				return false;
+				convert_to_le(data + 0, block.hash);
+				convert_to_le(data + 8, block.file_offset);
+				convert_to_le(*reinterpret_cast<PayloadHeaderRaw *>(data + 16), block.payload);
+				data += IndexBlockSize;
 			}
 		}
 
+		convert_to_le(data + 0, write_offset);
+		convert_to_le(data + 8, stream_index_magic);
+
+		if (!write_uncompressed_entry(stream_index_tag, 0, payload.data(), payload.size()))
+			return false;
+
+		index_dirty = false;
 		return true;
 	}
 
-	bool decode_payload_deflate(void *blob, size_t blob_size, const Entry &entry, bool concurrent)
+	static bool find_entry_from_metadata(const ExportedMetadataHeader *header, ResourceTag tag, Hash hash, Entry *entry)
 	{
-		if (entry.header.uncompressed_size != blob_size)
+		size_t count = header->lists[tag].count;
+		if (!count)
 			return false;
 
-		uint8_t *dst_zlib_buffer = nullptr;
-		std::unique_ptr<uint8_t[]> zlib_buffer_holder;
+		auto *blocks = reinterpret_cast<const ExportedMetadataBlock *>(
+				reinterpret_cast<const uint8_t *>(header) + header->lists[tag].offset);
+		const ExportedMetadataBlock *itr = nullptr;
 
+		const ExportedMetadataList *perfect_hash_list = nullptr;
+		if (header->magic == ExportedMetadataMagicPerfectHash)
+			perfect_hash_list = &reinterpret_cast<const ExportedMetadataPerfectHashLists *>(header + 1)->lists[tag];
+
+		if (perfect_hash_list && perfect_hash_list->count)
 		{
-			ConditionalLockGuard holder(read_lock, concurrent);
-			if (concurrent)
+			auto *table = reinterpret_cast<const uint32_t *>(
+					reinterpret_cast<const uint8_t *>(header) + perfect_hash_list->offset);
+			size_t index = HashPerfectHashTable::lookup(table, perfect_hash_list->count, count, hash);
+			itr = index < count ? blocks + index : blocks + count;
+		}
+		else
+		{
+			// Binary search in-place.
+			itr = std::lower_bound(blocks, blocks + count, hash, [](const ExportedMetadataBlock &a, Hash hash_) {
+				return a.hash < hash_;
+			});
+		}
+
+		if (itr != blocks + count && itr->hash == hash)
+		{
+			if (entry)
 			{
-				dst_zlib_buffer = new uint8_t[entry.header.payload_size];
-				zlib_buffer_holder.reset(dst_zlib_buffer);
+				entry->offset = itr->file_offset;
+				entry->header = itr->payload;
 			}
-			else if (zlib_buffer_size < entry.header.payload_size)
+			return true;
+		}
+		else
+			return false;
+	}
+
+	bool find_entry(ResourceTag tag, Hash hash, Entry &entry) const
+	{
+		if (imported_metadata)
+		{
+			return find_entry_from_metadata(imported_metadata, tag, hash, &entry);
+		}
+		else
+		{
+			auto itr = seen_blobs[tag].find(hash);
+			if (itr == end(seen_blobs[tag]))
+				return false;
+
+			entry = itr->second;
+			return true;
+		}
+	}
+
+	bool read_entry(ResourceTag tag, Hash hash, size_t *blob_size, void *blob, PayloadReadFlags flags) override
+	{
+		if (!alive || mode != DatabaseMode::ReadOnly)
+			return false;
+
+		Entry entry;
+		if (!find_entry(tag, hash, entry))
+			return false;
+
+		if (!blob_size)
+			return false;
+
+		uint32_t out_size = (flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0 ?
+		                    (entry.header.payload_size + sizeof(PayloadHeaderRaw)) :
+		                    entry.header.uncompressed_size;
+
+		if (blob)
+		{
+			if (*blob_size != out_size)
+				return false;
+		}
+		else
+			*blob_size = out_size;
+
+		if (blob)
+		{
+			if ((flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0)
 			{
-				auto *new_zlib_buffer = static_cast<uint8_t *>(realloc(zlib_buffer, entry.header.payload_size));
-				if (new_zlib_buffer)
-				{
-					zlib_buffer = new_zlib_buffer;
-					zlib_buffer_size = entry.header.payload_size;
-				}
-				else
+				// Include the header.
+				size_t read_size = entry.header.payload_size + sizeof(PayloadHeaderRaw);
+				if (mapped_file)
 				{
-					free(zlib_buffer);
-					zlib_buffer = nullptr;
-					zlib_buffer_size = 0;
+					auto *mapped = get_mapped_payload(entry);
+					if (!mapped)
+						return false;
+					memcpy(blob, mapped - sizeof(PayloadHeaderRaw), read_size);
 				}
+				else if (!read_file_at(blob, read_size, entry.offset - sizeof(PayloadHeaderRaw)))
+					return false;
+			}
+			else
+			{
+				if (!decode_payload(tag, blob, out_size, entry, (flags & PAYLOAD_READ_CONCURRENT_BIT) != 0))
+					return false;
+			}
+		}
 
-				if (!zlib_buffer)
+		return true;
+	}
+
+	bool read_entry_zero_copy(ResourceTag tag, Hash hash, size_t *blob_size, const void **blob, PayloadReadFlags flags) override
+	{
+		if (!alive || mode != DatabaseMode::ReadOnly || !mapped_file)
+			return false;
+
+		if (!blob_size || !blob)
+			return false;
+
+		Entry entry;
+		if (!find_entry(tag, hash, entry))
+			return false;
+
+		auto *mapped = get_mapped_payload(entry);
+		if (!mapped)
+			return false;
+
+		if ((flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) != 0)
+		{
+			*blob = mapped - sizeof(PayloadHeaderRaw);
+			*blob_size = entry.header.payload_size + sizeof(PayloadHeaderRaw);
+			return true;
+		}
+
+		// Compressed payloads must go through read_entry, which decompresses straight from the mapping.
+		if (get_compression_format(entry.header) != FOSSILIZE_COMPRESSION_NONE ||
+		    entry.header.payload_size != entry.header.uncompressed_size)
+			return false;
+
+		if (!verify_payload_checksum(entry.header, mapped, entry.header.payload_size))
+			return false;
+
+		*blob = mapped;
+		*blob_size = entry.header.payload_size;
+		return true;
+	}
+
+	bool prefetch_entries(ResourceTag tag, const Hash *hashes, size_t count) override
+	{
+		if (!alive || mode != DatabaseMode::ReadOnly)
+			return false;
+
+#ifdef _WIN32
+		(void)tag;
+		(void)hashes;
+		(void)count;
+		return false;
+#else
+		struct Range
+		{
+			uint64_t begin;
+			uint64_t end;
+		};
+
+		std::vector<Range> ranges;
+		ranges.reserve(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			Entry entry;
+			if (find_entry(tag, hashes[i], entry))
+			{
+				uint64_t begin = entry.offset - sizeof(PayloadHeaderRaw);
+				ranges.push_back({ begin, entry.offset + entry.header.payload_size });
+			}
+		}
+
+		if (ranges.empty())
+			return true;
+
+		// Issue the hints in file order, and merge neighbors so the kernel sees a few large sequential requests
+		// rather than one scattered request per entry.
+		std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) { return a.begin < b.begin; });
+
+		const uint64_t page_size = uint64_t(sysconf(_SC_PAGESIZE));
+		const uint64_t merge_gap = 16 * page_size;
+
+		size_t merged_count = 0;
+		for (auto &range : ranges)
+		{
+			if (merged_count && range.begin <= ranges[merged_count - 1].end + merge_gap)
+				ranges[merged_count - 1].end = std::max(ranges[merged_count - 1].end, range.end);
+			else
+				ranges[merged_count++] = range;
+		}
+		ranges.resize(merged_count);
+
+		for (auto &range : ranges)
+		{
+			if (mapped_file)
+			{
+				// madvise requires a page aligned address.
+				uint64_t begin = range.begin & ~(page_size - 1);
+				uint64_t end = std::min<uint64_t>(range.end, mapped_file_size);
+				if (begin >= end)
+					continue;
+
+				if (madvise(const_cast<uint8_t *>(mapped_file) + begin, size_t(end - begin), MADV_WILLNEED) != 0)
 					return false;
+			}
+			else if (posix_fadvise(fileno(file), off_t(range.begin), off_t(range.end - range.begin), POSIX_FADV_WILLNEED) != 0)
+				return false;
+		}
+
+		return true;
+#endif
+	}
+
+	bool get_entry_storage_offset(ResourceTag tag, Hash hash, uint64_t *offset) override
+	{
+		if (!alive || mode != DatabaseMode::ReadOnly || !offset)
+			return false;
+
+		Entry entry;
+		if (!find_entry(tag, hash, entry))
+			return false;
+
+		*offset = entry.offset;
+		return true;
+	}
+
+	static void convert_from_le(uint32_t *output, const uint8_t *le_input, unsigned word_count)
+	{
+		for (unsigned i = 0; i < word_count; i++)
+		{
+			uint32_t v =
+					(uint32_t(le_input[0]) << 0) |
+					(uint32_t(le_input[1]) << 8) |
+					(uint32_t(le_input[2]) << 16) |
+					(uint32_t(le_input[3]) << 24);
+
+			*output++ = v;
+			le_input += 4;
+		}
+	}
+
+	static void convert_from_le(uint64_t &value, const uint8_t *le_input)
+	{
+		uint32_t words[2];
+		convert_from_le(words, le_input, 2);
+		value = uint64_t(words[0]) | (uint64_t(words[1]) << 32);
+	}
+
+	static void convert_from_le(PayloadHeader &header, const PayloadHeaderRaw &raw)
+	{
+		convert_from_le(&header.payload_size, raw.data + 0, 1);
+		convert_from_le(&header.format, raw.data + 4, 1);
+		convert_from_le(&header.crc, raw.data + 8, 1);
+		convert_from_le(&header.uncompressed_size, raw.data + 12, 1);
+	}
+
+	static void convert_to_le(uint8_t *le_output, const uint32_t *value_input, unsigned count)
+	{
+		for (unsigned i = 0; i < count; i++)
+		{
+			uint32_t v = value_input[i];
+			*le_output++ = uint8_t((v >> 0) & 0xffu);
+			*le_output++ = uint8_t((v >> 8) & 0xffu);
+			*le_output++ = uint8_t((v >> 16) & 0xffu);
+			*le_output++ = uint8_t((v >> 24) & 0xffu);
+		}
+	}
+
+	static void convert_to_le(uint8_t *le_output, uint64_t value)
+	{
+		uint32_t words[2] = { uint32_t(value & 0xffffffffu), uint32_t(value >> 32) };
+		convert_to_le(le_output, words, 2);
+	}
+
+	static void convert_to_le(PayloadHeaderRaw &raw, const PayloadHeader &header)
+	{
+		uint8_t *le_output = raw.data;
+		convert_to_le(le_output + 0, &header.payload_size, 1);
+		convert_to_le(le_output + 4, &header.format, 1);
+		convert_to_le(le_output + 8, &header.crc, 1);
+		convert_to_le(le_output + 12, &header.uncompressed_size, 1);
+	}
+
+	static uint32_t get_compression_format(const PayloadHeader &header)
+	{
+		return header.format & FOSSILIZE_COMPRESSION_MASK;
+	}
+
+	static uint32_t compute_payload_checksum(uint32_t format, const void *data, size_t size)
+	{
+		if ((format & FOSSILIZE_CHECKSUM_CRC32C_BIT) != 0)
+			return compute_crc32c(0, data, size);
+		else
+			return uint32_t(mz_crc32(MZ_CRC32_INIT, static_cast<const unsigned char *>(data), size));
+	}
+
+	static bool verify_payload_checksum(const PayloadHeader &header, const void *data, size_t size)
+	{
+		if ((header.format & ~uint32_t(FOSSILIZE_COMPRESSION_MASK | FOSSILIZE_CHECKSUM_CRC32C_BIT)) != 0)
+		{
+			LOGE_LEVEL("Payload flags 0x%x are not supported by this build.\n", header.format);
+			return false;
+		}
+
+		// A zero checksum means the payload was written without one.
+		if (header.crc != 0 && compute_payload_checksum(header.format, data, size) != header.crc)
+		{
+			LOGE_LEVEL("CRC mismatch!\n");
+			return false;
+		}
+
+		return true;
+	}
+
+	bool validate_raw_payload(ResourceTag tag, const void *blob, size_t size) const
+	{
+		if (size < sizeof(PayloadHeaderRaw))
+			return false;
+
+		PayloadHeader header = {};
+		convert_from_le(header, *static_cast<const PayloadHeaderRaw *>(blob));
+		if (get_compression_format(header) != FOSSILIZE_COMPRESSION_ZSTD_DICTIONARY)
+			return true;
+
+		// The payload can only be decoded if we have the very same dictionary.
+#ifdef FOSSILIZE_HAVE_ZSTD
+		auto &dictionary = dictionaries[tag];
+		if (!dictionary.data.empty() && size == sizeof(PayloadHeaderRaw) + header.payload_size &&
+		    ZSTD_getDictID_fromFrame(static_cast<const uint8_t *>(blob) + sizeof(PayloadHeaderRaw), header.payload_size) ==
+		    ZSTD_getDictID_fromDict(dictionary.data.data(), dictionary.data.size()))
+		{
+			return true;
+		}
+#else
+		(void)tag;
+#endif
+
+		// Merging archives can run into this for every entry, so don't flood the log.
+		if (!reported_dictionary_mismatch)
+			LOGE_LEVEL("Raw payload depends on a compression dictionary which does not match the target archive.\n");
+		reported_dictionary_mismatch = true;
+		return false;
+	}
+
+	uint32_t select_compression_format(ResourceTag tag, PayloadWriteFlags flags) const
+	{
+#ifdef FOSSILIZE_HAVE_ZSTD
+		if ((flags & PAYLOAD_WRITE_COMPRESS_ZSTD_BIT) != 0)
+			return dictionaries[tag].data.empty() ? FOSSILIZE_COMPRESSION_ZSTD : FOSSILIZE_COMPRESSION_ZSTD_DICTIONARY;
+#else
+		(void)tag;
+#endif
+#ifdef FOSSILIZE_HAVE_LZ4
+		if ((flags & PAYLOAD_WRITE_COMPRESS_LZ4_BIT) != 0)
+			return FOSSILIZE_COMPRESSION_LZ4;
+#endif
+		(void)flags;
+		return FOSSILIZE_COMPRESSION_DEFLATE;
+	}
+
+	static size_t compress_bound(uint32_t format, size_t size)
+	{
+		switch (format)
+		{
+#ifdef FOSSILIZE_HAVE_ZSTD
+		case FOSSILIZE_COMPRESSION_ZSTD:
+		case FOSSILIZE_COMPRESSION_ZSTD_DICTIONARY:
+			return ZSTD_compressBound(size);
+#endif
+#ifdef FOSSILIZE_HAVE_LZ4
+		case FOSSILIZE_COMPRESSION_LZ4:
+			if (size > size_t(LZ4_MAX_INPUT_SIZE))
+				return 0;
+			return size_t(LZ4_compressBound(int(size)));
+#endif
+		case FOSSILIZE_COMPRESSION_DEFLATE:
+			return mz_compressBound(size);
+		default:
+			return 0;
+		}
+	}
+
+	// Compresses into the buffer of ctx, which must hold at least compress_bound() bytes.
+	bool compress_payload(CompressionContext &ctx, ResourceTag tag, uint32_t format, bool best,
+	                      const uint8_t *blob, size_t size, size_t *compressed_size)
+	{
+		switch (format)
+		{
+#ifdef FOSSILIZE_HAVE_ZSTD
+		case FOSSILIZE_COMPRESSION_ZSTD:
+		case FOSSILIZE_COMPRESSION_ZSTD_DICTIONARY:
+		{
+			if (!ctx.zstd_cctx)
+				ctx.zstd_cctx = ZSTD_createCCtx();
+			if (!ctx.zstd_cctx)
+				return false;
+
+			int level = best ? 19 : 3;
+			size_t ret;
+
+			if (format == FOSSILIZE_COMPRESSION_ZSTD_DICTIONARY)
+			{
+				auto *cdict = get_compression_dictionary(tag, best, level);
+				if (!cdict)
+					return false;
+				ret = ZSTD_compress_usingCDict(ctx.zstd_cctx, ctx.buffer, ctx.buffer_size, blob, size, cdict);
+			}
+			else
+				ret = ZSTD_compressCCtx(ctx.zstd_cctx, ctx.buffer, ctx.buffer_size, blob, size, level);
+
+			if (ZSTD_isError(ret))
+				return false;
+			*compressed_size = ret;
+			return true;
+		}
+#else
+		(void)tag;
+#endif
+
+#ifdef FOSSILIZE_HAVE_LZ4
+		case FOSSILIZE_COMPRESSION_LZ4:
+		{
+			int ret;
+			if (best)
+			{
+				ret = LZ4_compress_HC(reinterpret_cast<const char *>(blob), reinterpret_cast<char *>(ctx.buffer),
+				                      int(size), int(std::min<size_t>(ctx.buffer_size, INT_MAX)), LZ4HC_CLEVEL_MAX);
+			}
+			else
+			{
+				ret = LZ4_compress_default(reinterpret_cast<const char *>(blob), reinterpret_cast<char *>(ctx.buffer),
+				                           int(size), int(std::min<size_t>(ctx.buffer_size, INT_MAX)));
+			}
+
+			if (ret <= 0)
+				return false;
+			*compressed_size = size_t(ret);
+			return true;
+		}
+#endif
+
+		case FOSSILIZE_COMPRESSION_DEFLATE:
+		{
+			mz_ulong zsize = ctx.buffer_size;
+			if (mz_compress2(ctx.buffer, &zsize, blob, size, best ? MZ_BEST_COMPRESSION : MZ_BEST_SPEED) != MZ_OK)
+				return false;
+			*compressed_size = size_t(zsize);
+			return true;
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	// Computes the header and stored payload of an entry as requested by flags.
+	// *payload either points into blob, or into the buffer of ctx.
+	bool encode_payload(CompressionContext &ctx, ResourceTag tag, const void *blob, size_t size,
+	                    PayloadWriteFlags flags, PayloadHeader &header, const uint8_t **payload)
+	{
+		if (size > UINT32_MAX)
+			return false;
+
+		if ((flags & PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT) != 0)
+		{
+			// The raw payload already contains the header, so it can be stored as-is.
+			convert_from_le(header, *static_cast<const PayloadHeaderRaw *>(blob));
+			if (size != sizeof(PayloadHeaderRaw) + header.payload_size)
+				return false;
+			*payload = static_cast<const uint8_t *>(blob) + sizeof(PayloadHeaderRaw);
+		}
+		else if ((flags & PAYLOAD_WRITE_COMPRESS_BIT) != 0)
+		{
+			uint32_t format = select_compression_format(tag, flags);
+			size_t compressed_bound = compress_bound(format, size);
+			if (compressed_bound == 0 || !ctx.reserve(compressed_bound))
+				return false;
+
+			size_t zsize = 0;
+			auto start_time = std::chrono::steady_clock::now();
+			if (!compress_payload(ctx, tag, format, (flags & PAYLOAD_WRITE_BEST_COMPRESSION_BIT) != 0,
+			                      static_cast<const uint8_t *>(blob), size, &zsize))
+				return false;
+			auto end_time = std::chrono::steady_clock::now();
+
+			compressed_payloads.fetch_add(1, std::memory_order_relaxed);
+			compression_input_bytes.fetch_add(size, std::memory_order_relaxed);
+			compression_output_bytes.fetch_add(zsize, std::memory_order_relaxed);
+			compression_ns.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count()),
+			                         std::memory_order_relaxed);
+
+			header.payload_size = uint32_t(zsize);
+			header.format = format;
+			header.crc = 0;
+			header.uncompressed_size = uint32_t(size);
+			*payload = ctx.buffer;
+		}
+		else
+		{
+			header = { uint32_t(size), FOSSILIZE_COMPRESSION_NONE, 0, uint32_t(size) };
+			*payload = static_cast<const uint8_t *>(blob);
+		}
+
+		if ((flags & PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT) == 0 && (flags & PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT) != 0)
+		{
+			if ((flags & PAYLOAD_WRITE_CHECKSUM_CRC32C_BIT) != 0)
+				header.format |= FOSSILIZE_CHECKSUM_CRC32C_BIT;
+			header.crc = compute_payload_checksum(header.format, *payload, header.payload_size);
+		}
+
+		return true;
+	}
+
+	// Appends a complete entry to the archive. *payload_offset receives the file offset of its payload.
+	bool write_encoded_entry(uint32_t tag, Hash hash, const PayloadHeader &header, const void *payload,
+	                         uint64_t *payload_offset)
+	{
+		char str[FOSSILIZE_BLOB_HASH_LENGTH + 1]; // 40 digits + null
+		format_entry_name(str, tag, hash);
+
+		PayloadHeaderRaw raw = {};
+		convert_to_le(raw, header);
+
+		if (fwrite(str, 1, FOSSILIZE_BLOB_HASH_LENGTH, file) != FOSSILIZE_BLOB_HASH_LENGTH)
+			return false;
+		if (fwrite(&raw, 1, sizeof(raw), file) != sizeof(raw))
+			return false;
+		if (header.payload_size && fwrite(payload, 1, header.payload_size, file) != header.payload_size)
+			return false;
+
+		if (payload_offset)
+			*payload_offset = write_offset + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(raw);
+		write_offset += FOSSILIZE_BLOB_HASH_LENGTH + sizeof(raw) + header.payload_size;
+		return true;
+	}
+
+	bool write_entry(ResourceTag tag, Hash hash, const void *blob, size_t size, PayloadWriteFlags flags) override
+	{
+		if (!alive || mode == DatabaseMode::ReadOnly)
+			return false;
+
+		auto itr = seen_blobs[tag].find(hash);
+		if (itr != end(seen_blobs[tag]))
+			return true;
+
+		if ((flags & PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT) != 0 && !validate_raw_payload(tag, blob, size))
+			return false;
+
+		if (async_writer)
+		{
+			if (!write_entry_async(tag, hash, blob, size, flags))
+				return false;
+
+			// The real offset is filled in once the entry has been written to disk.
+			seen_blobs[tag].emplace(hash, Entry{});
+			index_dirty = true;
+			return true;
+		}
+
+		// Keep track of where the payload lands so we can write an index when closing.
+		Entry entry = {};
+		const uint8_t *payload = nullptr;
+		if (!encode_payload(compression_context, tag, blob, size, flags, entry.header, &payload))
+			return false;
+		if (!write_encoded_entry(tag, hash, entry.header, payload, &entry.offset))
+			return false;
+
+		seen_blobs[tag].emplace(hash, entry);
+		index_dirty = true;
+		return true;
+	}
+
+#ifdef FOSSILIZE_HAVE_ZSTD
+	ZSTD_CDict *get_compression_dictionary(ResourceTag tag, bool best, int level)
+	{
+		// Digesting the dictionary is expensive, so do it once per compression level.
+		std::lock_guard<std::mutex> holder(cdict_lock);
+		auto &dictionary = dictionaries[tag];
+		auto &cdict = dictionary.cdicts[best ? 1 : 0];
+		if (!cdict)
+			cdict = ZSTD_createCDict(dictionary.data.data(), dictionary.data.size(), level);
+		return cdict;
+	}
+#endif
+
+	void start_async_writes()
+	{
+		auto &async = *async_writer;
+		for (unsigned i = 0; i < async.policy.compression_threads; i++)
+			async.workers.emplace_back(&StreamArchive::async_compression_worker, this);
+		async.writer = std::thread(&StreamArchive::async_disk_writer, this);
+	}
+
+	void stop_async_writes()
+	{
+		auto &async = *async_writer;
+
+		// Workers drain the job queue before exiting, and the writer drains the batch after that.
+		{
+			std::lock_guard<std::mutex> holder(async.lock);
+			async.stop_workers = true;
+			async.job_cond.notify_all();
+		}
+		for (auto &worker : async.workers)
+			worker.join();
+		async.workers.clear();
+
+		{
+			std::lock_guard<std::mutex> holder(async.lock);
+			async.stop_writer = true;
+			async.batch_cond.notify_one();
+		}
+		async.writer.join();
+
+		if (async.write_failed)
+		{
+			// We cannot know which entries made it to disk, so leave it to the scanner on next open.
+			index_dirty = false;
+			return;
+		}
+
+		for (auto &entry : async.written_entries)
+			seen_blobs[entry.tag][entry.hash] = { entry.offset, entry.header };
+		for (auto &entry : async.dropped_entries)
+			seen_blobs[entry.first].erase(entry.second);
+	}
+
+	// Must be called with the async lock held.
+	void queue_encoded_entry(ResourceTag tag, Hash hash, const PayloadHeader &header, const uint8_t *payload)
+	{
+		auto &async = *async_writer;
+		size_t entry_size = FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw) + header.payload_size;
+		size_t offset = async.batch.size();
+		async.batch.resize(offset + entry_size);
+		uint8_t *data = async.batch.data() + offset;
+
+		char str[FOSSILIZE_BLOB_HASH_LENGTH + 1]; // 40 digits + null
+		format_entry_name(str, tag, hash);
+		memcpy(data, str, FOSSILIZE_BLOB_HASH_LENGTH);
+		convert_to_le(*reinterpret_cast<PayloadHeaderRaw *>(data + FOSSILIZE_BLOB_HASH_LENGTH), header);
+		if (header.payload_size)
+			memcpy(data + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw), payload, header.payload_size);
+
+		async.batch_entries.push_back({ tag, hash, offset + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(PayloadHeaderRaw), header });
+		async.queued_bytes += entry_size;
+		if (async.batch.size() >= async.policy.batch_size)
+			async.batch_cond.notify_one();
+	}
+
+	bool write_entry_async(ResourceTag tag, Hash hash, const void *blob, size_t size, PayloadWriteFlags flags)
+	{
+		auto &async = *async_writer;
+		bool deferred_compression = !async.workers.empty() &&
+		                            (flags & PAYLOAD_WRITE_COMPRESS_BIT) != 0 &&
+		                            (flags & PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT) == 0;
+
+		// Anything which does not need compression is cheap enough to encode right away.
+		PayloadHeader header = {};
+		const uint8_t *payload = nullptr;
+		std::vector<uint8_t> data;
+		if (deferred_compression)
+			data.assign(static_cast<const uint8_t *>(blob), static_cast<const uint8_t *>(blob) + size);
+		else if (!encode_payload(compression_context, tag, blob, size, flags, header, &payload))
+			return false;
+
+		std::unique_lock<std::mutex> holder(async.lock);
+
+		// If the disk cannot keep up, block rather than letting the queue grow without bound.
+		async.space_cond.wait(holder, [&]() {
+			return async.write_failed || async.queued_bytes < 4 * async.policy.batch_size;
+		});
+
+		if (async.write_failed)
+			return false;
+
+		if (deferred_compression)
+		{
+			async.queued_bytes += size;
+			async.jobs.push_back({ tag, hash, flags, std::move(data) });
+			async.job_cond.notify_one();
+		}
+		else
+			queue_encoded_entry(tag, hash, header, payload);
+
+		return true;
+	}
+
+	void async_compression_worker()
+	{
+		auto &async = *async_writer;
+		CompressionContext ctx;
+		std::unique_lock<std::mutex> holder(async.lock);
+
+		for (;;)
+		{
+			async.job_cond.wait(holder, [&]() { return async.stop_workers || !async.jobs.empty(); });
+			if (async.jobs.empty())
+				break;
+
+			auto job = std::move(async.jobs.front());
+			async.jobs.pop_front();
+			holder.unlock();
+
+			PayloadHeader header = {};
+			const uint8_t *payload = nullptr;
+			bool ret = encode_payload(ctx, job.tag, job.data.data(), job.data.size(), job.flags, header, &payload);
+
+			holder.lock();
+			async.queued_bytes -= job.data.size();
+			if (ret)
+				queue_encoded_entry(job.tag, job.hash, header, payload);
+			else
+			{
+				LOGE_LEVEL("Failed to compress payload, entry %016" PRIx64 " is dropped.\n", job.hash);
+				async.dropped_entries.emplace_back(job.tag, job.hash);
+			}
+			async.space_cond.notify_all();
+		}
+	}
+
+	void async_disk_writer()
+	{
+		auto &async = *async_writer;
+		std::vector<uint8_t> batch;
+		std::vector<AsyncWriter::PendingEntry> batch_entries;
+		std::unique_lock<std::mutex> holder(async.lock);
+
+		for (;;)
+		{
+			auto batch_ready = [&]() {
+				return async.stop_writer || async.flush_requested || async.batch.size() >= async.policy.batch_size;
+			};
+
+			if (async.policy.flush_interval_ms)
+				async.batch_cond.wait_for(holder, std::chrono::milliseconds(async.policy.flush_interval_ms), batch_ready);
+			else
+				async.batch_cond.wait(holder, batch_ready);
+
+			async.flush_requested = false;
+			if (async.batch.empty())
+			{
+				if (async.stop_writer)
+					break;
+				continue;
+			}
+
+			// Swap buffers so producers can keep going while we write. The allocations are recycled.
+			batch.swap(async.batch);
+			batch_entries.swap(async.batch_entries);
+			bool write_failed = async.write_failed;
+			holder.unlock();
+
+			// Entries never straddle batches, so a crash at any point still leaves a well-formed (if truncated) archive.
+			// After a failed write, our offsets are unreliable, so stop writing altogether.
+			bool ret = !write_failed &&
+			           fwrite(batch.data(), 1, batch.size(), file) == batch.size() &&
+			           fflush(file) == 0;
+
+			holder.lock();
+			if (ret)
+			{
+				for (auto &entry : batch_entries)
+				{
+					entry.offset += write_offset;
+					async.written_entries.push_back(entry);
+				}
+				write_offset += batch.size();
+			}
+			else if (!write_failed)
+			{
+				LOGE_LEVEL("Failed to write to stream archive.\n");
+				async.write_failed = true;
+			}
+
+			async.queued_bytes -= batch.size();
+			batch.clear();
+			batch_entries.clear();
+			async.space_cond.notify_all();
+		}
+	}
+
+	bool has_entry(ResourceTag tag, Hash hash) override
+	{
+		if (!test_resource_filter(tag, hash))
+			return false;
+
+		if (imported_metadata)
+			return find_entry_from_metadata(imported_metadata, tag, hash, nullptr);
+		else
+			return seen_blobs[tag].count(hash) != 0;
+	}
+
+	bool get_hash_list_for_resource_tag(ResourceTag tag, size_t *hash_count, Hash *hashes) override
+	{
+		if (imported_metadata)
+		{
+			size_t size = imported_metadata->lists[tag].count;
+			if (hashes)
+			{
+				if (size != *hash_count)
+					return false;
+			}
+			else
+				*hash_count = size;
+
+			if (hashes)
+			{
+				const auto *blocks = reinterpret_cast<const ExportedMetadataBlock *>(
+						reinterpret_cast<const uint8_t *>(imported_metadata) + imported_metadata->lists[tag].offset);
+				for (size_t i = 0; i < size; i++)
+					hashes[i] = blocks[i].hash;
+			}
+		}
+		else
+		{
+			size_t size = seen_blobs[tag].size();
+			if (hashes)
+			{
+				if (size != *hash_count)
+					return false;
+			}
+			else
+				*hash_count = size;
+
+			if (hashes)
+			{
+				Hash *iter = hashes;
+				for (auto &blob : seen_blobs[tag])
+					*iter++ = blob.first;
+
+				// Make replay more deterministic.
+				sort(hashes, hashes + size);
+			}
+		}
+
+		return true;
+	}
+
+	bool get_hash_view_for_resource_tag(ResourceTag tag, DatabaseHashView *view) override
+	{
+		// Only imported metadata (or an on-disk index) is kept as a sorted table we can point into.
+		if (mode != DatabaseMode::ReadOnly || !imported_metadata)
+			return false;
+
+		view->data = reinterpret_cast<const uint8_t *>(imported_metadata) + imported_metadata->lists[tag].offset;
+		view->count = size_t(imported_metadata->lists[tag].count);
+		view->stride = sizeof(ExportedMetadataBlock);
+		return true;
+	}
+
+	bool decode_payload_uncompressed(void *blob, size_t blob_size, const Entry &entry)
+	{
+		if (entry.header.uncompressed_size != blob_size || entry.header.payload_size != blob_size)
+			return false;
+
+		if (mapped_file)
+		{
+			auto *mapped = get_mapped_payload(entry);
+			if (!mapped)
+				return false;
+			memcpy(blob, mapped, blob_size);
+		}
+		else if (!read_file_at(blob, blob_size, entry.offset))
+			return false;
+
+		if (!verify_payload_checksum(entry.header, blob, blob_size))
+			return false;
+
+		return true;
+	}
+
+	bool decode_payload_compressed(ResourceTag tag, void *blob, size_t blob_size, const Entry &entry, bool concurrent)
+	{
+		if (entry.header.uncompressed_size != blob_size)
+			return false;
+
+		const uint8_t *src_zlib_buffer = nullptr;
+
+		if (mapped_file)
+		{
+			// Decompress straight from the mapping, no need to lock or copy.
+			src_zlib_buffer = get_mapped_payload(entry);
+			if (!src_zlib_buffer)
+				return false;
+		}
+		else
+		{
+			uint8_t *dst_zlib_buffer = nullptr;
+			if (concurrent)
+			{
+				// Workers keep their own staging buffer around, so we don't need to allocate on every read.
+				static thread_local std::vector<uint8_t> concurrent_zlib_buffer;
+				if (concurrent_zlib_buffer.size() < entry.header.payload_size)
+					concurrent_zlib_buffer.resize(entry.header.payload_size);
+				dst_zlib_buffer = concurrent_zlib_buffer.data();
+			}
+			else if (zlib_buffer_size < entry.header.payload_size)
+			{
+				auto *new_zlib_buffer = static_cast<uint8_t *>(realloc(zlib_buffer, entry.header.payload_size));
+				if (new_zlib_buffer)
+				{
+					zlib_buffer = new_zlib_buffer;
+					zlib_buffer_size = entry.header.payload_size;
+				}
+				else
+				{
+					free(zlib_buffer);
+					zlib_buffer = nullptr;
+					zlib_buffer_size = 0;
+				}
+
+				if (!zlib_buffer)
+					return false;
+
+				dst_zlib_buffer = zlib_buffer;
+			}
+			else
+				dst_zlib_buffer = zlib_buffer;
+
+			if (!read_file_at(dst_zlib_buffer, entry.header.payload_size, entry.offset))
+				return false;
+
+			src_zlib_buffer = dst_zlib_buffer;
+		}
+
+		if (!verify_payload_checksum(entry.header, src_zlib_buffer, entry.header.payload_size))
+			return false;
+
+		return decompress_payload(tag, get_compression_format(entry.header), static_cast<uint8_t *>(blob), blob_size,
+		                          src_zlib_buffer, entry.header.payload_size);
+	}
+
+#ifdef FOSSILIZE_HAVE_ZSTD
+	static ZSTD_DCtx *get_thread_zstd_dctx()
+	{
+		// Creating a decompression context is not free, so keep one around per thread.
+		struct ZstdDecompressionContext
+		{
+			~ZstdDecompressionContext() { ZSTD_freeDCtx(ctx); }
+			ZSTD_DCtx *ctx = ZSTD_createDCtx();
+		};
+		static thread_local ZstdDecompressionContext dctx;
+		return dctx.ctx;
+	}
+#endif
+
+	bool decompress_payload(ResourceTag tag, uint32_t format, uint8_t *blob, size_t blob_size,
+	                        const uint8_t *src, size_t src_size) const
+	{
+		switch (format)
+		{
+#ifdef FOSSILIZE_HAVE_ZSTD
+		case FOSSILIZE_COMPRESSION_ZSTD:
+		{
+			auto *dctx = get_thread_zstd_dctx();
+			if (!dctx)
+				return false;
+
+			size_t ret = ZSTD_decompressDCtx(dctx, blob, blob_size, src, src_size);
+			return !ZSTD_isError(ret) && ret == blob_size;
+		}
+
+		case FOSSILIZE_COMPRESSION_ZSTD_DICTIONARY:
+		{
+			auto *dctx = get_thread_zstd_dctx();
+			if (!dctx)
+				return false;
+
+			if (!dictionaries[tag].ddict)
+			{
+				LOGE_LEVEL("Payload requires a compression dictionary which is not present in archive.\n");
+				return false;
+			}
+
+			size_t ret = ZSTD_decompress_usingDDict(dctx, blob, blob_size, src, src_size, dictionaries[tag].ddict);
+			return !ZSTD_isError(ret) && ret == blob_size;
+		}
+#else
+		(void)tag;
+#endif
+
+#ifdef FOSSILIZE_HAVE_LZ4
+		case FOSSILIZE_COMPRESSION_LZ4:
+		{
+			if (blob_size > size_t(INT_MAX) || src_size > size_t(INT_MAX))
+				return false;
+			int ret = LZ4_decompress_safe(reinterpret_cast<const char *>(src), reinterpret_cast<char *>(blob),
+			                              int(src_size), int(blob_size));
+			return ret >= 0 && size_t(ret) == blob_size;
+		}
+#endif
+
+		case FOSSILIZE_COMPRESSION_DEFLATE:
+		{
+			mz_ulong zsize = blob_size;
+			if (mz_uncompress(blob, &zsize, src, src_size) != MZ_OK)
+				return false;
+			return zsize == blob_size;
+		}
+
+		default:
+			LOGE_LEVEL("Payload compression format %u is not supported by this build.\n", format);
+			return false;
+		}
+	}
+
+	bool decode_payload(ResourceTag tag, void *blob, size_t blob_size, const Entry &entry, bool concurrent)
+	{
+		if (get_compression_format(entry.header) == FOSSILIZE_COMPRESSION_NONE)
+			return decode_payload_uncompressed(blob, blob_size, entry);
+		else
+			return decode_payload_compressed(tag, blob, blob_size, entry, concurrent);
+	}
+
+	bool install_dictionary(ResourceTag tag, std::vector<uint8_t> data)
+	{
+#ifdef FOSSILIZE_HAVE_ZSTD
+		auto &dictionary = dictionaries[tag];
+		if (!dictionary.data.empty() || data.empty())
+			return false;
+
+		dictionary.data = std::move(data);
+		dictionary.ddict = ZSTD_createDDict(dictionary.data.data(), dictionary.data.size());
+		return dictionary.ddict != nullptr;
+#else
+		// We cannot make use of the dictionary, but payloads which do not use it can still be read.
+		(void)tag;
+		(void)data;
+		return true;
+#endif
+	}
+
+	bool add_compression_dictionary(ResourceTag tag, const void *data, size_t size) override
+	{
+#ifdef FOSSILIZE_HAVE_ZSTD
+		if (!alive || (mode != DatabaseMode::OverWrite && mode != DatabaseMode::ExclusiveOverWrite))
+			return false;
+
+		// Dictionaries must come before any other entry in the archive.
+		for (auto &blobs : seen_blobs)
+			if (!blobs.empty())
+				return false;
+
+		if (unsigned(tag) >= RESOURCE_COUNT || !data || !size || !dictionaries[tag].data.empty())
+			return false;
+
+		auto *bytes = static_cast<const uint8_t *>(data);
+		if (!install_dictionary(tag, std::vector<uint8_t>(bytes, bytes + size)))
+			return false;
+
+		return write_uncompressed_entry(stream_dictionary_tag, Hash(tag), data, size);
+#else
+		(void)tag;
+		(void)data;
+		(void)size;
+		return false;
+#endif
+	}
+
+	const char *get_db_path_for_hash(ResourceTag tag, Hash hash) override
+	{
+		if (!has_entry(tag, hash))
+			return nullptr;
+
+		return path.c_str();
+	}
+
+	size_t get_lookup_memory_usage() const override
+	{
+		size_t size = index_metadata.capacity() * sizeof(uint64_t);
+		for (auto &blobs : seen_blobs)
+			size += blobs.get_memory_usage();
+		return size;
+	}
+
+	void get_compression_statistics(DatabaseCompressionStatistics *stats) const override
+	{
+		stats->payload_count = compressed_payloads.load(std::memory_order_relaxed);
+		stats->input_bytes = compression_input_bytes.load(std::memory_order_relaxed);
+		stats->output_bytes = compression_output_bytes.load(std::memory_order_relaxed);
+		stats->compression_ns = compression_ns.load(std::memory_order_relaxed);
+	}
+
+	size_t compute_exported_metadata_size() const override
+	{
+		// Metadata loaded from an on-disk index is already in the exported format.
+		if (!index_metadata.empty())
+			return size_t(imported_metadata->size);
+
+		uint64_t counts[RESOURCE_COUNT];
+		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+			counts[i] = seen_blobs[i].size();
+		return compute_metadata_size(counts);
+	}
+
+	bool write_exported_metadata(void *data_, size_t size) const override
+	{
+		auto *data = static_cast<uint8_t *>(data_);
+		auto *header = static_cast<ExportedMetadataHeader *>(data_);
+		if (size < sizeof(*header))
+			return false;
+
+		if (!index_metadata.empty())
+		{
+			if (size != imported_metadata->size)
+				return false;
+			memcpy(data_, imported_metadata, size);
+			return true;
+		}
+
+		uint64_t counts[RESOURCE_COUNT];
+		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+			counts[i] = seen_blobs[i].size();
+
+		if (compute_metadata_size(counts) != size)
+			return false;
+		init_metadata_header(header, size, counts);
+
+		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+		{
+			auto *blocks = reinterpret_cast<ExportedMetadataBlock *>(data + header->lists[i].offset);
+			auto *pblocks = blocks;
+
+			for (auto &blob : seen_blobs[i])
+			{
+				auto &block = *pblocks;
+				block.hash = blob.first;
+				block.file_offset = blob.second.offset;
+				block.payload = blob.second.header;
+				pblocks++;
+			}
+
+			// Sorting here is somewhat important, since we will be using binary search when looking up exported metadata.
+			// Conserving memory is also somewhat important, so we should only have one copy of the data structures we need
+			// in immutable shared memory.
+			// For hashmaps we would either need to make a completely custom SHM compatible hashmap implementation, which
+			// would likely consume more memory either way.
+			std::sort(blocks, blocks + seen_blobs[i].size(), [](const ExportedMetadataBlock &a, const ExportedMetadataBlock &b) {
+				return a.hash < b.hash;
+			});
+		}
+
+		// Large lists additionally get a perfect hash, so lookups do not walk the binary search tree.
+		build_perfect_hash_tables(header);
+		return true;
+	}
+
+	const ExportedMetadataHeader *imported_metadata = nullptr;
+	std::vector<uint64_t> index_metadata;
+	FILE *file = nullptr;
+	const uint8_t *mapped_file = nullptr;
+	size_t mapped_file_size = 0;
+	string path;
+	FlatHashMap<Entry> seen_blobs[RESOURCE_COUNT];
+	DatabaseMode mode;
+	uint8_t *zlib_buffer = nullptr;
+	size_t zlib_buffer_size = 0;
+	CompressionContext compression_context;
+	std::unique_ptr<AsyncWriter> async_writer;
+	std::atomic<uint64_t> compressed_payloads{ 0 };
+	std::atomic<uint64_t> compression_input_bytes{ 0 };
+	std::atomic<uint64_t> compression_output_bytes{ 0 };
+	std::atomic<uint64_t> compression_ns{ 0 };
+#ifdef FOSSILIZE_HAVE_ZSTD
+	// Compression dictionaries are digested lazily, possibly from multiple compression workers.
+	std::mutex cdict_lock;
+
+	struct CompressionDictionary
+	{
+		~CompressionDictionary()
+		{
+			ZSTD_freeDDict(ddict);
+			for (auto *cdict : cdicts)
+				ZSTD_freeCDict(cdict);
+		}
+
+		std::vector<uint8_t> data;
+		ZSTD_DDict *ddict = nullptr;
+		// One for each compression level we use.
+		ZSTD_CDict *cdicts[2] = {};
+	};
+	CompressionDictionary dictionaries[RESOURCE_COUNT];
+#endif
+	uint64_t write_offset = 0;
+	bool alive = false;
+	bool index_dirty = false;
+	mutable bool reported_dictionary_mismatch = false;
+};
+
+size_t train_compression_dictionary(const void *samples, const size_t *sample_sizes, unsigned sample_count,
+                                    void *dictionary, size_t dictionary_capacity)
+{
+#ifdef FOSSILIZE_HAVE_ZSTD
+	size_t ret = ZDICT_trainFromBuffer(dictionary, dictionary_capacity, samples, sample_sizes, sample_count);
+	if (ZDICT_isError(ret))
+	{
+		LOGE_LEVEL("Failed to train compression dictionary: %s\n", ZDICT_getErrorName(ret));
+		return 0;
+	}
+	return ret;
+#else
+	(void)samples;
+	(void)sample_sizes;
+	(void)sample_count;
+	(void)dictionary;
+	(void)dictionary_capacity;
+	return 0;
+#endif
+}
+
+DatabaseInterface *create_stream_archive_database(const char *path, DatabaseMode mode)
+{
+	auto *db = new StreamArchive(path, mode);
+	return db;
+}
+
+#ifndef _WIN32
+// Just enough of HTTP/1.1 for the remote archive: GET requests for a single byte range on a kept-alive connection.
+// Only plain http is supported, and bodies must come with a Content-Length, which range responses always do.
+struct HTTPRangeClient
+{
+	struct Response
+	{
+		uint64_t begin;
+		uint64_t total_size;
+		// ETag and Last-Modified, to tell if the archive changed since it was cached.
+		std::string validator;
+	};
+
+	~HTTPRangeClient()
+	{
+		disconnect();
+	}
+
+	bool set_url(const std::string &url)
+	{
+		static const char scheme[] = "http://";
+		if (url.compare(0, sizeof(scheme) - 1, scheme) != 0)
+			return false;
+
+		auto authority_end = url.find('/', sizeof(scheme) - 1);
+		if (authority_end == std::string::npos)
+			return false;
+
+		host = url.substr(sizeof(scheme) - 1, authority_end - (sizeof(scheme) - 1));
+		resource = url.substr(authority_end);
+		port = "80";
+
+		auto colon = host.rfind(':');
+		if (colon != std::string::npos)
+		{
+			port = host.substr(colon + 1);
+			host.resize(colon);
+		}
+
+		return !host.empty() && !port.empty();
+	}
+
+	// The body may be shorter than requested if the range goes past the end of the file.
+	bool get_range(uint64_t begin, uint64_t end, std::vector<uint8_t> &body, Response &response)
+	{
+		// The server may have closed an idle connection in the meantime, so retry once on a fresh one.
+		for (unsigned attempt = 0; attempt < 2; attempt++)
+		{
+			bool reused = fd >= 0;
+			if (!reused && !connect_to_host())
+				return false;
+
+			auto result = request_range(begin, end, body, response);
+			if (result == Result::Success)
+				return true;
+
+			disconnect();
+			if (result == Result::Failed || !reused)
+				return false;
+		}
+
+		return false;
+	}
+
+private:
+	enum class Result { Success, Failed, ConnectionLost };
+
+	std::string host;
+	std::string port;
+	std::string resource;
+	int fd = -1;
+	// Bytes received past the end of the last response.
+	std::vector<uint8_t> pending;
+
+	void disconnect()
+	{
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+		pending.clear();
+	}
+
+	bool connect_to_host()
+	{
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo *addresses = nullptr;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+		{
+			LOGE_LEVEL("Failed to resolve %s.\n", host.c_str());
+			return false;
+		}
+
+		for (auto *addr = addresses; addr && fd < 0; addr = addr->ai_next)
+		{
+			fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+			if (fd < 0)
+				continue;
+
+			// Don't hang forever on a dead server.
+			timeval timeout = { 30, 0 };
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+			int one = 1;
+			setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+			// Requests are small and we always wait for the response.
+			int nodelay = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+			if (connect(fd, addr->ai_addr, addr->ai_addrlen) != 0)
+			{
+				close(fd);
+				fd = -1;
+			}
+		}
+
+		freeaddrinfo(addresses);
+		if (fd < 0)
+			LOGE_LEVEL("Failed to connect to %s:%s.\n", host.c_str(), port.c_str());
+		return fd >= 0;
+	}
+
+	bool send_all(const char *data, size_t size)
+	{
+#ifdef MSG_NOSIGNAL
+		const int flags = MSG_NOSIGNAL;
+#else
+		const int flags = 0;
+#endif
+		while (size)
+		{
+			ssize_t ret = send(fd, data, size, flags);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				return false;
+			data += ret;
+			size -= size_t(ret);
+		}
+		return true;
+	}
+
+	// Appends to pending. Returns false once the connection is closed or broken.
+	bool receive_more()
+	{
+		uint8_t buffer[64 * 1024];
+		for (;;)
+		{
+			ssize_t ret = recv(fd, buffer, sizeof(buffer), 0);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret <= 0)
+				return false;
+			pending.insert(pending.end(), buffer, buffer + ret);
+			return true;
+		}
+	}
+
+	static bool header_name_equals(const std::string &line, size_t name_size, const char *name)
+	{
+		if (name_size != strlen(name))
+			return false;
+		for (size_t i = 0; i < name_size; i++)
+			if (tolower(static_cast<unsigned char>(line[i])) != name[i])
+				return false;
+		return true;
+	}
+
+	Result request_range(uint64_t begin, uint64_t end, std::vector<uint8_t> &body, Response &response)
+	{
+		char range[64];
+		snprintf(range, sizeof(range), "bytes=%" PRIu64 "-%" PRIu64, begin, end - 1);
+		std::string request = "GET " + resource + " HTTP/1.1\r\nHost: " + host +
+		                      "\r\nRange: " + range + "\r\nConnection: keep-alive\r\n\r\n";
+		if (!send_all(request.data(), request.size()))
+			return Result::ConnectionLost;
+
+		static const uint8_t header_end_marker[] = { '\r', '\n', '\r', '\n' };
+		size_t header_size;
+		for (;;)
+		{
+			auto itr = std::search(pending.begin(), pending.end(), header_end_marker, header_end_marker + 4);
+			if (itr != pending.end())
+			{
+				header_size = size_t(itr - pending.begin()) + 4;
+				break;
+			}
+
+			bool received_nothing = pending.empty();
+			if (!receive_more())
+				return received_nothing ? Result::ConnectionLost : Result::Failed;
+		}
+
+		std::string headers(pending.begin(), pending.begin() + header_size);
+		pending.erase(pending.begin(), pending.begin() + header_size);
+
+		unsigned status = 0;
+		if (sscanf(headers.c_str(), "HTTP/%*u.%*u %u", &status) != 1)
+			return Result::Failed;
+
+		uint64_t content_length = UINT64_MAX;
+		uint64_t range_end = 0;
+		bool has_range = false;
+		bool keep_alive = true;
+		std::string etag, last_modified;
+
+		size_t line_begin = headers.find("\r\n") + 2;
+		while (line_begin < headers.size())
+		{
+			size_t line_end = headers.find("\r\n", line_begin);
+			std::string line = headers.substr(line_begin, line_end - line_begin);
+			line_begin = line_end + 2;
+
+			auto colon = line.find(':');
+			if (colon == std::string::npos)
+				continue;
+			auto value_begin = line.find_first_not_of(' ', colon + 1);
+			std::string value = value_begin != std::string::npos ? line.substr(value_begin) : std::string();
+
+			if (header_name_equals(line, colon, "content-length"))
+				content_length = strtoull(value.c_str(), nullptr, 10);
+			else if (header_name_equals(line, colon, "content-range"))
+			{
+				has_range = sscanf(value.c_str(), "bytes %" SCNu64 "-%" SCNu64 "/%" SCNu64,
+				                   &response.begin, &range_end, &response.total_size) == 3;
+			}
+			else if (header_name_equals(line, colon, "etag"))
+				etag = value;
+			else if (header_name_equals(line, colon, "last-modified"))
+				last_modified = value;
+			else if (header_name_equals(line, colon, "connection"))
+				keep_alive = value != "close";
+			else if (header_name_equals(line, colon, "transfer-encoding"))
+				return Result::Failed;
+		}
+
+		if (status != 206 || !has_range || content_length == UINT64_MAX ||
+		    range_end < response.begin || content_length != range_end - response.begin + 1)
+		{
+			LOGE_LEVEL("Unexpected response to range request for %s (status %u).\n", resource.c_str(), status);
+			return Result::Failed;
+		}
+
+		while (pending.size() < content_length)
+			if (!receive_more())
+				return Result::Failed;
+
+		body.assign(pending.begin(), pending.begin() + ptrdiff_t(content_length));
+		pending.erase(pending.begin(), pending.begin() + ptrdiff_t(content_length));
+		response.validator = etag + "|" + last_modified;
+
+		if (!keep_alive)
+			disconnect();
+		return Result::Success;
+	}
+};
+#endif
+
+// Reads a stream archive from a web server.
+// Everything fetched is written to a sparse local copy of the archive, which a regular StreamArchive reads from,
+// so index lookups, dictionaries and decoding work just like for local archives.
+// The only rule is that the bytes the StreamArchive is about to touch must have been fetched first.
+// The local copy persists in the cache directory, so later runs only fetch what they have not seen yet.
+struct RemoteArchive : DatabaseInterface
+{
+	// Fetches are in whole blocks, which makes it easy to track what has been cached.
+	enum { BlockSize = 64 * 1024 };
+	// Missing runs separated by at most this many cached blocks are fetched in one request,
+	// a few redundant blocks are cheaper than another round trip.
+	enum { MaxMergeGapBlocks = 4 };
+	enum { MaxRequestBlocks = 256 };
+
+	struct Range
+	{
+		uint64_t begin;
+		uint64_t end;
+	};
+
+	RemoteArchive(const char *url_, const char *cache_directory_, DatabaseMode mode_)
+		: DatabaseInterface(mode_), url(url_), mode(mode_)
+	{
+		if (cache_directory_)
+			cache_directory = cache_directory_;
+		else if (const char *env = getenv("FOSSILIZE_REMOTE_CACHE_DIR"))
+			cache_directory = env;
+		else if (const char *tmp = getenv("TMPDIR"))
+			cache_directory = tmp;
+		else
+			cache_directory = "/tmp";
+	}
+
+	~RemoteArchive()
+	{
+		archive.reset();
+		if (cache_file)
+		{
+			persist_block_map();
+			fclose(cache_file);
+		}
+	}
+
+	bool prepare() override
+	{
+		if (mode != DatabaseMode::ReadOnly)
+			return false;
+
+#ifdef _WIN32
+		LOGE_LEVEL("Remote archives are not supported on this platform.\n");
+		return false;
+#else
+		if (!client.set_url(url))
+		{
+			LOGE_LEVEL("Only http:// URLs are supported for remote archives, got %s.\n", url.c_str());
+			return false;
+		}
+
+		// The first block tells us the size of the archive, and holds the header and any dictionaries anyway.
+		std::vector<uint8_t> body;
+		HTTPRangeClient::Response response = {};
+		if (!client.get_range(0, BlockSize, body, response) || response.begin != 0 ||
+		    response.total_size < StreamArchive::MagicSize)
+		{
+			LOGE_LEVEL("Failed to fetch remote archive %s.\n", url.c_str());
+			return false;
+		}
+
+		total_size = response.total_size;
+		validator = response.validator;
+		if (!open_cache() || !write_blocks(0, body))
+			return false;
+
+		if (!fetch_metadata())
+			return false;
+
+		archive.reset(new StreamArchive(cache_path, DatabaseMode::ReadOnly));
+		if (!impl->imported_metadata.empty())
+			archive->add_imported_metadata(impl->imported_metadata.front());
+		return archive->prepare();
+#endif
+	}
+
+	bool read_entry(ResourceTag tag, Hash hash, size_t *blob_size, void *blob, PayloadReadFlags flags) override
+	{
+		if (!archive || !test_resource_filter(tag, hash))
+			return false;
+
+		// The size is known from the index alone.
+		if (blob && !fetch_entry(tag, hash))
+			return false;
+
+		return archive->read_entry(tag, hash, blob_size, blob, flags);
+	}
+
+	bool read_entry_zero_copy(ResourceTag tag, Hash hash, size_t *blob_size, const void **blob, PayloadReadFlags flags) override
+	{
+		if (!archive || !test_resource_filter(tag, hash) || !fetch_entry(tag, hash))
+			return false;
+		return archive->read_entry_zero_copy(tag, hash, blob_size, blob, flags);
+	}
+
+	bool write_entry(ResourceTag, Hash, const void *, size_t, PayloadWriteFlags) override
+	{
+		return false;
+	}
+
+	bool has_entry(ResourceTag tag, Hash hash) override
+	{
+		return archive && test_resource_filter(tag, hash) && archive->has_entry(tag, hash);
+	}
+
+	// Rather than hinting the OS, this is where the remote archive gets to coalesce fetches.
+	bool prefetch_entries(ResourceTag tag, const Hash *hashes, size_t count) override
+	{
+		if (!archive)
+			return false;
+
+		std::vector<Range> ranges;
+		ranges.reserve(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			StreamArchive::Entry entry;
+			if (test_resource_filter(tag, hashes[i]) && archive->find_entry(tag, hashes[i], entry))
+				ranges.push_back(get_entry_range(entry));
+		}
+
+		return fetch_ranges(ranges.data(), ranges.size());
+	}
+
+	bool get_entry_storage_offset(ResourceTag tag, Hash hash, uint64_t *offset) override
+	{
+		StreamArchive::Entry entry;
+		if (!archive || !offset || !test_resource_filter(tag, hash) || !archive->find_entry(tag, hash, entry))
+			return false;
+
+		*offset = entry.offset;
+		return true;
+	}
+
+	bool get_hash_list_for_resource_tag(ResourceTag tag, size_t *num_hashes, Hash *hashes) override
+	{
+		if (!archive)
+			return false;
+
+		size_t count = 0;
+		if (!archive->get_hash_list_for_resource_tag(tag, &count, nullptr))
+			return false;
+		std::vector<Hash> all_hashes(count);
+		if (!archive->get_hash_list_for_resource_tag(tag, &count, all_hashes.data()))
+			return false;
+
+		all_hashes.erase(std::remove_if(all_hashes.begin(), all_hashes.end(), [&](Hash hash) {
+			return !test_resource_filter(tag, hash);
+		}), all_hashes.end());
+
+		if (hashes)
+		{
+			if (*num_hashes != all_hashes.size())
+				return false;
+			std::copy(all_hashes.begin(), all_hashes.end(), hashes);
+		}
+		else
+			*num_hashes = all_hashes.size();
+
+		return true;
+	}
+
+	void flush() override
+	{
+	}
+
+	const char *get_db_path_for_hash(ResourceTag tag, Hash hash) override
+	{
+		return has_entry(tag, hash) ? url.c_str() : nullptr;
+	}
+
+	size_t get_lookup_memory_usage() const override
+	{
+		return block_map.capacity() + (archive ? archive->get_lookup_memory_usage() : 0);
+	}
+
+	size_t compute_exported_metadata_size() const override
+	{
+		return archive ? archive->compute_exported_metadata_size() : 0;
+	}
+
+	bool write_exported_metadata(void *data, size_t size) const override
+	{
+		return archive && archive->write_exported_metadata(data, size);
+	}
+
+	static Range get_entry_range(const StreamArchive::Entry &entry)
+	{
+		return { entry.offset - sizeof(StreamArchive::PayloadHeaderRaw), entry.offset + entry.header.payload_size };
+	}
+
+	bool fetch_entry(ResourceTag tag, Hash hash)
+	{
+		StreamArchive::Entry entry;
+		if (!archive->find_entry(tag, hash, entry))
+			return false;
+		auto range = get_entry_range(entry);
+		return fetch_ranges(&range, 1);
+	}
+
+	bool block_is_cached(uint64_t block) const
+	{
+		return (block_map[block >> 3] & (1u << (block & 7))) != 0;
+	}
+
+	// Writes whole blocks starting at offset, which must be block aligned.
+	bool write_blocks(uint64_t offset, const std::vector<uint8_t> &data)
+	{
+		if (fseek(cache_file, long(offset), SEEK_SET) < 0 ||
+		    fwrite(data.data(), 1, data.size(), cache_file) != data.size() ||
+		    fflush(cache_file) != 0)
+		{
+			LOGE_LEVEL("Failed to write to remote archive cache %s.\n", cache_path.c_str());
+			return false;
+		}
 
-				dst_zlib_buffer = zlib_buffer;
-			}
-			else
-				dst_zlib_buffer = zlib_buffer;
+		uint64_t end = offset + data.size();
+		for (uint64_t block = offset / BlockSize; block * BlockSize < end; block++)
+			if (std::min<uint64_t>((block + 1) * BlockSize, total_size) <= end)
+				block_map[block >> 3] |= uint8_t(1u << (block & 7));
+		return true;
+	}
 
-			if (fseek(file, entry.offset, SEEK_SET) < 0)
-				return false;
-			if (fread(dst_zlib_buffer, 1, entry.header.payload_size, file) != entry.header.payload_size)
+	bool fetch_ranges(const Range *ranges, size_t count)
+	{
+#ifdef _WIN32
+		(void)ranges;
+		(void)count;
+		return false;
+#else
+		std::vector<uint64_t> missing;
+		for (size_t i = 0; i < count; i++)
+		{
+			if (ranges[i].begin >= ranges[i].end || ranges[i].end > total_size)
 				return false;
+			for (uint64_t block = ranges[i].begin / BlockSize; block * BlockSize < ranges[i].end; block++)
+				missing.push_back(block);
 		}
 
-		if (entry.header.crc != 0) // Verify checksum.
+		// There is one connection and one cache file, so fetches are serialized.
+		// Reads of cached entries only hold the lock for the block lookup.
+		std::lock_guard<std::mutex> holder(lock);
+
+		missing.erase(std::remove_if(missing.begin(), missing.end(), [this](uint64_t block) {
+			return block_is_cached(block);
+		}), missing.end());
+		if (missing.empty())
+			return true;
+
+		std::sort(missing.begin(), missing.end());
+		missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+		std::vector<uint8_t> body;
+		for (size_t i = 0; i < missing.size(); )
 		{
-			auto disk_crc = uint32_t(mz_crc32(MZ_CRC32_INIT, dst_zlib_buffer, entry.header.payload_size));
-			if (disk_crc != entry.header.crc)
+			uint64_t first = missing[i];
+			uint64_t last = first;
+			for (i++; i < missing.size() && missing[i] - last <= MaxMergeGapBlocks + 1 &&
+			          missing[i] - first < MaxRequestBlocks; i++)
+				last = missing[i];
+
+			uint64_t begin = first * BlockSize;
+			uint64_t end = std::min<uint64_t>((last + 1) * BlockSize, total_size);
+
+			HTTPRangeClient::Response response = {};
+			if (!client.get_range(begin, end, body, response))
+				return false;
+
+			if (response.begin != begin || body.size() != end - begin ||
+			    response.total_size != total_size || response.validator != validator)
 			{
-				LOGE_LEVEL("CRC mismatch!\n");
+				LOGE_LEVEL("Remote archive %s changed while reading from it.\n", url.c_str());
 				return false;
 			}
-		}
 
-		mz_ulong zsize = blob_size;
-		if (mz_uncompress(static_cast<unsigned char *>(blob), &zsize, dst_zlib_buffer, entry.header.payload_size) != MZ_OK)
-			return false;
-		if (zsize != blob_size)
-			return false;
+			if (!write_blocks(begin, body))
+				return false;
+		}
 
 		return true;
+#endif
 	}
 
-	bool decode_payload(void *blob, size_t blob_size, const Entry &entry, bool concurrent)
+	bool read_cached(void *data, uint64_t begin, uint64_t end)
 	{
-		if (entry.header.format == FOSSILIZE_COMPRESSION_NONE)
-			return decode_payload_uncompressed(blob, blob_size, entry, concurrent);
-		else if (entry.header.format == FOSSILIZE_COMPRESSION_DEFLATE)
-			return decode_payload_deflate(blob, blob_size, entry, concurrent);
-		else
+		Range range = { begin, end };
+		if (!fetch_ranges(&range, 1))
 			return false;
+		std::lock_guard<std::mutex> holder(lock);
+		return read_file_at(cache_file, data, size_t(end - begin), begin);
 	}
 
-	const char *get_db_path_for_hash(ResourceTag tag, Hash hash) override
+	// Fetches everything StreamArchive::prepare() reads, i.e. the header, dictionaries and index.
+	bool fetch_metadata()
 	{
-		if (!has_entry(tag, hash))
-			return nullptr;
+		uint8_t trailer[StreamArchive::IndexTrailerSize];
+		if (total_size < StreamArchive::MagicSize + sizeof(trailer) ||
+		    !read_cached(trailer, total_size - sizeof(trailer), total_size))
+			return false;
 
-		return path.c_str();
-	}
+		uint64_t index_offset, trailer_magic;
+		StreamArchive::convert_from_le(index_offset, trailer + 0);
+		StreamArchive::convert_from_le(trailer_magic, trailer + 8);
 
-	size_t compute_exported_metadata_size() const override
-	{
-		size_t size = sizeof(ExportedMetadataHeader);
-		for (auto &blobs : seen_blobs)
-			size += blobs.size() * sizeof(ExportedMetadataBlock);
-		return size;
+		// Without an index the StreamArchive has to scan every entry, so we might as well fetch it all in one go.
+		// fossilize-compact and fossilize-merge-db both write archives with an index.
+		if (trailer_magic != stream_index_magic || index_offset < StreamArchive::MagicSize || index_offset >= total_size)
+		{
+			LOGW_LEVEL("Remote archive %s has no index, fetching all of it.\n", url.c_str());
+			Range range = { 0, total_size };
+			return fetch_ranges(&range, 1);
+		}
+
+		Range index_range = { index_offset, total_size };
+		if (!fetch_ranges(&index_range, 1))
+			return false;
+
+		// Dictionaries are stored right after the file header.
+		char dictionary_name[FOSSILIZE_BLOB_HASH_LENGTH + 1];
+		StreamArchive::format_entry_name(dictionary_name, stream_dictionary_tag, 0);
+		const uint64_t entry_header_size = FOSSILIZE_BLOB_HASH_LENGTH + sizeof(StreamArchive::PayloadHeaderRaw);
+
+		uint64_t offset = StreamArchive::MagicSize;
+		while (offset + entry_header_size <= total_size)
+		{
+			uint8_t bytes[FOSSILIZE_BLOB_HASH_LENGTH + sizeof(StreamArchive::PayloadHeaderRaw)];
+			if (!read_cached(bytes, offset, offset + entry_header_size))
+				return false;
+			if (memcmp(bytes, dictionary_name, FOSSILIZE_BLOB_HASH_LENGTH - 16) != 0)
+				break;
+
+			PayloadHeader header = {};
+			StreamArchive::convert_from_le(header, *reinterpret_cast<const StreamArchive::PayloadHeaderRaw *>(
+					bytes + FOSSILIZE_BLOB_HASH_LENGTH));
+			offset += entry_header_size;
+			if (offset + header.payload_size > total_size)
+				return false;
+
+			Range range = { offset, offset + header.payload_size };
+			if (header.payload_size && !fetch_ranges(&range, 1))
+				return false;
+			offset += header.payload_size;
+		}
+
+		return true;
 	}
 
-	bool write_exported_metadata(void *data_, size_t size) const override
+	// The block map lives next to the cached copy:
+	// magic, archive size, block size, validator size, validator, then one bit per block.
+	static const uint64_t block_map_magic = 0xf055111dcac4eull;
+
+	bool read_block_map(std::vector<uint8_t> &map) const
 	{
-		auto *data = static_cast<uint8_t *>(data_);
-		auto *header = static_cast<ExportedMetadataHeader *>(data_);
-		if (size < sizeof(*header))
+		FILE *file = fopen(block_map_path.c_str(), "rb");
+		if (!file)
 			return false;
 
-		header->magic = ExportedMetadataMagic;
-		header->size = size;
+		uint64_t header[2] = {};
+		uint32_t sizes[2] = {};
+		bool ret = fread(header, sizeof(header), 1, file) == 1 && fread(sizes, sizeof(sizes), 1, file) == 1 &&
+		           header[0] == block_map_magic && header[1] == total_size && sizes[0] == BlockSize &&
+		           sizes[1] == validator.size();
 
-		size_t offset = sizeof(*header);
-		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+		if (ret)
 		{
-			header->lists[i].offset = offset;
-			header->lists[i].count = seen_blobs[i].size();
-			offset += header->lists[i].count * sizeof(ExportedMetadataBlock);
+			std::string stored_validator(validator.size(), '\0');
+			ret = fread(&stored_validator[0], 1, stored_validator.size(), file) == stored_validator.size() &&
+			      stored_validator == validator;
 		}
 
-		if (offset != size)
-			return false;
+		if (ret)
+		{
+			map.resize(block_map.size());
+			ret = fread(map.data(), 1, map.size(), file) == map.size();
+		}
 
-		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+		fclose(file);
+		return ret;
+	}
+
+	bool open_cache()
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "fossilize-remote-%016" PRIx64, compute_xxh64(url.data(), url.size(), 0));
+		cache_path = Path::join(cache_directory, std::string(name) + ".foz");
+		block_map_path = cache_path + ".blocks";
+
+		uint64_t block_count = (total_size + BlockSize - 1) / BlockSize;
+		block_map.resize((block_count + 7) / 8);
+
+		// A stale copy of an older version of the archive is useless, start over.
+		bool valid = read_block_map(block_map);
+		if (!valid)
+			std::fill(block_map.begin(), block_map.end(), 0);
+
+		cache_file = fopen(cache_path.c_str(), valid ? "r+b" : "w+b");
+		if (!cache_file && valid)
 		{
-			auto *blocks = reinterpret_cast<ExportedMetadataBlock *>(data + header->lists[i].offset);
-			auto *pblocks = blocks;
+			std::fill(block_map.begin(), block_map.end(), 0);
+			cache_file = fopen(cache_path.c_str(), "w+b");
+		}
 
-			for (auto &blob : seen_blobs[i])
-			{
-				auto &block = *pblocks;
-				block.hash = blob.first;
-				block.file_offset = blob.second.offset;
-				block.payload = blob.second.header;
-				pblocks++;
-			}
+		if (!cache_file)
+		{
+			LOGE_LEVEL("Failed to open remote archive cache %s.\n", cache_path.c_str());
+			return false;
+		}
 
-			// Sorting here is somewhat important, since we will be using binary search when looking up exported metadata.
-			// Conserving memory is also somewhat important, so we should only have one copy of the data structures we need
-			// in immutable shared memory.
-			// For hashmaps we would either need to make a completely custom SHM compatible hashmap implementation, which
-			// would likely consume more memory either way.
-			std::sort(blocks, blocks + seen_blobs[i].size(), [](const ExportedMetadataBlock &a, const ExportedMetadataBlock &b) {
-				return a.hash < b.hash;
-			});
+		// Extend the file to its full size up front, since the StreamArchive maps it once in prepare().
+		// Blocks which have not been fetched yet are left as holes.
+		uint8_t last_byte = 0;
+		if (fseek(cache_file, long(total_size - 1), SEEK_SET) < 0)
+			return false;
+		if (fread(&last_byte, 1, 1, cache_file) != 1)
+		{
+			if (fseek(cache_file, long(total_size - 1), SEEK_SET) < 0 ||
+			    fwrite(&last_byte, 1, 1, cache_file) != 1 || fflush(cache_file) != 0)
+				return false;
 		}
 
 		return true;
 	}
 
-	const ExportedMetadataHeader *imported_metadata = nullptr;
-	FILE *file = nullptr;
-	string path;
-	unordered_map<Hash, Entry> seen_blobs[RESOURCE_COUNT];
+	// Other processes may share the cache, so merge with what they cached before replacing the map.
+	void persist_block_map()
+	{
+		std::vector<uint8_t> map;
+		if (read_block_map(map))
+			for (size_t i = 0; i < map.size(); i++)
+				block_map[i] |= map[i];
+
+		std::string tmp_path = block_map_path + "." + std::to_string(getpid());
+		FILE *file = fopen(tmp_path.c_str(), "wb");
+		if (!file)
+			return;
+
+		uint64_t header[2] = { block_map_magic, total_size };
+		uint32_t sizes[2] = { BlockSize, uint32_t(validator.size()) };
+		bool ret = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(sizes, sizeof(sizes), 1, file) == 1 &&
+		           fwrite(validator.data(), 1, validator.size(), file) == validator.size() &&
+		           fwrite(block_map.data(), 1, block_map.size(), file) == block_map.size();
+		ret = fclose(file) == 0 && ret;
+
+		if (!ret || rename(tmp_path.c_str(), block_map_path.c_str()) != 0)
+			remove(tmp_path.c_str());
+	}
+
+	std::string url;
+	std::string cache_directory;
+	std::string cache_path;
+	std::string block_map_path;
 	DatabaseMode mode;
-	uint8_t *zlib_buffer = nullptr;
-	size_t zlib_buffer_size = 0;
-	bool alive = false;
-	std::mutex read_lock;
+#ifndef _WIN32
+	HTTPRangeClient client;
+#endif
+	std::unique_ptr<StreamArchive> archive;
+	std::mutex lock;
+	FILE *cache_file = nullptr;
+	uint64_t total_size = 0;
+	std::string validator;
+	std::vector<uint8_t> block_map;
 };
 
-DatabaseInterface *create_stream_archive_database(const char *path, DatabaseMode mode)
+DatabaseInterface *create_remote_archive_database(const char *url, DatabaseMode mode, const char *cache_directory)
 {
-	auto *db = new StreamArchive(path, mode);
-	return db;
+	return new RemoteArchive(url, cache_directory, mode);
+}
+
+static bool is_remote_archive_path(const char *path)
+{
+	return strncmp(path, "http://", 7) == 0 || strncmp(path, "https://", 8) == 0;
+}
+
+// Extra read-only archives of the concurrent database may live on a web server as well.
+static DatabaseInterface *create_read_only_archive_database(const char *path)
+{
+	if (is_remote_archive_path(path))
+		return create_remote_archive_database(path, DatabaseMode::ReadOnly, nullptr);
+	else
+		return create_stream_archive_database(path, DatabaseMode::ReadOnly);
 }
 
 DatabaseInterface *create_database(const char *path, DatabaseMode mode)
 {
+	if (is_remote_archive_path(path))
+		return create_remote_archive_database(path, mode, nullptr);
+
 	auto ext = Path::ext(path);
 	if (ext == "foz")
 		return create_stream_archive_database(path, mode);
 	else if (ext == "zip")
 		return create_zip_archive_database(path, mode);
 	else
-		return create_dumb_folder_database(path, mode);
+		return create_dumb_folder_database(path, mode, 0);
+}
+
+// Filters another database down to shader modules, see create_shader_module_store_database().
+struct ShaderModuleStore : DatabaseInterface
+{
+	ShaderModuleStore(const char *path, DatabaseMode mode_)
+		: DatabaseInterface(mode_), store(create_database(path, mode_))
+	{
+	}
+
+	bool is_visible(ResourceTag tag) const
+	{
+		return tag == RESOURCE_SHADER_MODULE && store;
+	}
+
+	bool prepare() override
+	{
+		if (!store)
+			return false;
+
+		// Metadata imported through the concurrent database describes the database underneath.
+		for (auto *header : impl->imported_metadata)
+			store->add_imported_metadata(header);
+		return store->prepare();
+	}
+
+	bool read_entry(ResourceTag tag, Hash hash, size_t *blob_size, void *blob, PayloadReadFlags flags) override
+	{
+		return is_visible(tag) && store->read_entry(tag, hash, blob_size, blob, flags);
+	}
+
+	bool read_entry_zero_copy(ResourceTag tag, Hash hash, size_t *blob_size, const void **blob, PayloadReadFlags flags) override
+	{
+		return is_visible(tag) && store->read_entry_zero_copy(tag, hash, blob_size, blob, flags);
+	}
+
+	bool write_entry(ResourceTag tag, Hash hash, const void *blob, size_t blob_size, PayloadWriteFlags flags) override
+	{
+		return is_visible(tag) && store->write_entry(tag, hash, blob, blob_size, flags);
+	}
+
+	bool add_compression_dictionary(ResourceTag tag, const void *dictionary, size_t size) override
+	{
+		return is_visible(tag) && store->add_compression_dictionary(tag, dictionary, size);
+	}
+
+	bool set_async_write_policy(const DatabaseAsyncWritePolicy &policy) override
+	{
+		return store && store->set_async_write_policy(policy);
+	}
+
+	bool has_entry(ResourceTag tag, Hash hash) override
+	{
+		return is_visible(tag) && store->has_entry(tag, hash);
+	}
+
+	bool prefetch_entries(ResourceTag tag, const Hash *hashes, size_t count) override
+	{
+		return is_visible(tag) && store->prefetch_entries(tag, hashes, count);
+	}
+
+	bool get_entry_storage_offset(ResourceTag tag, Hash hash, uint64_t *offset) override
+	{
+		return is_visible(tag) && store->get_entry_storage_offset(tag, hash, offset);
+	}
+
+	bool get_hash_list_for_resource_tag(ResourceTag tag, size_t *num_hashes, Hash *hashes) override
+	{
+		if (is_visible(tag))
+			return store->get_hash_list_for_resource_tag(tag, num_hashes, hashes);
+
+		if (hashes)
+			return *num_hashes == 0;
+		*num_hashes = 0;
+		return true;
+	}
+
+	bool get_hash_view_for_resource_tag(ResourceTag tag, DatabaseHashView *view) override
+	{
+		if (is_visible(tag))
+			return store->get_hash_view_for_resource_tag(tag, view);
+
+		*view = {};
+		return true;
+	}
+
+	void flush() override
+	{
+		if (store)
+			store->flush();
+	}
+
+	const char *get_db_path_for_hash(ResourceTag tag, Hash hash) override
+	{
+		return is_visible(tag) ? store->get_db_path_for_hash(tag, hash) : nullptr;
+	}
+
+	size_t get_lookup_memory_usage() const override
+	{
+		return store ? store->get_lookup_memory_usage() : 0;
+	}
+
+	void get_compression_statistics(DatabaseCompressionStatistics *stats) const override
+	{
+		if (store)
+			store->get_compression_statistics(stats);
+		else
+			*stats = {};
+	}
+
+	size_t compute_exported_metadata_size() const override
+	{
+		return store ? store->compute_exported_metadata_size() : 0;
+	}
+
+	bool write_exported_metadata(void *data, size_t size) const override
+	{
+		return store && store->write_exported_metadata(data, size);
+	}
+
+	std::unique_ptr<DatabaseInterface> store;
+};
+
+DatabaseInterface *create_shader_module_store_database(const char *path, DatabaseMode mode)
+{
+	return new ShaderModuleStore(path, mode);
+}
+
+static bool is_shader_module_store_path(const char *path)
+{
+	static const char suffix[] = ".modules.foz";
+	size_t len = strlen(path);
+	return len >= sizeof(suffix) - 1 && strcmp(path + len - (sizeof(suffix) - 1), suffix) == 0;
 }
 
 struct ConcurrentDatabase : DatabaseInterface
@@ -1682,33 +4662,168 @@ struct ConcurrentDatabase : DatabaseInterface
 		}
 
 		for (size_t i = 0; i < num_extra_paths; i++)
-			extra_readonly.emplace_back(create_stream_archive_database(extra_paths[i], DatabaseMode::ReadOnly));
+		{
+			bool module_store = is_shader_module_store_path(extra_paths[i]);
+			if (module_store)
+				extra_readonly.emplace_back(create_shader_module_store_database(extra_paths[i], DatabaseMode::ReadOnly));
+			else
+				extra_readonly.emplace_back(create_read_only_archive_database(extra_paths[i]));
+			extra_is_module_store.push_back(module_store);
+		}
+	}
+
+	// A store holds the modules of many applications. When replaying, its modules are only looked up
+	// when something refers to them, rather than being listed as part of this database.
+	bool is_listed_sub_database(size_t extra_index) const
+	{
+		return mode != DatabaseMode::ReadOnly || !extra_is_module_store[extra_index];
+	}
+
+	bool has_module_store_entry(ResourceTag tag, Hash hash) const
+	{
+		if (tag != RESOURCE_SHADER_MODULE || mode != DatabaseMode::ReadOnly)
+			return false;
+
+		for (size_t i = 0; i < extra_readonly.size(); i++)
+			if (extra_is_module_store[i] && extra_readonly[i] && extra_readonly[i]->has_entry(tag, hash))
+				return true;
+
+		return false;
+	}
+
+	void flush() override
+	{
+		if (writeonly_interface)
+			writeonly_interface->flush();
+	}
+
+	bool set_async_write_policy(const DatabaseAsyncWritePolicy &policy) override
+	{
+		if (mode == DatabaseMode::ReadOnly || policy.batch_size == 0)
+			return false;
+
+		// Applied once the write-only archive is created.
+		async_write_policy.reset(new DatabaseAsyncWritePolicy(policy));
+		return true;
 	}
 
-	void flush() override
-	{
-		if (writeonly_interface)
-			writeonly_interface->flush();
+	// source_index follows the get_sub_database() convention and is only tracked in ReadOnly mode.
+	bool prime_read_only_hashes(DatabaseInterface &interface, unsigned source_index)
+	{
+		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+		{
+			auto tag = static_cast<ResourceTag>(i);
+			const auto prime = [&](Hash hash) {
+				if (test_resource_filter(tag, hash))
+				{
+					primed_hashes[i].push_back(hash);
+					if (mode == DatabaseMode::ReadOnly)
+						primed_sources[i].push_back(uint16_t(source_index));
+				}
+			};
+
+			// Read straight from the sub-database's tables if we can, rather than from a temporary copy.
+			DatabaseHashView view;
+			if (interface.get_hash_view_for_resource_tag(tag, &view))
+			{
+				primed_hashes[i].reserve(primed_hashes[i].size() + view.size());
+				for (Hash hash : view)
+					prime(hash);
+				continue;
+			}
+
+			size_t num_hashes;
+			if (!interface.get_hash_list_for_resource_tag(tag, &num_hashes, nullptr))
+				return false;
+			std::vector<Hash> hashes(num_hashes);
+			if (!interface.get_hash_list_for_resource_tag(tag, &num_hashes, hashes.data()))
+				return false;
+
+			for (auto &hash : hashes)
+				prime(hash);
+		}
+
+		return true;
 	}
 
-	void prime_read_only_hashes(DatabaseInterface &interface)
+	// The primed hashes never change after prepare(), so keep them as sorted arrays for binary search.
+	// Most lookups while recording are misses, which the bloom filters reject without searching.
+	void finalize_primed_hashes()
 	{
 		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
 		{
-			auto tag = static_cast<ResourceTag>(i);
-			size_t num_hashes;
-			if (!interface.get_hash_list_for_resource_tag(tag, &num_hashes, nullptr))
-				return;
-			std::vector<Hash> hashes(num_hashes);
-			if (!interface.get_hash_list_for_resource_tag(tag, &num_hashes, hashes.data()))
-				return;
+			auto &hashes = primed_hashes[i];
+			auto &sources = primed_sources[i];
 
-			for (auto &hash : hashes)
-				if (test_resource_filter(tag, hash))
-					primed_hashes[i].insert(hash);
+			if (sources.size() == hashes.size() && !sources.empty())
+			{
+				// Keep the source of each hash in step with the sorted hashes.
+				// On duplicates, the lowest index wins, matching the order the sub-databases used to be searched in.
+				std::vector<std::pair<Hash, uint16_t>> entries(hashes.size());
+				for (size_t j = 0; j < hashes.size(); j++)
+					entries[j] = { hashes[j], sources[j] };
+				std::sort(entries.begin(), entries.end());
+				entries.erase(std::unique(entries.begin(), entries.end(),
+				                          [](const std::pair<Hash, uint16_t> &a, const std::pair<Hash, uint16_t> &b) {
+					                          return a.first == b.first;
+				                          }), entries.end());
+
+				hashes.resize(entries.size());
+				sources.resize(entries.size());
+				for (size_t j = 0; j < entries.size(); j++)
+				{
+					hashes[j] = entries[j].first;
+					sources[j] = entries[j].second;
+				}
+			}
+			else
+			{
+				sources.clear();
+				std::sort(hashes.begin(), hashes.end());
+				hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+			}
+
+			hashes.shrink_to_fit();
+			sources.shrink_to_fit();
+			HashBloomFilter::build(primed_filters[i], hashes.data(), hashes.size());
 		}
 	}
 
+	// With a base archive and a stack of delta archives, most entries live in exactly one sub-database,
+	// so go straight to it rather than probing each one in turn.
+	// Returns nullptr if the entry was not primed, in which case callers search the sub-databases.
+	DatabaseInterface *find_primed_sub_database(ResourceTag tag, Hash hash) const
+	{
+		auto &sources = primed_sources[tag];
+		if (sources.empty())
+			return nullptr;
+
+		auto &filter = primed_filters[tag];
+		if (!HashBloomFilter::test(filter.data(), filter.size() / HashBloomFilter::BlockWords, hash))
+			return nullptr;
+
+		auto &hashes = primed_hashes[tag];
+		auto itr = std::lower_bound(hashes.begin(), hashes.end(), hash);
+		if (itr == hashes.end() || *itr != hash)
+			return nullptr;
+
+		unsigned index = sources[itr - hashes.begin()];
+		if (index == 0)
+			return readonly_interface.get();
+		else if (index <= extra_readonly.size())
+			return extra_readonly[index - 1].get();
+		else
+			return nullptr;
+	}
+
+	bool is_primed_hash(ResourceTag tag, Hash hash) const
+	{
+		auto &filter = primed_filters[tag];
+		if (!HashBloomFilter::test(filter.data(), filter.size() / HashBloomFilter::BlockWords, hash))
+			return false;
+		return std::binary_search(primed_hashes[tag].begin(), primed_hashes[tag].end(), hash);
+	}
+
 	bool prepare() override
 	{
 		if (mode != DatabaseMode::Append && mode != DatabaseMode::ReadOnly)
@@ -1760,12 +4875,21 @@ struct ConcurrentDatabase : DatabaseInterface
 			// Prime the hashmaps, however, we'll rely on concurrent metadata if we have it to avoid memory bloat.
 			if (!impl->imported_concurrent_metadata)
 			{
-				if (readonly_interface)
-					prime_read_only_hashes(*readonly_interface);
+				readonly_is_primed = true;
+				if (readonly_interface && !prime_read_only_hashes(*readonly_interface, 0))
+					readonly_is_primed = false;
 
-				for (auto &extra : extra_readonly)
-					if (extra)
-						prime_read_only_hashes(*extra);
+				for (size_t i = 0; i < extra_readonly.size(); i++)
+					if (extra_readonly[i] && is_listed_sub_database(i) &&
+					    !prime_read_only_hashes(*extra_readonly[i], unsigned(i + 1)))
+						readonly_is_primed = false;
+
+				// An incomplete index would send reads to the wrong sub-database.
+				if (extra_readonly.size() >= UINT16_MAX || !readonly_is_primed)
+					for (auto &sources : primed_sources)
+						sources.clear();
+
+				finalize_primed_hashes();
 			}
 
 			// We only need the database for priming purposes.
@@ -1785,6 +4909,10 @@ struct ConcurrentDatabase : DatabaseInterface
 		if (mode != DatabaseMode::ReadOnly)
 			return false;
 
+		auto *primed = find_primed_sub_database(tag, hash);
+		if (primed && primed->read_entry(tag, hash, blob_size, blob, flags))
+			return true;
+
 		if (readonly_interface && readonly_interface->read_entry(tag, hash, blob_size, blob, flags))
 			return true;
 
@@ -1797,17 +4925,53 @@ struct ConcurrentDatabase : DatabaseInterface
 		return false;
 	}
 
+	bool read_entry_zero_copy(ResourceTag tag, Hash hash, size_t *blob_size, const void **blob, PayloadReadFlags flags) override
+	{
+		if (mode != DatabaseMode::ReadOnly)
+			return false;
+
+		auto *primed = find_primed_sub_database(tag, hash);
+		if (primed && primed->has_entry(tag, hash))
+			return primed->read_entry_zero_copy(tag, hash, blob_size, blob, flags);
+
+		if (readonly_interface && readonly_interface->has_entry(tag, hash))
+			return readonly_interface->read_entry_zero_copy(tag, hash, blob_size, blob, flags);
+
+		for (auto &extra : extra_readonly)
+			if (extra && extra->has_entry(tag, hash))
+				return extra->read_entry_zero_copy(tag, hash, blob_size, blob, flags);
+
+		return false;
+	}
+
+	bool prefetch_entries(ResourceTag tag, const Hash *hashes, size_t count) override
+	{
+		if (mode != DatabaseMode::ReadOnly)
+			return false;
+
+		// Sub-databases ignore hashes they do not contain, so just forward everything.
+		bool ret = false;
+		if (readonly_interface && readonly_interface->prefetch_entries(tag, hashes, count))
+			ret = true;
+		for (auto &extra : extra_readonly)
+			if (extra && extra->prefetch_entries(tag, hashes, count))
+				ret = true;
+
+		return ret;
+	}
+
 	bool write_entry(ResourceTag tag, Hash hash, const void *blob, size_t blob_size, PayloadWriteFlags flags) override
 	{
 		if (mode != DatabaseMode::Append)
 			return false;
 
-		if (primed_hashes[tag].count(hash))
+		if (is_primed_hash(tag, hash))
 			return true;
 
 		// All threads must have called prepare and synchronized readonly_interface from that,
 		// and from here on out readonly_interface is purely read-only, no need to lock just to check.
-		if (readonly_interface && readonly_interface->has_entry(tag, hash))
+		// The primed hashes cover it already, unless priming failed.
+		if (!readonly_is_primed && readonly_interface && readonly_interface->has_entry(tag, hash))
 			return true;
 
 		if (writeonly_interface && writeonly_interface->has_entry(tag, hash))
@@ -1821,10 +4985,13 @@ struct ConcurrentDatabase : DatabaseInterface
 			{
 				std::string write_path = base_path + "." + std::to_string(index) + ".foz";
 				writeonly_interface.reset(create_stream_archive_database(write_path.c_str(), DatabaseMode::ExclusiveOverWrite));
+				if (async_write_policy)
+					writeonly_interface->set_async_write_policy(*async_write_policy);
 				if (!writeonly_interface->prepare())
 					writeonly_interface.reset();
 			}
 
+			statistics_interface.store(writeonly_interface.get(), std::memory_order_release);
 			need_writeonly_database = false;
 		}
 
@@ -1836,29 +5003,65 @@ struct ConcurrentDatabase : DatabaseInterface
 
 	static bool find_entry_in_concurrent_metadata(const ExportedMetadataHeader *header, ResourceTag tag, Hash hash)
 	{
-		auto *begin_range = reinterpret_cast<const uint8_t *>(header) + header->lists[tag].offset;
+		auto *begin_range = reinterpret_cast<const ExportedMetadataConcurrentPrimedBlock *>(
+				reinterpret_cast<const uint8_t *>(header) + header->lists[tag].offset);
 		auto *end_range = begin_range + header->lists[tag].count;
 		return std::binary_search(begin_range, end_range, hash);
 	}
 
+	static bool test_concurrent_metadata_filter(const ExportedMetadataHeader *header, ResourceTag tag, Hash hash)
+	{
+		auto *words = reinterpret_cast<const uint64_t *>(
+				reinterpret_cast<const uint8_t *>(header) + header->lists[tag].offset);
+		return HashBloomFilter::test(words, header->lists[tag].count, hash);
+	}
+
 	// Checks if entry already exists in database, i.e. no need to serialize.
 	bool has_entry(ResourceTag tag, Hash hash) override
 	{
 		if (impl->imported_concurrent_metadata)
-			return find_entry_in_concurrent_metadata(impl->imported_concurrent_metadata, tag, hash);
+		{
+			if (impl->imported_concurrent_filters &&
+			    !test_concurrent_metadata_filter(impl->imported_concurrent_filters, tag, hash))
+				return has_module_store_entry(tag, hash);
+			return find_entry_in_concurrent_metadata(impl->imported_concurrent_metadata, tag, hash) ||
+			       has_module_store_entry(tag, hash);
+		}
 
 		if (!test_resource_filter(tag, hash))
 			return false;
 
-		if (primed_hashes[tag].count(hash))
+		if (is_primed_hash(tag, hash))
 			return true;
 
 		// All threads must have called prepare and synchronized readonly_interface from that,
 		// and from here on out readonly_interface is purely read-only, no need to lock just to check.
-		if (readonly_interface && readonly_interface->has_entry(tag, hash))
+		// The primed hashes cover it already, unless priming failed.
+		if (!readonly_is_primed && readonly_interface && readonly_interface->has_entry(tag, hash))
+			return true;
+
+		if (writeonly_interface && writeonly_interface->has_entry(tag, hash))
 			return true;
 
-		return writeonly_interface && writeonly_interface->has_entry(tag, hash);
+		return has_module_store_entry(tag, hash);
+	}
+
+	bool has_prior_entry(ResourceTag tag, Hash hash) const override
+	{
+		if (impl->imported_concurrent_metadata)
+		{
+			if (impl->imported_concurrent_filters &&
+			    !test_concurrent_metadata_filter(impl->imported_concurrent_filters, tag, hash))
+				return has_module_store_entry(tag, hash);
+			return find_entry_in_concurrent_metadata(impl->imported_concurrent_metadata, tag, hash) ||
+			       has_module_store_entry(tag, hash);
+		}
+
+		if (!test_resource_filter(tag, hash))
+			return false;
+
+		// If priming failed, this can report false for prior entries, which only costs a redundant copy.
+		return is_primed_hash(tag, hash) || has_module_store_entry(tag, hash);
 	}
 
 	bool get_hash_list_for_resource_tag(ResourceTag tag, size_t *num_hashes, Hash *hashes) override
@@ -1917,8 +5120,36 @@ struct ConcurrentDatabase : DatabaseInterface
 		return true;
 	}
 
+	bool get_hash_view_for_resource_tag(ResourceTag tag, DatabaseHashView *view) override
+	{
+		if (mode != DatabaseMode::ReadOnly)
+			return false;
+
+		if (impl->imported_concurrent_metadata)
+		{
+			view->data = reinterpret_cast<const uint8_t *>(impl->imported_concurrent_metadata) +
+			             impl->imported_concurrent_metadata->lists[tag].offset;
+			view->count = size_t(impl->imported_concurrent_metadata->lists[tag].count);
+			view->stride = sizeof(ExportedMetadataConcurrentPrimedBlock);
+			return true;
+		}
+
+		// If priming failed, the primed hashes are incomplete.
+		if (!readonly_is_primed)
+			return false;
+
+		view->data = reinterpret_cast<const uint8_t *>(primed_hashes[tag].data());
+		view->count = primed_hashes[tag].size();
+		view->stride = sizeof(Hash);
+		return true;
+	}
+
 	const char *get_db_path_for_hash(ResourceTag tag, Hash hash) override
 	{
+		auto *primed = find_primed_sub_database(tag, hash);
+		if (primed && primed->has_entry(tag, hash))
+			return primed->get_db_path_for_hash(tag, hash);
+
 		if (readonly_interface && readonly_interface->has_entry(tag, hash))
 			return readonly_interface->get_db_path_for_hash(tag, hash);
 
@@ -1960,10 +5191,11 @@ struct ConcurrentDatabase : DatabaseInterface
 			return 0;
 		count += hash_count;
 
-		for (auto &e : extra_readonly)
+		for (size_t i = 0; i < extra_readonly.size(); i++)
 		{
+			auto &e = extra_readonly[i];
 			hash_count = 0;
-			if (e && !e->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			if (e && is_listed_sub_database(i) && !e->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
 				return 0;
 			count += hash_count;
 		}
@@ -1982,6 +5214,35 @@ struct ConcurrentDatabase : DatabaseInterface
 		return count;
 	}
 
+	size_t get_lookup_memory_usage() const override
+	{
+		size_t size = 0;
+		for (auto &hashes : primed_hashes)
+			size += hashes.capacity() * sizeof(Hash);
+		for (auto &filter : primed_filters)
+			size += filter.capacity() * sizeof(uint64_t);
+		for (auto &sources : primed_sources)
+			size += sources.capacity() * sizeof(uint16_t);
+		if (readonly_interface)
+			size += readonly_interface->get_lookup_memory_usage();
+		for (auto &extra : extra_readonly)
+			if (extra)
+				size += extra->get_lookup_memory_usage();
+		if (writeonly_interface)
+			size += writeonly_interface->get_lookup_memory_usage();
+		return size;
+	}
+
+	void get_compression_statistics(DatabaseCompressionStatistics *stats) const override
+	{
+		// Only the write-only archive compresses anything.
+		auto *iface = statistics_interface.load(std::memory_order_acquire);
+		if (iface)
+			iface->get_compression_statistics(stats);
+		else
+			*stats = {};
+	}
+
 	size_t compute_exported_metadata_size() const override
 	{
 		if (mode != DatabaseMode::ReadOnly)
@@ -1990,6 +5251,7 @@ struct ConcurrentDatabase : DatabaseInterface
 		size_t size = 0;
 
 		size += sizeof(ExportedMetadataHeader) + get_total_num_hashes() * sizeof(ExportedMetadataConcurrentPrimedBlock);
+		size += compute_exported_filter_size();
 
 		if (readonly_interface)
 			size += readonly_interface->compute_exported_metadata_size();
@@ -2011,8 +5273,11 @@ struct ConcurrentDatabase : DatabaseInterface
 	{
 		auto *data = static_cast<uint8_t *>(data_);
 
+		auto *concurrent_header = reinterpret_cast<const ExportedMetadataHeader *>(data);
 		if (!write_exported_concurrent_metadata(data, size))
 			return false;
+		if (!write_exported_concurrent_filters(concurrent_header, data, size))
+			return false;
 
 		if (!write_exported_metadata_for_db(readonly_interface.get(), data, size))
 			return false;
@@ -2038,12 +5303,16 @@ struct ConcurrentDatabase : DatabaseInterface
 			return false;
 		primed += hash_count;
 
-		for (auto &e : extra_readonly)
+		for (size_t i = 0; i < extra_readonly.size(); i++)
 		{
+			auto &e = extra_readonly[i];
+			if (!e || !is_listed_sub_database(i))
+				continue;
+
 			hash_count = 0;
-			if (e && !e->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			if (!e->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
 				return false;
-			if (e && !e->get_hash_list_for_resource_tag(tag, &hash_count, primed))
+			if (!e->get_hash_list_for_resource_tag(tag, &hash_count, primed))
 				return false;
 			primed += hash_count;
 		}
@@ -2083,6 +5352,51 @@ struct ConcurrentDatabase : DatabaseInterface
 		return true;
 	}
 
+	// The number of unique hashes is not known until the concurrent block is written,
+	// so size the filters for the upper bound.
+	size_t compute_exported_filter_size() const
+	{
+		size_t size = sizeof(ExportedMetadataHeader);
+		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+		{
+			size_t block_count = HashBloomFilter::compute_block_count(get_total_num_hashes_for_tag(ResourceTag(i)));
+			size += block_count * HashBloomFilter::BlockWords * sizeof(uint64_t);
+		}
+		return size;
+	}
+
+	bool write_exported_concurrent_filters(const ExportedMetadataHeader *concurrent_header, uint8_t *&data, size_t &size) const
+	{
+		size_t required = compute_exported_filter_size();
+		if (size < required)
+			return false;
+
+		auto *header = reinterpret_cast<ExportedMetadataHeader *>(data);
+		header->magic = ExportedMetadataMagicConcurrentFilter;
+		header->size = required;
+
+		size_t offset = sizeof(*header);
+		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+		{
+			size_t block_count = HashBloomFilter::compute_block_count(get_total_num_hashes_for_tag(ResourceTag(i)));
+			auto *words = reinterpret_cast<uint64_t *>(data + offset);
+			memset(words, 0, block_count * HashBloomFilter::BlockWords * sizeof(uint64_t));
+
+			auto *hashes = reinterpret_cast<const ExportedMetadataConcurrentPrimedBlock *>(
+					reinterpret_cast<const uint8_t *>(concurrent_header) + concurrent_header->lists[i].offset);
+			for (uint64_t j = 0; j < concurrent_header->lists[i].count; j++)
+				HashBloomFilter::insert(words, block_count, hashes[j]);
+
+			header->lists[i].offset = offset;
+			header->lists[i].count = block_count;
+			offset += block_count * HashBloomFilter::BlockWords * sizeof(uint64_t);
+		}
+
+		data += required;
+		size -= required;
+		return true;
+	}
+
 	static bool write_exported_metadata_for_db(const DatabaseInterface *iface, uint8_t *&data, size_t &size)
 	{
 		if (iface)
@@ -2117,8 +5431,16 @@ struct ConcurrentDatabase : DatabaseInterface
 	DatabaseMode mode;
 	std::unique_ptr<DatabaseInterface> readonly_interface;
 	std::unique_ptr<DatabaseInterface> writeonly_interface;
+	// writeonly_interface is created lazily while writing, this publishes it to statistics queries from other threads.
+	std::atomic<DatabaseInterface *> statistics_interface{ nullptr };
+	std::unique_ptr<DatabaseAsyncWritePolicy> async_write_policy;
 	std::vector<std::unique_ptr<DatabaseInterface>> extra_readonly;
-	std::unordered_set<Hash> primed_hashes[RESOURCE_COUNT];
+	std::vector<bool> extra_is_module_store;
+	std::vector<Hash> primed_hashes[RESOURCE_COUNT];
+	std::vector<uint64_t> primed_filters[RESOURCE_COUNT];
+	// Sub-database index of each primed hash, only kept in ReadOnly mode.
+	std::vector<uint16_t> primed_sources[RESOURCE_COUNT];
+	bool readonly_is_primed = false;
 	bool has_prepared_readonly = false;
 	bool need_writeonly_database = true;
 };
@@ -2150,45 +5472,272 @@ DatabaseInterface *create_concurrent_database_with_encoded_extra_paths(const cha
 	return create_concurrent_database(base_path, mode, char_paths.data(), char_paths.size());
 }
 
-bool merge_concurrent_databases(const char *append_archive, const char * const *source_paths, size_t num_source_paths)
+struct MergeSource
 {
-	auto append_db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(append_archive, DatabaseMode::Append));
-	if (!append_db->prepare())
+	struct RawEntry
+	{
+		ResourceTag tag;
+		Hash hash;
+		const uint8_t *data;
+		size_t size;
+	};
+
+	std::unique_ptr<DatabaseInterface> db;
+	std::vector<RawEntry> entries;
+	// Only used if payloads cannot be referenced in place.
+	std::vector<std::unique_ptr<uint8_t []>> owned_payloads;
+	bool ready = false;
+	bool ok = false;
+};
+
+// Runs on the reader threads. The raw payloads are referenced straight from the mapped archive where possible,
+// and we touch every page so the I/O happens here rather than in the writer.
+static bool load_merge_source(MergeSource &source, const char *path)
+{
+	source.db.reset(create_stream_archive_database(path, DatabaseMode::ReadOnly));
+	if (!source.db->prepare())
+	{
+		LOGE_LEVEL("Failed to open source archive %s for merging.\n", path);
 		return false;
+	}
+
+	uint32_t page_sum = 0;
 
-	for (size_t source = 0; source < num_source_paths; source++)
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
 	{
-		const char *path = source_paths[source];
-		auto source_db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path, DatabaseMode::ReadOnly));
-		if (!source_db->prepare())
+		auto tag = static_cast<ResourceTag>(i);
+
+		size_t hash_count = 0;
+		if (!source.db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!source.db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
 			return false;
 
-		for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+		for (auto &hash : hashes)
 		{
-			auto tag = static_cast<ResourceTag>(i);
-
-			size_t hash_count = 0;
-			if (!source_db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
-				return false;
-			std::vector<Hash> hashes(hash_count);
-			if (!source_db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
-				return false;
+			MergeSource::RawEntry entry = { tag, hash, nullptr, 0 };
 
-			for (auto &hash : hashes)
+			const void *mapped = nullptr;
+			if (source.db->read_entry_zero_copy(tag, hash, &entry.size, &mapped, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+			{
+				entry.data = static_cast<const uint8_t *>(mapped);
+				for (size_t offset = 0; offset < entry.size; offset += 4096)
+					page_sum += entry.data[offset];
+			}
+			else
 			{
-				size_t blob_size = 0;
-				if (!source_db->read_entry(tag, hash, &blob_size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+				if (!source.db->read_entry(tag, hash, &entry.size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
 					return false;
-				std::vector<uint8_t> blob(blob_size);
-				if (!source_db->read_entry(tag, hash, &blob_size, blob.data(), PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+				std::unique_ptr<uint8_t []> payload(new uint8_t[entry.size]);
+				if (!source.db->read_entry(tag, hash, &entry.size, payload.get(), PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
 					return false;
+				entry.data = payload.get();
+				source.owned_payloads.push_back(std::move(payload));
+			}
+
+			source.entries.push_back(entry);
+		}
+	}
+
+	// Make sure the page touching is not optimized away.
+	static std::atomic<uint32_t> page_sum_sink;
+	page_sum_sink.fetch_add(page_sum, std::memory_order_relaxed);
+	return true;
+}
+
+// Runs on the writer thread.
+static bool write_merge_source(DatabaseInterface &append_db, MergeSource &source)
+{
+	std::vector<uint8_t> decoded;
+
+	for (auto &entry : source.entries)
+	{
+		// Raw payloads can be copied over as-is, no matter how they are compressed.
+		if (append_db.write_entry(entry.tag, entry.hash, entry.data, entry.size, PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT))
+			continue;
+
+		// The only payloads which cannot be transferred raw depend on a dictionary the target archive does not have.
+		// Those have to be recompressed.
+		size_t decoded_size = 0;
+		if (!source.db->read_entry(entry.tag, entry.hash, &decoded_size, nullptr, 0))
+			return false;
+		decoded.resize(decoded_size);
+		if (!source.db->read_entry(entry.tag, entry.hash, &decoded_size, decoded.data(), 0))
+			return false;
+
+		if (!append_db.write_entry(entry.tag, entry.hash, decoded.data(), decoded.size(),
+		                           PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPRESS_ZSTD_BIT |
+		                           PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool merge_concurrent_databases(const char *append_archive, const char * const *source_paths, size_t num_source_paths,
+                                unsigned num_threads)
+{
+	auto append_db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(append_archive, DatabaseMode::Append));
+	if (!append_db->prepare())
+		return false;
+
+	if (num_threads == 0)
+		num_threads = std::thread::hardware_concurrency();
+	num_threads = unsigned(std::max<size_t>(1, std::min<size_t>(num_threads, num_source_paths)));
+
+	// Sources are read in parallel, but written strictly in order, so the result matches a serial merge.
+	// Don't let readers get too far ahead, or we would keep too many archives open at once.
+	const size_t max_sources_in_flight = 2 * num_threads;
+	std::vector<MergeSource> sources(num_source_paths);
+	std::mutex lock;
+	std::condition_variable cond;
+	size_t next_source = 0;
+	size_t written_sources = 0;
+	bool failed = false;
+
+	std::vector<std::thread> readers;
+	for (unsigned i = 0; i < num_threads; i++)
+	{
+		readers.emplace_back([&]() {
+			for (;;)
+			{
+				size_t index;
+				{
+					std::unique_lock<std::mutex> holder(lock);
+					cond.wait(holder, [&]() {
+						return failed || next_source >= num_source_paths ||
+						       next_source < written_sources + max_sources_in_flight;
+					});
+
+					if (failed || next_source >= num_source_paths)
+						break;
+					index = next_source++;
+				}
+
+				bool ret = load_merge_source(sources[index], source_paths[index]);
+
+				std::lock_guard<std::mutex> holder(lock);
+				sources[index].ok = ret;
+				sources[index].ready = true;
+				cond.notify_all();
+			}
+		});
+	}
+
+	bool ret = true;
+	for (size_t i = 0; i < num_source_paths && ret; i++)
+	{
+		{
+			std::unique_lock<std::mutex> holder(lock);
+			cond.wait(holder, [&]() { return sources[i].ready; });
+		}
+
+		ret = sources[i].ok && write_merge_source(*append_db, sources[i]);
+		// Release the source as soon as we're done with it.
+		sources[i].entries.clear();
+		sources[i].entries.shrink_to_fit();
+		sources[i].owned_payloads.clear();
+		sources[i].owned_payloads.shrink_to_fit();
+		sources[i].db.reset();
+
+		std::lock_guard<std::mutex> holder(lock);
+		written_sources++;
+		failed = !ret;
+		cond.notify_all();
+	}
+
+	for (auto &reader : readers)
+		reader.join();
+
+	return ret;
+}
+
+bool diff_concurrent_databases(const char *delta_path, const char * const *base_paths, size_t num_base_paths,
+                               const char *new_path, DatabaseDiffStatistics *stats)
+{
+	DatabaseDiffStatistics diff_stats = {};
+
+	// The concurrent database primes a bloom filter and sorted hash list across all base archives for us.
+	std::unique_ptr<DatabaseInterface> base_db(
+			create_concurrent_database(nullptr, DatabaseMode::ReadOnly, base_paths, num_base_paths));
+	if (!base_db->prepare())
+		return false;
 
-				if (!append_db->write_entry(tag, hash, blob.data(), blob.size(), PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT))
+	// Sub-databases which fail to prepare are silently dropped, which would make the delta far too large.
+	for (size_t i = 0; i < num_base_paths; i++)
+	{
+		if (!base_db->get_sub_database(unsigned(i + 1)))
+		{
+			LOGE_LEVEL("Failed to open base archive %s.\n", base_paths[i]);
+			return false;
+		}
+	}
+
+	MergeSource source;
+	source.db.reset(create_stream_archive_database(new_path, DatabaseMode::ReadOnly));
+	if (!source.db->prepare())
+	{
+		LOGE_LEVEL("Failed to open new archive %s.\n", new_path);
+		return false;
+	}
+
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		auto tag = static_cast<ResourceTag>(i);
+
+		size_t hash_count = 0;
+		if (!source.db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!source.db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			return false;
+		diff_stats.new_entry_count += hash_count;
+
+		for (auto &hash : hashes)
+		{
+			if (base_db->has_entry(tag, hash))
+				continue;
+
+			MergeSource::RawEntry entry = { tag, hash, nullptr, 0 };
+			const void *mapped = nullptr;
+			if (source.db->read_entry_zero_copy(tag, hash, &entry.size, &mapped, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+			{
+				entry.data = static_cast<const uint8_t *>(mapped);
+			}
+			else
+			{
+				if (!source.db->read_entry(tag, hash, &entry.size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+					return false;
+				std::unique_ptr<uint8_t []> payload(new uint8_t[entry.size]);
+				if (!source.db->read_entry(tag, hash, &entry.size, payload.get(), PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
 					return false;
+				entry.data = payload.get();
+				source.owned_payloads.push_back(std::move(payload));
 			}
+
+			source.entries.push_back(entry);
+			diff_stats.delta_payload_bytes += entry.size;
 		}
 	}
 
+	diff_stats.delta_entry_count = source.entries.size();
+	base_db.reset();
+
+	auto delta_db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(delta_path, DatabaseMode::OverWrite));
+	if (!delta_db->prepare())
+	{
+		LOGE_LEVEL("Failed to open delta archive %s for writing.\n", delta_path);
+		return false;
+	}
+
+	if (!write_merge_source(*delta_db, source))
+		return false;
+
+	if (stats)
+		*stats = diff_stats;
 	return true;
 }
 
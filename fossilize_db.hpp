@@ -46,6 +46,18 @@ enum PayloadWriteFlagBits
 	// Compute checksum of payload for more robustness.
 	PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT = 1 << 3,
 
+	// If WRITE_COMPRESS_BIT is set, selects an alternative compression algorithm for the stream archive database.
+	// ZSTD favors compression ratio, LZ4 favors decompression speed.
+	// If Fossilize is built without support for the algorithm, Deflate is used instead.
+	// Readers built without support for the algorithm cannot decode such payloads.
+	PAYLOAD_WRITE_COMPRESS_ZSTD_BIT = 1 << 4,
+	PAYLOAD_WRITE_COMPRESS_LZ4_BIT = 1 << 5,
+
+	// If COMPUTE_CHECKSUM_BIT is set, use CRC32C rather than CRC32 for the stream archive database.
+	// CRC32C is much faster to compute on CPUs with SSE4.2 or ARMv8 CRC instructions.
+	// Readers built before CRC32C support was added cannot decode such payloads.
+	PAYLOAD_WRITE_CHECKSUM_CRC32C_BIT = 1 << 6,
+
 	PAYLOAD_WRITE_MAX_ENUM = 0x7fffffff
 };
 
@@ -60,6 +72,7 @@ enum PayloadReadFlagBits
 
 	// Allows read_entry to be called concurrently from multiple threads.
 	// Might cause locking when reading from database depending on implementation.
+	// The stream archive database does not lock, it reads from a memory mapping or with positional reads.
 	// Decompression if needed is always lock-free.
 	// *NOTE*: Only tested with the Fossilize database format.
 	PAYLOAD_READ_CONCURRENT_BIT = 1 << 1,
@@ -81,6 +94,90 @@ enum class DatabaseMode
 
 struct ExportedMetadataHeader;
 
+// Controls asynchronous writes, see DatabaseInterface::set_async_write_policy().
+struct DatabaseAsyncWritePolicy
+{
+	// Number of worker threads which compress payloads.
+	// If 0, payloads are compressed in write_entry() and only the disk writes happen in the background.
+	unsigned compression_threads = 1;
+
+	// Pending entries are written to disk in one go once this many bytes have accumulated.
+	size_t batch_size = 1024 * 1024;
+
+	// Pending entries are written to disk at least this often, even if the batch is not full.
+	// If 0, batches are only written once full, on flush(), or when the database is destroyed.
+	unsigned flush_interval_ms = 500;
+};
+
+// See DatabaseInterface::get_compression_statistics().
+struct DatabaseCompressionStatistics
+{
+	uint64_t payload_count;
+	uint64_t input_bytes;
+	uint64_t output_bytes;
+	uint64_t compression_ns;
+};
+
+// A read-only view of the hashes of one tag, see DatabaseInterface::get_hash_view_for_resource_tag().
+// Hashes are sorted and unique. They may be spread out with a stride in a table owned by the database,
+// e.g. metadata imported from another process, so the view must not outlive the database.
+struct DatabaseHashView
+{
+	const uint8_t *data = nullptr;
+	size_t count = 0;
+	size_t stride = sizeof(Hash);
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	Hash operator[](size_t index) const
+	{
+		return *reinterpret_cast<const Hash *>(data + index * stride);
+	}
+
+	// Binary search, so callers do not need to build their own hash sets.
+	bool contains(Hash hash) const;
+
+	struct Iterator
+	{
+		const uint8_t *ptr;
+		size_t stride;
+
+		Hash operator*() const
+		{
+			return *reinterpret_cast<const Hash *>(ptr);
+		}
+
+		Iterator &operator++()
+		{
+			ptr += stride;
+			return *this;
+		}
+
+		bool operator!=(const Iterator &other) const
+		{
+			return ptr != other.ptr;
+		}
+	};
+
+	Iterator begin() const
+	{
+		return { data, stride };
+	}
+
+	Iterator end() const
+	{
+		return { data + count * stride, stride };
+	}
+};
+
 // This is an interface to interact with an external database for blob modules.
 // It is is a simple database with key + blob.
 // NOTE: The database is NOT thread-safe.
@@ -129,15 +226,63 @@ public:
 	// The same flags must be passed when just querying size and reading data into buffer.
 	virtual bool read_entry(ResourceTag tag, Hash hash, size_t *size, void *buffer, PayloadReadFlags flags) = 0;
 
+	// Zero-copy variant of read_entry.
+	// If the backend holds the payload in memory in its final form (e.g. an uncompressed payload in a memory mapped
+	// stream archive), *buffer is set to point directly to it and *size holds its size.
+	// The pointer remains valid for the lifetime of the database and can be used from any thread.
+	// If this returns false, the payload is not available this way and read_entry must be used instead.
+	// The same flags as read_entry are accepted.
+	virtual bool read_entry_zero_copy(ResourceTag tag, Hash hash, size_t *size, const void **buffer, PayloadReadFlags flags);
+
 	// Writes an entry to database.
 	virtual bool write_entry(ResourceTag tag, Hash hash, const void *buffer, size_t size, PayloadWriteFlags flags) = 0;
 
+	// Stores a compression dictionary for a tag, see train_compression_dictionary().
+	// Entries of that tag which are written with PAYLOAD_WRITE_COMPRESS_ZSTD_BIT are then compressed against it.
+	// Only supported for the stream archive database in OverWrite modes, and only if built with Zstandard support.
+	// Must be called after prepare(), but before any entry is written. Only one dictionary can be added per tag.
+	virtual bool add_compression_dictionary(ResourceTag tag, const void *dictionary, size_t size);
+
+	// Makes write_entry() hand entries off to background threads rather than compressing and writing them inline.
+	// Entries are written to disk in large sequential batches according to policy.
+	// flush() kicks off a write of pending entries without waiting for it,
+	// and all pending entries are written when the database is destroyed.
+	// If the process dies, entries which have not been written yet are lost, which is no worse than a truncated archive.
+	// Write errors are reported by subsequent calls to write_entry().
+	// Only supported for the stream archive database (and concurrent variant) in write modes. Call before prepare().
+	virtual bool set_async_write_policy(const DatabaseAsyncWritePolicy &policy);
+
 	// Checks if entry already exists in database, i.e. no need to serialize.
 	virtual bool has_entry(ResourceTag tag, Hash hash) = 0;
 
+	// Checks if entry was part of the read-only data the database was prepared with, e.g. captured by a prior session.
+	// Entries written since are not considered. Since that data never changes after prepare(),
+	// this can be called from any thread once prepare() has returned, even while other threads write entries.
+	// Only the concurrent database has such read-only data, others return false.
+	virtual bool has_prior_entry(ResourceTag tag, Hash hash) const;
+
+	// Hints that the given entries will be read soon. Only supported on ReadOnly stream archives (or concurrent variant).
+	// The affected byte ranges are sorted by file offset and coalesced before readahead is requested from the OS,
+	// so reads issued afterwards are more likely to hit the page cache. Unknown hashes are ignored.
+	// This does not block on I/O and may be called from any thread once prepare() has returned.
+	// Returns false if prefetching is not supported.
+	virtual bool prefetch_entries(ResourceTag tag, const Hash *hashes, size_t count);
+
+	// Returns where the payload of an entry is stored, so that tools can read many entries in mostly sequential order.
+	// Offsets can only be compared between entries of the same database.
+	// Only supported on ReadOnly stream archives. May be called from any thread once prepare() has returned.
+	virtual bool get_entry_storage_offset(ResourceTag tag, Hash hash, uint64_t *offset);
+
 	// Arguments are similar to Vulkan, call the query function twice.
 	virtual bool get_hash_list_for_resource_tag(ResourceTag tag, size_t *num_hashes, Hash *hash) = 0;
 
+	// Zero-copy variant of get_hash_list_for_resource_tag, which points *view at the database's own sorted hash table.
+	// Only supported in ReadOnly mode, for stream archives with imported metadata or an on-disk index
+	// and for the concurrent database. Call after prepare().
+	// The view remains valid for the lifetime of the database and can be used from any thread.
+	// If this returns false, get_hash_list_for_resource_tag must be used instead.
+	virtual bool get_hash_view_for_resource_tag(ResourceTag tag, DatabaseHashView *view);
+
 	// Ensures all file writes are flushed, ala fflush(). Might be noop depending on the implementation.
 	virtual void flush() = 0;
 
@@ -179,6 +324,14 @@ public:
 	// If needed, those must be used before exporting metadata.
 	bool import_metadata_from_os_handle(intptr_t handle);
 
+	// Returns the number of bytes of memory used for looking up entries. Metadata imported from other processes is not included.
+	// Only meant for statistics.
+	virtual size_t get_lookup_memory_usage() const;
+
+	// Totals for payloads compressed since the database was created, including those compressed by async write workers.
+	// Can be called from any thread while entries are written. Only meant for statistics.
+	virtual void get_compression_statistics(DatabaseCompressionStatistics *stats) const;
+
 	// Internal details.
 	virtual size_t compute_exported_metadata_size() const;
 	virtual bool write_exported_metadata(void *data, size_t size) const;
@@ -192,11 +345,42 @@ protected:
 	Impl *impl;
 };
 
-DatabaseInterface *create_dumb_folder_database(const char *directory_path, DatabaseMode mode);
+// Stores every entry as a separate file, sharded into subdirectories by hash.
+// prepare() scans the shards with num_scan_threads threads, 0 means one thread per CPU.
+DatabaseInterface *create_dumb_folder_database(const char *directory_path, DatabaseMode mode,
+                                               unsigned num_scan_threads = 1);
 DatabaseInterface *create_zip_archive_database(const char *path, DatabaseMode mode);
 DatabaseInterface *create_stream_archive_database(const char *path, DatabaseMode mode);
+
+// Reads a stream archive from a web server with HTTP range requests, e.g. "http://host:8080/path/archive.foz".
+// Only ReadOnly mode and plain http are supported.
+// On prepare(), only the header, dictionaries and the index at the end of the archive are fetched.
+// Payloads are fetched as they are read, and prefetch_entries() coalesces reads of many entries into few requests.
+// Everything fetched is kept in a local copy of the archive in cache_directory, which is reused by later runs
+// and other processes until the archive on the server changes.
+// If cache_directory is nullptr, $FOSSILIZE_REMOTE_CACHE_DIR is used, falling back to $TMPDIR or /tmp.
+// Archives without an index are fetched in full, fossilize-compact can be used to add one.
+// Not supported on Windows.
+DatabaseInterface *create_remote_archive_database(const char *url, DatabaseMode mode, const char *cache_directory = nullptr);
+
+// Paths starting with http:// are opened with create_remote_archive_database,
+// other backends are chosen by file extension.
 DatabaseInterface *create_database(const char *path, DatabaseMode mode);
 
+// A content-addressed store of shader modules which many applications can share, e.g. one per machine.
+// Module hashes only depend on the module itself, so SPIR-V which several archives share is stored once.
+// Only RESOURCE_SHADER_MODULE entries are visible or can be written, so a store can never add pipelines
+// or other objects to an application's archive. The store is backed by a database chosen by create_database().
+// fossilize-prune --shader-module-store moves the modules of an archive into a store.
+DatabaseInterface *create_shader_module_store_database(const char *path, DatabaseMode mode);
+
+// Trains a compression dictionary for DatabaseInterface::add_compression_dictionary().
+// samples holds sample_count payloads back to back, the size of each payload is found in sample_sizes.
+// Returns the size of the dictionary written to dictionary,
+// or 0 if training failed or Fossilize was built without Zstandard support.
+size_t train_compression_dictionary(const void *samples, const size_t *sample_sizes, unsigned sample_count,
+                                    void *dictionary, size_t dictionary_capacity);
+
 // This is a special kind of database which can be used from multiple independent processes and splits out the database
 // into a read-only part and a write-only part, which is unique for each instance of this database.
 // base_path.foz is the read-only database. If it does not exist, it will not be written to either.
@@ -213,6 +397,10 @@ DatabaseInterface *create_database(const char *path, DatabaseMode mode);
 // and thus will not trigger creation of a new database.
 // Similarly, in append mode, the entries in the extra databases are assumed to be part of the base_path.foz database.
 // If any database in extra_read_only_database_paths does not ->prepare() correctly, it is simply ignored.
+// Extra paths starting with http:// are opened with create_remote_archive_database.
+// Extra paths ending with .modules.foz are opened with create_shader_module_store_database.
+// In Append mode, modules found in such a store are not written again. In ReadOnly mode, has_entry() and read_entry()
+// find them, but get_hash_list_for_resource_tag() does not list them, since a store holds the modules of many applications.
 // base_path may be nullptr if mode is ReadOnly. In this case, the read-only database from base_path.foz is ignored.
 DatabaseInterface *create_concurrent_database(const char *base_path, DatabaseMode mode,
                                               const char * const *extra_read_only_database_paths,
@@ -227,5 +415,26 @@ DatabaseInterface *create_concurrent_database_with_encoded_extra_paths(const cha
                                                                        const char *encoded_read_only_database_paths);
 
 // Merges stream archives found in source_paths into append_database_path.
-bool merge_concurrent_databases(const char *append_database_path, const char * const *source_paths, size_t num_source_paths);
+// Payloads are transferred without decompressing them, unless they depend on a compression dictionary
+// which the target archive does not have.
+// Source archives are read on num_threads threads. If 0, the number of hardware threads is used.
+bool merge_concurrent_databases(const char *append_database_path, const char * const *source_paths, size_t num_source_paths,
+                                unsigned num_threads = 0);
+
+// See diff_concurrent_databases().
+struct DatabaseDiffStatistics
+{
+	uint64_t new_entry_count;
+	uint64_t delta_entry_count;
+	uint64_t delta_payload_bytes;
+};
+
+// Writes every entry of new_path which is not found in any of base_paths to a new stream archive at delta_path.
+// base_paths would typically be the archive clients already have, plus any deltas shipped on top of it.
+// Passing the base and delta archives as extra read-only paths to create_concurrent_database
+// then provides the same entries as new_path, without merging anything on the client.
+// Payloads are transferred without decompressing them, like merge_concurrent_databases.
+// Fails if any of the archives cannot be opened. stats may be nullptr.
+bool diff_concurrent_databases(const char *delta_path, const char * const *base_paths, size_t num_base_paths,
+                               const char *new_path, DatabaseDiffStatistics *stats = nullptr);
 }
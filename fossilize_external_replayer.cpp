@@ -68,6 +68,54 @@ ExternalReplayer::PollResult ExternalReplayer::poll_progress(Progress &progress)
 	return impl->poll_progress(progress);
 }
 
+bool ExternalReplayer::wait_for_messages(unsigned timeout_ms)
+{
+	return impl->wait_for_messages(timeout_ms);
+}
+
+static void compute_type_progress_delta(const ExternalReplayer::TypeProgress &current,
+                                        const ExternalReplayer::TypeProgress &last,
+                                        ExternalReplayer::TypeProgress &delta)
+{
+	delta.parsed = current.parsed - last.parsed;
+	delta.parsed_fail = current.parsed_fail - last.parsed_fail;
+	delta.completed = current.completed - last.completed;
+	delta.skipped = current.skipped - last.skipped;
+	delta.cached = current.cached - last.cached;
+	delta.total = current.total - last.total;
+}
+
+ExternalReplayer::PollResult ExternalReplayer::poll_progress_delta(Progress &progress, Progress &delta)
+{
+	// Clear first, so a change which happens while we poll signals the handle again.
+	impl->clear_progress_wait_handle();
+
+	delta = {};
+	auto result = impl->poll_progress(progress);
+	if (result != PollResult::Running && result != PollResult::Complete)
+		return result;
+
+	auto &last = impl->last_delta_progress;
+	compute_type_progress_delta(progress.compute, last.compute, delta.compute);
+	compute_type_progress_delta(progress.graphics, last.graphics, delta.graphics);
+	delta.completed_modules = progress.completed_modules - last.completed_modules;
+	delta.missing_modules = progress.missing_modules - last.missing_modules;
+	delta.total_modules = progress.total_modules - last.total_modules;
+	delta.banned_modules = progress.banned_modules - last.banned_modules;
+	delta.module_validation_failures = progress.module_validation_failures - last.module_validation_failures;
+	delta.clean_crashes = progress.clean_crashes - last.clean_crashes;
+	delta.dirty_crashes = progress.dirty_crashes - last.dirty_crashes;
+	delta.total_graphics_pipeline_blobs = progress.total_graphics_pipeline_blobs - last.total_graphics_pipeline_blobs;
+	delta.total_compute_pipeline_blobs = progress.total_compute_pipeline_blobs - last.total_compute_pipeline_blobs;
+	last = progress;
+	return result;
+}
+
+bool ExternalReplayer::get_progress_wait_handle(uintptr_t *handle) const
+{
+	return impl->get_progress_wait_handle(handle);
+}
+
 void ExternalReplayer::compute_condensed_progress(const Progress &progress, unsigned &completed, unsigned &total)
 {
 	// Pipelines go through parsing and then compilation, each of which stage gets a report.
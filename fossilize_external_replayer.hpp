@@ -99,6 +99,11 @@ public:
 		// Maps to --device-index.
 		unsigned device_index;
 
+		// Maps to one --replay-device-index per entry. Child process N replays on device N % count,
+		// and pipeline caches are merged once per pipelineCacheUUID. Overrides device_index if non-zero count.
+		const unsigned *replay_device_indices;
+		unsigned num_replay_device_indices;
+
 		// Carve out a range of which pipelines to replay if use_pipeline_range is set.
 		// Used for multi-process replays where each process gets its own slice to churn through.
 		unsigned start_graphics_index;
@@ -143,6 +148,107 @@ public:
 		// This is useful if we only want to use the whitelist for e.g. shader modules.
 		// Must be non-zero if on_disk_replay_whitelist is set.
 		WhiteListMaskFlags on_disk_replay_whitelist_mask;
+
+		// Compiles pipelines in order of how often they were bound while recording,
+		// according to RESOURCE_PIPELINE_USAGE entries in the databases.
+		// Faulty pipeline indices then refer to this order as well.
+		bool prioritize_hot_pipelines;
+
+		// Compiles the most expensive pipelines first, so per-process slices finish more evenly.
+		// Cost is estimated from shader module sizes and stage counts. If pipeline_cost_history_path
+		// points to a CSV written by an earlier pipeline_stats_path run, measured compile times are used where known.
+		bool prioritize_expensive_pipelines;
+		const char *pipeline_cost_history_path;
+
+		// Replays pipelines which share shader modules close together to reduce shader module cache misses.
+		bool module_affinity_order;
+
+		// Replays samplers, layouts and render passes when a pipeline first needs them,
+		// so pipelines start compiling before every trivial object has been created.
+		bool lazy_trivial_objects;
+
+		// Evicts shader modules by how many pipelines still need them rather than LRU.
+		bool shader_cache_remaining_uses;
+
+		// Backs large parser scratch blocks with transparent huge pages where supported.
+		bool scratch_huge_pages;
+
+		// If greater than 1, worker threads pass up to this many pipelines to a single vkCreate*Pipelines call.
+		// If a child process crashes inside such a call, the range is retried without batching to find the faulty pipeline.
+		unsigned pipeline_batch_size;
+
+		// Number of pipeline chunks each process parses and compiles at the same time. 0 lets the replayer decide.
+		unsigned pipeline_memory_contexts;
+
+		// Size in MiB of a shared memory block where child processes publish decoded SPIR-V,
+		// so other processes which need the same module do not have to read and decode it again.
+		// 0 disables the cache. Only supported on Linux.
+		unsigned shared_module_cache_mb;
+
+		// Keeps a standby child per process which has already created its device and replayed the trivial objects.
+		// When a child crashes, its standby takes over instead of a new child starting from scratch.
+		// Only supported on Linux.
+		bool spare_processes;
+
+		// Runs the replayer's child processes in a new cgroup below this delegated cgroup v2 directory.
+		// cgroup_memory_high_mb sets memory.high, and the replayer backs off when the kernel starts throttling.
+		// cgroup_cpu_weight sets cpu.weight, 1 to 10000. 0 leaves either at the default. Only supported on Linux.
+		const char *cgroup_path;
+		unsigned cgroup_memory_high_mb;
+		unsigned cgroup_cpu_weight;
+
+		// Limits committed memory of all child processes together through their job object.
+		// The replayer suspends children as the limit gets close. 0 means no limit. Only supported on Windows.
+		unsigned job_memory_limit_mb;
+
+		// If shard_count is non-zero, only replays the pipelines whose hash falls in shard shard_index.
+		// Every node in a build farm can be handed the same archive with its own shard index.
+		unsigned shard_index;
+		unsigned shard_count;
+
+		// If non-zero, only replays the pipelines which were recorded for this application feature hash,
+		// i.e. the hash of the application info entry. Useful for archives which combine many applications.
+		Hash filter_application_hash;
+
+		// If non-zero, stops compiling pipelines this many seconds after the replayer started.
+		// Pipelines are compiled hottest first, and caches are flushed as usual once the deadline passes.
+		// Together with replayer_cache_path, the next replay picks up the pipelines which were left over.
+		unsigned time_budget_seconds;
+
+		// Compiles graphics pipelines as pre-rasterization and fragment shader libraries which are shared
+		// between pipelines, then links them. Ignored if the device lacks VK_EXT_graphics_pipeline_library.
+		bool graphics_pipeline_library;
+
+		// Passes SPIR-V inline to pipeline creation instead of creating VkShaderModules.
+		// Ignored if the device supports neither VK_KHR_maintenance5 nor VK_EXT_graphics_pipeline_library.
+		bool inline_shader_modules;
+
+		// Creates pipelines with VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT first, and only compiles the misses.
+		// Ignored if the device lacks VK_EXT_pipeline_creation_cache_control.
+		bool probe_pipeline_cache;
+
+		// If non-null, captures VK_KHR_pipeline_binary data of every replayed pipeline into this stream archive.
+		const char *pipeline_binary_archive_path;
+
+		// Writes compile time percentiles, per-thread idle time, pipeline cache hit ratio
+		// and the slowest pipelines as JSON to this path once replay is done.
+		const char *benchmark_report_path;
+
+		// Writes a Chrome JSON trace of what every replayer thread was doing to this path once replay is done.
+		// It can be loaded in chrome://tracing or Perfetto.
+		const char *trace_path;
+
+		// Restricts worker threads to a CPU list such as "0-15,32-47". Null leaves affinity alone.
+		const char *worker_cpus;
+
+		// Keeps each worker thread on the CPUs of one NUMA node, nodes picked round-robin,
+		// so parsing memory stays local to the node the thread runs on.
+		bool numa_local_workers;
+
+		// "low" or "idle" lowers the scheduling priority of worker threads, e.g. to stay out of the way
+		// of a game running in the foreground. "idle" maps to SCHED_IDLE or THREAD_MODE_BACKGROUND_BEGIN.
+		// Null leaves the priority alone.
+		const char *worker_priority;
 	};
 
 	ExternalReplayer();
@@ -227,16 +333,35 @@ public:
 	};
 
 	PollResult poll_progress(Progress &progress);
+
+	// Like poll_progress(), but also returns how much every counter moved since the previous call,
+	// so a UI can react to only what changed. The first call reports everything as a delta.
+	// Clears the handle returned by get_progress_wait_handle().
+	PollResult poll_progress_delta(Progress &progress, Progress &delta);
+
+	// Gets a handle which is signalled when progress counters change, messages are posted,
+	// or the replayer completes. The master checks for changes about once a second, so this does not fire per pipeline.
+	// On Linux, this is an eventfd to be used with poll() or epoll. On Windows, an auto-reset event HANDLE.
+	// Returns false if the platform does not support it.
+	// Do not mix this with wait_for_messages() on Windows, since both consume the same event.
+	bool get_progress_wait_handle(uintptr_t *handle) const;
+
+	// Blocks until the replayer has posted messages for poll_progress() to consume, or timeout_ms passes.
+	// Progress counters do not post messages, so a timeout should still be used to refresh those.
+	// Returns true if messages are pending.
+	bool wait_for_messages(unsigned timeout_ms);
 	static void compute_condensed_progress(const Progress &progress, unsigned &completed, unsigned &total);
 
 	struct GlobalResourceUsage
 	{
 		// Number of outstanding dirty pages on the system.
 		// Can be used to keep track if driver cache threads are being swarmed.
+		// On Windows, this is the amount of data child processes wrote in the last second instead.
 		// If negative, the query failed.
 		int32_t dirty_pages_mib;
 
 		// Stats from PSI on Linux, represents IO stall time from 0 to 100.
+		// On Windows, this is the share of time running child processes did not get to run on a CPU.
 		// If negative, the query failed.
 		int32_t io_stall_percentage;
 
@@ -257,6 +382,14 @@ public:
 		// how much unrelated shared memory is used.
 		uint32_t shared_metadata_mib;
 
+		// Memory the replayer accounts for itself, in KiB. Zero for the primary process, which does not replay.
+		// Parser scratch blocks, JSON document pools and read buffers, SPIR-V held by the shader module cache,
+		// and the lookup tables of the archives. What is resident beyond these is mostly the Vulkan driver.
+		uint32_t scratch_allocator_kib;
+		uint32_t parse_buffer_kib;
+		uint32_t shader_module_cache_kib;
+		uint32_t database_index_kib;
+
 		// resident - shared is the amount of resident memory which is unique to the process,
 	};
 
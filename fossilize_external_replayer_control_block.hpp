@@ -23,6 +23,7 @@
 #pragma once
 
 #include <string.h>
+#include <stdint.h>
 #include <atomic>
 static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Atomic size mismatch. This type likely requires a lock to work.");
 
@@ -32,16 +33,26 @@ static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Atomic size mi
 namespace Fossilize
 {
 enum { ControlBlockMessageSize = 64 };
-enum { ControlBlockMagic = 0x19bcde1b };
+enum { ControlBlockMagic = 0x19bcde1c };
 enum { MaxProcessStats = 256 };
+// Bytes reserved for SharedControlBlock in front of the message ring.
+enum { ControlBlockDataSize = 8 * 1024 };
+
+// Memory a replayer process accounts for itself. Whatever is resident beyond these
+// is the Vulkan driver, or allocations which are not tracked.
+enum ControlBlockMemorySubsystem
+{
+	ControlBlockMemoryScratchAllocators = 0,
+	ControlBlockMemoryParseBuffers,
+	ControlBlockMemoryShaderModuleCache,
+	ControlBlockMemoryDatabaseIndex,
+	ControlBlockMemorySubsystemCount
+};
 
 struct SharedControlBlock
 {
 	uint32_t version_cookie;
 
-	// Used to implement a lock (or spinlock).
-	int futex_lock;
-
 	// Progress. Just need atomics to implement this.
 	std::atomic<uint32_t> successful_modules;
 	std::atomic<uint32_t> successful_graphics;
@@ -75,90 +86,173 @@ struct SharedControlBlock
 	// 64-bit would need some form of locking on 32-bit arch.
 	std::atomic<uint32_t> process_reserved_memory_mib[MaxProcessStats];
 	std::atomic<uint32_t> process_shared_memory_mib[MaxProcessStats];
+	// Written by each replayer process into its own slot, indexed like the counters above.
+	// Measured in KiB, since some subsystems stay well below a MiB.
+	std::atomic<uint32_t> process_subsystem_memory_kib[MaxProcessStats][ControlBlockMemorySubsystemCount];
 
 	std::atomic<int32_t> dirty_pages_mib;
 	std::atomic<int32_t> io_stall_percentage;
 
-	// Ring buffer. Needs lock.
-	uint32_t write_count;
-	uint32_t read_count;
-	uint32_t read_offset;
-	uint32_t write_offset;
+	// Message ring. Lock-free, any number of writers and readers.
+	std::atomic<uint32_t> write_count;
+	std::atomic<uint32_t> read_count;
 	uint32_t ring_buffer_offset;
 	uint32_t ring_buffer_size;
+
+	// Bumped after every message is written. Readers can sleep on it with a futex.
+	std::atomic<uint32_t> message_serial;
+	// Number of readers sleeping on message_serial. Writers only need to wake if non-zero.
+	std::atomic<uint32_t> message_waiters;
 };
 
-// These are not thread-safe. Need to lock them by external means.
-static inline uint32_t shared_control_block_read_avail(SharedControlBlock *control_block)
+static_assert(sizeof(SharedControlBlock) <= ControlBlockDataSize, "Control block overlaps the message ring.");
+
+// The ring is an array of fixed size slots, each with its own sequence number.
+// A slot for message N is free for writing when its sequence is N,
+// and holds a complete message when its sequence is N + 1.
+// A writer dying half-way through only stalls the ring at that slot, it cannot corrupt other messages.
+struct SharedControlBlockMessageSlot
 {
-	uint32_t ret = control_block->write_count - control_block->read_count;
-	return ret;
-}
+	std::atomic<uint32_t> sequence;
+	// Keep the payload in its own cache line, away from the sequence number.
+	uint32_t padding[15];
+	char data[ControlBlockMessageSize];
+};
 
-static inline uint32_t shared_control_block_write_avail(SharedControlBlock *control_block)
+static inline SharedControlBlockMessageSlot *shared_control_block_slots(SharedControlBlock *control_block)
 {
-	uint32_t ret = 0;
-	uint32_t max_capacity_write_count = control_block->read_count + control_block->ring_buffer_size;
-	if (control_block->write_count >= max_capacity_write_count)
-		ret = 0;
-	else
-		ret = max_capacity_write_count - control_block->write_count;
-	return ret;
+	return reinterpret_cast<SharedControlBlockMessageSlot *>(
+			reinterpret_cast<uint8_t *>(control_block) + control_block->ring_buffer_offset);
 }
 
-static inline bool shared_control_block_read(SharedControlBlock *control_block,
-                                             void *data_, uint32_t size)
+static inline uint32_t shared_control_block_num_slots(const SharedControlBlock *control_block)
 {
-	auto *data = static_cast<uint8_t *>(data_);
-	const uint8_t *ring = reinterpret_cast<const uint8_t *>(control_block) + control_block->ring_buffer_offset;
+	return control_block->ring_buffer_size / uint32_t(sizeof(SharedControlBlockMessageSlot));
+}
 
-	if (size > control_block->ring_buffer_size)
-		return false;
+// Must be called once by the process which owns the control block, after ring_buffer_offset and ring_buffer_size are set.
+// ring_buffer_size must be a power of two.
+static inline void shared_control_block_init_ring(SharedControlBlock *control_block)
+{
+	auto *slots = shared_control_block_slots(control_block);
+	uint32_t num_slots = shared_control_block_num_slots(control_block);
+	for (uint32_t i = 0; i < num_slots; i++)
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+	control_block->write_count.store(0, std::memory_order_relaxed);
+	control_block->read_count.store(0, std::memory_order_relaxed);
+}
 
-	if (size > (control_block->write_count - control_block->read_count))
+// Reads one message. size must not exceed ControlBlockMessageSize.
+// Returns false if there are no complete messages.
+static inline bool shared_control_block_read(SharedControlBlock *control_block,
+                                             void *data, uint32_t size)
+{
+	if (size > ControlBlockMessageSize)
 		return false;
 
-	uint32_t read_first = control_block->ring_buffer_size - control_block->read_offset;
-	uint32_t read_second = 0;
-	if (read_first > size)
-		read_first = size;
-	read_second = size - read_first;
+	auto *slots = shared_control_block_slots(control_block);
+	uint32_t num_slots = shared_control_block_num_slots(control_block);
+	uint32_t mask = num_slots - 1;
+	uint32_t pos = control_block->read_count.load(std::memory_order_relaxed);
 
-	memcpy(data, ring + control_block->read_offset, read_first);
-	if (read_second)
-		memcpy(data + read_first, ring, read_second);
+	for (;;)
+	{
+		auto &slot = slots[pos & mask];
+		uint32_t seq = slot.sequence.load(std::memory_order_acquire);
+		auto diff = int32_t(seq - (pos + 1));
 
-	control_block->read_offset = (control_block->read_offset + size) & (control_block->ring_buffer_size - 1);
-	control_block->read_count += size;
-	return true;
+		if (diff == 0)
+		{
+			if (control_block->read_count.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				memcpy(data, slot.data, size);
+				// Hand the slot back to writers for the next lap around the ring.
+				slot.sequence.store(pos + num_slots, std::memory_order_release);
+				return true;
+			}
+		}
+		else if (diff < 0)
+			return false;
+		else
+			pos = control_block->read_count.load(std::memory_order_relaxed);
+	}
 }
 
+// Writes one message. size must not exceed ControlBlockMessageSize, shorter messages are zero padded.
+// Returns false if the ring is full.
 static inline bool shared_control_block_write(SharedControlBlock *control_block,
-                                              const void *data_, uint32_t size)
+                                              const void *data, uint32_t size)
 {
-	auto *data = static_cast<const uint8_t *>(data_);
-	uint8_t *ring = reinterpret_cast<uint8_t *>(control_block) + control_block->ring_buffer_offset;
-
-	if (size > control_block->ring_buffer_size)
-		return false;
-
-	uint32_t max_capacity_write_count = control_block->read_count + control_block->ring_buffer_size;
-	if (control_block->write_count + size > max_capacity_write_count)
+	if (size > ControlBlockMessageSize)
 		return false;
 
-	uint32_t write_first = control_block->ring_buffer_size - control_block->write_offset;
-	uint32_t write_second = 0;
-	if (write_first > size)
-		write_first = size;
-	write_second = size - write_first;
+	auto *slots = shared_control_block_slots(control_block);
+	uint32_t num_slots = shared_control_block_num_slots(control_block);
+	uint32_t mask = num_slots - 1;
+	uint32_t pos = control_block->write_count.load(std::memory_order_relaxed);
 
-	memcpy(ring + control_block->write_offset, data, write_first);
-	if (write_second)
-		memcpy(ring, data + write_first, write_second);
+	for (;;)
+	{
+		auto &slot = slots[pos & mask];
+		uint32_t seq = slot.sequence.load(std::memory_order_acquire);
+		auto diff = int32_t(seq - pos);
 
-	control_block->write_offset = (control_block->write_offset + size) & (control_block->ring_buffer_size - 1);
-	control_block->write_count += size;
+		if (diff == 0)
+		{
+			if (control_block->write_count.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				memcpy(slot.data, data, size);
+				memset(slot.data + size, 0, ControlBlockMessageSize - size);
+				slot.sequence.store(pos + 1, std::memory_order_release);
+				break;
+			}
+		}
+		else if (diff < 0)
+			return false;
+		else
+			pos = control_block->write_count.load(std::memory_order_relaxed);
+	}
 
+	control_block->message_serial.fetch_add(1, std::memory_order_seq_cst);
 	return true;
 }
+
+// After a successful write, the writer must wake up sleeping readers if this returns true.
+static inline bool shared_control_block_needs_wake(SharedControlBlock *control_block)
+{
+	return control_block->message_waiters.load(std::memory_order_seq_cst) != 0;
+}
+
+// Returns true if a complete message can be read.
+static inline bool shared_control_block_read_avail(SharedControlBlock *control_block)
+{
+	auto *slots = shared_control_block_slots(control_block);
+	uint32_t mask = shared_control_block_num_slots(control_block) - 1;
+	uint32_t pos = control_block->read_count.load(std::memory_order_relaxed);
+	return slots[pos & mask].sequence.load(std::memory_order_acquire) == pos + 1;
+}
+
+// Changes whenever any of the counters behind ExternalReplayer::Progress changes.
+// The master compares this between ticks to decide whether readers should be woken up.
+static inline uint32_t shared_control_block_progress_signature(const SharedControlBlock *control_block)
+{
+	const std::atomic<uint32_t> *counters[] = {
+		&control_block->successful_modules, &control_block->successful_graphics, &control_block->successful_compute,
+		&control_block->skipped_graphics, &control_block->skipped_compute,
+		&control_block->cached_graphics, &control_block->cached_compute,
+		&control_block->clean_process_deaths, &control_block->dirty_process_deaths,
+		&control_block->parsed_graphics, &control_block->parsed_compute,
+		&control_block->parsed_graphics_failures, &control_block->parsed_compute_failures,
+		&control_block->parsed_module_failures,
+		&control_block->total_graphics, &control_block->total_compute, &control_block->total_modules,
+		&control_block->banned_modules, &control_block->module_validation_failures,
+		&control_block->progress_started, &control_block->progress_complete,
+	};
+
+	// Every counter only grows, so a plain sum cannot come back to a previous value.
+	uint32_t signature = 0;
+	for (auto *counter : counters)
+		signature += counter->load(std::memory_order_relaxed);
+	return signature;
+}
 }
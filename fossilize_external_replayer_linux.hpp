@@ -26,6 +26,9 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include <fcntl.h>
 #include <unistd.h>
 #include <sched.h>
@@ -107,6 +110,7 @@ struct ExternalReplayer::Impl
 	int fd = -1;
 	int kill_fd = -1;
 	int control_fd = -1;
+	int progress_fd = -1;
 	SharedControlBlock *shm_block = nullptr;
 	size_t shm_block_size = 0;
 	int wstatus = 0;
@@ -116,10 +120,14 @@ struct ExternalReplayer::Impl
 	std::vector<std::pair<unsigned, Hash>> faulty_compute_pipelines;
 	std::unordered_set<Hash> graphics_failed_validation;
 	std::unordered_set<Hash> compute_failed_validation;
+	Progress last_delta_progress = {};
 
 	bool start(const ExternalReplayer::Options &options);
 	void start_replayer_process(const ExternalReplayer::Options &options, int ctl_fd);
 	ExternalReplayer::PollResult poll_progress(Progress &progress);
+	bool wait_for_messages(unsigned timeout_ms);
+	bool get_progress_wait_handle(uintptr_t *handle) const;
+	void clear_progress_wait_handle();
 	uintptr_t get_process_handle() const;
 	int wait();
 	bool is_process_complete(int *return_status);
@@ -148,11 +156,44 @@ ExternalReplayer::Impl::~Impl()
 		close(kill_fd);
 	if (control_fd >= 0)
 		close(control_fd);
+	if (progress_fd >= 0)
+		close(progress_fd);
 
 	if (shm_block)
 		munmap(shm_block, shm_block_size);
 }
 
+bool ExternalReplayer::Impl::get_progress_wait_handle(uintptr_t *handle) const
+{
+	if (progress_fd < 0)
+		return false;
+	*handle = uintptr_t(progress_fd);
+	return true;
+}
+
+void ExternalReplayer::Impl::clear_progress_wait_handle()
+{
+	uint64_t count;
+	if (progress_fd >= 0 && read(progress_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		LOGW("Failed to clear progress eventfd.\n");
+}
+
+bool ExternalReplayer::Impl::wait_for_messages(unsigned timeout_ms)
+{
+	if (!shm_block)
+		return false;
+
+	// Register as a waiter before sampling the serial, so a writer either sees us and wakes,
+	// or has already bumped the serial and the futex wait returns immediately.
+	shm_block->message_waiters.fetch_add(1, std::memory_order_seq_cst);
+	uint32_t serial = shm_block->message_serial.load(std::memory_order_seq_cst);
+	if (!shared_control_block_read_avail(shm_block))
+		futex_wrapper_wait(reinterpret_cast<uint32_t *>(&shm_block->message_serial), serial, timeout_ms);
+	shm_block->message_waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+	return shared_control_block_read_avail(shm_block);
+}
+
 uintptr_t ExternalReplayer::Impl::get_process_handle() const
 {
 	return uintptr_t(pid);
@@ -203,6 +244,12 @@ bool ExternalReplayer::Impl::poll_memory_usage(uint32_t *num_processes, ProcessS
 				stats[i].shared_metadata_mib = shm_block->metadata_shared_size_mib.load(std::memory_order_relaxed);
 			else
 				stats[i].shared_metadata_mib = 0;
+
+			auto &subsystems = shm_block->process_subsystem_memory_kib[i];
+			stats[i].scratch_allocator_kib = subsystems[ControlBlockMemoryScratchAllocators].load(std::memory_order_relaxed);
+			stats[i].parse_buffer_kib = subsystems[ControlBlockMemoryParseBuffers].load(std::memory_order_relaxed);
+			stats[i].shader_module_cache_kib = subsystems[ControlBlockMemoryShaderModuleCache].load(std::memory_order_relaxed);
+			stats[i].database_index_kib = subsystems[ControlBlockMemoryDatabaseIndex].load(std::memory_order_relaxed);
 		}
 	}
 	else
@@ -269,15 +316,9 @@ ExternalReplayer::PollResult ExternalReplayer::Impl::poll_progress(ExternalRepla
 	progress.total_graphics_pipeline_blobs = shm_block->static_total_count_graphics.load(std::memory_order_relaxed);
 	progress.total_compute_pipeline_blobs = shm_block->static_total_count_compute.load(std::memory_order_relaxed);
 
-	futex_wrapper_lock(&shm_block->futex_lock);
-	size_t read_avail = shared_control_block_read_avail(shm_block);
-	for (size_t i = ControlBlockMessageSize; i <= read_avail; i += ControlBlockMessageSize)
-	{
-		char buf[ControlBlockMessageSize] = {};
-		shared_control_block_read(shm_block, buf, sizeof(buf));
+	char buf[ControlBlockMessageSize];
+	while (shared_control_block_read(shm_block, buf, sizeof(buf)))
 		parse_message(buf);
-	}
-	futex_wrapper_unlock(&shm_block->futex_lock);
 	return complete ? ExternalReplayer::PollResult::Complete : ExternalReplayer::PollResult::Running;
 }
 
@@ -491,7 +532,7 @@ bool ExternalReplayer::Impl::get_compute_failed_validation(size_t *count, Hash *
 
 void ExternalReplayer::Impl::start_replayer_process(const ExternalReplayer::Options &options, int ctl_fd)
 {
-	char fd_name[16], control_fd_name[16];
+	char fd_name[16], control_fd_name[16], progress_fd_name[16];
 	sprintf(fd_name, "%d", fd);
 	char num_thread_holder[16];
 
@@ -530,6 +571,13 @@ void ExternalReplayer::Impl::start_replayer_process(const ExternalReplayer::Opti
 		argv.push_back(control_fd_name);
 	}
 
+	if (progress_fd >= 0)
+	{
+		argv.push_back("--progress-fd");
+		sprintf(progress_fd_name, "%d", progress_fd);
+		argv.push_back(progress_fd_name);
+	}
+
 	if (options.spirv_validate)
 		argv.push_back("--spirv-val");
 
@@ -587,6 +635,123 @@ void ExternalReplayer::Impl::start_replayer_process(const ExternalReplayer::Opti
 	if (options.ignore_derived_pipelines)
 		argv.push_back("--ignore-derived-pipelines");
 
+	if (options.prioritize_hot_pipelines)
+		argv.push_back("--prioritize-hot-pipelines");
+
+	if (options.prioritize_expensive_pipelines)
+		argv.push_back("--prioritize-expensive-pipelines");
+
+	if (options.module_affinity_order)
+		argv.push_back("--module-affinity-order");
+
+	if (options.lazy_trivial_objects)
+		argv.push_back("--lazy-trivial-objects");
+
+	if (options.scratch_huge_pages)
+		argv.push_back("--scratch-huge-pages");
+
+	if (options.graphics_pipeline_library)
+		argv.push_back("--graphics-pipeline-library");
+
+	if (options.inline_shader_modules)
+		argv.push_back("--inline-shader-modules");
+
+	if (options.probe_pipeline_cache)
+		argv.push_back("--probe-pipeline-cache");
+
+	char batch_size_str[16];
+	if (options.pipeline_batch_size > 1)
+	{
+		sprintf(batch_size_str, "%u", options.pipeline_batch_size);
+		argv.push_back("--pipeline-batch-size");
+		argv.push_back(batch_size_str);
+	}
+
+	char shared_module_cache_str[16];
+	if (options.shared_module_cache_mb)
+	{
+		sprintf(shared_module_cache_str, "%u", options.shared_module_cache_mb);
+		argv.push_back("--shared-module-cache");
+		argv.push_back(shared_module_cache_str);
+	}
+
+	if (options.spare_processes)
+		argv.push_back("--spare-processes");
+
+	if (options.cgroup_path)
+	{
+		argv.push_back("--cgroup");
+		argv.push_back(options.cgroup_path);
+	}
+
+	char cgroup_memory_high_str[16];
+	if (options.cgroup_memory_high_mb)
+	{
+		sprintf(cgroup_memory_high_str, "%u", options.cgroup_memory_high_mb);
+		argv.push_back("--cgroup-memory-high");
+		argv.push_back(cgroup_memory_high_str);
+	}
+
+	char cgroup_cpu_weight_str[16];
+	if (options.cgroup_cpu_weight)
+	{
+		sprintf(cgroup_cpu_weight_str, "%u", options.cgroup_cpu_weight);
+		argv.push_back("--cgroup-cpu-weight");
+		argv.push_back(cgroup_cpu_weight_str);
+	}
+
+	char shard_index_str[16], shard_count_str[16];
+	if (options.shard_count)
+	{
+		sprintf(shard_index_str, "%u", options.shard_index);
+		sprintf(shard_count_str, "%u", options.shard_count);
+		argv.push_back("--shard");
+		argv.push_back(shard_index_str);
+		argv.push_back(shard_count_str);
+	}
+
+	char filter_application_str[17];
+	if (options.filter_application_hash)
+	{
+		sprintf(filter_application_str, "%016llx", static_cast<unsigned long long>(options.filter_application_hash));
+		argv.push_back("--filter-application");
+		argv.push_back(filter_application_str);
+	}
+
+	char time_budget_str[16];
+	if (options.time_budget_seconds)
+	{
+		sprintf(time_budget_str, "%u", options.time_budget_seconds);
+		argv.push_back("--time-budget");
+		argv.push_back(time_budget_str);
+	}
+
+	char memory_contexts_str[16];
+	if (options.pipeline_memory_contexts)
+	{
+		sprintf(memory_contexts_str, "%u", options.pipeline_memory_contexts);
+		argv.push_back("--memory-contexts");
+		argv.push_back(memory_contexts_str);
+	}
+
+	if (options.shader_cache_remaining_uses)
+	{
+		argv.push_back("--shader-cache-policy");
+		argv.push_back("remaining-uses");
+	}
+
+	if (options.pipeline_cost_history_path)
+	{
+		argv.push_back("--pipeline-cost-history");
+		argv.push_back(options.pipeline_cost_history_path);
+	}
+
+	if (options.pipeline_binary_archive_path)
+	{
+		argv.push_back("--pipeline-binary-archive");
+		argv.push_back(options.pipeline_binary_archive_path);
+	}
+
 	if (options.null_device)
 		argv.push_back("--null-device");
 
@@ -619,6 +784,33 @@ void ExternalReplayer::Impl::start_replayer_process(const ExternalReplayer::Opti
 		argv.push_back(options.pipeline_stats_path);
 	}
 
+	if (options.benchmark_report_path)
+	{
+		argv.push_back("--benchmark-report");
+		argv.push_back(options.benchmark_report_path);
+	}
+
+	if (options.trace_path)
+	{
+		argv.push_back("--trace");
+		argv.push_back(options.trace_path);
+	}
+
+	if (options.worker_cpus)
+	{
+		argv.push_back("--worker-cpus");
+		argv.push_back(options.worker_cpus);
+	}
+
+	if (options.numa_local_workers)
+		argv.push_back("--numa-local-workers");
+
+	if (options.worker_priority)
+	{
+		argv.push_back("--worker-priority");
+		argv.push_back(options.worker_priority);
+	}
+
 	char timeout[16];
 	if (options.timeout_seconds)
 	{
@@ -636,6 +828,15 @@ void ExternalReplayer::Impl::start_replayer_process(const ExternalReplayer::Opti
 		argv.push_back(implicit_indices[i].data());
 	}
 
+	std::vector<std::array<char, 16>> replay_device_indices;
+	replay_device_indices.resize(options.num_replay_device_indices);
+	for (unsigned i = 0; i < options.num_replay_device_indices; i++)
+	{
+		argv.push_back("--replay-device-index");
+		sprintf(replay_device_indices[i].data(), "%u", options.replay_device_indices[i]);
+		argv.push_back(replay_device_indices[i].data());
+	}
+
 	argv.push_back(nullptr);
 
 	if (options.quiet)
@@ -767,8 +968,8 @@ bool ExternalReplayer::Impl::start(const ExternalReplayer::Options &options)
 		return false;
 	}
 
-	// Reserve 4 kB for control data, and 64 kB for a cross-process SHMEM ring buffer.
-	shm_block_size = 64 * 1024 + 4 * 1024;
+	// Reserve space for control data, and 128 kB for a cross-process SHMEM ring buffer of 1024 messages.
+	shm_block_size = 128 * 1024 + ControlBlockDataSize;
 
 	if (ftruncate(fd, shm_block_size) < 0)
 		return false;
@@ -787,8 +988,9 @@ bool ExternalReplayer::Impl::start(const ExternalReplayer::Options &options)
 	memset(static_cast<void *>(shm_block), 0, shm_block_size);
 	shm_block->version_cookie = ControlBlockMagic;
 
-	shm_block->ring_buffer_size = 64 * 1024;
-	shm_block->ring_buffer_offset = 4 * 1024;
+	shm_block->ring_buffer_size = 128 * 1024;
+	shm_block->ring_buffer_offset = ControlBlockDataSize;
+	shared_control_block_init_ring(shm_block);
 
 	// We need to let our child inherit the shared FD.
 	int current_flags = fcntl(fd, F_GETFD);
@@ -819,6 +1021,13 @@ bool ExternalReplayer::Impl::start(const ExternalReplayer::Options &options)
 	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, control_fds) < 0)
 		return false;
 
+#ifdef __linux__
+	// Not fatal, the client just cannot sleep on progress.
+	progress_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (progress_fd < 0)
+		LOGW("Failed to create progress eventfd.\n");
+#endif
+
 	pid_t new_pid = fork();
 	if (new_pid > 0)
 	{
@@ -838,6 +1047,13 @@ bool ExternalReplayer::Impl::start(const ExternalReplayer::Options &options)
 		close(control_fds[1]);
 		shutdown(control_fds[0], SHUT_WR);
 
+		// Only the replayer should inherit the eventfd, not every process the client spawns.
+		if (progress_fd >= 0 && fcntl(progress_fd, F_SETFD, 0) < 0)
+		{
+			close(progress_fd);
+			progress_fd = -1;
+		}
+
 		if (!options.inherit_process_group)
 		{
 			if (!create_low_priority_autogroup())
@@ -44,7 +44,7 @@ struct ExternalReplayer::Impl
 
 	HANDLE process = nullptr;
 	HANDLE mapping_handle = nullptr;
-	HANDLE mutex = nullptr;
+	HANDLE message_event = nullptr;
 	HANDLE job_handle = nullptr;
 	SharedControlBlock *shm_block = nullptr;
 	size_t shm_block_size = 0;
@@ -54,9 +54,13 @@ struct ExternalReplayer::Impl
 	std::vector<std::pair<unsigned, Hash>> faulty_compute_pipelines;
 	std::unordered_set<Hash> graphics_failed_validation;
 	std::unordered_set<Hash> compute_failed_validation;
+	Progress last_delta_progress = {};
 
 	bool start(const ExternalReplayer::Options &options);
 	ExternalReplayer::PollResult poll_progress(Progress &progress);
+	bool wait_for_messages(unsigned timeout_ms);
+	bool get_progress_wait_handle(uintptr_t *handle) const;
+	void clear_progress_wait_handle();
 	uintptr_t get_process_handle() const;
 	int wait();
 	bool is_process_complete(int *return_status);
@@ -82,22 +86,55 @@ ExternalReplayer::Impl::~Impl()
 		UnmapViewOfFile(shm_block);
 	if (mapping_handle)
 		CloseHandle(mapping_handle);
-	if (mutex)
-		CloseHandle(mutex);
+	if (message_event)
+		CloseHandle(message_event);
 	if (process)
 		CloseHandle(process);
 	if (job_handle)
 		CloseHandle(job_handle);
 }
 
+bool ExternalReplayer::Impl::wait_for_messages(unsigned timeout_ms)
+{
+	if (!shm_block)
+		return false;
+
+	// A stale signal from an earlier message only causes a spurious wakeup.
+	shm_block->message_waiters.fetch_add(1, std::memory_order_seq_cst);
+	if (!shared_control_block_read_avail(shm_block))
+		WaitForSingleObject(message_event, timeout_ms);
+	shm_block->message_waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+	return shared_control_block_read_avail(shm_block);
+}
+
+bool ExternalReplayer::Impl::get_progress_wait_handle(uintptr_t *handle) const
+{
+	if (!message_event)
+		return false;
+	*handle = reinterpret_cast<uintptr_t>(message_event);
+	return true;
+}
+
+void ExternalReplayer::Impl::clear_progress_wait_handle()
+{
+	// Auto-reset, waiting on it clears it.
+}
+
 bool ExternalReplayer::Impl::poll_memory_usage(uint32_t *, ProcessStats *) const
 {
 	return false;
 }
 
-bool ExternalReplayer::Impl::poll_global_resource_usage(GlobalResourceUsage &) const
+bool ExternalReplayer::Impl::poll_global_resource_usage(GlobalResourceUsage &stats) const
 {
-	return false;
+	if (!shm_block)
+		return false;
+
+	stats.dirty_pages_mib = shm_block->dirty_pages_mib.load(std::memory_order_relaxed);
+	stats.io_stall_percentage = shm_block->io_stall_percentage.load(std::memory_order_relaxed);
+	stats.num_running_processes = shm_block->num_running_processes.load(std::memory_order_relaxed);
+	return stats.num_running_processes != 0;
 }
 
 uintptr_t ExternalReplayer::Impl::get_process_handle() const
@@ -138,17 +175,9 @@ ExternalReplayer::PollResult ExternalReplayer::Impl::poll_progress(ExternalRepla
 	progress.total_graphics_pipeline_blobs = shm_block->static_total_count_graphics.load(std::memory_order_relaxed);
 	progress.total_compute_pipeline_blobs = shm_block->static_total_count_compute.load(std::memory_order_relaxed);
 
-	if (WaitForSingleObject(mutex, INFINITE) == WAIT_OBJECT_0)
-	{
-		size_t read_avail = shared_control_block_read_avail(shm_block);
-		for (size_t i = ControlBlockMessageSize; i <= read_avail; i += ControlBlockMessageSize)
-		{
-			char buf[ControlBlockMessageSize] = {};
-			shared_control_block_read(shm_block, buf, sizeof(buf));
-			parse_message(buf);
-		}
-		ReleaseMutex(mutex);
-	}
+	char buf[ControlBlockMessageSize];
+	while (shared_control_block_read(shm_block, buf, sizeof(buf)))
+		parse_message(buf);
 	return complete ? ExternalReplayer::PollResult::Complete : ExternalReplayer::PollResult::Running;
 }
 
@@ -398,8 +427,8 @@ static char *create_modified_environment(unsigned num_environment_variables, con
 
 bool ExternalReplayer::Impl::start(const ExternalReplayer::Options &options)
 {
-	// Reserve 4 kB for control data, and 64 kB for a cross-process SHMEM ring buffer.
-	shm_block_size = 64 * 1024 + 4 * 1024;
+	// Reserve space for control data, and 128 kB for a cross-process SHMEM ring buffer of 1024 messages.
+	shm_block_size = 128 * 1024 + ControlBlockDataSize;
 
 	char shm_name[256];
 	char shm_mutex_name[256];
@@ -426,13 +455,16 @@ bool ExternalReplayer::Impl::start(const ExternalReplayer::Options &options)
 	// Cast to void explicitly to avoid warnings on GCC 8.
 	memset(static_cast<void *>(shm_block), 0, shm_block_size);
 	shm_block->version_cookie = ControlBlockMagic;
-	shm_block->ring_buffer_size = 64 * 1024;
-	shm_block->ring_buffer_offset = 4 * 1024;
+	shm_block->ring_buffer_size = 128 * 1024;
+	shm_block->ring_buffer_offset = ControlBlockDataSize;
+	shared_control_block_init_ring(shm_block);
 
-	mutex = CreateMutexA(nullptr, FALSE, shm_mutex_name);
-	if (!mutex)
+	// The ring itself is lock-free. The named object is an auto-reset event which the replayer signals
+	// when it posts messages or makes progress. It is still passed as --shm-mutex-name.
+	message_event = CreateEventA(nullptr, FALSE, FALSE, shm_mutex_name);
+	if (!message_event)
 	{
-		LOGE("Failed to create named mutex.\n");
+		LOGE("Failed to create named event.\n");
 		return false;
 	}
 
@@ -537,6 +569,92 @@ bool ExternalReplayer::Impl::start(const ExternalReplayer::Options &options)
 	if (options.ignore_derived_pipelines)
 		cmdline += " --ignore-derived-pipelines";
 
+	if (options.prioritize_hot_pipelines)
+		cmdline += " --prioritize-hot-pipelines";
+
+	if (options.prioritize_expensive_pipelines)
+		cmdline += " --prioritize-expensive-pipelines";
+
+	if (options.module_affinity_order)
+		cmdline += " --module-affinity-order";
+
+	if (options.lazy_trivial_objects)
+		cmdline += " --lazy-trivial-objects";
+
+	if (options.scratch_huge_pages)
+		cmdline += " --scratch-huge-pages";
+
+	if (options.graphics_pipeline_library)
+		cmdline += " --graphics-pipeline-library";
+
+	if (options.inline_shader_modules)
+		cmdline += " --inline-shader-modules";
+
+	if (options.probe_pipeline_cache)
+		cmdline += " --probe-pipeline-cache";
+
+	if (options.pipeline_batch_size > 1)
+	{
+		cmdline += " --pipeline-batch-size ";
+		cmdline += std::to_string(options.pipeline_batch_size);
+	}
+
+	if (options.shared_module_cache_mb)
+	{
+		cmdline += " --shared-module-cache ";
+		cmdline += std::to_string(options.shared_module_cache_mb);
+	}
+
+	if (options.spare_processes)
+		cmdline += " --spare-processes";
+
+	if (options.shard_count)
+	{
+		cmdline += " --shard ";
+		cmdline += std::to_string(options.shard_index);
+		cmdline += " ";
+		cmdline += std::to_string(options.shard_count);
+	}
+
+	if (options.filter_application_hash)
+	{
+		char filter_application_str[17];
+		sprintf(filter_application_str, "%016llx", static_cast<unsigned long long>(options.filter_application_hash));
+		cmdline += " --filter-application ";
+		cmdline += filter_application_str;
+	}
+
+	if (options.time_budget_seconds)
+	{
+		cmdline += " --time-budget ";
+		cmdline += std::to_string(options.time_budget_seconds);
+	}
+
+	if (options.pipeline_memory_contexts)
+	{
+		cmdline += " --memory-contexts ";
+		cmdline += std::to_string(options.pipeline_memory_contexts);
+	}
+
+	if (options.shader_cache_remaining_uses)
+		cmdline += " --shader-cache-policy remaining-uses";
+
+	if (options.pipeline_cost_history_path)
+	{
+		cmdline += " --pipeline-cost-history ";
+		cmdline += "\"";
+		cmdline += options.pipeline_cost_history_path;
+		cmdline += "\"";
+	}
+
+	if (options.pipeline_binary_archive_path)
+	{
+		cmdline += " --pipeline-binary-archive ";
+		cmdline += "\"";
+		cmdline += options.pipeline_binary_archive_path;
+		cmdline += "\"";
+	}
+
 	if (options.null_device)
 		cmdline += " --null-device";
 
@@ -561,6 +679,43 @@ bool ExternalReplayer::Impl::start(const ExternalReplayer::Options &options)
 		cmdline += "\"";
 	}
 
+	if (options.benchmark_report_path)
+	{
+		cmdline += " --benchmark-report ";
+		cmdline += "\"";
+		cmdline += options.benchmark_report_path;
+		cmdline += "\"";
+	}
+
+	if (options.trace_path)
+	{
+		cmdline += " --trace ";
+		cmdline += "\"";
+		cmdline += options.trace_path;
+		cmdline += "\"";
+	}
+
+	if (options.worker_cpus)
+	{
+		cmdline += " --worker-cpus ";
+		cmdline += options.worker_cpus;
+	}
+
+	if (options.numa_local_workers)
+		cmdline += " --numa-local-workers";
+
+	if (options.worker_priority)
+	{
+		cmdline += " --worker-priority ";
+		cmdline += options.worker_priority;
+	}
+
+	if (options.job_memory_limit_mb)
+	{
+		cmdline += " --job-memory-limit ";
+		cmdline += std::to_string(options.job_memory_limit_mb);
+	}
+
 	if (options.timeout_seconds)
 	{
 		cmdline += " --timeout-seconds ";
@@ -573,6 +728,12 @@ bool ExternalReplayer::Impl::start(const ExternalReplayer::Options &options)
 		cmdline += std::to_string(options.implicit_whitelist_indices[i]);
 	}
 
+	for (unsigned i = 0; i < options.num_replay_device_indices; i++)
+	{
+		cmdline += " --replay-device-index ";
+		cmdline += std::to_string(options.replay_device_indices[i]);
+	}
+
 	STARTUPINFO si = {};
 	si.cb = sizeof(STARTUPINFO);
 	si.dwFlags = STARTF_USESTDHANDLES;
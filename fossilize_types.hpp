@@ -37,12 +37,16 @@ enum ResourceTag
 	RESOURCE_GRAPHICS_PIPELINE = 6,
 	RESOURCE_COMPUTE_PIPELINE = 7,
 	RESOURCE_APPLICATION_BLOB_LINK = 8,
-	RESOURCE_COUNT = 9
+	RESOURCE_PIPELINE_USAGE = 9,
+	RESOURCE_DEPENDENCY_GRAPH = 10,
+	RESOURCE_COUNT = 11
 };
 
+// Version 7 allows shader modules and pipelines to be hashed with HashAlgorithm::XXH64,
+// and shader modules to be stored with ShaderModuleEncoding::SPIRVDelta.
 enum
 {
-	FOSSILIZE_FORMAT_VERSION = 6,
+	FOSSILIZE_FORMAT_VERSION = 7,
 	FOSSILIZE_FORMAT_MIN_COMPAT_VERSION = 5
 };
 
@@ -24,6 +24,7 @@
 #include "instance.hpp"
 #include "path.hpp"
 #include "utils.hpp"
+#include "fossilize.hpp"
 #include <cinttypes>
 #include <stdlib.h>
 
@@ -41,4 +42,74 @@ void Device::init(VkPhysicalDevice gpu_, VkDevice device_, Instance *pInstance_,
 	pTable = pTable_;
 	recorder = Instance::getStateRecorderForDevice(pInstance->getApplicationInfo(), &features);
 }
+
+// Upper bound of the histogram bucket which contains the given fraction of calls.
+static double latencyPercentileUs(const RecorderStatistics::Latency &latency, double fraction)
+{
+	uint64_t target = uint64_t(double(latency.count) * fraction);
+	uint64_t total = 0;
+	for (unsigned i = 0; i < RecorderStatistics::LatencyBucketCount; i++)
+	{
+		total += latency.buckets[i];
+		if (total > target)
+			return double(uint64_t(2) << i) * 1e-3;
+	}
+	return double(latency.max_ns) * 1e-3;
+}
+
+void Device::logRecorderStatistics()
+{
+	RecorderStatistics stats;
+	if (!recorder->get_statistics(&stats))
+		return;
+
+	static const char *tagNames[RESOURCE_COUNT] = {
+		"Application info",
+		"Sampler",
+		"Descriptor set layout",
+		"Pipeline layout",
+		"Shader module",
+		"Render pass",
+		"Graphics pipeline",
+		"Compute pipeline",
+		"Application blob link",
+		"Pipeline usage",
+	};
+
+	LOGI("Recorder statistics:\n");
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		auto &latency = stats.record_latency[i];
+		if (!latency.count)
+			continue;
+
+		LOGI("  %s: %" PRIu64 " calls, avg %.2f us, p50 < %.2f us, p99 < %.2f us, max %.2f us.\n",
+		     tagNames[i], latency.count,
+		     double(latency.total_ns) * 1e-3 / double(latency.count),
+		     latencyPercentileUs(latency, 0.5), latencyPercentileUs(latency, 0.99),
+		     double(latency.max_ns) * 1e-3);
+	}
+
+	LOGI("  Copied %.3f MiB on application threads, queue high-water mark %" PRIu64 " objects, recorder allocator peak %.3f MiB.\n",
+	     double(stats.bytes_copied) / (1024.0 * 1024.0), stats.queue_high_water_mark,
+	     double(stats.allocator_peak_bytes) / (1024.0 * 1024.0));
+
+	double writeSeconds = double(stats.database_write_ns) * 1e-9;
+	double writtenMiB = double(stats.database_bytes_written) / (1024.0 * 1024.0);
+	LOGI("  Wrote %" PRIu64 " entries, %.3f MiB in %.3f s (%.2f MiB/s).\n",
+	     stats.database_entries_written, writtenMiB, writeSeconds,
+	     writeSeconds > 0.0 ? writtenMiB / writeSeconds : 0.0);
+
+	if (stats.compressed_payloads)
+	{
+		LOGI("  Compressed %" PRIu64 " payloads, %.3f MiB to %.3f MiB in %.3f s.\n",
+		     stats.compressed_payloads,
+		     double(stats.compression_input_bytes) / (1024.0 * 1024.0),
+		     double(stats.compression_output_bytes) / (1024.0 * 1024.0),
+		     double(stats.compression_ns) * 1e-9);
+	}
+
+	if (stats.uncompressed_backlog_payloads)
+		LOGI("  Wrote %" PRIu64 " payloads uncompressed while the queue was backed up.\n", stats.uncompressed_backlog_payloads);
+}
 }
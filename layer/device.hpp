@@ -56,6 +56,9 @@ public:
 		return pInstance;
 	}
 
+	// Logs RecorderStatistics of the recorder, if they are enabled.
+	void logRecorderStatistics();
+
 private:
 	VkPhysicalDevice gpu = VK_NULL_HANDLE;
 	VkDevice device = VK_NULL_HANDLE;
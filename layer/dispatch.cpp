@@ -26,6 +26,7 @@
 #include "instance.hpp"
 #include "fossilize_errors.hpp"
 #include <mutex>
+#include <unordered_map>
 
 // VALVE: do exports without .def file, see vk_layer.h for definition on non-Windows platforms
 #ifdef _MSC_VER
@@ -49,25 +50,58 @@ namespace Fossilize
 {
 
 // Global data structures to remap VkInstance and VkDevice to internal data structures.
+// globalLock serializes creation and destruction, lookups do not need it.
 static mutex globalLock;
 static InstanceTable instanceDispatch;
 static DeviceTable deviceDispatch;
-static unordered_map<void *, unique_ptr<Instance>> instanceData;
-static unordered_map<void *, unique_ptr<Device>> deviceData;
+static LayerDataMap<Instance> instanceData;
+static LayerDataMap<Device> deviceData;
+
+// Pipeline binds are counted per thread and handed to the recorder in batches,
+// so that counting never contends between threads.
+// Counts still pending when a thread exits are flushed, unless the device is gone by then.
+static const uint32_t PipelineUsageFlushInterval = 4096;
+
+struct PipelineUsageCounters
+{
+	void *dispatchKey = nullptr;
+	unordered_map<VkPipeline, uint64_t> graphics;
+	unordered_map<VkPipeline, uint64_t> compute;
+	uint32_t pendingBinds = 0;
+
+	~PipelineUsageCounters()
+	{
+		flush();
+	}
+
+	void flush()
+	{
+		if (!pendingBinds)
+			return;
+
+		auto *layer = getLayerData(dispatchKey, deviceData);
+		if (layer)
+		{
+			for (auto &usage : graphics)
+				layer->getRecorder().record_pipeline_usage(RESOURCE_GRAPHICS_PIPELINE, usage.first, usage.second);
+			for (auto &usage : compute)
+				layer->getRecorder().record_pipeline_usage(RESOURCE_COMPUTE_PIPELINE, usage.first, usage.second);
+		}
+
+		graphics.clear();
+		compute.clear();
+		pendingBinds = 0;
+	}
+};
+static thread_local PipelineUsageCounters pipelineUsageCounters;
 
 static Device *get_device_layer(VkDevice device)
 {
-	// Need to hold a lock while querying the global hashmap, but not after it.
-	Device *layer = nullptr;
-	void *key = getDispatchKey(device);
-	lock_guard<mutex> holder{ globalLock };
-	layer = getLayerData(key, deviceData);
-	return layer;
+	return getLayerData(getDispatchKey(device), deviceData);
 }
 
 static Instance *get_instance_layer(VkPhysicalDevice gpu)
 {
-	lock_guard<mutex> holder{ globalLock };
 	return getLayerData(getDispatchKey(gpu), instanceData);
 }
 
@@ -374,6 +408,15 @@ static VKAPI_ATTR void VKAPI_CALL DestroyDevice(VkDevice device, const VkAllocat
 	void *key = getDispatchKey(device);
 	auto *layer = getLayerData(key, deviceData);
 
+	// Binds counted on other threads are lost if they have not been flushed yet.
+	if (pipelineUsageCounters.dispatchKey == key)
+		pipelineUsageCounters.flush();
+
+	// The recorder outlives the device, so buffered entries would otherwise wait for the next batch.
+	if (layer->getInstance()->buffersDatabaseWrites())
+		layer->getRecorder().request_database_flush();
+
+	layer->logRecorderStatistics();
 	layer->getTable()->DestroyDevice(device, pAllocator);
 	destroyLayerData(key, deviceData);
 }
@@ -427,6 +470,50 @@ static VKAPI_ATTR VkResult VKAPI_CALL CreateRenderPass(VkDevice device, const Vk
 	return res;
 }
 
+static VKAPI_ATTR void VKAPI_CALL CmdBindPipeline(VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint,
+                                                  VkPipeline pipeline)
+{
+	void *key = getDispatchKey(commandBuffer);
+	auto *layer = getLayerData(key, deviceData);
+	layer->getTable()->CmdBindPipeline(commandBuffer, pipelineBindPoint, pipeline);
+
+	if (pipelineBindPoint != VK_PIPELINE_BIND_POINT_GRAPHICS && pipelineBindPoint != VK_PIPELINE_BIND_POINT_COMPUTE)
+		return;
+
+	auto &counters = pipelineUsageCounters;
+	if (counters.dispatchKey != key)
+	{
+		counters.flush();
+		counters.dispatchKey = key;
+	}
+
+	if (pipelineBindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS)
+		counters.graphics[pipeline]++;
+	else
+		counters.compute[pipeline]++;
+
+	if (++counters.pendingBinds >= PipelineUsageFlushInterval)
+		counters.flush();
+}
+
+// When database writes are buffered in memory, these are points where the application
+// is unlikely to mind disk I/O. Android destroys the swapchain when an application is paused.
+static VKAPI_ATTR VkResult VKAPI_CALL DeviceWaitIdle(VkDevice device)
+{
+	auto *layer = get_device_layer(device);
+	auto res = layer->getTable()->DeviceWaitIdle(device);
+	layer->getRecorder().request_database_flush();
+	return res;
+}
+
+static VKAPI_ATTR void VKAPI_CALL DestroySwapchainKHR(VkDevice device, VkSwapchainKHR swapchain,
+                                                      const VkAllocationCallbacks *pAllocator)
+{
+	auto *layer = get_device_layer(device);
+	layer->getTable()->DestroySwapchainKHR(device, swapchain, pAllocator);
+	layer->getRecorder().request_database_flush();
+}
+
 static PFN_vkVoidFunction interceptCoreDeviceCommand(const char *pName)
 {
 	static const struct
@@ -463,10 +550,18 @@ VK_LAYER_EXPORT VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL VK_LAYER_fossilize_GetD
 	if (proc)
 		return proc;
 
-	Device *layer = nullptr;
+	auto *layer = getLayerData(getDispatchKey(device), deviceData);
+
+	// Only intercepted when counting binds, since this is called far more often than anything else.
+	if (layer->getInstance()->recordsPipelineUsage() && strcmp(pName, "vkCmdBindPipeline") == 0)
+		return reinterpret_cast<PFN_vkVoidFunction>(CmdBindPipeline);
+
+	if (layer->getInstance()->buffersDatabaseWrites())
 	{
-		lock_guard<mutex> holder{globalLock};
-		layer = getLayerData(getDispatchKey(device), deviceData);
+		if (strcmp(pName, "vkDeviceWaitIdle") == 0)
+			return reinterpret_cast<PFN_vkVoidFunction>(DeviceWaitIdle);
+		if (strcmp(pName, "vkDestroySwapchainKHR") == 0 && layer->getTable()->DestroySwapchainKHR)
+			return reinterpret_cast<PFN_vkVoidFunction>(DestroySwapchainKHR);
 	}
 
 	return layer->getTable()->GetDeviceProcAddr(device, pName);
@@ -482,12 +577,7 @@ VK_LAYER_EXPORT VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL VK_LAYER_fossilize_GetI
 	if (proc)
 		return proc;
 
-	Instance *layer = nullptr;
-	{
-		lock_guard<mutex> holder{globalLock};
-		layer = getLayerData(getDispatchKey(instance), instanceData);
-	}
-
+	auto *layer = getLayerData(getDispatchKey(instance), instanceData);
 	return layer->getProcAddr(pName);
 }
 
@@ -29,6 +29,8 @@
 #include <memory>
 #include <string.h>
 #include <unordered_map>
+#include <vector>
+#include <atomic>
 #include <algorithm>
 #include "vk_layer.h"
 #include "vk_layer_dispatch_table.h"
@@ -75,29 +77,81 @@ static inline void *getDispatchKey(void *ptr)
 	return *static_cast<void **>(ptr);
 }
 
+// Maps dispatch keys to layer data. Every intercepted call looks up its layer data,
+// so lookups read an immutable snapshot of the map and never lock.
+// Instances and devices are created and destroyed rarely. Updates must be serialized by the caller.
+// An update publishes a new snapshot. The old one is retired rather than freed, since a concurrent lookup
+// might still be reading it. That costs a few bytes per created or destroyed object, for the lifetime of the layer.
 template <typename T>
-static inline T *getLayerData(void *key, const std::unordered_map<void *, std::unique_ptr<T>> &m)
+class LayerDataMap
 {
-	auto itr = m.find(key);
-	if (itr != end(m))
-		return itr->second.get();
-	else
+public:
+	T *find(void *key) const
+	{
+		auto *snapshot = current.load(std::memory_order_acquire);
+		if (!snapshot)
+			return nullptr;
+
+		// There are rarely more than a handful of instances or devices, so a linear scan beats hashing.
+		for (auto &entry : *snapshot)
+			if (entry.first == key)
+				return entry.second;
 		return nullptr;
+	}
+
+	template <typename... TArgs>
+	T *create(void *key, TArgs &&... args)
+	{
+		auto *ptr = new T(std::forward<TArgs>(args)...);
+		auto *snapshot = copy_snapshot(key);
+		snapshot->emplace_back(key, ptr);
+		data[key] = std::unique_ptr<T>(ptr);
+		current.store(snapshot, std::memory_order_release);
+		return ptr;
+	}
+
+	void destroy(void *key)
+	{
+		current.store(copy_snapshot(key), std::memory_order_release);
+		data.erase(key);
+	}
+
+private:
+	using Snapshot = std::vector<std::pair<void *, T *>>;
+	std::atomic<const Snapshot *> current{ nullptr };
+	std::vector<std::unique_ptr<Snapshot>> snapshots;
+	std::unordered_map<void *, std::unique_ptr<T>> data;
+
+	// Copies the current snapshot, except for key.
+	Snapshot *copy_snapshot(void *key)
+	{
+		auto *snapshot = new Snapshot;
+		snapshots.emplace_back(snapshot);
+
+		if (auto *old_snapshot = current.load(std::memory_order_relaxed))
+			for (auto &entry : *old_snapshot)
+				if (entry.first != key)
+					snapshot->push_back(entry);
+		return snapshot;
+	}
+};
+
+template <typename T>
+static inline T *getLayerData(void *key, const LayerDataMap<T> &m)
+{
+	return m.find(key);
 }
 
 template <typename T, typename... TArgs>
-static inline T *createLayerData(void *key, std::unordered_map<void *, std::unique_ptr<T>> &m, TArgs &&... args)
+static inline T *createLayerData(void *key, LayerDataMap<T> &m, TArgs &&... args)
 {
-	auto *ptr = new T(std::forward<TArgs>(args)...);
-	m[key] = std::unique_ptr<T>(ptr);
-	return ptr;
+	return m.create(key, std::forward<TArgs>(args)...);
 }
 
 template <typename T>
-static inline void destroyLayerData(void *key, std::unordered_map<void *, std::unique_ptr<T>> &m)
+static inline void destroyLayerData(void *key, LayerDataMap<T> &m)
 {
-	auto itr = m.find(key);
-	m.erase(itr);
+	m.destroy(key);
 }
 
 static inline VkLayerInstanceDispatchTable *initInstanceTable(VkInstance instance, const PFN_vkGetInstanceProcAddr gpa,
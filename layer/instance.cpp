@@ -120,6 +120,74 @@ static std::string getSystemProperty(const char *key)
 #define FOSSILIZE_APPLICATION_INFO_FILTER_PATH_ENV "FOSSILIZE_APPLICATION_INFO_FILTER_PATH"
 #endif
 
+#ifndef FOSSILIZE_ASYNC_WRITE_ENV
+#define FOSSILIZE_ASYNC_WRITE_ENV "FOSSILIZE_ASYNC_WRITE"
+#endif
+
+#ifndef FOSSILIZE_CHECKSUM_CRC32C_ENV
+#define FOSSILIZE_CHECKSUM_CRC32C_ENV "FOSSILIZE_CHECKSUM_CRC32C"
+#endif
+
+#ifndef FOSSILIZE_HASH_XXH64_ENV
+#define FOSSILIZE_HASH_XXH64_ENV "FOSSILIZE_HASH_XXH64"
+#endif
+
+#ifndef FOSSILIZE_SPIRV_DELTA_ENV
+#define FOSSILIZE_SPIRV_DELTA_ENV "FOSSILIZE_SPIRV_DELTA"
+#endif
+
+#ifndef FOSSILIZE_BINARY_PAYLOADS_ENV
+#define FOSSILIZE_BINARY_PAYLOADS_ENV "FOSSILIZE_BINARY_PAYLOADS"
+#endif
+
+#ifndef FOSSILIZE_RECORD_QUEUE_LIMIT_ENV
+#define FOSSILIZE_RECORD_QUEUE_LIMIT_ENV "FOSSILIZE_RECORD_QUEUE_LIMIT"
+#endif
+
+#ifndef FOSSILIZE_RECORD_QUEUE_DROP_ENV
+#define FOSSILIZE_RECORD_QUEUE_DROP_ENV "FOSSILIZE_RECORD_QUEUE_DROP"
+#endif
+
+#ifndef FOSSILIZE_ADAPTIVE_COMPRESSION_ENV
+#define FOSSILIZE_ADAPTIVE_COMPRESSION_ENV "FOSSILIZE_ADAPTIVE_COMPRESSION"
+#endif
+
+#ifndef FOSSILIZE_RECORD_WORKERS_ENV
+#define FOSSILIZE_RECORD_WORKERS_ENV "FOSSILIZE_RECORD_WORKERS"
+#endif
+
+#ifndef FOSSILIZE_SKIP_PRIOR_OBJECTS_ENV
+#define FOSSILIZE_SKIP_PRIOR_OBJECTS_ENV "FOSSILIZE_SKIP_PRIOR_OBJECTS"
+#endif
+
+#ifndef FOSSILIZE_STATISTICS_ENV
+#define FOSSILIZE_STATISTICS_ENV "FOSSILIZE_STATISTICS"
+#endif
+
+#ifndef FOSSILIZE_DEPENDENCY_GRAPH_ENV
+#define FOSSILIZE_DEPENDENCY_GRAPH_ENV "FOSSILIZE_DEPENDENCY_GRAPH"
+#endif
+
+#ifndef FOSSILIZE_PIPELINE_USAGE_ENV
+#define FOSSILIZE_PIPELINE_USAGE_ENV "FOSSILIZE_PIPELINE_USAGE"
+#endif
+
+#ifndef FOSSILIZE_MEMORY_BUFFER_SIZE_ENV
+#define FOSSILIZE_MEMORY_BUFFER_SIZE_ENV "FOSSILIZE_MEMORY_BUFFER_SIZE"
+#endif
+
+// Size in bytes of the in-memory buffer for serialized entries, or 0 to write them as they come.
+static size_t getMemoryBufferSize()
+{
+#ifdef ANDROID
+	auto memoryBufferSize = getSystemProperty("debug.fossilize.memory_buffer_size");
+	return !memoryBufferSize.empty() ? size_t(strtoull(memoryBufferSize.c_str(), nullptr, 0)) : 0;
+#else
+	const char *memoryBufferSize = getenv(FOSSILIZE_MEMORY_BUFFER_SIZE_ENV);
+	return memoryBufferSize ? size_t(strtoull(memoryBufferSize, nullptr, 0)) : 0;
+#endif
+}
+
 #ifdef FOSSILIZE_LAYER_CAPTURE_SIGSEGV
 static thread_local const VkComputePipelineCreateInfo *tls_compute_create_info = nullptr;
 static thread_local const VkGraphicsPipelineCreateInfo *tls_graphics_create_info = nullptr;
@@ -218,6 +286,15 @@ void Instance::completedPipelineCompilation()
 
 Instance::Instance()
 {
+#ifdef ANDROID
+	auto pipelineUsage = getSystemProperty("debug.fossilize.pipeline_usage");
+	enablePipelineUsage = !pipelineUsage.empty() && strtoul(pipelineUsage.c_str(), nullptr, 0) != 0;
+#else
+	const char *pipelineUsage = getenv(FOSSILIZE_PIPELINE_USAGE_ENV);
+	enablePipelineUsage = pipelineUsage && strtoul(pipelineUsage, nullptr, 0) != 0;
+#endif
+	enableMemoryBuffer = getMemoryBufferSize() != 0;
+
 #ifdef FOSSILIZE_LAYER_CAPTURE_SIGSEGV
 #ifdef ANDROID
 	auto sigsegv = getSystemProperty("debug.fossilize.dump_sigsegv");
@@ -260,6 +337,30 @@ StateRecorder *Instance::getStateRecorderForDevice(const VkApplicationInfo *appI
 		LOGI("Overriding serialization path: \"%s\".\n", logPath.c_str());
 	}
 	const char *filterPath = nullptr;
+	auto asyncWrite = getSystemProperty("debug.fossilize.async_write");
+	bool enableAsyncWrite = !asyncWrite.empty() && strtoul(asyncWrite.c_str(), nullptr, 0) != 0;
+	auto checksumCrc32c = getSystemProperty("debug.fossilize.checksum_crc32c");
+	bool enableCrc32c = !checksumCrc32c.empty() && strtoul(checksumCrc32c.c_str(), nullptr, 0) != 0;
+	auto hashXxh64 = getSystemProperty("debug.fossilize.hash_xxh64");
+	bool enableXxh64 = !hashXxh64.empty() && strtoul(hashXxh64.c_str(), nullptr, 0) != 0;
+	auto spirvDelta = getSystemProperty("debug.fossilize.spirv_delta");
+	bool enableSpirvDelta = !spirvDelta.empty() && strtoul(spirvDelta.c_str(), nullptr, 0) != 0;
+	auto binaryPayloads = getSystemProperty("debug.fossilize.binary_payloads");
+	bool enableBinaryPayloads = !binaryPayloads.empty() && strtoul(binaryPayloads.c_str(), nullptr, 0) != 0;
+	auto recordQueueLimit = getSystemProperty("debug.fossilize.record_queue_limit");
+	unsigned long queueLimit = !recordQueueLimit.empty() ? strtoul(recordQueueLimit.c_str(), nullptr, 0) : 0;
+	auto recordQueueDrop = getSystemProperty("debug.fossilize.record_queue_drop");
+	bool enableQueueDrop = !recordQueueDrop.empty() && strtoul(recordQueueDrop.c_str(), nullptr, 0) != 0;
+	auto adaptiveCompression = getSystemProperty("debug.fossilize.adaptive_compression");
+	unsigned long compressionBacklog = !adaptiveCompression.empty() ? strtoul(adaptiveCompression.c_str(), nullptr, 0) : 0;
+	auto recordWorkers = getSystemProperty("debug.fossilize.record_workers");
+	unsigned long workerCount = !recordWorkers.empty() ? strtoul(recordWorkers.c_str(), nullptr, 0) : 0;
+	auto skipPriorObjects = getSystemProperty("debug.fossilize.skip_prior_objects");
+	bool enableSkipPriorObjects = !skipPriorObjects.empty() && strtoul(skipPriorObjects.c_str(), nullptr, 0) != 0;
+	auto statistics = getSystemProperty("debug.fossilize.statistics");
+	bool enableStatistics = !statistics.empty() && strtoul(statistics.c_str(), nullptr, 0) != 0;
+	auto dependencyGraph = getSystemProperty("debug.fossilize.dependency_graph");
+	bool enableDependencyGraph = !dependencyGraph.empty() && strtoul(dependencyGraph.c_str(), nullptr, 0) != 0;
 #else
 	serializationPath = "fossilize";
 	const char *path = getenv(FOSSILIZE_DUMP_PATH_ENV);
@@ -270,6 +371,30 @@ StateRecorder *Instance::getStateRecorderForDevice(const VkApplicationInfo *appI
 	}
 	extraPaths = getenv(FOSSILIZE_DUMP_PATH_READ_ONLY_ENV);
 	const char *filterPath = getenv(FOSSILIZE_APPLICATION_INFO_FILTER_PATH_ENV);
+	const char *asyncWrite = getenv(FOSSILIZE_ASYNC_WRITE_ENV);
+	bool enableAsyncWrite = asyncWrite && strtoul(asyncWrite, nullptr, 0) != 0;
+	const char *checksumCrc32c = getenv(FOSSILIZE_CHECKSUM_CRC32C_ENV);
+	bool enableCrc32c = checksumCrc32c && strtoul(checksumCrc32c, nullptr, 0) != 0;
+	const char *hashXxh64 = getenv(FOSSILIZE_HASH_XXH64_ENV);
+	bool enableXxh64 = hashXxh64 && strtoul(hashXxh64, nullptr, 0) != 0;
+	const char *spirvDelta = getenv(FOSSILIZE_SPIRV_DELTA_ENV);
+	bool enableSpirvDelta = spirvDelta && strtoul(spirvDelta, nullptr, 0) != 0;
+	const char *binaryPayloads = getenv(FOSSILIZE_BINARY_PAYLOADS_ENV);
+	bool enableBinaryPayloads = binaryPayloads && strtoul(binaryPayloads, nullptr, 0) != 0;
+	const char *recordQueueLimit = getenv(FOSSILIZE_RECORD_QUEUE_LIMIT_ENV);
+	unsigned long queueLimit = recordQueueLimit ? strtoul(recordQueueLimit, nullptr, 0) : 0;
+	const char *recordQueueDrop = getenv(FOSSILIZE_RECORD_QUEUE_DROP_ENV);
+	bool enableQueueDrop = recordQueueDrop && strtoul(recordQueueDrop, nullptr, 0) != 0;
+	const char *adaptiveCompression = getenv(FOSSILIZE_ADAPTIVE_COMPRESSION_ENV);
+	unsigned long compressionBacklog = adaptiveCompression ? strtoul(adaptiveCompression, nullptr, 0) : 0;
+	const char *recordWorkers = getenv(FOSSILIZE_RECORD_WORKERS_ENV);
+	unsigned long workerCount = recordWorkers ? strtoul(recordWorkers, nullptr, 0) : 0;
+	const char *skipPriorObjects = getenv(FOSSILIZE_SKIP_PRIOR_OBJECTS_ENV);
+	bool enableSkipPriorObjects = skipPriorObjects && strtoul(skipPriorObjects, nullptr, 0) != 0;
+	const char *statistics = getenv(FOSSILIZE_STATISTICS_ENV);
+	bool enableStatistics = statistics && strtoul(statistics, nullptr, 0) != 0;
+	const char *dependencyGraph = getenv(FOSSILIZE_DEPENDENCY_GRAPH_ENV);
+	bool enableDependencyGraph = dependencyGraph && strtoul(dependencyGraph, nullptr, 0) != 0;
 #endif
 
 	if (filterPath)
@@ -287,10 +412,45 @@ StateRecorder *Instance::getStateRecorderForDevice(const VkApplicationInfo *appI
 	                                                                          DatabaseMode::Append,
 	                                                                          extraPaths));
 
+	size_t memoryBufferSize = getMemoryBufferSize();
+	if (memoryBufferSize)
+	{
+		// Entries are only written once the buffer is full, or when the layer requests a flush.
+		DatabaseAsyncWritePolicy policy;
+		policy.batch_size = memoryBufferSize;
+		policy.flush_interval_ms = 0;
+		if (!entry.interface->set_async_write_policy(policy))
+		{
+			LOGE_LEVEL("Failed to enable in-memory buffering of database writes.\n");
+			memoryBufferSize = 0;
+		}
+	}
+	else if (enableAsyncWrite && !entry.interface->set_async_write_policy(DatabaseAsyncWritePolicy()))
+		LOGE_LEVEL("Failed to enable asynchronous database writes.\n");
+
 	auto *recorder = new StateRecorder;
 	entry.recorder.reset(recorder);
 	recorder->set_database_enable_compression(true);
 	recorder->set_database_enable_checksum(true);
+	if (enableCrc32c)
+		recorder->set_database_checksum_algorithm(DatabaseChecksumAlgorithm::CRC32C);
+	if (enableXxh64)
+		recorder->set_hash_algorithm(HashAlgorithm::XXH64);
+	if (enableSpirvDelta)
+		recorder->set_database_shader_module_encoding(ShaderModuleEncoding::SPIRVDelta);
+	if (enableBinaryPayloads)
+		recorder->set_database_payload_encoding(PayloadEncoding::Binary);
+	if (queueLimit)
+		recorder->set_record_queue_mode(enableQueueDrop ? RecordQueueMode::Drop : RecordQueueMode::Block, uint32_t(queueLimit));
+	if (compressionBacklog)
+		recorder->set_database_adaptive_compression(uint32_t(compressionBacklog));
+	if (workerCount)
+		recorder->set_serialization_worker_count(unsigned(workerCount));
+	recorder->set_skip_prior_objects(enableSkipPriorObjects);
+	recorder->set_statistics_enabled(enableStatistics);
+	recorder->set_record_dependency_graph(enableDependencyGraph);
+	if (memoryBufferSize)
+		recorder->set_database_flush_on_idle(false);
 	recorder->set_application_info_filter(entry.filter.get());
 	if (appInfo)
 		if (!recorder->record_application_info(*appInfo))
@@ -57,6 +57,16 @@ public:
 
 	static StateRecorder *getStateRecorderForDevice(const VkApplicationInfo *appInfo, const VkPhysicalDeviceFeatures2 *features);
 
+	bool recordsPipelineUsage() const
+	{
+		return enablePipelineUsage;
+	}
+
+	bool buffersDatabaseWrites() const
+	{
+		return enableMemoryBuffer;
+	}
+
 #ifdef FOSSILIZE_LAYER_CAPTURE_SIGSEGV
 	bool capturesCrashes() const
 	{
@@ -74,6 +84,8 @@ private:
 	VkInstance instance = VK_NULL_HANDLE;
 	VkLayerInstanceDispatchTable *pTable = nullptr;
 	PFN_vkGetInstanceProcAddr gpa = nullptr;
+	bool enablePipelineUsage = false;
+	bool enableMemoryBuffer = false;
 #ifdef FOSSILIZE_LAYER_CAPTURE_SIGSEGV
 	bool enableCrashHandler = false;
 #endif
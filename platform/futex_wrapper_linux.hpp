@@ -25,6 +25,9 @@
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <linux/futex.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
 
 // Implementation based on https://eli.thegreenplace.net/2018/basics-of-futexes/ and
 // "Futexes are Tricky" by Ulrich Drepper.
@@ -71,4 +74,18 @@ static inline void futex_wrapper_unlock(int *lock)
 		syscall(SYS_futex, lock, FUTEX_WAKE, 1, 0, 0, 0);
 	}
 }
+
+// Sleeps until the word is woken or timeout_ms passes, unless the word no longer holds expected.
+static inline void futex_wrapper_wait(uint32_t *word, uint32_t expected, unsigned timeout_ms)
+{
+	struct timespec ts;
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = long(timeout_ms % 1000) * 1000000;
+	syscall(SYS_futex, word, FUTEX_WAIT, expected, &ts, 0, 0);
+}
+
+static inline void futex_wrapper_wake_all(uint32_t *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
 }
\ No newline at end of file
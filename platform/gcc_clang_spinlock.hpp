@@ -22,6 +22,9 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <unistd.h>
+
 // Lazy hack for now to make macOS compile.
 
 namespace Fossilize
@@ -35,4 +38,14 @@ static inline void futex_wrapper_unlock(int *lock)
 {
     __sync_fetch_and_and(lock, 0);
 }
+
+// No futex, just sleep for the timeout.
+static inline void futex_wrapper_wait(uint32_t *, uint32_t, unsigned timeout_ms)
+{
+    usleep(timeout_ms * 1000);
+}
+
+static inline void futex_wrapper_wake_all(uint32_t *)
+{
+}
 }
@@ -0,0 +1,192 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "spirv_delta.hpp"
+#include <string.h>
+
+namespace Fossilize
+{
+static const uint32_t SpirvMagic = 0x07230203u;
+static const size_t SpirvHeaderWords = 5;
+
+// Operand contexts are hashed on opcode and operand position.
+// Collisions only cost compression, encoder and decoder agree on them.
+static const unsigned ContextOpcodeBuckets = 1024;
+static const unsigned ContextPositions = 8;
+
+/*
+ * Encoded layout, all integers are varints:
+ * - Size in bytes of the instruction stream.
+ * - Instruction stream: opcode and word count per instruction.
+ * - Operand stream: SPIR-V header words, then zigzag deltas of every operand.
+ */
+
+struct OperandContexts
+{
+	uint32_t previous[ContextOpcodeBuckets * ContextPositions];
+
+	OperandContexts()
+	{
+		memset(previous, 0, sizeof(previous));
+	}
+
+	inline uint32_t &get(uint32_t opcode, size_t position)
+	{
+		uint32_t bucket = (opcode ^ (opcode >> 10)) & (ContextOpcodeBuckets - 1);
+		size_t pos = position < ContextPositions ? position : (ContextPositions - 1);
+		return previous[bucket * ContextPositions + pos];
+	}
+};
+
+static inline void push_varint(std::vector<uint8_t> &out, uint32_t w)
+{
+	while (w >= 0x80u)
+	{
+		out.push_back(uint8_t(0x80u | (w & 0x7fu)));
+		w >>= 7;
+	}
+	out.push_back(uint8_t(w));
+}
+
+static inline bool read_varint(const uint8_t *&buffer, const uint8_t *end, uint32_t &w)
+{
+	w = 0;
+	uint32_t shift = 0;
+	uint8_t b;
+	do
+	{
+		if (buffer >= end || shift >= 32u)
+			return false;
+		b = *buffer++;
+		w |= uint32_t(b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	return true;
+}
+
+static inline uint32_t zigzag_encode(uint32_t delta)
+{
+	return (delta << 1) ^ uint32_t(-int32_t(delta >> 31));
+}
+
+static inline uint32_t zigzag_decode(uint32_t v)
+{
+	return (v >> 1) ^ uint32_t(-int32_t(v & 1));
+}
+
+bool encode_spirv_delta(std::vector<uint8_t> &encoded, const uint32_t *words, size_t word_count)
+{
+	if (word_count < SpirvHeaderWords || words[0] != SpirvMagic)
+		return false;
+
+	// Validate the instruction stream up front, so we never have to bail half way through.
+	for (size_t offset = SpirvHeaderWords; offset < word_count; )
+	{
+		uint32_t count = words[offset] >> 16;
+		if (count == 0 || count > word_count - offset)
+			return false;
+		offset += count;
+	}
+
+	std::vector<uint8_t> instructions;
+	std::vector<uint8_t> operands;
+	instructions.reserve(word_count);
+	operands.reserve(word_count * 2);
+
+	for (size_t i = 0; i < SpirvHeaderWords; i++)
+		push_varint(operands, words[i]);
+
+	OperandContexts contexts;
+	for (size_t offset = SpirvHeaderWords; offset < word_count; )
+	{
+		uint32_t opcode = words[offset] & 0xffffu;
+		uint32_t count = words[offset] >> 16;
+		push_varint(instructions, opcode);
+		push_varint(instructions, count);
+
+		for (uint32_t i = 1; i < count; i++)
+		{
+			uint32_t w = words[offset + i];
+			auto &previous = contexts.get(opcode, i - 1);
+			push_varint(operands, zigzag_encode(w - previous));
+			previous = w;
+		}
+
+		offset += count;
+	}
+
+	encoded.clear();
+	encoded.reserve(instructions.size() + operands.size() + 5);
+	push_varint(encoded, uint32_t(instructions.size()));
+	encoded.insert(encoded.end(), instructions.begin(), instructions.end());
+	encoded.insert(encoded.end(), operands.begin(), operands.end());
+	return true;
+}
+
+bool decode_spirv_delta(uint32_t *words, size_t word_count, const uint8_t *buffer, size_t buffer_size)
+{
+	const uint8_t *end = buffer + buffer_size;
+	uint32_t instruction_size;
+	if (!read_varint(buffer, end, instruction_size))
+		return false;
+	if (instruction_size > size_t(end - buffer))
+		return false;
+
+	const uint8_t *instructions = buffer;
+	const uint8_t *instructions_end = buffer + instruction_size;
+	const uint8_t *operands = instructions_end;
+
+	if (word_count < SpirvHeaderWords)
+		return false;
+	for (size_t i = 0; i < SpirvHeaderWords; i++)
+		if (!read_varint(operands, end, words[i]))
+			return false;
+
+	OperandContexts contexts;
+	for (size_t offset = SpirvHeaderWords; offset < word_count; )
+	{
+		uint32_t opcode, count;
+		if (!read_varint(instructions, instructions_end, opcode) ||
+		    !read_varint(instructions, instructions_end, count))
+			return false;
+
+		if (opcode > 0xffffu || count == 0 || count > 0xffffu || count > word_count - offset)
+			return false;
+
+		words[offset] = (count << 16) | opcode;
+		for (uint32_t i = 1; i < count; i++)
+		{
+			uint32_t delta;
+			if (!read_varint(operands, end, delta))
+				return false;
+			auto &previous = contexts.get(opcode, i - 1);
+			previous += zigzag_decode(delta);
+			words[offset + i] = previous;
+		}
+
+		offset += count;
+	}
+
+	return instructions == instructions_end && operands == end;
+}
+}
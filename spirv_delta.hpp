@@ -0,0 +1,39 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace Fossilize
+{
+// A SPIR-V aware alternative to plain varint encoding of shader modules.
+// Instruction headers are split into separate opcode and word count streams,
+// and every operand is delta coded against the operand in the same position of the previous instruction with the same opcode.
+// Result IDs tend to increase slowly and types repeat, so most operands end up as single byte varints,
+// and the separated streams are far more regular for the backend compressor.
+// Returns false if the module does not parse as little-endian SPIR-V, in which case plain varint should be used.
+bool encode_spirv_delta(std::vector<uint8_t> &encoded, const uint32_t *words, size_t word_count);
+bool decode_spirv_delta(uint32_t *words, size_t word_count, const uint8_t *buffer, size_t buffer_size);
+}
@@ -0,0 +1,391 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Stress test for the concurrent database write path.
+// Many processes with many threads each append to the same base path, like game processes running with the layer.
+// Every thread gets its own database instance, since the layer serializes access to one instance.
+// The shards are then merged and checked for missing or corrupt entries.
+// Run with no arguments for a quick test, or e.g. --processes 32 --threads 8 --entries 4096 to measure scaling.
+
+#include "fossilize_db.hpp"
+#include "layer/utils.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "fossilize_inttypes.h"
+
+using namespace Fossilize;
+
+static const char base_path[] = ".__test_concurrent_stress";
+
+struct StressOptions
+{
+	unsigned processes = 8;
+	unsigned threads = 4;
+	unsigned entries = 256;
+	unsigned payload_size = 1024;
+};
+
+// Even entries are written by every writer, odd entries are unique to each writer.
+// Every fourth entry already exists in the read-only database, so writers must skip it.
+static Hash get_entry_hash(unsigned writer, unsigned entry)
+{
+	if (entry & 1)
+		return (Hash(writer + 1) << 32) | entry;
+	else
+		return entry + 1;
+}
+
+static bool is_primed_entry(unsigned entry)
+{
+	return (entry & 3) == 0;
+}
+
+static void fill_payload(std::vector<uint8_t> &payload, Hash hash)
+{
+	uint64_t state = hash * 0x9e3779b97f4a7c15ull;
+	for (auto &p : payload)
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		p = uint8_t(state);
+	}
+}
+
+static bool run_writer(const StressOptions &opts, unsigned writer, uint64_t *latencies_ns)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(create_concurrent_database(base_path, DatabaseMode::Append, nullptr, 0));
+	if (!db->prepare())
+	{
+		LOGE("Writer %u failed to prepare database.\n", writer);
+		return false;
+	}
+
+	std::vector<uint8_t> payload(opts.payload_size);
+	for (unsigned entry = 0; entry < opts.entries; entry++)
+	{
+		Hash hash = get_entry_hash(writer, entry);
+		fill_payload(payload, hash);
+
+		auto begin_time = std::chrono::steady_clock::now();
+		bool ret = db->write_entry(RESOURCE_SHADER_MODULE, hash, payload.data(), payload.size(),
+		                           PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT);
+		auto end_time = std::chrono::steady_clock::now();
+
+		if (!ret)
+		{
+			LOGE("Writer %u failed to write entry %016" PRIx64 ".\n", writer, hash);
+			return false;
+		}
+
+		latencies_ns[entry] = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - begin_time).count());
+	}
+
+	return true;
+}
+
+static int run_writer_process(const StressOptions &opts, unsigned process, uint64_t *latencies_ns)
+{
+	std::vector<std::thread> threads;
+	std::vector<char> results(opts.threads);
+
+	for (unsigned i = 0; i < opts.threads; i++)
+	{
+		unsigned writer = process * opts.threads + i;
+		threads.emplace_back([&, i, writer]() {
+			results[i] = run_writer(opts, writer, latencies_ns + size_t(writer) * opts.entries);
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+
+	for (auto &result : results)
+		if (!result)
+			return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
+
+static std::vector<std::string> find_shards()
+{
+	std::vector<std::string> paths;
+	for (unsigned index = 1; index < 256; index++)
+	{
+		std::string path = std::string(base_path) + "." + std::to_string(index) + ".foz";
+		if (access(path.c_str(), F_OK) == 0)
+			paths.push_back(std::move(path));
+	}
+	return paths;
+}
+
+static void remove_files()
+{
+	for (auto &path : find_shards())
+		remove(path.c_str());
+	remove((std::string(base_path) + ".foz").c_str());
+}
+
+static bool write_primed_database(const StressOptions &opts)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(
+			create_stream_archive_database((std::string(base_path) + ".foz").c_str(), DatabaseMode::OverWrite));
+	if (!db->prepare())
+		return false;
+
+	std::vector<uint8_t> payload(opts.payload_size);
+	for (unsigned entry = 0; entry < opts.entries; entry++)
+	{
+		if (!is_primed_entry(entry))
+			continue;
+
+		Hash hash = get_entry_hash(0, entry);
+		fill_payload(payload, hash);
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, hash, payload.data(), payload.size(), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+	}
+
+	return true;
+}
+
+static bool verify_entry(DatabaseInterface &db, Hash hash, std::vector<uint8_t> &expected, std::vector<uint8_t> &blob)
+{
+	size_t size = 0;
+	if (!db.read_entry(RESOURCE_SHADER_MODULE, hash, &size, nullptr, PAYLOAD_READ_NO_FLAGS) || size != expected.size())
+		return false;
+	if (!db.read_entry(RESOURCE_SHADER_MODULE, hash, &size, blob.data(), PAYLOAD_READ_NO_FLAGS))
+		return false;
+
+	fill_payload(expected, hash);
+	return memcmp(blob.data(), expected.data(), size) == 0;
+}
+
+static bool verify_shards(const StressOptions &opts, const std::vector<std::string> &shards)
+{
+	unsigned num_writers = opts.processes * opts.threads;
+	if (shards.empty() || shards.size() > num_writers)
+	{
+		LOGE("Expected between 1 and %u shards, got %u.\n", num_writers, unsigned(shards.size()));
+		return false;
+	}
+
+	// Writers must never duplicate what the read-only database already has.
+	for (auto &path : shards)
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(path.c_str(), DatabaseMode::ReadOnly));
+		if (!db->prepare())
+		{
+			LOGE("Failed to open shard %s.\n", path.c_str());
+			return false;
+		}
+
+		for (unsigned entry = 0; entry < opts.entries; entry++)
+		{
+			if (is_primed_entry(entry) && db->has_entry(RESOURCE_SHADER_MODULE, get_entry_hash(0, entry)))
+			{
+				LOGE("Shard %s duplicates primed entry %u.\n", path.c_str(), entry);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool verify_merged(const StressOptions &opts)
+{
+	auto db = std::unique_ptr<DatabaseInterface>(
+			create_stream_archive_database((std::string(base_path) + ".foz").c_str(), DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	unsigned num_writers = opts.processes * opts.threads;
+	size_t expected_count = (opts.entries + 1) / 2 + size_t(num_writers) * (opts.entries / 2);
+
+	size_t hash_count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &hash_count, nullptr) || hash_count != expected_count)
+	{
+		LOGE("Expected %u entries in merged database, got %u.\n", unsigned(expected_count), unsigned(hash_count));
+		return false;
+	}
+
+	std::vector<uint8_t> expected(opts.payload_size);
+	std::vector<uint8_t> blob(opts.payload_size);
+	for (unsigned writer = 0; writer < num_writers; writer++)
+	{
+		for (unsigned entry = 0; entry < opts.entries; entry++)
+		{
+			// Shared entries only need to be checked once.
+			if (writer != 0 && (entry & 1) == 0)
+				continue;
+
+			Hash hash = get_entry_hash(writer, entry);
+			if (!verify_entry(*db, hash, expected, blob))
+			{
+				LOGE("Entry %016" PRIx64 " is missing or corrupt in merged database.\n", hash);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void report_statistics(const StressOptions &opts, std::vector<uint64_t> latencies_ns, double wall_time_s)
+{
+	std::sort(latencies_ns.begin(), latencies_ns.end());
+
+	const auto percentile = [&](size_t pct) -> double {
+		size_t rank = (latencies_ns.size() * pct + 99) / 100;
+		return double(latencies_ns[rank ? rank - 1 : 0]) * 1e-3;
+	};
+
+	size_t count = latencies_ns.size();
+	LOGI("%u processes x %u threads, %u entries of %u bytes per writer.\n",
+	     opts.processes, opts.threads, opts.entries, opts.payload_size);
+	LOGI("Issued %u writes in %.3f s: %.0f writes/s, %.3f MB/s.\n",
+	     unsigned(count), wall_time_s, double(count) / wall_time_s,
+	     double(count) * opts.payload_size / (wall_time_s * 1024.0 * 1024.0));
+	LOGI("Write latency: p50 %.3f us, p90 %.3f us, p99 %.3f us, max %.3f us.\n",
+	     percentile(50), percentile(90), percentile(99), double(latencies_ns.back()) * 1e-3);
+}
+
+static bool parse_options(int argc, char *argv[], StressOptions &opts)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		unsigned *value = nullptr;
+		if (strcmp(argv[i], "--processes") == 0)
+			value = &opts.processes;
+		else if (strcmp(argv[i], "--threads") == 0)
+			value = &opts.threads;
+		else if (strcmp(argv[i], "--entries") == 0)
+			value = &opts.entries;
+		else if (strcmp(argv[i], "--payload-size") == 0)
+			value = &opts.payload_size;
+
+		if (!value || i + 1 >= argc)
+		{
+			LOGE("Usage: concurrent-database-stress-test [--processes <count>] [--threads <count>] "
+			     "[--entries <count>] [--payload-size <bytes>]\n");
+			return false;
+		}
+
+		*value = unsigned(strtoul(argv[++i], nullptr, 0));
+	}
+
+	// Each writer creates at most one shard, and there are only 255 shard indices.
+	if (!opts.processes || !opts.threads || !opts.entries || !opts.payload_size || opts.processes * opts.threads > 255)
+	{
+		LOGE("Invalid options, there must be between 1 and 255 writers.\n");
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	StressOptions opts;
+	if (!parse_options(argc, argv, opts))
+		return EXIT_FAILURE;
+
+	remove_files();
+	if (!write_primed_database(opts))
+		return EXIT_FAILURE;
+
+	// Children write their latencies into shared memory, one slot per entry and writer.
+	size_t num_latencies = size_t(opts.processes) * opts.threads * opts.entries;
+	size_t latencies_size = num_latencies * sizeof(uint64_t);
+	void *mapped = mmap(nullptr, latencies_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED)
+		return EXIT_FAILURE;
+	auto *latencies_ns = static_cast<uint64_t *>(mapped);
+
+	auto begin_time = std::chrono::steady_clock::now();
+
+	std::vector<pid_t> children;
+	for (unsigned process = 0; process < opts.processes; process++)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+			_exit(run_writer_process(opts, process, latencies_ns));
+		else if (pid < 0)
+		{
+			LOGE("Failed to fork.\n");
+			return EXIT_FAILURE;
+		}
+		children.push_back(pid);
+	}
+
+	bool success = true;
+	for (auto &pid : children)
+	{
+		int wstatus = 0;
+		if (waitpid(pid, &wstatus, 0) < 0 || !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != EXIT_SUCCESS)
+			success = false;
+	}
+
+	auto end_time = std::chrono::steady_clock::now();
+
+	if (!success)
+	{
+		LOGE("Writer process failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	report_statistics(opts, std::vector<uint64_t>(latencies_ns, latencies_ns + num_latencies),
+	                  std::chrono::duration<double>(end_time - begin_time).count());
+	munmap(mapped, latencies_size);
+
+	auto shards = find_shards();
+	if (!verify_shards(opts, shards))
+		return EXIT_FAILURE;
+
+	std::vector<const char *> shard_paths;
+	for (auto &path : shards)
+		shard_paths.push_back(path.c_str());
+
+	auto merge_begin_time = std::chrono::steady_clock::now();
+	if (!merge_concurrent_databases((std::string(base_path) + ".foz").c_str(), shard_paths.data(), shard_paths.size()))
+	{
+		LOGE("Failed to merge shards.\n");
+		return EXIT_FAILURE;
+	}
+	auto merge_end_time = std::chrono::steady_clock::now();
+	LOGI("Merged %u shards in %.3f s.\n", unsigned(shards.size()),
+	     std::chrono::duration<double>(merge_end_time - merge_begin_time).count());
+
+	if (!verify_merged(opts))
+		return EXIT_FAILURE;
+
+	remove_files();
+	return EXIT_SUCCESS;
+}
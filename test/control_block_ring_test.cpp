@@ -0,0 +1,101 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "fossilize_external_replayer_control_block.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace Fossilize;
+
+static const unsigned num_writers = 16;
+static const unsigned num_iterations = 20000;
+// Small ring, so writers wrap around and hit a full ring constantly.
+static const uint32_t ring_size = 16 * sizeof(SharedControlBlockMessageSlot);
+
+static SharedControlBlock *control_block;
+
+static void *writer(void *arg)
+{
+	auto index = unsigned(uintptr_t(arg));
+	for (unsigned i = 0; i < num_iterations; i++)
+	{
+		char msg[ControlBlockMessageSize] = {};
+		sprintf(msg, "%u %u", index, i);
+		while (!shared_control_block_write(control_block, msg, sizeof(msg)))
+			sched_yield();
+	}
+	return nullptr;
+}
+
+int main()
+{
+	std::vector<uint8_t> storage(ControlBlockDataSize + ring_size);
+	control_block = reinterpret_cast<SharedControlBlock *>(storage.data());
+	control_block->ring_buffer_offset = ControlBlockDataSize;
+	control_block->ring_buffer_size = ring_size;
+	shared_control_block_init_ring(control_block);
+
+	char msg[ControlBlockMessageSize];
+	if (shared_control_block_read(control_block, msg, sizeof(msg)) || shared_control_block_read_avail(control_block))
+		return EXIT_FAILURE;
+
+	pthread_t threads[num_writers];
+	for (unsigned i = 0; i < num_writers; i++)
+		pthread_create(&threads[i], nullptr, writer, reinterpret_cast<void *>(uintptr_t(i)));
+
+	// Every writer's messages must arrive exactly once and in order.
+	unsigned next_iteration[num_writers] = {};
+	unsigned total = 0;
+	while (total < num_writers * num_iterations)
+	{
+		if (!shared_control_block_read(control_block, msg, sizeof(msg)))
+		{
+			sched_yield();
+			continue;
+		}
+
+		unsigned index, iteration;
+		if (sscanf(msg, "%u %u", &index, &iteration) != 2 || index >= num_writers ||
+		    iteration != next_iteration[index])
+		{
+			fprintf(stderr, "Unexpected message: %s\n", msg);
+			return EXIT_FAILURE;
+		}
+
+		next_iteration[index]++;
+		total++;
+	}
+
+	for (auto &t : threads)
+		pthread_join(t, nullptr);
+
+	if (shared_control_block_read(control_block, msg, sizeof(msg)))
+		return EXIT_FAILURE;
+	if (control_block->message_serial.load() != num_writers * num_iterations)
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
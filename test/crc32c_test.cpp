@@ -0,0 +1,76 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "crc32c.hpp"
+#include <stdlib.h>
+#include <stdio.h>
+#include <random>
+#include <vector>
+
+using namespace Fossilize;
+
+int main()
+{
+	// Check value from the CRC catalogue.
+	static const char check[] = "123456789";
+	if (compute_crc32c(0, check, 9) != 0xe3069283u || compute_crc32c_portable(0, check, 9) != 0xe3069283u)
+	{
+		fprintf(stderr, "CRC32C check value mismatch.\n");
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 rnd;
+	std::vector<uint8_t> buffer(64 * 1024);
+	for (auto &b : buffer)
+		b = uint8_t(rnd());
+
+	// Exercise every alignment and tail length, and make sure checksums can be computed piecewise.
+	for (size_t offset = 0; offset < 16; offset++)
+	{
+		for (size_t size = 0; size < 256; size++)
+		{
+			uint32_t expected = compute_crc32c_portable(0, buffer.data() + offset, size);
+			if (compute_crc32c(0, buffer.data() + offset, size) != expected)
+			{
+				fprintf(stderr, "CRC32C mismatch for offset %u, size %u.\n", unsigned(offset), unsigned(size));
+				return EXIT_FAILURE;
+			}
+
+			uint32_t split = compute_crc32c(0, buffer.data() + offset, size / 3);
+			split = compute_crc32c(split, buffer.data() + offset + size / 3, size - size / 3);
+			if (split != expected)
+			{
+				fprintf(stderr, "Piecewise CRC32C mismatch for offset %u, size %u.\n", unsigned(offset), unsigned(size));
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (compute_crc32c(0, buffer.data(), buffer.size()) != compute_crc32c_portable(0, buffer.data(), buffer.size()))
+	{
+		fprintf(stderr, "CRC32C mismatch for large buffer.\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "util/flat_hash_map.hpp"
+#include "layer/utils.hpp"
+#include <stdlib.h>
+#include <unordered_map>
+
+using namespace Fossilize;
+
+int main()
+{
+	FlatHashMap<int> map;
+	if (!map.empty() || map.count(0) || map.find(1) != map.end())
+		abort();
+
+	// Key 0 is special internally, make sure it behaves like any other key.
+	if (!map.emplace(0, 10).second)
+		abort();
+	if (map.emplace(0, 20).second)
+		abort();
+	if (map.find(0)->second != 10 || map.size() != 1)
+		abort();
+
+	// Insert lots of keys with poorly distributed low bits, and compare against a reference.
+	std::unordered_map<Hash, int> reference;
+	reference[0] = 10;
+	for (int i = 1; i < 20000; i++)
+	{
+		Hash hash = Hash(i) << 32;
+		map[hash] = i;
+		reference[hash] = i;
+	}
+
+	for (int i = 1; i < 20000; i += 3)
+	{
+		Hash hash = Hash(i) << 32;
+		if (map.erase(hash) != 1)
+			abort();
+		reference.erase(hash);
+	}
+
+	if (map.erase(Hash(1) << 32) != 0)
+		abort();
+	if (map.size() != reference.size())
+		abort();
+
+	for (auto &entry : reference)
+	{
+		auto itr = map.find(entry.first);
+		if (itr == map.end() || itr->second != entry.second)
+			abort();
+	}
+
+	size_t count = 0;
+	for (auto &entry : map)
+	{
+		if (reference.count(entry.first) == 0 || reference[entry.first] != entry.second)
+			abort();
+		count++;
+	}
+
+	if (count != reference.size())
+		abort();
+
+	map.erase(0);
+	if (map.count(0) || map.size() != reference.size() - 1)
+		abort();
+
+	LOGI("Flat hash map uses %u bytes for %u entries.\n", unsigned(map.get_memory_usage()), unsigned(map.size()));
+
+	map.clear();
+	if (!map.empty() || map.begin() != map.end())
+		abort();
+}
@@ -27,8 +27,24 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
 #include "layer/utils.hpp"
 #include "fossilize_errors.hpp"
+#include "fossilize_inttypes.h"
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
 
 using namespace Fossilize;
 
@@ -736,6 +752,13 @@ static bool test_database()
 		if (db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 3))
 			return false;
 
+#ifndef _WIN32
+		// Unknown hashes are ignored.
+		const Hash prefetch_hashes[] = { 3, 4 };
+		if (!db->prefetch_entries(RESOURCE_SHADER_MODULE, prefetch_hashes, 2))
+			return false;
+#endif
+
 		size_t blob_size;
 		std::vector<uint8_t> blob;
 
@@ -762,866 +785,3253 @@ static bool test_database()
 			return false;
 		if (!compare(blob, { 1, 2, 3, 1, 2, 3 }))
 			return false;
+
+		// Uncompressed payloads can be read in-place, compressed ones must go through read_entry.
+		const void *zero_copy_data = nullptr;
+		if (db->read_entry_zero_copy(RESOURCE_SAMPLER, 1, &blob_size, &zero_copy_data, 0))
+			return false;
+		if (db->read_entry_zero_copy(RESOURCE_SHADER_MODULE, 3, &blob_size, &zero_copy_data, 0))
+		{
+			if (blob_size != 6 || memcmp(zero_copy_data, blob.data(), blob_size) != 0)
+				return false;
+		}
 	}
 
 	return true;
 }
 
-static bool file_exists(const char *path)
-{
-	FILE *file = fopen(path, "rb");
-	if (file)
-	{
-		fclose(file);
-		return true;
-	}
-	else
-		return false;
-}
-
-static bool test_concurrent_database_extra_paths()
+static bool test_database_index()
 {
-	// Test a normal flow. First time we don't have the read-only database.
-	// Next time we have one.
-	remove(".__test_concurrent.foz");
-	remove(".__test_concurrent.1.foz");
-	remove(".__test_concurrent.2.foz");
-	remove(".__test_concurrent.3.foz");
-	remove(".__test_concurrent.4.foz");
+	remove(".__test_index.foz");
 
-	static const char *extra_paths = ".__test_concurrent.1.foz;.__test_concurrent.2.foz;.__test_concurrent.3.foz";
-	static const uint8_t blob[] = {1, 2, 3};
+	static const uint8_t entry1[] = { 1, 2, 3 };
+	static const uint8_t entry2[] = { 4, 5, 6, 7 };
 
 	{
-		auto db0 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
-		                                                                         DatabaseMode::Append, nullptr, 0));
-		if (!db0->prepare())
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_index.foz", DatabaseMode::OverWrite));
+		if (!db->prepare())
 			return false;
-
-		if (!db0->write_entry(RESOURCE_SAMPLER, 2, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+		if (!db->write_entry(RESOURCE_SAMPLER, 1, entry1, sizeof(entry1), PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT))
 			return false;
-		if (!db0->write_entry(RESOURCE_SAMPLER, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+		if (!db->write_entry(RESOURCE_SAMPLER, 2, entry2, sizeof(entry2), PAYLOAD_WRITE_COMPRESS_BIT))
 			return false;
+	}
 
-		auto db1 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
-		                                                                         DatabaseMode::Append, nullptr, 0));
-		if (!db1->prepare())
+	// Append a new entry by hand, just like a writer which is not aware of the index would.
+	// The index is now stale, and it must not hide the new entry.
+	{
+		FILE *file = fopen(".__test_index.foz", "ab");
+		if (!file)
 			return false;
 
-		if (!db1->write_entry(RESOURCE_SAMPLER, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+		static const char name[] = "00000000000000000000000400000000000000ff";
+		static const uint8_t header[16] = { 3, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0 };
+		bool ret = fwrite(name, 1, 40, file) == 40 &&
+		           fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+		           fwrite(entry1, 1, sizeof(entry1), file) == sizeof(entry1);
+		fclose(file);
+		if (!ret)
 			return false;
-		if (!db1->write_entry(RESOURCE_SAMPLER, 4, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+	}
+
+	for (unsigned iter = 0; iter < 2; iter++)
+	{
+		// Appending rewrites the index on the first iteration, so the second iteration reads it back.
+		if (iter == 1)
+		{
+			auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_index.foz", DatabaseMode::Append));
+			if (!db->prepare())
+				return false;
+			if (!db->has_entry(RESOURCE_SHADER_MODULE, 0xff))
+				return false;
+			if (!db->write_entry(RESOURCE_SAMPLER, 3, entry2, sizeof(entry2), 0))
+				return false;
+		}
+
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_index.foz", DatabaseMode::ReadOnly));
+		if (!db->prepare())
 			return false;
 
-		auto db2 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
-		                                                                         DatabaseMode::Append, nullptr, 0));
-		if (!db2->prepare())
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_SAMPLER, &hash_count, nullptr))
+			return false;
+		if (hash_count != 2 + iter)
+			return false;
+		if (!db->has_entry(RESOURCE_SHADER_MODULE, 0xff))
 			return false;
 
-		if (!db2->write_entry(RESOURCE_SAMPLER, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+		size_t blob_size = 0;
+		uint8_t blob[4];
+		if (!db->read_entry(RESOURCE_SHADER_MODULE, 0xff, &blob_size, nullptr, 0) || blob_size != sizeof(entry1))
 			return false;
-		if (!db2->write_entry(RESOURCE_SAMPLER, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+		if (!db->read_entry(RESOURCE_SHADER_MODULE, 0xff, &blob_size, blob, 0) || memcmp(blob, entry1, sizeof(entry1)) != 0)
+			return false;
+		if (!db->read_entry(RESOURCE_SAMPLER, 2, &blob_size, nullptr, 0) || blob_size != sizeof(entry2))
+			return false;
+		if (!db->read_entry(RESOURCE_SAMPLER, 2, &blob_size, blob, 0) || memcmp(blob, entry2, sizeof(entry2)) != 0)
 			return false;
 	}
 
-	if (!file_exists(".__test_concurrent.1.foz"))
-		return false;
-	if (!file_exists(".__test_concurrent.2.foz"))
-		return false;
-	if (!file_exists(".__test_concurrent.3.foz"))
-		return false;
+	remove(".__test_index.foz");
+	return true;
+}
 
-	auto db = std::unique_ptr<DatabaseInterface>(
-			create_concurrent_database_with_encoded_extra_paths(nullptr, DatabaseMode::ReadOnly, extra_paths));
+static bool test_database_compression()
+{
+	remove(".__test_compression.foz");
 
-	auto append_db = std::unique_ptr<DatabaseInterface>(
-			create_concurrent_database_with_encoded_extra_paths(".__test_concurrent",
-			                                                    DatabaseMode::Append, extra_paths));
-	if (!db->prepare())
-		return false;
-	if (!append_db->prepare())
-		return false;
+	// Algorithms which are not compiled in fall back to deflate, so this must round-trip in any build.
+	static const PayloadWriteFlags algorithm_flags[] = {
+		0, PAYLOAD_WRITE_COMPRESS_ZSTD_BIT, PAYLOAD_WRITE_COMPRESS_LZ4_BIT,
+	};
 
-	size_t num_samplers;
-	if (!db->get_hash_list_for_resource_tag(RESOURCE_SAMPLER, &num_samplers, nullptr))
-		return false;
-	if (num_samplers != 4)
-		return false;
+	std::vector<uint8_t> entry(4096);
+	for (size_t i = 0; i < entry.size(); i++)
+		entry[i] = uint8_t((i * 7) ^ (i >> 5));
 
-	for (Hash i = 1; i <= 4; i++)
 	{
-		size_t blob_size;
-		if (!db->read_entry(RESOURCE_SAMPLER, i, &blob_size, nullptr, 0))
-			return false;
-		if (blob_size != sizeof(blob))
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_compression.foz", DatabaseMode::OverWrite));
+		if (!db->prepare())
 			return false;
-	}
-
-	if (!append_db->write_entry(RESOURCE_SAMPLER, 4, blob, sizeof(blob), 0))
-		return false;
 
-	// This should not be written.
-	if (file_exists(".__test_concurrent.4.foz"))
-		return false;
+		Hash hash = 0;
+		for (auto flags : algorithm_flags)
+		{
+			for (unsigned best = 0; best < 2; best++)
+			{
+				PayloadWriteFlags write_flags = flags | PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+				if (best)
+					write_flags |= PAYLOAD_WRITE_BEST_COMPRESSION_BIT;
+				if (!db->write_entry(RESOURCE_SHADER_MODULE, ++hash, entry.data(), entry.size(), write_flags))
+					return false;
+			}
+		}
+	}
 
-	if (!append_db->write_entry(RESOURCE_DESCRIPTOR_SET_LAYOUT, 4, blob, sizeof(blob), 0))
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_compression.foz", DatabaseMode::ReadOnly));
+	if (!db->prepare())
 		return false;
 
-	// .. but now it should exist.
-	if (!file_exists(".__test_concurrent.4.foz"))
-		return false;
+	for (Hash hash = 1; hash <= 2 * sizeof(algorithm_flags) / sizeof(algorithm_flags[0]); hash++)
+	{
+		for (PayloadReadFlags flags : { 0u, uint32_t(PAYLOAD_READ_CONCURRENT_BIT) })
+		{
+			size_t blob_size = 0;
+			if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, nullptr, flags))
+				return false;
+			if (blob_size != entry.size())
+				return false;
+			std::vector<uint8_t> blob(blob_size);
+			if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, blob.data(), flags))
+				return false;
+			if (blob != entry)
+				return false;
+		}
+	}
 
+	db.reset();
+	remove(".__test_compression.foz");
 	return true;
 }
 
-static bool test_concurrent_database()
+static bool test_database_checksums()
 {
-	// Test a normal flow. First time we don't have the read-only database.
-	// Next time we have one.
-	for (unsigned iter = 0; iter < 2; iter++)
-	{
-		if (iter == 0)
-			remove(".__test_concurrent.foz");
-		remove(".__test_concurrent.1.foz");
-		remove(".__test_concurrent.2.foz");
-		remove(".__test_concurrent.3.foz");
+	remove(".__test_checksums.foz");
 
-		static const uint8_t blob[] = {1, 2, 3};
+	static const PayloadWriteFlags write_flags[] = {
+		PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT,
+		PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT | PAYLOAD_WRITE_CHECKSUM_CRC32C_BIT,
+		PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT | PAYLOAD_WRITE_COMPRESS_BIT,
+		PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT | PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_CHECKSUM_CRC32C_BIT,
+	};
+	static const unsigned write_flag_count = sizeof(write_flags) / sizeof(write_flags[0]);
 
-		{
-			{
-				auto db0 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
-				                                                                         DatabaseMode::Append, nullptr, 0));
-				if (!db0->prepare())
-					return false;
+	const auto make_entry = [](Hash hash) {
+		std::vector<uint8_t> entry(1000 + hash);
+		for (size_t i = 0; i < entry.size(); i++)
+			entry[i] = uint8_t((i * 13) ^ (i >> 4) ^ hash);
+		return entry;
+	};
 
-				if (!db0->write_entry(RESOURCE_SAMPLER, 2, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-					return false;
-				if (!db0->write_entry(RESOURCE_SAMPLER, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-					return false;
-			}
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_checksums.foz", DatabaseMode::OverWrite));
+		if (!db->prepare())
+			return false;
 
-			{
-				auto db1 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
-				                                                                         DatabaseMode::Append, nullptr, 0));
-				if (!db1->prepare())
-					return false;
+		for (unsigned i = 0; i < write_flag_count; i++)
+		{
+			auto entry = make_entry(i + 1);
+			if (!db->write_entry(RESOURCE_SHADER_MODULE, i + 1, entry.data(), entry.size(), write_flags[i]))
+				return false;
+		}
+	}
 
-				if (!db1->write_entry(RESOURCE_SAMPLER, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-					return false;
-				if (!db1->write_entry(RESOURCE_SAMPLER, 4, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-					return false;
-			}
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_checksums.foz", DatabaseMode::ReadOnly));
+		if (!db->prepare())
+			return false;
 
+		for (unsigned i = 0; i < write_flag_count; i++)
+		{
+			auto entry = make_entry(i + 1);
+
+			// CRC32 and CRC32C payloads must both verify.
+			for (PayloadReadFlags flags : { 0u, uint32_t(PAYLOAD_READ_CONCURRENT_BIT) })
 			{
-				auto db2 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
-				                                                                         DatabaseMode::Append, nullptr, 0));
-				if (!db2->prepare())
+				size_t blob_size = 0;
+				if (!db->read_entry(RESOURCE_SHADER_MODULE, i + 1, &blob_size, nullptr, flags))
 					return false;
-
-				if (!db2->write_entry(RESOURCE_SAMPLER, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+				std::vector<uint8_t> blob(blob_size);
+				if (!db->read_entry(RESOURCE_SHADER_MODULE, i + 1, &blob_size, blob.data(), flags))
 					return false;
-				if (!db2->write_entry(RESOURCE_SAMPLER, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+				if (blob != entry)
 					return false;
 			}
+
+			// The checksum type is recorded in the payload flags.
+			const void *raw = nullptr;
+			size_t raw_size = 0;
+			if (!db->read_entry_zero_copy(RESOURCE_SHADER_MODULE, i + 1, &raw_size, &raw, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+				return false;
+			bool is_crc32c = (static_cast<const uint8_t *>(raw)[5] & 1) != 0;
+			if (is_crc32c != ((write_flags[i] & PAYLOAD_WRITE_CHECKSUM_CRC32C_BIT) != 0))
+				return false;
 		}
+	}
 
-		bool expected_exist = iter == 0;
+	// Corrupt the uncompressed CRC32C payload, and make sure the checksum catches it.
+	FILE *file = fopen(".__test_checksums.foz", "rb+");
+	if (!file)
+		return false;
+	std::vector<uint8_t> archive;
+	uint8_t buffer[4096];
+	size_t read_size;
+	while ((read_size = fread(buffer, 1, sizeof(buffer), file)) != 0)
+		archive.insert(archive.end(), buffer, buffer + read_size);
+
+	auto corrupt_entry = make_entry(2);
+	auto itr = std::search(archive.begin(), archive.end(), corrupt_entry.begin(), corrupt_entry.end());
+	if (itr == archive.end())
+	{
+		fclose(file);
+		return false;
+	}
 
-		if (expected_exist != file_exists(".__test_concurrent.1.foz"))
-			return false;
-		if (expected_exist != file_exists(".__test_concurrent.2.foz"))
+	uint8_t corrupt_byte = uint8_t(itr[100] ^ 0x10);
+	if (fseek(file, long(itr - archive.begin()) + 100, SEEK_SET) < 0 || fwrite(&corrupt_byte, 1, 1, file) != 1)
+	{
+		fclose(file);
+		return false;
+	}
+	fclose(file);
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_checksums.foz", DatabaseMode::ReadOnly));
+		if (!db->prepare())
 			return false;
-		if (expected_exist != file_exists(".__test_concurrent.3.foz"))
+
+		std::vector<uint8_t> blob(corrupt_entry.size());
+		size_t blob_size = blob.size();
+		if (db->read_entry(RESOURCE_SHADER_MODULE, 2, &blob_size, blob.data(), 0))
 			return false;
 
-		static const char *append_paths[] = {
-			".__test_concurrent.1.foz",
-			".__test_concurrent.2.foz",
-			".__test_concurrent.3.foz",
-		};
+		const void *mapped = nullptr;
+		if (db->read_entry_zero_copy(RESOURCE_SHADER_MODULE, 2, &blob_size, &mapped, 0))
+			return false;
 
-		if (iter == 0)
-		{
-			if (!merge_concurrent_databases(".__test_concurrent.foz", append_paths, 3))
-				return false;
-		}
+		blob_size = 0;
+		if (!db->read_entry(RESOURCE_SHADER_MODULE, 1, &blob_size, nullptr, 0))
+			return false;
 	}
 
+	remove(".__test_checksums.foz");
 	return true;
 }
 
-static bool test_implicit_whitelist()
+static void remove_directory(const char *path)
 {
-	remove(".__test_concurrent.foz");
-	remove(".__test_concurrent.1.foz");
-	remove(".__test_concurrent.2.foz");
-	remove(".__test_concurrent.3.foz");
-	static const uint8_t blob[] = {1, 2, 3};
+#ifdef _WIN32
+	_rmdir(path);
+#else
+	rmdir(path);
+#endif
+}
+
+static bool test_dumb_folder_database()
+{
+	static const char base[] = ".__test_folder";
+
+	const auto make_entry = [](Hash hash) {
+		std::string entry = "{ \"entry\": " + std::to_string(hash) + " }";
+		return std::vector<uint8_t>(entry.begin(), entry.end());
+	};
+
+	// A few entries share shard directories, and there are more entries than files the reader keeps open.
+	std::vector<Hash> hashes;
+	for (Hash i = 0; i < 100; i++)
+		hashes.push_back(((i % 7) << 56) | ((i % 3) << 48) | (i + 1));
 
 	{
-		auto whitelist_db = std::unique_ptr<DatabaseInterface>(
-				create_stream_archive_database(".__test_concurrent_whitelist.foz", DatabaseMode::OverWrite));
-		if (!whitelist_db || !whitelist_db->prepare())
+		auto db = std::unique_ptr<DatabaseInterface>(create_dumb_folder_database(base, DatabaseMode::OverWrite));
+		if (!db->prepare())
 			return false;
 
-		if (!whitelist_db->write_entry(RESOURCE_SHADER_MODULE, 1, nullptr, 0, PAYLOAD_WRITE_NO_FLAGS))
-			return false;
+		for (auto hash : hashes)
+		{
+			auto entry = make_entry(hash);
+			if (!db->write_entry(RESOURCE_SHADER_MODULE, hash, entry.data(), entry.size(), 0))
+				return false;
+		}
 	}
 
+	// Entries in the old flat layout must still be found.
+	const Hash flat_hash = 0xf1a7;
+	char flat_path[64];
+	sprintf(flat_path, "%s/%02x.%016" PRIx64 ".json", base, unsigned(RESOURCE_SAMPLER), flat_hash);
 	{
-		auto db0 = std::unique_ptr<DatabaseInterface>(
-				create_concurrent_database(".__test_concurrent",
-				                           DatabaseMode::Append, nullptr, 0));
-		auto db1 = std::unique_ptr<DatabaseInterface>(
-				create_concurrent_database(".__test_concurrent",
-				                           DatabaseMode::Append, nullptr, 0));
-		auto db2 = std::unique_ptr<DatabaseInterface>(
-				create_concurrent_database(".__test_concurrent",
-				                           DatabaseMode::Append, nullptr, 0));
-
-		if (!db0 || !db0->prepare())
+		FILE *file = fopen(flat_path, "wb");
+		if (!file)
 			return false;
-		if (!db1 || !db1->prepare())
+		auto entry = make_entry(flat_hash);
+		bool ret = fwrite(entry.data(), 1, entry.size(), file) == entry.size();
+		fclose(file);
+		if (!ret)
 			return false;
-		if (!db2 || !db2->prepare())
+	}
+
+	for (unsigned num_scan_threads : { 1u, 4u })
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_dumb_folder_database(base, DatabaseMode::ReadOnly, num_scan_threads));
+		if (!db->prepare())
 			return false;
 
-		if (!db0->write_entry(RESOURCE_SHADER_MODULE, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &hash_count, nullptr) || hash_count != hashes.size())
 			return false;
-		if (!db1->write_entry(RESOURCE_GRAPHICS_PIPELINE, 2, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_SAMPLER, &hash_count, nullptr) || hash_count != 1)
 			return false;
-		if (!db2->write_entry(RESOURCE_COMPUTE_PIPELINE, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+
+		for (unsigned iteration = 0; iteration < 2; iteration++)
+		{
+			for (auto hash : hashes)
+			{
+				size_t blob_size = 0;
+				if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, nullptr, 0))
+					return false;
+				std::vector<uint8_t> blob(blob_size);
+				if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, blob.data(), 0))
+					return false;
+				if (blob != make_entry(hash))
+					return false;
+			}
+		}
+
+		size_t blob_size = 0;
+		if (!db->read_entry(RESOURCE_SAMPLER, flat_hash, &blob_size, nullptr, 0))
+			return false;
+		std::vector<uint8_t> blob(blob_size);
+		if (!db->read_entry(RESOURCE_SAMPLER, flat_hash, &blob_size, blob.data(), 0))
+			return false;
+		if (blob != make_entry(flat_hash))
+			return false;
+	}
+
+	remove(flat_path);
+	for (auto hash : hashes)
+	{
+		char path[64];
+		sprintf(path, "%s/%02x/%02x/%02x.%016" PRIx64 ".json", base,
+		        unsigned(hash >> 56), unsigned((hash >> 48) & 0xff), unsigned(RESOURCE_SHADER_MODULE), hash);
+		if (remove(path) != 0)
+			return false;
+		sprintf(path, "%s/%02x/%02x", base, unsigned(hash >> 56), unsigned((hash >> 48) & 0xff));
+		remove_directory(path);
+		sprintf(path, "%s/%02x", base, unsigned(hash >> 56));
+		remove_directory(path);
+	}
+	remove_directory(base);
+	return true;
+}
+
+static bool test_zip_database()
+{
+	remove(".__test_zip.zip");
+
+	const auto make_entry = [](Hash hash) {
+		std::vector<uint8_t> entry(200 + (hash % 97) * 31);
+		for (size_t i = 0; i < entry.size(); i++)
+			entry[i] = uint8_t((i * 3) ^ (i >> 6) ^ hash);
+		return entry;
+	};
+
+	const unsigned entry_count = 256;
+
+	// Write half the entries, then append the rest, so both stored and deflated entries end up in the archive.
+	for (unsigned pass = 0; pass < 2; pass++)
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(
+				create_zip_archive_database(".__test_zip.zip", pass ? DatabaseMode::Append : DatabaseMode::OverWrite));
+		if (!db->prepare())
+			return false;
+
+		for (Hash hash = pass * entry_count / 2 + 1; hash <= (pass + 1) * entry_count / 2; hash++)
+		{
+			auto entry = make_entry(hash);
+			if (!db->write_entry(RESOURCE_SHADER_MODULE, hash, entry.data(), entry.size(),
+			                     (hash & 1) ? PAYLOAD_WRITE_COMPRESS_BIT : PAYLOAD_WRITE_NO_FLAGS))
+				return false;
+		}
+	}
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_zip_archive_database(".__test_zip.zip", DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	size_t hash_count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &hash_count, nullptr) || hash_count != entry_count)
+		return false;
+
+	std::atomic<bool> success(true);
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < 4; i++)
+	{
+		threads.emplace_back([&, i]() {
+			for (unsigned iteration = 0; iteration < 4; iteration++)
+			{
+				for (Hash hash = 1 + i; hash <= entry_count; hash++)
+				{
+					size_t blob_size = 0;
+					if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
+					{
+						success = false;
+						return;
+					}
+					std::vector<uint8_t> blob(blob_size);
+					if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, blob.data(), PAYLOAD_READ_CONCURRENT_BIT) ||
+					    blob != make_entry(hash))
+					{
+						success = false;
+						return;
+					}
+				}
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+
+	db.reset();
+	remove(".__test_zip.zip");
+	return success.load();
+}
+
+static bool test_database_concurrent_reads()
+{
+	remove(".__test_concurrent_reads.foz");
+
+	static const unsigned entry_count = 256;
+	const auto make_entry = [](Hash hash) -> std::vector<uint8_t> {
+		std::vector<uint8_t> entry(64 + hash * 3);
+		for (size_t i = 0; i < entry.size(); i++)
+			entry[i] = uint8_t(hash + i / 16);
+		return entry;
+	};
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_concurrent_reads.foz", DatabaseMode::OverWrite));
+		if (!db->prepare())
+			return false;
+
+		for (Hash hash = 1; hash <= entry_count; hash++)
+		{
+			auto entry = make_entry(hash);
+			PayloadWriteFlags flags = PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+			if (hash & 1)
+				flags |= PAYLOAD_WRITE_COMPRESS_BIT;
+			if (!db->write_entry(RESOURCE_SHADER_MODULE, hash, entry.data(), entry.size(), flags))
+				return false;
+		}
+	}
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_concurrent_reads.foz", DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	std::atomic<unsigned> failures;
+	failures = 0;
+
+	std::vector<std::thread> threads;
+	for (unsigned thread_index = 0; thread_index < 4; thread_index++)
+	{
+		threads.emplace_back([&, thread_index]() {
+			for (unsigned iter = 0; iter < entry_count; iter++)
+			{
+				Hash hash = 1 + (iter * 7 + thread_index * 31) % entry_count;
+				auto expected = make_entry(hash);
+
+				for (PayloadReadFlags flags : { 0u, uint32_t(PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) })
+				{
+					flags |= PAYLOAD_READ_CONCURRENT_BIT;
+					size_t blob_size = 0;
+					if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, nullptr, flags))
+					{
+						failures++;
+						continue;
+					}
+
+					std::vector<uint8_t> blob(blob_size);
+					if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, blob.data(), flags))
+						failures++;
+					else if ((flags & PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT) == 0 && blob != expected)
+						failures++;
+				}
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+
+	db.reset();
+	remove(".__test_concurrent_reads.foz");
+	return failures == 0;
+}
+
+static bool test_database_async_writes()
+{
+	static const unsigned entry_count = 512;
+	const auto make_entry = [](Hash hash) -> std::vector<uint8_t> {
+		std::vector<uint8_t> entry(32 + (hash * 13) % 700);
+		for (size_t i = 0; i < entry.size(); i++)
+			entry[i] = uint8_t(hash * 3 + i / 8);
+		return entry;
+	};
+
+	for (unsigned compression_threads : { 0u, 3u })
+	{
+		remove(".__test_async.foz");
+
+		{
+			auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_async.foz", DatabaseMode::OverWrite));
+
+			// Small batches so we end up with many of them.
+			DatabaseAsyncWritePolicy policy;
+			policy.compression_threads = compression_threads;
+			policy.batch_size = 4096;
+			policy.flush_interval_ms = 1;
+			if (!db->set_async_write_policy(policy))
+				return false;
+			if (!db->prepare())
+				return false;
+			if (db->set_async_write_policy(policy))
+				return false;
+
+			for (Hash hash = 1; hash <= entry_count; hash++)
+			{
+				auto entry = make_entry(hash);
+				PayloadWriteFlags flags = PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+				if (hash % 3 != 0)
+					flags |= PAYLOAD_WRITE_COMPRESS_BIT;
+				if (!db->write_entry(RESOURCE_SHADER_MODULE, hash, entry.data(), entry.size(), flags))
+					return false;
+
+				// Entries must be visible right away, even if they have not reached the disk yet.
+				if (!db->has_entry(RESOURCE_SHADER_MODULE, hash))
+					return false;
+				if (!db->write_entry(RESOURCE_SHADER_MODULE, hash, entry.data(), entry.size(), flags))
+					return false;
+
+				if (hash % 100 == 0)
+					db->flush();
+			}
+		}
+
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_async.foz", DatabaseMode::ReadOnly));
+		if (!db->prepare())
+			return false;
+
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &hash_count, nullptr))
+			return false;
+		if (hash_count != entry_count)
+			return false;
+
+		for (Hash hash = 1; hash <= entry_count; hash++)
+		{
+			size_t blob_size = 0;
+			if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, nullptr, 0))
+				return false;
+			std::vector<uint8_t> blob(blob_size);
+			if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, blob.data(), 0))
+				return false;
+			if (blob != make_entry(hash))
+				return false;
+		}
+	}
+
+	remove(".__test_async.foz");
+	return true;
+}
+
+static bool test_database_compression_dictionary()
+{
+	remove(".__test_dictionary.foz");
+	remove(".__test_dictionary_copy.foz");
+
+	// Lots of small and similar payloads, which is where dictionaries shine.
+	std::vector<uint8_t> samples;
+	std::vector<size_t> sample_sizes;
+	for (unsigned i = 0; i < 1024; i++)
+	{
+		char entry[256];
+		int len = snprintf(entry, sizeof(entry),
+		                   "{ \"version\": 6, \"flags\": %u, \"stage\": \"fragment\", \"module\": \"%016x\", \"name\": \"main\" }",
+		                   i & 7, i * 0x9e3779b9u);
+		samples.insert(samples.end(), entry, entry + len);
+		sample_sizes.push_back(size_t(len));
+	}
+
+	std::vector<uint8_t> dictionary(4096);
+	size_t dictionary_size = train_compression_dictionary(samples.data(), sample_sizes.data(), unsigned(sample_sizes.size()),
+	                                                      dictionary.data(), dictionary.size());
+
+	bool has_dictionary;
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_dictionary.foz", DatabaseMode::OverWrite));
+		if (!db->prepare())
+			return false;
+
+		// Without Zstandard support, training fails and there is no dictionary, but everything else must still work.
+		has_dictionary = dictionary_size != 0;
+		if (has_dictionary && !db->add_compression_dictionary(RESOURCE_GRAPHICS_PIPELINE, dictionary.data(), dictionary_size))
+			return false;
+		if (db->add_compression_dictionary(RESOURCE_GRAPHICS_PIPELINE, dictionary.data(), dictionary_size))
+			return false;
+
+		const uint8_t *sample = samples.data();
+		for (size_t i = 0; i < sample_sizes.size(); i++)
+		{
+			if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, i + 1, sample, sample_sizes[i],
+			                     PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPRESS_ZSTD_BIT | PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT))
+				return false;
+			sample += sample_sizes[i];
+		}
+
+		// Dictionaries must come before any other entry.
+		if (db->add_compression_dictionary(RESOURCE_SHADER_MODULE, dictionary.data(), dictionary_size))
+			return false;
+	}
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_dictionary.foz", DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	const uint8_t *sample = samples.data();
+	for (size_t i = 0; i < sample_sizes.size(); i++)
+	{
+		size_t blob_size = 0;
+		if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, i + 1, &blob_size, nullptr, PAYLOAD_READ_CONCURRENT_BIT))
+			return false;
+		if (blob_size != sample_sizes[i])
+			return false;
+		std::vector<uint8_t> blob(blob_size);
+		if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, i + 1, &blob_size, blob.data(), PAYLOAD_READ_CONCURRENT_BIT))
+			return false;
+		if (memcmp(blob.data(), sample, blob_size) != 0)
+			return false;
+		sample += sample_sizes[i];
+	}
+
+	// Raw copies of payloads which depend on a dictionary must be rejected by archives without it.
+	{
+		auto db_copy = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_dictionary_copy.foz", DatabaseMode::OverWrite));
+		if (!db_copy->prepare())
+			return false;
+
+		size_t blob_size = 0;
+		if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 1, &blob_size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+			return false;
+		std::vector<uint8_t> blob(blob_size);
+		if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 1, &blob_size, blob.data(), PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+			return false;
+		if (db_copy->write_entry(RESOURCE_GRAPHICS_PIPELINE, 1, blob.data(), blob.size(), PAYLOAD_WRITE_RAW_FOSSILIZE_DB_BIT) == has_dictionary)
+			return false;
+	}
+
+	db.reset();
+	remove(".__test_dictionary.foz");
+	remove(".__test_dictionary_copy.foz");
+	return true;
+}
+
+static bool file_exists(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (file)
+	{
+		fclose(file);
+		return true;
+	}
+	else
+		return false;
+}
+
+static bool test_concurrent_database_extra_paths()
+{
+	// Test a normal flow. First time we don't have the read-only database.
+	// Next time we have one.
+	remove(".__test_concurrent.foz");
+	remove(".__test_concurrent.1.foz");
+	remove(".__test_concurrent.2.foz");
+	remove(".__test_concurrent.3.foz");
+	remove(".__test_concurrent.4.foz");
+
+	static const char *extra_paths = ".__test_concurrent.1.foz;.__test_concurrent.2.foz;.__test_concurrent.3.foz";
+	static const uint8_t blob[] = {1, 2, 3};
+
+	{
+		auto db0 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
+		                                                                         DatabaseMode::Append, nullptr, 0));
+		if (!db0->prepare())
+			return false;
+
+		if (!db0->write_entry(RESOURCE_SAMPLER, 2, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db0->write_entry(RESOURCE_SAMPLER, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+
+		auto db1 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
+		                                                                         DatabaseMode::Append, nullptr, 0));
+		if (!db1->prepare())
+			return false;
+
+		if (!db1->write_entry(RESOURCE_SAMPLER, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db1->write_entry(RESOURCE_SAMPLER, 4, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+
+		auto db2 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
+		                                                                         DatabaseMode::Append, nullptr, 0));
+		if (!db2->prepare())
+			return false;
+
+		if (!db2->write_entry(RESOURCE_SAMPLER, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db2->write_entry(RESOURCE_SAMPLER, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+	}
+
+	if (!file_exists(".__test_concurrent.1.foz"))
+		return false;
+	if (!file_exists(".__test_concurrent.2.foz"))
+		return false;
+	if (!file_exists(".__test_concurrent.3.foz"))
+		return false;
+
+	auto db = std::unique_ptr<DatabaseInterface>(
+			create_concurrent_database_with_encoded_extra_paths(nullptr, DatabaseMode::ReadOnly, extra_paths));
+
+	auto append_db = std::unique_ptr<DatabaseInterface>(
+			create_concurrent_database_with_encoded_extra_paths(".__test_concurrent",
+			                                                    DatabaseMode::Append, extra_paths));
+	if (!db->prepare())
+		return false;
+	if (!append_db->prepare())
+		return false;
+
+	size_t num_samplers;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_SAMPLER, &num_samplers, nullptr))
+		return false;
+	if (num_samplers != 4)
+		return false;
+
+	for (Hash i = 1; i <= 4; i++)
+	{
+		size_t blob_size;
+		if (!db->read_entry(RESOURCE_SAMPLER, i, &blob_size, nullptr, 0))
+			return false;
+		if (blob_size != sizeof(blob))
+			return false;
+	}
+
+	if (!append_db->write_entry(RESOURCE_SAMPLER, 4, blob, sizeof(blob), 0))
+		return false;
+
+	// This should not be written.
+	if (file_exists(".__test_concurrent.4.foz"))
+		return false;
+
+	if (!append_db->write_entry(RESOURCE_DESCRIPTOR_SET_LAYOUT, 4, blob, sizeof(blob), 0))
+		return false;
+
+	// .. but now it should exist.
+	if (!file_exists(".__test_concurrent.4.foz"))
+		return false;
+
+	return true;
+}
+
+static bool test_concurrent_database_many_extra_paths()
+{
+	// Enough entries that the bloom filters span many blocks.
+	static const unsigned archive_count = 12;
+	static const unsigned entries_per_archive = 500;
+	std::vector<std::string> paths;
+	std::vector<const char *> path_ptrs;
+
+	for (unsigned i = 0; i < archive_count; i++)
+	{
+		paths.push_back(".__test_many_extra." + std::to_string(i) + ".foz");
+		remove(paths.back().c_str());
+
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(paths.back().c_str(), DatabaseMode::OverWrite));
+		if (!db->prepare())
+			return false;
+
+		for (unsigned j = 0; j < entries_per_archive; j++)
+		{
+			// Even hashes are present, odd ones are not.
+			Hash hash = Hash(i * entries_per_archive + j) * 2 * 0x9e3779b97f4a7c15ull;
+			if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, hash, &hash, sizeof(hash), 0))
+				return false;
+		}
+	}
+
+	for (auto &path : paths)
+		path_ptrs.push_back(path.c_str());
+
+	remove(".__test_many_extra_base.1.foz");
+	auto db = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_many_extra_base", DatabaseMode::Append,
+	                                                                        path_ptrs.data(), path_ptrs.size()));
+	if (!db->prepare())
+		return false;
+
+	for (unsigned i = 0; i < archive_count * entries_per_archive; i++)
+	{
+		Hash present = Hash(i) * 2 * 0x9e3779b97f4a7c15ull;
+		Hash missing = (Hash(i) * 2 + 1) * 0x9e3779b97f4a7c15ull;
+		if (!db->has_entry(RESOURCE_GRAPHICS_PIPELINE, present))
+			return false;
+		if (db->has_entry(RESOURCE_GRAPHICS_PIPELINE, missing))
+			return false;
+		if (db->has_entry(RESOURCE_COMPUTE_PIPELINE, present))
+			return false;
+	}
+
+	// Entries which are present in read-only archives must not be written again.
+	Hash hash = 0;
+	if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, hash, &hash, sizeof(hash), 0))
+		return false;
+	db.reset();
+
+	FILE *file = fopen(".__test_many_extra_base.1.foz", "rb");
+	if (file)
+	{
+		fclose(file);
+		return false;
+	}
+
+	for (auto &path : paths)
+		remove(path.c_str());
+	return true;
+}
+
+static bool test_shader_module_store()
+{
+	static const uint8_t blob[] = { 1, 2, 3 };
+	remove(".__test_store.modules.foz");
+	remove(".__test_store_app.foz");
+	remove(".__test_store_base.1.foz");
+
+	{
+		auto store = std::unique_ptr<DatabaseInterface>(
+				create_shader_module_store_database(".__test_store.modules.foz", DatabaseMode::OverWrite));
+		if (!store->prepare())
+			return false;
+		if (!store->write_entry(RESOURCE_SHADER_MODULE, 1, blob, sizeof(blob), 0))
+			return false;
+		if (!store->write_entry(RESOURCE_SHADER_MODULE, 2, blob, sizeof(blob), 0))
+			return false;
+		// Stores only hold modules.
+		if (store->write_entry(RESOURCE_SAMPLER, 1, blob, sizeof(blob), 0))
+			return false;
+
+		auto app = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_store_app.foz", DatabaseMode::OverWrite));
+		if (!app->prepare())
+			return false;
+		if (!app->write_entry(RESOURCE_SHADER_MODULE, 3, blob, sizeof(blob), 0))
+			return false;
+		if (!app->write_entry(RESOURCE_SAMPLER, 10, blob, sizeof(blob), 0))
+			return false;
+	}
+
+	static const char *extra_paths = ".__test_store_app.foz;.__test_store.modules.foz";
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(
+				create_concurrent_database_with_encoded_extra_paths(nullptr, DatabaseMode::ReadOnly, extra_paths));
+		if (!db->prepare())
+			return false;
+
+		// Modules in the store are found, but are not listed as part of the application.
+		size_t count = 0;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, nullptr) || count != 1)
+			return false;
+		if (!db->has_entry(RESOURCE_SHADER_MODULE, 1) || !db->has_entry(RESOURCE_SHADER_MODULE, 3))
+			return false;
+		if (db->has_entry(RESOURCE_SHADER_MODULE, 4))
+			return false;
+
+		size_t blob_size = 0;
+		if (!db->read_entry(RESOURCE_SHADER_MODULE, 2, &blob_size, nullptr, 0) || blob_size != sizeof(blob))
+			return false;
+	}
+
+	{
+		// Recording skips modules the store already has.
+		auto db = std::unique_ptr<DatabaseInterface>(
+				create_concurrent_database_with_encoded_extra_paths(".__test_store_base", DatabaseMode::Append,
+				                                                    ".__test_store.modules.foz"));
+		if (!db->prepare())
+			return false;
+		if (!db->has_prior_entry(RESOURCE_SHADER_MODULE, 2))
+			return false;
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 1, blob, sizeof(blob), 0))
+			return false;
+		if (file_exists(".__test_store_base.1.foz"))
+			return false;
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 4, blob, sizeof(blob), 0))
+			return false;
+		if (!file_exists(".__test_store_base.1.foz"))
+			return false;
+	}
+
+	remove(".__test_store.modules.foz");
+	remove(".__test_store_app.foz");
+	remove(".__test_store_base.1.foz");
+	return true;
+}
+
+static bool test_concurrent_database()
+{
+	// Test a normal flow. First time we don't have the read-only database.
+	// Next time we have one.
+	for (unsigned iter = 0; iter < 2; iter++)
+	{
+		if (iter == 0)
+			remove(".__test_concurrent.foz");
+		remove(".__test_concurrent.1.foz");
+		remove(".__test_concurrent.2.foz");
+		remove(".__test_concurrent.3.foz");
+
+		static const uint8_t blob[] = {1, 2, 3};
+
+		{
+			{
+				auto db0 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
+				                                                                         DatabaseMode::Append, nullptr, 0));
+				if (!db0->prepare())
+					return false;
+
+				if (!db0->write_entry(RESOURCE_SAMPLER, 2, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+					return false;
+				if (!db0->write_entry(RESOURCE_SAMPLER, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+					return false;
+			}
+
+			{
+				auto db1 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
+				                                                                         DatabaseMode::Append, nullptr, 0));
+				if (!db1->prepare())
+					return false;
+
+				if (!db1->write_entry(RESOURCE_SAMPLER, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+					return false;
+				if (!db1->write_entry(RESOURCE_SAMPLER, 4, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+					return false;
+			}
+
+			{
+				auto db2 = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_concurrent",
+				                                                                         DatabaseMode::Append, nullptr, 0));
+				if (!db2->prepare())
+					return false;
+
+				if (!db2->write_entry(RESOURCE_SAMPLER, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+					return false;
+				if (!db2->write_entry(RESOURCE_SAMPLER, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+					return false;
+			}
+		}
+
+		bool expected_exist = iter == 0;
+
+		if (expected_exist != file_exists(".__test_concurrent.1.foz"))
+			return false;
+		if (expected_exist != file_exists(".__test_concurrent.2.foz"))
+			return false;
+		if (expected_exist != file_exists(".__test_concurrent.3.foz"))
+			return false;
+
+		static const char *append_paths[] = {
+			".__test_concurrent.1.foz",
+			".__test_concurrent.2.foz",
+			".__test_concurrent.3.foz",
+		};
+
+		if (iter == 0)
+		{
+			if (!merge_concurrent_databases(".__test_concurrent.foz", append_paths, 3))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+static bool test_merge_databases()
+{
+	static const unsigned source_count = 8;
+	static const unsigned entries_per_source = 64;
+	std::vector<std::string> paths;
+	std::vector<const char *> path_ptrs;
+	remove(".__test_merge.foz");
+
+	const auto make_entry = [](unsigned source, Hash hash) -> std::vector<uint8_t> {
+		std::vector<uint8_t> entry(64 + hash % 200);
+		for (size_t i = 0; i < entry.size(); i++)
+			entry[i] = uint8_t(source + hash + i / 32);
+		return entry;
+	};
+
+	for (unsigned source = 0; source < source_count; source++)
+	{
+		paths.push_back(".__test_merge." + std::to_string(source) + ".foz");
+		remove(paths.back().c_str());
+
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(paths.back().c_str(), DatabaseMode::OverWrite));
+		if (!db->prepare())
+			return false;
+
+		// Every source overlaps with the previous one by half, the first source to have an entry must win.
+		for (unsigned i = 0; i < entries_per_source; i++)
+		{
+			Hash hash = source * entries_per_source / 2 + i + 1;
+			auto entry = make_entry(source, hash);
+			PayloadWriteFlags flags = PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+			if (hash & 1)
+				flags |= PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_BEST_COMPRESSION_BIT;
+			if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, hash, entry.data(), entry.size(), flags))
+				return false;
+		}
+	}
+
+	for (auto &path : paths)
+		path_ptrs.push_back(path.c_str());
+
+	if (!merge_concurrent_databases(".__test_merge.foz", path_ptrs.data(), path_ptrs.size(), 3))
+		return false;
+
+	auto merged = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_merge.foz", DatabaseMode::ReadOnly));
+	if (!merged->prepare())
+		return false;
+
+	size_t hash_count = 0;
+	if (!merged->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &hash_count, nullptr))
+		return false;
+	if (hash_count != (source_count + 1) * entries_per_source / 2)
+		return false;
+
+	for (unsigned source = 0; source < source_count; source++)
+	{
+		auto source_db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(paths[source].c_str(), DatabaseMode::ReadOnly));
+		if (!source_db->prepare())
+			return false;
+
+		// The first half of every later source overlaps with the previous source, which wins.
+		for (unsigned i = source ? entries_per_source / 2 : 0; i < entries_per_source; i++)
+		{
+			Hash hash = source * entries_per_source / 2 + i + 1;
+
+			// Payloads must be carried over verbatim, without recompression.
+			std::vector<uint8_t> raw[2];
+			DatabaseInterface *dbs[2] = { source_db.get(), merged.get() };
+			for (unsigned j = 0; j < 2; j++)
+			{
+				size_t blob_size = 0;
+				if (!dbs[j]->read_entry(RESOURCE_GRAPHICS_PIPELINE, hash, &blob_size, nullptr, PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+					return false;
+				raw[j].resize(blob_size);
+				if (!dbs[j]->read_entry(RESOURCE_GRAPHICS_PIPELINE, hash, &blob_size, raw[j].data(), PAYLOAD_READ_RAW_FOSSILIZE_DB_BIT))
+					return false;
+			}
+
+			if (raw[0] != raw[1])
+				return false;
+
+			size_t blob_size = 0;
+			if (!merged->read_entry(RESOURCE_GRAPHICS_PIPELINE, hash, &blob_size, nullptr, 0))
+				return false;
+			std::vector<uint8_t> blob(blob_size);
+			if (!merged->read_entry(RESOURCE_GRAPHICS_PIPELINE, hash, &blob_size, blob.data(), 0))
+				return false;
+			if (blob != make_entry(source, hash))
+				return false;
+		}
+	}
+
+	merged.reset();
+	for (auto &path : paths)
+		remove(path.c_str());
+	remove(".__test_merge.foz");
+	return true;
+}
+
+static bool test_implicit_whitelist()
+{
+	remove(".__test_concurrent.foz");
+	remove(".__test_concurrent.1.foz");
+	remove(".__test_concurrent.2.foz");
+	remove(".__test_concurrent.3.foz");
+	static const uint8_t blob[] = {1, 2, 3};
+
+	{
+		auto whitelist_db = std::unique_ptr<DatabaseInterface>(
+				create_stream_archive_database(".__test_concurrent_whitelist.foz", DatabaseMode::OverWrite));
+		if (!whitelist_db || !whitelist_db->prepare())
+			return false;
+
+		if (!whitelist_db->write_entry(RESOURCE_SHADER_MODULE, 1, nullptr, 0, PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+	}
+
+	{
+		auto db0 = std::unique_ptr<DatabaseInterface>(
+				create_concurrent_database(".__test_concurrent",
+				                           DatabaseMode::Append, nullptr, 0));
+		auto db1 = std::unique_ptr<DatabaseInterface>(
+				create_concurrent_database(".__test_concurrent",
+				                           DatabaseMode::Append, nullptr, 0));
+		auto db2 = std::unique_ptr<DatabaseInterface>(
+				create_concurrent_database(".__test_concurrent",
+				                           DatabaseMode::Append, nullptr, 0));
+
+		if (!db0 || !db0->prepare())
+			return false;
+		if (!db1 || !db1->prepare())
+			return false;
+		if (!db2 || !db2->prepare())
+			return false;
+
+		if (!db0->write_entry(RESOURCE_SHADER_MODULE, 1, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db1->write_entry(RESOURCE_GRAPHICS_PIPELINE, 2, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db2->write_entry(RESOURCE_COMPUTE_PIPELINE, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+
+		if (!db0->write_entry(RESOURCE_SHADER_MODULE, 2, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db1->write_entry(RESOURCE_GRAPHICS_PIPELINE, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db2->write_entry(RESOURCE_COMPUTE_PIPELINE, 4, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+
+		// Should not return a database for Append mode.
+		if (db0->get_sub_database(0))
+			return false;
+		if (db1->get_sub_database(0))
+			return false;
+		if (db2->get_sub_database(0))
+			return false;
+	}
+
+	static const char *extra_paths[] = {
+		".__test_concurrent.1.foz",
+		".__test_concurrent.2.foz",
+		".__test_concurrent.3.foz",
+	};
+	auto replay_db = std::unique_ptr<DatabaseInterface>(
+			create_concurrent_database(nullptr, DatabaseMode::ReadOnly, extra_paths, 3));
+
+	if (!replay_db->load_whitelist_database(".__test_concurrent_whitelist.foz"))
+		return false;
+	replay_db->promote_sub_database_to_whitelist(3);
+	if (!replay_db || !replay_db->prepare())
+		return false;
+
+	// This should be whitelisted by primary whitelist.
+	if (!replay_db->has_entry(RESOURCE_SHADER_MODULE, 1))
+		return false;
+	// Should not exist.
+	if (replay_db->has_entry(RESOURCE_SHADER_MODULE, 2))
+		return false;
+	if (replay_db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 2))
+		return false;
+	if (replay_db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 3))
+		return false;
+	// Should be whitelisted by implicit whitelist.
+	if (!replay_db->has_entry(RESOURCE_COMPUTE_PIPELINE, 3))
+		return false;
+	if (!replay_db->has_entry(RESOURCE_COMPUTE_PIPELINE, 4))
+		return false;
+
+	size_t size = 0;
+	Hash hashes[3];
+
+	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &size, nullptr) || size != 1)
+		return false;
+	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &size, hashes) || size != 1)
+		return false;
+	if (hashes[0] != 1)
+		return false;
+
+	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &size, nullptr) || size != 0)
+		return false;
+
+	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &size, nullptr) || size != 2)
+		return false;
+	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &size, hashes) || size != 2)
+		return false;
+	if (hashes[0] != 3)
+		return false;
+	if (hashes[1] != 4)
+		return false;
+
+	// We have no primary database.
+	if (replay_db->get_sub_database(0))
+		return false;
+	if (!replay_db->get_sub_database(1))
+		return false;
+	if (!replay_db->get_sub_database(2))
+		return false;
+	if (!replay_db->get_sub_database(3))
+		return false;
+	if (replay_db->get_sub_database(4))
+		return false;
+
+	replay_db.reset();
+	remove(".__test_concurrent.1.foz");
+	remove(".__test_concurrent.2.foz");
+	remove(".__test_concurrent.3.foz");
+	remove(".__test_concurrent_whitelist.foz");
+	return true;
+}
+
+static bool test_filter()
+{
+	static const uint8_t blob[4] = { 1, 2, 3, 4 };
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_filter.foz",
+		                                                                             DatabaseMode::OverWrite));
+		if (!db->prepare())
+			return false;
+
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 10, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 11, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 12, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 10, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 11, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 12, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+
+		if (!db->write_entry(RESOURCE_COMPUTE_PIPELINE, 10, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db->write_entry(RESOURCE_COMPUTE_PIPELINE, 11, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+		if (!db->write_entry(RESOURCE_COMPUTE_PIPELINE, 12, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+			return false;
+	}
+
+	{
+		auto whitelist = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_whitelist.foz",
+		                                                                                   DatabaseMode::OverWrite));
+		auto blacklist = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_blacklist.foz",
+		                                                                                   DatabaseMode::OverWrite));
+
+		if (!whitelist->prepare())
+			return false;
+		if (!blacklist->prepare())
+			return false;
+
+		if (!whitelist->write_entry(RESOURCE_SHADER_MODULE, 10, nullptr, 0, 0))
+			return false;
+		if (!whitelist->write_entry(RESOURCE_SHADER_MODULE, 11, nullptr, 0, 0))
+			return false;
+		if (!whitelist->write_entry(RESOURCE_SHADER_MODULE, 12, nullptr, 0, 0))
+			return false;
+
+		if (!whitelist->write_entry(RESOURCE_GRAPHICS_PIPELINE, 11, nullptr, 0, 0))
+			return false;
+		if (!whitelist->write_entry(RESOURCE_GRAPHICS_PIPELINE, 12, nullptr, 0, 0))
+			return false;
+		if (!blacklist->write_entry(RESOURCE_GRAPHICS_PIPELINE, 10, nullptr, 0, 0))
+			return false;
+
+		if (!whitelist->write_entry(RESOURCE_COMPUTE_PIPELINE, 10, nullptr, 0, 0))
+			return false;
+		if (!whitelist->write_entry(RESOURCE_COMPUTE_PIPELINE, 12, nullptr, 0, 0))
+			return false;
+		if (!blacklist->write_entry(RESOURCE_COMPUTE_PIPELINE, 11, nullptr, 0, 0))
+			return false;
+	}
+
+	for (unsigned i = 0; i < 3; i++)
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_filter.foz",
+		                                                                            DatabaseMode::ReadOnly));
+		switch (i)
+		{
+		case 0:
+			if (!db->load_whitelist_database(i ? ".__test_blacklist.foz" : ".__test_whitelist.foz"))
+				return false;
+			break;
+
+		case 1:
+			if (!db->load_blacklist_database(".__test_blacklist.foz"))
+				return false;
+			break;
+
+		case 2:
+			if (!db->load_whitelist_database(".__test_whitelist.foz"))
+				return false;
+			if (!db->load_blacklist_database(".__test_blacklist.foz"))
+				return false;
+			break;
+
+		default:
+			return false;
+		}
+
+		if (!db->prepare())
+			return false;
+
+		size_t count;
+		Hash hashes[3];
+
+		// Test whitelist filtering of different types.
+		if (!db->has_entry(RESOURCE_SHADER_MODULE, 10))
+			return false;
+		if (!db->has_entry(RESOURCE_SHADER_MODULE, 11))
+			return false;
+		if (!db->has_entry(RESOURCE_SHADER_MODULE, 12))
+			return false;
+		if (db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 10))
+			return false;
+		if (db->has_entry(RESOURCE_COMPUTE_PIPELINE, 11))
+			return false;
+
+		// Test get_hash_list.
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, nullptr))
+			return false;
+		if (count != 3)
+			return false;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, hashes))
+			return false;
+
+		static const Hash expected_0[3] = { 10, 11, 12 };
+		if (memcmp(expected_0, hashes, sizeof(expected_0)) != 0)
+			return false;
+
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &count, nullptr))
+			return false;
+		if (count != 2)
+			return false;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &count, hashes))
+			return false;
+
+		static const Hash expected_1[2] = { 11, 12 };
+		if (memcmp(expected_1, hashes, sizeof(expected_1)) != 0)
+			return false;
+
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &count, nullptr))
+			return false;
+		if (count != 2)
+			return false;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &count, hashes))
+			return false;
+
+		static const Hash expected_2[2] = { 10, 12 };
+		if (memcmp(expected_2, hashes, sizeof(expected_2)) != 0)
+			return false;
+	}
+
+	remove(".__test_filter.foz");
+	remove(".__test_whitelist.foz");
+	remove(".__test_blacklist.foz");
+	return true;
+}
+
+static bool test_export_single_archive()
+{
+	static const uint16_t one = 1;
+	static const uint32_t two = 2;
+	static const uint64_t three = 3;
+	char export_path[DatabaseInterface::OSHandleNameSize];
+	DatabaseInterface::get_unique_os_export_name(export_path, sizeof(export_path));
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz",
+		                                                                            DatabaseMode::OverWrite));
+		if (!db || !db->prepare())
+			return false;
+
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 1, &one, sizeof(one), 0))
+			return false;
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 2, &two, sizeof(two), 0))
+			return false;
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 3, &three, sizeof(three), 0))
+			return false;
+
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 300, &one, sizeof(one), 0))
+			return false;
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 200, &two, sizeof(two), 0))
+			return false;
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 100, &three, sizeof(three), 0))
+			return false;
+	}
+
+	intptr_t handle;
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz", DatabaseMode::ReadOnly));
+		if (!db || !db->prepare())
+			return false;
+		handle = db->export_metadata_to_os_handle(export_path);
+#ifdef __WIN32
+		if (handle == 0)
+			return false;
+#else
+		if (handle < 0)
+			return false;
+#endif
+	}
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz", DatabaseMode::ReadOnly));
+	if (!db || !db->import_metadata_from_os_handle(handle) || !db->prepare())
+		return false;
+
+	size_t count;
+
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		if (!db->get_hash_list_for_resource_tag(ResourceTag(i), &count, nullptr))
+			return false;
+
+		switch (ResourceTag(i))
+		{
+		case RESOURCE_GRAPHICS_PIPELINE:
+		case RESOURCE_SHADER_MODULE:
+			if (count != 3)
+				return false;
+			break;
+
+		default:
+			if (count != 0)
+				return false;
+			break;
+		}
+	}
+
+	Hash hashes[3];
+	count = 3;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, hashes))
+		return false;
+	static const Hash reference_hashes_module[3] = { 1, 2, 3 };
+	static const Hash reference_hashes_pipeline[3] = { 100, 200, 300 };
+	if (memcmp(reference_hashes_module, hashes, sizeof(hashes)) != 0)
+		return false;
+
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &count, hashes))
+		return false;
+	if (memcmp(reference_hashes_pipeline, hashes, sizeof(hashes)) != 0)
+		return false;
+
+	union
+	{
+		uint16_t u16;
+		uint32_t u32;
+		uint64_t u64;
+	} u;
+
+	size_t blob_size;
+
+	blob_size = sizeof(u.u16);
+	if (!db->read_entry(RESOURCE_SHADER_MODULE, 1, &blob_size, &u.u16, 0) || u.u16 != one)
+		return false;
+
+	blob_size = sizeof(u.u32);
+	if (!db->read_entry(RESOURCE_SHADER_MODULE, 2, &blob_size, &u.u32, 0) || u.u32 != two)
+		return false;
+
+	blob_size = sizeof(u.u64);
+	if (!db->read_entry(RESOURCE_SHADER_MODULE, 3, &blob_size, &u.u64, 0) || u.u64 != three)
+		return false;
+
+	if (db->has_entry(RESOURCE_SHADER_MODULE, 0) || db->has_entry(RESOURCE_SHADER_MODULE, 4))
+		return false;
+
+	blob_size = sizeof(u.u16);
+	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 300, &blob_size, &u.u16, 0) || u.u16 != one)
+		return false;
+
+	blob_size = sizeof(u.u32);
+	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 200, &blob_size, &u.u32, 0) || u.u32 != two)
+		return false;
+
+	blob_size = sizeof(u.u64);
+	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 100, &blob_size, &u.u64, 0) || u.u64 != three)
+		return false;
+
+	if (db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 150) ||
+	    db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 99) ||
+	    db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 400))
+		return false;
+
+	db.reset();
+	remove(".__test_archive.foz");
+	return true;
+}
+
+// Large enough lists get a perfect hash in exported metadata, so check that lookups through it work.
+static bool test_export_large_archive()
+{
+	static const unsigned entry_count = 10000;
+	char export_path[DatabaseInterface::OSHandleNameSize];
+	DatabaseInterface::get_unique_os_export_name(export_path, sizeof(export_path));
+
+	const auto hash_for_index = [](unsigned i) -> Hash {
+		return (Hash(i) * 0x9e3779b97f4a7c15ull) | 1;
+	};
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz",
+		                                                                            DatabaseMode::OverWrite));
+		if (!db || !db->prepare())
+			return false;
+
+		for (unsigned i = 0; i < entry_count; i++)
+			if (!db->write_entry(RESOURCE_SHADER_MODULE, hash_for_index(i), &i, sizeof(i), 0))
+				return false;
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 100, &entry_count, sizeof(entry_count), 0))
+			return false;
+	}
+
+	intptr_t handle;
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz", DatabaseMode::ReadOnly));
+		if (!db || !db->prepare())
+			return false;
+		handle = db->export_metadata_to_os_handle(export_path);
+#ifdef __WIN32
+		if (handle == 0)
+			return false;
+#else
+		if (handle < 0)
+			return false;
+#endif
+	}
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz", DatabaseMode::ReadOnly));
+	if (!db || !db->import_metadata_from_os_handle(handle) || !db->prepare())
+		return false;
+
+	size_t count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, nullptr) || count != entry_count)
+		return false;
+
+	std::vector<Hash> hashes(count);
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, hashes.data()))
+		return false;
+	if (!std::is_sorted(hashes.begin(), hashes.end()))
+		return false;
+
+	for (unsigned i = 0; i < entry_count; i++)
+	{
+		unsigned value = 0;
+		size_t blob_size = sizeof(value);
+		if (!db->read_entry(RESOURCE_SHADER_MODULE, hash_for_index(i), &blob_size, &value, 0) || value != i)
+			return false;
+		if (db->has_entry(RESOURCE_SHADER_MODULE, hash_for_index(i) + 1))
+			return false;
+	}
+
+	if (!db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 100) || db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 101))
+		return false;
+
+	db.reset();
+	remove(".__test_archive.foz");
+	return true;
+}
+
+static bool test_export_concurrent_archive(bool with_read_only)
+{
+	remove(".__test_archive.foz");
+	static const uint16_t one = 1;
+	static const uint32_t two = 2;
+	static const uint64_t three = 3;
+	static const uint8_t four = 4;
+
+	char export_path[DatabaseInterface::OSHandleNameSize];
+	DatabaseInterface::get_unique_os_export_name(export_path, sizeof(export_path));
+
+	if (with_read_only)
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz",
+		                                                                            DatabaseMode::OverWrite));
+		if (!db || !db->prepare())
+			return false;
+
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 1000, &four, sizeof(four), 0))
+			return false;
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 1300, &four, sizeof(four), 0))
+			return false;
+	}
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive1.foz",
+		                                                                            DatabaseMode::OverWrite));
+		if (!db || !db->prepare())
+			return false;
+
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 1, &one, sizeof(one), 0))
+			return false;
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 300, &one, sizeof(one), 0))
+			return false;
+
+		// Duplicate.
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 2, &two, sizeof(two), 0))
+			return false;
+	}
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive2.foz",
+		                                                                            DatabaseMode::OverWrite));
+		if (!db || !db->prepare())
+			return false;
+
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 2, &two, sizeof(two), 0))
+			return false;
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 200, &two, sizeof(two), 0))
+			return false;
+	}
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive3.foz",
+		                                                                            DatabaseMode::OverWrite));
+		if (!db || !db->prepare())
+			return false;
+
+		if (!db->write_entry(RESOURCE_SHADER_MODULE, 3, &three, sizeof(three), 0))
+			return false;
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 100, &three, sizeof(three), 0))
+			return false;
+	}
+
+	static const char *extra_paths[] = { ".__test_archive1.foz", ".__test_archive_bogus.foz", ".__test_archive2.foz", ".__test_archive3.foz" };
+	intptr_t handle;
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_archive", DatabaseMode::ReadOnly, extra_paths, 4));
+		if (!db || !db->prepare())
+			return false;
+		handle = db->export_metadata_to_os_handle(export_path);
+#ifdef __WIN32
+		if (handle == 0)
+			return false;
+#else
+		if (handle < 0)
+			return false;
+#endif
+	}
+
+	auto db = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_archive", DatabaseMode::ReadOnly, extra_paths, 4));
+	if (!db || !db->import_metadata_from_os_handle(handle) || !db->prepare())
+		return false;
+
+	size_t expected_count = with_read_only ? 4 : 3;
+	size_t count;
+
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		if (!db->get_hash_list_for_resource_tag(ResourceTag(i), &count, nullptr))
+			return false;
+
+		switch (ResourceTag(i))
+		{
+		case RESOURCE_GRAPHICS_PIPELINE:
+		case RESOURCE_SHADER_MODULE:
+			if (count != expected_count)
+				return false;
+			break;
+
+		default:
+			if (count != 0)
+				return false;
+			break;
+		}
+	}
+
+	Hash hashes[4];
+	count = expected_count;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, hashes))
+		return false;
+	static const Hash reference_hashes_module[4] = { 1, 2, 3, 1000 };
+	static const Hash reference_hashes_pipeline[4] = { 100, 200, 300, 1300 };
+	if (memcmp(reference_hashes_module, hashes, sizeof(*hashes) * expected_count) != 0)
+		return false;
+
+	count = expected_count;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &count, hashes))
+		return false;
+	if (memcmp(reference_hashes_pipeline, hashes, sizeof(*hashes) * expected_count) != 0)
+		return false;
+
+	// The hash view points into the imported metadata and must match the copied list.
+	DatabaseHashView view;
+	if (!db->get_hash_view_for_resource_tag(RESOURCE_SHADER_MODULE, &view) || view.size() != expected_count)
+		return false;
+	count = 0;
+	for (Hash hash : view)
+		if (hash != reference_hashes_module[count++])
+			return false;
+	if (!view.contains(3) || view.contains(4) || view.contains(0))
+		return false;
+
+	// Sub-databases expose their imported stream archive metadata.
+	auto *sub_db = db->get_sub_database(1);
+	if (!sub_db || !sub_db->get_hash_view_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &view) ||
+	    view.size() != 1 || view[0] != 300)
+		return false;
+
+	union
+	{
+		uint8_t u8;
+		uint16_t u16;
+		uint32_t u32;
+		uint64_t u64;
+	} u;
+
+	size_t blob_size;
+
+	blob_size = sizeof(u.u16);
+	if (!db->read_entry(RESOURCE_SHADER_MODULE, 1, &blob_size, &u.u16, 0) || u.u16 != one)
+		return false;
+
+	blob_size = sizeof(u.u32);
+	if (!db->read_entry(RESOURCE_SHADER_MODULE, 2, &blob_size, &u.u32, 0) || u.u32 != two)
+		return false;
+
+	blob_size = sizeof(u.u64);
+	if (!db->read_entry(RESOURCE_SHADER_MODULE, 3, &blob_size, &u.u64, 0) || u.u64 != three)
+		return false;
+
+	if (with_read_only)
+	{
+		blob_size = sizeof(u.u8);
+		if (!db->read_entry(RESOURCE_SHADER_MODULE, 1000, &blob_size, &u.u8, 0) || u.u8 != four)
+			return false;
+
+		blob_size = sizeof(u.u8);
+		if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 1300, &blob_size, &u.u8, 0) || u.u8 != four)
 			return false;
+	}
 
-		if (!db0->write_entry(RESOURCE_SHADER_MODULE, 2, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+	if (db->has_entry(RESOURCE_SHADER_MODULE, 0) || db->has_entry(RESOURCE_SHADER_MODULE, 4))
+		return false;
+	for (auto &hash : reference_hashes_module)
+		if (db->has_entry(RESOURCE_SHADER_MODULE, hash) != (hash != 1000 || with_read_only))
 			return false;
-		if (!db1->write_entry(RESOURCE_GRAPHICS_PIPELINE, 3, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+	for (auto &hash : reference_hashes_pipeline)
+		if (db->has_entry(RESOURCE_GRAPHICS_PIPELINE, hash) != (hash != 1300 || with_read_only))
 			return false;
-		if (!db2->write_entry(RESOURCE_COMPUTE_PIPELINE, 4, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+
+	blob_size = sizeof(u.u16);
+	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 300, &blob_size, &u.u16, 0) || u.u16 != one)
+		return false;
+
+	blob_size = sizeof(u.u32);
+	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 200, &blob_size, &u.u32, 0) || u.u32 != two)
+		return false;
+
+	blob_size = sizeof(u.u64);
+	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 100, &blob_size, &u.u64, 0) || u.u64 != three)
+		return false;
+
+	if (db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 150) ||
+	    db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 99) ||
+	    db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 400))
+		return false;
+
+	db.reset();
+	remove(".__test_archive.foz");
+	remove(".__test_archive1.foz");
+	remove(".__test_archive2.foz");
+	remove(".__test_archive3.foz");
+	return true;
+}
+
+static bool test_logging()
+{
+	VkSamplerCreateInfo create_info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+	VkSamplerYcbcrConversionCreateInfo conv_info = { VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO };
+	create_info.pNext = &conv_info;
+
+	const auto immutable = fake_handle<VkSampler>(100);
+
+	VkDescriptorSetLayoutCreateInfo set_layout = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	VkDescriptorSetLayoutBinding binding = {};
+	binding.pImmutableSamplers = &immutable;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	binding.stageFlags = VK_SHADER_STAGE_ALL;
+	binding.descriptorCount = 1;
+	set_layout.pBindings = &binding;
+	set_layout.bindingCount = 1;
+
+	struct UserData
+	{
+		unsigned err_count;
+		unsigned warn_count;
+		unsigned info_count;
+	};
+
+	UserData userdata = {};
+	set_thread_log_callback([](LogLevel level, const char *message, void *u) {
+		auto *user = static_cast<UserData *>(u);
+		if (level == LOG_WARNING)
+			user->warn_count++;
+		else if (level == LOG_ERROR)
+			user->err_count++;
+		else if (level == LOG_INFO)
+			user->info_count++;
+		fprintf(stderr, "Callback: %s", message);
+	}, &userdata);
+
+	for (unsigned i = 0; i < 3; i++)
+	{
+		userdata = {};
+
+		std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(
+				".__test_archive.foz", DatabaseMode::OverWrite));
+		StateRecorder recorder;
+		if (!db || !db->prepare())
 			return false;
 
-		// Should not return a database for Append mode.
-		if (db0->get_sub_database(0))
+		if (i < 2)
+			LOGI("Expecting log to trigger.\n");
+		else
+			LOGI("Expecting log to NOT trigger.\n");
+		LOGI("=======================\n");
+
+		set_thread_log_level(LogLevel(i));
+		recorder.init_recording_thread(db.get());
+
+		// Expect failure
+		if (recorder.record_sampler(immutable, create_info, 100))
 			return false;
-		if (db1->get_sub_database(0))
+
+		unsigned expected_warn = i < 2 ? 1 : 0;
+		if (userdata.warn_count != expected_warn || userdata.err_count != 0 || userdata.info_count != 0)
 			return false;
-		if (db2->get_sub_database(0))
+
+		// Should succeed, but will fail later when trying to resolve sampler.
+		if (!recorder.record_descriptor_set_layout(fake_handle<VkDescriptorSetLayout>(10), set_layout, 200))
+			return false;
+
+		recorder.tear_down_recording_thread();
+		LOGI("=======================\n");
+
+		expected_warn = i < 2 ? 2 : 0;
+		if (userdata.warn_count != expected_warn || userdata.err_count != 0 || userdata.info_count != 0)
+			return false;
+	}
+	remove(".__test_archive.foz");
+	set_thread_log_callback(nullptr, nullptr);
+	return true;
+}
+
+struct ShaderModuleCollector : StateCreatorInterface
+{
+	std::unordered_map<Hash, std::vector<uint32_t>> modules;
+
+	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override { return true; }
+	bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override { return true; }
+	bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override { return true; }
+	bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override { return true; }
+	bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override { return true; }
+	bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override { return true; }
+
+	bool enqueue_create_shader_module(Hash hash, const VkShaderModuleCreateInfo *create_info, VkShaderModule *module) override
+	{
+		modules[hash] = std::vector<uint32_t>(create_info->pCode, create_info->pCode + create_info->codeSize / 4);
+		*module = fake_handle<VkShaderModule>(hash);
+		return true;
+	}
+};
+
+static bool test_shader_module_encoding()
+{
+	// OpCapability Shader, OpMemoryModel Logical GLSL450, then a run of OpIAdd with increasing IDs.
+	std::vector<uint32_t> spirv = { 0x07230203u, 0x00010000u, 0, 100, 0, 0x00020011u, 1, 0x0003000eu, 0, 1 };
+	for (uint32_t i = 0; i < 64; i++)
+		spirv.insert(spirv.end(), { 0x00050080u, 2, 10 + i, 9 + i, 8 + i });
+	// Does not parse as SPIR-V, so it has to fall back to varint.
+	std::vector<uint32_t> garbage = { 0xdeadbeef, 0xcafebabe, 0x00010000u };
+
+	VkShaderModuleCreateInfo infos[2] = {};
+	infos[0].sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	infos[0].pCode = spirv.data();
+	infos[0].codeSize = spirv.size() * sizeof(uint32_t);
+	infos[1].sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	infos[1].pCode = garbage.data();
+	infos[1].codeSize = garbage.size() * sizeof(uint32_t);
+
+	Hash hashes[2];
+	for (unsigned i = 0; i < 2; i++)
+		if (!Hashing::compute_hash_shader_module(infos[i], &hashes[i]))
+			return false;
+
+	for (auto encoding : { ShaderModuleEncoding::Varint, ShaderModuleEncoding::SPIRVDelta })
+	{
+		{
+			std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_archive.foz", DatabaseMode::OverWrite));
+			if (!db || !db->prepare())
+				return false;
+
+			StateRecorder recorder;
+			recorder.set_database_shader_module_encoding(encoding);
+			recorder.init_recording_thread(db.get());
+			for (unsigned i = 0; i < 2; i++)
+				if (!recorder.record_shader_module(fake_handle<VkShaderModule>(i + 1), infos[i]))
+					return false;
+			recorder.tear_down_recording_thread();
+		}
+
+		std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_archive.foz", DatabaseMode::ReadOnly));
+		if (!db || !db->prepare())
+			return false;
+
+		StateReplayer replayer;
+		ShaderModuleCollector collector;
+		for (auto hash : hashes)
+		{
+			size_t blob_size = 0;
+			if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, nullptr, 0))
+				return false;
+			std::vector<uint8_t> blob(blob_size);
+			if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &blob_size, blob.data(), 0))
+				return false;
+
+			// Modules which parse as SPIR-V must use the requested encoding.
+			bool is_spirv_delta = strstr(reinterpret_cast<const char *>(blob.data()), "spirvOffset") != nullptr;
+			if (is_spirv_delta != (encoding == ShaderModuleEncoding::SPIRVDelta && hash == hashes[0]))
+				return false;
+
+			if (!replayer.parse(collector, db.get(), blob.data(), blob.size()))
+				return false;
+		}
+
+		if (collector.modules[hashes[0]] != spirv || collector.modules[hashes[1]] != garbage)
+			return false;
+	}
+
+	remove(".__test_archive.foz");
+	return true;
+}
+
+static bool test_hash_algorithms()
+{
+	std::vector<uint32_t> code(64 * 1024);
+	for (size_t i = 0; i < code.size(); i++)
+		code[i] = uint32_t(i * 0x9e3779b9u);
+
+	VkShaderModuleCreateInfo info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+	info.pCode = code.data();
+	info.codeSize = code.size() * sizeof(uint32_t);
+
+	Hash fnv_hash, xxh_hash;
+	if (!Hashing::compute_hash_shader_module(info, &fnv_hash, HashAlgorithm::FNV1A))
+		return false;
+	if (!Hashing::compute_hash_shader_module(info, &xxh_hash, HashAlgorithm::XXH64))
+		return false;
+	if (fnv_hash == xxh_hash)
+		return false;
+
+	// The default must stay stable, existing archives are keyed on it.
+	Hash default_hash;
+	if (!Hashing::compute_hash_shader_module(info, &default_hash))
+		return false;
+	if (default_hash != fnv_hash)
+		return false;
+
+	code[code.size() / 2] ^= 1;
+	Hash modified_hash;
+	if (!Hashing::compute_hash_shader_module(info, &modified_hash, HashAlgorithm::XXH64))
+		return false;
+	if (modified_hash == xxh_hash)
+		return false;
+	code[code.size() / 2] ^= 1;
+
+	StateRecorder recorder;
+	recorder.set_hash_algorithm(HashAlgorithm::XXH64);
+	if (!recorder.record_shader_module(fake_handle<VkShaderModule>(1), info))
+		return false;
+
+	Hash recorded_hash;
+	if (!recorder.get_hash_for_shader_module(fake_handle<VkShaderModule>(1), &recorded_hash))
+		return false;
+	if (recorded_hash != xxh_hash)
+		return false;
+
+	return true;
+}
+
+static bool record_all_to_archive(const char *path, PayloadEncoding encoding, unsigned serialization_workers = 0)
+{
+	std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(path, DatabaseMode::OverWrite));
+	if (!db || !db->prepare())
+		return false;
+
+	StateRecorder recorder;
+	recorder.set_database_payload_encoding(encoding);
+	recorder.set_serialization_worker_count(serialization_workers);
+
+	VkApplicationInfo app_info = { VK_STRUCTURE_TYPE_APPLICATION_INFO };
+	app_info.pApplicationName = "binary";
+	app_info.apiVersion = VK_API_VERSION_1_1;
+	if (!recorder.record_application_info(app_info))
+		return false;
+
+	recorder.init_recording_thread(db.get());
+	record_samplers(recorder);
+	record_set_layouts(recorder);
+	record_pipeline_layouts(recorder);
+	record_shader_modules(recorder);
+	record_render_passes(recorder);
+	record_compute_pipelines(recorder);
+	record_graphics_pipelines(recorder);
+	recorder.tear_down_recording_thread();
+	return true;
+}
+
+static bool read_blob(DatabaseInterface &db, ResourceTag tag, Hash hash, std::vector<uint8_t> &blob)
+{
+	size_t blob_size = 0;
+	if (!db.read_entry(tag, hash, &blob_size, nullptr, 0))
+		return false;
+	blob.resize(blob_size);
+	return db.read_entry(tag, hash, &blob_size, blob.data(), 0);
+}
+
+static bool test_binary_payloads()
+{
+	if (!record_all_to_archive(".__test_json.foz", PayloadEncoding::JSON))
+		return false;
+	if (!record_all_to_archive(".__test_binary.foz", PayloadEncoding::Binary))
+		return false;
+
+	std::unique_ptr<DatabaseInterface> json_db(create_stream_archive_database(".__test_json.foz", DatabaseMode::ReadOnly));
+	std::unique_ptr<DatabaseInterface> binary_db(create_stream_archive_database(".__test_binary.foz", DatabaseMode::ReadOnly));
+	if (!json_db || !json_db->prepare() || !binary_db || !binary_db->prepare())
+		return false;
+
+	// Both directions of conversion must reproduce what the recorder wrote byte for byte.
+	PayloadConverter to_binary, to_json;
+	std::vector<uint8_t> json_blob, binary_blob;
+	unsigned binary_count = 0;
+
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		auto tag = static_cast<ResourceTag>(i);
+		size_t hash_count = 0;
+		if (!json_db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!json_db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			return false;
+
+		for (auto hash : hashes)
+		{
+			if (!read_blob(*json_db, tag, hash, json_blob) || !read_blob(*binary_db, tag, hash, binary_blob))
+				return false;
+
+			if (binary_blob != json_blob)
+			{
+				if (binary_blob.empty() || binary_blob.front() == '{')
+					return false;
+				binary_count++;
+			}
+
+			if (!to_binary.convert(tag, json_blob.data(), json_blob.size(), PayloadEncoding::Binary))
+				return false;
+			auto *converted = static_cast<const uint8_t *>(to_binary.get_data());
+			if (std::vector<uint8_t>(converted, converted + to_binary.get_size()) != binary_blob)
+				return false;
+
+			if (!to_json.convert(tag, binary_blob.data(), binary_blob.size(), PayloadEncoding::JSON))
+				return false;
+			converted = static_cast<const uint8_t *>(to_json.get_data());
+			if (std::vector<uint8_t>(converted, converted + to_json.get_size()) != json_blob)
+				return false;
+		}
+	}
+
+	if (binary_count == 0)
+		return false;
+
+	// Replaying the binary payloads must reproduce the recorded hashes.
+	StateReplayer replayer;
+	ReplayInterface iface;
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		auto tag = static_cast<ResourceTag>(i);
+		size_t hash_count = 0;
+		if (!binary_db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr))
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!binary_db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			return false;
+
+		for (auto hash : hashes)
+		{
+			if (!read_blob(*binary_db, tag, hash, binary_blob))
+				return false;
+			if (!replayer.parse(iface, binary_db.get(), binary_blob.data(), binary_blob.size()))
+				return false;
+		}
+	}
+
+	// Pipelines must replay on their own when trivial objects are pulled from the database on demand.
+	for (auto *db : { json_db.get(), binary_db.get() })
+	{
+		StateReplayer lazy_replayer;
+		ReplayInterface lazy_iface;
+		lazy_replayer.set_resolve_trivial_object_handles(true);
+		for (auto tag : { RESOURCE_COMPUTE_PIPELINE, RESOURCE_GRAPHICS_PIPELINE })
+		{
+			size_t hash_count = 0;
+			if (!db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr) || hash_count == 0)
+				return false;
+			std::vector<Hash> hashes(hash_count);
+			if (!db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+				return false;
+
+			for (auto hash : hashes)
+			{
+				if (!read_blob(*db, tag, hash, binary_blob))
+					return false;
+				if (!lazy_replayer.parse(lazy_iface, db, binary_blob.data(), binary_blob.size()))
+					return false;
+			}
+		}
+	}
+
+	// The application info entry is keyed on the application feature hash, which every link entry is derived from.
+	size_t hash_count = 0;
+	Hash application_hash = 0;
+	if (!binary_db->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_INFO, &hash_count, nullptr) || hash_count != 1 ||
+	    !binary_db->get_hash_list_for_resource_tag(RESOURCE_APPLICATION_INFO, &hash_count, &application_hash))
+		return false;
+	if (!binary_db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &hash_count, nullptr) || hash_count == 0)
+		return false;
+	std::vector<Hash> pipeline_hashes(hash_count);
+	if (!binary_db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &hash_count, pipeline_hashes.data()))
+		return false;
+	for (auto hash : pipeline_hashes)
+	{
+		if (!binary_db->has_entry(RESOURCE_APPLICATION_BLOB_LINK, Hashing::compute_hash_application_info_link(
+				application_hash, RESOURCE_GRAPHICS_PIPELINE, hash)))
+			return false;
+		if (binary_db->has_entry(RESOURCE_APPLICATION_BLOB_LINK, Hashing::compute_hash_application_info_link(
+				application_hash + 1, RESOURCE_GRAPHICS_PIPELINE, hash)))
+			return false;
+	}
+
+	// Truncated payloads must be rejected rather than read out of bounds.
+	hash_count = 0;
+	if (!binary_db->get_hash_list_for_resource_tag(RESOURCE_SAMPLER, &hash_count, nullptr) || hash_count == 0)
+		return false;
+	std::vector<Hash> sampler_hashes(hash_count);
+	if (!binary_db->get_hash_list_for_resource_tag(RESOURCE_SAMPLER, &hash_count, sampler_hashes.data()))
+		return false;
+	if (!read_blob(*binary_db, RESOURCE_SAMPLER, sampler_hashes.front(), binary_blob))
+		return false;
+	for (size_t size = 4; size < binary_blob.size(); size++)
+	{
+		StateReplayer truncated_replayer;
+		ReplayInterface truncated_iface;
+		if (truncated_replayer.parse(truncated_iface, nullptr, binary_blob.data(), size))
 			return false;
 	}
 
-	static const char *extra_paths[] = {
-		".__test_concurrent.1.foz",
-		".__test_concurrent.2.foz",
-		".__test_concurrent.3.foz",
+	remove(".__test_json.foz");
+	remove(".__test_binary.foz");
+	return true;
+}
+
+static bool count_entries(const char *path, ResourceTag tag, size_t *count)
+{
+	std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(path, DatabaseMode::ReadOnly));
+	if (!db || !db->prepare())
+		return false;
+	return db->get_hash_list_for_resource_tag(tag, count, nullptr);
+}
+
+static bool test_diff_databases()
+{
+	static const char *paths[] = { ".__test_diff_base.foz", ".__test_diff_new.foz", ".__test_diff_delta.foz" };
+	for (auto *path : paths)
+		remove(path);
+
+	const auto make_entry = [](Hash hash) -> std::vector<uint8_t> {
+		std::vector<uint8_t> entry(32 + hash % 100);
+		for (size_t i = 0; i < entry.size(); i++)
+			entry[i] = uint8_t(hash + i / 16);
+		return entry;
 	};
-	auto replay_db = std::unique_ptr<DatabaseInterface>(
-			create_concurrent_database(nullptr, DatabaseMode::ReadOnly, extra_paths, 3));
 
-	if (!replay_db->load_whitelist_database(".__test_concurrent_whitelist.foz"))
+	// The new archive keeps most of the base and adds a few entries on top.
+	for (unsigned archive = 0; archive < 2; archive++)
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(paths[archive], DatabaseMode::OverWrite));
+		if (!db->prepare())
+			return false;
+
+		for (Hash hash = archive ? 3 : 1; hash <= (archive ? 40 : 32); hash++)
+		{
+			auto entry = make_entry(hash);
+			PayloadWriteFlags flags = PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT;
+			if (hash & 1)
+				flags |= PAYLOAD_WRITE_COMPRESS_BIT;
+			ResourceTag tag = (hash & 2) ? RESOURCE_SHADER_MODULE : RESOURCE_GRAPHICS_PIPELINE;
+			if (!db->write_entry(tag, hash, entry.data(), entry.size(), flags))
+				return false;
+		}
+	}
+
+	DatabaseDiffStatistics stats = {};
+	if (!diff_concurrent_databases(paths[2], paths, 1, paths[1], &stats))
 		return false;
-	replay_db->promote_sub_database_to_whitelist(3);
-	if (!replay_db || !replay_db->prepare())
+	if (stats.new_entry_count != 38 || stats.delta_entry_count != 8)
 		return false;
 
-	// This should be whitelisted by primary whitelist.
-	if (!replay_db->has_entry(RESOURCE_SHADER_MODULE, 1))
+	// A base which does not exist must not silently turn into a full copy.
+	static const char *missing_base = ".__test_diff_missing.foz";
+	if (diff_concurrent_databases(paths[2], &missing_base, 1, paths[1], nullptr))
 		return false;
-	// Should not exist.
-	if (replay_db->has_entry(RESOURCE_SHADER_MODULE, 2))
-		return false;
-	if (replay_db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 2))
+	if (!diff_concurrent_databases(paths[2], paths, 1, paths[1], nullptr))
 		return false;
-	if (replay_db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 3))
+
+	size_t delta_count = 0;
+	if (!count_entries(paths[2], RESOURCE_SHADER_MODULE, &delta_count) || delta_count != 4)
 		return false;
-	// Should be whitelisted by implicit whitelist.
-	if (!replay_db->has_entry(RESOURCE_COMPUTE_PIPELINE, 3))
+	if (!count_entries(paths[2], RESOURCE_GRAPHICS_PIPELINE, &delta_count) || delta_count != 4)
 		return false;
-	if (!replay_db->has_entry(RESOURCE_COMPUTE_PIPELINE, 4))
+
+	// Base and delta stacked together must provide everything.
+	const char *stacked_paths[] = { paths[0], paths[2] };
+	auto stacked = std::unique_ptr<DatabaseInterface>(create_concurrent_database(nullptr, DatabaseMode::ReadOnly, stacked_paths, 2));
+	if (!stacked->prepare())
 		return false;
 
-	size_t size = 0;
-	Hash hashes[3];
+	for (Hash hash = 1; hash <= 40; hash++)
+	{
+		ResourceTag tag = (hash & 2) ? RESOURCE_SHADER_MODULE : RESOURCE_GRAPHICS_PIPELINE;
+		std::vector<uint8_t> blob;
+		if (!read_blob(*stacked, tag, hash, blob) || blob != make_entry(hash))
+			return false;
 
-	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &size, nullptr) || size != 1)
-		return false;
-	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &size, hashes) || size != 1)
-		return false;
-	if (hashes[0] != 1)
-		return false;
+		const char *db_path = stacked->get_db_path_for_hash(tag, hash);
+		if (!db_path || strcmp(db_path, hash <= 32 ? paths[0] : paths[2]) != 0)
+			return false;
+	}
 
-	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &size, nullptr) || size != 0)
+	stacked.reset();
+	for (auto *path : paths)
+		remove(path);
+	return true;
+}
+
+static bool record_queue_from_threads(RecordQueueMode mode, bool with_set_layouts, unsigned serialization_workers,
+                                      uint64_t *dropped)
+{
+	static const unsigned thread_count = 4;
+	static const unsigned samplers_per_thread = 500;
+
+	std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_record_queue.foz", DatabaseMode::OverWrite));
+	if (!db || !db->prepare())
 		return false;
 
-	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &size, nullptr) || size != 2)
+	StateRecorder recorder;
+	// Tiny ring, so producers constantly run into a full queue.
+	recorder.set_record_queue_mode(mode, 2);
+	recorder.set_serialization_worker_count(serialization_workers);
+	recorder.init_recording_thread(db.get());
+
+	std::atomic<unsigned> failures;
+	failures = 0;
+
+	std::vector<std::thread> threads;
+	for (unsigned thread_index = 0; thread_index < thread_count; thread_index++)
+	{
+		threads.emplace_back([&, thread_index]() {
+			VkSamplerCreateInfo sampler = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+			VkSampler handle = VK_NULL_HANDLE;
+			for (unsigned i = 0; i < samplers_per_thread; i++)
+			{
+				sampler.minLod = float(thread_index * samplers_per_thread + i);
+				handle = fake_handle<VkSampler>(1000 + thread_index * samplers_per_thread + i);
+				if (!recorder.record_sampler(handle, sampler))
+					failures++;
+			}
+
+			// Refers to the last sampler, which the recording thread must have seen first.
+			if (with_set_layouts)
+			{
+				VkDescriptorSetLayoutBinding binding = {};
+				binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+				binding.descriptorCount = 1;
+				binding.pImmutableSamplers = &handle;
+				VkDescriptorSetLayoutCreateInfo layout = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+				layout.bindingCount = 1;
+				layout.pBindings = &binding;
+				if (!recorder.record_descriptor_set_layout(fake_handle<VkDescriptorSetLayout>(10 + thread_index), layout))
+					failures++;
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+	recorder.tear_down_recording_thread();
+	*dropped = recorder.get_dropped_record_count();
+	db.reset();
+
+	size_t sampler_count = 0;
+	size_t layout_count = 0;
+	if (!count_entries(".__test_record_queue.foz", RESOURCE_SAMPLER, &sampler_count))
 		return false;
-	if (!replay_db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &size, hashes) || size != 2)
+	if (!count_entries(".__test_record_queue.foz", RESOURCE_DESCRIPTOR_SET_LAYOUT, &layout_count))
 		return false;
-	if (hashes[0] != 3)
+	remove(".__test_record_queue.foz");
+
+	if (failures != 0)
 		return false;
-	if (hashes[1] != 4)
+	if (sampler_count + *dropped != thread_count * samplers_per_thread)
 		return false;
-
-	// We have no primary database.
-	if (replay_db->get_sub_database(0))
+	if (with_set_layouts && layout_count != thread_count)
 		return false;
-	if (!replay_db->get_sub_database(1))
+	return true;
+}
+
+static bool test_record_queue_modes()
+{
+	uint64_t dropped = 0;
+	if (!record_queue_from_threads(RecordQueueMode::Unbounded, true, 0, &dropped) || dropped != 0)
 		return false;
-	if (!replay_db->get_sub_database(2))
+	if (!record_queue_from_threads(RecordQueueMode::Block, true, 0, &dropped) || dropped != 0)
 		return false;
-	if (!replay_db->get_sub_database(3))
+	if (!record_queue_from_threads(RecordQueueMode::Drop, false, 0, &dropped))
 		return false;
-	if (replay_db->get_sub_database(4))
+	LOGI("Dropped %" PRIu64 " samplers with a full record queue.\n", dropped);
+	return true;
+}
+
+static bool read_whole_file(const char *path, std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
 		return false;
 
-	replay_db.reset();
-	remove(".__test_concurrent.1.foz");
-	remove(".__test_concurrent.2.foz");
-	remove(".__test_concurrent.3.foz");
-	remove(".__test_concurrent_whitelist.foz");
+	data.clear();
+	uint8_t buffer[4096];
+	size_t read_size;
+	while ((read_size = fread(buffer, 1, sizeof(buffer), file)) != 0)
+		data.insert(data.end(), buffer, buffer + read_size);
+	fclose(file);
 	return true;
 }
 
-static bool test_filter()
+#ifndef _WIN32
+// Serves byte ranges of a file over HTTP, one connection at a time, like a static file server would.
+struct TestRangeServer
 {
-	static const uint8_t blob[4] = { 1, 2, 3, 4 };
-
+	bool start(std::vector<uint8_t> data_)
 	{
-		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_filter.foz",
-		                                                                             DatabaseMode::OverWrite));
-		if (!db->prepare())
+		data = std::move(data_);
+		listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (listen_fd < 0)
 			return false;
 
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 10, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-			return false;
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 11, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-			return false;
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 12, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
+		sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t addr_size = sizeof(addr);
+		if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listen_fd, 4) != 0 ||
+		    getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &addr_size) != 0)
 			return false;
 
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 10, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-			return false;
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 11, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-			return false;
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 12, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-			return false;
+		url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/test.foz";
+		thread = std::thread([this]() { serve(); });
+		return true;
+	}
 
-		if (!db->write_entry(RESOURCE_COMPUTE_PIPELINE, 10, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-			return false;
-		if (!db->write_entry(RESOURCE_COMPUTE_PIPELINE, 11, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-			return false;
-		if (!db->write_entry(RESOURCE_COMPUTE_PIPELINE, 12, blob, sizeof(blob), PAYLOAD_WRITE_NO_FLAGS))
-			return false;
+	~TestRangeServer()
+	{
+		if (listen_fd >= 0)
+		{
+			shutdown(listen_fd, SHUT_RDWR);
+			close(listen_fd);
+		}
+		if (thread.joinable())
+			thread.join();
 	}
 
+	void serve()
 	{
-		auto whitelist = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_whitelist.foz",
-		                                                                                   DatabaseMode::OverWrite));
-		auto blacklist = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_blacklist.foz",
-		                                                                                   DatabaseMode::OverWrite));
+		for (;;)
+		{
+			int fd = accept(listen_fd, nullptr, nullptr);
+			if (fd < 0)
+				return;
 
-		if (!whitelist->prepare())
-			return false;
-		if (!blacklist->prepare())
-			return false;
+			std::string request;
+			char buffer[4096];
+			for (;;)
+			{
+				auto end = request.find("\r\n\r\n");
+				if (end == std::string::npos)
+				{
+					ssize_t ret = recv(fd, buffer, sizeof(buffer), 0);
+					if (ret <= 0)
+						break;
+					request.append(buffer, size_t(ret));
+					continue;
+				}
+
+				uint64_t begin = 0, last = 0;
+				auto range = request.find("Range: bytes=");
+				if (range == std::string::npos || range > end ||
+				    sscanf(request.c_str() + range, "Range: bytes=%" SCNu64 "-%" SCNu64, &begin, &last) != 2 ||
+				    begin >= data.size())
+					break;
+				request.erase(0, end + 4);
+				last = std::min<uint64_t>(last, data.size() - 1);
+
+				std::string response = "HTTP/1.1 206 Partial Content\r\nETag: \"1\"\r\nContent-Length: " +
+				                       std::to_string(last - begin + 1) + "\r\nContent-Range: bytes " +
+				                       std::to_string(begin) + "-" + std::to_string(last) + "/" +
+				                       std::to_string(data.size()) + "\r\n\r\n";
+				response.append(data.begin() + begin, data.begin() + last + 1);
+				if (send(fd, response.data(), response.size(), 0) != ssize_t(response.size()))
+					break;
+				request_count++;
+			}
 
-		if (!whitelist->write_entry(RESOURCE_SHADER_MODULE, 10, nullptr, 0, 0))
-			return false;
-		if (!whitelist->write_entry(RESOURCE_SHADER_MODULE, 11, nullptr, 0, 0))
-			return false;
-		if (!whitelist->write_entry(RESOURCE_SHADER_MODULE, 12, nullptr, 0, 0))
-			return false;
+			close(fd);
+		}
+	}
 
-		if (!whitelist->write_entry(RESOURCE_GRAPHICS_PIPELINE, 11, nullptr, 0, 0))
-			return false;
-		if (!whitelist->write_entry(RESOURCE_GRAPHICS_PIPELINE, 12, nullptr, 0, 0))
-			return false;
-		if (!blacklist->write_entry(RESOURCE_GRAPHICS_PIPELINE, 10, nullptr, 0, 0))
-			return false;
+	std::vector<uint8_t> data;
+	std::string url;
+	int listen_fd = -1;
+	std::thread thread;
+	std::atomic<unsigned> request_count{ 0 };
+};
 
-		if (!whitelist->write_entry(RESOURCE_COMPUTE_PIPELINE, 10, nullptr, 0, 0))
-			return false;
-		if (!whitelist->write_entry(RESOURCE_COMPUTE_PIPELINE, 12, nullptr, 0, 0))
-			return false;
-		if (!blacklist->write_entry(RESOURCE_COMPUTE_PIPELINE, 11, nullptr, 0, 0))
-			return false;
-	}
+static bool test_remote_archive()
+{
+	static const char *local_path = ".__test_remote.foz";
+	static const char *cache_dir = ".__test_remote_cache";
+	static const unsigned entry_count = 400;
+	remove(local_path);
+	mkdir(cache_dir, 0755);
+
+	const auto make_entry = [](Hash hash) -> std::vector<uint8_t> {
+		std::vector<uint8_t> entry(4000 + hash % 1000);
+		uint32_t state = uint32_t(hash) * 0x9e3779b9u + 1;
+		for (auto &b : entry)
+		{
+			state = state * 1664525u + 1013904223u;
+			b = uint8_t(state >> 24);
+		}
+		return entry;
+	};
 
-	for (unsigned i = 0; i < 3; i++)
 	{
-		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_filter.foz",
-		                                                                            DatabaseMode::ReadOnly));
-		switch (i)
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(local_path, DatabaseMode::OverWrite));
+		if (!db->prepare())
+			return false;
+		for (Hash hash = 1; hash <= entry_count; hash++)
 		{
-		case 0:
-			if (!db->load_whitelist_database(i ? ".__test_blacklist.foz" : ".__test_whitelist.foz"))
+			auto entry = make_entry(hash);
+			PayloadWriteFlags flags = (hash & 1) ? PAYLOAD_WRITE_COMPRESS_BIT | PAYLOAD_WRITE_COMPUTE_CHECKSUM_BIT : 0;
+			if (!db->write_entry(RESOURCE_SHADER_MODULE, hash, entry.data(), entry.size(), flags))
 				return false;
-			break;
+		}
+	}
 
-		case 1:
-			if (!db->load_blacklist_database(".__test_blacklist.foz"))
-				return false;
-			break;
+	std::vector<uint8_t> archive_data;
+	if (!read_whole_file(local_path, archive_data))
+		return false;
 
-		case 2:
-			if (!db->load_whitelist_database(".__test_whitelist.foz"))
-				return false;
-			if (!db->load_blacklist_database(".__test_blacklist.foz"))
-				return false;
-			break;
+	TestRangeServer server;
+	if (!server.start(archive_data))
+		return false;
 
-		default:
-			return false;
+	for (unsigned run = 0; run < 2; run++)
+	{
+		// The second run goes through the URL scheme, and picks up the cache directory from the environment.
+		std::unique_ptr<DatabaseInterface> db;
+		if (run == 0)
+			db.reset(create_remote_archive_database(server.url.c_str(), DatabaseMode::ReadOnly, cache_dir));
+		else
+		{
+			setenv("FOSSILIZE_REMOTE_CACHE_DIR", cache_dir, 1);
+			db.reset(create_database(server.url.c_str(), DatabaseMode::ReadOnly));
+			unsetenv("FOSSILIZE_REMOTE_CACHE_DIR");
 		}
-
 		if (!db->prepare())
 			return false;
 
-		size_t count;
-		Hash hashes[3];
+		// Only the start and the index at the end are needed to open the archive.
+		unsigned prepare_requests = server.request_count.exchange(0);
+		if (run == 0 && (prepare_requests < 2 || prepare_requests > 4))
+			return false;
 
-		// Test whitelist filtering of different types.
-		if (!db->has_entry(RESOURCE_SHADER_MODULE, 10))
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &hash_count, nullptr) || hash_count != entry_count)
 			return false;
-		if (!db->has_entry(RESOURCE_SHADER_MODULE, 11))
+		std::vector<Hash> hashes(hash_count);
+		if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &hash_count, hashes.data()))
 			return false;
-		if (!db->has_entry(RESOURCE_SHADER_MODULE, 12))
+
+		// The entries span a few dozen blocks, which is well within one request.
+		if (!db->prefetch_entries(RESOURCE_SHADER_MODULE, hashes.data(), hashes.size()))
 			return false;
-		if (db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 10))
+		if (server.request_count.exchange(0) > (run == 0 ? 1u : 0u))
 			return false;
-		if (db->has_entry(RESOURCE_COMPUTE_PIPELINE, 11))
+
+		for (auto hash : hashes)
+		{
+			std::vector<uint8_t> blob;
+			if (!read_blob(*db, RESOURCE_SHADER_MODULE, hash, blob) || blob != make_entry(hash))
+				return false;
+		}
+
+		// Everything is cached by now, and the second run starts out with the cache of the first.
+		if (server.request_count.exchange(0) != 0)
 			return false;
+	}
 
-		// Test get_hash_list.
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, nullptr))
+	DIR *dir = opendir(cache_dir);
+	if (dir)
+	{
+		while (auto *entry = readdir(dir))
+			if (entry->d_name[0] != '.')
+				remove((std::string(cache_dir) + "/" + entry->d_name).c_str());
+		closedir(dir);
+	}
+	remove_directory(cache_dir);
+	remove(local_path);
+	return true;
+}
+#endif
+
+static bool test_serialization_workers()
+{
+	if (!record_all_to_archive(".__test_serial.foz", PayloadEncoding::JSON))
+		return false;
+	if (!record_all_to_archive(".__test_workers.foz", PayloadEncoding::JSON, 3))
+		return false;
+
+	std::unique_ptr<DatabaseInterface> serial_db(create_stream_archive_database(".__test_serial.foz", DatabaseMode::ReadOnly));
+	std::unique_ptr<DatabaseInterface> workers_db(create_stream_archive_database(".__test_workers.foz", DatabaseMode::ReadOnly));
+	if (!serial_db || !serial_db->prepare() || !workers_db || !workers_db->prepare())
+		return false;
+
+	// Entries are written in recording order regardless of workers, so the archives are identical.
+	std::vector<uint8_t> serial_file, workers_file;
+	if (!read_whole_file(".__test_serial.foz", serial_file) || !read_whole_file(".__test_workers.foz", workers_file))
+		return false;
+	if (serial_file != workers_file)
+		return false;
+
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+	{
+		auto tag = static_cast<ResourceTag>(i);
+		size_t serial_count = 0, workers_count = 0;
+		if (!serial_db->get_hash_list_for_resource_tag(tag, &serial_count, nullptr))
 			return false;
-		if (count != 3)
+		if (!workers_db->get_hash_list_for_resource_tag(tag, &workers_count, nullptr))
 			return false;
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, hashes))
+		if (serial_count != workers_count)
 			return false;
 
-		static const Hash expected_0[3] = { 10, 11, 12 };
-		if (memcmp(expected_0, hashes, sizeof(expected_0)) != 0)
+		std::vector<Hash> hashes(serial_count);
+		if (!serial_db->get_hash_list_for_resource_tag(tag, &serial_count, hashes.data()))
 			return false;
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &count, nullptr))
-			return false;
-		if (count != 2)
-			return false;
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &count, hashes))
-			return false;
+		for (auto hash : hashes)
+		{
+			std::vector<uint8_t> serial_blob, workers_blob;
+			if (!read_blob(*serial_db, tag, hash, serial_blob) || !read_blob(*workers_db, tag, hash, workers_blob))
+				return false;
+			if (serial_blob != workers_blob)
+				return false;
+		}
+	}
 
-		static const Hash expected_1[2] = { 11, 12 };
-		if (memcmp(expected_1, hashes, sizeof(expected_1)) != 0)
+	uint64_t dropped = 0;
+	if (!record_queue_from_threads(RecordQueueMode::Unbounded, true, 2, &dropped) || dropped != 0)
+		return false;
+
+	serial_db.reset();
+	workers_db.reset();
+	remove(".__test_serial.foz");
+	remove(".__test_workers.foz");
+	return true;
+}
+
+static bool test_buffered_database_flush()
+{
+	remove(".__test_buffered.foz");
+
+	{
+		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_buffered.foz", DatabaseMode::OverWrite));
+		DatabaseAsyncWritePolicy policy;
+		policy.batch_size = 64 * 1024 * 1024;
+		policy.flush_interval_ms = 0;
+		if (!db->set_async_write_policy(policy))
 			return false;
 
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &count, nullptr))
-			return false;
-		if (count != 2)
+		StateRecorder recorder;
+		recorder.set_database_flush_on_idle(false);
+		recorder.init_recording_thread(db.get());
+		record_samplers(recorder);
+		record_set_layouts(recorder);
+		record_shader_modules(recorder);
+
+		// Nothing but the header may reach the disk, even once the recording thread has been idle for a while.
+		std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+		std::vector<uint8_t> data;
+		if (!read_whole_file(".__test_buffered.foz", data) || data.size() > 16)
 			return false;
-		if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &count, hashes))
+
+		recorder.request_database_flush();
+		for (unsigned i = 0; i < 5000 && data.size() <= 16; i++)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			if (!read_whole_file(".__test_buffered.foz", data))
+				return false;
+		}
+
+		if (data.size() <= 16)
 			return false;
+	}
 
-		static const Hash expected_2[2] = { 10, 12 };
-		if (memcmp(expected_2, hashes, sizeof(expected_2)) != 0)
+	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_buffered.foz", DatabaseMode::ReadOnly));
+	if (!db->prepare())
+		return false;
+
+	for (auto tag : { RESOURCE_SAMPLER, RESOURCE_DESCRIPTOR_SET_LAYOUT, RESOURCE_SHADER_MODULE })
+	{
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr) || hash_count == 0)
 			return false;
 	}
 
-	remove(".__test_filter.foz");
-	remove(".__test_whitelist.foz");
-	remove(".__test_blacklist.foz");
+	db.reset();
+	remove(".__test_buffered.foz");
 	return true;
 }
 
-static bool test_export_single_archive()
+static bool test_persisted_objects_are_released()
 {
-	static const uint16_t one = 1;
-	static const uint32_t two = 2;
-	static const uint64_t three = 3;
-	char export_path[DatabaseInterface::OSHandleNameSize];
-	DatabaseInterface::get_unique_os_export_name(export_path, sizeof(export_path));
+	static const unsigned layout_count = 2000;
 
-	{
-		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz",
-		                                                                            DatabaseMode::OverWrite));
-		if (!db || !db->prepare())
-			return false;
+	std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_release.foz", DatabaseMode::OverWrite));
+	if (!db || !db->prepare())
+		return false;
 
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 1, &one, sizeof(one), 0))
-			return false;
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 2, &two, sizeof(two), 0))
-			return false;
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 3, &three, sizeof(three), 0))
-			return false;
+	StateRecorder recorder;
+	recorder.init_recording_thread(db.get());
 
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 300, &one, sizeof(one), 0))
-			return false;
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 200, &two, sizeof(two), 0))
-			return false;
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 100, &three, sizeof(three), 0))
-			return false;
+	VkDescriptorSetLayoutBinding bindings[8] = {};
+	for (unsigned i = 0; i < 8; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		bindings[i].descriptorCount = 1;
 	}
 
-	intptr_t handle;
+	VkDescriptorSetLayoutCreateInfo layout = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	layout.bindingCount = 8;
+	layout.pBindings = bindings;
+
+	for (unsigned i = 0; i < layout_count; i++)
 	{
-		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz", DatabaseMode::ReadOnly));
-		if (!db || !db->prepare())
-			return false;
-		handle = db->export_metadata_to_os_handle(export_path);
-#ifdef __WIN32
-		if (handle == 0)
+		bindings[0].stageFlags = i;
+		if (!recorder.record_descriptor_set_layout(fake_handle<VkDescriptorSetLayout>(1000 + i), layout))
 			return false;
-#else
-		if (handle < 0)
-			return false;
-#endif
 	}
+	recorder.tear_down_recording_thread();
 
-	auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz", DatabaseMode::ReadOnly));
-	if (!db || !db->import_metadata_from_os_handle(handle) || !db->prepare())
+	// Written objects are remapped in place in their captured copy, so the recorder never copies them again.
+	if (recorder.get_allocator().get_peak_memory_consumption() != 0)
 		return false;
 
-	size_t count;
+	// Only the handle to hash mapping remains.
+	Hash first = 0, last = 0;
+	if (!recorder.get_hash_for_descriptor_set_layout(fake_handle<VkDescriptorSetLayout>(1000), &first))
+		return false;
+	if (!recorder.get_hash_for_descriptor_set_layout(fake_handle<VkDescriptorSetLayout>(1000 + layout_count - 1), &last))
+		return false;
+	if (first == last || !db->has_entry(RESOURCE_DESCRIPTOR_SET_LAYOUT, last))
+		return false;
 
-	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
-	{
-		if (!db->get_hash_list_for_resource_tag(ResourceTag(i), &count, nullptr))
-			return false;
+	db.reset();
+	remove(".__test_release.foz");
+	return true;
+}
 
-		switch (ResourceTag(i))
+static bool test_scratch_allocator()
+{
+	ScratchAllocator alloc(4096);
+
+	// Two cycles with the same shape should be served entirely from retained blocks the second time.
+	for (unsigned cycle = 0; cycle < 2; cycle++)
+	{
+		for (unsigned i = 0; i < 64; i++)
 		{
-		case RESOURCE_GRAPHICS_PIPELINE:
-		case RESOURCE_SHADER_MODULE:
-			if (count != 3)
+			auto *data = static_cast<uint8_t *>(alloc.allocate_raw(1000 + i, 16));
+			if (!data || (reinterpret_cast<uintptr_t>(data) & 15) != 0)
 				return false;
-			break;
+			memset(data, int(i), 1000 + i);
+		}
 
-		default:
-			if (count != 0)
+		auto *cleared = static_cast<uint8_t *>(alloc.allocate_raw_cleared(10000, 64));
+		for (unsigned i = 0; i < 10000; i++)
+			if (cleared[i] != 0)
 				return false;
-			break;
-		}
+		alloc.reset();
 	}
 
-	Hash hashes[3];
-	count = 3;
-	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, hashes))
+	auto stats = alloc.get_statistics();
+	if (stats.block_reuses != stats.block_allocations || stats.reused_bytes != stats.allocated_bytes)
 		return false;
-	static const Hash reference_hashes_module[3] = { 1, 2, 3 };
-	static const Hash reference_hashes_pipeline[3] = { 100, 200, 300 };
-	if (memcmp(reference_hashes_module, hashes, sizeof(hashes)) != 0)
+	if (stats.retained_bytes > alloc.get_peak_memory_consumption() || stats.retained_bytes == 0)
 		return false;
 
-	if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &count, hashes))
+	// Nothing retained, next cycle has to allocate again.
+	alloc.set_max_retained_size(0);
+	alloc.allocate_raw(100, 16);
+	alloc.reset();
+	if (alloc.get_statistics().retained_bytes != 0)
 		return false;
-	if (memcmp(reference_hashes_pipeline, hashes, sizeof(hashes)) != 0)
+	alloc.allocate_raw(100, 16);
+	if (alloc.get_statistics().block_allocations != stats.block_allocations + 1)
 		return false;
 
-	union
-	{
-		uint16_t u16;
-		uint32_t u32;
-		uint64_t u64;
-	} u;
-
-	size_t blob_size;
-
-	blob_size = sizeof(u.u16);
-	if (!db->read_entry(RESOURCE_SHADER_MODULE, 1, &blob_size, &u.u16, 0) || u.u16 != one)
+	// Huge page backed blocks must behave like any other block.
+	alloc.set_max_retained_size(SIZE_MAX);
+	alloc.set_huge_page_threshold(64 * 1024);
+	auto *large = static_cast<uint8_t *>(alloc.allocate_raw(3 * 1024 * 1024, 4096));
+	if (!large)
 		return false;
-
-	blob_size = sizeof(u.u32);
-	if (!db->read_entry(RESOURCE_SHADER_MODULE, 2, &blob_size, &u.u32, 0) || u.u32 != two)
+	memset(large, 0xab, 3 * 1024 * 1024);
+	alloc.reset();
+	if (alloc.get_statistics().retained_bytes < 3 * 1024 * 1024)
 		return false;
 
-	blob_size = sizeof(u.u64);
-	if (!db->read_entry(RESOURCE_SHADER_MODULE, 3, &blob_size, &u.u64, 0) || u.u64 != three)
+	// The process-wide counter follows blocks of every allocator, and forgets them once they are freed.
+	size_t process_bytes = ScratchAllocator::get_process_memory_usage();
+	if (process_bytes < alloc.get_statistics().retained_bytes)
 		return false;
+	{
+		ScratchAllocator other;
+		other.allocate_raw(100, 16);
+		if (ScratchAllocator::get_process_memory_usage() != process_bytes + other.get_statistics().retained_bytes)
+			return false;
+	}
+	return ScratchAllocator::get_process_memory_usage() == process_bytes;
+}
 
-	if (db->has_entry(RESOURCE_SHADER_MODULE, 0) || db->has_entry(RESOURCE_SHADER_MODULE, 4))
-		return false;
+static bool record_canonicalized_pipelines(bool canonicalize, Hash hashes[3])
+{
+	StateRecorder recorder;
+	recorder.set_canonicalize_pipeline_state(canonicalize);
+	recorder.init_recording_thread(nullptr);
+	record_samplers(recorder);
+	record_set_layouts(recorder);
+	record_pipeline_layouts(recorder);
+	record_render_passes(recorder);
 
-	blob_size = sizeof(u.u16);
-	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 300, &blob_size, &u.u16, 0) || u.u16 != one)
-		return false;
+	VkGraphicsPipelineCreateInfo pipe = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	pipe.layout = fake_handle<VkPipelineLayout>(10000);
+	pipe.renderPass = fake_handle<VkRenderPass>(30000);
 
-	blob_size = sizeof(u.u32);
-	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 200, &blob_size, &u.u32, 0) || u.u32 != two)
+	static const VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT };
+	VkPipelineDynamicStateCreateInfo dyn = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+	dyn.dynamicStateCount = 1;
+	dyn.pDynamicStates = dynamic_states;
+	VkPipelineViewportStateCreateInfo vp = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+	VkViewport viewport = { 0.0f, 0.0f, 1920.0f, 1080.0f, 0.0f, 1.0f };
+	vp.viewportCount = 1;
+	vp.pViewports = &viewport;
+	VkPipelineDepthStencilStateCreateInfo ds = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+	ds.front.failOp = VK_STENCIL_OP_REPLACE;
+	VkPipelineColorBlendAttachmentState att = {};
+	att.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	att.colorWriteMask = 0xf;
+	VkPipelineColorBlendStateCreateInfo blend = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+	blend.attachmentCount = 1;
+	blend.pAttachments = &att;
+	blend.blendConstants[0] = 0.5f;
+	pipe.pDynamicState = &dyn;
+	pipe.pViewportState = &vp;
+	pipe.pDepthStencilState = &ds;
+	pipe.pColorBlendState = &blend;
+	if (!recorder.record_graphics_pipeline(fake_handle<VkPipeline>(100000), pipe, nullptr, 0))
 		return false;
 
-	blob_size = sizeof(u.u64);
-	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 100, &blob_size, &u.u64, 0) || u.u64 != three)
+	// Only differs in state which is ignored.
+	viewport.width = 1280.0f;
+	ds.front.failOp = VK_STENCIL_OP_ZERO;
+	ds.back.writeMask = 0xff;
+	att.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	blend.blendConstants[0] = 0.0f;
+	if (!recorder.record_graphics_pipeline(fake_handle<VkPipeline>(100001), pipe, nullptr, 0))
 		return false;
 
-	if (db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 150) ||
-	    db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 99) ||
-	    db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 400))
+	// With blending enabled the factors are relevant again.
+	att.blendEnable = VK_TRUE;
+	if (!recorder.record_graphics_pipeline(fake_handle<VkPipeline>(100002), pipe, nullptr, 0))
 		return false;
+	recorder.tear_down_recording_thread();
 
-	db.reset();
-	remove(".__test_archive.foz");
+	for (unsigned i = 0; i < 3; i++)
+		if (!recorder.get_hash_for_graphics_pipeline_handle(fake_handle<VkPipeline>(100000 + i), &hashes[i]))
+			return false;
 	return true;
 }
 
-static bool test_export_concurrent_archive(bool with_read_only)
+static bool test_canonicalize_pipeline_state()
 {
-	remove(".__test_archive.foz");
-	static const uint16_t one = 1;
-	static const uint32_t two = 2;
-	static const uint64_t three = 3;
-	static const uint8_t four = 4;
+	Hash hashes[3];
+	if (!record_canonicalized_pipelines(false, hashes))
+		return false;
+	if (hashes[0] == hashes[1] || hashes[1] == hashes[2])
+		return false;
 
-	char export_path[DatabaseInterface::OSHandleNameSize];
-	DatabaseInterface::get_unique_os_export_name(export_path, sizeof(export_path));
+	if (!record_canonicalized_pipelines(true, hashes))
+		return false;
+	return hashes[0] == hashes[1] && hashes[1] != hashes[2];
+}
 
-	if (with_read_only)
+static bool test_skip_prior_objects()
+{
+	static const Hash prior_pipeline_hash = 0x1234;
+	remove(".__test_prior.foz");
+	remove(".__test_prior.1.foz");
+
+	// A prior session, whose archive becomes the read-only part of the concurrent database.
 	{
-		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive.foz",
-		                                                                            DatabaseMode::OverWrite));
+		std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_prior.foz", DatabaseMode::OverWrite));
 		if (!db || !db->prepare())
 			return false;
+		StateRecorder recorder;
+		recorder.init_recording_thread(db.get());
+		record_shader_modules(recorder);
+		recorder.tear_down_recording_thread();
 
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 1000, &four, sizeof(four), 0))
-			return false;
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 1300, &four, sizeof(four), 0))
+		static const uint8_t blob[] = { 1 };
+		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, prior_pipeline_hash, blob, sizeof(blob), 0))
 			return false;
 	}
 
-	{
-		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive1.foz",
-		                                                                            DatabaseMode::OverWrite));
-		if (!db || !db->prepare())
-			return false;
+	std::unique_ptr<DatabaseInterface> db(create_concurrent_database(".__test_prior", DatabaseMode::Append, nullptr, 0));
+	if (!db)
+		return false;
 
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 1, &one, sizeof(one), 0))
-			return false;
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 300, &one, sizeof(one), 0))
-			return false;
+	StateRecorder recorder;
+	recorder.set_skip_prior_objects(true);
+	recorder.init_recording_thread(db.get());
 
-		// Duplicate.
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 2, &two, sizeof(two), 0))
-			return false;
-	}
+	VkShaderModuleCreateInfo info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+	static const uint32_t code[] = { 0xdeadbeef, 0xcafebabe };
+	info.pCode = code;
+	info.codeSize = sizeof(code);
+	Hash module_hash = 0;
+	if (!Hashing::compute_hash_shader_module(info, &module_hash, recorder.get_hash_algorithm()))
+		return false;
 
-	{
-		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive2.foz",
-		                                                                            DatabaseMode::OverWrite));
-		if (!db || !db->prepare())
-			return false;
+	// The recording thread prepares the database in the background.
+	for (unsigned i = 0; i < 5000 && !recorder.has_prior_object(RESOURCE_SHADER_MODULE, module_hash); i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	if (!recorder.has_prior_object(RESOURCE_SHADER_MODULE, module_hash))
+		return false;
+	if (recorder.has_prior_object(RESOURCE_SHADER_MODULE, module_hash + 1))
+		return false;
 
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 2, &two, sizeof(two), 0))
-			return false;
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 200, &two, sizeof(two), 0))
-			return false;
-	}
+	if (!recorder.record_shader_module(fake_handle<VkShaderModule>(6000), info))
+		return false;
 
-	{
-		auto db = std::unique_ptr<DatabaseInterface>(create_stream_archive_database(".__test_archive3.foz",
-		                                                                            DatabaseMode::OverWrite));
-		if (!db || !db->prepare())
-			return false;
+	// Nothing this pipeline refers to was recorded, so it could only be recorded as a prior object.
+	VkGraphicsPipelineCreateInfo pipe = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	pipe.layout = fake_handle<VkPipelineLayout>(1);
+	pipe.renderPass = fake_handle<VkRenderPass>(1);
+	if (!recorder.record_graphics_pipeline(fake_handle<VkPipeline>(6001), pipe, nullptr, 0, prior_pipeline_hash))
+		return false;
+	recorder.tear_down_recording_thread();
 
-		if (!db->write_entry(RESOURCE_SHADER_MODULE, 3, &three, sizeof(three), 0))
-			return false;
-		if (!db->write_entry(RESOURCE_GRAPHICS_PIPELINE, 100, &three, sizeof(three), 0))
-			return false;
-	}
+	Hash hash = 0;
+	if (!recorder.get_hash_for_shader_module(fake_handle<VkShaderModule>(6000), &hash) || hash != module_hash)
+		return false;
+	if (!recorder.get_hash_for_graphics_pipeline_handle(fake_handle<VkPipeline>(6001), &hash) || hash != prior_pipeline_hash)
+		return false;
 
-	static const char *extra_paths[] = { ".__test_archive1.foz", ".__test_archive_bogus.foz", ".__test_archive2.foz", ".__test_archive3.foz" };
-	intptr_t handle;
+	// Only the application link of the pipeline is new, the objects themselves were not written again.
+	db.reset();
+	size_t module_count = 0, pipeline_count = 0, link_count = 0;
+	if (!count_entries(".__test_prior.1.foz", RESOURCE_SHADER_MODULE, &module_count) ||
+	    !count_entries(".__test_prior.1.foz", RESOURCE_GRAPHICS_PIPELINE, &pipeline_count) ||
+	    !count_entries(".__test_prior.1.foz", RESOURCE_APPLICATION_BLOB_LINK, &link_count))
+		return false;
+	if (module_count != 0 || pipeline_count != 0 || link_count != 1)
+		return false;
+
+	remove(".__test_prior.foz");
+	remove(".__test_prior.1.foz");
+	return true;
+}
+
+static bool test_recorder_statistics()
+{
+	std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_statistics.foz", DatabaseMode::OverWrite));
+	if (!db || !db->prepare())
+		return false;
+
+	StateRecorder recorder;
+	RecorderStatistics stats = {};
+	if (recorder.get_statistics(&stats))
+		return false;
+
+	recorder.set_statistics_enabled(true);
+	recorder.set_database_enable_compression(true);
+	recorder.init_recording_thread(db.get());
+	record_samplers(recorder);
+	record_shader_modules(recorder);
+	record_render_passes(recorder);
+	recorder.tear_down_recording_thread();
+
+	if (!recorder.get_statistics(&stats))
+		return false;
+
+	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
 	{
-		auto db = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_archive", DatabaseMode::ReadOnly, extra_paths, 4));
-		if (!db || !db->prepare())
-			return false;
-		handle = db->export_metadata_to_os_handle(export_path);
-#ifdef __WIN32
-		if (handle == 0)
+		auto &latency = stats.record_latency[i];
+		uint64_t bucket_total = 0;
+		for (auto count : latency.buckets)
+			bucket_total += count;
+		if (bucket_total != latency.count || latency.max_ns > latency.total_ns)
 			return false;
-#else
-		if (handle < 0)
-			return false;
-#endif
 	}
 
-	auto db = std::unique_ptr<DatabaseInterface>(create_concurrent_database(".__test_archive", DatabaseMode::ReadOnly, extra_paths, 4));
-	if (!db || !db->import_metadata_from_os_handle(handle) || !db->prepare())
+	// One sampler fails to record, but is still timed.
+	if (stats.record_latency[RESOURCE_SAMPLER].count != 3 ||
+	    stats.record_latency[RESOURCE_SHADER_MODULE].count != 2 ||
+	    stats.record_latency[RESOURCE_RENDER_PASS].count != 2 ||
+	    stats.record_latency[RESOURCE_GRAPHICS_PIPELINE].count != 0)
 		return false;
 
-	size_t expected_count = with_read_only ? 4 : 3;
-	size_t count;
+	if (stats.bytes_copied == 0 || stats.queue_high_water_mark == 0)
+		return false;
+
+	// Application info, six objects and their application links.
+	if (stats.database_entries_written != 13 || stats.database_bytes_written == 0)
+		return false;
+	// Application links are never compressed.
+	if (stats.compressed_payloads != 7 || stats.compression_input_bytes == 0)
+		return false;
+
+	db.reset();
+	remove(".__test_statistics.foz");
+	return true;
+}
 
-	for (unsigned i = 0; i < RESOURCE_COUNT; i++)
+static bool test_adaptive_compression()
+{
 	{
-		if (!db->get_hash_list_for_resource_tag(ResourceTag(i), &count, nullptr))
+		std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_adaptive.foz", DatabaseMode::OverWrite));
+		if (!db || !db->prepare())
 			return false;
 
-		switch (ResourceTag(i))
-		{
-		case RESOURCE_GRAPHICS_PIPELINE:
-		case RESOURCE_SHADER_MODULE:
-			if (count != expected_count)
-				return false;
-			break;
+		// Every object is part of the backlog, so only application info is compressed.
+		StateRecorder recorder;
+		recorder.set_statistics_enabled(true);
+		recorder.set_database_enable_compression(true);
+		recorder.set_database_adaptive_compression(1);
+		recorder.init_recording_thread(db.get());
+		record_samplers(recorder);
+		record_shader_modules(recorder);
+		record_render_passes(recorder);
+		recorder.tear_down_recording_thread();
 
-		default:
-			if (count != 0)
-				return false;
-			break;
-		}
+		RecorderStatistics stats = {};
+		if (!recorder.get_statistics(&stats))
+			return false;
+		if (stats.compressed_payloads != 1 || stats.uncompressed_backlog_payloads != 6)
+			return false;
 	}
 
-	Hash hashes[4];
-	count = expected_count;
-	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, hashes))
-		return false;
-	static const Hash reference_hashes_module[4] = { 1, 2, 3, 1000 };
-	static const Hash reference_hashes_pipeline[4] = { 100, 200, 300, 1300 };
-	if (memcmp(reference_hashes_module, hashes, sizeof(*hashes) * expected_count) != 0)
+	std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_adaptive.foz", DatabaseMode::ReadOnly));
+	if (!db || !db->prepare())
 		return false;
 
-	count = expected_count;
-	if (!db->get_hash_list_for_resource_tag(RESOURCE_GRAPHICS_PIPELINE, &count, hashes))
+	size_t count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, nullptr) || count != 2)
 		return false;
-	if (memcmp(reference_hashes_pipeline, hashes, sizeof(*hashes) * expected_count) != 0)
+	std::vector<Hash> hashes(count);
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_SHADER_MODULE, &count, hashes.data()))
 		return false;
-
-	union
+	for (auto hash : hashes)
 	{
-		uint8_t u8;
-		uint16_t u16;
-		uint32_t u32;
-		uint64_t u64;
-	} u;
+		size_t size = 0;
+		if (!db->read_entry(RESOURCE_SHADER_MODULE, hash, &size, nullptr, 0) || size == 0)
+			return false;
+	}
 
-	size_t blob_size;
+	db.reset();
+	remove(".__test_adaptive.foz");
+	return true;
+}
 
-	blob_size = sizeof(u.u16);
-	if (!db->read_entry(RESOURCE_SHADER_MODULE, 1, &blob_size, &u.u16, 0) || u.u16 != one)
-		return false;
+struct PipelineUsageCollector : StateCreatorInterface
+{
+	std::unordered_map<Hash, uint64_t> usage[RESOURCE_COUNT];
 
-	blob_size = sizeof(u.u32);
-	if (!db->read_entry(RESOURCE_SHADER_MODULE, 2, &blob_size, &u.u32, 0) || u.u32 != two)
-		return false;
+	bool enqueue_create_sampler(Hash, const VkSamplerCreateInfo *, VkSampler *) override { return true; }
+	bool enqueue_create_descriptor_set_layout(Hash, const VkDescriptorSetLayoutCreateInfo *, VkDescriptorSetLayout *) override { return true; }
+	bool enqueue_create_pipeline_layout(Hash, const VkPipelineLayoutCreateInfo *, VkPipelineLayout *) override { return true; }
+	bool enqueue_create_shader_module(Hash, const VkShaderModuleCreateInfo *, VkShaderModule *) override { return true; }
+	bool enqueue_create_render_pass(Hash, const VkRenderPassCreateInfo *, VkRenderPass *) override { return true; }
+	bool enqueue_create_compute_pipeline(Hash, const VkComputePipelineCreateInfo *, VkPipeline *) override { return true; }
+	bool enqueue_create_graphics_pipeline(Hash, const VkGraphicsPipelineCreateInfo *, VkPipeline *) override { return true; }
 
-	blob_size = sizeof(u.u64);
-	if (!db->read_entry(RESOURCE_SHADER_MODULE, 3, &blob_size, &u.u64, 0) || u.u64 != three)
-		return false;
+	void notify_pipeline_usage(ResourceTag tag, Hash hash, uint64_t bind_count) override
+	{
+		usage[tag][hash] += bind_count;
+	}
+};
 
-	if (with_read_only)
+static bool test_pipeline_usage()
+{
 	{
-		blob_size = sizeof(u.u8);
-		if (!db->read_entry(RESOURCE_SHADER_MODULE, 1000, &blob_size, &u.u8, 0) || u.u8 != four)
+		std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_usage.foz", DatabaseMode::OverWrite));
+		if (!db || !db->prepare())
 			return false;
 
-		blob_size = sizeof(u.u8);
-		if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 1300, &blob_size, &u.u8, 0) || u.u8 != four)
-			return false;
+		StateRecorder recorder;
+		recorder.init_recording_thread(db.get());
+		record_samplers(recorder);
+		record_set_layouts(recorder);
+		record_pipeline_layouts(recorder);
+		record_shader_modules(recorder);
+		record_compute_pipelines(recorder);
+
+		recorder.record_pipeline_usage(RESOURCE_COMPUTE_PIPELINE, fake_handle<VkPipeline>(80000), 10);
+		recorder.record_pipeline_usage(RESOURCE_COMPUTE_PIPELINE, fake_handle<VkPipeline>(80001), 3);
+		recorder.record_pipeline_usage(RESOURCE_COMPUTE_PIPELINE, fake_handle<VkPipeline>(80000), 5);
+		// Never recorded, so there is no hash to count these against.
+		recorder.record_pipeline_usage(RESOURCE_COMPUTE_PIPELINE, fake_handle<VkPipeline>(90000), 7);
+		recorder.record_pipeline_usage(RESOURCE_GRAPHICS_PIPELINE, fake_handle<VkPipeline>(80000), 7);
+		recorder.tear_down_recording_thread();
 	}
 
-	if (db->has_entry(RESOURCE_SHADER_MODULE, 0) || db->has_entry(RESOURCE_SHADER_MODULE, 4))
+	std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_usage.foz", DatabaseMode::ReadOnly));
+	if (!db || !db->prepare())
 		return false;
 
-	blob_size = sizeof(u.u16);
-	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 300, &blob_size, &u.u16, 0) || u.u16 != one)
+	// Everything was counted well within the write interval, so it all ends up in one entry at the end.
+	size_t count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_PIPELINE_USAGE, &count, nullptr) || count != 1)
+		return false;
+	Hash usage_hash;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_PIPELINE_USAGE, &count, &usage_hash))
 		return false;
 
-	blob_size = sizeof(u.u32);
-	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 200, &blob_size, &u.u32, 0) || u.u32 != two)
+	Hash hashes[2];
+	size_t hash_count = 2;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_COMPUTE_PIPELINE, &hash_count, hashes) || hash_count != 2)
 		return false;
 
-	blob_size = sizeof(u.u64);
-	if (!db->read_entry(RESOURCE_GRAPHICS_PIPELINE, 100, &blob_size, &u.u64, 0) || u.u64 != three)
+	std::vector<uint8_t> blob;
+	if (!read_blob(*db, RESOURCE_PIPELINE_USAGE, usage_hash, blob))
 		return false;
 
-	if (db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 150) ||
-	    db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 99) ||
-	    db->has_entry(RESOURCE_GRAPHICS_PIPELINE, 400))
+	StateReplayer replayer;
+	PipelineUsageCollector collector;
+	if (!replayer.parse(collector, db.get(), blob.data(), blob.size()))
+		return false;
+
+	auto &compute_usage = collector.usage[RESOURCE_COMPUTE_PIPELINE];
+	if (compute_usage.size() != 2 || !collector.usage[RESOURCE_GRAPHICS_PIPELINE].empty())
+		return false;
+
+	uint64_t counts[2];
+	for (unsigned i = 0; i < 2; i++)
+	{
+		auto itr = compute_usage.find(hashes[i]);
+		if (itr == compute_usage.end())
+			return false;
+		counts[i] = itr->second;
+	}
+
+	if (!((counts[0] == 15 && counts[1] == 3) || (counts[0] == 3 && counts[1] == 15)))
 		return false;
 
 	db.reset();
-	remove(".__test_archive.foz");
-	remove(".__test_archive1.foz");
-	remove(".__test_archive2.foz");
-	remove(".__test_archive3.foz");
+	remove(".__test_usage.foz");
 	return true;
 }
 
-static bool test_logging()
+static bool test_dependency_graph()
 {
-	VkSamplerCreateInfo create_info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-	VkSamplerYcbcrConversionCreateInfo conv_info = { VK_STRUCTURE_TYPE_SAMPLER_YCBCR_CONVERSION_CREATE_INFO };
-	create_info.pNext = &conv_info;
+	{
+		std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_dependency_graph.foz", DatabaseMode::OverWrite));
+		if (!db || !db->prepare())
+			return false;
 
-	const auto immutable = fake_handle<VkSampler>(100);
+		StateRecorder recorder;
+		recorder.set_record_dependency_graph(true);
+		recorder.init_recording_thread(db.get());
+		record_samplers(recorder);
+		record_set_layouts(recorder);
+		record_pipeline_layouts(recorder);
+		record_shader_modules(recorder);
+		record_render_passes(recorder);
+		record_compute_pipelines(recorder);
+		record_graphics_pipelines(recorder);
+		recorder.tear_down_recording_thread();
+	}
 
-	VkDescriptorSetLayoutCreateInfo set_layout = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-	VkDescriptorSetLayoutBinding binding = {};
-	binding.pImmutableSamplers = &immutable;
-	binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
-	binding.stageFlags = VK_SHADER_STAGE_ALL;
-	binding.descriptorCount = 1;
-	set_layout.pBindings = &binding;
-	set_layout.bindingCount = 1;
+	std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(".__test_dependency_graph.foz", DatabaseMode::ReadOnly));
+	if (!db || !db->prepare())
+		return false;
 
-	struct UserData
+	std::vector<uint8_t> blob;
+	std::vector<DependencyGraph::Dependency> deps;
+	size_t entry_count = 0;
+
+	for (auto tag : { RESOURCE_DESCRIPTOR_SET_LAYOUT, RESOURCE_PIPELINE_LAYOUT,
+	                  RESOURCE_GRAPHICS_PIPELINE, RESOURCE_COMPUTE_PIPELINE })
 	{
-		unsigned err_count;
-		unsigned warn_count;
-		unsigned info_count;
-	};
+		size_t hash_count = 0;
+		if (!db->get_hash_list_for_resource_tag(tag, &hash_count, nullptr) || hash_count == 0)
+			return false;
+		std::vector<Hash> hashes(hash_count);
+		if (!db->get_hash_list_for_resource_tag(tag, &hash_count, hashes.data()))
+			return false;
 
-	UserData userdata = {};
-	set_thread_log_callback([](LogLevel level, const char *message, void *u) {
-		auto *user = static_cast<UserData *>(u);
-		if (level == LOG_WARNING)
-			user->warn_count++;
-		else if (level == LOG_ERROR)
-			user->err_count++;
-		else if (level == LOG_INFO)
-			user->info_count++;
-		fprintf(stderr, "Callback: %s", message);
-	}, &userdata);
+		for (auto hash : hashes)
+		{
+			// Every layout and pipeline gets an entry, even if it refers to nothing.
+			if (!read_blob(*db, RESOURCE_DEPENDENCY_GRAPH, hash, blob))
+				return false;
 
-	for (unsigned i = 0; i < 3; i++)
-	{
-		userdata = {};
+			ResourceTag entry_tag;
+			size_t count = 0;
+			if (!DependencyGraph::decode_entry(blob.data(), blob.size(), &entry_tag, &count, nullptr) || entry_tag != tag)
+				return false;
+			deps.resize(count);
+			if (count && !DependencyGraph::decode_entry(blob.data(), blob.size(), &entry_tag, &count, deps.data()))
+				return false;
 
-		std::unique_ptr<DatabaseInterface> db(create_stream_archive_database(
-				".__test_archive.foz", DatabaseMode::OverWrite));
-		StateRecorder recorder;
-		if (!db || !db->prepare())
-			return false;
+			bool has_layout = false;
+			bool has_module = false;
+			for (auto &dep : deps)
+			{
+				if (!db->has_entry(dep.tag, dep.hash))
+					return false;
+				has_layout = has_layout || dep.tag == RESOURCE_PIPELINE_LAYOUT;
+				has_module = has_module || dep.tag == RESOURCE_SHADER_MODULE;
+			}
 
-		if (i < 2)
-			LOGI("Expecting log to trigger.\n");
-		else
-			LOGI("Expecting log to NOT trigger.\n");
-		LOGI("=======================\n");
+			if ((tag == RESOURCE_GRAPHICS_PIPELINE || tag == RESOURCE_COMPUTE_PIPELINE) && (!has_layout || !has_module))
+				return false;
 
-		set_thread_log_level(LogLevel(i));
-		recorder.init_recording_thread(db.get());
+			// Truncated entries must be rejected.
+			if (DependencyGraph::decode_entry(blob.data(), blob.size() - 1, &entry_tag, &count, nullptr))
+				return false;
 
-		// Expect failure
-		if (recorder.record_sampler(immutable, create_info, 100))
-			return false;
+			entry_count++;
+		}
+	}
 
-		unsigned expected_warn = i < 2 ? 1 : 0;
-		if (userdata.warn_count != expected_warn || userdata.err_count != 0 || userdata.info_count != 0)
-			return false;
+	size_t graph_count = 0;
+	if (!db->get_hash_list_for_resource_tag(RESOURCE_DEPENDENCY_GRAPH, &graph_count, nullptr) || graph_count != entry_count)
+		return false;
 
-		// Should succeed, but will fail later when trying to resolve sampler.
-		if (!recorder.record_descriptor_set_layout(fake_handle<VkDescriptorSetLayout>(10), set_layout, 200))
-			return false;
+	db.reset();
+	remove(".__test_dependency_graph.foz");
+	return true;
+}
 
-		recorder.tear_down_recording_thread();
-		LOGI("=======================\n");
+static bool serialize_replayed(const std::vector<uint8_t> &json, JsonParseBackend backend, std::vector<uint8_t> &replayed)
+{
+	StateReplayer replayer;
+	ReplayInterface iface;
+	if (!replayer.set_json_parse_backend(backend))
+		return false;
+	if (!replayer.parse(iface, nullptr, json.data(), json.size()))
+		return false;
 
-		expected_warn = i < 2 ? 2 : 0;
-		if (userdata.warn_count != expected_warn || userdata.err_count != 0 || userdata.info_count != 0)
+	uint8_t *serialized;
+	size_t serialized_size;
+	if (!iface.recorder.serialize(&serialized, &serialized_size))
+		return false;
+	replayed.assign(serialized, serialized + serialized_size);
+	StateRecorder::free_serialized(serialized);
+	return true;
+}
+
+static bool test_json_parse_backends(const std::vector<uint8_t> &json)
+{
+	// RapidJSON is always available.
+	std::vector<uint8_t> rapidjson_replayed;
+	if (!serialize_replayed(json, JsonParseBackend::RapidJSON, rapidjson_replayed))
+		return false;
+
+	StateReplayer probe;
+	if (!probe.set_json_parse_backend(JsonParseBackend::Simdjson))
+		return true;
+
+	// Both backends must replay the exact same objects.
+	std::vector<uint8_t> simdjson_replayed;
+	if (!serialize_replayed(json, JsonParseBackend::Simdjson, simdjson_replayed))
+		return false;
+	if (simdjson_replayed != rapidjson_replayed)
+		return false;
+
+	// Truncated documents and garbage after the document must be rejected by both.
+	// Anything past the terminating '\0' is binary payload, not JSON.
+	size_t json_size = std::find(json.begin(), json.end(), uint8_t(0)) - json.begin();
+	std::vector<uint8_t> truncated(json.begin(), json.begin() + json_size / 2);
+	std::vector<uint8_t> trailing(json);
+	trailing.insert(trailing.begin() + json_size, uint8_t('x'));
+	for (auto backend : { JsonParseBackend::RapidJSON, JsonParseBackend::Simdjson })
+	{
+		std::vector<uint8_t> replayed;
+		if (serialize_replayed(truncated, backend, replayed) || serialize_replayed(trailing, backend, replayed))
 			return false;
 	}
-	remove(".__test_archive.foz");
-	set_thread_log_callback(nullptr, nullptr);
+
 	return true;
 }
 
@@ -1631,20 +4041,78 @@ int main()
 		return EXIT_FAILURE;
 	if (!test_concurrent_database())
 		return EXIT_FAILURE;
+	if (!test_concurrent_database_many_extra_paths())
+		return EXIT_FAILURE;
+	if (!test_shader_module_store())
+		return EXIT_FAILURE;
+	if (!test_merge_databases())
+		return EXIT_FAILURE;
 	if (!test_implicit_whitelist())
 		return EXIT_FAILURE;
 	if (!test_database())
 		return EXIT_FAILURE;
+	if (!test_database_index())
+		return EXIT_FAILURE;
+	if (!test_database_compression())
+		return EXIT_FAILURE;
+	if (!test_database_checksums())
+		return EXIT_FAILURE;
+	if (!test_dumb_folder_database())
+		return EXIT_FAILURE;
+	if (!test_zip_database())
+		return EXIT_FAILURE;
+	if (!test_database_concurrent_reads())
+		return EXIT_FAILURE;
+	if (!test_database_async_writes())
+		return EXIT_FAILURE;
+	if (!test_database_compression_dictionary())
+		return EXIT_FAILURE;
 	if (!test_filter())
 		return EXIT_FAILURE;
 	if (!test_export_single_archive())
 		return EXIT_FAILURE;
+	if (!test_export_large_archive())
+		return EXIT_FAILURE;
 	if (!test_export_concurrent_archive(false))
 		return EXIT_FAILURE;
 	if (!test_export_concurrent_archive(true))
 		return EXIT_FAILURE;
 	if (!test_logging())
 		return EXIT_FAILURE;
+	if (!test_hash_algorithms())
+		return EXIT_FAILURE;
+	if (!test_shader_module_encoding())
+		return EXIT_FAILURE;
+	if (!test_binary_payloads())
+		return EXIT_FAILURE;
+	if (!test_record_queue_modes())
+		return EXIT_FAILURE;
+	if (!test_serialization_workers())
+		return EXIT_FAILURE;
+	if (!test_buffered_database_flush())
+		return EXIT_FAILURE;
+	if (!test_persisted_objects_are_released())
+		return EXIT_FAILURE;
+	if (!test_skip_prior_objects())
+		return EXIT_FAILURE;
+	if (!test_recorder_statistics())
+		return EXIT_FAILURE;
+	if (!test_adaptive_compression())
+		return EXIT_FAILURE;
+	if (!test_pipeline_usage())
+		return EXIT_FAILURE;
+	if (!test_dependency_graph())
+		return EXIT_FAILURE;
+	if (!test_scratch_allocator())
+		return EXIT_FAILURE;
+	if (!test_canonicalize_pipeline_state())
+		return EXIT_FAILURE;
+	if (!test_diff_databases())
+		return EXIT_FAILURE;
+#ifndef _WIN32
+	if (!test_remote_archive())
+		return EXIT_FAILURE;
+#endif
 
 	std::vector<uint8_t> res;
 	{
@@ -1687,5 +4155,38 @@ int main()
 
 	if (!replayer.parse(iface, nullptr, res.data(), res.size()))
 		return EXIT_FAILURE;
+
+	// Parsing in place must replay the exact same objects. The buffer needs one spare byte.
+	std::vector<uint8_t> insitu_buffer(res);
+	insitu_buffer.push_back(0);
+
+	StateReplayer insitu_replayer;
+	ReplayInterface insitu_iface;
+	if (!insitu_replayer.parse_insitu(insitu_iface, nullptr, insitu_buffer.data(), res.size()))
+		return EXIT_FAILURE;
+
+	uint8_t *replayed, *insitu_replayed;
+	size_t replayed_size, insitu_replayed_size;
+	if (!iface.recorder.serialize(&replayed, &replayed_size))
+		return EXIT_FAILURE;
+	if (!insitu_iface.recorder.serialize(&insitu_replayed, &insitu_replayed_size))
+		return EXIT_FAILURE;
+
+	bool equal = replayed_size == insitu_replayed_size &&
+	             memcmp(replayed, insitu_replayed, replayed_size) == 0;
+	StateRecorder::free_serialized(replayed);
+	StateRecorder::free_serialized(insitu_replayed);
+
+	if (!equal)
+	{
+		LOGE("In-situ parse does not match regular parse.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!test_json_parse_backends(res))
+	{
+		LOGE("JSON parse backends do not match.\n");
+		return EXIT_FAILURE;
+	}
 	return EXIT_SUCCESS;
 }
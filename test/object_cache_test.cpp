@@ -22,6 +22,9 @@
 
 #include "util/object_cache.hpp"
 #include "layer/utils.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
 #include <stdlib.h>
 
 using namespace Fossilize;
@@ -80,4 +83,88 @@ int main()
 		abort();
 	if (cache.get_current_object_count() != 0)
 		abort();
+
+	// With remaining uses, objects without uses go away even if we are below target size,
+	// and objects with the most remaining uses survive even if they were not used recently.
+	cache.set_eviction_policy(ObjectCacheEvictionPolicy::FewestRemainingUses);
+	cache.set_target_size(20);
+	cache.add_remaining_uses(1, 500);
+	cache.add_remaining_uses(2, 1);
+	cache.add_remaining_uses(3, 2);
+	cache.add_remaining_uses(4, 1);
+	for (unsigned i = 1; i <= 5; i++)
+		cache.insert_object(i, i * 1000, 10);
+
+	// 5 has no uses, 4 has one use left and was used less recently than 2.
+	if (cache.find_object(2).first != 2000)
+		abort();
+	cache.release_use(3);
+	cache.release_use(3);
+	cache.release_use(3);
+
+	cache.prune_cache([](Hash, int) {});
+	if (cache.get_current_object_count() != 2)
+		abort();
+	if (cache.find_object(1).first != 1000)
+		abort();
+	if (cache.find_object(2).first != 2000)
+		abort();
+
+	// Below target, only objects without uses are destroyed.
+	cache.release_use(2);
+	cache.prune_cache([](Hash, int) {});
+	if (cache.get_current_object_count() != 1)
+		abort();
+	if (cache.find_object(1).first != 1000)
+		abort();
+
+	cache.delete_cache([](Hash, int) {});
+	if (cache.get_current_total_size() != 0)
+		abort();
+
+	// Insert and look up from many threads at once, then make sure pruning respects the global budget.
+	ShardedObjectCache<int> sharded;
+	std::atomic<unsigned> lookup_failures{0};
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < 8; t++)
+	{
+		threads.emplace_back([&, t]() {
+			for (unsigned i = 0; i < 1000; i++)
+			{
+				Hash hash = t * 1000 + i + 1;
+				sharded.insert_object(hash, int(hash), 10);
+				if (sharded.find_object(hash).first != int(hash))
+					lookup_failures++;
+			}
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+
+	if (lookup_failures.load() != 0)
+		abort();
+	if (sharded.get_current_total_size() != 80000 || sharded.get_current_object_count() != 8000)
+		abort();
+
+	std::atomic<unsigned> evicted{0};
+	sharded.set_target_size(20000);
+	sharded.prune_cache([&](Hash, int) { evicted++; });
+	if (sharded.get_current_total_size() > 20000)
+		abort();
+	if (sharded.get_current_object_count() + evicted.load() != 8000)
+		abort();
+
+	// Objects used after the last prune must survive the next one in their shard.
+	if (sharded.find_object(8000).second)
+	{
+		sharded.set_target_size(10000);
+		sharded.prune_cache([](Hash, int) {});
+		if (!sharded.find_object(8000).second)
+			abort();
+	}
+
+	sharded.delete_cache([](Hash, int) {});
+	if (sharded.get_current_total_size() != 0 || sharded.get_current_object_count() != 0)
+		abort();
 }
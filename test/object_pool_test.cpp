@@ -0,0 +1,187 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "util/object_pool.hpp"
+#include "layer/utils.hpp"
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <stdlib.h>
+
+using namespace Fossilize;
+
+struct Object
+{
+	Object(unsigned owner_, unsigned serial_)
+		: owner(owner_), serial(serial_)
+	{
+	}
+
+	unsigned owner;
+	unsigned serial;
+};
+
+struct Allocation
+{
+	Object *object;
+	unsigned owner;
+	unsigned serial;
+};
+
+static void test_object_pool()
+{
+	ObjectPool<Object> pool;
+	std::vector<Object *> objects;
+	std::unordered_set<Object *> unique;
+
+	for (unsigned i = 0; i < 1000; i++)
+	{
+		objects.push_back(pool.allocate(0u, i));
+		unique.insert(objects.back());
+	}
+
+	if (unique.size() != objects.size())
+		abort();
+
+	for (unsigned i = 0; i < 1000; i++)
+		if (objects[i]->serial != i)
+			abort();
+
+	// Freed objects must be handed out again before the pool grows.
+	for (auto *object : objects)
+		pool.free(object);
+	for (unsigned i = 0; i < 1000; i++)
+		if (!unique.count(pool.allocate(0u, i)))
+			abort();
+}
+
+static void test_concurrent_object_pool()
+{
+	static const unsigned num_threads = 8;
+	static const unsigned num_iterations = 100000;
+	static const unsigned max_live_objects = 256;
+
+	ConcurrentObjectPool<Object, 16> pool;
+
+	// Objects which are freed by another thread than the one which allocated them.
+	std::mutex exchange_lock;
+	std::vector<Allocation> exchange;
+
+	std::vector<std::thread> threads;
+	std::vector<char> results(num_threads);
+
+	for (unsigned thread_index = 0; thread_index < num_threads; thread_index++)
+	{
+		threads.emplace_back([&, thread_index]() {
+			ConcurrentObjectPool<Object, 16>::ThreadCache cache;
+			std::vector<Allocation> live;
+			std::mt19937 rnd(thread_index);
+			bool success = true;
+
+			// If an object was handed out twice, the other owner will have overwritten it.
+			const auto check_and_free = [&](const Allocation &allocation) {
+				if (allocation.object->owner != allocation.owner || allocation.object->serial != allocation.serial)
+					success = false;
+				pool.free(cache, allocation.object);
+			};
+
+			for (unsigned i = 0; i < num_iterations; i++)
+			{
+				auto *object = pool.allocate(cache, thread_index, i);
+				if (!object)
+				{
+					success = false;
+					break;
+				}
+				live.push_back({ object, thread_index, i });
+
+				if (live.size() >= max_live_objects || (rnd() & 3) == 0)
+				{
+					size_t index = rnd() % live.size();
+					auto victim = live[index];
+					live[index] = live.back();
+					live.pop_back();
+
+					if (rnd() & 1)
+					{
+						check_and_free(victim);
+					}
+					else
+					{
+						std::lock_guard<std::mutex> holder{exchange_lock};
+						exchange.push_back(victim);
+					}
+				}
+
+				Allocation foreign = {};
+				if ((i & 7) == 0)
+				{
+					std::lock_guard<std::mutex> holder{exchange_lock};
+					if (!exchange.empty())
+					{
+						foreign = exchange.back();
+						exchange.pop_back();
+					}
+				}
+
+				if (foreign.object)
+					check_and_free(foreign);
+			}
+
+			for (auto &allocation : live)
+				check_and_free(allocation);
+			pool.flush(cache);
+			results[thread_index] = success;
+		});
+	}
+
+	for (auto &thread : threads)
+		thread.join();
+
+	for (auto &result : results)
+		if (!result)
+			abort();
+
+	// Everything left in the exchange is still valid, and freeing it through a fresh cache works.
+	ConcurrentObjectPool<Object, 16>::ThreadCache cache;
+	std::unordered_set<Object *> unique;
+	for (auto &allocation : exchange)
+	{
+		if (allocation.object->owner != allocation.owner || allocation.object->serial != allocation.serial)
+			abort();
+		unique.insert(allocation.object);
+		pool.free(cache, allocation.object);
+	}
+
+	if (unique.size() != exchange.size())
+		abort();
+	pool.flush(cache);
+}
+
+int main()
+{
+	test_object_pool();
+	test_concurrent_object_pool();
+	LOGI("Object pool tests passed.\n");
+}
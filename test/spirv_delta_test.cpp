@@ -0,0 +1,172 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "spirv_delta.hpp"
+#include "varint.hpp"
+#include "miniz.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <random>
+#include <vector>
+
+using namespace Fossilize;
+
+static void emit(std::vector<uint32_t> &code, uint32_t opcode, std::initializer_list<uint32_t> operands)
+{
+	code.push_back((uint32_t(operands.size() + 1) << 16) | opcode);
+	code.insert(code.end(), operands.begin(), operands.end());
+}
+
+// Not valid SPIR-V, but with the same statistics: types declared up front, then long function bodies
+// of loads, arithmetic and stores where every instruction allocates a new result ID.
+static std::vector<uint32_t> generate_module(std::mt19937 &rnd, unsigned instruction_count)
+{
+	enum { OpDecorate = 71, OpTypeFloat = 22, OpTypeVector = 23, OpTypePointer = 32, OpConstant = 43,
+	       OpLoad = 61, OpStore = 62, OpAccessChain = 65, OpFAdd = 129, OpFMul = 133, OpDot = 148 };
+
+	std::vector<uint32_t> code = { 0x07230203u, 0x00010300u, 0x00080001u, 0, 0 };
+	uint32_t id = 1;
+
+	uint32_t float_type = id++;
+	emit(code, OpTypeFloat, { float_type, 32 });
+	uint32_t vec4_type = id++;
+	emit(code, OpTypeVector, { vec4_type, float_type, 4 });
+	uint32_t ptr_type = id++;
+	emit(code, OpTypePointer, { ptr_type, 7, vec4_type });
+
+	std::vector<uint32_t> variables;
+	for (unsigned i = 0; i < 32; i++)
+	{
+		uint32_t var = id++;
+		variables.push_back(var);
+		emit(code, OpDecorate, { var, 30, i });
+	}
+
+	uint32_t last_value = id;
+	emit(code, OpConstant, { float_type, id++, 0x3f800000u });
+
+	for (unsigned i = 0; i < instruction_count; i++)
+	{
+		switch (rnd() % 6)
+		{
+		case 0:
+			emit(code, OpLoad, { vec4_type, id, variables[rnd() % variables.size()] });
+			last_value = id++;
+			break;
+		case 1:
+			emit(code, OpStore, { variables[rnd() % variables.size()], last_value });
+			break;
+		case 2:
+			emit(code, OpAccessChain, { ptr_type, id++, variables[rnd() % variables.size()], uint32_t(rnd() % 4) });
+			break;
+		case 3:
+			emit(code, OpFAdd, { vec4_type, id, last_value, id - 1 - uint32_t(rnd() % 8) });
+			last_value = id++;
+			break;
+		case 4:
+			emit(code, OpFMul, { vec4_type, id, last_value, id - 1 - uint32_t(rnd() % 8) });
+			last_value = id++;
+			break;
+		default:
+			emit(code, OpDot, { float_type, id, last_value, id - 2 });
+			last_value = id++;
+			break;
+		}
+	}
+
+	code[3] = id;
+	return code;
+}
+
+static size_t deflated_size(const std::vector<uint8_t> &data)
+{
+	mz_ulong size = mz_compressBound(mz_ulong(data.size()));
+	std::vector<uint8_t> compressed(size);
+	if (mz_compress2(compressed.data(), &size, data.data(), mz_ulong(data.size()), MZ_BEST_COMPRESSION) != MZ_OK)
+		abort();
+	return size;
+}
+
+int main()
+{
+	std::mt19937 rnd;
+
+	for (unsigned count : { 0u, 1u, 10u, 1000u, 100000u })
+	{
+		auto code = generate_module(rnd, count);
+		std::vector<uint8_t> encoded;
+		if (!encode_spirv_delta(encoded, code.data(), code.size()))
+		{
+			fprintf(stderr, "Failed to encode module.\n");
+			return EXIT_FAILURE;
+		}
+
+		std::vector<uint32_t> decoded(code.size());
+		if (!decode_spirv_delta(decoded.data(), decoded.size(), encoded.data(), encoded.size()) || decoded != code)
+		{
+			fprintf(stderr, "Module does not round-trip.\n");
+			return EXIT_FAILURE;
+		}
+
+		// Truncated or oversized payloads must be rejected.
+		if (decode_spirv_delta(decoded.data(), decoded.size(), encoded.data(), encoded.size() - 1))
+			return EXIT_FAILURE;
+		encoded.push_back(0);
+		if (decode_spirv_delta(decoded.data(), decoded.size(), encoded.data(), encoded.size()))
+			return EXIT_FAILURE;
+		encoded.pop_back();
+
+		if (count == 100000)
+		{
+			std::vector<uint8_t> varint(compute_size_varint(code.data(), code.size()));
+			encode_varint(varint.data(), code.data(), code.size());
+			printf("SPIR-V delta: %u bytes deflated, plain varint: %u bytes deflated.\n",
+			       unsigned(deflated_size(encoded)), unsigned(deflated_size(varint)));
+		}
+	}
+
+	// Anything which does not parse as SPIR-V is left to plain varint.
+	std::vector<uint8_t> encoded;
+	std::vector<uint32_t> garbage = { 0x07230203u, 0, 0, 0, 0, 0x00050001u, 1, 2 };
+	if (encode_spirv_delta(encoded, garbage.data(), garbage.size()))
+		return EXIT_FAILURE;
+	garbage[5] = 0x00000001u;
+	if (encode_spirv_delta(encoded, garbage.data(), garbage.size()))
+		return EXIT_FAILURE;
+	garbage[0] = 0x03022307u;
+	garbage[5] = 0x00030001u;
+	if (encode_spirv_delta(encoded, garbage.data(), garbage.size()))
+		return EXIT_FAILURE;
+
+	// Random payloads must never decode out of bounds.
+	std::vector<uint32_t> decoded(64);
+	for (unsigned iter = 0; iter < 10000; iter++)
+	{
+		std::vector<uint8_t> bytes(rnd() % 128);
+		for (auto &b : bytes)
+			b = uint8_t(rnd());
+		decode_spirv_delta(decoded.data(), rnd() % decoded.size(), bytes.data(), bytes.size());
+	}
+
+	return EXIT_SUCCESS;
+}
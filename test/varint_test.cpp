@@ -23,11 +23,98 @@
 #include "fossilize.hpp"
 #include "varint.hpp"
 #include <string.h>
+#include <stdio.h>
 #include <random>
 #include <vector>
+#include <chrono>
 
 using namespace Fossilize;
 
+// Byte at a time reference, which the optimized decoder must match exactly, including which inputs it rejects.
+static bool decode_varint_reference(uint32_t *words, size_t words_size, const uint8_t *buffer, size_t buffer_size)
+{
+	size_t offset = 0;
+	for (size_t i = 0; i < words_size; i++)
+	{
+		auto &w = words[i];
+		w = 0;
+
+		uint32_t shift = 0;
+		do
+		{
+			if (offset >= buffer_size || shift >= 32u)
+				return false;
+
+			w |= uint32_t(buffer[offset] & 0x7f) << shift;
+			shift += 7;
+		} while (buffer[offset++] & 0x80);
+	}
+
+	return buffer_size == offset;
+}
+
+static bool test_roundtrip(const std::vector<uint32_t> &buffer)
+{
+	size_t computed = compute_size_varint(buffer.data(), buffer.size());
+	std::vector<uint8_t> encode_buffer(computed);
+	if (encode_varint(encode_buffer.data(), buffer.data(), buffer.size()) != encode_buffer.data() + computed)
+		return false;
+
+	std::vector<uint32_t> decode_buffer(buffer.size());
+	if (!decode_varint(decode_buffer.data(), decode_buffer.size(), encode_buffer.data(), encode_buffer.size()))
+		return false;
+
+	return decode_buffer == buffer;
+}
+
+static bool test_against_reference(std::mt19937 &rnd)
+{
+	// Random garbage mostly exercises the error paths, so both decoders must agree on success and output.
+	for (unsigned iter = 0; iter < 20000; iter++)
+	{
+		size_t size = rnd() % 64;
+		std::vector<uint8_t> bytes(size);
+		for (auto &b : bytes)
+		{
+			b = uint8_t(rnd());
+			if (rnd() & 1)
+				b &= 0x7f;
+		}
+
+		size_t words = rnd() % 48;
+		std::vector<uint32_t> expected(words), decoded(words);
+		bool expected_ok = decode_varint_reference(expected.data(), words, bytes.data(), bytes.size());
+		bool ok = decode_varint(decoded.data(), words, bytes.data(), bytes.size());
+		if (ok != expected_ok || (ok && expected != decoded))
+		{
+			fprintf(stderr, "Varint decoder disagrees with reference (%u bytes, %u words).\n",
+			        unsigned(size), unsigned(words));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void benchmark_decode(const std::vector<uint32_t> &buffer, const char *tag)
+{
+	size_t computed = compute_size_varint(buffer.data(), buffer.size());
+	std::vector<uint8_t> encode_buffer(computed);
+	encode_varint(encode_buffer.data(), buffer.data(), buffer.size());
+	std::vector<uint32_t> decode_buffer(buffer.size());
+
+	auto start = std::chrono::steady_clock::now();
+	const unsigned iterations = 8;
+	for (unsigned i = 0; i < iterations; i++)
+		if (!decode_varint(decode_buffer.data(), decode_buffer.size(), encode_buffer.data(), encode_buffer.size()))
+			abort();
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	double mib = double(decode_buffer.size() * sizeof(uint32_t) * iterations) / (1024.0 * 1024.0);
+	printf("Varint decode (%s): %.1f MiB/s of decoded words.\n", tag, mib / seconds);
+}
+
 int main()
 {
 	std::mt19937 rnd;
@@ -36,16 +123,51 @@ int main()
 	for (unsigned i = 0; i < 16 * 1024 * 1024; i++)
 		buffer.push_back(uint32_t(rnd()) & ((1u << 29) - 1));
 
-	size_t computed = compute_size_varint(buffer.data(), buffer.size());
-	std::vector<uint8_t> encode_buffer(computed);
-	encode_varint(encode_buffer.data(), buffer.data(), buffer.size());
+	if (!test_roundtrip(buffer))
+		return EXIT_FAILURE;
 
-	std::vector<uint32_t> decode_buffer(16 * 1024 * 1024);
-	if (!decode_varint(decode_buffer.data(), decode_buffer.size(), encode_buffer.data(), encode_buffer.size()))
+	// Mix of every encoded length, including full 32-bit words and long runs of single byte values.
+	std::vector<uint32_t> mixed;
+	for (unsigned i = 0; i < 1024 * 1024; i++)
+	{
+		unsigned bits = rnd() % 33;
+		uint32_t w = bits == 32 ? uint32_t(rnd()) : (uint32_t(rnd()) & ((1u << bits) - 1));
+		if ((i / 256) & 1)
+			w &= 0x7f;
+		mixed.push_back(w);
+	}
+	mixed.push_back(0xffffffffu);
+
+	if (!test_roundtrip(mixed))
 		return EXIT_FAILURE;
 
-	if (memcmp(buffer.data(), decode_buffer.data(), decode_buffer.size() * sizeof(uint32_t)))
+	// Every length of the tail, which is handled by the scalar path.
+	for (size_t count = 0; count < 64; count++)
+	{
+		std::vector<uint32_t> tail(mixed.begin(), mixed.begin() + count);
+		if (!test_roundtrip(tail))
+			return EXIT_FAILURE;
+	}
+
+	if (!test_against_reference(rnd))
 		return EXIT_FAILURE;
 
+	// Roughly what SPIR-V looks like: mostly small IDs with some opcodes and large literals.
+	std::vector<uint32_t> spirv_like;
+	spirv_like.reserve(16 * 1024 * 1024);
+	for (unsigned i = 0; i < 16 * 1024 * 1024; i++)
+	{
+		uint32_t r = uint32_t(rnd());
+		if ((r & 7) == 0)
+			spirv_like.push_back((((r >> 8) & 7) << 16) | ((r >> 16) & 0x1ff));
+		else if ((r & 63) == 1)
+			spirv_like.push_back(uint32_t(rnd()));
+		else
+			spirv_like.push_back((r >> 8) & 0x3ff);
+	}
+
+	benchmark_decode(buffer, "random 29-bit");
+	benchmark_decode(spirv_like, "SPIR-V like");
+
 	return EXIT_SUCCESS;
 }
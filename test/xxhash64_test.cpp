@@ -0,0 +1,92 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "xxhash64.hpp"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+using namespace Fossilize;
+
+struct Reference
+{
+	const char *str;
+	uint64_t seed;
+	uint64_t hash;
+};
+
+int main()
+{
+	// Reference values from the canonical XXH64 implementation.
+	static const Reference references[] = {
+		{ "", 0, 0xef46db3751d8e999ull },
+		{ "abc", 0, 0x44bc2cf5ad770999ull },
+		{ "abc", 0xcbf29ce484222325ull, 0x059332d3e3c87519ull },
+		{ "Nobody inspects the spammish repetition", 0, 0xfbcea83c8a378bf1ull },
+	};
+
+	for (auto &ref : references)
+	{
+		if (compute_xxh64(ref.str, strlen(ref.str), ref.seed) != ref.hash)
+		{
+			fprintf(stderr, "XXH64 mismatch for \"%s\".\n", ref.str);
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::mt19937 rnd;
+	std::vector<uint8_t> buffer(64 * 1024 + 16);
+	for (auto &b : buffer)
+		b = uint8_t(rnd());
+
+	// Alignment must not matter, and every byte must contribute.
+	for (size_t size = 0; size < 256; size++)
+	{
+		std::vector<uint8_t> copy(buffer.begin(), buffer.begin() + size);
+		uint64_t expected = compute_xxh64(copy.data(), size, 0);
+		for (size_t offset = 1; offset < 16; offset++)
+		{
+			memcpy(buffer.data() + offset, copy.data(), size);
+			if (compute_xxh64(buffer.data() + offset, size, 0) != expected)
+			{
+				fprintf(stderr, "XXH64 depends on alignment for offset %u, size %u.\n", unsigned(offset), unsigned(size));
+				return EXIT_FAILURE;
+			}
+		}
+
+		for (size_t i = 0; i < size; i++)
+		{
+			copy[i] ^= 0x10;
+			if (compute_xxh64(copy.data(), size, 0) == expected)
+			{
+				fprintf(stderr, "XXH64 ignores byte %u for size %u.\n", unsigned(i), unsigned(size));
+				return EXIT_FAILURE;
+			}
+			copy[i] ^= 0x10;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,302 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include "fossilize_types.hpp"
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+namespace Fossilize
+{
+// Open-addressing hash table keyed by Hash, for tracking a very large number of entries.
+// All entries live in one flat array, so there is no allocation per entry,
+// and a lookup normally touches a single cache line.
+// Hash 0 marks empty slots. The key 0 itself is stored in a dedicated slot after the table.
+// Inserting and erasing invalidates iterators.
+template <typename T>
+class FlatHashMap
+{
+public:
+	using value_type = std::pair<Hash, T>;
+
+	template <typename Map, typename Value>
+	class Iterator
+	{
+	public:
+		Iterator(Map *map_, size_t index_)
+			: map(map_), index(index_)
+		{
+			skip_empty();
+		}
+
+		Value &operator*() const
+		{
+			return map->slots[index];
+		}
+
+		Value *operator->() const
+		{
+			return &map->slots[index];
+		}
+
+		Iterator &operator++()
+		{
+			index++;
+			skip_empty();
+			return *this;
+		}
+
+		bool operator==(const Iterator &other) const
+		{
+			return index == other.index;
+		}
+
+		bool operator!=(const Iterator &other) const
+		{
+			return index != other.index;
+		}
+
+	private:
+		void skip_empty()
+		{
+			while (index < map->slots.size() && !map->is_occupied(index))
+				index++;
+		}
+
+		Map *map;
+		size_t index;
+	};
+
+	using iterator = Iterator<FlatHashMap, value_type>;
+	using const_iterator = Iterator<const FlatHashMap, const value_type>;
+
+	iterator begin()
+	{
+		return iterator(this, 0);
+	}
+
+	iterator end()
+	{
+		return iterator(this, slots.size());
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(this, 0);
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(this, slots.size());
+	}
+
+	iterator find(Hash hash)
+	{
+		return iterator(this, find_index(hash));
+	}
+
+	const_iterator find(Hash hash) const
+	{
+		return const_iterator(this, find_index(hash));
+	}
+
+	size_t count(Hash hash) const
+	{
+		return find_index(hash) != slots.size() ? 1 : 0;
+	}
+
+	std::pair<iterator, bool> emplace(Hash hash, const T &value)
+	{
+		size_t index = find_index(hash);
+		if (index != slots.size())
+			return { iterator(this, index), false };
+
+		index = insert_index(hash);
+		slots[index].second = value;
+		return { iterator(this, index), true };
+	}
+
+	T &operator[](Hash hash)
+	{
+		size_t index = find_index(hash);
+		if (index == slots.size())
+			index = insert_index(hash);
+		return slots[index].second;
+	}
+
+	size_t erase(Hash hash)
+	{
+		size_t index = find_index(hash);
+		if (index == slots.size())
+			return 0;
+
+		current_size--;
+		if (hash == 0)
+		{
+			has_zero_key = false;
+			slots[index].second = T();
+			return 1;
+		}
+
+		// Backward-shift deletion, so we never need tombstones.
+		size_t mask = table_size() - 1;
+		for (size_t next = (index + 1) & mask; slots[next].first != 0; next = (next + 1) & mask)
+		{
+			size_t home = mix(slots[next].first) & mask;
+			if (((next - home) & mask) >= ((next - index) & mask))
+			{
+				slots[index] = std::move(slots[next]);
+				index = next;
+			}
+		}
+
+		slots[index] = value_type();
+		return 1;
+	}
+
+	void reserve(size_t count)
+	{
+		size_t size = MinTableSize;
+		while (size * MaxLoadNumerator < count * MaxLoadDenominator)
+			size *= 2;
+		if (size > table_size())
+			rehash(size);
+	}
+
+	void clear()
+	{
+		slots.clear();
+		slots.shrink_to_fit();
+		current_size = 0;
+		has_zero_key = false;
+	}
+
+	size_t size() const
+	{
+		return current_size;
+	}
+
+	bool empty() const
+	{
+		return current_size == 0;
+	}
+
+	// Bytes allocated for the table.
+	size_t get_memory_usage() const
+	{
+		return slots.capacity() * sizeof(value_type);
+	}
+
+private:
+	enum { MinTableSize = 16, MaxLoadNumerator = 3, MaxLoadDenominator = 4 };
+
+	// Keys are usually hashes already, but they might not be well distributed in the lower bits.
+	static size_t mix(Hash hash)
+	{
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdull;
+		hash ^= hash >> 33;
+		return size_t(hash);
+	}
+
+	size_t table_size() const
+	{
+		return slots.empty() ? 0 : slots.size() - 1;
+	}
+
+	bool is_occupied(size_t index) const
+	{
+		if (index == table_size())
+			return has_zero_key;
+		return slots[index].first != 0;
+	}
+
+	// Returns slots.size() if not found.
+	size_t find_index(Hash hash) const
+	{
+		if (slots.empty())
+			return 0;
+		if (hash == 0)
+			return has_zero_key ? table_size() : slots.size();
+
+		size_t mask = table_size() - 1;
+		for (size_t index = mix(hash) & mask; ; index = (index + 1) & mask)
+		{
+			if (slots[index].first == hash)
+				return index;
+			else if (slots[index].first == 0)
+				return slots.size();
+		}
+	}
+
+	// Claims a slot for a key which is known to not be present yet.
+	size_t insert_index(Hash hash)
+	{
+		size_t non_zero_count = current_size - (has_zero_key ? 1 : 0);
+		if (hash != 0 && (non_zero_count + 1) * MaxLoadDenominator > table_size() * MaxLoadNumerator)
+			rehash(table_size() ? table_size() * 2 : size_t(MinTableSize));
+		else if (slots.empty())
+			rehash(MinTableSize);
+
+		current_size++;
+		if (hash == 0)
+		{
+			has_zero_key = true;
+			return table_size();
+		}
+
+		size_t mask = table_size() - 1;
+		size_t index = mix(hash) & mask;
+		while (slots[index].first != 0)
+			index = (index + 1) & mask;
+		slots[index].first = hash;
+		return index;
+	}
+
+	void rehash(size_t size)
+	{
+		std::vector<value_type> old_slots(size + 1);
+		old_slots.swap(slots);
+
+		size_t mask = size - 1;
+		for (size_t i = 0; i + 1 < old_slots.size(); i++)
+		{
+			if (old_slots[i].first == 0)
+				continue;
+
+			size_t index = mix(old_slots[i].first) & mask;
+			while (slots[index].first != 0)
+				index = (index + 1) & mask;
+			slots[index] = std::move(old_slots[i]);
+		}
+
+		if (!old_slots.empty())
+			slots.back() = std::move(old_slots.back());
+	}
+
+	std::vector<value_type> slots;
+	size_t current_size = 0;
+	bool has_zero_key = false;
+};
+}
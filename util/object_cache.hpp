@@ -23,6 +23,10 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include "fossilize_types.hpp"
 #include "object_pool.hpp"
 #include "intrusive_list.hpp"
@@ -30,6 +34,16 @@
 
 namespace Fossilize
 {
+enum class ObjectCacheEvictionPolicy
+{
+	// Evicts least recently used objects until the target size is met.
+	LeastRecentlyUsed,
+	// Needs the number of future uses of each object up front, see add_remaining_uses().
+	// Objects without remaining uses are destroyed on every prune, and beyond that,
+	// objects with the fewest remaining uses are evicted first, least recently used first among equals.
+	FewestRemainingUses
+};
+
 template <typename T>
 class ObjectCache
 {
@@ -48,6 +62,25 @@ public:
 		target_size = size;
 	}
 
+	void set_eviction_policy(ObjectCacheEvictionPolicy policy_)
+	{
+		policy = policy_;
+	}
+
+	// Use counts are tracked by hash, so they can be set up before an object is inserted
+	// and survive the object being evicted and inserted again.
+	void add_remaining_uses(Hash hash, unsigned count)
+	{
+		remaining_uses[hash] += count;
+	}
+
+	void release_use(Hash hash)
+	{
+		auto itr = remaining_uses.find(hash);
+		if (itr != std::end(remaining_uses) && itr->second != 0)
+			itr->second--;
+	}
+
 	std::pair<T, bool> find_object(Hash hash)
 	{
 		auto itr = hash_to_objects.find(hash);
@@ -61,17 +94,16 @@ public:
 	template <typename Deleter>
 	void prune_cache(const Deleter &deleter)
 	{
+		if (policy == ObjectCacheEvictionPolicy::FewestRemainingUses)
+		{
+			prune_cache_by_remaining_uses(deleter);
+			return;
+		}
+
 		while (total_size > target_size)
 		{
 			assert(!lru_cache.empty());
-			auto last_used_entry = lru_cache.rbegin();
-			assert(last_used_entry->size <= total_size);
-			total_size -= last_used_entry->size;
-			lru_cache.erase(last_used_entry);
-
-			deleter(last_used_entry->hash, last_used_entry->object);
-			hash_to_objects.erase(last_used_entry->hash);
-			pool.free(last_used_entry.get());
+			evict_entry(lru_cache.rbegin().get(), deleter);
 		}
 	}
 
@@ -121,6 +153,7 @@ public:
 private:
 	size_t target_size = 0;
 	size_t total_size = 0;
+	ObjectCacheEvictionPolicy policy = ObjectCacheEvictionPolicy::LeastRecentlyUsed;
 
 	struct CacheEntry : IntrusiveListEnabled<CacheEntry>
 	{
@@ -131,6 +164,182 @@ private:
 
 	ObjectPool<CacheEntry> pool;
 	std::unordered_map<Hash, CacheEntry *> hash_to_objects;
+	std::unordered_map<Hash, unsigned> remaining_uses;
 	IntrusiveList<CacheEntry> lru_cache;
+
+	template <typename Deleter>
+	void evict_entry(CacheEntry *entry, const Deleter &deleter)
+	{
+		assert(entry->size <= total_size);
+		total_size -= entry->size;
+		lru_cache.erase(entry);
+
+		deleter(entry->hash, entry->object);
+		hash_to_objects.erase(entry->hash);
+		pool.free(entry);
+	}
+
+	template <typename Deleter>
+	void prune_cache_by_remaining_uses(const Deleter &deleter)
+	{
+		std::vector<std::pair<unsigned, CacheEntry *>> candidates;
+		candidates.reserve(hash_to_objects.size());
+
+		// Walk from the least recently used end, so the stable sort keeps LRU order among equals.
+		for (auto itr = lru_cache.rbegin(); itr != lru_cache.end(); --itr)
+		{
+			auto uses = remaining_uses.find(itr->hash);
+			candidates.push_back({ uses != std::end(remaining_uses) ? uses->second : 0u, itr.get() });
+		}
+
+		std::stable_sort(std::begin(candidates), std::end(candidates),
+		                 [](const std::pair<unsigned, CacheEntry *> &a, const std::pair<unsigned, CacheEntry *> &b) {
+			                 return a.first < b.first;
+		                 });
+
+		for (auto &candidate : candidates)
+		{
+			if (candidate.first != 0 && total_size <= target_size)
+				break;
+			evict_entry(candidate.second, deleter);
+		}
+	}
+};
+
+// ObjectCache which can be used from many threads at once.
+// Objects are partitioned by hash into shards, each being an ObjectCache with its own lock and LRU list.
+// The target size is a budget for all shards together. Pruning trims every shard in proportion to its share
+// of the total size, which approximates a global LRU since hashes are spread evenly over the shards.
+// Deleters passed to prune_cache() and delete_cache() are called with a shard lock held.
+template <typename T, unsigned NumShards = 16>
+class ShardedObjectCache
+{
+public:
+	static_assert((NumShards & (NumShards - 1)) == 0, "NumShards must be a power of two.");
+
+	ShardedObjectCache() = default;
+	ShardedObjectCache(const ShardedObjectCache &) = delete;
+	void operator=(const ShardedObjectCache &) = delete;
+
+	void set_target_size(size_t size)
+	{
+		target_size.store(size, std::memory_order_relaxed);
+	}
+
+	void set_eviction_policy(ObjectCacheEvictionPolicy policy_)
+	{
+		policy.store(policy_, std::memory_order_relaxed);
+		for (auto &shard : shards)
+		{
+			std::lock_guard<std::mutex> holder{shard.lock};
+			shard.cache.set_eviction_policy(policy_);
+		}
+	}
+
+	void add_remaining_uses(Hash hash, unsigned count)
+	{
+		auto &shard = get_shard(hash);
+		std::lock_guard<std::mutex> holder{shard.lock};
+		shard.cache.add_remaining_uses(hash, count);
+	}
+
+	void release_use(Hash hash)
+	{
+		auto &shard = get_shard(hash);
+		std::lock_guard<std::mutex> holder{shard.lock};
+		shard.cache.release_use(hash);
+	}
+
+	std::pair<T, bool> find_object(Hash hash)
+	{
+		auto &shard = get_shard(hash);
+		std::lock_guard<std::mutex> holder{shard.lock};
+		return shard.cache.find_object(hash);
+	}
+
+	// Like find_object() followed by release_use(), but only takes the lock once.
+	std::pair<T, bool> find_object_and_release_use(Hash hash)
+	{
+		auto &shard = get_shard(hash);
+		std::lock_guard<std::mutex> holder{shard.lock};
+		auto result = shard.cache.find_object(hash);
+		shard.cache.release_use(hash);
+		return result;
+	}
+
+	void insert_object(Hash hash, T object, size_t object_size)
+	{
+		auto &shard = get_shard(hash);
+		std::lock_guard<std::mutex> holder{shard.lock};
+		shard.cache.insert_object(hash, object, object_size);
+		total_size.fetch_add(object_size, std::memory_order_relaxed);
+	}
+
+	template <typename Deleter>
+	void prune_cache(const Deleter &deleter)
+	{
+		size_t target = target_size.load(std::memory_order_relaxed);
+		size_t total = total_size.load(std::memory_order_relaxed);
+
+		// Objects without remaining uses go away on every prune, so there is always work to do with that policy.
+		if (total <= target && policy.load(std::memory_order_relaxed) == ObjectCacheEvictionPolicy::LeastRecentlyUsed)
+			return;
+
+		double ratio = total > target ? double(target) / double(total) : 1.0;
+
+		for (auto &shard : shards)
+		{
+			std::lock_guard<std::mutex> holder{shard.lock};
+			size_t shard_size = shard.cache.get_current_total_size();
+			shard.cache.set_target_size(size_t(double(shard_size) * ratio));
+			shard.cache.prune_cache(deleter);
+			total_size.fetch_sub(shard_size - shard.cache.get_current_total_size(), std::memory_order_relaxed);
+		}
+	}
+
+	template <typename Deleter>
+	void delete_cache(const Deleter &deleter)
+	{
+		for (auto &shard : shards)
+		{
+			std::lock_guard<std::mutex> holder{shard.lock};
+			total_size.fetch_sub(shard.cache.get_current_total_size(), std::memory_order_relaxed);
+			shard.cache.delete_cache(deleter);
+		}
+	}
+
+	size_t get_current_total_size() const
+	{
+		return total_size.load(std::memory_order_relaxed);
+	}
+
+	size_t get_current_object_count()
+	{
+		size_t count = 0;
+		for (auto &shard : shards)
+		{
+			std::lock_guard<std::mutex> holder{shard.lock};
+			count += shard.cache.get_current_object_count();
+		}
+		return count;
+	}
+
+private:
+	struct Shard
+	{
+		std::mutex lock;
+		ObjectCache<T> cache;
+	};
+
+	Shard shards[NumShards];
+	std::atomic<size_t> target_size{0};
+	std::atomic<size_t> total_size{0};
+	std::atomic<ObjectCacheEvictionPolicy> policy{ObjectCacheEvictionPolicy::LeastRecentlyUsed};
+
+	Shard &get_shard(Hash hash)
+	{
+		// Hashes may come from anywhere, so fold the upper half in as well.
+		return shards[(hash ^ (hash >> 32)) & (NumShards - 1)];
+	}
 };
 }
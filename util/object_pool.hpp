@@ -37,21 +37,30 @@ public:
 	template<typename... P>
 	T *allocate(P &&... p)
 	{
-		if (vacants.empty())
+		T *ptr;
+		if (!vacants.empty())
 		{
-			unsigned num_objects = 64u << memory.size();
-			T *ptr = static_cast<T *>(malloc(num_objects * sizeof(T)));
-			if (!ptr)
-				return nullptr;
+			ptr = vacants.back();
+			vacants.pop_back();
+		}
+		else
+		{
+			// Hand out slots of the newest block in order, so growing the pool does not have to touch every slot.
+			if (block_used == block_size)
+			{
+				unsigned num_objects = 64u << memory.size();
+				T *block = static_cast<T *>(malloc(num_objects * sizeof(T)));
+				if (!block)
+					return nullptr;
 
-			for (unsigned i = 0; i < num_objects; i++)
-				vacants.push_back(&ptr[i]);
+				memory.emplace_back(block);
+				block_size = num_objects;
+				block_used = 0;
+			}
 
-			memory.emplace_back(ptr);
+			ptr = memory.back().get() + block_used++;
 		}
 
-		T *ptr = vacants.back();
-		vacants.pop_back();
 		new(ptr) T(std::forward<P>(p)...);
 		return ptr;
 	}
@@ -66,6 +75,8 @@ public:
 	{
 		vacants.clear();
 		memory.clear();
+		block_size = 0;
+		block_used = 0;
 	}
 
 protected:
@@ -80,5 +91,143 @@ protected:
 	};
 
 	std::vector<std::unique_ptr<T, MallocDeleter>> memory;
+	unsigned block_size = 0;
+	unsigned block_used = 0;
+};
+
+// Object pool which can be used from many threads at once.
+// Every thread allocates from and frees to its own ThreadCache, which holds up to two magazines of free objects.
+// Only when both are empty or full, a whole magazine of up to MagazineSize objects is exchanged with the shared depot,
+// so the lock is taken at most once every MagazineSize allocations or frees.
+// Objects may be freed through a different ThreadCache than the one they were allocated from.
+// A ThreadCache must only be used by one thread at a time. Flush it before it is destroyed,
+// or the objects it holds are only reclaimed along with the pool.
+template<typename T, unsigned MagazineSize = 64>
+class ConcurrentObjectPool
+{
+public:
+	struct ThreadCache
+	{
+		std::vector<T *> loaded;
+		std::vector<T *> previous;
+	};
+
+	ConcurrentObjectPool() = default;
+	ConcurrentObjectPool(const ConcurrentObjectPool &) = delete;
+	void operator=(const ConcurrentObjectPool &) = delete;
+
+	template<typename... P>
+	T *allocate(ThreadCache &cache, P &&... p)
+	{
+		if (cache.loaded.empty())
+		{
+			if (!cache.previous.empty())
+				std::swap(cache.loaded, cache.previous);
+			else if (!refill_magazine(cache.loaded))
+				return nullptr;
+		}
+
+		T *ptr = cache.loaded.back();
+		cache.loaded.pop_back();
+		new(ptr) T(std::forward<P>(p)...);
+		return ptr;
+	}
+
+	void free(ThreadCache &cache, T *ptr)
+	{
+		ptr->~T();
+
+		if (cache.loaded.size() >= MagazineSize)
+		{
+			if (cache.previous.size() >= MagazineSize)
+			{
+				std::lock_guard<std::mutex> holder{lock};
+				return_magazine(cache.previous);
+			}
+			std::swap(cache.loaded, cache.previous);
+		}
+
+		cache.loaded.push_back(ptr);
+	}
+
+	// Hands all objects held by cache back to the depot, so other threads can allocate them.
+	void flush(ThreadCache &cache)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+		if (!cache.loaded.empty())
+			return_magazine(cache.loaded);
+		if (!cache.previous.empty())
+			return_magazine(cache.previous);
+	}
+
+private:
+	std::mutex lock;
+	std::vector<std::vector<T *>> full_magazines;
+	// Keeps the storage of exchanged magazines around, so exchanges do not allocate once the pool is warm.
+	std::vector<std::vector<T *>> empty_magazines;
+
+	struct MallocDeleter
+	{
+		void operator()(T *ptr)
+		{
+			::free(ptr);
+		}
+	};
+
+	std::vector<std::unique_ptr<T, MallocDeleter>> memory;
+	unsigned block_size = 0;
+	unsigned block_used = 0;
+
+	// Swaps magazine, which must be empty, for a magazine of free objects.
+	bool refill_magazine(std::vector<T *> &magazine)
+	{
+		std::lock_guard<std::mutex> holder{lock};
+
+		if (!full_magazines.empty())
+		{
+			magazine.swap(full_magazines.back());
+			empty_magazines.push_back(std::move(full_magazines.back()));
+			full_magazines.pop_back();
+			return true;
+		}
+
+		if (block_used == block_size)
+		{
+			unsigned num_objects = std::max(MagazineSize, 64u << memory.size());
+			T *block = static_cast<T *>(malloc(num_objects * sizeof(T)));
+			if (!block)
+				return false;
+
+			memory.emplace_back(block);
+			block_size = num_objects;
+			block_used = 0;
+		}
+
+		unsigned count = std::min(MagazineSize, block_size - block_used);
+		T *ptr = memory.back().get() + block_used;
+		block_used += count;
+
+		magazine.reserve(MagazineSize);
+		for (unsigned i = 0; i < count; i++)
+			magazine.push_back(ptr + i);
+		return true;
+	}
+
+	// Moves the objects in magazine to the depot and leaves an empty magazine behind. Lock must be held.
+	void return_magazine(std::vector<T *> &magazine)
+	{
+		if (empty_magazines.empty())
+		{
+			full_magazines.emplace_back();
+		}
+		else
+		{
+			full_magazines.push_back(std::move(empty_magazines.back()));
+			empty_magazines.pop_back();
+		}
+
+		full_magazines.back().swap(magazine);
+		magazine.clear();
+	}
 };
 }
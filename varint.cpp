@@ -21,25 +21,69 @@
  */
 
 #include "varint.hpp"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define FOSSILIZE_VARINT_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <tmmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define FOSSILIZE_VARINT_NEON 1
+#include <arm_neon.h>
+#endif
 
 namespace Fossilize
 {
+static inline unsigned leading_zeroes(uint32_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_clz(x);
+#elif defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse(&index, x);
+	return 31 - index;
+#else
+	unsigned count = 0;
+	while (!(x & 0x80000000u))
+	{
+		x <<= 1;
+		count++;
+	}
+	return count;
+#endif
+}
+
+static inline unsigned trailing_zeroes(uint64_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return index;
+#else
+	unsigned count = 0;
+	while (!(x & 1))
+	{
+		x >>= 1;
+		count++;
+	}
+	return count;
+#endif
+}
+
 size_t compute_size_varint(const uint32_t *words, size_t word_count)
 {
 	size_t size = 0;
 	for (size_t i = 0; i < word_count; i++)
 	{
-		auto w = words[i];
-		if (w < (1u << 7))
-			size += 1;
-		else if (w < (1u << 14))
-			size += 2;
-		else if (w < (1u << 21))
-			size += 3;
-		else if (w < (1u << 28))
-			size += 4;
-		else
-			size += 5;
+		// Every byte holds 7 bits, and zero still needs one byte.
+		unsigned bits = 32 - leading_zeroes(words[i] | 1u);
+		size += (bits + 6) / 7;
 	}
 	return size;
 }
@@ -81,9 +125,9 @@ uint8_t *encode_varint(uint8_t *buffer, const uint32_t *words, size_t word_count
 	return buffer;
 }
 
-bool decode_varint(uint32_t *words, size_t words_size, const uint8_t *buffer, size_t buffer_size)
+static bool decode_varint_scalar(uint32_t *words, size_t words_size, const uint8_t *buffer, size_t buffer_size,
+                                 size_t offset)
 {
-	size_t offset = 0;
 	for (size_t i = 0; i < words_size; i++)
 	{
 		auto &w = words[i];
@@ -95,11 +139,258 @@ bool decode_varint(uint32_t *words, size_t words_size, const uint8_t *buffer, si
 			if (offset >= buffer_size || shift >= 32u)
 				return false;
 
-			w |= (buffer[offset] & 0x7f) << shift;
+			w |= uint32_t(buffer[offset] & 0x7f) << shift;
 			shift += 7;
 		} while (buffer[offset++] & 0x80);
 	}
 
 	return buffer_size == offset;
 }
+
+static inline uint64_t load_u64_le(const uint8_t *buffer)
+{
+	uint64_t v;
+	memcpy(&v, buffer, sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+// Decodes the varints of one 8 byte window without branching on individual bytes.
+// Returns the number of bytes consumed, or 0 if the first varint is longer than 5 bytes.
+// 8 bytes must be readable from buffer.
+static inline size_t decode_varint_window(uint32_t *words, size_t &word_index, size_t words_size, const uint8_t *buffer)
+{
+	uint64_t v = load_u64_le(buffer);
+	uint64_t stop_bits = ~v & 0x8080808080808080ull;
+	size_t consumed = 0;
+
+	do
+	{
+		// Longer than 5 bytes, which the scalar decoder rejects as well.
+		unsigned stop_bit = stop_bits ? trailing_zeroes(stop_bits) : 64;
+		if (stop_bit > 39)
+			return consumed;
+
+		unsigned len = (stop_bit + 1) >> 3;
+		uint64_t x = v & 0x7f7f7f7f7f7f7f7full & ((uint64_t(1) << (len * 8)) - 1);
+
+		// Compact the 7-bit groups, 5 bytes at most means the result fits in the low 35 bits.
+		x = (x & 0x007f007f007f007full) | ((x & 0x7f007f007f007f00ull) >> 1);
+		x = (x & 0x00003fff00003fffull) | ((x & 0x3fff00003fff0000ull) >> 2);
+		x = (x & 0x000000000fffffffull) | ((x & 0x0fffffff00000000ull) >> 4);
+		words[word_index++] = uint32_t(x);
+
+		consumed += len;
+		v >>= len * 8;
+		stop_bits >>= len * 8;
+	} while (stop_bits && word_index < words_size);
+
+	return consumed;
+}
+
+#if defined(FOSSILIZE_VARINT_X86) || defined(FOSSILIZE_VARINT_NEON)
+// For every pattern of continuation bits in an 8 byte window, a shuffle which moves
+// up to 4 complete varints of at most 4 bytes into their own 32-bit lane.
+struct VarintShuffleTables
+{
+	uint8_t shuffle[256][16];
+	uint8_t count[256];
+	uint8_t consumed[256];
+
+	VarintShuffleTables()
+	{
+		for (unsigned mask = 0; mask < 256; mask++)
+		{
+			memset(shuffle[mask], 0x80, sizeof(shuffle[mask]));
+			unsigned pos = 0;
+			unsigned n = 0;
+
+			while (n < 4)
+			{
+				unsigned end = pos;
+				while (end < 8 && (mask & (1u << end)))
+					end++;
+				if (end >= 8 || end - pos >= 4)
+					break;
+
+				for (unsigned i = pos; i <= end; i++)
+					shuffle[mask][4 * n + (i - pos)] = uint8_t(i);
+				n++;
+				pos = end + 1;
+			}
+
+			count[mask] = uint8_t(n);
+			consumed[mask] = uint8_t(pos);
+		}
+	}
+};
+
+static const VarintShuffleTables &get_varint_shuffle_tables()
+{
+	static const VarintShuffleTables tables;
+	return tables;
+}
+#endif
+
+#if defined(FOSSILIZE_VARINT_X86)
+#ifndef _MSC_VER
+__attribute__((target("ssse3")))
+#endif
+static bool decode_varint_simd(uint32_t *words, size_t words_size, const uint8_t *buffer, size_t buffer_size,
+                               size_t &word_index, size_t &offset)
+{
+	auto &tables = get_varint_shuffle_tables();
+	const __m128i low7 = _mm_set1_epi32(0x7f7f7f7f);
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = word_index;
+	size_t off = offset;
+
+	while (off + 16 <= buffer_size && i + 16 <= words_size)
+	{
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buffer + off));
+		unsigned mask = unsigned(_mm_movemask_epi8(bytes));
+
+		// Runs of single byte varints, which is common for SPIR-V IDs and literals.
+		if (mask == 0)
+		{
+			__m128i lo = _mm_unpacklo_epi8(bytes, zero);
+			__m128i hi = _mm_unpackhi_epi8(bytes, zero);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(words + i + 0), _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(words + i + 4), _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(words + i + 8), _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(words + i + 12), _mm_unpackhi_epi16(hi, zero));
+			i += 16;
+			off += 16;
+			continue;
+		}
+
+		mask &= 0xffu;
+		unsigned count = tables.count[mask];
+		if (count == 0)
+		{
+			// 5 byte varint, or garbage.
+			size_t consumed = decode_varint_window(words, i, words_size, buffer + off);
+			if (!consumed)
+				return false;
+			off += consumed;
+			continue;
+		}
+
+		__m128i shuf = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.shuffle[mask]));
+		__m128i x = _mm_and_si128(_mm_shuffle_epi8(bytes, shuf), low7);
+		__m128i r = _mm_and_si128(x, _mm_set1_epi32(0x7f));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi32(x, 1), _mm_set1_epi32(0x3f80)));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi32(x, 2), _mm_set1_epi32(0x1fc000)));
+		r = _mm_or_si128(r, _mm_and_si128(_mm_srli_epi32(x, 3), _mm_set1_epi32(0xfe00000)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(words + i), r);
+
+		i += count;
+		off += tables.consumed[mask];
+	}
+
+	word_index = i;
+	offset = off;
+	return true;
+}
+
+static bool supports_varint_simd()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+#else
+	unsigned eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ecx & bit_SSSE3) != 0;
+#endif
+}
+#elif defined(FOSSILIZE_VARINT_NEON)
+static bool decode_varint_simd(uint32_t *words, size_t words_size, const uint8_t *buffer, size_t buffer_size,
+                               size_t &word_index, size_t &offset)
+{
+	auto &tables = get_varint_shuffle_tables();
+	static const uint8_t bit_weights[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	const uint8x8_t weights = vld1_u8(bit_weights);
+	const uint32x4_t low7 = vdupq_n_u32(0x7f7f7f7f);
+	size_t i = word_index;
+	size_t off = offset;
+
+	while (off + 16 <= buffer_size && i + 16 <= words_size)
+	{
+		uint8x16_t bytes = vld1q_u8(buffer + off);
+
+		// Runs of single byte varints, which is common for SPIR-V IDs and literals.
+		if (vmaxvq_u8(bytes) < 0x80)
+		{
+			uint16x8_t lo = vmovl_u8(vget_low_u8(bytes));
+			uint16x8_t hi = vmovl_u8(vget_high_u8(bytes));
+			vst1q_u32(words + i + 0, vmovl_u16(vget_low_u16(lo)));
+			vst1q_u32(words + i + 4, vmovl_u16(vget_high_u16(lo)));
+			vst1q_u32(words + i + 8, vmovl_u16(vget_low_u16(hi)));
+			vst1q_u32(words + i + 12, vmovl_u16(vget_high_u16(hi)));
+			i += 16;
+			off += 16;
+			continue;
+		}
+
+		unsigned mask = vaddv_u8(vmul_u8(vshr_n_u8(vget_low_u8(bytes), 7), weights));
+		unsigned count = tables.count[mask];
+		if (count == 0)
+		{
+			// 5 byte varint, or garbage.
+			size_t consumed = decode_varint_window(words, i, words_size, buffer + off);
+			if (!consumed)
+				return false;
+			off += consumed;
+			continue;
+		}
+
+		uint8x16_t shuf = vld1q_u8(tables.shuffle[mask]);
+		uint32x4_t x = vandq_u32(vreinterpretq_u32_u8(vqtbl1q_u8(bytes, shuf)), low7);
+		uint32x4_t r = vandq_u32(x, vdupq_n_u32(0x7f));
+		r = vorrq_u32(r, vandq_u32(vshrq_n_u32(x, 1), vdupq_n_u32(0x3f80)));
+		r = vorrq_u32(r, vandq_u32(vshrq_n_u32(x, 2), vdupq_n_u32(0x1fc000)));
+		r = vorrq_u32(r, vandq_u32(vshrq_n_u32(x, 3), vdupq_n_u32(0xfe00000)));
+		vst1q_u32(words + i, r);
+
+		i += count;
+		off += tables.consumed[mask];
+	}
+
+	word_index = i;
+	offset = off;
+	return true;
+}
+
+static bool supports_varint_simd()
+{
+	return true;
+}
+#endif
+
+bool decode_varint(uint32_t *words, size_t words_size, const uint8_t *buffer, size_t buffer_size)
+{
+	size_t offset = 0;
+	size_t i = 0;
+
+#if defined(FOSSILIZE_VARINT_X86) || defined(FOSSILIZE_VARINT_NEON)
+	static const bool has_simd = supports_varint_simd();
+	if (has_simd && !decode_varint_simd(words, words_size, buffer, buffer_size, i, offset))
+		return false;
+#endif
+
+	while (offset + 8 <= buffer_size && i < words_size)
+	{
+		size_t consumed = decode_varint_window(words, i, words_size, buffer + offset);
+		if (!consumed)
+			return false;
+		offset += consumed;
+	}
+
+	return decode_varint_scalar(words + i, words_size - i, buffer, buffer_size, offset);
+}
 }
@@ -0,0 +1,136 @@
+/* Copyright (c) 2019 Hans-Kristian Arntzen
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "xxhash64.hpp"
+#include <string.h>
+
+namespace Fossilize
+{
+static const uint64_t Prime1 = 0x9e3779b185ebca87ull;
+static const uint64_t Prime2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t Prime3 = 0x165667b19e3779f9ull;
+static const uint64_t Prime4 = 0x85ebca77c2b2ae63ull;
+static const uint64_t Prime5 = 0x27d4eb2f165667c5ull;
+
+static inline uint64_t rotl(uint64_t v, unsigned bits)
+{
+	return (v << bits) | (v >> (64 - bits));
+}
+
+// The hash is defined on little-endian words.
+static inline uint64_t read_u64(const uint8_t *data)
+{
+	uint64_t v;
+	memcpy(&v, data, sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint32_t read_u32(const uint8_t *data)
+{
+	uint32_t v;
+	memcpy(&v, data, sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline uint64_t mix_round(uint64_t acc, uint64_t input)
+{
+	acc += input * Prime2;
+	acc = rotl(acc, 31);
+	return acc * Prime1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t value)
+{
+	acc ^= mix_round(0, value);
+	return acc * Prime1 + Prime4;
+}
+
+uint64_t compute_xxh64(const void *data_, size_t size, uint64_t seed)
+{
+	auto *data = static_cast<const uint8_t *>(data_);
+	const uint8_t *end = data + size;
+	uint64_t h;
+
+	if (size >= 32)
+	{
+		uint64_t v0 = seed + Prime1 + Prime2;
+		uint64_t v1 = seed + Prime2;
+		uint64_t v2 = seed;
+		uint64_t v3 = seed - Prime1;
+
+		const uint8_t *limit = end - 32;
+		do
+		{
+			v0 = mix_round(v0, read_u64(data + 0));
+			v1 = mix_round(v1, read_u64(data + 8));
+			v2 = mix_round(v2, read_u64(data + 16));
+			v3 = mix_round(v3, read_u64(data + 24));
+			data += 32;
+		} while (data <= limit);
+
+		h = rotl(v0, 1) + rotl(v1, 7) + rotl(v2, 12) + rotl(v3, 18);
+		h = merge_round(h, v0);
+		h = merge_round(h, v1);
+		h = merge_round(h, v2);
+		h = merge_round(h, v3);
+	}
+	else
+		h = seed + Prime5;
+
+	h += uint64_t(size);
+
+	while (data + 8 <= end)
+	{
+		h ^= mix_round(0, read_u64(data));
+		h = rotl(h, 27) * Prime1 + Prime4;
+		data += 8;
+	}
+
+	if (data + 4 <= end)
+	{
+		h ^= uint64_t(read_u32(data)) * Prime1;
+		h = rotl(h, 23) * Prime2 + Prime3;
+		data += 4;
+	}
+
+	while (data < end)
+	{
+		h ^= uint64_t(*data) * Prime5;
+		h = rotl(h, 11) * Prime1;
+		data++;
+	}
+
+	h ^= h >> 33;
+	h *= Prime2;
+	h ^= h >> 29;
+	h *= Prime3;
+	h ^= h >> 32;
+	return h;
+}
+}